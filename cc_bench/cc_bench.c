@@ -0,0 +1,269 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Congestion control benchmark harness.
+ *
+ * Runs every registered congestion control algorithm through a matrix of
+ * simulated link conditions -- bandwidth, RTT, loss pattern, jitter and
+ * buffer depth -- using the deterministic link simulator from the test
+ * library, and emits one CSV line per run with goodput, p99 RTT and the
+ * retransmission rate. The intent is to qualify congestion control
+ * changes by diffing the CSV against a reference run, without hand
+ * writing one test per algorithm and condition.
+ *
+ * Usage: cc_bench [-q] [output.csv]
+ *   -q          quick mode, runs a reduced matrix
+ *   output.csv  defaults to standard output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "picoquictest_internal.h"
+
+#define CC_BENCH_MAX_RTT_SAMPLES 0x10000
+#define CC_BENCH_MAX_TRIALS 4000000
+
+static test_api_stream_desc_t cc_bench_scenario[] = {
+    { 4, 0, 257, 1000000 }
+};
+
+static picoquic_congestion_algorithm_t const** cc_bench_algo_list(size_t* nb_algos)
+{
+    static picoquic_congestion_algorithm_t const* algos[7];
+
+    algos[0] = picoquic_newreno_algorithm;
+    algos[1] = picoquic_cubic_algorithm;
+    algos[2] = picoquic_dcubic_algorithm;
+    algos[3] = picoquic_fastcc_algorithm;
+    algos[4] = picoquic_bbr_algorithm;
+    algos[5] = picoquic_prague_algorithm;
+    algos[6] = picoquic_bbr1_algorithm;
+    *nb_algos = sizeof(algos) / sizeof(algos[0]);
+
+    return algos;
+}
+
+static int cc_bench_cmp_uint64(const void* pa, const void* pb)
+{
+    uint64_t a = *(const uint64_t*)pa;
+    uint64_t b = *(const uint64_t*)pb;
+
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/* Run one transfer of the benchmark scenario under the specified
+ * conditions, and append the result line to F. A run that fails, e.g.
+ * because the transfer did not complete, is reported with a "fail"
+ * status so a regression does not silently drop a line from the CSV. */
+static int cc_bench_one(FILE* F, picoquic_congestion_algorithm_t const* ccalgo,
+    uint64_t mbps, uint64_t rtt_ms, uint64_t loss_pattern, uint64_t jitter_us, uint64_t buffer_us)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t data_start_time = 0;
+    uint64_t rtt_last = 0;
+    uint64_t* rtt_samples = NULL;
+    size_t nb_rtt_samples = 0;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 &&
+        (rtt_samples = (uint64_t*)malloc(sizeof(uint64_t) * CC_BENCH_MAX_RTT_SAMPLES)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
+
+        test_ctx->c_to_s_link->picosec_per_byte = 8000000ull / mbps;
+        test_ctx->s_to_c_link->picosec_per_byte = 8000000ull / mbps;
+        test_ctx->c_to_s_link->microsec_latency = rtt_ms * 500;
+        test_ctx->s_to_c_link->microsec_latency = rtt_ms * 500;
+        test_ctx->c_to_s_link->jitter = jitter_us;
+        test_ctx->s_to_c_link->jitter = jitter_us;
+        test_ctx->c_to_s_link->queue_delay_max = buffer_us;
+        test_ctx->s_to_c_link->queue_delay_max = buffer_us;
+
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, buffer_us, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, cc_bench_scenario, sizeof(cc_bench_scenario));
+    }
+
+    if (ret == 0) {
+        /* Only start dropping packets once the handshake completed */
+        loss_mask = loss_pattern;
+        data_start_time = simulated_time;
+
+        while (ret == 0 && nb_trials < CC_BENCH_MAX_TRIALS && nb_inactive < 256 &&
+            TEST_CLIENT_READY && TEST_SERVER_READY) {
+            int was_active = 0;
+            nb_trials++;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+            if (ret < 0) {
+                break;
+            }
+
+            if (was_active) {
+                nb_inactive = 0;
+            }
+            else {
+                nb_inactive++;
+            }
+
+            /* Collect one RTT sample per acknowledgement processed */
+            if (test_ctx->cnx_client->path[0]->rtt_sample != rtt_last &&
+                nb_rtt_samples < CC_BENCH_MAX_RTT_SAMPLES) {
+                rtt_last = test_ctx->cnx_client->path[0]->rtt_sample;
+                rtt_samples[nb_rtt_samples++] = rtt_last;
+            }
+
+            if (test_ctx->test_finished &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                break;
+            }
+        }
+    }
+
+    if (F != NULL && test_ctx != NULL && test_ctx->cnx_client != NULL) {
+        uint64_t duration = simulated_time - data_start_time;
+        uint64_t delivered = 0;
+        uint64_t p99_rtt = 0;
+        uint64_t packets_sent = test_ctx->cnx_client->nb_packets_sent;
+        uint64_t retransmitted = test_ctx->cnx_client->nb_retransmission_total;
+        double goodput_mbps = 0.0;
+        double retrans_rate = 0.0;
+        int is_complete = (ret == 0 && test_ctx->test_finished);
+
+        for (size_t i = 0; i < test_ctx->nb_test_streams; i++) {
+            delivered += test_ctx->test_stream[i].q_recv_nb + test_ctx->test_stream[i].r_recv_nb;
+        }
+        if (duration > 0) {
+            goodput_mbps = (8.0 * (double)delivered) / (double)duration;
+        }
+        if (nb_rtt_samples > 0) {
+            qsort(rtt_samples, nb_rtt_samples, sizeof(uint64_t), cc_bench_cmp_uint64);
+            p99_rtt = rtt_samples[(nb_rtt_samples * 99) / 100];
+        }
+        if (packets_sent > 0) {
+            retrans_rate = (double)retransmitted / (double)packets_sent;
+        }
+
+        fprintf(F, "%s,%" PRIu64 ",%" PRIu64 ",0x%" PRIx64 ",%" PRIu64 ",%" PRIu64 ",%s,%" PRIu64 ",%.3f,%" PRIu64 ",%.5f\n",
+            ccalgo->congestion_algorithm_id, mbps, rtt_ms, loss_pattern, jitter_us, buffer_us,
+            (is_complete) ? "pass" : "fail", duration, goodput_mbps, p99_rtt, retrans_rate);
+    }
+
+    if (rtt_samples != NULL) {
+        free(rtt_samples);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    FILE* F = stdout;
+    int is_quick = 0;
+    int arg_index = 1;
+    int nb_fail = 0;
+    size_t nb_algos = 0;
+    picoquic_congestion_algorithm_t const** algos = cc_bench_algo_list(&nb_algos);
+    static const uint64_t mbps_list[] = { 10, 100 };
+    static const uint64_t rtt_ms_list[] = { 10, 100 };
+    static const uint64_t loss_list[] = { 0, 1 }; /* bit mask, one bit set = 1 loss in 64 */
+    static const uint64_t jitter_list[] = { 0, 5000 };
+
+    if (arg_index < argc && strcmp(argv[arg_index], "-q") == 0) {
+        is_quick = 1;
+        arg_index++;
+    }
+
+    if (argc - arg_index > 1 || (arg_index < argc && argv[arg_index][0] == '-')) {
+        fprintf(stderr, "Usage: %s [-q] [output.csv]\n", argv[0]);
+        return -1;
+    }
+
+    if (arg_index < argc) {
+        F = picoquic_file_open(argv[arg_index], "w");
+        if (F == NULL) {
+            fprintf(stderr, "Cannot open %s\n", argv[arg_index]);
+            return -1;
+        }
+    }
+
+    fprintf(F, "algorithm,mbps,rtt_ms,loss_mask,jitter_us,buffer_us,status,duration_us,goodput_mbps,p99_rtt_us,retrans_rate\n");
+
+    for (size_t i_algo = 0; i_algo < nb_algos; i_algo++) {
+        size_t nb_mbps = (is_quick) ? 1 : sizeof(mbps_list) / sizeof(uint64_t);
+        for (size_t i_mbps = 0; i_mbps < nb_mbps; i_mbps++) {
+            size_t nb_rtt = (is_quick) ? 1 : sizeof(rtt_ms_list) / sizeof(uint64_t);
+            for (size_t i_rtt = 0; i_rtt < nb_rtt; i_rtt++) {
+                for (size_t i_loss = 0; i_loss < sizeof(loss_list) / sizeof(uint64_t); i_loss++) {
+                    size_t nb_jitter = (is_quick) ? 1 : sizeof(jitter_list) / sizeof(uint64_t);
+                    for (size_t i_jitter = 0; i_jitter < nb_jitter; i_jitter++) {
+                        /* Buffer depth: a shallow buffer of a quarter RTT,
+                         * and a deep buffer of four RTT */
+                        uint64_t rtt_us = rtt_ms_list[i_rtt] * 1000;
+                        uint64_t buffer_list[2] = { rtt_us / 4, 4 * rtt_us };
+                        size_t nb_buffer = (is_quick) ? 1 : 2;
+
+                        for (size_t i_buffer = 0; i_buffer < nb_buffer; i_buffer++) {
+                            if (cc_bench_one(F, algos[i_algo], mbps_list[i_mbps], rtt_ms_list[i_rtt],
+                                loss_list[i_loss], jitter_list[i_jitter], buffer_list[i_buffer]) != 0) {
+                                nb_fail++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (F != stdout) {
+        (void)picoquic_file_close(F);
+    }
+
+    if (nb_fail > 0) {
+        fprintf(stderr, "%d benchmark runs failed.\n", nb_fail);
+    }
+
+    return (nb_fail == 0) ? 0 : -1;
+}
@@ -0,0 +1,162 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Crypto microbenchmark. Measures sealed bytes per second and packets per
+ * second for every registered cipher suite, for each crypto provider
+ * combination that the build supports, at representative packet sizes: a
+ * 64 byte ACK, a 1252 byte full packet, and an 8192 byte GSO train. The
+ * point is to catch provider level regressions before deployment rather
+ * than after; run it on the target hardware, as the results depend on the
+ * CPU features the providers detect at run time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "picotls.h"
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_crypto_provider_api.h"
+#include "tls_api.h"
+
+#define CRYPTO_BENCH_MAX_PACKET_SIZE 8192
+#define CRYPTO_BENCH_AAD_SIZE 16
+#define CRYPTO_BENCH_TARGET_DURATION 500000 /* half a second per measurement, in microseconds */
+#define CRYPTO_BENCH_BATCH 256
+
+static const size_t crypto_bench_sizes[] = { 64, 1252, 8192 };
+static const char* crypto_bench_size_names[] = { "ack(64)", "full(1252)", "gso(8192)" };
+static const size_t crypto_bench_nb_sizes = sizeof(crypto_bench_sizes) / sizeof(size_t);
+
+typedef struct st_crypto_bench_config_t {
+    const char* name;
+    uint64_t init_flags;
+} crypto_bench_config_t;
+
+/* Provider loading follows "latest registration wins": with all providers
+ * loaded, fusion (when the CPU supports it) covers AES-GCM and OpenSSL
+ * covers ChaCha20, which is what production runs. The other rows isolate
+ * individual providers. */
+static const crypto_bench_config_t crypto_bench_configs[] = {
+    { "default", 0 },
+    { "no-fusion", TLS_API_INIT_FLAGS_NO_FUSION },
+    { "openssl", TLS_API_INIT_FLAGS_NO_FUSION | TLS_API_INIT_FLAGS_NO_MINICRYPTO | TLS_API_INIT_FLAGS_NO_MBEDTLS },
+    { "minicrypto", TLS_API_INIT_FLAGS_NO_FUSION | TLS_API_INIT_FLAGS_NO_OPENSSL | TLS_API_INIT_FLAGS_NO_MBEDTLS },
+#ifdef PICOQUIC_WITH_MBEDTLS
+    { "mbedtls", TLS_API_INIT_FLAGS_NO_FUSION | TLS_API_INIT_FLAGS_NO_OPENSSL | TLS_API_INIT_FLAGS_NO_MINICRYPTO },
+#endif
+};
+
+static const size_t crypto_bench_nb_configs = sizeof(crypto_bench_configs) / sizeof(crypto_bench_config_t);
+
+static int crypto_bench_suite(ptls_cipher_suite_t* suite, const char* config_name)
+{
+    int ret = 0;
+    uint8_t secret[PTLS_MAX_DIGEST_SIZE];
+    uint8_t plain[CRYPTO_BENCH_MAX_PACKET_SIZE];
+    uint8_t sealed[CRYPTO_BENCH_MAX_PACKET_SIZE + 64];
+    uint8_t aad[CRYPTO_BENCH_AAD_SIZE];
+    ptls_aead_context_t* aead;
+
+    memset(secret, 0x5a, sizeof(secret));
+    memset(plain, 0xa5, sizeof(plain));
+    memset(aad, 0x3c, sizeof(aad));
+
+    aead = ptls_aead_new(suite->aead, suite->hash, 1, secret, PICOQUIC_LABEL_QUIC_BASE);
+    if (aead == NULL) {
+        fprintf(stderr, "Cannot create AEAD context for %s\n", suite->aead->name);
+        ret = -1;
+    }
+    else {
+        for (size_t i_size = 0; i_size < crypto_bench_nb_sizes; i_size++) {
+            size_t length = crypto_bench_sizes[i_size];
+            uint64_t seq_num = 0;
+            uint64_t nb_packets = 0;
+            uint64_t start_time = picoquic_current_time();
+            uint64_t elapsed = 0;
+
+            while (elapsed < CRYPTO_BENCH_TARGET_DURATION) {
+                for (int i = 0; i < CRYPTO_BENCH_BATCH; i++) {
+                    (void)ptls_aead_encrypt(aead, sealed, plain, length, seq_num, aad, sizeof(aad));
+                    seq_num++;
+                }
+                nb_packets += CRYPTO_BENCH_BATCH;
+                elapsed = picoquic_current_time() - start_time;
+            }
+
+            if (elapsed > 0) {
+                double pps = ((double)nb_packets * 1000000.0) / (double)elapsed;
+                double mbytes = (pps * (double)length) / 1000000.0;
+                printf("%-12s %-24s %-12s %12.0f pkt/s %10.1f MB/s\n",
+                    config_name, suite->aead->name, crypto_bench_size_names[i_size],
+                    pps, mbytes);
+            }
+        }
+        ptls_aead_free(aead);
+    }
+
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+#else
+    (void)argc;
+    (void)argv;
+#endif
+
+    printf("%-12s %-24s %-12s %18s %16s\n",
+        "provider", "suite", "size", "packets", "throughput");
+
+    for (size_t i_config = 0; ret == 0 && i_config < crypto_bench_nb_configs; i_config++) {
+        const crypto_bench_config_t* config = &crypto_bench_configs[i_config];
+        int nb_suites = 0;
+
+        picoquic_tls_api_reset(config->init_flags);
+
+        for (int i = 0; i < PICOQUIC_CIPHER_SUITES_NB_MAX; i++) {
+            ptls_cipher_suite_t* suite = picoquic_cipher_suites[i].high_memory_suite;
+
+            if (suite != NULL) {
+                nb_suites++;
+                ret = crypto_bench_suite(suite, config->name);
+                if (ret != 0) {
+                    break;
+                }
+            }
+        }
+
+        if (nb_suites == 0) {
+            printf("%-12s (no cipher suites registered)\n", config->name);
+        }
+    }
+
+    picoquic_tls_api_unload();
+
+    return ret;
+}
@@ -20,6 +20,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
@@ -32,13 +33,141 @@
 
 static int byteread_packet_header(bytestream * s, picoquic_packet_header * ph);
 
+/* Decoding state of a v2 binlog, one entry per connection id seen in
+ * the file. The v2 format encodes event times and packet numbers as
+ * zigzag varint deltas from the previous event of the connection; the
+ * reader reconstructs the absolute values before handing each chunk to
+ * the callbacks, so the event consumers only see the v1 layout. */
+typedef struct st_binlog_v2_state_t {
+    picoquic_connection_id_t cid;
+    uint64_t time_prev;
+    uint64_t pn_prev[2]; /* sent then received */
+} binlog_v2_state_t;
+
+static uint64_t binlog_unzigzag(uint64_t encoded, uint64_t previous)
+{
+    int64_t delta = (int64_t)((encoded >> 1) ^ (~(encoded & 1) + 1));
+
+    return previous + (uint64_t)delta;
+}
+
+static binlog_v2_state_t* binlog_v2_state_find(binlog_v2_state_t** p_states, size_t* p_nb_states,
+    const picoquic_connection_id_t* cid, uint64_t log_time)
+{
+    binlog_v2_state_t* state = NULL;
+
+    for (size_t i = 0; i < *p_nb_states; i++) {
+        if (picoquic_compare_connection_id(&(*p_states)[i].cid, cid) == 0) {
+            state = &(*p_states)[i];
+            break;
+        }
+    }
+
+    if (state == NULL) {
+        binlog_v2_state_t* states = (binlog_v2_state_t*)realloc(*p_states,
+            (*p_nb_states + 1) * sizeof(binlog_v2_state_t));
+
+        if (states != NULL) {
+            *p_states = states;
+            state = &states[*p_nb_states];
+            *p_nb_states += 1;
+            memset(state, 0, sizeof(binlog_v2_state_t));
+            state->cid = *cid;
+            state->time_prev = log_time;
+        }
+    }
+
+    return state;
+}
+
+/* Rewrite one v2 chunk as its v1 equivalent, replacing the delta
+ * encoded fields by absolute values. */
+static int binlog_v2_undelta(bytestream* s, bytestream* out,
+    binlog_v2_state_t** p_states, size_t* p_nb_states, uint64_t log_time)
+{
+    int ret = 0;
+    picoquic_connection_id_t cid;
+    uint64_t time_delta = 0;
+    uint64_t path_id = 0;
+    uint64_t event_type = 0;
+    binlog_v2_state_t* state = NULL;
+
+    ret |= byteread_cid(s, &cid);
+    ret |= byteread_vint(s, &time_delta);
+    ret |= byteread_vint(s, &path_id);
+    ret |= byteread_vint(s, &event_type);
+
+    if (ret == 0 && (state = binlog_v2_state_find(p_states, p_nb_states, &cid, log_time)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        state->time_prev = binlog_unzigzag(time_delta, state->time_prev);
+        ret |= bytewrite_cid(out, &cid);
+        ret |= bytewrite_vint(out, state->time_prev);
+        ret |= bytewrite_vint(out, path_id);
+        ret |= bytewrite_vint(out, event_type);
+    }
+
+    if (ret == 0 &&
+        (event_type == picoquic_log_event_packet_sent || event_type == picoquic_log_event_packet_recv)) {
+        int receiving = (event_type == picoquic_log_event_packet_recv);
+        uint64_t packet_length = 0;
+        uint8_t header_flags = 0;
+        uint64_t payload_length = 0;
+        uint64_t ptype = 0;
+        uint64_t pn_delta = 0;
+
+        ret |= byteread_vint(s, &packet_length);
+        ret |= byteread_int8(s, &header_flags);
+        ret |= byteread_vint(s, &payload_length);
+        ret |= byteread_vint(s, &ptype);
+        ret |= byteread_vint(s, &pn_delta);
+
+        if (ret == 0) {
+            state->pn_prev[receiving] = binlog_unzigzag(pn_delta, state->pn_prev[receiving]);
+            ret |= bytewrite_vint(out, packet_length);
+            ret |= bytewrite_int8(out, header_flags);
+            ret |= bytewrite_vint(out, payload_length);
+            ret |= bytewrite_vint(out, ptype);
+            ret |= bytewrite_vint(out, state->pn_prev[receiving]);
+        }
+    }
+
+    if (ret == 0) {
+        ret |= bytewrite_buffer(out, s->data + s->ptr, bytestream_remain(s));
+    }
+
+    return ret;
+}
+
 int fileread_binlog(FILE* bin_log, int(*cb)(bytestream*, void*), void* cbptr)
 {
     int ret = 0;
     uint8_t head[4];
     bytestream_buf stream_msg;
+    bytestream_buf stream_v1;
+    uint16_t version = 0;
+    uint64_t log_time = 0;
+    binlog_v2_state_t* states = NULL;
+    size_t nb_states = 0;
+
+    /* Read the file header to learn the format version */
+    fseek(bin_log, 0, SEEK_SET);
+    {
+        bytestream_buf stream_head;
+        bytestream* ps = bytestream_buf_init(&stream_head, 16);
+        uint32_t fcc = 0;
+        uint16_t flags = 0;
 
-    fseek(bin_log, 16, SEEK_SET);
+        if (fread(stream_head.buf, bytestream_size(ps), 1, bin_log) <= 0 ||
+            byteread_int32(ps, &fcc) != 0 ||
+            byteread_int16(ps, &flags) != 0 ||
+            byteread_int16(ps, &version) != 0 ||
+            byteread_int64(ps, &log_time) != 0) {
+            ret = -1;
+        }
+    }
 
     while (ret == 0 && fread(head, sizeof(head), 1, bin_log) > 0) {
 
@@ -53,10 +182,21 @@ int fileread_binlog(FILE* bin_log, int(*cb)(bytestream*, void*), void* cbptr)
 
         if (ret == 0) {
             bytestream* s = bytestream_buf_init(&stream_msg, len);
-            ret |= cb(s, cbptr);
+
+            if (version >= 0x02) {
+                bytestream* out = bytestream_buf_init(&stream_v1, sizeof(stream_v1.buf));
+
+                ret = binlog_v2_undelta(s, out, &states, &nb_states, log_time);
+                s = bytestream_buf_init(&stream_v1, bytestream_length(out));
+            }
+            if (ret == 0) {
+                ret |= cb(s, cbptr);
+            }
         }
     }
 
+    free(states);
+
     return ret;
 }
 
@@ -321,7 +461,7 @@ FILE * picoquic_open_cc_log_file_for_read(char const * bin_cc_log_name, uint16_t
             ret = -1;
             DBG_PRINTF("Header for file %s does include flags.\n", bin_cc_log_name);
         }
-        else if (byteread_int16(ps, &version) != 0 || version != 0x01) {
+        else if (byteread_int16(ps, &version) != 0 || (version != 0x01 && version != 0x02)) {
             ret = -1;
             DBG_PRINTF("Header for file %s requires unsupported version.\n", bin_cc_log_name);
         }
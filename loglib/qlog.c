@@ -29,6 +29,10 @@
 #include "logreader.h"
 #include "logconvert.h"
 
+/* Size of the stdio buffer attached to the output file, a multiple of
+ * common file system block sizes. */
+#define QLOG_WRITE_BUFFER_SIZE 0x10000
+
 typedef struct qlog_context_st {
 
     FILE * f_txtlog;      /*!< The file handle of the opened output file. */
@@ -63,50 +67,81 @@ typedef struct qlog_context_st {
     int state;
 } qlog_context_t;
 
+static char const qlog_hex[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+/* The string serializers below run for every CID, token and frame blob
+ * of the trace, so they build the escaped text in a stack buffer and
+ * hand complete chunks to stdio instead of calling printf per byte. */
 int qlog_string(FILE* f, bytestream* s, uint64_t l)
 {
+    char buf[256];
+    size_t nb_chars = 0;
     uint64_t x;
     int error_found = (s->ptr + (size_t)l > s->size);
 
-    fprintf(f, "\"");
+    buf[nb_chars++] = '"';
 
     for (x = 0; x < l && s->ptr < s->size; x++) {
-        fprintf(f, "%02x", s->data[s->ptr++]);
+        uint8_t b = s->data[s->ptr++];
+
+        if (nb_chars + 2 > sizeof(buf)) {
+            (void)fwrite(buf, 1, nb_chars, f);
+            nb_chars = 0;
+        }
+        buf[nb_chars++] = qlog_hex[b >> 4];
+        buf[nb_chars++] = qlog_hex[b & 0x0F];
     }
 
     if (error_found) {
-        fprintf(f, "... coding error!");
+        (void)fwrite(buf, 1, nb_chars, f);
+        nb_chars = 0;
+        fputs("... coding error!", f);
     }
 
-    fprintf(f, "\"");
+    buf[nb_chars++] = '"';
+    (void)fwrite(buf, 1, nb_chars, f);
     return (error_found) ? -1 : 0;
 }
 
 int qlog_chars(FILE* f, bytestream* s, uint64_t l)
 {
+    char buf[256];
+    size_t nb_chars = 0;
     uint64_t x;
     int error_found = (s->ptr + (size_t)l > s->size);
 
-    fprintf(f, "\"");
+    buf[nb_chars++] = '"';
 
     for (x = 0; x < l && s->ptr < s->size; x++) {
         int c = s->data[s->ptr++];
+
+        if (nb_chars + 3 > sizeof(buf)) {
+            (void)fwrite(buf, 1, nb_chars, f);
+            nb_chars = 0;
+        }
         if (c == '"' || c == '\\') {
-            fprintf(f, "\\%c", c);
+            buf[nb_chars++] = '\\';
+            buf[nb_chars++] = (char)c;
         }
         else if (c >= ' ' && c < 127) {
-            fprintf(f, "%c", c);
+            buf[nb_chars++] = (char)c;
         }
         else {
-            fprintf(f, "\\%02x", c);
+            buf[nb_chars++] = '\\';
+            buf[nb_chars++] = qlog_hex[(c >> 4) & 0x0F];
+            buf[nb_chars++] = qlog_hex[c & 0x0F];
         }
     }
 
     if (error_found) {
-        fprintf(f, "... coding error!");
+        (void)fwrite(buf, 1, nb_chars, f);
+        nb_chars = 0;
+        fputs("... coding error!", f);
     }
 
-    fprintf(f, "\"");
+    buf[nb_chars++] = '"';
+    (void)fwrite(buf, 1, nb_chars, f);
     return (error_found) ? -1 : 0;
 }
 
@@ -1587,6 +1622,7 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
 {
     int ret = 0;
     FILE* f_txtlog = NULL;
+    char* out_buffer = NULL;
     char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
 
     if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), cid) != 0) {
@@ -1607,6 +1643,16 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
 
         qlog_context_t qlog;
 
+        /* The converter emits many small writes; a block sized stdio
+         * buffer turns them into full block writes to the file system.
+         * Best effort: on allocation failure the default buffer is used. */
+        out_buffer = (char*)malloc(QLOG_WRITE_BUFFER_SIZE);
+        if (out_buffer != NULL &&
+            setvbuf(f_txtlog, out_buffer, _IOFBF, QLOG_WRITE_BUFFER_SIZE) != 0) {
+            free(out_buffer);
+            out_buffer = NULL;
+        }
+
         memset(&qlog, 0, sizeof(qlog_context_t));
 
         qlog.f_txtlog = f_txtlog;
@@ -1639,6 +1685,7 @@ int qlog_convert(const picoquic_connection_id_t* cid, FILE* f_binlog, const char
         }
 
         picoquic_file_close(f_txtlog);
+        free(out_buffer);
     }
 
     return ret;
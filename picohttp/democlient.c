@@ -1044,3 +1044,272 @@ int demo_client_parse_scenario_desc(char const * text, size_t * nb_streams, pico
 
     return ret;
 }
+
+/* Client connection pool.
+ *
+ * Each pooled connection owns a copy of the stream descriptions that
+ * were submitted for its origin, so the demo callback context can keep
+ * pointing at them while the pool grows. The queued entries are opened
+ * directly, outside of the "previous stream finished" chaining used by
+ * scripted scenarios, so requests submitted at different times can be
+ * pipelined on the same connection.
+ */
+
+void picoquic_demo_client_pool_init(picoquic_demo_client_pool_t* pool, picoquic_quic_t* quic,
+    char const* alpn, uint32_t proposed_version, char const* out_dir, int no_disk)
+{
+    memset(pool, 0, sizeof(picoquic_demo_client_pool_t));
+    pool->quic = quic;
+    pool->alpn = alpn;
+    pool->proposed_version = proposed_version;
+    pool->out_dir = out_dir;
+    pool->no_disk = no_disk;
+}
+
+static int picoquic_demo_client_pool_cnx_is_live(picoquic_demo_client_pool_cnx_t* pool_cnx)
+{
+    return (pool_cnx->cnx != NULL &&
+        !pool_cnx->callback_ctx.connection_closed &&
+        picoquic_get_cnx_state(pool_cnx->cnx) < picoquic_state_disconnecting);
+}
+
+static picoquic_demo_client_pool_cnx_t* picoquic_demo_client_pool_find(
+    picoquic_demo_client_pool_t* pool, char const* sni, struct sockaddr* server_address)
+{
+    picoquic_demo_client_pool_cnx_t* pool_cnx = pool->first_cnx;
+
+    while (pool_cnx != NULL) {
+        if (picoquic_demo_client_pool_cnx_is_live(pool_cnx) &&
+            picoquic_compare_addr((struct sockaddr*)&pool_cnx->server_address, server_address) == 0 &&
+            ((sni == NULL && pool_cnx->sni == NULL) ||
+                (sni != NULL && pool_cnx->sni != NULL && strcmp(sni, pool_cnx->sni) == 0))) {
+            break;
+        }
+        pool_cnx = pool_cnx->next_cnx;
+    }
+
+    return pool_cnx;
+}
+
+static picoquic_demo_client_pool_cnx_t* picoquic_demo_client_pool_cnx_create(
+    picoquic_demo_client_pool_t* pool, char const* sni, struct sockaddr* server_address,
+    uint64_t current_time)
+{
+    picoquic_demo_client_pool_cnx_t* pool_cnx = (picoquic_demo_client_pool_cnx_t*)
+        malloc(sizeof(picoquic_demo_client_pool_cnx_t));
+
+    if (pool_cnx != NULL) {
+        char const* alpn = pool->alpn;
+        uint32_t proposed_version = pool->proposed_version;
+        char const* ticket_alpn;
+        uint32_t ticket_version;
+
+        memset(pool_cnx, 0, sizeof(picoquic_demo_client_pool_cnx_t));
+        picoquic_store_addr(&pool_cnx->server_address, server_address);
+        if (sni != NULL &&
+            (pool_cnx->sni = picoquic_string_duplicate(sni)) == NULL) {
+            free(pool_cnx);
+            return NULL;
+        }
+
+        /* 0-RTT first: when a resumption ticket is stored for the
+         * origin, take the ALPN and version from the ticket. */
+        if (picoquic_demo_client_get_alpn_and_version_from_tickets(pool->quic, sni, alpn,
+            proposed_version, &ticket_alpn, &ticket_version) == 0) {
+            if (ticket_alpn != NULL) {
+                alpn = ticket_alpn;
+            }
+            if (ticket_version != 0) {
+                proposed_version = ticket_version;
+            }
+        }
+
+        (void)picoquic_demo_client_initialize_context(&pool_cnx->callback_ctx,
+            pool_cnx->queued_streams, 0, alpn, pool->no_disk, 0);
+        pool_cnx->callback_ctx.out_dir = pool->out_dir;
+
+        pool_cnx->cnx = picoquic_create_cnx(pool->quic, picoquic_null_connection_id,
+            picoquic_null_connection_id, server_address, current_time,
+            proposed_version, sni, alpn, 1);
+        if (pool_cnx->cnx == NULL) {
+            free(pool_cnx->sni);
+            free(pool_cnx);
+            return NULL;
+        }
+        picoquic_set_callback(pool_cnx->cnx, picoquic_demo_client_callback, &pool_cnx->callback_ctx);
+        if (picoquic_start_client_cnx(pool_cnx->cnx) != 0) {
+            picoquic_delete_cnx(pool_cnx->cnx);
+            free(pool_cnx->sni);
+            free(pool_cnx);
+            return NULL;
+        }
+
+        pool_cnx->next_cnx = pool->first_cnx;
+        pool->first_cnx = pool_cnx;
+    }
+
+    return pool_cnx;
+}
+
+static void picoquic_demo_client_pool_cnx_retire(picoquic_demo_client_pool_cnx_t* pool_cnx)
+{
+    if (pool_cnx->cnx != NULL) {
+        picoquic_set_callback(pool_cnx->cnx, NULL, NULL);
+        pool_cnx->cnx = NULL;
+    }
+}
+
+/* Open the requests queued on a pooled connection, as soon as either
+ * 0-RTT data can be sent or the handshake has completed. */
+static int picoquic_demo_client_pool_cnx_start(picoquic_demo_client_pool_cnx_t* pool_cnx)
+{
+    int ret = 0;
+
+    if (pool_cnx->callback_ctx.connection_closed) {
+        picoquic_demo_client_pool_cnx_retire(pool_cnx);
+    }
+    else if (pool_cnx->cnx != NULL &&
+        pool_cnx->nb_started_streams < pool_cnx->nb_queued_streams &&
+        (pool_cnx->callback_ctx.connection_ready || picoquic_is_0rtt_available(pool_cnx->cnx))) {
+        if (!pool_cnx->callback_ctx.connection_ready) {
+            pool_cnx->zero_rtt_attempted = 1;
+        }
+        if (pool_cnx->callback_ctx.alpn == picoquic_alpn_http_3 &&
+            !pool_cnx->is_h3_initialized) {
+            ret = h3zero_protocol_init(pool_cnx->cnx);
+            pool_cnx->is_h3_initialized = 1;
+        }
+        while (ret == 0 && pool_cnx->nb_started_streams < pool_cnx->nb_queued_streams) {
+            picoquic_demo_stream_desc_t* stream_desc =
+                &pool_cnx->queued_streams[pool_cnx->nb_started_streams];
+            ret = picoquic_demo_client_open_stream(pool_cnx->cnx, &pool_cnx->callback_ctx,
+                stream_desc->stream_id, stream_desc->doc_name, stream_desc->f_name,
+                stream_desc->range, stream_desc->post_size, 0);
+            pool_cnx->nb_started_streams++;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_demo_client_pool_submit(picoquic_demo_client_pool_t* pool,
+    char const* sni, struct sockaddr* server_address,
+    char const* doc_name, uint64_t post_size, uint64_t current_time)
+{
+    int ret = 0;
+    picoquic_demo_client_pool_cnx_t* pool_cnx =
+        picoquic_demo_client_pool_find(pool, sni, server_address);
+
+    if (pool_cnx == NULL) {
+        pool_cnx = picoquic_demo_client_pool_cnx_create(pool, sni, server_address, current_time);
+        if (pool_cnx == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && pool_cnx->nb_queued_streams >= pool_cnx->nb_alloc_streams) {
+        size_t new_alloc = (pool_cnx->nb_alloc_streams == 0) ? 4 : 2 * pool_cnx->nb_alloc_streams;
+        picoquic_demo_stream_desc_t* new_streams = (picoquic_demo_stream_desc_t*)
+            realloc(pool_cnx->queued_streams, new_alloc * sizeof(picoquic_demo_stream_desc_t));
+
+        if (new_streams == NULL) {
+            ret = -1;
+        }
+        else {
+            pool_cnx->queued_streams = new_streams;
+            pool_cnx->nb_alloc_streams = new_alloc;
+            pool_cnx->callback_ctx.demo_stream = new_streams;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_demo_stream_desc_t* stream_desc =
+            &pool_cnx->queued_streams[pool_cnx->nb_queued_streams];
+        char* doc_copy = picoquic_string_duplicate(doc_name);
+        char* f_name = (doc_copy == NULL) ? NULL : (char*)malloc(strlen(doc_copy) + 1);
+
+        if (doc_copy == NULL || f_name == NULL) {
+            free(doc_copy);
+            free(f_name);
+            ret = -1;
+        }
+        else {
+            /* Derive the file name from the document name, with the
+             * same sanitization as the scenario parser. */
+            size_t l_path = strlen(doc_copy);
+            for (size_t i = 0; i < l_path; i++) {
+                f_name[i] = (doc_copy[i] == '/') ? '_' : doc_copy[i];
+            }
+            f_name[l_path] = 0;
+
+            memset(stream_desc, 0, sizeof(picoquic_demo_stream_desc_t));
+            stream_desc->stream_id = pool_cnx->next_stream_id;
+            stream_desc->previous_stream_id = PICOQUIC_DEMO_STREAM_ID_INITIAL;
+            stream_desc->doc_name = doc_copy;
+            stream_desc->f_name = f_name;
+            stream_desc->post_size = post_size;
+            pool_cnx->next_stream_id += 4;
+            pool_cnx->nb_queued_streams++;
+            pool_cnx->callback_ctx.nb_demo_streams = pool_cnx->nb_queued_streams;
+
+            ret = picoquic_demo_client_pool_cnx_start(pool_cnx);
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_demo_client_pool_start_queued(picoquic_demo_client_pool_t* pool)
+{
+    int ret = 0;
+    picoquic_demo_client_pool_cnx_t* pool_cnx = pool->first_cnx;
+
+    while (pool_cnx != NULL) {
+        int cnx_ret = picoquic_demo_client_pool_cnx_start(pool_cnx);
+
+        if (ret == 0) {
+            ret = cnx_ret;
+        }
+        pool_cnx = pool_cnx->next_cnx;
+    }
+
+    return ret;
+}
+
+int picoquic_demo_client_pool_is_idle(picoquic_demo_client_pool_t* pool)
+{
+    int is_idle = 1;
+    picoquic_demo_client_pool_cnx_t* pool_cnx = pool->first_cnx;
+
+    while (is_idle && pool_cnx != NULL) {
+        if (picoquic_demo_client_pool_cnx_is_live(pool_cnx) &&
+            (pool_cnx->callback_ctx.nb_open_streams > 0 ||
+                pool_cnx->nb_started_streams < pool_cnx->nb_queued_streams)) {
+            is_idle = 0;
+        }
+        pool_cnx = pool_cnx->next_cnx;
+    }
+
+    return is_idle;
+}
+
+void picoquic_demo_client_pool_release(picoquic_demo_client_pool_t* pool)
+{
+    picoquic_demo_client_pool_cnx_t* pool_cnx;
+
+    while ((pool_cnx = pool->first_cnx) != NULL) {
+        pool->first_cnx = pool_cnx->next_cnx;
+
+        picoquic_demo_client_pool_cnx_retire(pool_cnx);
+        picoquic_demo_client_delete_context(&pool_cnx->callback_ctx);
+        for (size_t i = 0; i < pool_cnx->nb_queued_streams; i++) {
+            free((char*)pool_cnx->queued_streams[i].doc_name);
+            if (pool_cnx->queued_streams[i].f_name != pool_cnx->queued_streams[i].doc_name) {
+                free((char*)pool_cnx->queued_streams[i].f_name);
+            }
+        }
+        free(pool_cnx->queued_streams);
+        free(pool_cnx->sni);
+        free(pool_cnx);
+    }
+}
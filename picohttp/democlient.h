@@ -122,6 +122,56 @@ void picoquic_demo_client_delete_context(picoquic_demo_callback_ctx_t* ctx);
 int demo_client_parse_scenario_desc(char const * text, size_t * nb_streams, picoquic_demo_stream_desc_t ** desc);
 void demo_client_delete_scenario_desc(size_t nb_streams, picoquic_demo_stream_desc_t * desc);
 
+/* Client connection pool.
+ *
+ * The pool keeps one persistent connection per origin, identified by
+ * the SNI and the server address. Requests submitted to the pool are
+ * routed to the live connection for their origin if there is one, and
+ * pipelined on it; otherwise a new connection is created. When the
+ * ticket store holds a resumption ticket for the origin, the ALPN and
+ * version are taken from the ticket and the queued requests are sent
+ * as 0-RTT data together with the first flight, instead of waiting
+ * for the handshake to complete.
+ *
+ * The application calls picoquic_demo_client_pool_start_queued() from
+ * its event loop, e.g. after each receive, to start the requests that
+ * were queued while a connection was still completing its handshake,
+ * and to retire connections that the peer closed.
+ */
+
+typedef struct st_picoquic_demo_client_pool_cnx_t {
+    struct st_picoquic_demo_client_pool_cnx_t* next_cnx;
+    picoquic_cnx_t* cnx;
+    picoquic_demo_callback_ctx_t callback_ctx;
+    struct sockaddr_storage server_address;
+    char* sni;
+    picoquic_demo_stream_desc_t* queued_streams;
+    size_t nb_queued_streams;
+    size_t nb_alloc_streams;
+    size_t nb_started_streams;
+    uint64_t next_stream_id;
+    unsigned int is_h3_initialized : 1;
+    unsigned int zero_rtt_attempted : 1;
+} picoquic_demo_client_pool_cnx_t;
+
+typedef struct st_picoquic_demo_client_pool_t {
+    picoquic_quic_t* quic;
+    picoquic_demo_client_pool_cnx_t* first_cnx;
+    char const* alpn;
+    char const* out_dir;
+    uint32_t proposed_version;
+    int no_disk;
+} picoquic_demo_client_pool_t;
+
+void picoquic_demo_client_pool_init(picoquic_demo_client_pool_t* pool, picoquic_quic_t* quic,
+    char const* alpn, uint32_t proposed_version, char const* out_dir, int no_disk);
+int picoquic_demo_client_pool_submit(picoquic_demo_client_pool_t* pool,
+    char const* sni, struct sockaddr* server_address,
+    char const* doc_name, uint64_t post_size, uint64_t current_time);
+int picoquic_demo_client_pool_start_queued(picoquic_demo_client_pool_t* pool);
+int picoquic_demo_client_pool_is_idle(picoquic_demo_client_pool_t* pool);
+void picoquic_demo_client_pool_release(picoquic_demo_client_pool_t* pool);
+
 #ifdef __cplusplus
 }
 #endif
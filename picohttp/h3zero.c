@@ -273,6 +273,378 @@ h3zero_qpack_static_t qpack_static[] = {
 
 size_t h3zero_qpack_nb_static = sizeof(qpack_static) / sizeof(h3zero_qpack_static_t);
 
+/* Canonical header names, in the order of http_header_enum_t. These
+* are needed when the peer's encoder inserts a dynamic table entry by
+* reference to a static table name: the entry size rules of RFC 9204
+* count the length of the name, and the static table above only
+* documents the header type. */
+static char const* http_header_name[] = {
+    NULL, /* http_header_unknown */
+    ":authority",
+    ":path",
+    "age",
+    "content-disposition",
+    "content-length",
+    "cookie",
+    "date",
+    "etag",
+    "if-modified-since",
+    "if-none-match",
+    "last-modified",
+    "link",
+    "location",
+    "referer",
+    "set-cookie",
+    ":method",
+    ":scheme",
+    ":status",
+    ":protocol",
+    "accept",
+    "accept-encoding",
+    "accept-ranges",
+    "access-control-allow-headers",
+    "access-control-allow-origin",
+    "cache-control",
+    "content-encoding",
+    "content-type",
+    "range",
+    "strict-transport-security",
+    "vary",
+    "x-content-type-options",
+    "x-xss-protection",
+    "accept-language",
+    "access-control-allow-credentials",
+    "access-control-allow-methods",
+    "access-control-expose-headers",
+    "access-control-request-headers",
+    "access-control-request-method",
+    "alt-svc",
+    "authorization",
+    "content-security-policy",
+    "early-data",
+    "expect-ct",
+    "forwarded",
+    "if-range",
+    "origin",
+    "purpose",
+    "server",
+    "timing-allow-origin",
+    "upgrade-insecure-requests",
+    "user-agent",
+    "x-forwarded-for",
+    "x-frame-options",
+    "priority"
+};
+
+char const* h3zero_qpack_header_name(http_header_enum_t header)
+{
+    char const* name = NULL;
+
+    if ((size_t)header < sizeof(http_header_name) / sizeof(char const*)) {
+        name = http_header_name[header];
+    }
+
+    return name;
+}
+
+/* QPACK dynamic table, RFC 9204. See the description in h3zero.h. */
+
+int h3zero_get_interesting_header_type(uint8_t* name, size_t name_length, int is_huffman);
+
+void h3zero_qpack_dyntable_init(h3zero_qpack_dyntable_t* table, uint64_t max_capacity)
+{
+    memset(table, 0, sizeof(h3zero_qpack_dyntable_t));
+    table->max_capacity = max_capacity;
+}
+
+static void h3zero_qpack_dyntable_entry_clear(h3zero_qpack_dyntable_entry_t* entry)
+{
+    if (entry->name != NULL) {
+        free(entry->name);
+    }
+    if (entry->value != NULL) {
+        free(entry->value);
+    }
+    memset(entry, 0, sizeof(h3zero_qpack_dyntable_entry_t));
+}
+
+void h3zero_qpack_dyntable_release(h3zero_qpack_dyntable_t* table)
+{
+    if (table->entries != NULL) {
+        for (uint64_t abs_index = table->dropped_count; abs_index < table->insert_count; abs_index++) {
+            h3zero_qpack_dyntable_entry_clear(&table->entries[abs_index % table->nb_entries_alloc]);
+        }
+        free(table->entries);
+    }
+    memset(table, 0, sizeof(h3zero_qpack_dyntable_t));
+}
+
+h3zero_qpack_dyntable_entry_t* h3zero_qpack_dyntable_get(h3zero_qpack_dyntable_t* table, uint64_t abs_index)
+{
+    h3zero_qpack_dyntable_entry_t* entry = NULL;
+
+    if (table != NULL && abs_index >= table->dropped_count && abs_index < table->insert_count) {
+        entry = &table->entries[abs_index % table->nb_entries_alloc];
+    }
+
+    return entry;
+}
+
+/* Evict the oldest entries until the required number of bytes fits
+* within the table capacity, as specified in section 3.2.2 of RFC
+* 9204. The peer's encoder runs the same computation, so both ends
+* agree on which entries are present. */
+static void h3zero_qpack_dyntable_evict(h3zero_qpack_dyntable_t* table, uint64_t required_bytes)
+{
+    while (table->used_bytes + required_bytes > table->capacity &&
+        table->dropped_count < table->insert_count) {
+        h3zero_qpack_dyntable_entry_t* entry = &table->entries[table->dropped_count % table->nb_entries_alloc];
+
+        table->used_bytes -= entry->name_length + entry->value_length + 32;
+        h3zero_qpack_dyntable_entry_clear(entry);
+        table->dropped_count++;
+    }
+}
+
+int h3zero_qpack_dyntable_set_capacity(h3zero_qpack_dyntable_t* table, uint64_t capacity)
+{
+    int ret = 0;
+
+    if (capacity > table->max_capacity) {
+        ret = -1;
+    }
+    else {
+        table->capacity = capacity;
+        h3zero_qpack_dyntable_evict(table, 0);
+    }
+
+    return ret;
+}
+
+int h3zero_qpack_dyntable_insert(h3zero_qpack_dyntable_t* table, http_header_enum_t header,
+    const uint8_t* name, size_t name_length, const uint8_t* value, size_t value_length)
+{
+    int ret = 0;
+    uint64_t required_bytes = name_length + value_length + 32;
+
+    if (required_bytes > table->capacity) {
+        /* an entry larger than the table capacity is an encoder error */
+        ret = -1;
+    }
+    else {
+        h3zero_qpack_dyntable_evict(table, required_bytes);
+
+        if (table->insert_count - table->dropped_count >= table->nb_entries_alloc) {
+            /* Grow the ring, re-placing the live entries at their new position */
+            size_t new_alloc = (table->nb_entries_alloc == 0) ? 8 : 2 * table->nb_entries_alloc;
+            h3zero_qpack_dyntable_entry_t* new_entries = (h3zero_qpack_dyntable_entry_t*)
+                malloc(new_alloc * sizeof(h3zero_qpack_dyntable_entry_t));
+
+            if (new_entries == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(new_entries, 0, new_alloc * sizeof(h3zero_qpack_dyntable_entry_t));
+                for (uint64_t abs_index = table->dropped_count; abs_index < table->insert_count; abs_index++) {
+                    new_entries[abs_index % new_alloc] = table->entries[abs_index % table->nb_entries_alloc];
+                }
+                free(table->entries);
+                table->entries = new_entries;
+                table->nb_entries_alloc = new_alloc;
+            }
+        }
+
+        if (ret == 0) {
+            h3zero_qpack_dyntable_entry_t* entry = &table->entries[table->insert_count % table->nb_entries_alloc];
+
+            entry->name = (uint8_t*)malloc(name_length + 1);
+            entry->value = (uint8_t*)malloc(value_length + 1);
+            if (entry->name == NULL || entry->value == NULL) {
+                h3zero_qpack_dyntable_entry_clear(entry);
+                ret = -1;
+            }
+            else {
+                memcpy(entry->name, name, name_length);
+                entry->name[name_length] = 0;
+                entry->name_length = name_length;
+                memcpy(entry->value, value, value_length);
+                entry->value[value_length] = 0;
+                entry->value_length = value_length;
+                entry->header = header;
+                table->used_bytes += required_bytes;
+                table->insert_count++;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Read a length prefixed string, with the huffman bit just above the
+* length prefix, as used in the QPACK encoder instructions. Returns
+* NULL if the string does not fit in the available bytes, with
+* *is_error set if the string is malformed rather than merely
+* incomplete. */
+#define H3ZERO_QPACK_NAME_MAX 256
+#define H3ZERO_QPACK_VALUE_MAX 2048
+
+static uint8_t* h3zero_qpack_string_decode(uint8_t* bytes, uint8_t* bytes_max, uint8_t mask,
+    uint8_t* decoded, size_t decoded_max, size_t* decoded_length, int* is_error)
+{
+    uint64_t length = 0;
+    int is_huffman;
+
+    *decoded_length = 0;
+    if (bytes == NULL || bytes >= bytes_max) {
+        return NULL;
+    }
+    is_huffman = (bytes[0] & (mask + 1)) != 0;
+    bytes = h3zero_qpack_int_decode(bytes, bytes_max, mask, &length);
+    if (bytes == NULL || length > (uint64_t)(bytes_max - bytes)) {
+        /* incomplete */
+        bytes = NULL;
+    }
+    else if (is_huffman) {
+        if (hzero_qpack_huffman_decode(bytes, bytes + length, decoded, decoded_max, decoded_length) != 0) {
+            *is_error = 1;
+            bytes = NULL;
+        }
+        else {
+            bytes += length;
+        }
+    }
+    else if (length > decoded_max) {
+        *is_error = 1;
+        bytes = NULL;
+    }
+    else {
+        memcpy(decoded, bytes, (size_t)length);
+        *decoded_length = (size_t)length;
+        bytes += length;
+    }
+
+    return bytes;
+}
+
+uint8_t* h3zero_parse_qpack_encoder_stream(uint8_t* bytes, uint8_t* bytes_max,
+    h3zero_qpack_dyntable_t* table, uint64_t* error_found)
+{
+    while (bytes != NULL && bytes < bytes_max) {
+        uint8_t* instruction = bytes;
+        int is_error = 0;
+        uint8_t name_buf[H3ZERO_QPACK_NAME_MAX];
+        uint8_t value_buf[H3ZERO_QPACK_VALUE_MAX];
+        size_t name_length = 0;
+        size_t value_length = 0;
+        http_header_enum_t header = http_header_unknown;
+
+        if ((bytes[0] & 0x80) == 0x80) {
+            /* Insert with name reference */
+            int is_static = (bytes[0] & 0x40) != 0;
+            uint64_t n_index = 0;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x3F, &n_index);
+            if (bytes != NULL) {
+                if (is_static) {
+                    char const* s_name;
+
+                    if (n_index >= h3zero_qpack_nb_static ||
+                        (s_name = h3zero_qpack_header_name(qpack_static[n_index].header)) == NULL) {
+                        is_error = 1;
+                    }
+                    else {
+                        header = qpack_static[n_index].header;
+                        name_length = strlen(s_name);
+                        memcpy(name_buf, s_name, name_length);
+                    }
+                }
+                else {
+                    h3zero_qpack_dyntable_entry_t* ref = (n_index < table->insert_count) ?
+                        h3zero_qpack_dyntable_get(table, table->insert_count - 1 - n_index) : NULL;
+
+                    if (ref == NULL) {
+                        is_error = 1;
+                    }
+                    else {
+                        header = ref->header;
+                        name_length = ref->name_length;
+                        memcpy(name_buf, ref->name, name_length);
+                    }
+                }
+            }
+            if (bytes != NULL && !is_error) {
+                bytes = h3zero_qpack_string_decode(bytes, bytes_max, 0x7F,
+                    value_buf, sizeof(value_buf), &value_length, &is_error);
+            }
+            if (bytes != NULL && !is_error &&
+                h3zero_qpack_dyntable_insert(table, header, name_buf, name_length, value_buf, value_length) != 0) {
+                is_error = 1;
+            }
+        }
+        else if ((bytes[0] & 0x40) == 0x40) {
+            /* Insert with literal name */
+            bytes = h3zero_qpack_string_decode(bytes, bytes_max, 0x1F,
+                name_buf, sizeof(name_buf), &name_length, &is_error);
+            if (bytes != NULL) {
+                bytes = h3zero_qpack_string_decode(bytes, bytes_max, 0x7F,
+                    value_buf, sizeof(value_buf), &value_length, &is_error);
+            }
+            if (bytes != NULL && !is_error) {
+                header = (http_header_enum_t)h3zero_get_interesting_header_type(name_buf, name_length, 0);
+                if (h3zero_qpack_dyntable_insert(table, header, name_buf, name_length, value_buf, value_length) != 0) {
+                    is_error = 1;
+                }
+            }
+        }
+        else if ((bytes[0] & 0x20) == 0x20) {
+            /* Set dynamic table capacity */
+            uint64_t capacity = 0;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x1F, &capacity);
+            if (bytes != NULL && h3zero_qpack_dyntable_set_capacity(table, capacity) != 0) {
+                is_error = 1;
+            }
+        }
+        else {
+            /* Duplicate */
+            uint64_t n_index = 0;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x1F, &n_index);
+            if (bytes != NULL) {
+                h3zero_qpack_dyntable_entry_t* ref = (n_index < table->insert_count) ?
+                    h3zero_qpack_dyntable_get(table, table->insert_count - 1 - n_index) : NULL;
+
+                if (ref == NULL) {
+                    is_error = 1;
+                }
+                else {
+                    /* copy before inserting, as the insertion may evict the referenced entry */
+                    header = ref->header;
+                    name_length = ref->name_length;
+                    memcpy(name_buf, ref->name, name_length);
+                    value_length = ref->value_length;
+                    memcpy(value_buf, ref->value, value_length);
+                    if (h3zero_qpack_dyntable_insert(table, header, name_buf, name_length, value_buf, value_length) != 0) {
+                        is_error = 1;
+                    }
+                }
+            }
+        }
+
+        if (is_error) {
+            *error_found = H3ZERO_QPACK_ENCODER_STREAM_ERROR;
+            bytes = NULL;
+        }
+        else if (bytes == NULL) {
+            /* Incomplete instruction, hold the bytes until more arrive */
+            bytes = instruction;
+            break;
+        }
+    }
+
+    return bytes;
+}
+
 /* 
  * Minimal QPACK parsing.
  *
@@ -290,9 +662,10 @@ size_t h3zero_qpack_nb_static = sizeof(qpack_static) / sizeof(h3zero_qpack_stati
  * |      Compressed Headers     ...
  * +-------------------------------+
  *
- * Since H3zero only support static entries, we expect the required
- * Insert count to be zero, and we always ignore the Base delta.
- * The Base is encoded as sign-and-modulus integer (on 1 byte?)
+ * When no dynamic table capacity was announced, the required Insert
+ * count must be zero and the Base delta is ignored. Otherwise, the
+ * insert count and base are reconstructed per RFC 9204 and dynamic
+ * table references are resolved against the connection's table.
  *
  * We expect the following types of compressed content:
  *
@@ -403,6 +776,146 @@ uint8_t* h3zero_parse_qpack_header_value_string(uint8_t * bytes, uint8_t* decode
     return bytes;
 }
 
+static int h3zero_qpack_parts_set_string(h3zero_header_parts_t* parts,
+    const uint8_t* decoded, size_t decoded_length,
+    uint8_t const** field, size_t* length)
+{
+    int ret = 0;
+
+    if (*field != NULL) {
+        /* Duplicate field! */
+        ret = -1;
+    }
+    else {
+        uint8_t* stored;
+
+        if (decoded_length + 1 <= H3ZERO_HEADER_ARENA_SIZE - parts->arena_used) {
+            /* The common case: store the string in the arena, no allocation */
+            stored = parts->string_arena + parts->arena_used;
+            parts->arena_used += decoded_length + 1;
+        }
+        else {
+            stored = (uint8_t*)malloc(decoded_length + 1);
+        }
+
+        if (stored == NULL) {
+            ret = -1;
+            *length = 0;
+        }
+        else {
+            memcpy(stored, decoded, decoded_length);
+            stored[decoded_length] = 0;
+            *field = stored;
+            *length = decoded_length;
+        }
+    }
+
+    return ret;
+}
+
+/* Parse the RFC 9218 extended priority field value, e.g. "u=3, i".
+* The parsing is lenient: unknown dictionary members are skipped, and
+* out of range urgency values are ignored, as required by the RFC.
+* Also used for the payload of PRIORITY_UPDATE frames, which carry
+* the same field value. */
+void h3zero_parse_priority_field(const uint8_t* decoded, size_t decoded_length,
+    h3zero_header_parts_t* parts)
+{
+    size_t i = 0;
+
+    if (!parts->priority_set) {
+        /* Urgency defaults to 3 if the field only carries "i" */
+        parts->priority_urgency = 3;
+    }
+
+    while (i < decoded_length) {
+        /* Skip whitespace and member separators */
+        while (i < decoded_length && (decoded[i] == ' ' || decoded[i] == '\t' || decoded[i] == ',')) {
+            i++;
+        }
+        if (i < decoded_length) {
+            /* Find the end of the dictionary member, without trailing spaces */
+            size_t member_first = i;
+            size_t member_last;
+            while (i < decoded_length && decoded[i] != ',') {
+                i++;
+            }
+            member_last = i;
+            while (member_last > member_first &&
+                (decoded[member_last - 1] == ' ' || decoded[member_last - 1] == '\t')) {
+                member_last--;
+            }
+            if (member_last - member_first == 3 && decoded[member_first] == 'u' && decoded[member_first + 1] == '=' &&
+                decoded[member_first + 2] >= '0' && decoded[member_first + 2] <= '7') {
+                parts->priority_urgency = decoded[member_first + 2] - '0';
+                parts->priority_set = 1;
+            }
+            else if (decoded[member_first] == 'i' &&
+                (member_last - member_first == 1 ||
+                    (member_last - member_first == 4 && decoded[member_first + 1] == '=' &&
+                        decoded[member_first + 2] == '?' && decoded[member_first + 3] == '1'))) {
+                parts->priority_incremental = 1;
+                parts->priority_set = 1;
+            }
+        }
+    }
+}
+
+/* Document a decoded header value in the header parts. This is shared
+* between the literal values found in the header block and the values
+* resolved from the dynamic table. */
+static int h3zero_qpack_parts_set_value(http_header_enum_t header,
+    uint8_t* decoded, size_t decoded_length, h3zero_header_parts_t* parts)
+{
+    int ret = 0;
+
+    switch (header) {
+    case http_header_priority:
+        h3zero_parse_priority_field(decoded, decoded_length, parts);
+        break;
+    case http_pseudo_header_method:
+        if (parts->method != h3zero_method_none) {
+            /* Duplicate method! */
+            ret = -1;
+        }
+        else {
+            parts->method = h3zero_get_method_by_name(decoded, decoded_length);
+        }
+        break;
+    case http_header_content_type:
+        if (parts->content_type != h3zero_content_type_none) {
+            /* Duplicate content type! */
+            ret = -1;
+        }
+        else {
+            parts->content_type = h3zero_get_content_type_by_name(decoded, decoded_length);
+        }
+        break;
+    case http_pseudo_header_status:
+        if (parts->status != 0) {
+            /* Duplicate status! */
+            ret = -1;
+        }
+        else {
+            parts->status = h3zero_parse_status(decoded, decoded_length);
+        }
+        break;
+    case http_pseudo_header_path:
+        ret = h3zero_qpack_parts_set_string(parts, decoded, decoded_length, &parts->path, &parts->path_length);
+        break;
+    case http_header_range:
+        ret = h3zero_qpack_parts_set_string(parts, decoded, decoded_length, &parts->range, &parts->range_length);
+        break;
+    case http_pseudo_header_protocol:
+        ret = h3zero_qpack_parts_set_string(parts, decoded, decoded_length, &parts->protocol, &parts->protocol_length);
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
 uint8_t * h3zero_parse_qpack_header_value(uint8_t * bytes, uint8_t * bytes_max,
     http_header_enum_t header, h3zero_header_parts_t * parts)
 {
@@ -433,67 +946,8 @@ uint8_t * h3zero_parse_qpack_header_value(uint8_t * bytes, uint8_t * bytes_max,
                 decoded_length = (size_t) v_length;
             }
 
-            switch (header) {
-            case http_pseudo_header_method:
-                if (parts->method != h3zero_method_none) {
-                    /* Duplicate method! */
-                    bytes = 0;
-                }
-                else {
-                    parts->method = h3zero_get_method_by_name(decoded, decoded_length);
-                }
-                break;
-            case http_header_content_type:
-                if (parts->content_type != h3zero_content_type_none) {
-                    /* Duplicate content type! */
-                    bytes = 0;
-                }
-                else {
-                    parts->content_type = h3zero_get_content_type_by_name(decoded, decoded_length);
-                }
-                break;
-            case http_pseudo_header_status:
-                if (parts->status != 0) {
-                    /* Duplicate content type! */
-                    bytes = 0;
-                }
-                else {
-                    /* TODO: decimal to binary */
-                    parts->status = h3zero_parse_status(decoded, decoded_length);
-                }
-                break;
-            case http_pseudo_header_path:
-                if (parts->path != NULL) {
-                    /* Duplicate content type! */
-                    bytes = 0;
-                }
-                else {
-                    bytes = h3zero_parse_qpack_header_value_string(bytes, decoded,
-                        decoded_length, &parts->path, &parts->path_length);
-                }
-                break;
-            case http_header_range:
-                if (parts->range != NULL) {
-                    /* Duplicate content type! */
-                    bytes = 0;
-                }
-                else {
-                    bytes = h3zero_parse_qpack_header_value_string(bytes, decoded,
-                        decoded_length, &parts->range, &parts->range_length);
-                }
-                break;
-            case http_pseudo_header_protocol:
-                if (parts->protocol != NULL) {
-                    /* Duplicate content type! */
-                    bytes = 0;
-                }
-                else {
-                    bytes = h3zero_parse_qpack_header_value_string(bytes, decoded,
-                        decoded_length, &parts->protocol, &parts->protocol_length);
-                }
-                break;
-            default:
-                break;
+            if (h3zero_qpack_parts_set_value(header, decoded, decoded_length, parts) != 0) {
+                bytes = NULL;
             }
 
             if (bytes != NULL) {
@@ -508,12 +962,12 @@ uint8_t * h3zero_parse_qpack_header_value(uint8_t * bytes, uint8_t * bytes_max,
 int h3zero_get_interesting_header_type(uint8_t * name, size_t name_length, int is_huffman)
 {
     char const  * interesting_header_name[] = {
-     ":method", ":path", ":status", "content-type", ":protocol", "origin", "range", NULL};
+     ":method", ":path", ":status", "content-type", ":protocol", "origin", "range", "priority", NULL};
     const http_header_enum_t interesting_header[] = {
         http_pseudo_header_method, http_pseudo_header_path,
         http_pseudo_header_status, http_header_content_type,
         http_pseudo_header_protocol, http_header_origin,
-        http_header_range
+        http_header_range, http_header_priority
     };
     http_header_enum_t val = http_header_unknown;
     uint8_t deHuff[256];
@@ -537,23 +991,83 @@ int h3zero_get_interesting_header_type(uint8_t * name, size_t name_length, int i
     return val;
 }
 
-uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max, 
-    h3zero_header_parts_t * parts)
+uint8_t* h3zero_parse_qpack_header_frame_ex(uint8_t* bytes, uint8_t* bytes_max,
+    h3zero_header_parts_t* parts, h3zero_qpack_dyntable_t* table)
 {
+    uint64_t base = 0;
+
     memset(parts, 0, sizeof(h3zero_header_parts_t));
 
     if (bytes == NULL || bytes >= bytes_max) {
         return NULL;
     }
 
-    /* parse base, expect 0 insert */
-    if (bytes[0] != 0) {
-        /* unexpected value */
-        bytes = NULL;
+    /* Parse the encoded field section prefix. When no dynamic table
+     * capacity was announced, the required insert count must be zero. */
+    if (table == NULL || table->max_capacity == 0) {
+        if (bytes[0] != 0) {
+            /* unexpected value */
+            bytes = NULL;
+        }
+        else {
+            uint64_t delta_base;
+            bytes = h3zero_qpack_int_decode(bytes + 1, bytes_max, 0x7F, &delta_base);
+        }
     }
     else {
-        uint64_t delta_base;
-        bytes = h3zero_qpack_int_decode(bytes + 1, bytes_max, 0x7F, &delta_base);
+        uint64_t encoded_ric = 0;
+
+        bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0xFF, &encoded_ric);
+        if (bytes != NULL && bytes < bytes_max) {
+            int base_is_negative = (bytes[0] & 0x80) != 0;
+            uint64_t delta_base = 0;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x7F, &delta_base);
+            if (bytes != NULL && encoded_ric > 0) {
+                /* Reconstruct the required insert count, per section
+                 * 4.5.1.1 of RFC 9204 */
+                uint64_t max_entries = table->max_capacity / 32;
+                uint64_t full_range = 2 * max_entries;
+                uint64_t max_value = table->insert_count + max_entries;
+                uint64_t max_wrapped = (max_value / full_range) * full_range;
+
+                parts->required_insert_count = max_wrapped + encoded_ric - 1;
+                if (encoded_ric > full_range) {
+                    bytes = NULL;
+                }
+                else if (parts->required_insert_count > max_value) {
+                    if (parts->required_insert_count <= full_range) {
+                        bytes = NULL;
+                    }
+                    else {
+                        parts->required_insert_count -= full_range;
+                    }
+                }
+                if (bytes != NULL && (parts->required_insert_count == 0 ||
+                    parts->required_insert_count > table->insert_count)) {
+                    /* We announce zero blocked streams, so a section
+                     * that requires entries not yet received is an
+                     * encoder error, not a blocked stream. */
+                    bytes = NULL;
+                }
+            }
+            if (bytes != NULL) {
+                if (base_is_negative) {
+                    if (delta_base >= parts->required_insert_count) {
+                        bytes = NULL;
+                    }
+                    else {
+                        base = parts->required_insert_count - delta_base - 1;
+                    }
+                }
+                else {
+                    base = parts->required_insert_count + delta_base;
+                }
+            }
+        }
+        else {
+            bytes = NULL;
+        }
     }
 
     while (bytes != NULL && bytes < bytes_max) {
@@ -597,23 +1111,10 @@ uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
                     }
                     break;
                 case http_pseudo_header_path:
-                    if (parts->path != NULL) {
-                        /* Duplicate path! */
+                    if (h3zero_qpack_parts_set_string(parts, (const uint8_t*)qpack_static[s_index].content,
+                        strlen(qpack_static[s_index].content), &parts->path, &parts->path_length) != 0) {
                         bytes = NULL;
                     }
-                    else {
-                        parts->path_length = strlen(qpack_static[s_index].content);
-                        parts->path = malloc(parts->path_length + 1);
-                        if (parts->path == NULL) {
-                            /* internal error */
-                            bytes = NULL;
-                            parts->path_length = 0;
-                        }
-                        else {
-                            memcpy((uint8_t *)parts->path, qpack_static[s_index].content, parts->path_length);
-                            ((uint8_t*)parts->path)[parts->path_length] = 0;
-                        }
-                    }
                     break;
                 case http_header_origin:
                     /* TODO: parse origin value? */
@@ -624,6 +1125,20 @@ uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
                 }
             }
         }
+        else if ((bytes[0] & 0xC0) == 0x80) {
+            /* Indexed field line, dynamic table reference */
+            uint64_t d_index;
+            h3zero_qpack_dyntable_entry_t* entry;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x3F, &d_index);
+            if (bytes != NULL) {
+                entry = (d_index < base) ? h3zero_qpack_dyntable_get(table, base - 1 - d_index) : NULL;
+                if (entry == NULL ||
+                    h3zero_qpack_parts_set_value(entry->header, entry->value, entry->value_length, parts) != 0) {
+                    bytes = NULL;
+                }
+            }
+        }
         else if ((bytes[0] & 0xD0) == 0x50) {
             /* Literal header field with name reference, static encoding */
             uint64_t s_index;
@@ -639,6 +1154,23 @@ uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
                 }
             }
         }
+        else if ((bytes[0] & 0xD0) == 0x40) {
+            /* Literal header field with name reference, dynamic table */
+            uint64_t d_index;
+            h3zero_qpack_dyntable_entry_t* entry;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x0F, &d_index);
+            if (bytes != NULL) {
+                entry = (d_index < base) ? h3zero_qpack_dyntable_get(table, base - 1 - d_index) : NULL;
+                if (entry == NULL) {
+                    bytes = NULL;
+                }
+                else {
+                    bytes = h3zero_parse_qpack_header_value(bytes, bytes_max,
+                        entry->header, parts);
+                }
+            }
+        }
         else if ((bytes[0] & 0xE0) == 0x20) {
             /* Literal Header Field Without Name Reference */
             uint64_t n_length;
@@ -657,6 +1189,37 @@ uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
                 }
             }
         }
+        else if ((bytes[0] & 0xF0) == 0x10) {
+            /* Indexed field line, post-base dynamic table reference */
+            uint64_t d_index;
+            h3zero_qpack_dyntable_entry_t* entry;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x0F, &d_index);
+            if (bytes != NULL) {
+                entry = h3zero_qpack_dyntable_get(table, base + d_index);
+                if (entry == NULL ||
+                    h3zero_qpack_parts_set_value(entry->header, entry->value, entry->value_length, parts) != 0) {
+                    bytes = NULL;
+                }
+            }
+        }
+        else if ((bytes[0] & 0xF0) == 0x00) {
+            /* Literal header field with post-base name reference */
+            uint64_t d_index;
+            h3zero_qpack_dyntable_entry_t* entry;
+
+            bytes = h3zero_qpack_int_decode(bytes, bytes_max, 0x07, &d_index);
+            if (bytes != NULL) {
+                entry = h3zero_qpack_dyntable_get(table, base + d_index);
+                if (entry == NULL) {
+                    bytes = NULL;
+                }
+                else {
+                    bytes = h3zero_parse_qpack_header_value(bytes, bytes_max,
+                        entry->header, parts);
+                }
+            }
+        }
         else {
             /* unexpected encoding */
             bytes = NULL;
@@ -666,6 +1229,12 @@ uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     return bytes;
 }
 
+uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
+    h3zero_header_parts_t * parts)
+{
+    return h3zero_parse_qpack_header_frame_ex(bytes, bytes_max, parts, NULL);
+}
+
 /*
  * Header frame.
  * The HEADERS frame (type=0x1) is used to carry a header block,
@@ -1041,6 +1610,17 @@ uint8_t * h3zero_varint_from_stream(uint8_t* bytes, uint8_t* bytes_max, uint64_t
     if (bytes == bytes_max){
         return bytes; /* continuing */
     }
+    if (*buffer_length == 0) {
+        /* Fast path: nothing was held over from a previous chunk, and
+         * in the common case the whole varint is contiguous in the
+         * current chunk, so it can be decoded in place. */
+        size_t varint_length = h3zero_varint_skip(bytes);
+
+        if (bytes + varint_length <= bytes_max) {
+            (void)h3zero_varint_decode(bytes, varint_length, result);
+            return bytes + varint_length;
+        }
+    }
     if (bp == buffer) {
         *bp++ = *bytes++;
         *buffer_length += 1;
@@ -1061,25 +1641,28 @@ uint8_t * h3zero_varint_from_stream(uint8_t* bytes, uint8_t* bytes_max, uint64_t
     return bytes;
 }
 
-void h3zero_release_header_parts(h3zero_header_parts_t* header)
+static void h3zero_release_header_field(h3zero_header_parts_t* header,
+    uint8_t const** field, size_t* length)
 {
-    if (header->path != NULL) {
-        free((uint8_t*)header->path);
-        *((uint8_t**)&header->path) = NULL;
-        header->path_length = 0;
-    }
-    if (header->range != NULL) {
-        free((uint8_t*)header->range);
-        *((uint8_t**)&header->range) = NULL;
-        header->range_length = 0;
-    }
-    if (header->protocol != NULL) {
-        free((uint8_t*)header->protocol);
-        *((uint8_t**)&header->protocol) = NULL;
-        header->protocol_length = 0;
+    if (*field != NULL) {
+        /* Only free the strings that did not fit in the inline arena */
+        if ((const uint8_t*)*field < header->string_arena ||
+            (const uint8_t*)*field >= header->string_arena + H3ZERO_HEADER_ARENA_SIZE) {
+            free((uint8_t*)*field);
+        }
+        *field = NULL;
+        *length = 0;
     }
 }
 
+void h3zero_release_header_parts(h3zero_header_parts_t* header)
+{
+    h3zero_release_header_field(header, &header->path, &header->path_length);
+    h3zero_release_header_field(header, &header->range, &header->range_length);
+    h3zero_release_header_field(header, &header->protocol, &header->protocol_length);
+    header->arena_used = 0;
+}
+
 void h3zero_delete_data_stream_state(h3zero_data_stream_state_t * stream_state)
 {
     if (stream_state->header_found){
@@ -63,14 +63,16 @@ typedef enum {
     h3zero_frame_max_push_id = 0xd,
     h3zero_frame_reserved_base = 0xb,
     h3zero_frame_reserved_delta = 0x1f,
-    h3zero_frame_webtransport_stream = 0x41
+    h3zero_frame_webtransport_stream = 0x41,
+    h3zero_frame_priority_update = 0xF0700, /* RFC 9218, request variant */
+    h3zero_frame_priority_update_push = 0xF0701
 } h3zero_frame_type_enum_t;
 
 typedef enum {
     h3zero_stream_type_control = 0,
     h3zero_stream_type_push = 1, /* Push type not supported in h3zero settings */
-    h3zero_stream_type_qpack_encoder = 2, /* not required since not using dynamic table */
-    h3zero_stream_type_qpack_decoder = 3, /* not required since not using dynamic table */
+    h3zero_stream_type_qpack_encoder = 2, /* carries the peer's dynamic table instructions */
+    h3zero_stream_type_qpack_decoder = 3, /* carries acknowledgements of dynamic table use */
     h3zero_stream_type_webtransport = 0x54 /* unidir stream is used as specified in web transport */
 } h3zero_stream_type_enum;
 
@@ -129,6 +131,7 @@ typedef enum {
     http_header_user_agent,
     http_header_x_forwarded_for,
     http_header_x_frame_options,
+    http_header_priority,
 	http_header_max
 } http_header_enum_t;
 
@@ -181,6 +184,12 @@ typedef enum {
     h3zero_method_put
 } h3zero_method_enum;
 
+/* Inline storage for the decoded header strings. Most requests fit
+* entirely in the arena, so parsing a header frame does not allocate;
+* longer strings fall back to the heap, and
+* h3zero_release_header_parts frees whichever storage was used. */
+#define H3ZERO_HEADER_ARENA_SIZE 256
+
 typedef struct st_h3zero_header_parts_t {
     h3zero_method_enum method;
     uint8_t const * path;
@@ -191,7 +200,13 @@ typedef struct st_h3zero_header_parts_t {
     h3zero_content_type_enum content_type;
     uint8_t const * protocol;
     size_t protocol_length;
+    uint64_t required_insert_count; /* from the encoded field section prefix */
+    int priority_urgency; /* RFC 9218 extended priority, "u=0".."u=7" */
+    unsigned int priority_set : 1;
+    unsigned int priority_incremental : 1; /* RFC 9218 "i" parameter */
     unsigned int path_is_huffman : 1;
+    size_t arena_used;
+    uint8_t string_arena[H3ZERO_HEADER_ARENA_SIZE];
 } h3zero_header_parts_t;
 
 /* Setting codes.
@@ -228,8 +243,63 @@ uint8_t * h3zero_qpack_int_encode(uint8_t * bytes, uint8_t * bytes_max,
 uint8_t * h3zero_qpack_int_decode(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t mask, uint64_t *val);
 
+/* QPACK dynamic table, RFC 9204. H3zero itself keeps encoding header
+* blocks with static table references only, but it accepts dynamic
+* table entries inserted by the peer's encoder, so peers that repeat
+* large headers on every request can compress them. Entries are kept
+* in a ring indexed by absolute index; entry sizes and evictions
+* follow section 3.2 of the RFC, so the table stays in sync with the
+* peer's accounting. The table is unused until a capacity is announced
+* in the settings and the peer's encoder sets a non zero capacity.
+*/
+typedef struct st_h3zero_qpack_dyntable_entry_t {
+    http_header_enum_t header; /* resolved once, when the entry is inserted */
+    uint8_t* name;
+    size_t name_length;
+    uint8_t* value;
+    size_t value_length;
+} h3zero_qpack_dyntable_entry_t;
+
+typedef struct st_h3zero_qpack_dyntable_t {
+    h3zero_qpack_dyntable_entry_t* entries; /* ring, indexed by absolute index modulo nb_entries_alloc */
+    size_t nb_entries_alloc;
+    uint64_t max_capacity; /* the value announced in the settings */
+    uint64_t capacity; /* set by the peer's encoder, up to max_capacity */
+    uint64_t used_bytes;
+    uint64_t insert_count; /* total number of insertions */
+    uint64_t dropped_count; /* number of evicted entries */
+    /* Decoder stream, used to acknowledge dynamic table use */
+    struct st_picoquic_cnx_t* cnx;
+    uint64_t decoder_stream_id;
+    uint64_t acked_insert_count;
+    unsigned int has_decoder_stream : 1;
+} h3zero_qpack_dyntable_t;
+
+void h3zero_qpack_dyntable_init(h3zero_qpack_dyntable_t* table, uint64_t max_capacity);
+void h3zero_qpack_dyntable_release(h3zero_qpack_dyntable_t* table);
+int h3zero_qpack_dyntable_set_capacity(h3zero_qpack_dyntable_t* table, uint64_t capacity);
+int h3zero_qpack_dyntable_insert(h3zero_qpack_dyntable_t* table, http_header_enum_t header,
+    const uint8_t* name, size_t name_length, const uint8_t* value, size_t value_length);
+h3zero_qpack_dyntable_entry_t* h3zero_qpack_dyntable_get(h3zero_qpack_dyntable_t* table, uint64_t abs_index);
+char const* h3zero_qpack_header_name(http_header_enum_t header);
+
+/* Parse the instructions received on the peer's encoder stream.
+* Returns the start of the first incomplete instruction, so the caller
+* can hold the unread bytes until the next batch arrives, or NULL if
+* an instruction was in error, with *error_found documenting the
+* error. */
+uint8_t* h3zero_parse_qpack_encoder_stream(uint8_t* bytes, uint8_t* bytes_max,
+    h3zero_qpack_dyntable_t* table, uint64_t* error_found);
+
 uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     h3zero_header_parts_t * parts);
+/* Parse an RFC 9218 priority field value into the priority members of
+* the header parts, as found in a "priority" header or in the payload
+* of a PRIORITY_UPDATE frame. */
+void h3zero_parse_priority_field(const uint8_t* decoded, size_t decoded_length,
+    h3zero_header_parts_t* parts);
+uint8_t* h3zero_parse_qpack_header_frame_ex(uint8_t* bytes, uint8_t* bytes_max,
+    h3zero_header_parts_t* parts, h3zero_qpack_dyntable_t* table);
 uint8_t * h3zero_create_request_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t const * path, size_t path_length, char const * host);
 uint8_t* h3zero_create_request_header_frame_ex(uint8_t* bytes, uint8_t* bytes_max,
@@ -277,6 +347,7 @@ typedef struct st_h3zero_data_stream_state_t {
     unsigned int trailer_found : 1;
     unsigned int is_h3_control : 1;
     unsigned int is_current_frame_ignored : 1;
+    unsigned int qpack_ack_pending : 1; /* header section used the dynamic table, acknowledgement due */
     /* Keeping track of FIN sent and FIN received, so applications can delete stream contexts that are not useful */
     unsigned int is_fin_received : 1; 
     unsigned int is_fin_sent : 1;
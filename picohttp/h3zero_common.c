@@ -33,6 +33,7 @@
 #include "tls_api.h"
 #include "h3zero.h"
 #include "h3zero_common.h"
+#include "h3zero_filecache.h"
 
 
 
@@ -66,6 +67,10 @@ static void picohttp_clear_stream_ctx(h3zero_stream_ctx_t* stream_ctx)
 	if (stream_ctx->F != NULL) {
 		stream_ctx->F = picoquic_file_close(stream_ctx->F);
 	}
+	if (stream_ctx->cache_entry != NULL) {
+		h3zero_filecache_release(stream_ctx->cache_entry);
+		stream_ctx->cache_entry = NULL;
+	}
 
 	if (stream_ctx->path_callback != NULL) {
 		(void)stream_ctx->path_callback(stream_ctx->cnx, NULL, 0, picohttp_callback_free, stream_ctx, stream_ctx->path_callback_ctx);
@@ -81,12 +86,29 @@ static void picohttp_clear_stream_ctx(h3zero_stream_ctx_t* stream_ctx)
 	}
 }
 
+/* Deleted stream contexts are kept in a short free list and reused by
+ * h3zero_find_or_create_stream, so applications that open many short
+ * lived streams do not pay a malloc and free per stream. */
+#define H3ZERO_STREAM_CTX_FREE_MAX 64
+
 static void picohttp_stream_node_delete(void * tree, picosplay_node_t * node)
 {
+	h3zero_callback_ctx_t* ctx = (h3zero_callback_ctx_t*)((char*)tree -
+		offsetof(struct st_h3zero_callback_ctx_t, h3_stream_tree));
 	h3zero_stream_ctx_t * stream_ctx = picohttp_stream_node_value(node);
 	picohttp_clear_stream_ctx(stream_ctx);
 
-	free(stream_ctx);
+	if (ctx->nb_stream_ctx_live > 0) {
+		ctx->nb_stream_ctx_live--;
+	}
+	if (ctx->nb_stream_ctx_free < H3ZERO_STREAM_CTX_FREE_MAX) {
+		stream_ctx->next_free_ctx = ctx->stream_ctx_free_list;
+		ctx->stream_ctx_free_list = stream_ctx;
+		ctx->nb_stream_ctx_free++;
+	}
+	else {
+		free(stream_ctx);
+	}
 }
 
 void h3zero_delete_stream(picoquic_cnx_t * cnx, h3zero_callback_ctx_t* ctx, h3zero_stream_ctx_t* stream_ctx)
@@ -123,8 +145,18 @@ h3zero_stream_ctx_t * h3zero_find_or_create_stream(
 	/* if stream is already present, check its state. New bytes? */
 
 	if (stream_ctx == NULL && should_create) {
-		stream_ctx = (h3zero_stream_ctx_t*)
-			malloc(sizeof(h3zero_stream_ctx_t));
+		if ((stream_ctx = ctx->stream_ctx_free_list) != NULL) {
+			ctx->stream_ctx_free_list = stream_ctx->next_free_ctx;
+			ctx->nb_stream_ctx_free--;
+			ctx->nb_stream_ctx_recycled++;
+		}
+		else {
+			stream_ctx = (h3zero_stream_ctx_t*)
+				malloc(sizeof(h3zero_stream_ctx_t));
+			if (stream_ctx != NULL) {
+				ctx->nb_stream_ctx_allocated++;
+			}
+		}
 		if (stream_ctx == NULL) {
 			/* Could not handle this stream */
 			picoquic_reset_stream(cnx, stream_id, H3ZERO_INTERNAL_ERROR);
@@ -148,6 +180,10 @@ h3zero_stream_ctx_t * h3zero_find_or_create_stream(
 				}
 			}
 			picosplay_insert(&ctx->h3_stream_tree, stream_ctx);
+			ctx->nb_stream_ctx_live++;
+			if (ctx->nb_stream_ctx_live > ctx->nb_stream_ctx_high_water) {
+				ctx->nb_stream_ctx_high_water = ctx->nb_stream_ctx_live;
+			}
 		}
 	}
 
@@ -236,6 +272,12 @@ void h3zero_delete_stream_prefix(picoquic_cnx_t * cnx, h3zero_callback_ctx_t* ct
 				prefix_ctx->function_call(cnx, NULL, 0, picohttp_callback_deregister, stream_ctx, prefix_ctx->function_ctx);
 			}
 		}
+		if (prefix_ctx->dg_batch_buffer != NULL) {
+			free(prefix_ctx->dg_batch_buffer);
+		}
+		if (prefix_ctx->dg_batch_vec != NULL) {
+			free(prefix_ctx->dg_batch_vec);
+		}
 		free(prefix_ctx);
 	}
 	else {
@@ -281,7 +323,7 @@ uint64_t h3zero_parse_stream_prefix(uint8_t* buffer_8, size_t* nb_in_buffer, uin
 }
 #endif
 
-int h3zero_protocol_init(picoquic_cnx_t* cnx)
+int h3zero_protocol_init_ex(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx)
 {
 	uint8_t decoder_stream_head = (uint8_t)h3zero_stream_type_qpack_decoder;
 	uint8_t encoder_stream_head = (uint8_t)h3zero_stream_type_qpack_encoder;
@@ -293,6 +335,12 @@ int h3zero_protocol_init(picoquic_cnx_t* cnx)
 	int ret = 0;
 
 	settings.enable_connect_protocol = 1;
+	if (ctx != NULL) {
+		/* Announce the dynamic table capacity. Blocked streams remain
+		 * at zero: the peer's encoder may only reference entries that
+		 * were acknowledged on the decoder stream. */
+		settings.table_size = ctx->qpack_dec_table.max_capacity;
+	}
 
 	/* Web transport is only enabled if h3 datagrams are supported.
 	 */
@@ -312,6 +360,9 @@ int h3zero_protocol_init(picoquic_cnx_t* cnx)
 	if (ret == 0) {
 		/* set the settings stream the first stream to write! */
 		ret = picoquic_set_stream_priority(cnx, settings_stream_id, 0);
+		if (ret == 0 && ctx != NULL) {
+			ctx->local_control_stream_id = settings_stream_id;
+		}
 	}
 
 	if (ret == 0) {
@@ -325,11 +376,176 @@ int h3zero_protocol_init(picoquic_cnx_t* cnx)
 
 	if (ret == 0) {
 		uint64_t decoder_stream_id = picoquic_get_next_local_stream_id(cnx, 1);
-		/* set the the decoder stream, although we do not actually create dynamic codes. */
+		/* set the decoder stream, used to acknowledge the peer's dynamic table updates. */
 		ret = picoquic_add_to_stream(cnx, decoder_stream_id, &decoder_stream_head, 1, 0);
 		if (ret == 0) {
 			ret = picoquic_set_stream_priority(cnx, decoder_stream_id, 1);
 		}
+		if (ret == 0 && ctx != NULL) {
+			ctx->qpack_dec_table.cnx = cnx;
+			ctx->qpack_dec_table.decoder_stream_id = decoder_stream_id;
+			ctx->qpack_dec_table.has_decoder_stream = 1;
+		}
+	}
+	return ret;
+}
+
+int h3zero_protocol_init(picoquic_cnx_t* cnx)
+{
+	return h3zero_protocol_init_ex(cnx, NULL);
+}
+
+/* Graceful draining. The GOAWAY frame announces the lowest client
+ * request stream that will not be processed; requests at or above that
+ * stream id are rejected, so the client can retry them elsewhere while
+ * the responses already in flight complete. */
+
+int h3zero_send_goaway(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx)
+{
+	int ret = 0;
+
+	if (!ctx->is_goaway_sent) {
+		uint8_t buffer[16];
+		uint8_t* bytes;
+		uint64_t goaway_stream_id = ctx->next_client_stream_id;
+
+		if (ctx->local_control_stream_id == UINT64_MAX) {
+			ret = -1;
+		}
+		else {
+			buffer[0] = h3zero_frame_goaway;
+			bytes = picoquic_frames_varint_encode(buffer + 2, buffer + sizeof(buffer), goaway_stream_id);
+			if (bytes == NULL) {
+				ret = -1;
+			}
+			else {
+				/* The frame length is the size of the stream id varint,
+				 * which always fits a one byte varint. */
+				buffer[1] = (uint8_t)(bytes - (buffer + 2));
+				ret = picoquic_add_to_stream(cnx, ctx->local_control_stream_id, buffer, bytes - buffer, 0);
+			}
+			if (ret == 0) {
+				ctx->is_goaway_sent = 1;
+				ctx->goaway_stream_id = goaway_stream_id;
+				picoquic_log_app_message(cnx, "Sent GOAWAY, draining from stream %" PRIu64, goaway_stream_id);
+			}
+		}
+	}
+
+	return ret;
+}
+
+/* A connection is drained once everything that was queued has been
+ * sent and acknowledged, and no pulled response is left incomplete. */
+static int h3zero_cnx_is_drained(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx)
+{
+	int is_drained = picoquic_is_cnx_backlog_empty(cnx);
+
+	if (is_drained) {
+		picosplay_node_t* node = picosplay_first(&ctx->h3_stream_tree);
+
+		while (node != NULL) {
+			h3zero_stream_ctx_t* stream_ctx = picohttp_stream_node_value(node);
+
+			if (stream_ctx->is_h3 &&
+				(stream_ctx->echo_sent < stream_ctx->echo_length || stream_ctx->is_upgraded)) {
+				is_drained = 0;
+				break;
+			}
+			node = picosplay_next(node);
+		}
+	}
+
+	return is_drained;
+}
+
+int h3zero_quic_drain_begin(picoquic_quic_t* quic)
+{
+	int ret = 0;
+	picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic);
+
+	while (cnx != NULL) {
+		if (picoquic_get_callback_function(cnx) == h3zero_callback &&
+			picoquic_get_cnx_state(cnx) < picoquic_state_disconnecting) {
+			h3zero_callback_ctx_t* ctx = (h3zero_callback_ctx_t*)picoquic_get_callback_context(cnx);
+
+			if (ctx != NULL && ctx != picoquic_get_default_callback_context(quic)) {
+				int cnx_ret = h3zero_send_goaway(cnx, ctx);
+
+				if (ret == 0) {
+					ret = cnx_ret;
+				}
+			}
+		}
+		cnx = picoquic_get_next_cnx(cnx);
+	}
+
+	return ret;
+}
+
+int h3zero_quic_drain_check(picoquic_quic_t* quic, uint64_t current_time, uint64_t deadline)
+{
+	int all_drained = 1;
+	picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic);
+
+	while (cnx != NULL) {
+		if (picoquic_get_callback_function(cnx) == h3zero_callback &&
+			picoquic_get_cnx_state(cnx) < picoquic_state_disconnecting) {
+			h3zero_callback_ctx_t* ctx = (h3zero_callback_ctx_t*)picoquic_get_callback_context(cnx);
+
+			if (ctx == NULL || ctx == picoquic_get_default_callback_context(quic) ||
+				h3zero_cnx_is_drained(cnx, ctx) ||
+				current_time >= deadline) {
+				(void)picoquic_close(cnx, H3ZERO_NO_ERROR);
+			}
+			else {
+				all_drained = 0;
+			}
+		}
+		cnx = picoquic_get_next_cnx(cnx);
+	}
+
+	return all_drained;
+}
+
+int h3zero_qpack_send_insert_count_increment(h3zero_qpack_dyntable_t* table)
+{
+	int ret = 0;
+	uint64_t increment = table->insert_count - table->acked_insert_count;
+
+	if (increment > 0 && table->has_decoder_stream) {
+		uint8_t buffer[16];
+		uint8_t* last;
+
+		buffer[0] = 0;
+		if ((last = h3zero_qpack_int_encode(buffer, buffer + sizeof(buffer), 0x3F, increment)) == NULL) {
+			ret = -1;
+		}
+		else {
+			ret = picoquic_add_to_stream(table->cnx, table->decoder_stream_id, buffer, last - buffer, 0);
+			if (ret == 0) {
+				table->acked_insert_count = table->insert_count;
+			}
+		}
+	}
+	return ret;
+}
+
+int h3zero_qpack_send_section_ack(h3zero_qpack_dyntable_t* table, uint64_t stream_id)
+{
+	int ret = 0;
+
+	if (table->has_decoder_stream) {
+		uint8_t buffer[16];
+		uint8_t* last;
+
+		buffer[0] = 0x80;
+		if ((last = h3zero_qpack_int_encode(buffer, buffer + sizeof(buffer), 0x7F, stream_id)) == NULL) {
+			ret = -1;
+		}
+		else {
+			ret = picoquic_add_to_stream(table->cnx, table->decoder_stream_id, buffer, last - buffer, 0);
+		}
 	}
 	return ret;
 }
@@ -405,7 +621,7 @@ static void h3zero_reset_control_stream_state(h3zero_data_stream_state_t* stream
 	}
 }
 
-static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
+static uint8_t* h3zero_parse_control_stream(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t* bytes_max,
 	h3zero_data_stream_state_t* stream_state, h3zero_callback_ctx_t* ctx, uint64_t* error_found)
 {
 	while (bytes != NULL && bytes < bytes_max) {
@@ -437,7 +653,9 @@ static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
 					continue;
 				}
 				else if (stream_state->current_frame_type != h3zero_frame_settings) {
-					stream_state->is_current_frame_ignored = 1;
+					stream_state->is_current_frame_ignored =
+						(stream_state->current_frame_type != h3zero_frame_goaway &&
+							stream_state->current_frame_type != h3zero_frame_priority_update);
 				}
 			}
 		}
@@ -474,6 +692,48 @@ static uint8_t* h3zero_parse_control_stream(uint8_t* bytes, uint8_t* bytes_max,
 						ctx->settings.settings_received = 1;
 					}
 				}
+				else if (stream_state->current_frame_type == h3zero_frame_goaway) {
+					/* The peer is draining; remember the lowest stream
+					 * id that it will not process. */
+					if (stream_state->current_frame == NULL ||
+						h3zero_varint_decode(stream_state->current_frame,
+							(size_t)stream_state->current_frame_length, &ctx->peer_goaway_stream_id) == 0) {
+						*error_found = H3ZERO_FRAME_ERROR;
+						bytes = NULL;
+					}
+					else {
+						ctx->is_goaway_received = 1;
+					}
+				}
+				else if (stream_state->current_frame_type == h3zero_frame_priority_update) {
+					/* Reprioritization of a request stream: apply the
+					 * new urgency and incremental flag to the transport
+					 * stream, if it is still alive. The push variant
+					 * stays in the ignored set, push is not supported. */
+					uint64_t element_id = 0;
+					size_t id_length = (stream_state->current_frame == NULL) ? 0 :
+						h3zero_varint_decode(stream_state->current_frame,
+							(size_t)stream_state->current_frame_length, &element_id);
+					if (id_length == 0) {
+						*error_found = H3ZERO_FRAME_ERROR;
+						bytes = NULL;
+					}
+					else {
+						h3zero_header_parts_t parts;
+						memset(&parts, 0, sizeof(h3zero_header_parts_t));
+						h3zero_parse_priority_field(stream_state->current_frame + id_length,
+							(size_t)stream_state->current_frame_length - id_length, &parts);
+						if (parts.priority_set && cnx != NULL &&
+							h3zero_find_stream(ctx, element_id) != NULL) {
+							/* Only known request streams are updated, so
+							 * a bogus element id cannot create transport
+							 * state. Errors are ignored, the stream may
+							 * be closed for writing already. */
+							(void)picoquic_set_stream_priority(cnx, element_id,
+								h3zero_map_extended_priority(&parts));
+						}
+					}
+				}
 				h3zero_reset_control_stream_state(stream_state);
 			}
 		}
@@ -540,6 +800,76 @@ uint8_t* h3zero_parse_remote_bidir_stream(
 	return bytes;
 }
 
+/* Receive the peer's QPACK encoder stream. Instructions may be split
+* across packets, so the bytes of a partially received instruction are
+* held in the callback context until the rest arrives. After new
+* entries are inserted, an insert count increment is sent on the local
+* decoder stream, so the peer's encoder can start referencing them. */
+#define H3ZERO_QPACK_HOLD_MAX 0x1000
+
+static uint8_t* h3zero_receive_qpack_encoder_stream(
+	uint8_t* bytes, uint8_t* bytes_max,
+	h3zero_callback_ctx_t* ctx,
+	uint64_t* error_found)
+{
+	uint64_t old_insert_count = ctx->qpack_dec_table.insert_count;
+	uint8_t* buffer = bytes;
+	uint8_t* buffer_max = bytes_max;
+	uint8_t* combined = NULL;
+	uint8_t* parsed;
+
+	if (ctx->qpack_enc_hold_length > 0) {
+		size_t total = ctx->qpack_enc_hold_length + (bytes_max - bytes);
+
+		if ((combined = (uint8_t*)malloc(total)) == NULL) {
+			*error_found = H3ZERO_INTERNAL_ERROR;
+			return NULL;
+		}
+		memcpy(combined, ctx->qpack_enc_hold, ctx->qpack_enc_hold_length);
+		memcpy(combined + ctx->qpack_enc_hold_length, bytes, bytes_max - bytes);
+		free(ctx->qpack_enc_hold);
+		ctx->qpack_enc_hold = NULL;
+		ctx->qpack_enc_hold_length = 0;
+		buffer = combined;
+		buffer_max = combined + total;
+	}
+
+	parsed = h3zero_parse_qpack_encoder_stream(buffer, buffer_max, &ctx->qpack_dec_table, error_found);
+
+	if (parsed == NULL) {
+		bytes = NULL;
+	}
+	else if (parsed < buffer_max) {
+		/* hold the bytes of the incomplete instruction */
+		size_t remain = buffer_max - parsed;
+
+		if (remain > H3ZERO_QPACK_HOLD_MAX ||
+			(ctx->qpack_enc_hold = (uint8_t*)malloc(remain)) == NULL) {
+			*error_found = (remain > H3ZERO_QPACK_HOLD_MAX) ?
+				H3ZERO_QPACK_ENCODER_STREAM_ERROR : H3ZERO_INTERNAL_ERROR;
+			bytes = NULL;
+		}
+		else {
+			memcpy(ctx->qpack_enc_hold, parsed, remain);
+			ctx->qpack_enc_hold_length = remain;
+			bytes = bytes_max;
+		}
+	}
+	else {
+		bytes = bytes_max;
+	}
+
+	if (combined != NULL) {
+		free(combined);
+	}
+
+	if (bytes != NULL && ctx->qpack_dec_table.insert_count > old_insert_count) {
+		(void)h3zero_qpack_send_insert_count_increment(&ctx->qpack_dec_table);
+	}
+
+	return bytes;
+}
+
 uint8_t* h3zero_parse_remote_unidir_stream(
 	uint8_t* bytes, uint8_t* bytes_max,
 	h3zero_stream_ctx_t* stream_ctx,
@@ -561,15 +891,15 @@ uint8_t* h3zero_parse_remote_unidir_stream(
 	}
 	switch (stream_state->stream_type) {
 	case h3zero_stream_type_control: /* used to send/receive setting frame and other control frames. */
-		bytes = h3zero_parse_control_stream(bytes, bytes_max, stream_state, ctx, error_found);
+		bytes = h3zero_parse_control_stream(stream_ctx->cnx, bytes, bytes_max, stream_state, ctx, error_found);
 		break;
 	case h3zero_stream_type_push: /* Push type not supported in current implementation */
 		bytes = bytes_max;
 		break;
-	case h3zero_stream_type_qpack_encoder: /* not required since not using dynamic table */
-		bytes = bytes_max;
+	case h3zero_stream_type_qpack_encoder: /* dynamic table instructions from the peer's encoder */
+		bytes = h3zero_receive_qpack_encoder_stream(bytes, bytes_max, ctx, error_found);
 		break;
-	case h3zero_stream_type_qpack_decoder: /* not required since not using dynamic table */
+	case h3zero_stream_type_qpack_decoder: /* peer acknowledgements; nothing to track, as we encode with the static table only */
 		bytes = bytes_max;
 		break;
 	case h3zero_stream_type_webtransport: /* unidir stream is used as specified in web transport */
@@ -629,6 +959,25 @@ uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
 		size_t frame_type_length;
 		size_t frame_header_length;
 
+		if (stream_state->frame_header_read == 0) {
+			/* Fast path: after reassembly the type and length varints
+			 * are almost always contiguous in the current chunk. Copy
+			 * the whole frame header at once instead of byte by byte;
+			 * the decoding below then completes without looping. */
+			size_t fast_type_length = h3zero_varint_skip(bytes);
+
+			if (bytes + fast_type_length < bytes_max) {
+				size_t fast_header_length = fast_type_length + h3zero_varint_skip(bytes + fast_type_length);
+
+				if (bytes + fast_header_length <= bytes_max &&
+					fast_header_length <= sizeof(stream_state->frame_header)) {
+					memcpy(stream_state->frame_header, bytes, fast_header_length);
+					stream_state->frame_header_read = fast_header_length;
+					bytes += fast_header_length;
+				}
+			}
+		}
+
 		if (stream_state->frame_header_read < 1) {
 			stream_state->frame_header[stream_state->frame_header_read++] = *bytes++;
 		}
@@ -746,13 +1095,20 @@ uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
 						stream_state->trailer_found = stream_state->header_found;
 						stream_state->header_found = 1;
 						/* parse */
-						parsed = h3zero_parse_qpack_header_frame(stream_state->current_frame,
-							stream_state->current_frame + stream_state->current_frame_length, parts);
+						parsed = h3zero_parse_qpack_header_frame_ex(stream_state->current_frame,
+							stream_state->current_frame + stream_state->current_frame_length, parts,
+							(stream_state->h3_ctx != NULL) ? &stream_state->h3_ctx->qpack_dec_table : NULL);
 						if (parsed == NULL || (size_t)(parsed - stream_state->current_frame) != stream_state->current_frame_length) {
 							/* protocol error */
-							*error_found = H3ZERO_FRAME_ERROR;
+							*error_found = (stream_state->h3_ctx != NULL &&
+								stream_state->h3_ctx->qpack_dec_table.max_capacity > 0) ?
+								H3ZERO_QPACK_DECOMPRESSION_FAILED : H3ZERO_FRAME_ERROR;
 							bytes = NULL;
 						}
+						else if (parts->required_insert_count > 0) {
+							/* the section used the dynamic table; acknowledge once the stream id is known */
+							stream_state->qpack_ack_pending = 1;
+						}
 						/* free resource */
 						stream_state->frame_header_parsed = 0;
 						stream_state->frame_header_read = 0;
@@ -801,12 +1157,15 @@ h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters
 	if (ctx != NULL) {
 		memset(ctx, 0, sizeof(h3zero_callback_ctx_t));
 
+		ctx->local_control_stream_id = UINT64_MAX;
 		h3zero_init_stream_tree(&ctx->h3_stream_tree);
 
 		if (param != NULL) {
 			ctx->path_table = param->path_table;
 			ctx->path_table_nb = param->path_table_nb;
 			ctx->web_folder = param->web_folder;
+			ctx->file_cache = param->file_cache;
+			h3zero_qpack_dyntable_init(&ctx->qpack_dec_table, param->qpack_max_table_capacity);
 		}
 	}
 
@@ -815,8 +1174,18 @@ h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters
 
 void h3zero_callback_delete_context(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx)
 {
+	h3zero_stream_ctx_t* free_ctx;
+
 	h3zero_delete_all_stream_prefixes(cnx, ctx);
 	picosplay_empty_tree(&ctx->h3_stream_tree);
+	while ((free_ctx = ctx->stream_ctx_free_list) != NULL) {
+		ctx->stream_ctx_free_list = free_ctx->next_free_ctx;
+		free(free_ctx);
+	}
+	h3zero_qpack_dyntable_release(&ctx->qpack_dec_table);
+	if (ctx->qpack_enc_hold != NULL) {
+		free(ctx->qpack_enc_hold);
+	}
 	free(ctx);
 }
 
@@ -981,6 +1350,16 @@ h3zero_content_type_enum h3zero_get_content_type_by_path(const char *path) {
 * This function is called after the client's stream is closed,
 * after verifying that a request was received */
 
+/* Map the RFC 9218 extended priority of a request onto the transport
+* stream priority. Lower picoquic priority values are served first and
+* the low bit selects FIFO scheduling, so urgency levels 0..7 map to
+* 2..16 (leaving 0 and 1 to the H3 control streams) and incremental
+* responses use round robin scheduling within their level. */
+uint8_t h3zero_map_extended_priority(const h3zero_header_parts_t* header)
+{
+	return (uint8_t)(((header->priority_urgency + 1) << 1) | (header->priority_incremental ? 0 : 1));
+}
+
 int h3zero_process_request_frame(
 	picoquic_cnx_t* cnx,
 	h3zero_stream_ctx_t * stream_ctx,
@@ -998,6 +1377,17 @@ int h3zero_process_request_frame(
 	*o_bytes++ = h3zero_frame_header;
 	o_bytes += 2; /* reserve two bytes for frame length */
 
+	/* The transport scheduler fills the pacing credit across all
+	* active streams in one pass, lowest priority value first, so
+	* mapping the client's extended priority onto the stream priority
+	* is all that is needed to serve concurrent responses in the
+	* requested order. Applied before the response is queued so that
+	* small buffered responses are scheduled accordingly too. */
+	if (stream_ctx->ps.stream_state.header.priority_set) {
+		(void)picoquic_set_stream_priority(cnx, stream_ctx->stream_id,
+			h3zero_map_extended_priority(&stream_ctx->ps.stream_state.header));
+	}
+
 	if (stream_ctx->ps.stream_state.header.method == h3zero_method_get) {
 		/* Manage GET */
 		if (h3zero_server_parse_path(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length,
@@ -1011,6 +1401,14 @@ int h3zero_process_request_frame(
 			/* TODO: consider known-url?data construct */
 		}
 		else {
+			if (stream_ctx->echo_length > 0 && app_ctx->file_cache != NULL) {
+				/* Serve the response from the file cache; the entry
+				 * keeps the mapping valid until the stream is done. */
+				stream_ctx->cache_entry = h3zero_filecache_get(app_ctx->file_cache, stream_ctx->file_path);
+				if (stream_ctx->cache_entry != NULL) {
+					stream_ctx->echo_length = stream_ctx->cache_entry->data_length;
+				}
+			}
 			response_length = (stream_ctx->echo_length == 0) ?
 				strlen(h3zero_server_default_page) : stream_ctx->echo_length;
 			o_bytes = h3zero_create_response_header_frame(o_bytes, o_bytes_max,
@@ -1211,6 +1609,10 @@ int h3zero_process_h3_server_data(picoquic_cnx_t* cnx,
 
 	while (bytes < bytes_max) {
 		bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->ps.stream_state, &available_data, &error_found);
+		if (bytes != NULL && stream_ctx->ps.stream_state.qpack_ack_pending) {
+			stream_ctx->ps.stream_state.qpack_ack_pending = 0;
+			(void)h3zero_qpack_send_section_ack(&ctx->qpack_dec_table, stream_id);
+		}
 		if (bytes == NULL) {
 			ret = picoquic_close(cnx, error_found);
 			break;
@@ -1310,6 +1712,10 @@ int h3zero_process_h3_client_data(picoquic_cnx_t* cnx,
 		int header_required = !stream_ctx->ps.stream_state.header_found;
 		while (bytes < bytes_max) {
 			bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->ps.stream_state, &available_data, &error_found);
+			if (bytes != NULL && stream_ctx->ps.stream_state.qpack_ack_pending) {
+				stream_ctx->ps.stream_state.qpack_ack_pending = 0;
+				(void)h3zero_qpack_send_section_ack(&ctx->qpack_dec_table, stream_id);
+			}
 			if (bytes == NULL) {
 				ret = picoquic_close(cnx, error_found);
 				if (ret != 0) {
@@ -1401,6 +1807,19 @@ int h3zero_callback_data(picoquic_cnx_t* cnx,
 			stream_ctx = h3zero_find_stream(ctx, stream_id);
 		}
 		else {
+			if (!cnx->client_mode && IS_BIDIR_STREAM_ID(stream_id)) {
+				if (ctx->is_goaway_sent && stream_id >= ctx->goaway_stream_id &&
+					h3zero_find_stream(ctx, stream_id) == NULL) {
+					/* Draining: requests past the GOAWAY point are
+					 * rejected, so the client retries them elsewhere. */
+					(void)picoquic_stop_sending(cnx, stream_id, H3ZERO_REQUEST_REJECTED);
+					(void)picoquic_reset_stream(cnx, stream_id, H3ZERO_REQUEST_REJECTED);
+					return 0;
+				}
+				if (stream_id + 4 > ctx->next_client_stream_id) {
+					ctx->next_client_stream_id = stream_id + 4;
+				}
+			}
 			stream_ctx = h3zero_find_or_create_stream(cnx, stream_id, ctx, 1, 1);
 		}
 		if (stream_ctx == NULL) {
@@ -1512,12 +1931,44 @@ int h3zero_prepare_to_send_buffer(void* context, size_t space,
 	return ret;
 }
 
+/* Variant of h3zero_prepare_to_send_buffer sending from a memory
+* resident copy of the file, e.g. a file cache mapping: the bytes are
+* copied once, straight from the mapping into the packet buffer. */
+int h3zero_prepare_to_send_memory(void* context, size_t space,
+	uint64_t echo_length, uint64_t* echo_sent, const uint8_t* data)
+{
+	int ret = 0;
+
+	if (*echo_sent < echo_length) {
+		uint8_t* buffer;
+		uint64_t available = echo_length - *echo_sent;
+		int is_fin = 1;
+
+		if (available > space) {
+			available = space;
+			is_fin = 0;
+		}
+
+		buffer = picoquic_provide_stream_data_buffer(context, (size_t)available, is_fin, !is_fin);
+		if (buffer != NULL) {
+			memcpy(buffer, data + (size_t)*echo_sent, (size_t)available);
+			*echo_sent += available;
+		}
+		else {
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
 int h3zero_prepare_to_send(int client_mode, void* context, size_t space,
 	h3zero_stream_ctx_t* stream_ctx)
 {
 	int ret = 0;
 
-	if (!client_mode && stream_ctx->F == NULL && stream_ctx->file_path != NULL) {
+	if (!client_mode && stream_ctx->cache_entry == NULL &&
+		stream_ctx->F == NULL && stream_ctx->file_path != NULL) {
 		stream_ctx->F = picoquic_file_open(stream_ctx->file_path, "rb");
 		if (stream_ctx->F == NULL) {
 			ret = -1;
@@ -1528,6 +1979,10 @@ int h3zero_prepare_to_send(int client_mode, void* context, size_t space,
 		if (client_mode) {
 			ret = h3zero_prepare_to_send_buffer(context, space, stream_ctx->post_size, &stream_ctx->post_sent, NULL);
 		}
+		else if (stream_ctx->cache_entry != NULL) {
+			ret = h3zero_prepare_to_send_memory(context, space, stream_ctx->echo_length, &stream_ctx->echo_sent,
+				stream_ctx->cache_entry->data);
+		}
 		else {
 			ret = h3zero_prepare_to_send_buffer(context, space, stream_ctx->echo_length, &stream_ctx->echo_sent,
 				stream_ctx->F);
@@ -1590,6 +2045,98 @@ int h3zero_callback_prepare_to_send(picoquic_cnx_t* cnx,
 *  automatically include the quarter stream ID corresponding to the context.
 */
 
+#define H3ZERO_DATAGRAM_BATCH_COUNT_MAX 64
+#define H3ZERO_DATAGRAM_BATCH_BUFFER_SIZE 0x4000
+
+int h3zero_set_datagram_batch_mode(h3zero_callback_ctx_t* ctx, uint64_t prefix,
+	size_t nb_datagrams_max, size_t batch_buffer_size)
+{
+	int ret = 0;
+	h3zero_stream_prefix_t* prefix_ctx = h3zero_find_stream_prefix(ctx, prefix);
+
+	if (prefix_ctx == NULL || prefix_ctx->dg_batch_buffer != NULL) {
+		ret = -1;
+	}
+	else {
+		if (nb_datagrams_max == 0) {
+			nb_datagrams_max = H3ZERO_DATAGRAM_BATCH_COUNT_MAX;
+		}
+		if (batch_buffer_size == 0) {
+			batch_buffer_size = H3ZERO_DATAGRAM_BATCH_BUFFER_SIZE;
+		}
+		prefix_ctx->dg_batch_buffer = (uint8_t*)malloc(batch_buffer_size);
+		prefix_ctx->dg_batch_vec = (h3zero_datagram_vec_t*)malloc(nb_datagrams_max * sizeof(h3zero_datagram_vec_t));
+		if (prefix_ctx->dg_batch_buffer == NULL || prefix_ctx->dg_batch_vec == NULL) {
+			if (prefix_ctx->dg_batch_buffer != NULL) {
+				free(prefix_ctx->dg_batch_buffer);
+				prefix_ctx->dg_batch_buffer = NULL;
+			}
+			if (prefix_ctx->dg_batch_vec != NULL) {
+				free(prefix_ctx->dg_batch_vec);
+				prefix_ctx->dg_batch_vec = NULL;
+			}
+			ret = -1;
+		}
+		else {
+			prefix_ctx->dg_batch_buffer_size = batch_buffer_size;
+			prefix_ctx->dg_batch_count_max = nb_datagrams_max;
+			prefix_ctx->dg_batch_bytes = 0;
+			prefix_ctx->dg_batch_count = 0;
+		}
+	}
+	return ret;
+}
+
+static void h3zero_datagram_batch_flush_prefix(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+	h3zero_stream_prefix_t* prefix_ctx)
+{
+	if (prefix_ctx->dg_batch_count > 0) {
+		h3zero_stream_ctx_t* stream_ctx = h3zero_find_stream(h3_ctx, prefix_ctx->prefix);
+
+		if (stream_ctx != NULL && prefix_ctx->function_call != NULL) {
+			prefix_ctx->function_call(cnx, (uint8_t*)prefix_ctx->dg_batch_vec, prefix_ctx->dg_batch_count,
+				picohttp_callback_post_datagram_batch, stream_ctx, prefix_ctx->function_ctx);
+		}
+		prefix_ctx->dg_batch_count = 0;
+		prefix_ctx->dg_batch_bytes = 0;
+	}
+}
+
+void h3zero_datagram_batch_flush(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx, uint64_t prefix)
+{
+	h3zero_stream_prefix_t* prefix_ctx = h3zero_find_stream_prefix(ctx, prefix);
+
+	if (prefix_ctx != NULL && prefix_ctx->dg_batch_buffer != NULL) {
+		h3zero_datagram_batch_flush_prefix(cnx, ctx, prefix_ctx);
+	}
+}
+
+/* Append a received datagram to the batch of its prefix, flushing the
+* pending batch first if it is full. Datagrams larger than the batch
+* buffer are delivered through the per datagram callback instead. */
+static void h3zero_datagram_batch_append(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+	h3zero_stream_prefix_t* prefix_ctx, h3zero_stream_ctx_t* stream_ctx, uint8_t* bytes, size_t length)
+{
+	if (length > prefix_ctx->dg_batch_buffer_size) {
+		h3zero_datagram_batch_flush_prefix(cnx, h3_ctx, prefix_ctx);
+		prefix_ctx->function_call(cnx, bytes, length, picohttp_callback_post_datagram, stream_ctx, prefix_ctx->function_ctx);
+	}
+	else {
+		if (prefix_ctx->dg_batch_count >= prefix_ctx->dg_batch_count_max ||
+			prefix_ctx->dg_batch_bytes + length > prefix_ctx->dg_batch_buffer_size) {
+			h3zero_datagram_batch_flush_prefix(cnx, h3_ctx, prefix_ctx);
+		}
+		memcpy(prefix_ctx->dg_batch_buffer + prefix_ctx->dg_batch_bytes, bytes, length);
+		prefix_ctx->dg_batch_vec[prefix_ctx->dg_batch_count].bytes = prefix_ctx->dg_batch_buffer + prefix_ctx->dg_batch_bytes;
+		prefix_ctx->dg_batch_vec[prefix_ctx->dg_batch_count].length = length;
+		prefix_ctx->dg_batch_bytes += length;
+		prefix_ctx->dg_batch_count++;
+		if (prefix_ctx->dg_batch_count >= prefix_ctx->dg_batch_count_max) {
+			h3zero_datagram_batch_flush_prefix(cnx, h3_ctx, prefix_ctx);
+		}
+	}
+}
+
 int h3zero_callback_datagram(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length, h3zero_callback_ctx_t* h3_ctx)
 {
 	int ret = 0;
@@ -1608,6 +2155,8 @@ int h3zero_callback_datagram(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
 			h3zero_stream_ctx_t* stream_ctx = h3zero_find_stream(h3_ctx, prefix_ctx->prefix);
 			if (stream_ctx == NULL) {
 				/* Application is not yet ready -- just ignore the datagram */
+			} else if (prefix_ctx->dg_batch_buffer != NULL) {
+				h3zero_datagram_batch_append(cnx, h3_ctx, prefix_ctx, stream_ctx, bytes, bytes_max - bytes);
 			} else {
 				prefix_ctx->function_call(cnx, bytes, bytes_max - bytes, picohttp_callback_post_datagram, stream_ctx, prefix_ctx->function_ctx);
 			}
@@ -1783,7 +2332,7 @@ int h3zero_callback(picoquic_cnx_t* cnx,
 		}
 		else {
 			picoquic_set_callback(cnx, h3zero_callback, ctx);
-			ret = h3zero_protocol_init(cnx);
+			ret = h3zero_protocol_init_ex(cnx, ctx);
 		}
 	} else{
 		ctx = (h3zero_callback_ctx_t*)callback_ctx;
@@ -2015,6 +2564,25 @@ const uint8_t* h3zero_accumulate_capsule(const uint8_t* bytes, const uint8_t* by
 		size_t length_of_type = 0;
 		size_t length_of_length = 0;
 
+		if (capsule->header_read == 0 && bytes < bytes_max) {
+			/* Fast path: the capsule type and length varints are
+			 * almost always contiguous in the current chunk. Copy the
+			 * whole capsule header at once instead of byte by byte;
+			 * the decoding below then completes without looping. */
+			size_t fast_type_length = VARINT_LEN_T(bytes, size_t);
+
+			if (bytes + fast_type_length < bytes_max) {
+				size_t fast_header_length = fast_type_length + VARINT_LEN_T((bytes + fast_type_length), size_t);
+
+				if (bytes + fast_header_length <= bytes_max &&
+					fast_header_length <= sizeof(capsule->header_buffer)) {
+					memcpy(capsule->header_buffer, bytes, fast_header_length);
+					capsule->header_read = fast_header_length;
+					bytes += fast_header_length;
+				}
+			}
+		}
+
 		/* Decode T and L from input buffer */
 		if (capsule->header_read < 1) {
 			capsule->header_buffer[capsule->header_read++] = *bytes++;
@@ -42,6 +42,9 @@ extern "C" {
         picohttp_callback_post_fin, /* All posted data have been received on this stream */
         picohttp_callback_provide_data, /* Stack is ready to send chunk of data on stream N */
         picohttp_callback_post_datagram, /* Datagram received on this context */
+        picohttp_callback_post_datagram_batch, /* Batch of datagrams received. The bytes argument
+                                                * points to an array of h3zero_datagram_vec_t,
+                                                * the length argument is the number of entries */
         picohttp_callback_provide_datagram, /* Ready to send datagram in this context */
         picohttp_callback_reset, /* Stream has been abandoned by peer. */
         picohttp_callback_deregister, /* Context has been deregistered */
@@ -115,6 +118,8 @@ extern "C" {
         /* File state variables, used by both cclient and server */
         char* file_path;
         FILE* F;
+        struct st_h3zero_filecache_entry_t* cache_entry; /* reference on the cached file served on this stream */
+        struct st_h3zero_stream_ctx_t* next_free_ctx; /* chaining in the recycling list, only valid once deleted */
     } h3zero_stream_ctx_t;
 
     /* Parsing of a data stream. This is implemented as a filter, with a set of states:
@@ -164,6 +169,13 @@ extern "C" {
     const uint8_t* h3zero_settings_components_decode(const uint8_t* bytes, const uint8_t* bytes_max, h3zero_settings_t* settings);
     const uint8_t* h3zero_settings_decode(const uint8_t* bytes, const uint8_t* bytes_max, h3zero_settings_t* settings);
 
+    /* Entry in a datagram batch, delivered through the
+     * picohttp_callback_post_datagram_batch event. */
+    typedef struct st_h3zero_datagram_vec_t {
+        const uint8_t* bytes;
+        size_t length;
+    } h3zero_datagram_vec_t;
+
     /* Handling of stream prefixes, for applications that use it.
      */
     typedef struct st_h3zero_stream_prefix_t {
@@ -173,6 +185,15 @@ extern "C" {
         unsigned int ready_to_send_datagrams : 1;
         picohttp_post_data_cb_fn function_call;
         void* function_ctx;
+        /* Datagram batching, when enabled. Received datagrams are
+         * copied in the batch buffer and delivered in a single vector
+         * callback when the batch is full or explicitly flushed. */
+        uint8_t* dg_batch_buffer;
+        size_t dg_batch_buffer_size;
+        size_t dg_batch_bytes;
+        size_t dg_batch_count;
+        size_t dg_batch_count_max;
+        h3zero_datagram_vec_t* dg_batch_vec;
     } h3zero_stream_prefix_t;
 
     typedef struct st_h3zero_stream_prefixes_t {
@@ -181,6 +202,33 @@ extern "C" {
     } h3zero_stream_prefixes_t;
 
     int h3zero_protocol_init(picoquic_cnx_t* cnx);
+    /* Variant used by the h3zero callback: announces the QPACK dynamic
+     * table capacity configured in the context, and remembers the local
+     * decoder stream, so dynamic table updates can be acknowledged. */
+    int h3zero_protocol_init_ex(picoquic_cnx_t* cnx, struct st_h3zero_callback_ctx_t* ctx);
+
+    /* QPACK decoder stream instructions, sent to the peer's encoder */
+    int h3zero_qpack_send_insert_count_increment(h3zero_qpack_dyntable_t* table);
+    int h3zero_qpack_send_section_ack(h3zero_qpack_dyntable_t* table, uint64_t stream_id);
+
+    /* Graceful connection draining for zero downtime restarts.
+     *
+     * h3zero_send_goaway sends an H3 GOAWAY frame on the local control
+     * stream, announcing the lowest client request stream that will not
+     * be processed; later requests are rejected with
+     * H3ZERO_REQUEST_REJECTED, so a well behaved client retries them on
+     * a new connection. h3zero_quic_drain_begin sends the GOAWAY on
+     * every H3 connection of a quic context. The server then calls
+     * h3zero_quic_drain_check from its event loop: connections whose
+     * in flight responses have completed are closed with H3ZERO_NO_ERROR,
+     * remaining ones are closed once current_time passes the deadline,
+     * and the call returns 1 when no H3 connection is left. Session
+     * resumption survives the restart through the configured ticket
+     * encryption key, which lets the new instance decrypt previously
+     * issued tickets. */
+    int h3zero_send_goaway(picoquic_cnx_t* cnx, struct st_h3zero_callback_ctx_t* ctx);
+    int h3zero_quic_drain_begin(picoquic_quic_t* quic);
+    int h3zero_quic_drain_check(picoquic_quic_t* quic, uint64_t current_time, uint64_t deadline);
 
     /* CLIENT DEFINITIONS 
      */
@@ -194,6 +242,8 @@ extern "C" {
         char const* web_folder;
         picohttp_server_path_item_t* path_table;
         size_t path_table_nb;
+        struct st_h3zero_filecache_t* file_cache; /* optional cache of static files, see h3zero_filecache.h */
+        uint64_t qpack_max_table_capacity; /* QPACK dynamic table capacity announced to the peer, 0 = static only */
     } picohttp_server_parameters_t;
 
     typedef struct st_h3zero_callback_ctx_t {
@@ -201,8 +251,13 @@ extern "C" {
         picohttp_server_path_item_t * path_table;
         size_t path_table_nb;
         char const* web_folder;
+        struct st_h3zero_filecache_t* file_cache;
         /* Settings */
         h3zero_settings_t settings;
+        /* QPACK dynamic table, fed by the peer's encoder stream */
+        h3zero_qpack_dyntable_t qpack_dec_table;
+        uint8_t* qpack_enc_hold; /* bytes of a partially received encoder instruction */
+        size_t qpack_enc_hold_length;
         /* connection wide tracking of stream prefixes */
         h3zero_stream_prefixes_t stream_prefixes;
         uint64_t last_datagram_prefix;
@@ -213,6 +268,22 @@ extern "C" {
         int nb_open_streams;
         int nb_open_files;
         uint32_t nb_client_streams;
+        /* Recycling of stream contexts, to avoid malloc and free churn
+         * when the application opens many short lived streams */
+        struct st_h3zero_stream_ctx_t* stream_ctx_free_list;
+        size_t nb_stream_ctx_free;
+        /* Stream context accounting, for sizing the recycling list */
+        size_t nb_stream_ctx_live; /* contexts currently in the stream tree */
+        size_t nb_stream_ctx_high_water; /* largest value of nb_stream_ctx_live */
+        size_t nb_stream_ctx_allocated; /* contexts obtained from malloc */
+        size_t nb_stream_ctx_recycled; /* contexts served from the free list */
+        /* Graceful drain state (H3 GOAWAY) */
+        uint64_t local_control_stream_id;
+        uint64_t goaway_stream_id; /* lowest client stream id refused after sending GOAWAY */
+        uint64_t peer_goaway_stream_id; /* id announced in a GOAWAY received from the peer */
+        uint64_t next_client_stream_id; /* next client request stream the server expects */
+        unsigned int is_goaway_sent : 1;
+        unsigned int is_goaway_received : 1;
     } h3zero_callback_ctx_t;
 
     h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters_t* param);
@@ -242,6 +313,19 @@ extern "C" {
     h3zero_content_type_enum h3zero_get_content_type_by_path(const char *path);
 
     int h3zero_set_datagram_ready(picoquic_cnx_t* cnx, uint64_t stream_id);
+    int h3zero_callback_datagram(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length, h3zero_callback_ctx_t* h3_ctx);
+    /* Map the RFC 9218 extended priority of a request onto the
+     * transport stream priority used by the scheduler. */
+    uint8_t h3zero_map_extended_priority(const h3zero_header_parts_t* header);
+    /* Enable batch delivery of datagrams on a stream prefix. Received
+     * datagrams are accumulated and delivered in a single
+     * picohttp_callback_post_datagram_batch callback when either
+     * nb_datagrams_max are pending, the batch buffer is full, or
+     * h3zero_datagram_batch_flush is called. Pass 0 to use the default
+     * batch size and buffer size. */
+    int h3zero_set_datagram_batch_mode(h3zero_callback_ctx_t* ctx, uint64_t prefix,
+        size_t nb_datagrams_max, size_t batch_buffer_size);
+    void h3zero_datagram_batch_flush(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx, uint64_t prefix);
     void h3zero_receive_datagram_capsule(picoquic_cnx_t* cnx, h3zero_stream_ctx_t* stream_ctx, h3zero_capsule_t* capsule, h3zero_callback_ctx_t* h3_ctx);
     uint8_t* h3zero_provide_datagram_buffer(void* context, size_t length, int ready_to_send);
 
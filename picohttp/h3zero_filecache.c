@@ -0,0 +1,267 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Cache of static response files for the h3zero server, see
+* h3zero_filecache.h. The cache is a doubly linked list in least
+* recently used order, which also serves as the lookup structure: a
+* static web folder holds at most a few hundred files, and a linear
+* scan of the list is cheap compared to the syscalls it replaces.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "h3zero_filecache.h"
+
+#ifndef _WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+h3zero_filecache_t* h3zero_filecache_create(uint64_t byte_budget)
+{
+    h3zero_filecache_t* cache = (h3zero_filecache_t*)malloc(sizeof(h3zero_filecache_t));
+
+    if (cache != NULL) {
+        memset(cache, 0, sizeof(h3zero_filecache_t));
+        cache->byte_budget = byte_budget;
+    }
+
+    return cache;
+}
+
+static void h3zero_filecache_entry_free(h3zero_filecache_entry_t* entry)
+{
+    if (entry->data != NULL) {
+#ifndef _WINDOWS
+        if (entry->is_mapped) {
+            (void)munmap(entry->data, entry->data_length);
+        }
+        else
+#endif
+        {
+            free(entry->data);
+        }
+    }
+    free(entry->file_path);
+    free(entry);
+}
+
+static void h3zero_filecache_unlink(h3zero_filecache_t* cache, h3zero_filecache_entry_t* entry)
+{
+    if (entry->lru_previous == NULL) {
+        cache->lru_first = entry->lru_next;
+    }
+    else {
+        entry->lru_previous->lru_next = entry->lru_next;
+    }
+    if (entry->lru_next == NULL) {
+        cache->lru_last = entry->lru_previous;
+    }
+    else {
+        entry->lru_next->lru_previous = entry->lru_previous;
+    }
+    entry->lru_previous = NULL;
+    entry->lru_next = NULL;
+}
+
+static void h3zero_filecache_link_first(h3zero_filecache_t* cache, h3zero_filecache_entry_t* entry)
+{
+    entry->lru_previous = NULL;
+    entry->lru_next = cache->lru_first;
+    if (cache->lru_first != NULL) {
+        cache->lru_first->lru_previous = entry;
+    }
+    cache->lru_first = entry;
+    if (cache->lru_last == NULL) {
+        cache->lru_last = entry;
+    }
+}
+
+/* Evict the least recently used unreferenced entries until the cache
+* fits its byte budget. Entries still referenced by a stream are
+* skipped; they are unmapped when the last reference is released. */
+static void h3zero_filecache_trim(h3zero_filecache_t* cache)
+{
+    h3zero_filecache_entry_t* entry = cache->lru_last;
+
+    while (entry != NULL && cache->cached_bytes > cache->byte_budget) {
+        h3zero_filecache_entry_t* previous = entry->lru_previous;
+
+        if (entry->nb_references == 0) {
+            h3zero_filecache_unlink(cache, entry);
+            cache->cached_bytes -= entry->data_length;
+            h3zero_filecache_entry_free(entry);
+        }
+        entry = previous;
+    }
+}
+
+/* Load the file content, by mapping it read only, or by reading it
+* into the heap on Windows. */
+static int h3zero_filecache_load(h3zero_filecache_entry_t* entry, const char* file_path)
+{
+    int ret = 0;
+#ifndef _WINDOWS
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd < 0) {
+        ret = -1;
+    }
+    else {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || st.st_size < 0) {
+            ret = -1;
+        }
+        else {
+            entry->data_length = (size_t)st.st_size;
+            if (entry->data_length > 0) {
+                entry->data = (uint8_t*)mmap(NULL, entry->data_length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (entry->data == MAP_FAILED) {
+                    entry->data = NULL;
+                    ret = -1;
+                }
+                else {
+                    entry->is_mapped = 1;
+                }
+            }
+        }
+        (void)close(fd);
+    }
+#else
+    FILE* F = picoquic_file_open(file_path, "rb");
+
+    if (F == NULL) {
+        ret = -1;
+    }
+    else {
+        long file_size;
+
+        if (fseek(F, 0, SEEK_END) != 0 ||
+            (file_size = ftell(F)) < 0 ||
+            fseek(F, 0, SEEK_SET) != 0) {
+            ret = -1;
+        }
+        else {
+            entry->data_length = (size_t)file_size;
+            if (entry->data_length > 0) {
+                entry->data = (uint8_t*)malloc(entry->data_length);
+                if (entry->data == NULL ||
+                    fread(entry->data, 1, entry->data_length, F) != entry->data_length) {
+                    ret = -1;
+                }
+            }
+        }
+        (void)picoquic_file_close(F);
+    }
+#endif
+
+    return ret;
+}
+
+h3zero_filecache_entry_t* h3zero_filecache_get(h3zero_filecache_t* cache, const char* file_path)
+{
+    h3zero_filecache_entry_t* entry = NULL;
+
+    if (cache == NULL || file_path == NULL) {
+        return NULL;
+    }
+
+    for (entry = cache->lru_first; entry != NULL; entry = entry->lru_next) {
+        if (strcmp(entry->file_path, file_path) == 0) {
+            break;
+        }
+    }
+
+    if (entry != NULL) {
+        cache->nb_hits++;
+        /* Move to the front of the LRU list */
+        h3zero_filecache_unlink(cache, entry);
+        h3zero_filecache_link_first(cache, entry);
+    }
+    else {
+        cache->nb_misses++;
+        entry = (h3zero_filecache_entry_t*)malloc(sizeof(h3zero_filecache_entry_t));
+        if (entry != NULL) {
+            memset(entry, 0, sizeof(h3zero_filecache_entry_t));
+            entry->cache = cache;
+            entry->file_path = picoquic_string_duplicate(file_path);
+            if (entry->file_path == NULL ||
+                h3zero_filecache_load(entry, file_path) != 0) {
+                h3zero_filecache_entry_free(entry);
+                entry = NULL;
+            }
+            else {
+                h3zero_filecache_link_first(cache, entry);
+                cache->cached_bytes += entry->data_length;
+                h3zero_filecache_trim(cache);
+            }
+        }
+    }
+
+    if (entry != NULL) {
+        entry->nb_references++;
+    }
+
+    return entry;
+}
+
+void h3zero_filecache_release(h3zero_filecache_entry_t* entry)
+{
+    if (entry != NULL && entry->nb_references > 0) {
+        entry->nb_references--;
+        if (entry->nb_references == 0) {
+            if (entry->is_evicted) {
+                h3zero_filecache_entry_free(entry);
+            }
+            else {
+                h3zero_filecache_trim(entry->cache);
+            }
+        }
+    }
+}
+
+void h3zero_filecache_delete(h3zero_filecache_t* cache)
+{
+    if (cache != NULL) {
+        h3zero_filecache_entry_t* entry = cache->lru_first;
+
+        while (entry != NULL) {
+            h3zero_filecache_entry_t* next = entry->lru_next;
+
+            if (entry->nb_references == 0) {
+                h3zero_filecache_entry_free(entry);
+            }
+            else {
+                /* Still referenced by a stream; freed on last release */
+                entry->lru_previous = NULL;
+                entry->lru_next = NULL;
+                entry->is_evicted = 1;
+            }
+            entry = next;
+        }
+        free(cache);
+    }
+}
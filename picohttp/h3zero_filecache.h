@@ -0,0 +1,75 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef H3ZERO_FILECACHE_H
+#define H3ZERO_FILECACHE_H
+/* Cache of static response files for the h3zero server. Files are
+* mapped in memory (read into the heap on Windows) and handed out as
+* reference counted entries, so the data callbacks send straight from
+* the mapping instead of going through stdio for every request. The
+* cache keeps entries in least recently used order and evicts the
+* oldest unreferenced entries when the configured byte budget is
+* exceeded; an entry evicted while still referenced is unmapped when
+* the last reference is released.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct st_h3zero_filecache_entry_t {
+    struct st_h3zero_filecache_entry_t* lru_previous; /* towards the most recently used */
+    struct st_h3zero_filecache_entry_t* lru_next; /* towards the least recently used */
+    struct st_h3zero_filecache_t* cache;
+    char* file_path;
+    uint8_t* data;
+    size_t data_length;
+    int nb_references;
+    unsigned int is_mapped : 1; /* mmap'ed, vs. read into the heap */
+    unsigned int is_evicted : 1; /* removed from the cache, free on last release */
+} h3zero_filecache_entry_t;
+
+typedef struct st_h3zero_filecache_t {
+    h3zero_filecache_entry_t* lru_first; /* most recently used */
+    h3zero_filecache_entry_t* lru_last; /* least recently used */
+    uint64_t byte_budget;
+    uint64_t cached_bytes;
+    uint64_t nb_hits;
+    uint64_t nb_misses;
+} h3zero_filecache_t;
+
+h3zero_filecache_t* h3zero_filecache_create(uint64_t byte_budget);
+void h3zero_filecache_delete(h3zero_filecache_t* cache);
+
+/* Look up or load a file, returning a referenced entry, or NULL if the
+* file cannot be opened. The reference must be released with
+* h3zero_filecache_release; the entry data stays valid until then, even
+* if the entry is evicted in the meantime. */
+h3zero_filecache_entry_t* h3zero_filecache_get(h3zero_filecache_t* cache, const char* file_path);
+void h3zero_filecache_release(h3zero_filecache_entry_t* entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* H3ZERO_FILECACHE_H */
@@ -0,0 +1,348 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Relay between two connections, see h3zero_relay.h for the model.
+*
+* Each direction is a ring buffer. The receive callback of one
+* connection fills the ring; the prepare-to-send callback of the other
+* connection drains it directly into the outgoing packet through
+* picoquic_provide_stream_data_buffer, so the staged bytes are copied
+* exactly once between decryption and re-encryption. If the ring
+* overflows -- the receive callback cannot hold bytes back -- the ring
+* content and then the overflow are flushed into the outgoing stream's
+* send queue, which preserves ordering because picoquic always drains
+* a stream's send queue before polling its active-stream callback.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "h3zero.h"
+#include "h3zero_common.h"
+#include "h3zero_relay.h"
+
+/* Map the source connection of a receive event to the pipe that
+* carries its bytes, or the polled connection of a send event to the
+* pipe that feeds it. */
+static h3zero_relay_pipe_t* h3zero_relay_pipe_from_source(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx)
+{
+    return (cnx == relay->cnx_in) ? &relay->upstream : &relay->downstream;
+}
+
+static h3zero_relay_pipe_t* h3zero_relay_pipe_to_sink(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx)
+{
+    return (cnx == relay->cnx_out) ? &relay->upstream : &relay->downstream;
+}
+
+static h3zero_relay_dg_queue_t* h3zero_relay_dg_from_source(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx)
+{
+    return (cnx == relay->cnx_in) ? &relay->dg_upstream : &relay->dg_downstream;
+}
+
+static h3zero_relay_dg_queue_t* h3zero_relay_dg_to_sink(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx)
+{
+    return (cnx == relay->cnx_out) ? &relay->dg_upstream : &relay->dg_downstream;
+}
+
+/* Flush the ring into the sink's send queue. Used on overflow, and
+* when the sink stream cannot be marked active. */
+static int h3zero_relay_pipe_flush(h3zero_relay_pipe_t* pipe, int set_fin)
+{
+    int ret = 0;
+
+    while (ret == 0 && pipe->fill > 0) {
+        size_t chunk = H3ZERO_RELAY_PIPE_SIZE - pipe->read_index;
+        if (chunk > pipe->fill) {
+            chunk = pipe->fill;
+        }
+        ret = picoquic_add_to_stream(pipe->cnx_to, pipe->stream_id_to,
+            pipe->ring + pipe->read_index, chunk, 0);
+        if (ret == 0) {
+            pipe->read_index = (pipe->read_index + chunk) % H3ZERO_RELAY_PIPE_SIZE;
+            pipe->fill -= chunk;
+            pipe->nb_bytes_relayed += chunk;
+            pipe->nb_bytes_spilled += chunk;
+        }
+    }
+    if (ret == 0 && set_fin && !pipe->is_fin_sent) {
+        ret = picoquic_add_to_stream(pipe->cnx_to, pipe->stream_id_to, NULL, 0, 1);
+        if (ret == 0) {
+            pipe->is_fin_sent = 1;
+        }
+    }
+    return ret;
+}
+
+/* Receive bytes from the source connection. Stage them in the ring and
+* mark the sink stream active; on overflow fall back to the send queue. */
+static int h3zero_relay_pipe_recv(h3zero_relay_pipe_t* pipe, const uint8_t* bytes, size_t length, int is_fin)
+{
+    int ret = 0;
+
+    if (pipe->is_closed) {
+        return 0;
+    }
+    if (is_fin) {
+        pipe->is_fin_received = 1;
+    }
+
+    while (ret == 0 && length > 0) {
+        if (pipe->fill < H3ZERO_RELAY_PIPE_SIZE) {
+            size_t write_index = (pipe->read_index + pipe->fill) % H3ZERO_RELAY_PIPE_SIZE;
+            size_t chunk = H3ZERO_RELAY_PIPE_SIZE - pipe->fill;
+            if (chunk > H3ZERO_RELAY_PIPE_SIZE - write_index) {
+                chunk = H3ZERO_RELAY_PIPE_SIZE - write_index;
+            }
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(pipe->ring + write_index, bytes, chunk);
+            pipe->fill += chunk;
+            bytes += chunk;
+            length -= chunk;
+        }
+        else {
+            /* The sink is a full buffer behind. Flush the ring and then
+            * the remainder through the send queue, in order. */
+            ret = h3zero_relay_pipe_flush(pipe, 0);
+            if (ret == 0 && length > 0) {
+                ret = picoquic_add_to_stream(pipe->cnx_to, pipe->stream_id_to, bytes, length, 0);
+                if (ret == 0) {
+                    pipe->nb_bytes_relayed += length;
+                    pipe->nb_bytes_spilled += length;
+                    length = 0;
+                }
+            }
+        }
+    }
+
+    if (ret == 0 && !pipe->is_fin_sent) {
+        ret = picoquic_mark_active_stream(pipe->cnx_to, pipe->stream_id_to, 1,
+            pipe->stream_ctx_to);
+        if (ret == PICOQUIC_ERROR_CANNOT_SET_ACTIVE_STREAM) {
+            /* Fin or reset already requested on the sink, e.g. by the
+            * spill path above; nothing left to schedule. */
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+/* Drain the ring into the packet buffer offered by the stack. */
+static int h3zero_relay_pipe_provide(h3zero_relay_pipe_t* pipe, void* context, size_t space)
+{
+    int ret = 0;
+    size_t available = pipe->fill;
+    int is_fin;
+    int more_to_send;
+    uint8_t* buffer;
+
+    if (pipe->is_closed || pipe->is_fin_sent) {
+        (void)picoquic_provide_stream_data_buffer(context, 0, 0, 0);
+        return 0;
+    }
+    if (available > space) {
+        available = space;
+    }
+    is_fin = (pipe->is_fin_received && available == pipe->fill);
+    more_to_send = (available < pipe->fill);
+    buffer = picoquic_provide_stream_data_buffer(context, available, is_fin, more_to_send);
+    if (buffer == NULL) {
+        ret = (available > 0 || is_fin) ? -1 : 0;
+    }
+    else {
+        size_t copied = 0;
+        while (copied < available) {
+            size_t chunk = H3ZERO_RELAY_PIPE_SIZE - pipe->read_index;
+            if (chunk > available - copied) {
+                chunk = available - copied;
+            }
+            memcpy(buffer + copied, pipe->ring + pipe->read_index, chunk);
+            pipe->read_index = (pipe->read_index + chunk) % H3ZERO_RELAY_PIPE_SIZE;
+            pipe->fill -= chunk;
+            copied += chunk;
+        }
+        pipe->nb_bytes_relayed += available;
+        if (is_fin) {
+            pipe->is_fin_sent = 1;
+        }
+    }
+    return ret;
+}
+
+/* Park a datagram for the sink direction. Datagrams are droppable, so
+* a full queue drops the new arrival rather than blocking. */
+static int h3zero_relay_dg_recv(h3zero_relay_dg_queue_t* queue,
+    h3zero_relay_pipe_t* pipe, const uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+
+    if (length > H3ZERO_RELAY_DATAGRAM_MAX ||
+        queue->count >= H3ZERO_RELAY_DATAGRAM_QUEUE_MAX) {
+        queue->nb_datagrams_dropped++;
+    }
+    else {
+        size_t slot_index = (queue->first + queue->count) % H3ZERO_RELAY_DATAGRAM_QUEUE_MAX;
+        memcpy(queue->slot[slot_index], bytes, length);
+        queue->length[slot_index] = length;
+        queue->count++;
+        ret = h3zero_set_datagram_ready(pipe->cnx_to, pipe->stream_id_to);
+    }
+    return ret;
+}
+
+static int h3zero_relay_dg_provide(h3zero_relay_dg_queue_t* queue, void* context, size_t space)
+{
+    int ret = 0;
+
+    if (queue->count > 0 && queue->length[queue->first] <= space) {
+        uint8_t* buffer = h3zero_provide_datagram_buffer(context,
+            queue->length[queue->first], queue->count > 1);
+        if (buffer == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(buffer, queue->slot[queue->first], queue->length[queue->first]);
+            queue->first = (queue->first + 1) % H3ZERO_RELAY_DATAGRAM_QUEUE_MAX;
+            queue->count--;
+            queue->nb_datagrams_relayed++;
+        }
+    }
+    return ret;
+}
+
+/* Peer abandoned one side: propagate the reset and stop both pipes. */
+static void h3zero_relay_reset(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx)
+{
+    h3zero_relay_pipe_t* pipe = h3zero_relay_pipe_from_source(relay, cnx);
+
+    if (!pipe->is_closed && !pipe->is_fin_sent) {
+        (void)picoquic_reset_stream(pipe->cnx_to, pipe->stream_id_to, H3ZERO_NO_ERROR);
+    }
+    relay->upstream.is_closed = 1;
+    relay->downstream.is_closed = 1;
+}
+
+static void h3zero_relay_detach(h3zero_relay_ctx_t* relay, struct st_h3zero_stream_ctx_t* stream_ctx)
+{
+    if (stream_ctx != NULL && stream_ctx->path_callback_ctx == relay) {
+        stream_ctx->path_callback = NULL;
+        stream_ctx->path_callback_ctx = NULL;
+    }
+    if (relay->upstream.stream_ctx_to == stream_ctx) {
+        relay->upstream.stream_ctx_to = NULL;
+        relay->upstream.is_closed = 1;
+    }
+    if (relay->downstream.stream_ctx_to == stream_ctx) {
+        relay->downstream.stream_ctx_to = NULL;
+        relay->downstream.is_closed = 1;
+    }
+    if (relay->nb_attached > 0) {
+        relay->nb_attached--;
+    }
+    if (relay->nb_attached == 0) {
+        free(relay);
+    }
+}
+
+h3zero_relay_ctx_t* h3zero_relay_create(
+    picoquic_cnx_t* cnx_in, h3zero_stream_ctx_t* stream_ctx_in,
+    picoquic_cnx_t* cnx_out, h3zero_stream_ctx_t* stream_ctx_out)
+{
+    h3zero_relay_ctx_t* relay = NULL;
+
+    if (cnx_in != NULL && stream_ctx_in != NULL && cnx_out != NULL && stream_ctx_out != NULL &&
+        (relay = (h3zero_relay_ctx_t*)malloc(sizeof(h3zero_relay_ctx_t))) != NULL) {
+        memset(relay, 0, sizeof(h3zero_relay_ctx_t));
+        relay->cnx_in = cnx_in;
+        relay->cnx_out = cnx_out;
+        relay->upstream.cnx_to = cnx_out;
+        relay->upstream.stream_ctx_to = stream_ctx_out;
+        relay->upstream.stream_id_to = stream_ctx_out->stream_id;
+        relay->downstream.cnx_to = cnx_in;
+        relay->downstream.stream_ctx_to = stream_ctx_in;
+        relay->downstream.stream_id_to = stream_ctx_in->stream_id;
+        relay->nb_attached = 2;
+        stream_ctx_in->path_callback = h3zero_relay_callback;
+        stream_ctx_in->path_callback_ctx = relay;
+        stream_ctx_out->path_callback = h3zero_relay_callback;
+        stream_ctx_out->path_callback_ctx = relay;
+    }
+    return relay;
+}
+
+void h3zero_relay_delete(h3zero_relay_ctx_t* relay)
+{
+    if (relay != NULL) {
+        h3zero_relay_detach(relay, relay->downstream.stream_ctx_to);
+        if (relay->nb_attached > 0) {
+            h3zero_relay_detach(relay, relay->upstream.stream_ctx_to);
+        }
+    }
+}
+
+int h3zero_relay_callback(picoquic_cnx_t* cnx,
+    uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t fin_or_event,
+    h3zero_stream_ctx_t* stream_ctx,
+    void* path_app_ctx)
+{
+    int ret = 0;
+    h3zero_relay_ctx_t* relay = (h3zero_relay_ctx_t*)path_app_ctx;
+
+    if (relay == NULL) {
+        return -1;
+    }
+
+    switch (fin_or_event) {
+    case picohttp_callback_post_data:
+    case picohttp_callback_post_fin:
+        ret = h3zero_relay_pipe_recv(h3zero_relay_pipe_from_source(relay, cnx),
+            bytes, length, fin_or_event == picohttp_callback_post_fin);
+        break;
+    case picohttp_callback_provide_data:
+        ret = h3zero_relay_pipe_provide(h3zero_relay_pipe_to_sink(relay, cnx),
+            bytes, length);
+        break;
+    case picohttp_callback_post_datagram:
+        ret = h3zero_relay_dg_recv(h3zero_relay_dg_from_source(relay, cnx),
+            h3zero_relay_pipe_from_source(relay, cnx), bytes, length);
+        break;
+    case picohttp_callback_provide_datagram:
+        ret = h3zero_relay_dg_provide(h3zero_relay_dg_to_sink(relay, cnx),
+            bytes, length);
+        break;
+    case picohttp_callback_reset:
+        h3zero_relay_reset(relay, cnx);
+        break;
+    case picohttp_callback_free:
+    case picohttp_callback_deregister:
+        h3zero_relay_detach(relay, stream_ctx);
+        break;
+    default:
+        /* Connect negotiation events are handled by the proxy
+        * application before the relay is created. */
+        break;
+    }
+    return ret;
+}
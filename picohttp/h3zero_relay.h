@@ -0,0 +1,118 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef H3ZERO_RELAY_H
+#define H3ZERO_RELAY_H
+/* Relay facility for proxies built on h3zero's CONNECT handling.
+* A relay binds a stream (and the datagram flow attached to it) on an
+* incoming connection to a stream on an outgoing connection, so that
+* proxied bytes are decrypted once, staged once in a per-direction
+* loan buffer, and re-encrypted once: the drain side writes straight
+* into the outgoing packet through the "prepare to send" callback,
+* there is no per-chunk allocation and no intermediate queue on the
+* fast path.
+*
+* The relay implements the picohttp path callback interface on both
+* sides. A CONNECT (or CONNECT-UDP) handler creates the relay once the
+* outgoing connection and stream are set up; the relay then installs
+* itself as the path callback of both stream contexts and manages its
+* own lifetime: it frees itself when both sides have been released.
+*
+* Datagram relaying assumes the usual CONNECT-UDP plumbing: both
+* control streams are declared as stream prefixes, so datagram events
+* are routed to the relay callback with the relay as path_app_ctx.
+*/
+
+#include "h3zero.h"
+#include "h3zero_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the per-direction loan buffer. When the outgoing connection
+* falls more than a full buffer behind, the overflow spills into the
+* outgoing stream's send queue (a copy), preserving byte order. */
+#define H3ZERO_RELAY_PIPE_SIZE 0x10000
+/* Datagrams parked per direction while waiting for send credit. The
+* queue is deliberately short: datagrams are droppable, and parking
+* more of them only adds latency. */
+#define H3ZERO_RELAY_DATAGRAM_QUEUE_MAX 8
+#define H3ZERO_RELAY_DATAGRAM_MAX PICOQUIC_MAX_PACKET_SIZE
+
+    /* One direction of the relay: bytes received from one connection,
+    * staged in the ring, drained into packets of the other. */
+    typedef struct st_h3zero_relay_pipe_t {
+        picoquic_cnx_t* cnx_to;
+        struct st_h3zero_stream_ctx_t* stream_ctx_to;
+        uint64_t stream_id_to;
+        size_t read_index;
+        size_t fill;
+        uint64_t nb_bytes_relayed;
+        uint64_t nb_bytes_spilled; /* bytes sent through the send queue fallback */
+        unsigned int is_fin_received : 1;
+        unsigned int is_fin_sent : 1;
+        unsigned int is_closed : 1;
+        uint8_t ring[H3ZERO_RELAY_PIPE_SIZE];
+    } h3zero_relay_pipe_t;
+
+    typedef struct st_h3zero_relay_dg_queue_t {
+        size_t first;
+        size_t count;
+        uint64_t nb_datagrams_relayed;
+        uint64_t nb_datagrams_dropped;
+        size_t length[H3ZERO_RELAY_DATAGRAM_QUEUE_MAX];
+        uint8_t slot[H3ZERO_RELAY_DATAGRAM_QUEUE_MAX][H3ZERO_RELAY_DATAGRAM_MAX];
+    } h3zero_relay_dg_queue_t;
+
+    typedef struct st_h3zero_relay_ctx_t {
+        picoquic_cnx_t* cnx_in;
+        picoquic_cnx_t* cnx_out;
+        h3zero_relay_pipe_t upstream; /* incoming connection towards outgoing */
+        h3zero_relay_pipe_t downstream;
+        h3zero_relay_dg_queue_t dg_upstream;
+        h3zero_relay_dg_queue_t dg_downstream;
+        int nb_attached; /* sides not yet released; relay frees itself at zero */
+    } h3zero_relay_ctx_t;
+
+    /* Create a relay between stream_ctx_in on cnx_in and stream_ctx_out
+    * on cnx_out, and install the relay callback on both stream contexts.
+    * Returns NULL on allocation failure. */
+    h3zero_relay_ctx_t* h3zero_relay_create(
+        picoquic_cnx_t* cnx_in, struct st_h3zero_stream_ctx_t* stream_ctx_in,
+        picoquic_cnx_t* cnx_out, struct st_h3zero_stream_ctx_t* stream_ctx_out);
+
+    /* Release the relay regardless of the attachment count, e.g. when
+    * the proxy tears both connections down. */
+    void h3zero_relay_delete(h3zero_relay_ctx_t* relay);
+
+    /* Path callback, installed on both stream contexts by
+    * h3zero_relay_create. path_app_ctx is the relay context. */
+    int h3zero_relay_callback(picoquic_cnx_t* cnx,
+        uint8_t* bytes, size_t length,
+        picohttp_call_back_event_t fin_or_event,
+        struct st_h3zero_stream_ctx_t* stream_ctx,
+        void* path_app_ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* H3ZERO_RELAY_H */
@@ -87,13 +87,58 @@ extern "C" {
     void picowt_deregister(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx, h3zero_stream_ctx_t* control_stream_ctx);
 
     /**
-    * Create local stream: when a stream is created locally. 
+    * Create local stream: when a stream is created locally.
     * Send the stream header. Associate the stream with a per_stream
     * app context.
     */
     h3zero_stream_ctx_t* picowt_create_local_stream(picoquic_cnx_t* cnx, int is_bidir, h3zero_callback_ctx_t* h3_ctx,
         uint64_t control_stream_id);
 
+    /* Create a batch of local streams in a single call, filling the
+    * vector with the new stream contexts. The contexts come from the
+    * recycling list of the h3 context when available, so repeated
+    * batches of short lived streams do not allocate per stream.
+    *
+    * When stream_priority is not zero it is applied to every stream in
+    * the batch; setting the same priority with a zero low order bit
+    * (round robin) lets the transport scheduler interleave the batch
+    * streams, so several small streams share a packet instead of each
+    * triggering its own. Pass zero to keep the default priority.
+    *
+    * On failure the streams created so far are deleted and the call
+    * returns -1. */
+    int picowt_create_local_streams(picoquic_cnx_t* cnx, int is_bidir, h3zero_callback_ctx_t* h3_ctx,
+        uint64_t control_stream_id, uint8_t stream_priority,
+        size_t nb_streams, h3zero_stream_ctx_t** stream_ctx_vec);
+
+    /* Queue a batch of datagrams on a web transport session in a single
+    * call. Each entry of the vector is prefixed with the quarter stream
+    * ID of the session's control stream and queued for sending; the
+    * connection is woken up once for the whole batch. On return,
+    * nb_queued is set to the number of datagrams actually queued. The
+    * call stops and returns an error at the first datagram that cannot
+    * be queued, e.g. if the prefixed length exceeds
+    * PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH.
+    */
+    int picowt_queue_datagrams(picoquic_cnx_t* cnx, h3zero_stream_ctx_t* control_stream_ctx,
+        size_t nb_datagrams, const h3zero_datagram_vec_t* vec, size_t* nb_queued);
+
+    /* Enable batch delivery of the session's datagrams: instead of one
+    * picohttp_callback_post_datagram callback per datagram, received
+    * datagrams are accumulated and delivered in a single
+    * picohttp_callback_post_datagram_batch callback, whose bytes
+    * argument points to an array of h3zero_datagram_vec_t and whose
+    * length argument is the number of entries. The batch is delivered
+    * when nb_datagrams_max datagrams are pending, when the batch buffer
+    * fills up, or when the application calls picowt_flush_datagrams,
+    * e.g. at the end of its processing tick. Pass 0 for the default
+    * batch size and buffer size.
+    */
+    int picowt_set_datagram_batch_mode(h3zero_callback_ctx_t* h3_ctx, h3zero_stream_ctx_t* control_stream_ctx,
+        size_t nb_datagrams_max, size_t batch_buffer_size);
+    void picowt_flush_datagrams(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+        h3zero_stream_ctx_t* control_stream_ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -554,6 +554,85 @@ size_t quicperf_prepare_media_request_bytes(quicperf_stream_ctx_t* stream_ctx, u
  *
  */
 
+/* Log-linear latency histogram. The first QUICPERF_HISTOGRAM_NB_SUB
+* buckets record small values exactly; after that, each power of two
+* range is divided in QUICPERF_HISTOGRAM_NB_SUB linear sub buckets. */
+
+static size_t quicperf_histogram_bucket(uint64_t value)
+{
+    size_t index;
+
+    if (value < QUICPERF_HISTOGRAM_NB_SUB) {
+        index = (size_t)value;
+    }
+    else {
+        int shift = 0;
+        uint64_t v = value;
+
+        while (v >= 2 * QUICPERF_HISTOGRAM_NB_SUB) {
+            v >>= 1;
+            shift++;
+        }
+        index = (size_t)((shift + 1) * QUICPERF_HISTOGRAM_NB_SUB + (v - QUICPERF_HISTOGRAM_NB_SUB));
+    }
+    if (index >= QUICPERF_HISTOGRAM_NB_BUCKETS) {
+        index = QUICPERF_HISTOGRAM_NB_BUCKETS - 1;
+    }
+    return index;
+}
+
+/* Upper bound of the values mapped to a bucket */
+static uint64_t quicperf_histogram_bucket_max(size_t index)
+{
+    uint64_t value_max;
+
+    if (index < 2 * QUICPERF_HISTOGRAM_NB_SUB) {
+        value_max = (uint64_t)index;
+    }
+    else {
+        int shift = (int)(index / QUICPERF_HISTOGRAM_NB_SUB) - 1;
+        uint64_t sub = (uint64_t)(index % QUICPERF_HISTOGRAM_NB_SUB);
+
+        value_max = (((QUICPERF_HISTOGRAM_NB_SUB + sub + 1) << shift) - 1);
+    }
+    return value_max;
+}
+
+void quicperf_histogram_record(quicperf_histogram_t* hist, uint64_t value)
+{
+    hist->buckets[quicperf_histogram_bucket(value)] += 1;
+    hist->nb_samples += 1;
+    hist->sum_values += value;
+    if (hist->nb_samples == 1 || value < hist->min_value) {
+        hist->min_value = value;
+    }
+    if (value > hist->max_value) {
+        hist->max_value = value;
+    }
+}
+
+uint64_t quicperf_histogram_quantile(const quicperf_histogram_t* hist, double quantile)
+{
+    uint64_t value = 0;
+
+    if (hist->nb_samples > 0) {
+        uint64_t target = (uint64_t)(quantile * (double)hist->nb_samples);
+        uint64_t count = 0;
+
+        if (target >= hist->nb_samples) {
+            target = hist->nb_samples - 1;
+        }
+        for (size_t i = 0; i < QUICPERF_HISTOGRAM_NB_BUCKETS; i++) {
+            count += hist->buckets[i];
+            if (count > target) {
+                value = quicperf_histogram_bucket_max(i);
+                break;
+            }
+        }
+    }
+    return value;
+}
+
 quicperf_stream_ctx_t* quicperf_find_stream_ctx(quicperf_ctx_t* ctx, uint64_t stream_id)
 {
     quicperf_stream_ctx_t target;
@@ -568,6 +647,7 @@ quicperf_ctx_t* quicperf_create_ctx(const char* scenario_text)
 
     if (ctx != NULL) {
         memset(ctx, 0, sizeof(quicperf_ctx_t));
+        ctx->time_series_interval = 1000000;
 
         if (scenario_text != NULL) {
             if (quicperf_parse_scenario_desc(scenario_text, &ctx->nb_scenarios, &ctx->scenarios) == 0 &&
@@ -630,6 +710,7 @@ quicperf_stream_ctx_t* quicperf_init_batch_stream_from_scenario(picoquic_cnx_t*
         stream_ctx->rep_number = rep_number;
         stream_ctx->post_size = stream_desc->post_size;
         stream_ctx->response_size = stream_desc->response_size;
+        stream_ctx->post_time = picoquic_get_quic_time(picoquic_get_quic_ctx(cnx));
 
         if (stream_desc->is_infinite) {
             stream_ctx->stop_for_fin = 1;
@@ -994,6 +1075,8 @@ int quicperf_receive_batch_data(picoquic_cnx_t* cnx, quicperf_ctx_t* ctx, quicpe
                 ret = picoquic_stop_sending(cnx, stream_ctx->stream_id, 0);
                 stream_ctx->is_stopped = 1;
                 stream_ctx->is_closed = 1;
+                quicperf_histogram_record(&ctx->latency_histogram,
+                    picoquic_get_quic_time(picoquic_get_quic_ctx(cnx)) - stream_ctx->post_time);
             }
         }
         else if (fin_or_event == picoquic_callback_stream_fin) {
@@ -1008,6 +1091,8 @@ int quicperf_receive_batch_data(picoquic_cnx_t* cnx, quicperf_ctx_t* ctx, quicpe
             ret = picoquic_close(cnx, QUICPERF_ERROR_NOT_ENOUGH_DATA_SENT);
         }
         else {
+            quicperf_histogram_record(&ctx->latency_histogram,
+                picoquic_get_quic_time(picoquic_get_quic_ctx(cnx)) - stream_ctx->post_time);
             picoquic_reset_stream_ctx(cnx,stream_ctx->stream_id);
         }
     }
@@ -1066,6 +1151,7 @@ void quicperf_receive_media_data(picoquic_cnx_t* cnx, quicperf_ctx_t* ctx, quicp
                 if (rtt > report->max_delays) {
                     report->max_delays = rtt;
                 }
+                quicperf_histogram_record(&ctx->latency_histogram, rtt);
 
                 if (ctx->report_file != NULL) {
                     if (ctx->scenarios[stream_ctx->stream_desc_index].id[0] != 0) {
@@ -1473,6 +1559,39 @@ int quicperf_stop_sending_stream(picoquic_cnx_t* cnx, quicperf_ctx_t* ctx, quicp
     return 0;
 }
 
+/* Time series reporting. When a time series file is set, write one CSV
+* row per elapsed interval: end of interval relative to the first
+* observed event, bytes sent and received during the interval, number
+* of open streams, and the smoothed RTT, so warmup and steady state can
+* be told apart without post-processing qlog. Intervals without any
+* callback activity are reported when the next event arrives. */
+static void quicperf_time_series_check(quicperf_ctx_t* ctx, picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (ctx->time_series_file != NULL) {
+        if (ctx->time_series_next_time == 0) {
+            fprintf(ctx->time_series_file, "time,bytes_sent,bytes_received,nb_streams_open,rtt\n");
+            ctx->time_series_start = current_time;
+            ctx->time_series_next_time = current_time + ctx->time_series_interval;
+            ctx->time_series_data_sent = ctx->data_sent;
+            ctx->time_series_data_received = ctx->data_received;
+        }
+        else {
+            while (current_time >= ctx->time_series_next_time) {
+                fprintf(ctx->time_series_file,
+                    "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%zu,%" PRIu64 "\n",
+                    ctx->time_series_next_time - ctx->time_series_start,
+                    ctx->data_sent - ctx->time_series_data_sent,
+                    ctx->data_received - ctx->time_series_data_received,
+                    ctx->nb_open_streams,
+                    picoquic_get_rtt(cnx));
+                ctx->time_series_data_sent = ctx->data_sent;
+                ctx->time_series_data_received = ctx->data_received;
+                ctx->time_series_next_time += ctx->time_series_interval;
+            }
+        }
+    }
+}
+
 int quicperf_callback(picoquic_cnx_t* cnx,
     uint64_t stream_id, uint8_t* bytes, size_t length,
     picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
@@ -1497,6 +1616,10 @@ int quicperf_callback(picoquic_cnx_t* cnx,
     ctx->last_interaction_time = picoquic_get_quic_time(picoquic_get_quic_ctx(cnx));
     ctx->progress_observed = 1;
 
+    if (ctx->is_client) {
+        quicperf_time_series_check(ctx, cnx, ctx->last_interaction_time);
+    }
+
     switch (fin_or_event) {
     case picoquic_callback_stream_data:
     case picoquic_callback_stream_fin:
@@ -1613,5 +1736,15 @@ int quicperf_print_report(FILE* F, quicperf_ctx_t* quicperf_ctx)
         }
     }
 
+    if (ret == 0 && quicperf_ctx->latency_histogram.nb_samples > 0) {
+        quicperf_histogram_t* hist = &quicperf_ctx->latency_histogram;
+
+        ret |= fprintf(F, "Latency over %" PRIu64 " samples, min/mean/max = %" PRIu64 "/ %" PRIu64 "/ %" PRIu64
+            ", p50/p90/p99/p999 = %" PRIu64 "/ %" PRIu64 "/ %" PRIu64 "/ %" PRIu64 ".\n",
+            hist->nb_samples, hist->min_value, hist->sum_values / hist->nb_samples, hist->max_value,
+            quicperf_histogram_quantile(hist, 0.5), quicperf_histogram_quantile(hist, 0.9),
+            quicperf_histogram_quantile(hist, 0.99), quicperf_histogram_quantile(hist, 0.999)) <= 0;
+    }
+
     return ret;
 }
\ No newline at end of file
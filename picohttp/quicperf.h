@@ -120,6 +120,27 @@ typedef struct st_quicperf_stream_ctx {
     unsigned int is_closed : 1;
 } quicperf_stream_ctx_t;
 
+/* HDR style log-linear histogram of latencies, in microseconds. Values
+* below QUICPERF_HISTOGRAM_NB_SUB are recorded exactly; above that, each
+* power of two range is divided in QUICPERF_HISTOGRAM_NB_SUB linear sub
+* buckets, bounding the relative error of a quantile to 1/NB_SUB. The
+* 2048 buckets cover the full range of 64 bit microsecond values. */
+#define QUICPERF_HISTOGRAM_NB_SUB 32
+#define QUICPERF_HISTOGRAM_NB_BUCKETS 2048
+
+typedef struct st_quicperf_histogram_t {
+    uint64_t buckets[QUICPERF_HISTOGRAM_NB_BUCKETS];
+    uint64_t nb_samples;
+    uint64_t min_value;
+    uint64_t max_value;
+    uint64_t sum_values;
+} quicperf_histogram_t;
+
+void quicperf_histogram_record(quicperf_histogram_t* hist, uint64_t value);
+/* Return the upper bound of the bucket holding the requested quantile,
+* e.g. 0.5 for the median, 0.999 for p999. Returns 0 if no samples. */
+uint64_t quicperf_histogram_quantile(const quicperf_histogram_t* hist, double quantile);
+
 typedef struct st_quicperf_ctx_t {
     int is_client;
     int progress_observed;
@@ -141,10 +162,21 @@ typedef struct st_quicperf_ctx_t {
     int datagram_is_activated;
     /* Reporting file if available */
     FILE* report_file;
+    /* Time series file if available. One CSV row is written per
+    * interval: end of interval (microseconds since first event),
+    * bytes sent and received during the interval, number of open
+    * streams, and smoothed RTT. */
+    FILE* time_series_file;
+    uint64_t time_series_interval; /* microseconds, set to 1 second by default */
+    uint64_t time_series_start; /* time of the first observed event */
+    uint64_t time_series_next_time;
+    uint64_t time_series_data_sent; /* totals at the last emitted row */
+    uint64_t time_series_data_received;
     /* Statistics gathered on client */
     uint64_t data_sent;
     uint64_t data_received;
     uint64_t nb_streams;
+    quicperf_histogram_t latency_histogram; /* batch request and media frame latencies */
 } quicperf_ctx_t;
 
 quicperf_ctx_t* quicperf_create_ctx(const char* scenario_text);
@@ -156,6 +188,43 @@ int quicperf_callback(picoquic_cnx_t* cnx,
 
 int quicperf_print_report(FILE* F, quicperf_ctx_t* quicperf_ctx);
 
+/* Load generation mode: run the configured scenario on nb_connections
+* client connections spread over nb_threads threads, each thread owning
+* its own QUIC context and packet loop. At most nb_parallel connections
+* are in flight per thread. If arrival_interval is zero the threads run
+* a closed loop, replacing each completed connection immediately;
+* otherwise a new connection is started every arrival_interval
+* microseconds (open loop). If max_duration is non zero, the run is
+* stopped after that many microseconds even if connections remain. */
+typedef struct st_quicperf_load_config_t {
+    const char* server_name;
+    int server_port;
+    const char* sni;
+    const char* scenario_text;
+    int nb_threads;
+    int nb_connections; /* total, across all threads */
+    int nb_parallel; /* per thread, 0 means 1 */
+    uint64_t arrival_interval; /* microseconds, 0 means closed loop */
+    uint64_t max_duration; /* microseconds, 0 means no limit */
+} quicperf_load_config_t;
+
+typedef struct st_quicperf_load_report_t {
+    uint64_t nb_connections_started;
+    uint64_t nb_connections_complete;
+    uint64_t nb_connections_failed;
+    uint64_t data_sent;
+    uint64_t data_received;
+    uint64_t nb_streams;
+    uint64_t start_time;
+    uint64_t end_time;
+    uint64_t sum_connection_time;
+    uint64_t max_connection_time;
+} quicperf_load_report_t;
+
+int quicperf_load_run(const quicperf_load_config_t* config, quicperf_load_report_t* report);
+int quicperf_load_print_report(FILE* F, const quicperf_load_config_t* config,
+    const quicperf_load_report_t* report);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,426 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Multi connection, multi thread load generation mode for quicperf.
+*
+* A single connection driven from one thread cannot saturate a well
+* provisioned server, so the load mode spawns a set of client threads,
+* each with its own picoquic context and packet loop, and drives a
+* number of connections on each of them. Every connection runs the
+* configured quicperf scenario and closes itself when the scenario
+* completes, as usual. Two arrival models are supported:
+*
+* - closed loop (arrival_interval == 0): each thread keeps nb_parallel
+*   connections in flight, starting a replacement as soon as one
+*   completes, until its share of connections has been run;
+* - open loop (arrival_interval > 0): each thread starts a new
+*   connection every arrival_interval microseconds, regardless of
+*   completions, subject to the nb_parallel cap on in flight
+*   connections.
+*
+* The per connection statistics gathered by the quicperf callback are
+* merged into a per thread report when the connection closes, and the
+* per thread reports are merged after the threads are joined.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picosplay.h"
+#include "picosocks.h"
+#include "picoquic_packet_loop.h"
+#include "quicperf.h"
+
+typedef struct st_quicperf_load_cnx_t {
+    struct st_quicperf_load_thread_ctx_t* thread_ctx;
+    picoquic_cnx_t* cnx;
+    quicperf_ctx_t* perf_ctx;
+    uint64_t start_time;
+} quicperf_load_cnx_t;
+
+typedef struct st_quicperf_load_thread_ctx_t {
+    const quicperf_load_config_t* config;
+    picoquic_thread_t thread;
+    picoquic_quic_t* quic;
+    struct sockaddr_storage server_address;
+    quicperf_load_cnx_t* cnx_table; /* nb_parallel slots */
+    int nb_parallel;
+    int nb_assigned; /* this thread's share of the connections */
+    int nb_started;
+    int nb_active;
+    uint64_t next_start_time; /* open loop arrivals */
+    quicperf_load_report_t report;
+    int thread_ret;
+} quicperf_load_thread_ctx_t;
+
+/* Collect the statistics of a completed connection into the thread
+* report. Called from the connection callback on the close event, while
+* the connection and the quicperf context are still valid. */
+static void quicperf_load_collect(quicperf_load_cnx_t* slot, uint64_t current_time)
+{
+    quicperf_load_thread_ctx_t* thread_ctx = slot->thread_ctx;
+    uint64_t duration = current_time - slot->start_time;
+
+    if (picoquic_get_local_error(slot->cnx) != 0 ||
+        picoquic_get_remote_error(slot->cnx) != 0 ||
+        picoquic_get_application_error(slot->cnx) != 0) {
+        thread_ctx->report.nb_connections_failed++;
+    }
+    else {
+        thread_ctx->report.nb_connections_complete++;
+    }
+    thread_ctx->report.data_sent += slot->perf_ctx->data_sent;
+    thread_ctx->report.data_received += slot->perf_ctx->data_received;
+    thread_ctx->report.nb_streams += slot->perf_ctx->nb_streams;
+    thread_ctx->report.sum_connection_time += duration;
+    if (duration > thread_ctx->report.max_connection_time) {
+        thread_ctx->report.max_connection_time = duration;
+    }
+
+    quicperf_delete_ctx(slot->perf_ctx);
+    slot->perf_ctx = NULL;
+    slot->cnx = NULL;
+    thread_ctx->nb_active--;
+}
+
+/* Per connection callback: forward everything to the quicperf client
+* callback, and collect the connection statistics on the close event,
+* which is issued exactly once when the connection disconnects. */
+static int quicperf_load_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    quicperf_load_cnx_t* slot = (quicperf_load_cnx_t*)callback_ctx;
+    int ret = quicperf_callback(cnx, stream_id, bytes, length, fin_or_event,
+        slot->perf_ctx, v_stream_ctx);
+
+    if (fin_or_event == picoquic_callback_close ||
+        fin_or_event == picoquic_callback_application_close ||
+        fin_or_event == picoquic_callback_stateless_reset) {
+        quicperf_load_collect(slot, picoquic_get_quic_time(picoquic_get_quic_ctx(cnx)));
+    }
+
+    return ret;
+}
+
+static int quicperf_load_start_connection(quicperf_load_thread_ctx_t* thread_ctx, uint64_t current_time)
+{
+    int ret = 0;
+    quicperf_load_cnx_t* slot = NULL;
+
+    for (int i = 0; i < thread_ctx->nb_parallel; i++) {
+        if (thread_ctx->cnx_table[i].cnx == NULL) {
+            slot = &thread_ctx->cnx_table[i];
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        ret = -1;
+    }
+    else if ((slot->perf_ctx = quicperf_create_ctx(thread_ctx->config->scenario_text)) == NULL) {
+        ret = -1;
+    }
+    else {
+        slot->cnx = picoquic_create_cnx(thread_ctx->quic,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&thread_ctx->server_address, current_time, 0,
+            thread_ctx->config->sni, QUICPERF_ALPN, 1);
+        if (slot->cnx == NULL) {
+            quicperf_delete_ctx(slot->perf_ctx);
+            slot->perf_ctx = NULL;
+            ret = -1;
+        }
+        else {
+            slot->start_time = current_time;
+            picoquic_set_callback(slot->cnx, quicperf_load_callback, slot);
+            ret = picoquic_start_client_cnx(slot->cnx);
+            if (ret != 0) {
+                picoquic_delete_cnx(slot->cnx);
+                quicperf_delete_ctx(slot->perf_ctx);
+                slot->cnx = NULL;
+                slot->perf_ctx = NULL;
+            }
+            else {
+                thread_ctx->nb_started++;
+                thread_ctx->nb_active++;
+                thread_ctx->report.nb_connections_started++;
+            }
+        }
+    }
+
+    if (ret != 0) {
+        thread_ctx->report.nb_connections_failed++;
+        thread_ctx->nb_started++;
+    }
+
+    return ret;
+}
+
+/* Arrival control, called from the packet loop's time check. Starts
+* connections according to the configured arrival model, and returns
+* the termination code when the thread's share of connections has
+* completed. */
+static int quicperf_load_time_check(quicperf_load_thread_ctx_t* thread_ctx,
+    packet_loop_time_check_arg_t* time_check_arg)
+{
+    int ret = 0;
+    const quicperf_load_config_t* config = thread_ctx->config;
+    uint64_t current_time = time_check_arg->current_time;
+
+    while (thread_ctx->nb_started < thread_ctx->nb_assigned &&
+        thread_ctx->nb_active < thread_ctx->nb_parallel) {
+        if (config->arrival_interval > 0) {
+            /* Open loop: start at the programmed arrival times */
+            if (current_time < thread_ctx->next_start_time) {
+                int64_t delta_t = thread_ctx->next_start_time - current_time;
+
+                if (delta_t < time_check_arg->delta_t) {
+                    time_check_arg->delta_t = delta_t;
+                }
+                break;
+            }
+            (void)quicperf_load_start_connection(thread_ctx, current_time);
+            thread_ctx->next_start_time += config->arrival_interval;
+        }
+        else {
+            /* Closed loop: keep nb_parallel connections in flight */
+            (void)quicperf_load_start_connection(thread_ctx, current_time);
+        }
+    }
+
+    if (thread_ctx->nb_started >= thread_ctx->nb_assigned && thread_ctx->nb_active == 0) {
+        ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+    }
+    else if (config->max_duration > 0 &&
+        current_time >= thread_ctx->report.start_time + config->max_duration) {
+        ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+    }
+
+    return ret;
+}
+
+static int quicperf_load_loop_cb(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    int ret = 0;
+    quicperf_load_thread_ctx_t* thread_ctx = (quicperf_load_thread_ctx_t*)callback_ctx;
+
+    if (thread_ctx == NULL) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        switch (cb_mode) {
+        case picoquic_packet_loop_ready:
+            if (callback_arg != NULL) {
+                ((picoquic_packet_loop_options_t*)callback_arg)->do_time_check = 1;
+            }
+            break;
+        case picoquic_packet_loop_time_check:
+            ret = quicperf_load_time_check(thread_ctx, (packet_loop_time_check_arg_t*)callback_arg);
+            break;
+        case picoquic_packet_loop_after_receive:
+        case picoquic_packet_loop_after_send:
+        case picoquic_packet_loop_port_update:
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static int quicperf_load_thread_run(quicperf_load_thread_ctx_t* thread_ctx)
+{
+    int ret = 0;
+    uint64_t current_time = picoquic_current_time();
+    picoquic_packet_loop_param_t param = { 0 };
+
+    thread_ctx->report.start_time = current_time;
+    thread_ctx->next_start_time = current_time;
+
+    thread_ctx->quic = picoquic_create((uint32_t)thread_ctx->nb_parallel + 1,
+        NULL, NULL, NULL, QUICPERF_ALPN, NULL, NULL, NULL, NULL, NULL,
+        current_time, NULL, NULL, NULL, 0);
+    if (thread_ctx->quic == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_set_null_verifier(thread_ctx->quic);
+        param.local_af = thread_ctx->server_address.ss_family;
+        ret = picoquic_packet_loop_v2(thread_ctx->quic, &param, quicperf_load_loop_cb, thread_ctx);
+        if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+            ret = 0;
+        }
+        /* Account for the connections still in flight if the loop was
+        * stopped by the duration limit or by an error */
+        for (int i = 0; i < thread_ctx->nb_parallel; i++) {
+            if (thread_ctx->cnx_table[i].cnx != NULL) {
+                quicperf_load_collect(&thread_ctx->cnx_table[i], picoquic_current_time());
+            }
+        }
+        picoquic_free(thread_ctx->quic);
+        thread_ctx->quic = NULL;
+    }
+    thread_ctx->report.end_time = picoquic_current_time();
+
+    return ret;
+}
+
+static picoquic_thread_return_t quicperf_load_thread(void* arg)
+{
+    quicperf_load_thread_ctx_t* thread_ctx = (quicperf_load_thread_ctx_t*)arg;
+
+    thread_ctx->thread_ret = quicperf_load_thread_run(thread_ctx);
+
+    picoquic_thread_do_return;
+}
+
+int quicperf_load_run(const quicperf_load_config_t* config, quicperf_load_report_t* report)
+{
+    int ret = 0;
+    int is_name = 0;
+    struct sockaddr_storage server_address;
+    quicperf_load_thread_ctx_t* threads = NULL;
+    int nb_threads;
+
+    memset(report, 0, sizeof(quicperf_load_report_t));
+
+    if (config->server_name == NULL || config->scenario_text == NULL ||
+        config->nb_connections < 1 || config->nb_threads < 1) {
+        return -1;
+    }
+    nb_threads = config->nb_threads;
+    if (nb_threads > config->nb_connections) {
+        nb_threads = config->nb_connections;
+    }
+
+    ret = picoquic_get_server_address(config->server_name, config->server_port,
+        &server_address, &is_name);
+
+    if (ret == 0 &&
+        (threads = (quicperf_load_thread_ctx_t*)malloc(
+            nb_threads * sizeof(quicperf_load_thread_ctx_t))) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        int nb_left = config->nb_connections;
+        int nb_created = 0;
+
+        memset(threads, 0, nb_threads * sizeof(quicperf_load_thread_ctx_t));
+
+        for (int i = 0; ret == 0 && i < nb_threads; i++) {
+            quicperf_load_thread_ctx_t* thread_ctx = &threads[i];
+
+            thread_ctx->config = config;
+            memcpy(&thread_ctx->server_address, &server_address, sizeof(struct sockaddr_storage));
+            thread_ctx->nb_assigned = nb_left / (nb_threads - i);
+            nb_left -= thread_ctx->nb_assigned;
+            thread_ctx->nb_parallel = (config->nb_parallel > 0) ? config->nb_parallel : 1;
+            if (thread_ctx->nb_parallel > thread_ctx->nb_assigned) {
+                thread_ctx->nb_parallel = thread_ctx->nb_assigned;
+            }
+            thread_ctx->cnx_table = (quicperf_load_cnx_t*)malloc(
+                thread_ctx->nb_parallel * sizeof(quicperf_load_cnx_t));
+            if (thread_ctx->cnx_table == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(thread_ctx->cnx_table, 0,
+                    thread_ctx->nb_parallel * sizeof(quicperf_load_cnx_t));
+                for (int s = 0; s < thread_ctx->nb_parallel; s++) {
+                    thread_ctx->cnx_table[s].thread_ctx = thread_ctx;
+                }
+                ret = picoquic_create_thread(&thread_ctx->thread, quicperf_load_thread, thread_ctx);
+                if (ret == 0) {
+                    nb_created++;
+                }
+            }
+        }
+
+        for (int i = 0; i < nb_created; i++) {
+            (void)picoquic_wait_thread(threads[i].thread);
+        }
+
+        /* Merge the per thread reports */
+        for (int i = 0; i < nb_created; i++) {
+            quicperf_load_thread_ctx_t* thread_ctx = &threads[i];
+
+            if (thread_ctx->thread_ret != 0) {
+                ret = -1;
+            }
+            report->nb_connections_started += thread_ctx->report.nb_connections_started;
+            report->nb_connections_complete += thread_ctx->report.nb_connections_complete;
+            report->nb_connections_failed += thread_ctx->report.nb_connections_failed;
+            report->data_sent += thread_ctx->report.data_sent;
+            report->data_received += thread_ctx->report.data_received;
+            report->nb_streams += thread_ctx->report.nb_streams;
+            report->sum_connection_time += thread_ctx->report.sum_connection_time;
+            if (thread_ctx->report.max_connection_time > report->max_connection_time) {
+                report->max_connection_time = thread_ctx->report.max_connection_time;
+            }
+            if (report->start_time == 0 || thread_ctx->report.start_time < report->start_time) {
+                report->start_time = thread_ctx->report.start_time;
+            }
+            if (thread_ctx->report.end_time > report->end_time) {
+                report->end_time = thread_ctx->report.end_time;
+            }
+        }
+
+        for (int i = 0; i < nb_threads; i++) {
+            if (threads[i].cnx_table != NULL) {
+                free(threads[i].cnx_table);
+            }
+        }
+        free(threads);
+    }
+
+    return ret;
+}
+
+int quicperf_load_print_report(FILE* F, const quicperf_load_config_t* config,
+    const quicperf_load_report_t* report)
+{
+    int ret = 0;
+    uint64_t duration = report->end_time - report->start_time;
+    double duration_sec = ((double)duration) / 1000000.0;
+
+    if (fprintf(F, "Threads: %d, connections: %d, %s loop\n",
+        config->nb_threads, config->nb_connections,
+        (config->arrival_interval > 0) ? "open" : "closed") <= 0 ||
+        fprintf(F, "Connections started: %" PRIu64 ", complete: %" PRIu64 ", failed: %" PRIu64 "\n",
+            report->nb_connections_started, report->nb_connections_complete,
+            report->nb_connections_failed) <= 0 ||
+        fprintf(F, "Duration: %f sec, CPS: %f\n", duration_sec,
+            (duration > 0) ? ((double)report->nb_connections_complete) / duration_sec : 0.0) <= 0 ||
+        fprintf(F, "Nb_transactions: %" PRIu64 ", TPS: %f\n", report->nb_streams,
+            (duration > 0) ? ((double)report->nb_streams) / duration_sec : 0.0) <= 0 ||
+        fprintf(F, "Upload_Mbps: %f, Download_Mbps: %f\n",
+            (duration > 0) ? ((double)report->data_sent) * 8.0 / ((double)duration) : 0.0,
+            (duration > 0) ? ((double)report->data_received) * 8.0 / ((double)duration) : 0.0) <= 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
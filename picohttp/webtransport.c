@@ -145,6 +145,38 @@ h3zero_stream_ctx_t* picowt_create_local_stream(picoquic_cnx_t* cnx, int is_bidi
     return(stream_ctx);
 }
 
+int picowt_create_local_streams(picoquic_cnx_t* cnx, int is_bidir, h3zero_callback_ctx_t* h3_ctx,
+    uint64_t control_stream_id, uint8_t stream_priority,
+    size_t nb_streams, h3zero_stream_ctx_t** stream_ctx_vec)
+{
+    int ret = 0;
+    size_t nb_created = 0;
+
+    while (ret == 0 && nb_created < nb_streams) {
+        h3zero_stream_ctx_t* stream_ctx = picowt_create_local_stream(cnx, is_bidir, h3_ctx, control_stream_id);
+
+        if (stream_ctx == NULL) {
+            ret = -1;
+        }
+        else {
+            if (stream_priority != 0) {
+                (void)picoquic_set_stream_priority(cnx, stream_ctx->stream_id, stream_priority);
+            }
+            stream_ctx_vec[nb_created++] = stream_ctx;
+        }
+    }
+
+    if (ret != 0) {
+        while (nb_created > 0) {
+            nb_created--;
+            h3zero_delete_stream(cnx, h3_ctx, stream_ctx_vec[nb_created]);
+            stream_ctx_vec[nb_created] = NULL;
+        }
+    }
+
+    return ret;
+}
+
 
 /* Web transport initiate, client side. Start with two parameters:
 * cnx: an established QUIC connection, set to ALPN=H3.
@@ -457,3 +489,59 @@ void picowt_deregister(picoquic_cnx_t* cnx,
     picoquic_unlink_app_stream_ctx(cnx, control_stream_ctx->stream_id);
     picoquic_log_app_message(cnx, "Prefix for control stream %"PRIu64 " was unregistered", control_stream_id);
 }
+
+/* Batch datagram send. The quarter stream ID of the session's control
+* stream is encoded once, then each datagram of the vector is copied
+* after that prefix and queued, so a fanout of many small datagrams
+* costs one call and one connection wakeup instead of one per datagram.
+*/
+int picowt_queue_datagrams(picoquic_cnx_t* cnx, h3zero_stream_ctx_t* control_stream_ctx,
+    size_t nb_datagrams, const h3zero_datagram_vec_t* vec, size_t* nb_queued)
+{
+    int ret = 0;
+    uint8_t buffer[PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH];
+    uint8_t* prefix_end;
+    size_t prefix_length = 0;
+    size_t nb_sent = 0;
+
+    prefix_end = picoquic_frames_varint_encode(buffer, buffer + sizeof(buffer),
+        control_stream_ctx->stream_id >> 2);
+    if (prefix_end == NULL) {
+        ret = -1;
+    }
+    else {
+        prefix_length = prefix_end - buffer;
+        for (size_t i = 0; ret == 0 && i < nb_datagrams; i++) {
+            if (prefix_length + vec[i].length > sizeof(buffer)) {
+                ret = PICOQUIC_ERROR_DATAGRAM_TOO_LONG;
+            }
+            else {
+                memcpy(buffer + prefix_length, vec[i].bytes, vec[i].length);
+                ret = picoquic_queue_datagram_frame(cnx, prefix_length + vec[i].length, buffer);
+                if (ret == 0) {
+                    nb_sent++;
+                }
+            }
+        }
+    }
+    if (nb_queued != NULL) {
+        *nb_queued = nb_sent;
+    }
+    return ret;
+}
+
+/* Batch datagram delivery. See h3zero_set_datagram_batch_mode: received
+* datagrams are delivered through a single
+* picohttp_callback_post_datagram_batch callback per batch. */
+int picowt_set_datagram_batch_mode(h3zero_callback_ctx_t* h3_ctx, h3zero_stream_ctx_t* control_stream_ctx,
+    size_t nb_datagrams_max, size_t batch_buffer_size)
+{
+    return h3zero_set_datagram_batch_mode(h3_ctx, control_stream_ctx->stream_id,
+        nb_datagrams_max, batch_buffer_size);
+}
+
+void picowt_flush_datagrams(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+    h3zero_stream_ctx_t* control_stream_ctx)
+{
+    h3zero_datagram_batch_flush(cnx, h3_ctx, control_stream_ctx->stream_id);
+}
@@ -52,10 +52,17 @@ static const picoquic_test_def_t test_table[] = {
     { "h3zero_setting_error", h3zero_setting_error_test },
     { "h3zero_capsule", h3zero_capsule_test },
     { "h3zero_client_data", h3zero_client_data_test },
+    { "picowt_datagram_batch", picowt_datagram_batch_test },
+    { "picowt_stream_batch", picowt_stream_batch_test },
+    { "h3zero_goaway", h3zero_goaway_test },
+    { "h3zero_relay", h3zero_relay_test },
+    { "h3zero_priority_update", h3zero_priority_update_test },
     { "qpack_huffman", qpack_huffman_test },
     { "qpack_huffman_base", qpack_huffman_base_test},
     { "h3zero_parse_qpack", h3zero_parse_qpack_test },
     { "h3zero_prepare_qpack", h3zero_prepare_qpack_test },
+    { "qpack_dyntable", qpack_dyntable_test },
+    { "h3zero_priority_header", h3zero_priority_header_test },
     { "h3zero_user_agent", h3zero_user_agent_test },
     { "h3zero_uri", h3zero_uri_test },
     { "h3zero_null_sni", h3zero_null_sni_test },
@@ -64,6 +71,7 @@ static const picoquic_test_def_t test_table[] = {
     { "h3zero_stream_fuzz", h3zero_stream_fuzz_test },
     { "parse_demo_scenario", parse_demo_scenario_test },
     { "h3zero_server", h3zero_server_test },
+    { "h3zero_client_pool", h3zero_client_pool_test },
     { "h09_server", h09_server_test },
     { "h09_header", h09_header_test },
     { "generic_server", generic_server_test },
@@ -75,6 +83,8 @@ static const picoquic_test_def_t test_table[] = {
     { "demo_file_sanitize", demo_file_sanitize_test },
     { "demo_file_access", demo_file_access_test },
     { "demo_server_file", demo_server_file_test },
+    { "demo_server_file_cache", demo_server_file_cache_test },
+    { "h3zero_filecache", h3zero_filecache_test },
     { "h3zero_satellite", h3zero_satellite_test },
     { "h09_satellite", h09_satellite_test },
     { "h09_lone_fin", h09_lone_fin_test },
@@ -108,6 +118,8 @@ static const picoquic_test_def_t test_table[] = {
     { "quicperf_media", quicperf_media_test },
     { "quicperf_multi", quicperf_multi_test },
     { "quicperf_overflow", quicperf_overflow_test },
+    { "quicperf_load", quicperf_load_test },
+    { "quicperf_histogram", quicperf_histogram_test },
 };
 
 static size_t const nb_tests = sizeof(test_table) / sizeof(picoquic_test_def_t);
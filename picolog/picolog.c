@@ -53,6 +53,7 @@ typedef struct app_conversion_context_st
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr);
 int convert_svg(const picoquic_connection_id_t * cid, void * ptr);
 int convert_qlog(const picoquic_connection_id_t * cid, void * ptr);
+int convert_qlog_parallel(picohash_table* cids, const app_conversion_context_t* appctx, int nb_workers);
 int filedump_binlog(FILE* bin_log, FILE* bin_dump);
 
 int usage();
@@ -82,8 +83,10 @@ int main(int argc, char ** argv)
     app_conversion_context_t appctx = { 0 };
     appctx.out_format = "csv";
 
+    int nb_workers = 1;
+
     int opt;
-    while ((opt = getopt(argc, argv, "o:f:t:c:h")) != -1) {
+    while ((opt = getopt(argc, argv, "o:f:t:c:j:h")) != -1) {
         switch (opt) {
         case 'o':
             appctx.out_dir = optarg;
@@ -97,6 +100,12 @@ int main(int argc, char ** argv)
         case 'c':
             cid_name = optarg;
             break;
+        case 'j':
+            nb_workers = atoi(optarg);
+            if (nb_workers < 1) {
+                return usage();
+            }
+            break;
         case 'h':
         default:
             return usage();
@@ -195,7 +204,12 @@ int main(int argc, char ** argv)
                     }
                 }
                 else if (strcmp(appctx.out_format, "qlog") == 0) {
-                    ret = cidset_iterate(cids, convert_qlog, &appctx);
+                    if (nb_workers > 1) {
+                        ret = convert_qlog_parallel(cids, &appctx, nb_workers);
+                    }
+                    else {
+                        ret = cidset_iterate(cids, convert_qlog, &appctx);
+                    }
                 }
                 else {
                     fprintf(stderr, "Invalid output format '%s'. Valid formats are\n\n", appctx.out_format);
@@ -224,6 +238,8 @@ int usage()
     usage_formats();
     fprintf(stderr, "  -t template-file      template file for svg format conversion\n");
     fprintf(stderr, "  -c connection-id      only convert logs of specified connection id\n");
+    fprintf(stderr, "  -j nb-workers         convert connections in parallel on the specified\n");
+    fprintf(stderr, "                        number of worker threads (qlog format only)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "picolog converts binary log files into the format specified. Output files are\n");
     fprintf(stderr, "placed in the specified directory with their connection-id as file name.\n");
@@ -273,6 +289,120 @@ int convert_qlog(const picoquic_connection_id_t * cid, void * ptr)
     return qlog_convert(cid, appctx->f_binlog, appctx->binlog_name, NULL, appctx->out_dir, appctx->flags);
 }
 
+/* Parallel qlog conversion. Each connection produces an independent output
+ * file, so connections can be converted concurrently. The connection ids are
+ * collected into a flat work list; worker threads pull the next connection id
+ * under a mutex and run the regular qlog conversion on it. FILE handles carry
+ * a shared seek position, so each worker opens its own handle on the binlog. */
+
+typedef struct qlog_work_queue_st
+{
+    const app_conversion_context_t* appctx;
+    picoquic_connection_id_t* cid_list;
+    size_t nb_cids;
+    size_t next_cid;
+    picoquic_mutex_t mutex;
+    int ret;
+} qlog_work_queue_t;
+
+static int collect_cid(const picoquic_connection_id_t* cid, void* ptr)
+{
+    qlog_work_queue_t* queue = (qlog_work_queue_t*)ptr;
+    queue->cid_list[queue->nb_cids++] = *cid;
+    return 0;
+}
+
+static picoquic_thread_return_t qlog_convert_worker(void* ptr)
+{
+    qlog_work_queue_t* queue = (qlog_work_queue_t*)ptr;
+    uint16_t flags = 0;
+    uint64_t log_time = 0;
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(queue->appctx->binlog_name, &flags, &log_time);
+
+    if (f_binlog == NULL) {
+        picoquic_lock_mutex(&queue->mutex);
+        queue->ret = -1;
+        picoquic_unlock_mutex(&queue->mutex);
+    }
+    else {
+        for (;;) {
+            picoquic_connection_id_t cid;
+            int has_work = 0;
+            int ret = 0;
+
+            picoquic_lock_mutex(&queue->mutex);
+            if (queue->next_cid < queue->nb_cids) {
+                cid = queue->cid_list[queue->next_cid++];
+                has_work = 1;
+            }
+            picoquic_unlock_mutex(&queue->mutex);
+
+            if (!has_work) {
+                break;
+            }
+
+            ret = qlog_convert(&cid, f_binlog, queue->appctx->binlog_name, NULL,
+                queue->appctx->out_dir, queue->appctx->flags);
+
+            if (ret != 0) {
+                picoquic_lock_mutex(&queue->mutex);
+                queue->ret = ret;
+                picoquic_unlock_mutex(&queue->mutex);
+            }
+        }
+        (void)picoquic_file_close(f_binlog);
+    }
+
+    picoquic_thread_do_return;
+}
+
+int convert_qlog_parallel(picohash_table* cids, const app_conversion_context_t* appctx, int nb_workers)
+{
+    int ret = 0;
+    qlog_work_queue_t queue = { 0 };
+    picoquic_thread_t* threads = NULL;
+    int nb_started = 0;
+
+    queue.appctx = appctx;
+    queue.cid_list = (picoquic_connection_id_t*)malloc(sizeof(picoquic_connection_id_t) * cids->count);
+    if (queue.cid_list == NULL || picoquic_create_mutex(&queue.mutex) != 0) {
+        free(queue.cid_list);
+        return -1;
+    }
+    (void)cidset_iterate(cids, collect_cid, &queue);
+
+    if (nb_workers > (int)queue.nb_cids) {
+        nb_workers = (int)queue.nb_cids;
+    }
+
+    threads = (picoquic_thread_t*)malloc(sizeof(picoquic_thread_t) * nb_workers);
+    if (threads == NULL) {
+        ret = -1;
+    }
+    else {
+        for (int i = 0; ret == 0 && i < nb_workers; i++) {
+            ret = picoquic_create_thread(&threads[i], qlog_convert_worker, &queue);
+            if (ret == 0) {
+                nb_started++;
+            }
+        }
+
+        for (int i = 0; i < nb_started; i++) {
+            (void)picoquic_wait_thread(threads[i]);
+        }
+        free(threads);
+    }
+
+    if (ret == 0) {
+        ret = queue.ret;
+    }
+
+    (void)picoquic_delete_mutex(&queue.mutex);
+    free(queue.cid_list);
+
+    return ret;
+}
+
 int filedump_binlog(FILE* bin_log, FILE* bin_dump)
 {
     int ret = 0;
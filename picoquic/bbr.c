@@ -1649,8 +1649,29 @@ static int BBRHasElapsedInPhase(picoquic_bbr_state_t* bbr_state, uint64_t interv
     return current_time > bbr_state->cycle_stamp + interval;
 }
 
+/* Probe gating for structurally application limited flows, see
+ * picoquic_set_app_target_rate. When the application declared its
+ * target rate and the bandwidth estimate already exceeds that target
+ * with a 1.25 headroom, a bandwidth probe cannot discover anything the
+ * application would use; it only inflates the RTT. The periodic probe
+ * is suppressed while this holds, and resumes as soon as the estimate
+ * drops below the margin, e.g. after a route change. */
+static int BBRProbeSuppressedByAppRate(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
+{
+    uint64_t app_target_rate = path_x->cnx->app_target_rate;
+
+    return (app_target_rate > 0 &&
+        4 * bbr_state->max_bw >= 5 * app_target_rate);
+}
+
 static int BBRCheckTimeToProbeBW(picoquic_bbr_state_t* bbr_state, picoquic_path_t * path_x, bbr_per_ack_state_t* rs, uint64_t current_time)
 {
+    if (BBRProbeSuppressedByAppRate(bbr_state, path_x)) {
+        /* Push the probe clock forward so a probe does not fire the
+         * instant the application raises or removes its target rate. */
+        bbr_state->cycle_stamp = current_time;
+        return 0;
+    }
     if (BBRHasElapsedInPhase(bbr_state, bbr_state->bw_probe_wait, current_time) ||
         BBRIsRenoCoexistenceProbeTime(bbr_state, path_x) ||
         (BBRExpTest(bbr_state, do_enter_probeBW_after_limited) && BBRCheckAppLimitedEnded(bbr_state, rs))) {
@@ -2235,16 +2256,13 @@ void  BBRUpdateOnACK(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x, b
  */
 static void BBRSetRsFromAckState(picoquic_path_t* path_x, picoquic_per_ack_state_t* ack_state, bbr_per_ack_state_t* rs)
 {
-    /* Need to compute the delivery rate */
-    if (path_x->bandwidth_estimate > 0) {
-        rs->delivery_rate = path_x->bandwidth_estimate;
-    }
-    else if (ack_state->rtt_measurement > 0) {
-        rs->delivery_rate = 1000000 * ack_state->nb_bytes_delivered_since_packet_sent / ack_state->rtt_measurement;
+    /* Use the shared delivery rate sample, computing it locally for the
+     * notifications that build an ack_state from scratch. */
+    if (ack_state->delivery_rate > 0) {
+        rs->delivery_rate = ack_state->delivery_rate;
     }
-    else
-    {
-        rs->delivery_rate = 40000;
+    else {
+        rs->delivery_rate = picoquic_cc_delivery_rate_sample(path_x, ack_state);
     }
     rs->delivered = ack_state->nb_bytes_delivered_since_packet_sent;
     /* variable in path */
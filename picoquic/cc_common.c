@@ -20,6 +20,7 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_probes.h"
 #include <stdlib.h>
 #include <string.h>
 #include "cc_common.h"
@@ -189,9 +190,81 @@ int picoquic_hystart_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measur
     return ret;
 }
 
+/* HyStart++ (RFC 9406) variant of the delay based slow start exit.
+ * Instead of leaving slow start as soon as the RTT rises, the
+ * connection enters a conservative slow start (CSS) phase in which the
+ * window grows at a quarter of the normal rate, see
+ * picoquic_hystart_increase. If the filtered minimum RTT drops back to
+ * the level seen when CSS was entered, the rise is deemed spurious and
+ * normal slow start resumes; after PICOQUIC_HYSTART_PP_CSS_ROUNDS
+ * rounds without such a drop the test returns 1 and the caller exits
+ * to congestion avoidance. Rounds are counted as full turns of the
+ * RTT sample window. */
+int picoquic_hystart_pp_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measurement,
+    uint64_t packet_time, uint64_t current_time, int is_one_way_delay_enabled)
+{
+    int ret = 0;
+    int sample_before = rtt_track->sample_current;
+    int delay_excess = picoquic_hystart_test(rtt_track, rtt_measurement, packet_time,
+        current_time, is_one_way_delay_enabled);
+
+    if (!rtt_track->is_css) {
+        if (delay_excess) {
+            /* Enter conservative slow start instead of exiting slow start */
+            rtt_track->is_css = 1;
+            rtt_track->css_round_count = 0;
+            rtt_track->css_baseline_min = rtt_track->rtt_filtered_min;
+            rtt_track->nb_rtt_excess = 0;
+        }
+    }
+    else if (rtt_track->sample_min <= rtt_track->css_baseline_min) {
+        /* The RTT came back down: the rise was spurious, resume slow start */
+        rtt_track->is_css = 0;
+        rtt_track->nb_rtt_excess = 0;
+    }
+    else if (rtt_track->sample_current < sample_before) {
+        /* The sample window wrapped around, count one CSS round */
+        rtt_track->css_round_count++;
+        if (rtt_track->css_round_count >= PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
 void picoquic_hystart_increase(picoquic_path_t * path_x, picoquic_min_max_rtt_t* rtt_filter, uint64_t nb_delivered)
 {
-    path_x->cwin += nb_delivered;
+    if (rtt_filter->is_css) {
+        /* Conservative slow start phase of HyStart++ */
+        path_x->cwin += nb_delivered / PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+    }
+    else {
+        path_x->cwin += nb_delivered;
+    }
+    PICOQUIC_PROBE_CWIN_UPDATED(picoquic_val64_connection_id(path_x->cnx->initial_cnxid),
+        path_x->cwin, path_x->bytes_in_transit);
+}
+
+/* Careful resume of a previously observed path. The seed set by
+ * picoquic_seed_bandwidth reflects an earlier life of the path and may
+ * be stale, so the standard careful resume safety checks apply: the
+ * seed is only used before any retransmission was observed, and the
+ * unvalidated jump is limited to half the saved window. The caller is
+ * expected to leave the slow start threshold at the full saved value,
+ * so the window grows from the jump towards the seed in slow start and
+ * the normal loss response provides the retreat if the jump proves too
+ * large. Returns the window to jump to, which is the current window
+ * when the checks fail. */
+uint64_t picoquic_cc_careful_resume_jump(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t seed_cwin)
+{
+    uint64_t jump_cwin = seed_cwin / 2;
+
+    if (cnx->nb_retransmission_total > 0 || jump_cwin < path_x->cwin) {
+        jump_cwin = path_x->cwin;
+    }
+
+    return jump_cwin;
 }
 
 uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_window)
@@ -207,4 +280,34 @@ uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_win
         new_window = (uint64_t)w;
     }
     return new_window;
-}
\ No newline at end of file
+}
+/* Per-ACK delivery rate sample, as in the BBR draft: prefer the path
+ * level bandwidth estimate, which compares delivery and send intervals,
+ * and fall back to delivered bytes over the RTT when no estimate is
+ * available yet. The sample and its app-limited marking are recorded in
+ * the path so they can be exported through the congestion state
+ * snapshot regardless of the congestion algorithm in use. */
+uint64_t picoquic_cc_delivery_rate_sample(picoquic_path_t* path_x, picoquic_per_ack_state_t* ack_state)
+{
+    uint64_t delivery_rate;
+
+    if (path_x->bandwidth_estimate > 0) {
+        delivery_rate = path_x->bandwidth_estimate;
+    }
+    else if (ack_state->rtt_measurement > 0) {
+        delivery_rate = (1000000 * ack_state->nb_bytes_delivered_since_packet_sent) / ack_state->rtt_measurement;
+    }
+    else {
+        /* Default to a very conservative value, 40kbps */
+        delivery_rate = 40000;
+    }
+
+    path_x->delivery_rate_latest = delivery_rate;
+    path_x->delivery_rate_app_limited = ack_state->is_app_limited;
+    if (!ack_state->is_app_limited && delivery_rate > path_x->delivery_rate_max) {
+        path_x->delivery_rate_max = delivery_rate;
+    }
+    ack_state->delivery_rate = delivery_rate;
+
+    return delivery_rate;
+}
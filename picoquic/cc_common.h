@@ -30,6 +30,8 @@ extern "C" {
 #define PICOQUIC_SMOOTHED_LOSS_SCOPE 32
 #define PICOQUIC_SMOOTHED_LOSS_FACTOR (1.0/16.0)
 #define PICOQUIC_SMOOTHED_LOSS_THRESHOLD (0.15)
+#define PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR 4
+#define PICOQUIC_HYSTART_PP_CSS_ROUNDS 5
 
 typedef struct st_picoquic_min_max_rtt_t {
     uint64_t last_rtt_sample_time;
@@ -44,6 +46,10 @@ typedef struct st_picoquic_min_max_rtt_t {
     uint64_t sample_min;
     uint64_t sample_max;
     uint64_t samples[PICOQUIC_MIN_MAX_RTT_SCOPE];
+    /* HyStart++ conservative slow start state, see picoquic_hystart_pp_test */
+    int is_css;
+    int css_round_count;
+    uint64_t css_baseline_min;
 } picoquic_min_max_rtt_t;
 
 uint64_t picoquic_cc_get_sequence_number(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
@@ -62,6 +68,18 @@ int picoquic_hystart_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measur
 
 void picoquic_hystart_increase(picoquic_path_t* path_x, picoquic_min_max_rtt_t* rtt_filter, uint64_t nb_delivered);
 
+int picoquic_hystart_pp_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measurement,
+    uint64_t packet_time, uint64_t current_time, int is_one_way_delay_enabled);
+
+uint64_t picoquic_cc_careful_resume_jump(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t seed_cwin);
+
+/* Shared per-ACK delivery rate sampler. Computes the rate sample for the
+ * ACK being processed and records it in the path, so that monitoring
+ * sees rate samples whatever the congestion algorithm in use. The
+ * result is also stored in ack_state->delivery_rate before the
+ * congestion notification is delivered. */
+uint64_t picoquic_cc_delivery_rate_sample(picoquic_path_t* path_x, picoquic_per_ack_state_t* ack_state);
+
 /* Many congestion control algorithms run a parallel version of new reno in order
  * to provide a lower bound estimate of either the congestion window or the
  * the minimal bandwidth. This implementation of new reno does not directly
@@ -0,0 +1,222 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Close log: append a compact forensic record for every deleted
+ * connection to a dedicated file, see close_log.h. The deleting thread
+ * fills a slot of a lock free ring; the ring is drained to the file by
+ * a dedicated writer thread. The ring follows the same single producer,
+ * single consumer discipline as the binlog writer ring: the loop thread
+ * only writes the head index and the slot it designates, the writer
+ * thread only writes the tail index, and each index is published with
+ * release semantics after the slot content. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "close_log.h"
+
+#define PICOQUIC_CLOSE_LOG_RING_SLOTS 256
+
+#ifdef _WINDOWS
+/* MSVC gives volatile accesses acquire/release semantics by default */
+#define close_log_load(x) (x)
+#define close_log_store(p, v) (void)InterlockedExchange64((LONG64 volatile*)(p), (LONG64)(v))
+#else
+#define close_log_load(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define close_log_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+typedef struct st_picoquic_close_log_ctx_t {
+    FILE* F;
+    picoquic_thread_t writer;
+    picoquic_event_t work_ready;
+    volatile uint64_t head; /* next slot to fill, owned by the deleting thread */
+    volatile uint64_t tail; /* next slot to write, owned by the writer */
+    volatile int should_close;
+    uint64_t nb_dropped; /* records lost to a full ring, deleting thread only */
+    picoquic_close_record_t slots[PICOQUIC_CLOSE_LOG_RING_SLOTS];
+} picoquic_close_log_ctx_t;
+
+static picoquic_thread_return_t picoquic_close_log_writer(void* v_ctx)
+{
+    picoquic_close_log_ctx_t* ctx = (picoquic_close_log_ctx_t*)v_ctx;
+
+    for (;;) {
+        uint64_t tail = ctx->tail;
+
+        if (tail == close_log_load(ctx->head)) {
+            if (ctx->should_close) {
+                break;
+            }
+            /* Timed wait, so a lost wake up only delays the write */
+            (void)picoquic_wait_for_event(&ctx->work_ready, 1000);
+        }
+        else {
+            (void)fwrite(&ctx->slots[tail % PICOQUIC_CLOSE_LOG_RING_SLOTS],
+                sizeof(picoquic_close_record_t), 1, ctx->F);
+            close_log_store(&ctx->tail, tail + 1);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int picoquic_close_log_setup(picoquic_quic_t* quic, char const* close_log_file_name)
+{
+    int ret = 0;
+    picoquic_close_log_ctx_t* ctx = (picoquic_close_log_ctx_t*)malloc(sizeof(picoquic_close_log_ctx_t));
+
+    if (ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(ctx, 0, sizeof(picoquic_close_log_ctx_t));
+        ctx->F = picoquic_file_open(close_log_file_name, "ab");
+        if (ctx->F == NULL) {
+            ret = -1;
+        }
+        else {
+            long sz = -1;
+
+            if (fseek(ctx->F, 0, SEEK_END) == 0) {
+                sz = ftell(ctx->F);
+            }
+            if (sz == 0) {
+                /* New file: write the header that lets a reader check the
+                 * layout and stride over the records */
+                picoquic_close_log_header_t header = { 0 };
+
+                header.magic = PICOQUIC_CLOSE_LOG_MAGIC;
+                header.version = PICOQUIC_CLOSE_LOG_VERSION;
+                header.header_size = sizeof(picoquic_close_log_header_t);
+                header.record_size = sizeof(picoquic_close_record_t);
+                if (fwrite(&header, sizeof(header), 1, ctx->F) != 1) {
+                    ret = -1;
+                }
+            }
+            else if (sz < 0) {
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 &&
+            (picoquic_create_event(&ctx->work_ready) != 0 ||
+                picoquic_create_thread(&ctx->writer, picoquic_close_log_writer, ctx) != 0)) {
+            picoquic_delete_event(&ctx->work_ready);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            quic->v_close_log_ctx = (void*)ctx;
+        }
+        else {
+            if (ctx->F != NULL) {
+                (void)picoquic_file_close(ctx->F);
+            }
+            free(ctx);
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_close_log_record(picoquic_cnx_t* cnx)
+{
+    picoquic_close_log_ctx_t* ctx = (picoquic_close_log_ctx_t*)cnx->quic->v_close_log_ctx;
+
+    if (ctx != NULL) {
+        uint64_t head = ctx->head;
+
+        if (head - close_log_load(ctx->tail) >= PICOQUIC_CLOSE_LOG_RING_SLOTS) {
+            ctx->nb_dropped++;
+        }
+        else {
+            picoquic_close_record_t* r = &ctx->slots[head % PICOQUIC_CLOSE_LOG_RING_SLOTS];
+            uint64_t close_time = picoquic_get_quic_time(cnx->quic);
+
+            memset(r, 0, sizeof(picoquic_close_record_t));
+            memcpy(r->icid, cnx->initial_cnxid.id, cnx->initial_cnxid.id_len);
+            r->icid_len = cnx->initial_cnxid.id_len;
+            r->is_client = cnx->client_mode;
+            r->quic_version = (cnx->version_index >= 0) ?
+                picoquic_supported_versions[cnx->version_index].version : 0;
+            r->start_time = cnx->start_time;
+            r->duration = close_time - cnx->start_time;
+            r->local_error = cnx->local_error;
+            r->remote_error = cnx->remote_error;
+            r->application_error = cnx->application_error;
+            r->remote_application_error = cnx->remote_application_error;
+
+            r->stats.snapshot_time = close_time;
+            r->stats.nb_packets_received = cnx->nb_packets_received;
+            r->stats.nb_packets_sent = cnx->nb_packets_sent;
+            r->stats.nb_trains_sent = cnx->nb_trains_sent;
+            r->stats.nb_retransmission_total = cnx->nb_retransmission_total;
+            r->stats.nb_spurious = cnx->nb_spurious;
+            r->stats.nb_preemptive_repeat = cnx->nb_preemptive_repeat;
+            r->stats.data_sent = cnx->data_sent;
+            r->stats.data_received = cnx->data_received;
+            r->stats.nb_bytes_queued = cnx->nb_bytes_queued;
+            if (cnx->path != NULL && cnx->path[0] != NULL) {
+                picoquic_path_t* path_x = cnx->path[0];
+
+                r->stats.smoothed_rtt = path_x->smoothed_rtt;
+                r->stats.rtt_min = path_x->rtt_min;
+                r->stats.rtt_variant = path_x->rtt_variant;
+                r->stats.cwin = path_x->cwin;
+                r->stats.pacing_rate = path_x->pacing.rate;
+                r->stats.bytes_in_transit = path_x->bytes_in_transit;
+                r->stats.receive_rate_estimate = path_x->receive_rate_estimate;
+            }
+
+            close_log_store(&ctx->head, head + 1);
+            (void)picoquic_signal_event(&ctx->work_ready);
+        }
+    }
+}
+
+void picoquic_close_log_close(picoquic_quic_t* quic)
+{
+    picoquic_close_log_ctx_t* ctx = (picoquic_close_log_ctx_t*)quic->v_close_log_ctx;
+
+    if (ctx != NULL) {
+        /* The writer drains the ring before honoring should_close */
+        ctx->should_close = 1;
+        (void)picoquic_signal_event(&ctx->work_ready);
+        picoquic_delete_thread(&ctx->writer);
+        picoquic_delete_event(&ctx->work_ready);
+        if (ctx->nb_dropped > 0) {
+            DBG_PRINTF("Close log dropped %" PRIu64 " records", ctx->nb_dropped);
+        }
+        (void)picoquic_file_close(ctx->F);
+        quic->v_close_log_ctx = NULL;
+        free(ctx);
+    }
+}
+
+uint64_t picoquic_get_close_log_dropped(picoquic_quic_t* quic)
+{
+    picoquic_close_log_ctx_t* ctx = (picoquic_close_log_ctx_t*)quic->v_close_log_ctx;
+
+    return (ctx == NULL) ? 0 : ctx->nb_dropped;
+}
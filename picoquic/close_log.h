@@ -0,0 +1,87 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef PICOQUIC_CLOSE_LOG_H
+#define PICOQUIC_CLOSE_LOG_H
+
+#include "picoquic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forensic summary of closed connections.
+ *
+ * When a connection is deleted, its diagnostic state vanishes unless a
+ * full trace was on. The close log keeps a compact, fixed size record
+ * per connection -- close reason, final congestion and RTT state, loss
+ * counters, bytes in and out, duration -- in an append only binary
+ * file, cheap enough to leave on for every connection.
+ *
+ * The thread that deletes the connection only copies the record into a
+ * slot of a lock free ring; a dedicated writer thread appends the
+ * records to the file, so connection deletion never waits on disk. If
+ * the ring is full the record is dropped and counted.
+ *
+ * The file starts with a fixed header followed by fixed size records.
+ * The layout is versioned: new fields are only appended, the version
+ * number is bumped when they are, and "record_size" in the header lets
+ * a reader stride over records it does not fully know.
+ */
+
+#define PICOQUIC_CLOSE_LOG_MAGIC 0x51434c4full /* 'QCLO' */
+#define PICOQUIC_CLOSE_LOG_VERSION 1
+
+typedef struct st_picoquic_close_log_header_t {
+    uint64_t magic; /* PICOQUIC_CLOSE_LOG_MAGIC */
+    uint64_t version; /* PICOQUIC_CLOSE_LOG_VERSION */
+    uint64_t header_size; /* sizeof(picoquic_close_log_header_t) */
+    uint64_t record_size; /* sizeof(picoquic_close_record_t) */
+} picoquic_close_log_header_t;
+
+typedef struct st_picoquic_close_record_t {
+    uint8_t icid[20]; /* initial connection ID of the connection */
+    uint8_t icid_len;
+    uint8_t padding[3];
+    uint32_t is_client;
+    uint32_t quic_version;
+    uint64_t start_time; /* quic time at which the connection was created */
+    uint64_t duration; /* microseconds from creation to deletion */
+    uint64_t local_error; /* transport error declared locally, 0 if none */
+    uint64_t remote_error; /* transport error received from the peer */
+    uint64_t application_error; /* application error declared locally */
+    uint64_t remote_application_error; /* application error received from the peer */
+    picoquic_cnx_stats_t stats; /* final counters; snapshot_time is the close time */
+} picoquic_close_record_t;
+
+/* Start writing close records to the specified file. The file is opened
+ * in append mode; the header is written if the file is new. Returns -1
+ * if the file cannot be opened or the writer thread cannot start. The
+ * log is stopped, after draining, when the QUIC context is freed. */
+int picoquic_close_log_setup(picoquic_quic_t* quic, char const* close_log_file_name);
+
+/* Number of records dropped so far because the ring was full */
+uint64_t picoquic_get_close_log_dropped(picoquic_quic_t* quic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PICOQUIC_CLOSE_LOG_H */
@@ -89,6 +89,8 @@ static option_table_line_t option_table[] = {
     { picoquic_option_Ticket_File_Name, 'T', "ticket_file", 1, "file", "File storing the session tickets" },
     { picoquic_option_Token_File_Name, 'N', "token_file", 1, "file", "File storing the new tokens" },
     { picoquic_option_Socket_buffer_size, 'B', "so_buf_size", 1, "number", "Set buffer size with SO_SNDBUF SO_RCVBUF" },
+    { picoquic_option_Server_threads, 'y', "server_threads", 1, "number",
+        "Run the server as this many per-core loop threads sharing the port" },
     { picoquic_option_Performance_Log, 'F', "log_file_name", 1, "file", "Append performance reports to performance log" },
     { picoquic_option_Preemptive_Repeat, 'V', "preemptive_repeat", 0, "", "enable preemptive repeat" },
     { picoquic_option_Version_Upgrade, 'U', "version_upgrade", 1, "", "Version upgrade if server agrees, e.g. -U 6b3343cf" },
@@ -389,6 +391,13 @@ static int config_set_option(option_table_line_t* option_desc, option_param_t* p
             ret = -1;
         }
         break;
+    case picoquic_option_Server_threads:
+        config->nb_server_threads = config_atoi(params, nb_params, 0, &ret);
+        if (ret != 0 || config->nb_server_threads < 1 || config->nb_server_threads > 256) {
+            fprintf(stderr, "Invalid number of server threads: %s\n", config_optval_param_string(opval_buffer, 256, params, nb_params, 0));
+            ret = -1;
+        }
+        break;
     case picoquic_option_Performance_Log:
         ret = config_set_string_param(&config->performance_log, params, nb_params, 0);
         break;
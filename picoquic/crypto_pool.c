@@ -0,0 +1,507 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Crypto worker pool: offload the AEAD seal and header protection of
+ * outgoing packets to a set of worker threads. Packet preparation in
+ * sender.c builds the packet and its clear text header as usual, then
+ * queues a seal job instead of encrypting inline; the resulting length
+ * is deterministic (payload plus AEAD checksum), so preparation can
+ * continue without waiting. Whoever transmits the prepared buffers
+ * must call picoquic_crypto_pool_sync() first -- the packet loop in
+ * sockloop.c does this before every socket send.
+ *
+ * Two jobs that share an AEAD context (i.e. belong to the same path)
+ * never run concurrently and are executed in submission order, because
+ * the contexts keep internal state and packet protection must stay in
+ * sequence on a path. Jobs for different paths run in parallel, so
+ * throughput across connections scales with the number of workers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "tls_api.h"
+
+#define PICOQUIC_CRYPTO_POOL_MAX_WORKERS 16
+
+typedef struct st_picoquic_crypto_job_t {
+    struct st_picoquic_crypto_job_t* next;
+    /* Generic jobs: if job_fn is set, the worker just calls it and the
+     * seal fields below are unused. Used for certificate signing during
+     * handshakes, see picoquic_crypto_pool_submit_fn. */
+    void (*job_fn)(void* job_ctx);
+    void* job_ctx;
+    /* Copy jobs: if is_copy is set, the worker copies plaintext_length
+     * octets from plaintext to send_buffer and clears *copy_pending.
+     * Used for deferred stream data copies, see
+     * picoquic_set_deferred_stream_copy. */
+    int is_copy;
+    volatile int* copy_pending;
+    uint8_t* send_buffer; /* header already written; ciphertext goes after it */
+    const uint8_t* plaintext;
+    size_t plaintext_length;
+    size_t h_length;
+    uint64_t sequence_number;
+    uint64_t path_id;
+    int is_multipath;
+    void* aead_context;
+    void* pn_enc;
+    size_t pn_offset;
+    uint8_t first_mask;
+} picoquic_crypto_job_t;
+
+typedef struct st_picoquic_crypto_worker_arg_t {
+    struct st_picoquic_crypto_worker_pool_t* pool;
+    int worker_rank;
+} picoquic_crypto_worker_arg_t;
+
+typedef struct st_picoquic_crypto_worker_pool_t {
+    picoquic_mutex_t mutex;
+    picoquic_event_t work_ready;
+    picoquic_event_t work_done;
+    picoquic_crypto_job_t* first_job;
+    picoquic_crypto_job_t* last_job;
+    picoquic_crypto_job_t* free_jobs;
+    /* AEAD contexts currently being used by a worker; a queued job on
+     * the same context stays queued until the slot clears. */
+    void* executing_aead[PICOQUIC_CRYPTO_POOL_MAX_WORKERS];
+    int nb_pending; /* queued plus executing seal jobs */
+    int nb_pending_fn; /* queued plus executing generic jobs; not counted
+                        * by picoquic_crypto_pool_sync, so a slow signing
+                        * job does not stall the send path */
+    int nb_pending_copy; /* queued plus executing stream data copies,
+                          * waited for by picoquic_stream_copy_sync */
+    int nb_workers;
+    volatile int should_close;
+    picoquic_crypto_worker_arg_t worker_args[PICOQUIC_CRYPTO_POOL_MAX_WORKERS];
+    picoquic_thread_t workers[PICOQUIC_CRYPTO_POOL_MAX_WORKERS];
+} picoquic_crypto_worker_pool_t;
+
+static void picoquic_crypto_job_seal(picoquic_crypto_job_t* job)
+{
+    if (job->is_multipath) {
+        (void)picoquic_aead_encrypt_mp(job->send_buffer + job->h_length,
+            job->plaintext, job->plaintext_length, job->path_id,
+            job->sequence_number, job->send_buffer, job->h_length, job->aead_context);
+    }
+    else {
+        (void)picoquic_aead_encrypt_generic(job->send_buffer + job->h_length,
+            job->plaintext, job->plaintext_length,
+            job->sequence_number, job->send_buffer, job->h_length, job->aead_context);
+    }
+    picoquic_protect_packet_header(job->send_buffer, job->pn_offset, job->first_mask, job->pn_enc);
+}
+
+/* Pick the first queued job whose AEAD context is idle. Called with the
+ * pool mutex held. */
+static picoquic_crypto_job_t* picoquic_crypto_pool_pick_job(picoquic_crypto_worker_pool_t* pool)
+{
+    picoquic_crypto_job_t* job = pool->first_job;
+    picoquic_crypto_job_t* previous = NULL;
+
+    while (job != NULL) {
+        int is_busy = 0;
+
+        if (job->job_fn == NULL && !job->is_copy) {
+            for (int i = 0; i < pool->nb_workers; i++) {
+                if (pool->executing_aead[i] == job->aead_context) {
+                    is_busy = 1;
+                    break;
+                }
+            }
+        }
+        if (!is_busy) {
+            if (previous == NULL) {
+                pool->first_job = job->next;
+            }
+            else {
+                previous->next = job->next;
+            }
+            if (pool->last_job == job) {
+                pool->last_job = previous;
+            }
+            job->next = NULL;
+            break;
+        }
+        previous = job;
+        job = job->next;
+    }
+
+    return job;
+}
+
+static picoquic_thread_return_t picoquic_crypto_worker(void* v_arg)
+{
+    picoquic_crypto_worker_arg_t* arg = (picoquic_crypto_worker_arg_t*)v_arg;
+    picoquic_crypto_worker_pool_t* pool = arg->pool;
+    int worker_rank = arg->worker_rank;
+
+    while (!pool->should_close) {
+        picoquic_crypto_job_t* job;
+
+        (void)picoquic_lock_mutex(&pool->mutex);
+        job = picoquic_crypto_pool_pick_job(pool);
+        if (job != NULL) {
+            pool->executing_aead[worker_rank] = job->aead_context;
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (job == NULL) {
+            /* Timed wait: the events are plain condition variables, so
+             * a signal sent while nobody waits would otherwise be lost. */
+            (void)picoquic_wait_for_event(&pool->work_ready, 1000);
+        }
+        else {
+            if (job->job_fn != NULL) {
+                job->job_fn(job->job_ctx);
+            }
+            else if (job->is_copy) {
+                memcpy(job->send_buffer, job->plaintext, job->plaintext_length);
+                *job->copy_pending = 0;
+            }
+            else {
+                picoquic_crypto_job_seal(job);
+            }
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            pool->executing_aead[worker_rank] = NULL;
+            if (job->job_fn != NULL) {
+                pool->nb_pending_fn--;
+            }
+            else if (job->is_copy) {
+                pool->nb_pending_copy--;
+            }
+            else {
+                pool->nb_pending--;
+            }
+            job->next = pool->free_jobs;
+            pool->free_jobs = job;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            /* A job queued behind this one on the same path may have
+             * become runnable, and a sync may be waiting for zero. */
+            (void)picoquic_signal_event(&pool->work_ready);
+            (void)picoquic_signal_event(&pool->work_done);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int picoquic_crypto_pool_submit(picoquic_quic_t* quic,
+    uint8_t* send_buffer, size_t h_length,
+    const uint8_t* plaintext, size_t plaintext_length,
+    uint64_t sequence_number, uint64_t path_id, int is_multipath,
+    void* aead_context, void* pn_enc, size_t pn_offset, uint8_t first_mask)
+{
+    int ret = 0;
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+    picoquic_crypto_job_t* job = NULL;
+
+    if (pool == NULL) {
+        ret = -1;
+    }
+    else {
+        (void)picoquic_lock_mutex(&pool->mutex);
+        if (pool->free_jobs != NULL) {
+            job = pool->free_jobs;
+            pool->free_jobs = job->next;
+        }
+        else {
+            job = (picoquic_crypto_job_t*)malloc(sizeof(picoquic_crypto_job_t));
+        }
+        if (job == NULL) {
+            ret = -1;
+        }
+        else {
+            job->next = NULL;
+            job->job_fn = NULL;
+            job->job_ctx = NULL;
+            job->is_copy = 0;
+            job->copy_pending = NULL;
+            job->send_buffer = send_buffer;
+            job->plaintext = plaintext;
+            job->plaintext_length = plaintext_length;
+            job->h_length = h_length;
+            job->sequence_number = sequence_number;
+            job->path_id = path_id;
+            job->is_multipath = is_multipath;
+            job->aead_context = aead_context;
+            job->pn_enc = pn_enc;
+            job->pn_offset = pn_offset;
+            job->first_mask = first_mask;
+            if (pool->last_job == NULL) {
+                pool->first_job = job;
+            }
+            else {
+                pool->last_job->next = job;
+            }
+            pool->last_job = job;
+            pool->nb_pending++;
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (ret == 0) {
+            (void)picoquic_signal_event(&pool->work_ready);
+        }
+    }
+
+    return ret;
+}
+
+/* Queue a generic job, e.g. a certificate signature during a handshake.
+ * Generic jobs are not waited for by picoquic_crypto_pool_sync; their
+ * submitter polls its own completion state. */
+int picoquic_crypto_pool_submit_fn(picoquic_quic_t* quic, void (*job_fn)(void*), void* job_ctx)
+{
+    int ret = 0;
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+    picoquic_crypto_job_t* job = NULL;
+
+    if (pool == NULL) {
+        ret = -1;
+    }
+    else {
+        (void)picoquic_lock_mutex(&pool->mutex);
+        if (pool->free_jobs != NULL) {
+            job = pool->free_jobs;
+            pool->free_jobs = job->next;
+        }
+        else {
+            job = (picoquic_crypto_job_t*)malloc(sizeof(picoquic_crypto_job_t));
+        }
+        if (job == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(job, 0, sizeof(picoquic_crypto_job_t));
+            job->job_fn = job_fn;
+            job->job_ctx = job_ctx;
+            if (pool->last_job == NULL) {
+                pool->first_job = job;
+            }
+            else {
+                pool->last_job->next = job;
+            }
+            pool->last_job = job;
+            pool->nb_pending_fn++;
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (ret == 0) {
+            (void)picoquic_signal_event(&pool->work_ready);
+        }
+    }
+
+    return ret;
+}
+
+/* Queue a deferred stream data copy, see picoquic_add_to_stream_with_ctx
+ * in sender.c. Copy jobs do not touch an AEAD context, so any idle worker
+ * can run them. */
+int picoquic_crypto_pool_submit_copy(picoquic_quic_t* quic,
+    uint8_t* dest, const uint8_t* src, size_t length, volatile int* copy_pending)
+{
+    int ret = 0;
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+    picoquic_crypto_job_t* job = NULL;
+
+    if (pool == NULL) {
+        ret = -1;
+    }
+    else {
+        (void)picoquic_lock_mutex(&pool->mutex);
+        if (pool->free_jobs != NULL) {
+            job = pool->free_jobs;
+            pool->free_jobs = job->next;
+        }
+        else {
+            job = (picoquic_crypto_job_t*)malloc(sizeof(picoquic_crypto_job_t));
+        }
+        if (job == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(job, 0, sizeof(picoquic_crypto_job_t));
+            job->is_copy = 1;
+            job->copy_pending = copy_pending;
+            job->send_buffer = dest;
+            job->plaintext = src;
+            job->plaintext_length = length;
+            if (pool->last_job == NULL) {
+                pool->first_job = job;
+            }
+            else {
+                pool->last_job->next = job;
+            }
+            pool->last_job = job;
+            pool->nb_pending_copy++;
+        }
+        (void)picoquic_unlock_mutex(&pool->mutex);
+
+        if (ret == 0) {
+            (void)picoquic_signal_event(&pool->work_ready);
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_stream_copy_sync(picoquic_quic_t* quic)
+{
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+
+    if (pool != NULL) {
+        for (;;) {
+            int nb_pending;
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            nb_pending = pool->nb_pending_copy;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            if (nb_pending == 0) {
+                break;
+            }
+            (void)picoquic_wait_for_event(&pool->work_done, 1000);
+        }
+    }
+}
+
+void picoquic_crypto_pool_sync(picoquic_quic_t* quic)
+{
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+
+    if (pool != NULL) {
+        for (;;) {
+            int nb_pending;
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            nb_pending = pool->nb_pending;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            if (nb_pending == 0) {
+                break;
+            }
+            (void)picoquic_wait_for_event(&pool->work_done, 1000);
+        }
+    }
+}
+
+/* Wait until all generic jobs submitted through
+ * picoquic_crypto_pool_submit_fn have completed. */
+void picoquic_crypto_pool_fn_sync(picoquic_quic_t* quic)
+{
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+
+    if (pool != NULL) {
+        for (;;) {
+            int nb_pending;
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            nb_pending = pool->nb_pending_fn;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            if (nb_pending == 0) {
+                break;
+            }
+            (void)picoquic_wait_for_event(&pool->work_done, 1000);
+        }
+    }
+}
+
+void picoquic_delete_crypto_worker_pool(picoquic_quic_t* quic)
+{
+    picoquic_crypto_worker_pool_t* pool = quic->crypto_pool;
+
+    if (pool != NULL) {
+        /* wait for seal, generic and copy jobs before stopping the workers */
+        for (;;) {
+            int nb_pending;
+
+            (void)picoquic_lock_mutex(&pool->mutex);
+            nb_pending = pool->nb_pending + pool->nb_pending_fn + pool->nb_pending_copy;
+            (void)picoquic_unlock_mutex(&pool->mutex);
+            if (nb_pending == 0) {
+                break;
+            }
+            (void)picoquic_wait_for_event(&pool->work_done, 1000);
+        }
+        quic->crypto_pool = NULL;
+        pool->should_close = 1;
+        (void)picoquic_signal_event(&pool->work_ready);
+        for (int i = 0; i < pool->nb_workers; i++) {
+            (void)picoquic_wait_thread(pool->workers[i]);
+        }
+        while (pool->free_jobs != NULL) {
+            picoquic_crypto_job_t* job = pool->free_jobs;
+            pool->free_jobs = job->next;
+            free(job);
+        }
+        picoquic_delete_event(&pool->work_ready);
+        picoquic_delete_event(&pool->work_done);
+        (void)picoquic_delete_mutex(&pool->mutex);
+        free(pool);
+    }
+}
+
+int picoquic_set_crypto_worker_pool(picoquic_quic_t* quic, int nb_workers)
+{
+    int ret = 0;
+    picoquic_crypto_worker_pool_t* pool = NULL;
+
+    /* Resizing is delete plus create; the sync inside the delete makes
+     * this safe at any quiet point. */
+    picoquic_delete_crypto_worker_pool(quic);
+
+    if (nb_workers > 0) {
+        if (nb_workers > PICOQUIC_CRYPTO_POOL_MAX_WORKERS) {
+            nb_workers = PICOQUIC_CRYPTO_POOL_MAX_WORKERS;
+        }
+        if ((pool = (picoquic_crypto_worker_pool_t*)malloc(sizeof(picoquic_crypto_worker_pool_t))) == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(pool, 0, sizeof(picoquic_crypto_worker_pool_t));
+            if (picoquic_create_mutex(&pool->mutex) != 0 ||
+                picoquic_create_event(&pool->work_ready) != 0 ||
+                picoquic_create_event(&pool->work_done) != 0) {
+                free(pool);
+                ret = -1;
+            }
+            else {
+                quic->crypto_pool = pool;
+                for (int i = 0; ret == 0 && i < nb_workers; i++) {
+                    pool->worker_args[i].pool = pool;
+                    pool->worker_args[i].worker_rank = i;
+                    if (picoquic_create_thread(&pool->workers[i],
+                        picoquic_crypto_worker, &pool->worker_args[i]) != 0) {
+                        ret = -1;
+                    }
+                    else {
+                        pool->nb_workers = i + 1;
+                    }
+                }
+                if (ret != 0) {
+                    picoquic_delete_crypto_worker_pool(quic);
+                }
+            }
+        }
+    }
+
+    return ret;
+}
@@ -265,8 +265,11 @@ static void picoquic_cubic_notify(
             case picoquic_congestion_notification_rtt_measurement:
                 /* Using RTT increases as signal to get out of initial slow start */
                 if (cubic_state->ssthresh == UINT64_MAX &&
-                    picoquic_hystart_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
-                        cnx->path[0]->pacing.packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
+                    ((cnx->is_hystart_pp_enabled) ?
+                        picoquic_hystart_pp_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
+                            cnx->path[0]->pacing.packet_time_microsec, current_time, cnx->is_time_stamp_enabled) :
+                        picoquic_hystart_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
+                            cnx->path[0]->pacing.packet_time_microsec, current_time, cnx->is_time_stamp_enabled))) {
                     /* RTT increased too much, get out of slow start! */
                     if (cubic_state->rtt_filter.rtt_filtered_min > PICOQUIC_TARGET_RENO_RTT){
                         double correction;
@@ -305,15 +308,17 @@ static void picoquic_cubic_notify(
                 break;
             case picoquic_congestion_notification_seed_cwin:
                 if (cubic_state->ssthresh == UINT64_MAX) {
-                    if (path_x->cwin < ack_state->nb_bytes_acknowledged) {
-                        path_x->cwin = ack_state->nb_bytes_acknowledged;
+                    uint64_t jump_cwin = picoquic_cc_careful_resume_jump(cnx, path_x, ack_state->nb_bytes_acknowledged);
+                    if (jump_cwin > path_x->cwin) {
+                        /* Careful resume: jump to half the seed and
+                         * continue slow start towards the full seed. */
+                        path_x->cwin = jump_cwin;
+                        cubic_state->ssthresh = ack_state->nb_bytes_acknowledged;
+                        cubic_state->W_max = (double)cubic_state->ssthresh / (double)path_x->send_mtu;
+                        cubic_state->W_last_max = cubic_state->W_max;
+                        cubic_state->W_reno = ((double)path_x->cwin);
+                        path_x->is_ssthresh_initialized = 1;
                     }
-                    cubic_state->ssthresh = ack_state->nb_bytes_acknowledged;
-                    cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
-                    cubic_state->W_last_max = cubic_state->W_max;
-                    cubic_state->W_reno = ((double)path_x->cwin);
-                    path_x->is_ssthresh_initialized = 1;
-                    picoquic_cubic_enter_avoidance(cubic_state, current_time);
                 }
                 break;
             default:
@@ -532,8 +537,9 @@ static void picoquic_dcubic_notify(
                 break;
             case picoquic_congestion_notification_seed_cwin:
                 if (cubic_state->ssthresh == UINT64_MAX) {
-                    if (path_x->cwin < ack_state->nb_bytes_acknowledged) {
-                        path_x->cwin = ack_state->nb_bytes_acknowledged;
+                    uint64_t jump_cwin = picoquic_cc_careful_resume_jump(cnx, path_x, ack_state->nb_bytes_acknowledged);
+                    if (jump_cwin > path_x->cwin) {
+                        path_x->cwin = jump_cwin;
                     }
                 }
                 break;
@@ -82,11 +82,12 @@ void picoquic_fastcc_reset(picoquic_fastcc_state_t* fastcc_state, picoquic_path_
     path_x->cwin = PICOQUIC_CWIN_INITIAL;
 }
 
-void picoquic_fastcc_seed_cwin(picoquic_fastcc_state_t* fastcc_state, picoquic_path_t* path_x, uint64_t bytes_in_flight)
+void picoquic_fastcc_seed_cwin(picoquic_cnx_t* cnx, picoquic_fastcc_state_t* fastcc_state, picoquic_path_t* path_x, uint64_t bytes_in_flight)
 {
     if (fastcc_state->alg_state == picoquic_fastcc_initial) {
-        if (path_x->cwin < bytes_in_flight) {
-            path_x->cwin = bytes_in_flight;
+        uint64_t jump_cwin = picoquic_cc_careful_resume_jump(cnx, path_x, bytes_in_flight);
+        if (path_x->cwin < jump_cwin) {
+            path_x->cwin = jump_cwin;
         }
     }
 }
@@ -296,7 +297,7 @@ void picoquic_fastcc_notify(
             picoquic_fastcc_reset(fastcc_state, path_x, current_time);
             break;
         case picoquic_congestion_notification_seed_cwin:
-            picoquic_fastcc_seed_cwin(fastcc_state, path_x, ack_state->nb_bytes_acknowledged);
+            picoquic_fastcc_seed_cwin(cnx, fastcc_state, path_x, ack_state->nb_bytes_acknowledged);
             break;
         default:
             /* ignore */
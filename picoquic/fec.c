@@ -0,0 +1,300 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Experimental forward erasure correction.
+ *
+ * On lossy paths, repairing a lost packet by retransmission costs at
+ * least a full RTT, which interactive traffic cannot always afford.
+ * When the FEC extension is negotiated, packets that carry data from
+ * streams marked with picoquic_set_stream_fec are accumulated into a
+ * simple XOR repair symbol. Once enough source packets have been
+ * gathered -- the block size is driven by the observed loss rate, see
+ * picoquic_fec_block_size -- the repair symbol is sent in a repair
+ * frame. A receiver that sees the repair frame and all but one of the
+ * covered packets can rebuild the missing payload locally, process its
+ * frames, and acknowledge the packet as if it had arrived.
+ *
+ * The repair frame is encoded as:
+ *    type (0x46ec), block_id, first_pn, pn_mask, symbol_length, symbol
+ * where bit i of pn_mask indicates that packet first_pn + i belongs to
+ * the block, and the symbol is the XOR of the zero padded plaintext
+ * payloads of these packets.
+ *
+ * Limitations, deliberate for this first version:
+ * - only packets whose payload fits in PICOQUIC_FEC_SYMBOL_SIZE are
+ *   protected, since the repair symbol itself must fit in a packet of
+ *   the same MTU. Larger packets fall back to plain retransmission.
+ * - protection is disabled when multipath is negotiated, as blocks
+ *   would otherwise mix per path packet number spaces.
+ * - the code is a pure XOR, recovering a single loss per block. The
+ *   block size controller keeps blocks short enough that double losses
+ *   within a block are rare at the loss rates this targets.
+ */
+
+/* Size the coding blocks from the observed loss statistics: at a loss
+ * rate p, a block of about 1/(2p) packets keeps the chance of a double
+ * loss within a block low while holding the repair overhead close to
+ * twice the loss rate. */
+uint64_t picoquic_fec_block_size(picoquic_cnx_t* cnx)
+{
+    uint64_t block_size = PICOQUIC_FEC_BLOCK_DEFAULT;
+
+    if (cnx->nb_packets_sent >= 100 && cnx->nb_retransmission_total > 0) {
+        block_size = (cnx->nb_packets_sent / cnx->nb_retransmission_total) / 2;
+        if (block_size < PICOQUIC_FEC_BLOCK_MIN) {
+            block_size = PICOQUIC_FEC_BLOCK_MIN;
+        }
+        else if (block_size > PICOQUIC_FEC_BLOCK_MAX) {
+            block_size = PICOQUIC_FEC_BLOCK_MAX;
+        }
+    }
+
+    return block_size;
+}
+
+/* Close the current block: queue a repair frame carrying the
+ * accumulated symbol, then reset the accumulator. */
+static void picoquic_fec_flush_block(picoquic_cnx_t* cnx, picoquic_fec_sender_t* fec)
+{
+    if (fec->nb_source > 0 && fec->symbol_length > 0) {
+        uint8_t frame_buffer[PICOQUIC_FEC_SYMBOL_SIZE + 64];
+        uint8_t* bytes = frame_buffer;
+        uint8_t* bytes_max = frame_buffer + sizeof(frame_buffer);
+
+        if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, picoquic_frame_type_fec_repair)) != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, fec->block_id)) != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, fec->first_pn)) != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, fec->pn_mask)) != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)fec->symbol_length)) != NULL &&
+            bytes + fec->symbol_length <= bytes_max) {
+            memcpy(bytes, fec->symbol, fec->symbol_length);
+            bytes += fec->symbol_length;
+            /* The repair frame is ack eliciting but never retransmitted:
+             * by the time a loss of the repair frame itself is detected,
+             * the block it protects is stale. */
+            (void)picoquic_queue_misc_frame(cnx, frame_buffer, bytes - frame_buffer, 0,
+                picoquic_packet_context_application);
+        }
+    }
+    memset(fec->symbol, 0, sizeof(fec->symbol));
+    fec->symbol_length = 0;
+    fec->pn_mask = 0;
+    fec->nb_source = 0;
+    fec->block_id++;
+}
+
+/* Accumulate a freshly sealed 1-RTT packet into the current coding
+ * block. Called from the packet finalization path when the packet
+ * carried data from an FEC protected stream. */
+void picoquic_fec_on_packet_sent(picoquic_cnx_t* cnx, picoquic_packet_t* packet)
+{
+    picoquic_fec_sender_t* fec = cnx->fec_sender;
+    size_t payload_length = packet->length - packet->offset;
+
+    if (cnx->is_multipath_enabled ||
+        payload_length == 0 || payload_length > PICOQUIC_FEC_SYMBOL_SIZE) {
+        return;
+    }
+
+    if (fec == NULL) {
+        fec = (picoquic_fec_sender_t*)malloc(sizeof(picoquic_fec_sender_t));
+        if (fec == NULL) {
+            return;
+        }
+        memset(fec, 0, sizeof(picoquic_fec_sender_t));
+        cnx->fec_sender = fec;
+    }
+
+    /* The pn_mask must remain varint encodable, so a block cannot span
+     * more than PICOQUIC_FEC_SPAN_MAX packet numbers. If accumulating
+     * this packet would overflow the mask, close the block early. */
+    if (fec->nb_source > 0 &&
+        packet->sequence_number - fec->first_pn >= PICOQUIC_FEC_SPAN_MAX) {
+        picoquic_fec_flush_block(cnx, fec);
+    }
+
+    if (fec->nb_source == 0) {
+        fec->first_pn = packet->sequence_number;
+    }
+
+    for (size_t i = 0; i < payload_length; i++) {
+        fec->symbol[i] ^= packet->bytes[packet->offset + i];
+    }
+    if (payload_length > fec->symbol_length) {
+        fec->symbol_length = payload_length;
+    }
+    fec->pn_mask |= 1ull << (packet->sequence_number - fec->first_pn);
+    fec->nb_source++;
+
+    if (fec->nb_source >= picoquic_fec_block_size(cnx)) {
+        picoquic_fec_flush_block(cnx, fec);
+    }
+}
+
+/* Remember the plaintext payload of a received 1-RTT packet, so that it
+ * can serve as a source symbol if a later repair frame covers it. The
+ * ring is small; packets older than PICOQUIC_FEC_NB_RECEIVE_SLOTS are
+ * overwritten, which merely makes recovery impossible for blocks that
+ * stretch further back than the ring. */
+void picoquic_fec_receive_payload(picoquic_cnx_t* cnx, uint64_t pn64, const uint8_t* payload, size_t length)
+{
+    picoquic_fec_receiver_t* fec = cnx->fec_receiver;
+    picoquic_fec_receive_slot_t* slot;
+
+    if (cnx->is_multipath_enabled || length == 0 || length > PICOQUIC_FEC_SYMBOL_SIZE) {
+        return;
+    }
+
+    if (fec == NULL) {
+        fec = (picoquic_fec_receiver_t*)malloc(sizeof(picoquic_fec_receiver_t));
+        if (fec == NULL) {
+            return;
+        }
+        memset(fec, 0, sizeof(picoquic_fec_receiver_t));
+        cnx->fec_receiver = fec;
+    }
+
+    slot = &fec->slot[pn64 % PICOQUIC_FEC_NB_RECEIVE_SLOTS];
+    slot->pn = pn64;
+    slot->is_valid = 1;
+    slot->length = length;
+    memcpy(slot->payload, payload, length);
+}
+
+/* Decode a repair frame. If exactly one of the covered packets is
+ * missing and all the others are still present in the receive ring,
+ * rebuild the missing payload by XOR, record the packet number as
+ * received, and process the recovered frames. A duplicate of the
+ * recovered packet that arrives later is discarded by the regular
+ * duplicate detection, since the packet number is now in the SACK list. */
+const uint8_t* picoquic_decode_fec_repair_frame(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    const uint8_t* bytes, const uint8_t* bytes_max, uint64_t current_time)
+{
+    uint64_t block_id = 0;
+    uint64_t first_pn = 0;
+    uint64_t pn_mask = 0;
+    uint64_t symbol_length = 0;
+
+    if (!cnx->is_fec_enabled) {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION,
+            picoquic_frame_type_fec_repair);
+        return NULL;
+    }
+
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &block_id)) == NULL ||
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &first_pn)) == NULL ||
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &pn_mask)) == NULL ||
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &symbol_length)) == NULL ||
+        pn_mask == 0 ||
+        symbol_length == 0 ||
+        symbol_length > PICOQUIC_FEC_SYMBOL_SIZE ||
+        bytes + symbol_length > bytes_max) {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR,
+            picoquic_frame_type_fec_repair);
+        return NULL;
+    }
+    else {
+        const uint8_t* symbol = bytes;
+        picoquic_sack_list_t* sack_list = (cnx->is_multipath_enabled) ?
+            &path_x->ack_ctx.sack_list :
+            &cnx->ack_ctx[picoquic_packet_context_application].sack_list;
+        uint64_t missing_pn = 0;
+        int nb_missing = 0;
+
+        bytes += symbol_length;
+
+        for (int i = 0; i < 64; i++) {
+            if ((pn_mask & (1ull << i)) != 0 &&
+                picoquic_check_sack_list(sack_list, first_pn + i, first_pn + i) != 0) {
+                missing_pn = first_pn + i;
+                nb_missing++;
+            }
+        }
+
+        if (nb_missing == 1 && cnx->fec_receiver != NULL) {
+            picoquic_fec_receiver_t* fec = cnx->fec_receiver;
+            uint8_t recovered[PICOQUIC_FEC_SYMBOL_SIZE];
+            int all_sources_present = 1;
+
+            memcpy(recovered, symbol, (size_t)symbol_length);
+            memset(recovered + symbol_length, 0, sizeof(recovered) - (size_t)symbol_length);
+
+            for (int i = 0; all_sources_present && i < 64; i++) {
+                uint64_t pn = first_pn + i;
+                if ((pn_mask & (1ull << i)) != 0 && pn != missing_pn) {
+                    picoquic_fec_receive_slot_t* slot = &fec->slot[pn % PICOQUIC_FEC_NB_RECEIVE_SLOTS];
+                    if (!slot->is_valid || slot->pn != pn) {
+                        all_sources_present = 0;
+                    }
+                    else {
+                        for (size_t x = 0; x < slot->length; x++) {
+                            recovered[x] ^= slot->payload[x];
+                        }
+                    }
+                }
+            }
+
+            if (all_sources_present) {
+                /* Record the packet as received before processing it, so
+                 * that the recovery is acknowledged and a late arrival of
+                 * the real packet is dropped as a duplicate. Trailing
+                 * zeroes in the recovered buffer parse as PADDING. */
+                (void)picoquic_update_sack_list(sack_list, missing_pn, missing_pn, current_time);
+                picoquic_set_ack_needed(cnx, current_time, picoquic_packet_context_application, path_x, 0);
+                fec->nb_recovered++;
+
+                if (picoquic_decode_frames(cnx, path_x, recovered, (size_t)symbol_length,
+                    NULL, picoquic_epoch_1rtt, NULL, NULL, missing_pn, 0, current_time) != 0) {
+                    bytes = NULL;
+                }
+            }
+        }
+    }
+
+    return bytes;
+}
+
+const uint8_t* picoquic_skip_fec_repair_frame(const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    if ((bytes = picoquic_frames_varint_skip(bytes, bytes_max)) != NULL &&
+        (bytes = picoquic_frames_varint_skip(bytes, bytes_max)) != NULL &&
+        (bytes = picoquic_frames_varint_skip(bytes, bytes_max)) != NULL) {
+        bytes = picoquic_frames_length_data_skip(bytes, bytes_max);
+    }
+    return bytes;
+}
+
+void picoquic_fec_delete(picoquic_cnx_t* cnx)
+{
+    if (cnx->fec_sender != NULL) {
+        free(cnx->fec_sender);
+        cnx->fec_sender = NULL;
+    }
+    if (cnx->fec_receiver != NULL) {
+        free(cnx->fec_receiver);
+        cnx->fec_receiver = NULL;
+    }
+}
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "picoquic_internal.h"
+#include "cc_common.h"
+#include "picoquic_probes.h"
 #include "tls_api.h"
 
 static const size_t challenge_length = 8;
@@ -138,6 +140,12 @@ int picoquic_delete_stream_if_closed(picoquic_cnx_t* cnx, picoquic_stream_head_t
     
     /* We only delete the stream if there are no pending retransmissions */
     if (stream->is_closed && picoquic_is_stream_acked(stream)) {
+        if (stream->fin_sent && !stream->reset_sent && stream->first_send_time != 0) {
+            /* The FIN is acknowledged: the send side of the stream lifecycle
+             * is complete. Reset streams are not counted. */
+            picoquic_record_stream_time(cnx->stream_completion_histogram,
+                picoquic_get_quic_time(cnx->quic) - stream->creation_time);
+        }
         picoquic_delete_stream(cnx, stream);
     }
 
@@ -170,6 +178,9 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx)
                 stream->maxdata_remote = cnx->remote_parameters.initial_max_stream_data_bidi_local;
             }
         }
+        if (stream->is_output_parked && stream->sent_offset < stream->maxdata_remote) {
+            picoquic_insert_output_stream(cnx, stream);
+        }
         stream = picoquic_next_stream(stream);
     };
 }
@@ -243,10 +254,11 @@ uint8_t * picoquic_format_stream_reset_frame(picoquic_cnx_t* cnx, picoquic_strea
             while (stream->send_queue != NULL) {
                 picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
 
-                if (stream->send_queue->bytes != NULL) {
-                    free(stream->send_queue->bytes);
+                if (stream->send_queue->copy_pending) {
+                    /* Wait for the deferred copies before freeing their target */
+                    picoquic_stream_copy_sync(cnx->quic);
                 }
-                free(stream->send_queue);
+                picoquic_stream_queue_node_recycle(cnx, stream->send_queue);
                 stream->send_queue = next;
             }
             (void)picoquic_delete_stream_if_closed(cnx, stream);
@@ -1064,25 +1076,133 @@ static void picoquic_stream_data_chunk_callback(picoquic_cnx_t* cnx, picoquic_st
     }
 }
 
-void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+/* Reassembly spill tier, see picoquic_set_reassembly_spill_cap. When a
+ * stream already holds the configured amount of out of order data in
+ * memory, chunks arriving beyond everything received so far are appended
+ * to a per context temporary file and only a small record per chunk
+ * stays in memory, sorted by stream offset. The data is read back when
+ * delivery reaches it. The file is opened on first use and dropped once
+ * no spilled chunk is outstanding. */
+int picoquic_spill_stream_chunk(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream,
+    uint64_t offset, const uint8_t* bytes, size_t length)
 {
-    picoquic_stream_data_node_t* data;
+    int ret = 0;
+    picoquic_quic_t* quic = cnx->quic;
+    picoquic_spill_chunk_t* chunk = NULL;
+
+    if (quic->spill_file == NULL) {
+        quic->spill_file = tmpfile();
+        quic->spill_file_size = 0;
+    }
 
-    while ((data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree)) != NULL && data->offset <= stream->consumed_offset) {
-        size_t start = (size_t)(stream->consumed_offset - data->offset);
-        if (data->length >= start) {
-            size_t data_length = data->length - start;
-            picoquic_stream_data_chunk_callback(cnx, stream, data->bytes + start, data_length);
+    if (quic->spill_file == NULL ||
+        (chunk = (picoquic_spill_chunk_t*)malloc(sizeof(picoquic_spill_chunk_t))) == NULL) {
+        ret = -1;
+    }
+    else if (fseek(quic->spill_file, (long)quic->spill_file_size, SEEK_SET) != 0 ||
+        fwrite(bytes, 1, length, quic->spill_file) != length) {
+        free(chunk);
+        ret = -1;
+    }
+    else {
+        picoquic_spill_chunk_t** pnext = &stream->first_spill_chunk;
+
+        chunk->stream_offset = offset;
+        chunk->file_offset = quic->spill_file_size;
+        chunk->length = length;
+        quic->spill_file_size += length;
+        quic->nb_spill_chunks++;
+
+        while (*pnext != NULL && (*pnext)->stream_offset < offset) {
+            pnext = &(*pnext)->next;
+        }
+        chunk->next = *pnext;
+        *pnext = chunk;
+    }
+
+    return ret;
+}
+
+static void picoquic_spill_chunk_release(picoquic_quic_t* quic, picoquic_stream_head_t* stream)
+{
+    picoquic_spill_chunk_t* chunk = stream->first_spill_chunk;
+
+    stream->first_spill_chunk = chunk->next;
+    free(chunk);
+    quic->nb_spill_chunks--;
+    if (quic->nb_spill_chunks == 0 && quic->spill_file != NULL) {
+        /* No spilled chunk outstanding: drop the temporary file instead of
+         * letting it grow; it is recreated on the next spill. */
+        (void)fclose(quic->spill_file);
+        quic->spill_file = NULL;
+        quic->spill_file_size = 0;
+    }
+}
+
+void picoquic_clear_stream_spill(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    while (stream->first_spill_chunk != NULL) {
+        picoquic_spill_chunk_release(cnx->quic, stream);
+    }
+}
+
+void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    for (;;) {
+        picoquic_stream_data_node_t* data =
+            (picoquic_stream_data_node_t*)picoquic_stream_index_first(&stream->stream_data_tree);
+        picoquic_spill_chunk_t* spill = stream->first_spill_chunk;
+
+        if (data != NULL && data->offset <= stream->consumed_offset &&
+            (spill == NULL || data->offset <= spill->stream_offset)) {
+            size_t start = (size_t)(stream->consumed_offset - data->offset);
+            if (data->length >= start) {
+                size_t data_length = data->length - start;
+                cnx->quic->p_delivery_node = data;
+                picoquic_stream_data_chunk_callback(cnx, stream, data->bytes + start, data_length);
+                cnx->quic->p_delivery_node = NULL;
+            }
+            picoquic_stream_index_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
+        }
+        else if (spill != NULL && spill->stream_offset <= stream->consumed_offset) {
+            /* Fault the spilled chunk back in and deliver it */
+            size_t start = (size_t)(stream->consumed_offset - spill->stream_offset);
+
+            if (spill->length > start) {
+                uint8_t spill_data[PICOQUIC_MAX_PACKET_SIZE];
+                size_t data_length = spill->length - start;
+
+                if (fseek(cnx->quic->spill_file, (long)(spill->file_offset + start), SEEK_SET) != 0 ||
+                    fread(spill_data, 1, data_length, cnx->quic->spill_file) != data_length) {
+                    picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+                    break;
+                }
+                picoquic_stream_data_chunk_callback(cnx, stream, spill_data, data_length);
+            }
+            picoquic_spill_chunk_release(cnx->quic, stream);
+        }
+        else {
+            break;
         }
-        picosplay_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
     }
 
     /* handle the case where the fin frame does not carry any data */
     picoquic_stream_data_chunk_callback(cnx, stream, NULL, 0);
 }
 
-static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t offset,
-    size_t length, int is_last_frame, 
+/* Add a chunk of stream data to the reassembly tree.
+ *
+ * The common case is zero copy: "received_data" is the node into which the
+ * AEAD decrypted the packet, so the plaintext was written exactly once and
+ * the node is simply adopted by the tree ("bytes" points inside its own
+ * data buffer). Adoption is only safe for the last frame of the packet: if
+ * a later frame in the same packet triggered delivery of queued data, the
+ * adopted node could be recycled while the decoder is still parsing frames
+ * from its buffer. Non-last frames, and frames arriving after the node was
+ * already adopted, are copied into a freshly allocated node instead.
+ */
+static int add_chunk_node(picoquic_quic_t * quic, picoquic_stream_data_index_t* tree, uint64_t offset,
+    size_t length, int is_last_frame,
     const uint8_t* bytes, int* chunk_added, picoquic_stream_data_node_t * received_data)
 {
     int ret = 0;
@@ -1111,7 +1231,14 @@ static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64
     }
 
     if (node != NULL){
-        picosplay_insert(tree, node);
+        picoquic_stream_head_t* stream = (picoquic_stream_head_t*)((char*)tree -
+            offsetof(struct st_picoquic_stream_head_t, stream_data_tree));
+
+        picoquic_stream_index_insert(tree, node);
+        stream->bytes_in_reassembly += node->length;
+        if (stream->cnx != NULL) {
+            picoquic_account_stream_memory(stream->cnx, sizeof(picoquic_stream_data_node_t));
+        }
         *chunk_added = 1;
     }
 
@@ -1119,7 +1246,7 @@ static int add_chunk_node(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64
 }
 
 /* Common code to data stream and crypto hs stream */
-int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+int picoquic_queue_network_input(picoquic_quic_t * quic, picoquic_stream_data_index_t* tree, uint64_t consumed_offset,
     uint64_t frame_data_offset, const uint8_t* bytes, size_t length, int is_last_frame, picoquic_stream_data_node_t* received_data, int* new_data_available)
 {
     const uint64_t input_begin = frame_data_offset;
@@ -1139,7 +1266,7 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
         memset(&target, 0, sizeof(picoquic_stream_data_node_t));
         target.offset = frame_data_offset;
 
-        picoquic_stream_data_node_t* prev = (picoquic_stream_data_node_t*)picosplay_find_previous(tree, &target);
+        picoquic_stream_data_node_t* prev = (picoquic_stream_data_node_t*)picoquic_stream_index_find_previous(tree, &target);
         if (prev != NULL) {
             /* By definition, prev->offset <= frame_data_offset. Check whether the
              * beginning of the frame is already received and skip if necessary */
@@ -1148,8 +1275,8 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
         }
 
         picoquic_stream_data_node_t* next = (prev == NULL) ?
-            (picoquic_stream_data_node_t*)picosplay_first(tree) :
-            (picoquic_stream_data_node_t*)picosplay_next(&prev->stream_data_node);
+            (picoquic_stream_data_node_t*)picoquic_stream_index_first(tree) :
+            (picoquic_stream_data_node_t*)picoquic_stream_index_next(&prev->stream_data_node);
 
         /* Check whether parts of the new frame are covered by already received chunks */
         while (ret == 0 && frame_data_offset < input_end && next != NULL && next->offset < input_end) {
@@ -1165,7 +1292,7 @@ int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree,
             }
 
             frame_data_offset = next->offset + next->length;
-            next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
+            next = (picoquic_stream_data_node_t*)picoquic_stream_index_next(&next->stream_data_node);
         }
 
         /* no further already received chunk within the new frame */
@@ -1189,6 +1316,7 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
     /* Is there such a stream, is it still open? */
     picoquic_stream_head_t* stream;
     uint64_t new_fin_offset = offset + length;
+    uint64_t prior_fin_offset = UINT64_MAX;
 
     if ((stream = picoquic_find_or_create_stream(cnx, stream_id, 1)) == NULL) {
         if (stream_id < cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)]) {
@@ -1204,6 +1332,8 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         }
     }
     else {
+        prior_fin_offset = stream->fin_offset;
+
         if (fin) {
             stream->fin_received = 1;
             should_notify = 1;
@@ -1239,7 +1369,9 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
                 uint64_t data_length = length - delivered_index;
 
                 /* Ugly cast, but the callback requires a non-const pointer */
+                cnx->quic->p_delivery_node = received_data;
                 picoquic_stream_data_chunk_callback(cnx, stream, (uint8_t *)bytes + delivered_index, (size_t)data_length);
+                cnx->quic->p_delivery_node = NULL;
                 /* Adjust the tree if needed */
                 picoquic_stream_data_callback(cnx, stream);
             }
@@ -1249,14 +1381,27 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         } else {
             int new_data_available = 0;
 
-            ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
-                offset, bytes, length, is_last_frame, received_data, &new_data_available);
-            if (ret != 0) {
-                ret = picoquic_connection_error(cnx, (int64_t)ret, 0);
+            if (cnx->quic->reassembly_spill_cap > 0 && length > 0 &&
+                length <= PICOQUIC_MAX_PACKET_SIZE &&
+                offset >= prior_fin_offset &&
+                offset > stream->consumed_offset &&
+                stream->bytes_in_reassembly >= cnx->quic->reassembly_spill_cap &&
+                picoquic_spill_stream_chunk(cnx, stream, offset, bytes, length) == 0) {
+                /* The stream already holds too much out of order data in memory
+                 * and this chunk is beyond everything received so far: it was
+                 * written to the spill file instead of being queued in memory.
+                 * If the spill failed, fall through to the normal in memory queue. */
             }
-            else if (new_data_available) {
-                should_notify = 1;
-                cnx->latest_receive_time = current_time;
+            else {
+                ret = picoquic_queue_network_input(cnx->quic, &stream->stream_data_tree, stream->consumed_offset,
+                    offset, bytes, length, is_last_frame, received_data, &new_data_available);
+                if (ret != 0) {
+                    ret = picoquic_connection_error(cnx, (int64_t)ret, 0);
+                }
+                else if (new_data_available) {
+                    should_notify = 1;
+                    cnx->latest_receive_time = current_time;
+                }
             }
 
             if (ret == 0 && should_notify != 0 && cnx->callback_fn != NULL) {
@@ -1334,11 +1479,66 @@ const uint8_t* picoquic_decode_stream_frame(picoquic_cnx_t* cnx, const uint8_t*
     return bytes;
 }
 
+/* Weighted fair queuing discipline, selected per connection with
+ * picoquic_set_stream_scheduler. This is self clocked fair queuing: each
+ * stream carries a virtual finish tag, advanced by bytes_sent/weight
+ * whenever data is sent on the stream, and the scheduler picks the ready
+ * stream with the lowest tag inside the most urgent priority level. The
+ * connection level virtual clock follows the tag of the last stream
+ * served, so a stream that becomes ready joins at the current virtual
+ * time instead of claiming credit for its idle period. Weights are
+ * scaled so that small sends on heavy streams still produce distinct
+ * tags. */
+#define PICOQUIC_WFQ_WEIGHT_SCALE 256
+
+static uint64_t picoquic_wfq_effective_tag(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    return (stream->wfq_finish_tag > cnx->wfq_virtual_time) ? stream->wfq_finish_tag : cnx->wfq_virtual_time;
+}
+
+static void picoquic_wfq_account_data_sent(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, size_t length)
+{
+    if (cnx->stream_scheduler == picoquic_stream_scheduler_wfq && length > 0) {
+        uint64_t weight = (stream->wfq_weight == 0) ? 1 : stream->wfq_weight;
+        uint64_t charge = (((uint64_t)length) * PICOQUIC_WFQ_WEIGHT_SCALE) / weight;
+
+        if (charge == 0) {
+            charge = 1;
+        }
+        stream->wfq_finish_tag = picoquic_wfq_effective_tag(cnx, stream) + charge;
+        cnx->wfq_virtual_time = stream->wfq_finish_tag;
+    }
+}
+
+/* Discard queued chunks that outlived the stream deadline, see
+ * picoquic_set_stream_deadline. Only whole chunks that have not started
+ * transmission are dropped: once the first byte of a chunk was sent, the
+ * rest must follow to keep the stream content consistent. Recycling the
+ * node fires the "sent" callback if one was armed, which releases
+ * caller owned buffers just as if the data had been sent. */
+static void picoquic_discard_expired_stream_chunks(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, uint64_t current_time)
+{
+    picoquic_stream_queue_node_t* node;
+
+    while ((node = stream->send_queue) != NULL &&
+        node->offset == 0 && !node->copy_pending &&
+        node->queue_time + stream->stream_deadline <= current_time) {
+        stream->send_queue = node->next_stream_data;
+        picoquic_stream_queue_node_recycle(cnx, node);
+    }
+}
+
 picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, picoquic_path_t * path_x)
 {
     picoquic_stream_head_t* first_stream = cnx->first_output_stream;
     picoquic_stream_head_t* stream = first_stream;
     picoquic_stream_head_t* found_stream = NULL;
+    uint64_t current_time = 0;
+
+    if (cnx->first_parked_stream != NULL) {
+        /* At least one stream with data is blocked by stream flow control */
+        cnx->stream_blocked = 1;
+    }
 
 
     /* Look for a ready stream */
@@ -1346,13 +1546,32 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
         int has_data = 0;
         picoquic_stream_head_t* next_stream = stream->next_output_stream;
 
+        if (stream->stream_deadline != 0 && stream->send_queue != NULL) {
+            /* Drop expired chunks before they are considered for sending */
+            if (current_time == 0) {
+                current_time = picoquic_get_quic_time(cnx->quic);
+            }
+            picoquic_discard_expired_stream_chunks(cnx, stream, current_time);
+        }
+
+        if (stream->cork_time != 0) {
+            /* Corked stream, see picoquic_set_stream_cork_delay. Release
+             * the cork once its delay has elapsed. */
+            if (current_time == 0) {
+                current_time = picoquic_get_quic_time(cnx->quic);
+            }
+            if (current_time >= stream->cork_time) {
+                stream->cork_time = 0;
+            }
+        }
+
         if (found_stream != NULL && stream->stream_priority > found_stream->stream_priority) {
             /* All the streams at that priority level have been examined,
              * the current selection is validated */
             break;
         }
         has_data = (cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote && (stream->is_active ||
-                (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
+                (stream->send_queue != NULL && stream->cork_time == 0 && stream->send_queue->length > stream->send_queue->offset) ||
                 (stream->fin_requested && !stream->fin_sent)));
         if (has_data && path_x != NULL && stream->affinity_path != path_x && stream->affinity_path != NULL) {
             /* Only consider the streams that meet path affinity requirements */
@@ -1374,7 +1593,14 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
             }
             if (has_data) {
                 /* Something can be sent */
-                if ((stream->stream_priority & 1) != 0) {
+                if (cnx->stream_scheduler == picoquic_stream_scheduler_wfq) {
+                    /* Weighted fair queuing: lowest virtual finish tag in the level */
+                    if (found_stream == NULL ||
+                        picoquic_wfq_effective_tag(cnx, stream) < picoquic_wfq_effective_tag(cnx, found_stream)) {
+                        found_stream = stream;
+                    }
+                }
+                else if ((stream->stream_priority & 1) != 0) {
                     /* This priority level requests FIFO processing, so we return the first available stream */
                     found_stream = stream;
                     break;
@@ -1396,6 +1622,9 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
                 (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset)) {
                 if (stream->sent_offset >= stream->maxdata_remote) {
                     cnx->stream_blocked = 1;
+                    /* Park the stream until its flow control limit increases,
+                     * so the next calls do not walk over it again */
+                    picoquic_park_output_stream(cnx, stream);
                 }
                 else if (cnx->maxdata_remote <= cnx->data_sent) {
                     cnx->flow_blocked = 1;
@@ -1705,6 +1934,12 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                     bytes = bytes0 + stream_data_context.byte_index + stream_data_context.length;
                     stream->sent_offset += stream_data_context.length;
                     stream->last_time_data_sent = picoquic_get_quic_time(cnx->quic);
+                    if (stream->first_send_time == 0) {
+                        stream->first_send_time = stream->last_time_data_sent;
+                        picoquic_record_stream_time(cnx->stream_ttfb_histogram,
+                            stream->first_send_time - stream->creation_time);
+                    }
+                    picoquic_wfq_account_data_sent(cnx, stream, stream_data_context.length);
                     cnx->data_sent += stream_data_context.length;
 
                     if (stream_data_context.length > 0) {
@@ -1749,6 +1984,11 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                 if (stream->send_queue == NULL) {
                     length = 0;
                 }
+                else if (stream->send_queue->copy_pending) {
+                    /* A worker thread is still copying this chunk; the
+                     * "more data" marker below retries shortly. */
+                    length = 0;
+                }
                 else {
                     length = (size_t)(stream->send_queue->length - stream->send_queue->offset);
                 }
@@ -1766,13 +2006,18 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
                         picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_stream_queue_node_recycle(cnx, stream->send_queue);
                         stream->send_queue = next;
                     }
 
                     stream->sent_offset += length;
                     stream->last_time_data_sent = picoquic_get_quic_time(cnx->quic);
+                    if (stream->first_send_time == 0) {
+                        stream->first_send_time = stream->last_time_data_sent;
+                        picoquic_record_stream_time(cnx->stream_ttfb_histogram,
+                            stream->first_send_time - stream->creation_time);
+                    }
+                    picoquic_wfq_account_data_sent(cnx, stream, length);
                     cnx->data_sent += length;
                 }
 
@@ -1799,6 +2044,12 @@ uint8_t * picoquic_format_stream_frame(picoquic_cnx_t* cnx, picoquic_stream_head
         if (*ret == 0) {
             *is_pure_ack &= (bytes == bytes0);
 
+            if (bytes > bytes0 && stream->is_fec_protected && cnx->is_fec_enabled) {
+                /* The packet being built carries protected data and will
+                 * be accumulated into the FEC block when it is sealed. */
+                cnx->fec_protect_pending = 1;
+            }
+
             if (!may_close || !picoquic_delete_stream_if_closed(cnx, stream)) {
                 /* mark the stream as unblocked since we sent something */
                 stream->stream_data_blocked_sent = 0;
@@ -1860,28 +2111,14 @@ uint8_t* picoquic_format_available_stream_frames(picoquic_cnx_t* cnx, picoquic_p
  */
 
  /* When packets containing stream data are deemed lost, they are
- * chained in the "steam data queue". The queue is managed as
- * a splay, ordered by stream priority, stream id and offset.
+ * chained in the "stream data queue". The queue is managed as an
+ * intrusive pairing heap ordered by stream priority, stream id and
+ * offset: insert and find-min are O(1), removal is O(log n) amortized,
+ * so a burst loss that queues thousands of packets stays cheap.
  */
-static picosplay_node_t*picoquic_queue_data_repeat_node_create(void* value)
+static int64_t picoquic_queue_data_repeat_compare(picoquic_packet_t* lp, picoquic_packet_t* rp)
 {
-    return &((picoquic_packet_t*)value)->queue_data_repeat_node;
-}
-
-void* picoquic_queue_data_repeat_node_value(picosplay_node_t* node)
-{
-    return (void*)((char*)node - offsetof(struct st_picoquic_packet_t, queue_data_repeat_node));
-}
-
-
-int64_t picoquic_queue_data_repeat_compare(void* l, void* r)
-{
-    picoquic_packet_t* lp = (picoquic_packet_t*)picoquic_queue_data_repeat_node_value(l);
-    picoquic_packet_t* rp = (picoquic_packet_t*)picoquic_queue_data_repeat_node_value(r);
     int64_t ret = 0;
-    /* TODO: comparison function is wrong, because the "data_repeat_frame" value
-     * varies over time. Also, the result may not be unique.
-     */
 
     /* Lower means more urgent, goes in front */
     if (lp->data_repeat_priority > rp->data_repeat_priority) {
@@ -1904,24 +2141,102 @@ int64_t picoquic_queue_data_repeat_compare(void* l, void* r)
     return ret;
 }
 
-void picoquic_queue_data_repeat_delete(void* tree, picosplay_node_t* node)
+/* Meld two heap roots; the more urgent packet becomes the root and the
+ * other its first child. */
+static picoquic_packet_t* picoquic_data_repeat_meld(picoquic_packet_t* a, picoquic_packet_t* b)
 {
-    /* Packets can be queued simultaneously for data repeat and 
-    * for detection of spurious losses, so should only be recycled
-    * when removed from both queues */
-    picoquic_packet_t* packet = (picoquic_packet_t*)picoquic_queue_data_repeat_node_value(node);
-    picoquic_cnx_t * cnx = (picoquic_cnx_t *)((void *)((char*)tree - offsetof(struct st_picoquic_cnx_t, queue_data_repeat_tree)));
+    if (a == NULL) {
+        a = b;
+    }
+    else if (b != NULL) {
+        if (picoquic_queue_data_repeat_compare(b, a) < 0) {
+            picoquic_packet_t* tmp = a;
+            a = b;
+            b = tmp;
+        }
+        b->data_repeat_parent_or_left = a;
+        b->data_repeat_next_sibling = a->data_repeat_first_child;
+        if (a->data_repeat_first_child != NULL) {
+            a->data_repeat_first_child->data_repeat_parent_or_left = b;
+        }
+        a->data_repeat_first_child = b;
+    }
 
-    packet->is_queued_for_data_repeat = 0;
-    if (!packet->is_queued_for_spurious_detection) {
-        picoquic_recycle_packet(cnx->quic, packet);
+    if (a != NULL) {
+        a->data_repeat_parent_or_left = NULL;
+        a->data_repeat_next_sibling = NULL;
     }
+
+    return a;
+}
+
+/* Combine the children of a removed node with the classic two pass
+ * scheme, iteratively so a long child list cannot overflow the stack. */
+static picoquic_packet_t* picoquic_data_repeat_merge_pairs(picoquic_packet_t* child)
+{
+    picoquic_packet_t* pair_list = NULL;
+    picoquic_packet_t* root = NULL;
+
+    while (child != NULL) {
+        picoquic_packet_t* a = child;
+        picoquic_packet_t* b = a->data_repeat_next_sibling;
+        picoquic_packet_t* merged;
+
+        child = (b == NULL) ? NULL : b->data_repeat_next_sibling;
+        a->data_repeat_next_sibling = NULL;
+        a->data_repeat_parent_or_left = NULL;
+        if (b != NULL) {
+            b->data_repeat_next_sibling = NULL;
+            b->data_repeat_parent_or_left = NULL;
+        }
+        merged = picoquic_data_repeat_meld(a, b);
+        /* Use the sibling link to stack the merged pairs */
+        merged->data_repeat_next_sibling = pair_list;
+        pair_list = merged;
+    }
+
+    while (pair_list != NULL) {
+        picoquic_packet_t* next = pair_list->data_repeat_next_sibling;
+
+        pair_list->data_repeat_next_sibling = NULL;
+        root = picoquic_data_repeat_meld(root, pair_list);
+        pair_list = next;
+    }
+
+    return root;
+}
+
+/* Unlink a packet from the heap without recycling it */
+static void picoquic_data_repeat_remove(picoquic_cnx_t* cnx, picoquic_packet_t* packet)
+{
+    if (packet == cnx->queue_data_repeat_first) {
+        cnx->queue_data_repeat_first = picoquic_data_repeat_merge_pairs(packet->data_repeat_first_child);
+    }
+    else {
+        picoquic_packet_t* previous = packet->data_repeat_parent_or_left;
+        picoquic_packet_t* sub_heap;
+
+        if (previous->data_repeat_first_child == packet) {
+            previous->data_repeat_first_child = packet->data_repeat_next_sibling;
+        }
+        else {
+            previous->data_repeat_next_sibling = packet->data_repeat_next_sibling;
+        }
+        if (packet->data_repeat_next_sibling != NULL) {
+            packet->data_repeat_next_sibling->data_repeat_parent_or_left = previous;
+        }
+        sub_heap = picoquic_data_repeat_merge_pairs(packet->data_repeat_first_child);
+        cnx->queue_data_repeat_first = picoquic_data_repeat_meld(cnx->queue_data_repeat_first, sub_heap);
+    }
+
+    packet->data_repeat_first_child = NULL;
+    packet->data_repeat_next_sibling = NULL;
+    packet->data_repeat_parent_or_left = NULL;
 }
 
 void picoquic_queue_data_repeat_init(picoquic_cnx_t* cnx) {
-    picosplay_init_tree(&cnx->queue_data_repeat_tree, picoquic_queue_data_repeat_compare,
-        picoquic_queue_data_repeat_node_create, picoquic_queue_data_repeat_delete, picoquic_queue_data_repeat_node_value);
-} 
+    cnx->queue_data_repeat_first = NULL;
+}
 
 /* Handling of queue of packets containing data frames that 
  * should be resent, unless somehow acknowledged before that.
@@ -1930,7 +2245,30 @@ void picoquic_queue_data_repeat_init(picoquic_cnx_t* cnx) {
 void picoquic_dequeue_data_repeat_packet(
     picoquic_cnx_t* cnx, picoquic_packet_t* packet)
 {
-    picosplay_delete_hint(&cnx->queue_data_repeat_tree, &packet->queue_data_repeat_node);
+    if (packet->is_queued_for_data_repeat) {
+        picoquic_data_repeat_remove(cnx, packet);
+        packet->is_queued_for_data_repeat = 0;
+    }
+    /* Packets can be queued simultaneously for data repeat and
+    * for detection of spurious losses, so should only be recycled
+    * when removed from both queues */
+    if (!packet->is_queued_for_spurious_detection) {
+        picoquic_recycle_packet(cnx->quic, packet);
+    }
+}
+
+/* Drain the heap at connection deletion time */
+void picoquic_empty_data_repeat_queue(picoquic_cnx_t* cnx)
+{
+    picoquic_packet_t* packet;
+
+    while ((packet = cnx->queue_data_repeat_first) != NULL) {
+        picoquic_data_repeat_remove(cnx, packet);
+        packet->is_queued_for_data_repeat = 0;
+        if (!packet->is_queued_for_spurious_detection) {
+            picoquic_recycle_packet(cnx->quic, packet);
+        }
+    }
 }
 
 int picoquic_queue_data_repeat_adjust(picoquic_cnx_t* cnx, picoquic_packet_t* packet)
@@ -1994,7 +2332,7 @@ void picoquic_queue_data_repeat_packet(
         packet->data_repeat_index = packet->offset;
         if (picoquic_queue_data_repeat_adjust(cnx, packet) == 0 &&
             packet->data_repeat_frame < packet->length) {
-            picosplay_insert(&cnx->queue_data_repeat_tree, packet);
+            cnx->queue_data_repeat_first = picoquic_data_repeat_meld(cnx->queue_data_repeat_first, packet);
             packet->is_queued_for_data_repeat = 1;
         }
     }
@@ -2002,9 +2340,7 @@ void picoquic_queue_data_repeat_packet(
 
 picoquic_packet_t* picoquic_first_data_repeat_packet(picoquic_cnx_t* cnx)
 {
-    picosplay_node_t * first_node = picosplay_first(&cnx->queue_data_repeat_tree);
-    picoquic_packet_t* first_packet = (first_node == NULL) ? NULL : picoquic_queue_data_repeat_node_value(first_node);
-    return first_packet;
+    return cnx->queue_data_repeat_first;
 }
 
 /* Copy stream frame from packet to specified buffer, and update the
@@ -2062,7 +2398,17 @@ uint8_t* picoquic_copy_stream_frame_for_retransmit(
                 is_needed = 0;
             }
         }
-        if (is_needed) {
+        if (is_needed &&
+            data_available == data_length && (*frame & 2) != 0 &&
+            bytes_next + consumed + data_length <= bytes_max) {
+            /* Common case: nothing was partially sent, the original encoding
+             * carries an explicit length, and the whole frame fits. Reuse the
+             * original frame bytes verbatim, in a single copy, instead of
+             * re-encoding the header and copying the data separately. */
+            memcpy(bytes_next, frame, consumed + data_length);
+            bytes_next += consumed + data_length;
+        }
+        else if (is_needed) {
             /* Need to check how much can be encoded in the packet:
              * Header (with or without FIN), stream_id, offset, length.
              */
@@ -2169,13 +2515,10 @@ uint8_t* picoquic_copy_single_stream_frame_for_retransmit(picoquic_cnx_t* cnx, p
         *packet_dequeued = 1;
     }
     else if (packet->data_repeat_frame > last_frame) {
-        /* There is another stream frame after this one.  Dequeue with
-        * caution, then requeue */
-        int was_queued = packet->is_queued_for_spurious_detection;
-        packet->is_queued_for_spurious_detection = 1;
-        picosplay_delete_hint(&cnx->queue_data_repeat_tree, &packet->queue_data_repeat_node);
-        packet->is_queued_for_spurious_detection = was_queued;
-        (void)picosplay_insert(&cnx->queue_data_repeat_tree, packet);
+        /* There is another stream frame after this one. Requeue the
+        * packet under its new priority key */
+        picoquic_data_repeat_remove(cnx, packet);
+        cnx->queue_data_repeat_first = picoquic_data_repeat_meld(cnx->queue_data_repeat_first, packet);
         packet->is_queued_for_data_repeat = 1;
         *more_data |= 1;
     }
@@ -2413,8 +2756,7 @@ uint8_t* picoquic_format_crypto_hs_frame(picoquic_stream_head_t* stream, uint8_t
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
                         picoquic_stream_queue_node_t* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_stream_queue_node_recycle(stream->cnx, stream->send_queue);
                         stream->send_queue = next;
                     }
 
@@ -2536,6 +2878,24 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
                     old_path->max_reorder_gap = reorder_gap;
                 }
 
+                /* Adapt the RACK thresholds to the measured reordering
+                 * depth: this retransmission was spurious, so the packet
+                 * was merely reordered by "reorder_gap" packets and
+                 * "reorder_delay" microseconds. Raising the thresholds
+                 * just above those values avoids repeating the mistake.
+                 * The learned values shrink again when real timer based
+                 * losses occur, see picoquic_retransmit_needed. */
+                if (reorder_gap >= old_path->reorder_pkt_threshold) {
+                    old_path->reorder_pkt_threshold = reorder_gap + 1;
+                    if (old_path->reorder_pkt_threshold > PICOQUIC_REORDER_PKT_THRESHOLD_MAX) {
+                        old_path->reorder_pkt_threshold = PICOQUIC_REORDER_PKT_THRESHOLD_MAX;
+                    }
+                }
+                if (reorder_delay > old_path->reorder_time_extra) {
+                    old_path->reorder_time_extra = (reorder_delay > old_path->smoothed_rtt) ?
+                        old_path->smoothed_rtt : reorder_delay;
+                }
+
                 if (old_path->total_bytes_lost > p->length) {
                     old_path->total_bytes_lost -= p->length;
                 }
@@ -2623,7 +2983,12 @@ void picoquic_estimate_path_bandwidth(picoquic_cnx_t * cnx, picoquic_path_t* pat
                             uint64_t ack_delay_max;
                             picoquic_compute_ack_gap_and_delay(cnx, cnx->path[0]->rtt_min, cnx->remote_parameters.min_ack_delay,
                                 bw_estimate, &ack_gap, &ack_delay_max);
-                            if (ack_gap != cnx->ack_gap_local) {
+                            /* Only refresh the peer when the gap grew by
+                             * more than 1/8th or dropped by half, so rate
+                             * estimate jitter does not translate into a
+                             * stream of ACK_FREQUENCY frames. */
+                            if (ack_gap > cnx->ack_gap_local + (cnx->ack_gap_local >> 3) ||
+                                2 * ack_gap <= cnx->ack_gap_local) {
                                 cnx->is_ack_frequency_updated = 1;
                             }
                         }
@@ -2763,7 +3128,17 @@ static uint64_t picoquic_compute_ack_gap(picoquic_cnx_t* cnx, uint64_t data_rate
         }
         else {
             ack_gap = 32 + ((nb_packets - 128) / 8);
-            if (ack_gap > 64) {
+            if (cnx->path[0]->is_ssthresh_initialized && data_rate > PICOQUIC_BANDWIDTH_MEDIUM) {
+                /* Steady state bulk transfer: the window only moves by a
+                 * fraction per RTT, so a few ACKs per RTT are enough
+                 * feedback. Letting the gap follow the delivery rate past
+                 * the 64 packet cap cuts the reverse path packet volume
+                 * on high bandwidth-delay paths. */
+                if (ack_gap > 256) {
+                    ack_gap = 256;
+                }
+            }
+            else if (ack_gap > 64) {
                 ack_gap = 64;
             }
         }
@@ -2776,7 +3151,10 @@ uint64_t picoquic_compute_ack_delay_max(picoquic_cnx_t* cnx, uint64_t rtt, uint6
 {
     uint64_t ack_delay_max = rtt / 4;
 
-    if (!cnx->is_ack_frequency_negotiated && !cnx->path[0]->is_ssthresh_initialized) {
+    if (!cnx->path[0]->is_ssthresh_initialized) {
+        /* Slow start: the window doubles per RTT, so feedback delay
+         * directly slows the ramp. Ask for prompt ACKs, negotiated
+         * or not. */
         ack_delay_max /= 2;
     }
 
@@ -2944,10 +3322,14 @@ void process_decoded_packet_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
             ack_state.inflight_prior = packet_data->path_ack[i].inflight_prior;
             ack_state.is_app_limited = packet_data->path_ack[i].rs_is_path_limited;
             ack_state.is_cwnd_limited = packet_data->path_ack[i].rs_is_cwnd_limited;
+            (void)picoquic_cc_delivery_rate_sample(packet_data->path_ack[i].acked_path, &ack_state);
             packet_data->path_ack[i].acked_path->is_lost_feedback_notified = 0;
             cnx->congestion_alg->alg_notify(cnx, packet_data->path_ack[i].acked_path,
                 picoquic_congestion_notification_acknowledgement,
                 &ack_state, current_time);
+            PICOQUIC_PROBE_CWIN_UPDATED(picoquic_val64_connection_id(cnx->initial_cnxid),
+                packet_data->path_ack[i].acked_path->cwin,
+                packet_data->path_ack[i].acked_path->bytes_in_transit);
         }
     }
 
@@ -3163,7 +3545,9 @@ int picoquic_check_frame_needs_repeat(picoquic_cnx_t* cnx, const uint8_t* bytes,
                 *no_need_to_repeat = 1;
             }
             else {
-                if (stream->reset_sent) {
+                if (stream->reset_sent || stream->no_retransmit) {
+                    /* Reset sent, or the application marked the stream as
+                     * not worth repeating, see picoquic_mark_no_retransmit_stream */
                     *no_need_to_repeat = 1;
                 }
                 else {
@@ -3171,7 +3555,7 @@ int picoquic_check_frame_needs_repeat(picoquic_cnx_t* cnx, const uint8_t* bytes,
                     *no_need_to_repeat = picoquic_check_sack_list(&stream->sack_list, offset, offset + data_length - ((fin) ? 0 : 1));
                 }
 
-                if (is_preemptive_needed != NULL && stream->fin_sent) {
+                if (is_preemptive_needed != NULL && stream->fin_sent && !stream->no_retransmit) {
                     *is_preemptive_needed |= 1;
                 }
             }
@@ -3352,6 +3736,12 @@ int picoquic_check_frame_needs_repeat(picoquic_cnx_t* cnx, const uint8_t* bytes,
                 case picoquic_frame_type_time_stamp:
                     *no_need_to_repeat = 1;
                     break;
+                case picoquic_frame_type_fec_repair:
+                    /* A stale repair symbol is useless; losses of the
+                     * repair frame are repaired by the next block. */
+                    *no_need_to_repeat = 1;
+                    *do_not_detect_spurious = 0;
+                    break;
                 case picoquic_frame_type_path_abandon:
                     /* TODO: check whether there is still a need to abandon the path */
                     *no_need_to_repeat = 0;
@@ -3598,6 +3988,9 @@ static int picoquic_process_ack_range(
                     }
 
                     picoquic_record_ack_packet_data(packet_data, p);
+                    if (p->is_mtu_probe && old_path->nb_mtu_probes_in_flight > 0) {
+                        old_path->nb_mtu_probes_in_flight--;
+                    }
                     /* If packet is larger than the current MTU, update the MTU */
                     if ((p->length + p->checksum_overhead) == old_path->send_mtu) {
                         old_path->nb_mtu_losses = 0;
@@ -3633,6 +4026,33 @@ static int picoquic_process_ack_range(
     return ret;
 }
 
+/* Serve the next varint of an ACK frame from a small batch buffer,
+ * refilling it with picoquic_varint_decode_batch when empty. The batch
+ * size is capped by the number of varints that the frame header
+ * announced, so the decoder never reads into the fields that follow
+ * the ranges. Returns the buffer position after the refill, or NULL if
+ * a varint is needed and none can be decoded. */
+static const uint8_t* picoquic_frames_ack_varint_next(const uint8_t* bytes, const uint8_t* bytes_max,
+    uint64_t* n64, uint64_t* batch, size_t* batch_count, size_t* batch_rank, uint64_t* batch_left)
+{
+    if (*batch_rank >= *batch_count) {
+        size_t nb_max = (*batch_left < 8) ? (size_t)*batch_left : 8;
+        size_t consumed = picoquic_varint_decode_batch(bytes, bytes_max - bytes, batch, nb_max, batch_count);
+
+        *batch_rank = 0;
+        if (*batch_count == 0) {
+            return NULL;
+        }
+        bytes += consumed;
+    }
+
+    *n64 = batch[*batch_rank];
+    *batch_rank += 1;
+    *batch_left -= 1;
+
+    return bytes;
+}
+
 const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* bytes,
     const uint8_t* bytes_max, uint64_t current_time, int epoch, int is_ecn, int has_path_id, picoquic_packet_data_t* packet_data)
 {
@@ -3702,11 +4122,17 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
                 }
             }
 
+            uint64_t ack_batch[8];
+            size_t ack_batch_count = 0;
+            size_t ack_batch_rank = 0;
+            uint64_t ack_batch_left = 2 * num_block + 1;
+
             do {
                 uint64_t range;
                 uint64_t block_to_block;
 
-                if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &range)) == NULL) {
+                if ((bytes = picoquic_frames_ack_varint_next(bytes, bytes_max, &range,
+                    ack_batch, &ack_batch_count, &ack_batch_rank, &ack_batch_left)) == NULL) {
                     DBG_PRINTF("Malformed ACK RANGE, %d blocks remain.\n", (int)num_block);
                     picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, ftype);
                     bytes = NULL;
@@ -3726,7 +4152,8 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
                     break;
                 }
 
-                if (range > 0) {
+                if (range > 0 &&
+                    picoquic_retransmitted_map_range_maybe(pkt_ctx, largest + 1 - range, largest)) {
                     p_retransmitted_previous = picoquic_check_spurious_retransmission(cnx, pc, pkt_ctx,
                         largest + 1 - range, largest, current_time, time_stamp, p_retransmitted_previous, packet_data);
                 }
@@ -3735,7 +4162,8 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
                     break;
 
                 /* Skip the gap */
-                if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &block_to_block)) == NULL) {
+                if ((bytes = picoquic_frames_ack_varint_next(bytes, bytes_max, &block_to_block,
+                    ack_batch, &ack_batch_count, &ack_batch_rank, &ack_batch_left)) == NULL) {
                     DBG_PRINTF("    Malformed ACK GAP, %d blocks remain.\n", (int)num_block);
                     picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, ftype);
                     bytes = NULL;
@@ -3838,7 +4266,7 @@ uint8_t* picoquic_format_ack_frame_in_context(picoquic_cnx_t* cnx, uint8_t* byte
             /* Implement adaptive tuning of lowest repeat range */
             int nb_sent_max_acked = 0;
             int nb_sent_max_skip = 0;
-            picoquic_sack_item_t* next_sack = picoquic_sack_previous_item(last_sack);
+            picoquic_sack_item_t* next_sack = picoquic_sack_previous_item(&ack_ctx->sack_list, last_sack);
 
             /* Update send count for the top range */
             picoquic_sack_item_record_sent(&ack_ctx->sack_list, last_sack, is_opportunistic);
@@ -3875,7 +4303,7 @@ uint8_t* picoquic_format_ack_frame_in_context(picoquic_cnx_t* cnx, uint8_t* byte
                         }
                     }
                 }
-                next_sack = picoquic_sack_previous_item(next_sack);
+                next_sack = picoquic_sack_previous_item(&ack_ctx->sack_list, next_sack);
             }
             /* When numbers are lower than 64, varint encoding fits on one byte */
             *num_block_byte = (uint8_t)num_block;
@@ -3965,6 +4393,56 @@ uint8_t * picoquic_format_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t
     return bytes;
 }
 
+/* ACK emission policy. The immediate ACK on out of order arrival is the
+ * right reaction to occasional losses, but on high rate paths crossing
+ * multi queue NICs or GRO engines reordering is the steady state, and
+ * reacting to every hole generates one ACK per receive batch element
+ * instead of one per batch. The policy samples the arrival and
+ * reordering rates over short epochs; when the connection is
+ * established, arrivals are fast and reordering is persistent, the out
+ * of order trigger is deferred and the regular ack_gap / ack_delay
+ * cadence governs, with the ACK_FREQUENCY parameters negotiated with
+ * the peer as inputs. Rare holes, which probably are losses, still get
+ * an immediate ACK. */
+#define PICOQUIC_ACK_POLICY_EPOCH 10000 /* 10 ms sampling epoch */
+#define PICOQUIC_ACK_POLICY_RATE_THRESHOLD 50000 /* packets per second */
+
+void picoquic_ack_policy_record_arrival(picoquic_cnx_t* cnx, int is_out_of_order, uint64_t current_time)
+{
+    if (cnx->ack_policy_epoch_start == 0) {
+        cnx->ack_policy_epoch_start = current_time;
+    }
+    else if (current_time >= cnx->ack_policy_epoch_start + PICOQUIC_ACK_POLICY_EPOCH) {
+        uint64_t elapsed = current_time - cnx->ack_policy_epoch_start;
+        uint64_t packet_rate = (cnx->ack_policy_epoch_packets * 1000000) / elapsed;
+        uint64_t reorder_rate = (cnx->ack_policy_epoch_reorders * 1000000) / elapsed;
+
+        if (elapsed >= 8 * PICOQUIC_ACK_POLICY_EPOCH) {
+            /* Long silence: the old smoothed values are stale */
+            cnx->ack_policy_packet_rate = packet_rate;
+            cnx->ack_policy_reorder_rate = reorder_rate;
+        }
+        else {
+            cnx->ack_policy_packet_rate -= cnx->ack_policy_packet_rate / 4;
+            cnx->ack_policy_packet_rate += packet_rate / 4;
+            cnx->ack_policy_reorder_rate -= cnx->ack_policy_reorder_rate / 4;
+            cnx->ack_policy_reorder_rate += reorder_rate / 4;
+        }
+        cnx->ack_policy_epoch_start = current_time;
+        cnx->ack_policy_epoch_packets = 0;
+        cnx->ack_policy_epoch_reorders = 0;
+    }
+    cnx->ack_policy_epoch_packets++;
+    cnx->ack_policy_epoch_reorders += (is_out_of_order) ? 1 : 0;
+}
+
+static int picoquic_ack_policy_defer_out_of_order(picoquic_cnx_t* cnx)
+{
+    return (cnx->cnx_state == picoquic_state_ready &&
+        cnx->ack_policy_packet_rate > PICOQUIC_ACK_POLICY_RATE_THRESHOLD &&
+        cnx->ack_policy_reorder_rate * 8 > cnx->ack_policy_packet_rate);
+}
+
 void picoquic_set_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, picoquic_packet_context_enum pc,
     picoquic_path_t * path_x, int is_immediate_ack_required)
 {
@@ -4020,7 +4498,8 @@ int picoquic_is_ack_needed_in_ctx(picoquic_cnx_t* cnx, picoquic_ack_context_t* a
             ret = 1;
             ack_ctx->act[is_opportunistic].ack_after_fin = 0;
         }
-        else if (ack_ctx->act[is_opportunistic].out_of_order_received && !cnx->ack_ignore_order_remote) {
+        else if (ack_ctx->act[is_opportunistic].out_of_order_received && !cnx->ack_ignore_order_remote &&
+            !picoquic_ack_policy_defer_out_of_order(cnx)) {
             ret = 1;
         }
         else
@@ -4053,6 +4532,23 @@ int picoquic_is_ack_needed_in_ctx(picoquic_cnx_t* cnx, picoquic_ack_context_t* a
     return ret;
 }
 
+/* Check whether acknowledgeable data is pending, without regard for the
+ * ACK delay timer. Used for ACK coalescing: a packet that is about to be
+ * sent anyway can pick up the pending ACK state early, saving the pure
+ * ACK packet that the timer would otherwise trigger. */
+int picoquic_is_ack_pending(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc, int is_opportunistic)
+{
+    int ret = cnx->ack_ctx[pc].act[is_opportunistic].ack_needed;
+
+    if (!ret && pc == picoquic_packet_context_application && cnx->is_multipath_enabled) {
+        for (int i = 0; ret == 0 && i < cnx->nb_paths; i++) {
+            ret |= cnx->path[i]->ack_ctx.act[is_opportunistic].ack_needed;
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_is_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time,
     picoquic_packet_context_enum pc, int is_opportunistic)
 {
@@ -4273,6 +4769,9 @@ const uint8_t* picoquic_decode_max_stream_data_frame(picoquic_cnx_t* cnx, const
         if (maxdata > cnx->max_stream_data_remote) {
             cnx->max_stream_data_remote = maxdata;
         }
+        if (stream->is_output_parked && stream->sent_offset < stream->maxdata_remote) {
+            picoquic_insert_output_stream(cnx, stream);
+        }
     }
 
 
@@ -4711,6 +5210,10 @@ const uint8_t* picoquic_decode_path_response_frame(picoquic_cnx_t* cnx, const ui
             if (found_challenge && !path_x->challenge_verified){
                 /* TODO: update the RTT if using initial value */
                 path_x->challenge_verified = 1;
+                path_x->is_optimistic_send_allowed = 0;
+                /* Remember the address, so a NAT flapping back to it will
+                 * not need another validation round trip */
+                picoquic_remember_validated_address(cnx, (struct sockaddr*)&path_x->peer_addr, current_time);
 
                 /* Provide a qualified time estimate from challenge time */
                 picoquic_update_path_rtt(cnx, path_x, path_x, -1, path_x->challenge_time_first, current_time, 0, 0);
@@ -5232,12 +5735,17 @@ uint8_t* picoquic_format_ack_frequency_frame(picoquic_cnx_t* cnx, uint8_t* bytes
         cnx->path[0]->bandwidth_estimate, &ack_gap, &ack_delay_max);
     
     if (ack_gap <= cnx->ack_gap_local &&
+        2 * ack_gap > cnx->ack_gap_local &&
         ack_delay_max >= (7*cnx->ack_frequency_delay_local)/8 &&
         ack_delay_max <= (9* cnx->ack_frequency_delay_local) / 8) {
         cnx->is_ack_frequency_updated = 0;
     }
     else {
-        if (ack_gap < cnx->ack_gap_local) {
+        if (ack_gap < cnx->ack_gap_local && 2 * ack_gap > cnx->ack_gap_local) {
+            /* Small decreases are pinned to the current value to avoid
+             * churning the peer with marginal updates; a drop by half or
+             * more, e.g. slow start after a timeout or a collapsed
+             * window, is sent so the peer returns to frequent ACKs. */
             ack_gap = cnx->ack_gap_local;
         }
         if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, picoquic_frame_type_ack_frequency)) != NULL &&
@@ -6159,8 +6667,208 @@ uint8_t* picoquic_format_bdp_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t*
  * Decoding of the received frames.
  *
  * In some cases, the expected frames are "restricted" to only ACK, STREAM 0 and PADDING.
+ *
+ * The frame types that fit in a single byte are dispatched through a
+ * dense table indexed by the first byte of the frame, so the common
+ * ACK / STREAM / PADDING sequence costs one indirect call per frame.
+ * Each entry carries the set of epochs in which the frame is legal and
+ * the ack needed / path probing properties, which replaces the per
+ * frame epoch checks of the previous if / switch chain. Types that
+ * need a multi-byte varint (extension frames) or that are unknown fall
+ * through to the slow path below the table.
  */
 
+typedef struct st_picoquic_frame_decode_ctx_t {
+    picoquic_cnx_t* cnx;
+    picoquic_path_t* path_x;
+    picoquic_stream_data_node_t* received_data;
+    struct sockaddr* addr_from;
+    struct sockaddr* addr_to;
+    uint64_t current_time;
+    picoquic_packet_data_t* packet_data;
+    int epoch;
+    int path_is_not_allocated;
+} picoquic_frame_decode_ctx_t;
+
+typedef const uint8_t* (*picoquic_frame_decoder_fn)(picoquic_frame_decode_ctx_t* ctx,
+    const uint8_t* bytes, const uint8_t* bytes_max);
+
+#define PICOQUIC_FRAME_FLAG_ACK_NEEDED 0x01
+#define PICOQUIC_FRAME_FLAG_PATH_PROBING 0x02
+
+#define PICOQUIC_FRAME_EPOCHS_ALL 0x0Fu
+#define PICOQUIC_FRAME_EPOCHS_DATA ((1u << picoquic_epoch_0rtt) | (1u << picoquic_epoch_1rtt))
+#define PICOQUIC_FRAME_EPOCHS_NOT_0RTT (PICOQUIC_FRAME_EPOCHS_ALL & ~(1u << picoquic_epoch_0rtt))
+#define PICOQUIC_FRAME_EPOCHS_1RTT (1u << picoquic_epoch_1rtt)
+
+typedef struct st_picoquic_frame_dispatch_entry_t {
+    picoquic_frame_decoder_fn decoder;
+    uint8_t epoch_mask;
+    uint8_t flags;
+} picoquic_frame_dispatch_entry_t;
+
+static const uint8_t* picoquic_dispatch_0len_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(ctx);
+#else
+    (void)ctx;
+#endif
+    return picoquic_skip_0len_frame(bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_stream_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_stream_frame(ctx->cnx, bytes, bytes_max, ctx->received_data, ctx->current_time);
+}
+
+static const uint8_t* picoquic_dispatch_ack_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_ack_frame(ctx->cnx, bytes, bytes_max, ctx->current_time, ctx->epoch, 0, 0, ctx->packet_data);
+}
+
+static const uint8_t* picoquic_dispatch_ack_ecn_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_ack_frame(ctx->cnx, bytes, bytes_max, ctx->current_time, ctx->epoch, 1, 0, ctx->packet_data);
+}
+
+static const uint8_t* picoquic_dispatch_stream_reset_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_stream_reset_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_connection_close_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_connection_close_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_application_close_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_application_close_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_max_data_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_max_data_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_max_stream_data_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_max_stream_data_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_max_streams_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_max_streams_frame(ctx->cnx, bytes, bytes_max, bytes[0]);
+}
+
+static const uint8_t* picoquic_dispatch_blocked_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_blocked_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_stream_blocked_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_stream_blocked_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_streams_blocked_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_streams_blocked_frame(ctx->cnx, bytes, bytes_max, bytes[0]);
+}
+
+static const uint8_t* picoquic_dispatch_new_connection_id_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_new_connection_id_frame(ctx->cnx, bytes, bytes_max, ctx->current_time, 0);
+}
+
+static const uint8_t* picoquic_dispatch_stop_sending_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_stop_sending_frame(ctx->cnx, bytes, bytes_max);
+}
+
+static const uint8_t* picoquic_dispatch_path_challenge_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_path_challenge_frame(ctx->cnx, bytes, bytes_max,
+        (ctx->path_is_not_allocated) ? NULL : ctx->path_x, ctx->addr_from, ctx->addr_to);
+}
+
+static const uint8_t* picoquic_dispatch_path_response_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_path_response_frame(ctx->cnx, bytes, bytes_max,
+        (ctx->path_is_not_allocated) ? NULL : ctx->path_x, ctx->current_time);
+}
+
+static const uint8_t* picoquic_dispatch_crypto_hs_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_crypto_hs_frame(ctx->cnx, bytes, bytes_max, ctx->received_data, ctx->epoch);
+}
+
+static const uint8_t* picoquic_dispatch_new_token_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    return picoquic_decode_new_token_frame(ctx->cnx, bytes, bytes_max, ctx->current_time, ctx->addr_to);
+}
+
+static const uint8_t* picoquic_dispatch_retire_connection_id_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    /* the old code point for ACK frames, but 0x02 / 0x03 are matched in the table before this */
+    return picoquic_decode_retire_connection_id_frame(ctx->cnx, bytes, bytes_max, ctx->current_time, ctx->path_x, 0);
+}
+
+static const uint8_t* picoquic_dispatch_handshake_done_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(bytes_max);
+#else
+    (void)bytes_max;
+#endif
+    return picoquic_decode_handshake_done_frame(ctx->cnx, bytes, ctx->current_time);
+}
+
+static const uint8_t* picoquic_dispatch_datagram_frame(picoquic_frame_decode_ctx_t* ctx, const uint8_t* bytes, const uint8_t* bytes_max)
+{
+    /* Datagram carrying packets are acked, but not repeated */
+    return picoquic_decode_datagram_frame(ctx->cnx, ctx->path_x, bytes, bytes_max);
+}
+
+#define PICOQUIC_FRAME_DISPATCH_MAX 0x40
+
+static const picoquic_frame_dispatch_entry_t picoquic_frame_dispatch_table[PICOQUIC_FRAME_DISPATCH_MAX] = {
+    [picoquic_frame_type_padding] = { picoquic_dispatch_0len_frame, PICOQUIC_FRAME_EPOCHS_ALL, PICOQUIC_FRAME_FLAG_PATH_PROBING },
+    [picoquic_frame_type_ping] = { picoquic_dispatch_0len_frame, PICOQUIC_FRAME_EPOCHS_ALL, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_ack] = { picoquic_dispatch_ack_frame, PICOQUIC_FRAME_EPOCHS_NOT_0RTT, 0 },
+    [picoquic_frame_type_ack_ecn] = { picoquic_dispatch_ack_ecn_frame, PICOQUIC_FRAME_EPOCHS_NOT_0RTT, 0 },
+    [picoquic_frame_type_reset_stream] = { picoquic_dispatch_stream_reset_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_stop_sending] = { picoquic_dispatch_stop_sending_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_crypto_hs] = { picoquic_dispatch_crypto_hs_frame, PICOQUIC_FRAME_EPOCHS_NOT_0RTT, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_new_token] = { picoquic_dispatch_new_token_frame, PICOQUIC_FRAME_EPOCHS_1RTT, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x08] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x09] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0a] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0b] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0c] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0d] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0e] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [0x0f] = { picoquic_dispatch_stream_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_max_data] = { picoquic_dispatch_max_data_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_max_stream_data] = { picoquic_dispatch_max_stream_data_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_max_streams_bidir] = { picoquic_dispatch_max_streams_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_max_streams_unidir] = { picoquic_dispatch_max_streams_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_data_blocked] = { picoquic_dispatch_blocked_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_stream_data_blocked] = { picoquic_dispatch_stream_blocked_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_streams_blocked_bidir] = { picoquic_dispatch_streams_blocked_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_streams_blocked_unidir] = { picoquic_dispatch_streams_blocked_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_new_connection_id] = { picoquic_dispatch_new_connection_id_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED | PICOQUIC_FRAME_FLAG_PATH_PROBING },
+    [picoquic_frame_type_retire_connection_id] = { picoquic_dispatch_retire_connection_id_frame, PICOQUIC_FRAME_EPOCHS_1RTT, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_path_challenge] = { picoquic_dispatch_path_challenge_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_PATH_PROBING },
+    [picoquic_frame_type_path_response] = { picoquic_dispatch_path_response_frame, PICOQUIC_FRAME_EPOCHS_1RTT, PICOQUIC_FRAME_FLAG_PATH_PROBING },
+    [picoquic_frame_type_connection_close] = { picoquic_dispatch_connection_close_frame, PICOQUIC_FRAME_EPOCHS_ALL, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_application_close] = { picoquic_dispatch_application_close_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_handshake_done] = { picoquic_dispatch_handshake_done_frame, PICOQUIC_FRAME_EPOCHS_1RTT, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_datagram] = { picoquic_dispatch_datagram_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+    [picoquic_frame_type_datagram_l] = { picoquic_dispatch_datagram_frame, PICOQUIC_FRAME_EPOCHS_DATA, PICOQUIC_FRAME_FLAG_ACK_NEEDED },
+};
+
 int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, const uint8_t* bytes,
     size_t bytes_maxsize,
     picoquic_stream_data_node_t* received_data,
@@ -6175,254 +6883,144 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, const
     int is_path_probing_packet = 1; /* Will be set to zero if non probing frame received */
     picoquic_packet_context_enum pc = picoquic_context_from_epoch(epoch);
     picoquic_packet_data_t packet_data;
+    picoquic_frame_decode_ctx_t ctx;
 
     memset(&packet_data, 0, sizeof(packet_data));
+    ctx.cnx = cnx;
+    ctx.path_x = path_x;
+    ctx.received_data = received_data;
+    ctx.addr_from = addr_from;
+    ctx.addr_to = addr_to;
+    ctx.current_time = current_time;
+    ctx.packet_data = &packet_data;
+    ctx.epoch = epoch;
+    ctx.path_is_not_allocated = path_is_not_allocated;
 
     while (bytes != NULL && bytes < bytes_max) {
         uint8_t first_byte = bytes[0];
         int is_path_probing_frame = 0;
+        const picoquic_frame_dispatch_entry_t* entry =
+            (first_byte < PICOQUIC_FRAME_DISPATCH_MAX) ? &picoquic_frame_dispatch_table[first_byte] : NULL;
 
-        if (PICOQUIC_IN_RANGE(first_byte, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
-            if (epoch != picoquic_epoch_0rtt && epoch != picoquic_epoch_1rtt) {
-                DBG_PRINTF("Data frame (0x%x), when only TLS stream is expected", first_byte);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                bytes = NULL;
-                break;
-            }
-
-            bytes = picoquic_decode_stream_frame(cnx, bytes, bytes_max, received_data, current_time);
-            ack_needed = 1;
-
+        if (entry != NULL && entry->decoder == NULL) {
+            entry = NULL;
         }
-        else if (first_byte == picoquic_frame_type_ack) {
-            if (epoch == picoquic_epoch_0rtt) {
-                DBG_PRINTF("Ack frame (0x%x) not expected in 0-RTT packet", first_byte);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                bytes = NULL;
-                break;
-            }
-            bytes = picoquic_decode_ack_frame(cnx, bytes, bytes_max, current_time, epoch, 0, 0, &packet_data);
-        }
-        else if (first_byte == picoquic_frame_type_ack_ecn) {
-            if (epoch == picoquic_epoch_0rtt) {
-                DBG_PRINTF("Ack-ECN frame (0x%x) not expected in 0-RTT packet", first_byte);
+
+        if (entry != NULL) {
+            if ((entry->epoch_mask & (1u << epoch)) == 0) {
+                DBG_PRINTF("Frame (0x%x) not expected in epoch %d", first_byte, epoch);
                 picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
                 bytes = NULL;
                 break;
             }
-            bytes = picoquic_decode_ack_frame(cnx, bytes, bytes_max, current_time, epoch, 1, 0, &packet_data);
+            is_path_probing_frame = (entry->flags & PICOQUIC_FRAME_FLAG_PATH_PROBING) != 0;
+            ack_needed |= (entry->flags & PICOQUIC_FRAME_FLAG_ACK_NEEDED);
+            bytes = entry->decoder(&ctx, bytes, bytes_max);
         }
-        else if (epoch != picoquic_epoch_0rtt && epoch != picoquic_epoch_1rtt && first_byte != picoquic_frame_type_padding
-            && first_byte != picoquic_frame_type_ping
-            && first_byte != picoquic_frame_type_connection_close
-            && first_byte != picoquic_frame_type_crypto_hs) {
-            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-            bytes = NULL;
-            break;
-        }
-        else if (epoch == picoquic_epoch_0rtt && (first_byte == picoquic_frame_type_crypto_hs
-            || first_byte == picoquic_frame_type_handshake_done
-            || first_byte == picoquic_frame_type_new_token
-            || first_byte == picoquic_frame_type_path_response
-            || first_byte == picoquic_frame_type_retire_connection_id)) {
-            /* From draft-31:
-             * Note that it is not possible to send the following frames in 0-RTT
-             * packets for various reasons : ACK, CRYPTO, HANDSHAKE_DONE, NEW_TOKEN,
-             * PATH_RESPONSE, and RETIRE_CONNECTION_ID.A server MAY treat receipt
-             * of these frames in 0 - RTT packets as a connection error of type
-             * PROTOCOL_VIOLATION.
-             */
+        else if (epoch != picoquic_epoch_0rtt && epoch != picoquic_epoch_1rtt) {
+            /* Extension and unknown frame types are only expected in 0-RTT or 1-RTT packets */
             picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
             bytes = NULL;
             break;
         }
         else {
-            switch (first_byte) {
-            case picoquic_frame_type_padding:
-                is_path_probing_frame = 1;
-                bytes = picoquic_skip_0len_frame(bytes, bytes_max);
-                break;
-            case picoquic_frame_type_reset_stream:
-                bytes = picoquic_decode_stream_reset_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_connection_close:
-                bytes = picoquic_decode_connection_close_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_application_close:
-                bytes = picoquic_decode_application_close_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_max_data:
-                bytes = picoquic_decode_max_data_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_max_stream_data:
-                bytes = picoquic_decode_max_stream_data_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_max_streams_bidir:
-            case picoquic_frame_type_max_streams_unidir:
-                bytes = picoquic_decode_max_streams_frame(cnx, bytes, bytes_max, first_byte);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_ping:
-                bytes = picoquic_skip_0len_frame(bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_data_blocked:
-                bytes = picoquic_decode_blocked_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_stream_data_blocked:
-                bytes = picoquic_decode_stream_blocked_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_streams_blocked_unidir:
-            case picoquic_frame_type_streams_blocked_bidir:
-                bytes = picoquic_decode_streams_blocked_frame(cnx, bytes, bytes_max, first_byte);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_new_connection_id:
-                is_path_probing_frame = 1;
-                bytes = picoquic_decode_new_connection_id_frame(cnx, bytes, bytes_max, current_time, 0);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_stop_sending:
-                bytes = picoquic_decode_stop_sending_frame(cnx, bytes, bytes_max);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_path_challenge:
-                is_path_probing_frame = 1;
-                bytes = picoquic_decode_path_challenge_frame(cnx, bytes, bytes_max, 
-                    (path_is_not_allocated)?NULL:path_x, addr_from, addr_to);
-                break;
-            case picoquic_frame_type_path_response:
-                is_path_probing_frame = 1;
-                bytes = picoquic_decode_path_response_frame(cnx, bytes, bytes_max,
-                    (path_is_not_allocated) ? NULL : path_x, current_time);
-                break;
-            case picoquic_frame_type_crypto_hs:
-                bytes = picoquic_decode_crypto_hs_frame(cnx, bytes, bytes_max, received_data, epoch);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_new_token:
-                bytes = picoquic_decode_new_token_frame(cnx, bytes, bytes_max, current_time, addr_to);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_retire_connection_id:
-                /* the old code point for ACK frames, but this is taken care of in the ACK tests above */
-                bytes = picoquic_decode_retire_connection_id_frame(cnx, bytes, bytes_max, current_time, path_x, 0);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_handshake_done:
-                bytes = picoquic_decode_handshake_done_frame(cnx, bytes, current_time);
-                ack_needed = 1;
-                break;
-            case picoquic_frame_type_datagram:
-            case picoquic_frame_type_datagram_l:
-                /* Datagram carrying packets are acked, but not repeated */
-                ack_needed = 1;
-                bytes = picoquic_decode_datagram_frame(cnx, path_x, bytes, bytes_max);
-                break;
-            default: {
-                uint64_t frame_id64;
-                const uint8_t* bytes0 = bytes;
-
-                if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame_id64)) != NULL) {
-                    if (epoch == picoquic_epoch_0rtt &&
-                        frame_id64 != picoquic_frame_type_bdp) {
-                        /* By default, extension frames should not be used in 0rtt */
-                        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                        bytes = NULL;
+            uint64_t frame_id64;
+            const uint8_t* bytes0 = bytes;
+
+            if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame_id64)) != NULL) {
+                if (epoch == picoquic_epoch_0rtt &&
+                    frame_id64 != picoquic_frame_type_bdp) {
+                    /* By default, extension frames should not be used in 0rtt */
+                    picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
+                    bytes = NULL;
+                }
+                else {
+                    switch (frame_id64) {
+                    case picoquic_frame_type_ack_frequency:
+                        bytes = picoquic_decode_ack_frequency_frame(bytes, bytes_max, cnx);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_immediate_ack:
+                        bytes = picoquic_decode_immediate_ack_frame(bytes, bytes_max, cnx, path_x, current_time);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_time_stamp:
+                        bytes = picoquic_decode_time_stamp_frame(bytes, bytes_max, cnx, &packet_data);
+                        break;
+                    case picoquic_frame_type_path_ack: {
+                        bytes = picoquic_decode_ack_frame(cnx, bytes0, bytes_max, current_time, epoch, 0, 1, &packet_data);
+                        break;
                     }
-                    else {
-                        switch (frame_id64) {
-                        case picoquic_frame_type_ack_frequency:
-                            bytes = picoquic_decode_ack_frequency_frame(bytes, bytes_max, cnx);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_immediate_ack:
-                            bytes = picoquic_decode_immediate_ack_frame(bytes, bytes_max, cnx, path_x, current_time);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_time_stamp:
-                            bytes = picoquic_decode_time_stamp_frame(bytes, bytes_max, cnx, &packet_data);
-                            break;
-                        case picoquic_frame_type_path_ack: {
-                            bytes = picoquic_decode_ack_frame(cnx, bytes0, bytes_max, current_time, epoch, 0, 1, &packet_data);
+                    case picoquic_frame_type_path_ack_ecn: {
+                        bytes = picoquic_decode_ack_frame(cnx, bytes0, bytes_max, current_time, epoch, 1, 1, &packet_data);
+                        break;
+                    }
+                    case picoquic_frame_type_path_abandon:
+                        bytes = picoquic_decode_path_abandon_frame(bytes, bytes_max, cnx, current_time);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_path_backup:
+                    case picoquic_frame_type_path_available:
+                        bytes = picoquic_decode_path_available_or_standby_frame(bytes, bytes_max, frame_id64, cnx, current_time);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_max_path_id:
+                        bytes = picoquic_decode_max_path_id_frame(bytes, bytes_max, cnx);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_path_blocked:
+                        bytes = picoquic_decode_path_blocked_frame(bytes, bytes_max, cnx);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_path_new_connection_id:
+                        is_path_probing_frame = 1;
+                        bytes = picoquic_decode_new_connection_id_frame(cnx, bytes0, bytes_max, current_time, 1);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_path_retire_connection_id:
+                        bytes = picoquic_decode_retire_connection_id_frame(cnx, bytes0, bytes_max, current_time, path_x, 1);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_bdp:
+                        if (cnx->client_mode && epoch != picoquic_epoch_1rtt) {
+                            DBG_PRINTF("BDP frame (0x%x) is expected in 1-RTT packet", first_byte);
+                            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
+                            bytes = NULL;
                             break;
                         }
-                        case picoquic_frame_type_path_ack_ecn: {
-                            bytes = picoquic_decode_ack_frame(cnx, bytes0, bytes_max, current_time, epoch, 1, 1, &packet_data);
+                        if (!cnx->client_mode && epoch != picoquic_epoch_0rtt && epoch != picoquic_epoch_1rtt) {
+                            DBG_PRINTF("BDP frame (0x%x) is expected in 0-RTT packet", first_byte);
+                            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
+                            bytes = NULL;
                             break;
                         }
-                        case picoquic_frame_type_path_abandon:
-                            bytes = picoquic_decode_path_abandon_frame(bytes, bytes_max, cnx, current_time);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_path_backup:
-                        case picoquic_frame_type_path_available:
-                            bytes = picoquic_decode_path_available_or_standby_frame(bytes, bytes_max, frame_id64, cnx, current_time);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_max_path_id:
-                            bytes = picoquic_decode_max_path_id_frame(bytes, bytes_max, cnx);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_path_blocked:
-                            bytes = picoquic_decode_path_blocked_frame(bytes, bytes_max, cnx);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_path_new_connection_id:
-                            is_path_probing_frame = 1;
-                            bytes = picoquic_decode_new_connection_id_frame(cnx, bytes0, bytes_max, current_time, 1);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_path_retire_connection_id:
-                            bytes = picoquic_decode_retire_connection_id_frame(cnx, bytes0, bytes_max, current_time, path_x, 1);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_bdp:
-                            if (cnx->client_mode && epoch != picoquic_epoch_1rtt) {
-                                DBG_PRINTF("BDP frame (0x%x) is expected in 1-RTT packet", first_byte);
-                                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                                bytes = NULL;
-                                break;
-                            }
-                            if (!cnx->client_mode && epoch != picoquic_epoch_0rtt && epoch != picoquic_epoch_1rtt) {
-                                DBG_PRINTF("BDP frame (0x%x) is expected in 0-RTT packet", first_byte);
-                                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
-                                bytes = NULL;
-                                break;
-                            }
-                            if (cnx->client_mode && cnx->local_parameters.enable_bdp_frame == 0) {
-                                DBG_PRINTF("BDP frame (0x%x) not expected", first_byte);
-                                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, 0);
-                                bytes = NULL;
-                                break;
-                            }
-
-                            bytes = picoquic_decode_bdp_frame(cnx, bytes, bytes_max, current_time, addr_from, path_x);
-                            ack_needed = 1;
-                            break;
-                        case picoquic_frame_type_observed_address_v4:
-                        case picoquic_frame_type_observed_address_v6:
-                            is_path_probing_frame = 1;
-                            ack_needed = 1;
-                            bytes = picoquic_decode_observed_address_frame(cnx, bytes, bytes_max, path_x, frame_id64);
-                            break;
-                        default:
-                            /* Not implemented yet! */
-                            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, frame_id64);
+                        if (cnx->client_mode && cnx->local_parameters.enable_bdp_frame == 0) {
+                            DBG_PRINTF("BDP frame (0x%x) not expected", first_byte);
+                            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, 0);
                             bytes = NULL;
                             break;
                         }
+
+                        bytes = picoquic_decode_bdp_frame(cnx, bytes, bytes_max, current_time, addr_from, path_x);
+                        ack_needed = 1;
+                        break;
+                    case picoquic_frame_type_observed_address_v4:
+                    case picoquic_frame_type_observed_address_v6:
+                        is_path_probing_frame = 1;
+                        ack_needed = 1;
+                        bytes = picoquic_decode_observed_address_frame(cnx, bytes, bytes_max, path_x, frame_id64);
+                        break;
+                    case picoquic_frame_type_fec_repair:
+                        bytes = picoquic_decode_fec_repair_frame(cnx, path_x, bytes, bytes_max, current_time);
+                        ack_needed = 1;
+                        break;
+                    default:
+                        /* Not implemented yet! */
+                        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, frame_id64);
+                        bytes = NULL;
+                        break;
                     }
                 }
-                break;
-            }
             }
         }
         is_path_probing_packet &= is_path_probing_frame;
@@ -6736,6 +7334,10 @@ int picoquic_skip_frame(const uint8_t* bytes, size_t bytes_maxsize, size_t* cons
                     bytes = picoquic_skip_observed_address_frame(bytes, bytes_max, frame_id64);
                     *pure_ack = 0;
                     break;
+                case picoquic_frame_type_fec_repair:
+                    bytes = picoquic_skip_fec_repair_frame(bytes, bytes_max);
+                    *pure_ack = 0;
+                    break;
                 default:
                     /* Not implemented yet! */
                     bytes = NULL;
@@ -0,0 +1,226 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2021, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Hot restart support.
+ *
+ * For a binary upgrade, the old and the new process bind the same port
+ * with SO_REUSEPORT. The old process stops accepting new connections
+ * (picoquic_stop_accepting) and exports its resumption-critical state as
+ * an opaque blob; the application carries the blob to the new process,
+ * typically over a unix socket, where importing it installs the same
+ * stateless reset and retry seeds, ticket and retry token keys, and
+ * QUIC-LB configuration. Returning clients then resume their sessions
+ * against the new process instead of reconnecting from scratch, while
+ * the old process drains its established connections and exits.
+ *
+ * The blob is a five byte header (magic, format version) followed by
+ * records of type (1 byte), length (2 bytes) and value. Unknown record
+ * types are skipped, so a newer process can import the state of an
+ * older one. The library does not open the handover channel itself:
+ * sockets belong to the application, as everywhere else in picoquic.
+ */
+
+#include "picoquic_internal.h"
+#include "picoquic_lb.h"
+#include "tls_api.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PICOQUIC_RESTART_STATE_MAGIC 0x50515248
+#define PICOQUIC_RESTART_STATE_VERSION 1
+
+typedef enum {
+    picoquic_restart_record_reset_seed = 1,
+    picoquic_restart_record_retry_seed = 2,
+    picoquic_restart_record_ticket_secret = 3,
+    picoquic_restart_record_retry_token_secret = 4,
+    picoquic_restart_record_lb_config = 5
+} picoquic_restart_record_enum;
+
+#define PICOQUIC_RESTART_LB_CONFIG_SIZE 29
+
+void picoquic_stop_accepting(picoquic_quic_t* quic)
+{
+    quic->server_busy = 1;
+}
+
+static uint8_t* picoquic_restart_record_encode(uint8_t* bytes, const uint8_t* bytes_max,
+    uint8_t record_type, const uint8_t* value, size_t length)
+{
+    if (bytes == NULL || bytes + 3 + length > bytes_max) {
+        bytes = NULL;
+    }
+    else {
+        *bytes++ = record_type;
+        picoformat_16(bytes, (uint16_t)length);
+        bytes += 2;
+        memcpy(bytes, value, length);
+        bytes += length;
+    }
+
+    return bytes;
+}
+
+int picoquic_export_restart_state(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_max,
+    size_t* consumed)
+{
+    int ret = 0;
+    uint8_t* next = bytes;
+    const uint8_t* limit = bytes + bytes_max;
+
+    *consumed = 0;
+
+    if (bytes_max < 5) {
+        next = NULL;
+    }
+    else {
+        picoformat_32(next, PICOQUIC_RESTART_STATE_MAGIC);
+        next += 4;
+        *next++ = PICOQUIC_RESTART_STATE_VERSION;
+
+        next = picoquic_restart_record_encode(next, limit, picoquic_restart_record_reset_seed,
+            quic->reset_seed, sizeof(quic->reset_seed));
+        next = picoquic_restart_record_encode(next, limit, picoquic_restart_record_retry_seed,
+            quic->retry_seed, sizeof(quic->retry_seed));
+
+        if (quic->has_ticket_crypto_secret) {
+            next = picoquic_restart_record_encode(next, limit, picoquic_restart_record_ticket_secret,
+                quic->ticket_crypto_secret, sizeof(quic->ticket_crypto_secret));
+        }
+        if (quic->has_retry_token_secret) {
+            next = picoquic_restart_record_encode(next, limit, picoquic_restart_record_retry_token_secret,
+                quic->retry_token_secret, sizeof(quic->retry_token_secret));
+        }
+        if (quic->cnx_id_callback_fn == picoquic_lb_compat_cid_generate &&
+            quic->cnx_id_callback_ctx != NULL) {
+            picoquic_load_balancer_config_t* lb_config =
+                &((picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx)->config;
+            uint8_t config_bytes[PICOQUIC_RESTART_LB_CONFIG_SIZE];
+
+            config_bytes[0] = (uint8_t)lb_config->method;
+            config_bytes[1] = (uint8_t)(lb_config->rotation_bits |
+                (lb_config->first_byte_encodes_length << 2));
+            config_bytes[2] = lb_config->server_id_length;
+            config_bytes[3] = lb_config->nonce_length;
+            config_bytes[4] = lb_config->connection_id_length;
+            picoformat_64(config_bytes + 5, lb_config->server_id64);
+            memcpy(config_bytes + 13, lb_config->cid_encryption_key, 16);
+
+            next = picoquic_restart_record_encode(next, limit, picoquic_restart_record_lb_config,
+                config_bytes, sizeof(config_bytes));
+        }
+    }
+
+    if (next == NULL) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        *consumed = next - bytes;
+    }
+
+    return ret;
+}
+
+int picoquic_import_restart_state(picoquic_quic_t* quic, const uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    size_t byte_index = 5;
+
+    if (length < 5 ||
+        PICOPARSE_32(bytes) != PICOQUIC_RESTART_STATE_MAGIC ||
+        bytes[4] != PICOQUIC_RESTART_STATE_VERSION) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    while (ret == 0 && byte_index < length) {
+        uint8_t record_type;
+        uint16_t record_length;
+        const uint8_t* value;
+
+        if (byte_index + 3 > length) {
+            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+            break;
+        }
+        record_type = bytes[byte_index];
+        record_length = PICOPARSE_16(bytes + byte_index + 1);
+        value = bytes + byte_index + 3;
+        byte_index += 3 + (size_t)record_length;
+        if (byte_index > length) {
+            ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+            break;
+        }
+
+        switch (record_type) {
+        case picoquic_restart_record_reset_seed:
+            if (record_length != sizeof(quic->reset_seed)) {
+                ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+            }
+            else {
+                memcpy(quic->reset_seed, value, sizeof(quic->reset_seed));
+            }
+            break;
+        case picoquic_restart_record_retry_seed:
+            if (record_length != sizeof(quic->retry_seed)) {
+                ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+            }
+            else {
+                memcpy(quic->retry_seed, value, sizeof(quic->retry_seed));
+            }
+            break;
+        case picoquic_restart_record_ticket_secret:
+            ret = picoquic_set_ticket_crypto_secret(quic, value, record_length);
+            break;
+        case picoquic_restart_record_retry_token_secret:
+            ret = picoquic_set_retry_token_key(quic, value, record_length);
+            break;
+        case picoquic_restart_record_lb_config:
+            if (record_length != PICOQUIC_RESTART_LB_CONFIG_SIZE) {
+                ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+            }
+            else {
+                picoquic_load_balancer_config_t lb_config;
+
+                memset(&lb_config, 0, sizeof(lb_config));
+                lb_config.method = (picoquic_load_balancer_cid_method_enum)value[0];
+                lb_config.rotation_bits = value[1] & 3;
+                lb_config.first_byte_encodes_length = (value[1] >> 2) & 1;
+                lb_config.server_id_length = value[2];
+                lb_config.nonce_length = value[3];
+                lb_config.connection_id_length = value[4];
+                lb_config.server_id64 = PICOPARSE_64(value + 5);
+                memcpy(lb_config.cid_encryption_key, value + 13, 16);
+
+                if (quic->cnx_id_callback_fn == picoquic_lb_compat_cid_generate) {
+                    ret = picoquic_lb_compat_cid_config_update(quic, &lb_config);
+                }
+                else {
+                    ret = picoquic_lb_compat_cid_config(quic, &lb_config);
+                }
+            }
+            break;
+        default:
+            /* Unknown record, presumably from a newer process; skip it */
+            break;
+        }
+    }
+
+    return ret;
+}
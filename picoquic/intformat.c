@@ -20,9 +20,13 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 #ifndef WIN32
 #include <sys/types.h>
 #endif
+#ifdef _WINDOWS
+#include <stdlib.h>
+#endif
 
 void picoformat_16(uint8_t* bytes, uint16_t n16)
 {
@@ -165,3 +169,68 @@ size_t picoquic_varint_skip(const uint8_t* bytes)
 {
     return picoquic_decode_varint_length(bytes[0]);
 }
+
+/* Batch decoder for hot parse loops, such as the ACK range loop in
+ * frames.c. Lengths are looked up from the two type bits and the value
+ * is extracted from a single unaligned 64 bit load while at least 8
+ * bytes remain in the buffer, which removes the per byte loop and most
+ * branches of picoquic_varint_decode. The last few varints of a buffer
+ * go through the classic decoder. */
+
+static const uint8_t picoquic_varint_length_table[4] = { 1, 2, 4, 8 };
+
+static const uint64_t picoquic_varint_mask_table[4] = {
+    0x3Full, 0x3FFFull, 0x3FFFFFFFull, 0x3FFFFFFFFFFFFFFFull
+};
+
+static uint64_t picoquic_varint_load64_be(const uint8_t* bytes)
+{
+    uint64_t w;
+
+    memcpy(&w, bytes, 8);
+#ifdef _WINDOWS
+    w = _byteswap_uint64(w);
+#elif defined(__GNUC__)
+    w = __builtin_bswap64(w);
+#else
+    w = ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+        ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+        ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+        ((uint64_t)bytes[6] << 8) | (uint64_t)bytes[7];
+#endif
+    return w;
+}
+
+/* Decode up to nb_max consecutive varints from the buffer. Decoding
+ * stops at nb_max, at the end of the buffer, or at a varint that the
+ * buffer truncates. Returns the number of bytes consumed and sets
+ * *nb_decoded to the number of values stored in n64. */
+size_t picoquic_varint_decode_batch(const uint8_t* bytes, size_t max_bytes, uint64_t* n64, size_t nb_max, size_t* nb_decoded)
+{
+    size_t byte_index = 0;
+    size_t decoded = 0;
+
+    while (decoded < nb_max && byte_index < max_bytes) {
+        unsigned int tag = bytes[byte_index] >> 6;
+        size_t length = picoquic_varint_length_table[tag];
+
+        if (byte_index + length > max_bytes) {
+            break;
+        }
+
+        if (max_bytes - byte_index >= 8) {
+            uint64_t w = picoquic_varint_load64_be(bytes + byte_index);
+            n64[decoded] = (w >> ((8 - length) * 8)) & picoquic_varint_mask_table[tag];
+        }
+        else {
+            (void)picoquic_varint_decode(bytes + byte_index, max_bytes - byte_index, &n64[decoded]);
+        }
+
+        decoded++;
+        byte_index += length;
+    }
+
+    *nb_decoded = decoded;
+
+    return byte_index;
+}
@@ -24,6 +24,12 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "picoquic_binlog.h"
 #include "bytestream.h"
 #include "tls_api.h"
@@ -656,12 +662,30 @@ void picoquic_binlog_frames(FILE * f, const uint8_t* bytes, size_t length)
     }
 }
 
-static void binlog_compose_event_header(bytestream* msg, const picoquic_connection_id_t* cid, uint64_t current_time,
+/* Zigzag encoding of signed deltas in the v2 binlog: small deltas of
+ * either sign become small varints. */
+static uint64_t binlog_zigzag(uint64_t value, uint64_t previous)
+{
+    int64_t delta = (int64_t)(value - previous);
+
+    return ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+}
+
+static void binlog_compose_event_header(bytestream* msg, picoquic_cnx_t* cnx,
+    const picoquic_connection_id_t* cid, uint64_t current_time,
     uint64_t path_id, picoquic_log_event_type event_type)
 {
     /* Common chunk header */
     bytewrite_cid(msg, cid);
-    bytewrite_vint(msg, current_time);
+    if (cnx != NULL && cnx->binlog_is_v2) {
+        /* v2 format: the event time is a zigzag encoded delta from the
+         * previous event of the connection. */
+        bytewrite_vint(msg, binlog_zigzag(current_time, cnx->binlog_time_prev));
+        cnx->binlog_time_prev = current_time;
+    }
+    else {
+        bytewrite_vint(msg, current_time);
+    }
     bytewrite_vint(msg, path_id);
     bytewrite_vint(msg, (uint64_t)event_type);
 }
@@ -677,14 +701,473 @@ static uint64_t binlog_get_path_id(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
     return path_id;
 }
 
-void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+/* Dedicated binlog writer thread. When enabled, each complete event is
+ * copied into a slot of a fixed size ring instead of being written by
+ * the loop thread; a writer thread drains the ring to the log files. The
+ * ring is lock free: the loop thread only writes the head index and the
+ * slot it designates, the writer thread only writes the tail index, and
+ * each index is published with release semantics after the slot content.
+ * If the ring is full, or an event is larger than a slot, the event is
+ * dropped and counted, so logging never blocks the loop thread. */
+
+#define PICOQUIC_BINLOG_RING_SLOTS 256
+#define PICOQUIC_BINLOG_SLOT_SIZE 4096
+
+#ifdef _WINDOWS
+/* MSVC gives volatile accesses acquire/release semantics by default */
+#define binlog_ring_load(x) (x)
+#define binlog_ring_store(p, v) (void)InterlockedExchange64((LONG64 volatile*)(p), (LONG64)(v))
+#else
+#define binlog_ring_load(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define binlog_ring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+typedef struct st_picoquic_binlog_slot_t {
+    FILE* f;
+    size_t length;
+    uint8_t bytes[PICOQUIC_BINLOG_SLOT_SIZE];
+} picoquic_binlog_slot_t;
+
+typedef struct st_picoquic_binlog_ring_t {
+    picoquic_thread_t writer;
+    picoquic_event_t work_ready;
+    picoquic_event_t work_done;
+    volatile uint64_t head; /* next slot to fill, owned by the loop thread */
+    volatile uint64_t tail; /* next slot to drain, owned by the writer */
+    volatile int should_close;
+    uint64_t nb_dropped; /* events lost to a full ring, loop thread only */
+    picoquic_binlog_slot_t slots[PICOQUIC_BINLOG_RING_SLOTS];
+} picoquic_binlog_ring_t;
+
+static picoquic_thread_return_t picoquic_binlog_writer(void* v_ring)
+{
+    picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)v_ring;
+
+    while (!ring->should_close) {
+        uint64_t tail = ring->tail;
+
+        if (tail == binlog_ring_load(ring->head)) {
+            /* Timed wait, so a lost wake up only delays the write */
+            (void)picoquic_wait_for_event(&ring->work_ready, 1000);
+        }
+        else {
+            picoquic_binlog_slot_t* slot = &ring->slots[tail % PICOQUIC_BINLOG_RING_SLOTS];
+
+            (void)fwrite(slot->bytes, 1, slot->length, slot->f);
+            binlog_ring_store(&ring->tail, tail + 1);
+            (void)picoquic_signal_event(&ring->work_done);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+/* Post one event, made of up to two contiguous parts, on the ring.
+ * Runs on the loop thread. */
+static void binlog_ring_post(picoquic_binlog_ring_t* ring, FILE* f,
+    const uint8_t* part1, size_t len1, const uint8_t* part2, size_t len2)
+{
+    uint64_t head = ring->head;
+
+    if (len1 + len2 > PICOQUIC_BINLOG_SLOT_SIZE ||
+        head - binlog_ring_load(ring->tail) >= PICOQUIC_BINLOG_RING_SLOTS) {
+        ring->nb_dropped++;
+    }
+    else {
+        picoquic_binlog_slot_t* slot = &ring->slots[head % PICOQUIC_BINLOG_RING_SLOTS];
+
+        slot->f = f;
+        if (len1 > 0) {
+            memcpy(slot->bytes, part1, len1);
+        }
+        if (len2 > 0) {
+            memcpy(slot->bytes + len1, part2, len2);
+        }
+        slot->length = len1 + len2;
+        binlog_ring_store(&ring->head, head + 1);
+        (void)picoquic_signal_event(&ring->work_ready);
+    }
+}
+
+/* Wait until the writer thread has drained the ring. Called from the
+ * loop thread before a log file is written to directly or closed. */
+static void binlog_ring_sync(picoquic_quic_t* quic)
+{
+    picoquic_binlog_ring_t* ring = quic->binlog_ring;
+
+    if (ring != NULL) {
+        while (binlog_ring_load(ring->tail) != ring->head) {
+            (void)picoquic_wait_for_event(&ring->work_done, 1000);
+        }
+    }
+}
+
+int picoquic_set_binlog_thread(picoquic_quic_t* quic, int enabled)
+{
+    int ret = 0;
+
+    if (enabled) {
+#ifdef _WINDOWS
+        /* Staging the packet events requires open_memstream */
+        ret = -1;
+#else
+        if (quic->binlog_ring == NULL) {
+            picoquic_binlog_ring_t* ring = (picoquic_binlog_ring_t*)malloc(sizeof(picoquic_binlog_ring_t));
+
+            if (ring == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(ring, 0, sizeof(picoquic_binlog_ring_t));
+                if (picoquic_create_event(&ring->work_ready) != 0 ||
+                    picoquic_create_event(&ring->work_done) != 0 ||
+                    picoquic_create_thread(&ring->writer, picoquic_binlog_writer, ring) != 0) {
+                    picoquic_delete_event(&ring->work_ready);
+                    picoquic_delete_event(&ring->work_done);
+                    free(ring);
+                    ret = -1;
+                }
+                else {
+                    PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_log, sizeof(picoquic_binlog_ring_t));
+                    quic->binlog_ring = ring;
+                }
+            }
+        }
+#endif
+    }
+    else if (quic->binlog_ring != NULL) {
+        picoquic_binlog_ring_t* ring = quic->binlog_ring;
+
+        binlog_ring_sync(quic);
+        ring->should_close = 1;
+        (void)picoquic_signal_event(&ring->work_ready);
+        picoquic_delete_thread(&ring->writer);
+        picoquic_delete_event(&ring->work_ready);
+        picoquic_delete_event(&ring->work_done);
+        if (ring->nb_dropped > 0) {
+            DBG_PRINTF("Binlog ring dropped %" PRIu64 " events", ring->nb_dropped);
+        }
+        quic->binlog_ring = NULL;
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_log, sizeof(picoquic_binlog_ring_t));
+        free(ring);
+    }
+
+    return ret;
+}
+
+uint64_t picoquic_get_binlog_dropped(picoquic_quic_t* quic)
+{
+    return (quic->binlog_ring == NULL) ? 0 : quic->binlog_ring->nb_dropped;
+}
+
+/* Memory mapped binlog output. When enabled, the per connection log file
+ * is extended in large chunks and mapped into memory; each event
+ * reserves space with an atomic bump of the write offset and is copied
+ * straight into the mapping, so writing an event costs two memcpy and no
+ * syscall. The four byte length prefix of the chunk is written last:
+ * after a crash, the converter stops at the first zero length, so the
+ * file always ends on a complete record. The file is truncated to the
+ * exact length when the connection closes. */
+
+#ifndef _WINDOWS
+
+#define PICOQUIC_BINLOG_MMAP_CHUNK 0x100000
+
+typedef struct st_picoquic_binlog_mmap_t {
+    uint8_t* base;
+    size_t mapped_size;
+    volatile uint64_t offset; /* next free byte in the file */
+    int fd;
+} picoquic_binlog_mmap_t;
+
+/* Attach a memory mapping to the binlog file that was just created for
+ * the connection. On any failure the mapping is abandoned and the
+ * connection falls back to buffered writes. */
+static void binlog_mmap_attach(picoquic_cnx_t* cnx)
+{
+    picoquic_binlog_mmap_t* bm = (picoquic_binlog_mmap_t*)malloc(sizeof(picoquic_binlog_mmap_t));
+    long header_size = -1;
+    void* mapped = MAP_FAILED;
+
+    if (bm == NULL) {
+        return;
+    }
+    memset(bm, 0, sizeof(picoquic_binlog_mmap_t));
+    bm->fd = -1;
+
+    /* The file header and the new connection event were written through
+     * stdio; flush them so the mapping starts from a clean file */
+    if (fflush(cnx->f_binlog) == 0 &&
+        (header_size = ftell(cnx->f_binlog)) >= 0 &&
+        (bm->fd = open(cnx->binlog_file_name, O_RDWR)) >= 0 &&
+        ftruncate(bm->fd, PICOQUIC_BINLOG_MMAP_CHUNK) == 0) {
+        mapped = mmap(NULL, PICOQUIC_BINLOG_MMAP_CHUNK, PROT_READ | PROT_WRITE,
+            MAP_SHARED, bm->fd, 0);
+    }
+
+    if (mapped == MAP_FAILED) {
+        if (bm->fd >= 0) {
+            if (header_size >= 0) {
+                (void)ftruncate(bm->fd, header_size);
+            }
+            (void)close(bm->fd);
+        }
+        free(bm);
+    }
+    else {
+        bm->base = (uint8_t*)mapped;
+        bm->mapped_size = PICOQUIC_BINLOG_MMAP_CHUNK;
+        bm->offset = (uint64_t)header_size;
+        cnx->binlog_mmap = bm;
+    }
+}
+
+/* Grow the file and the mapping so "required" bytes fit. Runs on the
+ * loop thread, which is the only writer. */
+static int binlog_mmap_grow(picoquic_binlog_mmap_t* bm, uint64_t required)
+{
+    int ret = 0;
+    size_t new_size = bm->mapped_size;
+    void* mapped;
+
+    while (new_size < required) {
+        new_size += PICOQUIC_BINLOG_MMAP_CHUNK;
+    }
+
+    if (ftruncate(bm->fd, new_size) != 0 ||
+        (mapped = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, bm->fd, 0)) == MAP_FAILED) {
+        ret = -1;
+    }
+    else {
+        (void)munmap(bm->base, bm->mapped_size);
+        bm->base = (uint8_t*)mapped;
+        bm->mapped_size = new_size;
+    }
+
+    return ret;
+}
+
+/* Append one complete chunk, made of up to two contiguous parts. The
+ * first part starts with the four byte chunk length, which is written
+ * into the mapping last. */
+static void binlog_mmap_append(picoquic_binlog_mmap_t* bm,
+    const uint8_t* part1, size_t len1, const uint8_t* part2, size_t len2)
+{
+    size_t length = len1 + len2;
+
+    if (len1 >= 4) {
+        uint64_t offset = __atomic_fetch_add(&bm->offset, length, __ATOMIC_RELAXED);
+
+        if (offset + length <= bm->mapped_size ||
+            binlog_mmap_grow(bm, offset + length) == 0) {
+            uint8_t* p = bm->base + offset;
+
+            if (len1 > 4) {
+                memcpy(p + 4, part1 + 4, len1 - 4);
+            }
+            if (len2 > 0) {
+                memcpy(p + len1, part2, len2);
+            }
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            memcpy(p, part1, 4);
+        }
+    }
+}
+
+/* Unmap and truncate the file to the bytes actually written. The stdio
+ * handle is still closed by the caller, but has nothing pending. */
+static void binlog_mmap_detach(picoquic_cnx_t* cnx)
+{
+    picoquic_binlog_mmap_t* bm = cnx->binlog_mmap;
+
+    if (bm != NULL) {
+        (void)munmap(bm->base, bm->mapped_size);
+        (void)ftruncate(bm->fd, (off_t)bm->offset);
+        (void)close(bm->fd);
+        free(bm);
+        cnx->binlog_mmap = NULL;
+    }
+}
+#endif
+
+int picoquic_set_binlog_mmap(picoquic_quic_t* quic, int enabled)
+{
+#ifdef _WINDOWS
+    (void)quic;
+    return (enabled) ? -1 : 0;
+#else
+    quic->use_binlog_mmap = (enabled != 0);
+    return 0;
+#endif
+}
+
+/* In memory flight recorder. When enabled, binlog events for all
+ * connections are captured in a circular array of fixed size slots
+ * instead of being written to disk, so steady state logging costs one
+ * memcpy per event and no file I/O. When an incident is detected, the
+ * application calls picoquic_dump_flight_recorder() to write the
+ * retained events, oldest first, as a regular binlog file. */
+
+typedef struct st_picoquic_binlog_fr_slot_t {
+    size_t length;
+    uint8_t bytes[PICOQUIC_BINLOG_SLOT_SIZE];
+} picoquic_binlog_fr_slot_t;
+
+typedef struct st_picoquic_binlog_fr_t {
+    size_t nb_slots;
+    uint64_t head; /* total number of events recorded so far */
+    uint64_t nb_dropped; /* events larger than a slot */
+    uint64_t start_time; /* creation time stamped on dump files */
+    picoquic_binlog_fr_slot_t* slots;
+} picoquic_binlog_fr_t;
+
+static void binlog_fr_record(picoquic_binlog_fr_t* fr,
+    const uint8_t* part1, size_t len1, const uint8_t* part2, size_t len2)
+{
+    if (len1 + len2 > PICOQUIC_BINLOG_SLOT_SIZE) {
+        fr->nb_dropped++;
+    }
+    else {
+        picoquic_binlog_fr_slot_t* slot = &fr->slots[fr->head % fr->nb_slots];
+
+        if (len1 > 0) {
+            memcpy(slot->bytes, part1, len1);
+        }
+        if (len2 > 0) {
+            memcpy(slot->bytes + len1, part2, len2);
+        }
+        slot->length = len1 + len2;
+        fr->head++;
+    }
+}
+
+int picoquic_set_flight_recorder(picoquic_quic_t* quic, size_t nb_events)
+{
+    int ret = 0;
+
+    if (quic->binlog_fr != NULL) {
+        picoquic_binlog_fr_t* fr = quic->binlog_fr;
+
+        if (fr->nb_dropped > 0) {
+            DBG_PRINTF("Flight recorder dropped %" PRIu64 " oversized events", fr->nb_dropped);
+        }
+        quic->binlog_fr = NULL;
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_log,
+            sizeof(picoquic_binlog_fr_t) + fr->nb_slots * sizeof(picoquic_binlog_fr_slot_t));
+        free(fr->slots);
+        free(fr);
+    }
+
+    if (nb_events > 0) {
+#ifdef _WINDOWS
+        /* Staging the packet events requires open_memstream */
+        ret = -1;
+#else
+        picoquic_binlog_fr_t* fr = (picoquic_binlog_fr_t*)malloc(sizeof(picoquic_binlog_fr_t));
+        picoquic_binlog_fr_slot_t* slots =
+            (picoquic_binlog_fr_slot_t*)calloc(nb_events, sizeof(picoquic_binlog_fr_slot_t));
+
+        if (fr == NULL || slots == NULL) {
+            free(fr);
+            free(slots);
+            ret = -1;
+        }
+        else {
+            memset(fr, 0, sizeof(picoquic_binlog_fr_t));
+            fr->nb_slots = nb_events;
+            fr->slots = slots;
+            fr->start_time = picoquic_get_quic_time(quic);
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_log,
+                sizeof(picoquic_binlog_fr_t) + nb_events * sizeof(picoquic_binlog_fr_slot_t));
+            quic->binlog_fr = fr;
+            picoquic_enable_binlog(quic);
+        }
+#endif
+    }
+
+    return ret;
+}
+
+/* Write one complete event: into the flight recorder when one is
+ * active, into the memory mapping when the connection has one, through
+ * the ring when the writer thread is running, directly to the log file
+ * otherwise. */
+static void binlog_write_event(picoquic_cnx_t* cnx, FILE* f,
+    const uint8_t* part1, size_t len1, const uint8_t* part2, size_t len2)
+{
+    if (cnx != NULL && cnx->quic->binlog_fr != NULL) {
+        binlog_fr_record(cnx->quic->binlog_fr, part1, len1, part2, len2);
+        return;
+    }
+#ifndef _WINDOWS
+    if (cnx != NULL && cnx->binlog_mmap != NULL) {
+        binlog_mmap_append(cnx->binlog_mmap, part1, len1, part2, len2);
+        return;
+    }
+#endif
+    if (cnx != NULL && cnx->quic->binlog_ring != NULL) {
+        binlog_ring_post(cnx->quic->binlog_ring, f, part1, len1, part2, len2);
+    }
+    else {
+        if (len1 > 0) {
+            (void)fwrite(part1, len1, 1, f);
+        }
+        if (len2 > 0) {
+            (void)fwrite(part2, len2, 1, f);
+        }
+    }
+}
+
+#ifndef _WINDOWS
+/* The packet event serializers stream straight to a FILE and patch the
+ * chunk length in place, so in ring or mmap mode they run against a
+ * memory stream whose content is then posted as one event. */
+static int binlog_stage_needed(picoquic_cnx_t* cnx)
+{
+    return cnx->quic->binlog_ring != NULL || cnx->binlog_mmap != NULL ||
+        cnx->quic->binlog_fr != NULL;
+}
+
+static FILE* binlog_stage_open(picoquic_quic_t* quic, char** p_buf, size_t* p_len)
+{
+    FILE* stage = open_memstream(p_buf, p_len);
+
+    if (stage == NULL && quic->binlog_ring != NULL) {
+        quic->binlog_ring->nb_dropped++;
+    }
+    return stage;
+}
+
+static void binlog_stage_post(picoquic_cnx_t* cnx, FILE* f_target, FILE* stage,
+    char** p_buf, size_t* p_len)
+{
+    if (fclose(stage) == 0) {
+        if (cnx->quic->binlog_fr != NULL) {
+            binlog_fr_record(cnx->quic->binlog_fr, (const uint8_t*)*p_buf, *p_len, NULL, 0);
+        }
+        else if (cnx->binlog_mmap != NULL) {
+            binlog_mmap_append(cnx->binlog_mmap, (const uint8_t*)*p_buf, *p_len, NULL, 0);
+        }
+        else {
+            binlog_ring_post(cnx->quic->binlog_ring, f_target, (const uint8_t*)*p_buf, *p_len, NULL, 0);
+        }
+    }
+    else if (cnx->quic->binlog_ring != NULL) {
+        cnx->quic->binlog_ring->nb_dropped++;
+    }
+    free(*p_buf);
+}
+#endif
+
+static void binlog_pdu_write(FILE* f, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid,
+    int receiving, uint64_t current_time,
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
 {
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
 
     /* Common chunk header */
-    binlog_compose_event_header(msg, cid, current_time, 0, picoquic_log_event_pdu_sent + receiving);
+    binlog_compose_event_header(msg, cnx, cid, current_time, 0, picoquic_log_event_pdu_sent + receiving);
 
     /* PDU information */
     bytewrite_addr(msg, addr_peer);
@@ -698,15 +1181,35 @@ void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uin
     (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
 }
 
+void binlog_pdu(FILE* f, const picoquic_connection_id_t* cid, int receiving, uint64_t current_time,
+    const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
+{
+    binlog_pdu_write(f, NULL, cid, receiving, current_time, addr_peer, addr_local, packet_length);
+}
+
 static void binlog_pdu_ex(picoquic_cnx_t* cnx, int receiving, uint64_t current_time,
     const struct sockaddr* addr_peer, const struct sockaddr* addr_local, size_t packet_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_pdu(cnx->f_binlog, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+#ifndef _WINDOWS
+        if (binlog_stage_needed(cnx)) {
+            char* buf = NULL;
+            size_t len = 0;
+            FILE* stage = binlog_stage_open(cnx->quic, &buf, &len);
+
+            if (stage != NULL) {
+                binlog_pdu_write(stage, cnx, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
+                binlog_stage_post(cnx, cnx->f_binlog, stage, &buf, &len);
+            }
+            return;
+        }
+#endif
+        binlog_pdu_write(cnx->f_binlog, cnx, &cnx->initial_cnxid, receiving, current_time, addr_peer, addr_local, packet_length);
     }
 }
 
-void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
+static void binlog_packet_write(FILE* f, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cid,
+    uint64_t path_id, int receiving, uint64_t current_time,
     const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
     long fpos0 = ftell(f);
@@ -718,7 +1221,7 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_i
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
 
     /* Common chunk header */
-    binlog_compose_event_header(msg, cid, current_time, path_id, picoquic_log_event_packet_sent + receiving);
+    binlog_compose_event_header(msg, cnx, cid, current_time, path_id, picoquic_log_event_packet_sent + receiving);
 
     /* packet information */
     bytewrite_vint(msg, bytes_max);
@@ -727,7 +1230,15 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_i
     bytewrite_int8(msg, (uint8_t)(64*ph->quic_bit_is_zero + 2 * ph->spin + ph->key_phase));
     bytewrite_vint(msg, ph->payload_length);
     bytewrite_vint(msg, ph->ptype);
-    bytewrite_vint(msg, ph->pn64);
+    if (cnx != NULL && cnx->binlog_is_v2) {
+        /* v2 format: the packet number is a zigzag encoded delta from the
+         * previous packet logged in the same direction. */
+        bytewrite_vint(msg, binlog_zigzag(ph->pn64, cnx->binlog_pn_prev[receiving]));
+        cnx->binlog_pn_prev[receiving] = ph->pn64;
+    }
+    else {
+        bytewrite_vint(msg, ph->pn64);
+    }
 
     bytewrite_cid(msg, &ph->dest_cnx_id);
     bytewrite_cid(msg, &ph->srce_cnx_id);
@@ -762,11 +1273,31 @@ void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_i
     (void)fseek(f, 0, SEEK_END);
 }
 
+void binlog_packet(FILE* f, const picoquic_connection_id_t* cid, uint64_t path_id, int receiving, uint64_t current_time,
+    const picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
+{
+    binlog_packet_write(f, NULL, cid, path_id, receiving, current_time, ph, bytes, bytes_max);
+}
+
 static void binlog_packet_ex(picoquic_cnx_t* cnx, picoquic_path_t * path_x, int receiving, uint64_t current_time,
     picoquic_packet_header* ph, const uint8_t* bytes, size_t bytes_max)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_packet(cnx->f_binlog, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
+#ifndef _WINDOWS
+        if (binlog_stage_needed(cnx)) {
+            char* buf = NULL;
+            size_t len = 0;
+            FILE* stage = binlog_stage_open(cnx->quic, &buf, &len);
+
+            if (stage != NULL) {
+                binlog_packet_write(stage, cnx, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
+                    receiving, current_time, ph, bytes, bytes_max);
+                binlog_stage_post(cnx, cnx->f_binlog, stage, &buf, &len);
+            }
+            return;
+        }
+#endif
+        binlog_packet_write(cnx->f_binlog, cnx, &cnx->initial_cnxid, binlog_get_path_id(cnx, path_x),
             receiving, current_time, ph, bytes, bytes_max);
     }
 }
@@ -789,7 +1320,7 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     bytewrite_int32(msg, 0);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x),
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x),
         picoquic_log_event_packet_dropped);
     /* Event header */
     bytewrite_vint(msg, ph->ptype);
@@ -800,7 +1331,7 @@ void binlog_dropped_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, f, bytestream_data(msg), bytestream_length(msg), NULL, 0);
 }
 
 void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x, 
@@ -812,7 +1343,7 @@ void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     bytewrite_int32(msg, 0);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x),
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x),
         picoquic_log_event_packet_buffered);
     /* Event header */
     bytewrite_vint(msg, ptype);
@@ -820,7 +1351,7 @@ void binlog_buffered_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, f, bytestream_data(msg), bytestream_length(msg), NULL, 0);
 }
 
 
@@ -870,6 +1401,19 @@ void binlog_outgoing_packet(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         }
     }
 
+#ifndef _WINDOWS
+    if (cnx != NULL && binlog_stage_needed(cnx)) {
+        char* buf = NULL;
+        size_t len = 0;
+        FILE* stage = binlog_stage_open(cnx->quic, &buf, &len);
+
+        if (stage != NULL) {
+            binlog_packet(stage, cnxid, binlog_get_path_id(cnx, path_x), 0, current_time, &ph, bytes, length);
+            binlog_stage_post(cnx, f, stage, &buf, &len);
+        }
+        return;
+    }
+#endif
     binlog_packet(f, cnxid, binlog_get_path_id(cnx, path_x),  0, current_time, &ph, bytes, length);
 }
 
@@ -885,7 +1429,7 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     bytewrite_int32(msg, 0);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x), picoquic_log_event_packet_lost);
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, current_time, binlog_get_path_id(cnx, path_x), picoquic_log_event_packet_lost);
     /* Event header */
     bytewrite_vint(msg, ptype);
     bytewrite_vint(msg, sequence_number);
@@ -900,7 +1444,7 @@ void binlog_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     /* write the frame length at the reserved spot, and save to log file*/
     picoformat_32(msg->data, (uint32_t)(msg->ptr - 4));
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, f, bytestream_data(msg), bytestream_length(msg), NULL, 0);
 }
 
 
@@ -913,7 +1457,7 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_alpn_update);
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_alpn_update);
     /* Event header */
     bytewrite_vint(msg, is_local);
     bytewrite_vint(msg, sni_len);
@@ -938,8 +1482,8 @@ void binlog_negotiated_alpn(picoquic_cnx_t* cnx, int is_local,
     bytestream* head = bytestream_buf_init(&stream_head, 4);
     bytewrite_int32(head, (uint32_t)bytestream_length(msg));
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, f, bytestream_data(head), bytestream_length(head),
+        bytestream_data(msg), bytestream_length(msg));
 }
 
 void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
@@ -950,7 +1494,7 @@ void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
     bytestream_buf stream_msg;
     bytestream* msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_param_update);
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_param_update);
     /* Event header */
     bytewrite_vint(msg, is_local);
     bytewrite_vint(msg, param_length);
@@ -963,17 +1507,17 @@ void binlog_transport_extension(picoquic_cnx_t* cnx, int is_local,
     bytestream* head = bytestream_buf_init(&stream_head, 4);
     bytewrite_int32(head, (uint32_t)bytestream_length(msg));
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    binlog_write_event(cnx, f, bytestream_data(head), bytestream_length(head),
+        bytestream_data(msg), bytestream_length(msg));
 }
 
-void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+static void binlog_picotls_ticket_write(FILE* f, picoquic_cnx_t* cnx, picoquic_connection_id_t cnx_id,
     uint8_t* ticket, uint16_t ticket_length)
 {
     bytestream_buf stream_msg;
     bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx_id, 0, 0, picoquic_log_event_tls_key_update);
+    binlog_compose_event_header(msg, cnx, &cnx_id, 0, 0, picoquic_log_event_tls_key_update);
 
     bytewrite_vint(msg, ticket_length);
     bytewrite_buffer(msg, ticket, ticket_length);
@@ -986,21 +1530,52 @@ void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
     (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
 }
 
+void binlog_picotls_ticket(FILE* f, picoquic_connection_id_t cnx_id,
+    uint8_t* ticket, uint16_t ticket_length)
+{
+    binlog_picotls_ticket_write(f, NULL, cnx_id, ticket, ticket_length);
+}
+
 static void binlog_picotls_ticket_ex(picoquic_cnx_t* cnx,
     uint8_t* ticket, uint16_t ticket_length)
 {
     if (cnx != NULL && cnx->f_binlog != NULL && picoquic_cnx_is_still_logging(cnx)) {
-        binlog_picotls_ticket(cnx->f_binlog, cnx->initial_cnxid, ticket, ticket_length);
+#ifndef _WINDOWS
+        if (binlog_stage_needed(cnx)) {
+            char* buf = NULL;
+            size_t len = 0;
+            FILE* stage = binlog_stage_open(cnx->quic, &buf, &len);
+
+            if (stage != NULL) {
+                binlog_picotls_ticket_write(stage, cnx, cnx->initial_cnxid, ticket, ticket_length);
+                binlog_stage_post(cnx, cnx->f_binlog, stage, &buf, &len);
+            }
+            return;
+        }
+#endif
+        binlog_picotls_ticket_write(cnx->f_binlog, cnx, cnx->initial_cnxid, ticket, ticket_length);
     }
 }
 
 FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int multipath_enabled);
+static FILE* create_binlog_v(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported,
+    uint16_t version);
+static void binlog_message(picoquic_cnx_t* cnx, const char* fmt, ...);
 
 void binlog_new_connection(picoquic_cnx_t * cnx)
 {
     char const* bin_dir = (cnx->quic->binlog_dir == NULL) ? cnx->quic->qlog_dir : cnx->quic->binlog_dir;
+    int fr_mode = (cnx->quic->binlog_fr != NULL);
+
+    if (bin_dir == NULL && !fr_mode) {
+        return;
+    }
 
-    if (bin_dir == NULL) {
+    /* When log sampling is configured, only trace the selected share of
+     * connections. The selection hashes the initial CID so a given
+     * connection is traced (or not) on both client and server. */
+    if (cnx->quic->log_sample_one_in_n > 1 && !cnx->is_log_forced &&
+        (picoquic_val64_connection_id(cnx->initial_cnxid) % cnx->quic->log_sample_one_in_n) != 0) {
         return;
     }
 
@@ -1018,7 +1593,7 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
     }
 
     char log_filename[512];
-    if (ret == 0) {
+    if (ret == 0 && !fr_mode) {
         int sprintf_ret = -1;
         if (cnx->quic->use_unique_log_names) {
             sprintf_ret = picoquic_sprintf(log_filename, sizeof(log_filename), NULL, "%s%s%s.%x.%s.log",
@@ -1040,8 +1615,29 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        cnx->f_binlog = create_binlog(log_filename, picoquic_get_quic_time(cnx->quic),
-           cnx->local_parameters.is_multipath_enabled);
+        if (fr_mode) {
+            /* Flight recorder mode: no log file is created, events are
+             * diverted to the in memory recorder before they reach the
+             * FILE. The null device keeps cnx->f_binlog non NULL, since
+             * that is what enables event generation at the logging call
+             * sites. */
+            cnx->f_binlog = picoquic_file_open("/dev/null", "wb");
+            /* The flight recorder dumps an arbitrary subset of the
+             * recorded events, which would break the v2 event deltas,
+             * so it always records the v1 encoding. */
+            cnx->binlog_is_v2 = 0;
+        }
+        else {
+            uint64_t creation_time = picoquic_get_quic_time(cnx->quic);
+
+            cnx->binlog_is_v2 = (cnx->quic->use_binlog_v2 != 0);
+            cnx->binlog_time_prev = creation_time;
+            cnx->binlog_pn_prev[0] = 0;
+            cnx->binlog_pn_prev[1] = 0;
+            cnx->f_binlog = create_binlog_v(log_filename, creation_time,
+                cnx->local_parameters.is_multipath_enabled,
+                (cnx->binlog_is_v2) ? 0x02 : 0x01);
+        }
         if (cnx->f_binlog == NULL) {
             cnx->binlog_file_name = picoquic_string_free(cnx->binlog_file_name);
             ret = -1;
@@ -1055,7 +1651,7 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
         bytestream_buf stream_msg;
         bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
         /* Common chunk header */
-        binlog_compose_event_header(msg, &cnx->initial_cnxid, cnx->start_time, 0, picoquic_log_event_new_connection);
+        binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, cnx->start_time, 0, picoquic_log_event_new_connection);
 
         bytewrite_int8(msg, cnx->client_mode != 0);
         bytewrite_int32(msg, cnx->proposed_version);
@@ -1069,8 +1665,28 @@ void binlog_new_connection(picoquic_cnx_t * cnx)
         bytestream * head = bytestream_buf_init(&stream_head, 8);
         bytewrite_int32(head, (uint32_t)bytestream_length(msg));
 
-        (void)fwrite(bytestream_data(head), bytestream_length(head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, cnx->f_binlog);
+        if (fr_mode) {
+            binlog_fr_record(cnx->quic->binlog_fr,
+                bytestream_data(head), bytestream_length(head),
+                bytestream_data(msg), bytestream_length(msg));
+        }
+        else {
+            (void)fwrite(bytestream_data(head), bytestream_length(head), 1, cnx->f_binlog);
+            (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, cnx->f_binlog);
+        }
+    }
+
+#ifndef _WINDOWS
+    if (ret == 0 && cnx->quic->use_binlog_mmap && !fr_mode) {
+        binlog_mmap_attach(cnx);
+    }
+#endif
+
+    if (ret == 0 && cnx->log_correlation_id != NULL) {
+        /* Carry the correlation id into the newly opened log, so a log
+         * forced open after picoquic_set_log_correlation_id still
+         * contains it. */
+        binlog_message(cnx, "correlation_id=%s", cnx->log_correlation_id);
     }
 }
 
@@ -1081,23 +1697,45 @@ void binlog_close_connection(picoquic_cnx_t * cnx)
         return;
     }
 
+    /* Let the writer thread finish with this file before the final
+     * direct write and the close */
+    binlog_ring_sync(cnx->quic);
+
     bytestream_buf stream_msg;
     bytestream * msg = bytestream_buf_init(&stream_msg, BYTESTREAM_MAX_BUFFER_SIZE);
     /* Common chunk header */
-    binlog_compose_event_header(msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_connection_close);
+    binlog_compose_event_header(msg, cnx, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_connection_close);
 
     bytestream_buf stream_head;
     bytestream * head = bytestream_buf_init(&stream_head, 8);
     bytewrite_int32(head, (uint32_t)bytestream_length(msg));
 
-    (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
-    (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
+    if (cnx->quic->binlog_fr != NULL) {
+        binlog_fr_record(cnx->quic->binlog_fr,
+            bytestream_data(head), bytestream_length(head),
+            bytestream_data(msg), bytestream_length(msg));
+    }
+#ifndef _WINDOWS
+    else if (cnx->binlog_mmap != NULL) {
+        binlog_mmap_append(cnx->binlog_mmap,
+            bytestream_data(head), bytestream_length(head),
+            bytestream_data(msg), bytestream_length(msg));
+        /* Truncates the file to the bytes actually written, so the qlog
+         * converter does not see the zero filled tail of the mapping */
+        binlog_mmap_detach(cnx);
+    }
+#endif
+    else
+    {
+        (void)fwrite(bytestream_data(head), bytestream_length(head), 1, f);
+        (void)fwrite(bytestream_data(msg), bytestream_length(msg), 1, f);
 
-    fflush(f);
+        fflush(f);
+    }
 
     cnx->f_binlog = picoquic_file_close(cnx->f_binlog);
 
-    if (cnx->quic->qlog_dir != NULL && cnx->quic->autoqlog_fn != NULL) {
+    if (cnx->binlog_file_name != NULL && cnx->quic->qlog_dir != NULL && cnx->quic->autoqlog_fn != NULL) {
         (void)cnx->quic->autoqlog_fn(cnx);
     }
     cnx->binlog_file_name = picoquic_string_free(cnx->binlog_file_name);
@@ -1106,7 +1744,8 @@ void binlog_close_connection(picoquic_cnx_t * cnx)
     }
 }
 
-FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported)
+static FILE* create_binlog_v(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported,
+    uint16_t version)
 {
     FILE* f_binlog = picoquic_file_open(binlog_file, "wb");
     if (f_binlog == NULL) {
@@ -1118,7 +1757,7 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned in
         bytestream* ps = bytestream_buf_init(&stream, 16);
         bytewrite_int32(ps, FOURCC('q', 'l', 'o', 'g'));
         bytewrite_int16(ps, (is_multipath_supported) ? 0x01 : 0); /* flags */
-        bytewrite_int16(ps, 0x01); /* version */
+        bytewrite_int16(ps, version);
         bytewrite_int64(ps, creation_time);
 
         if (fwrite(bytestream_data(ps), bytestream_length(ps), 1, f_binlog) <= 0) {
@@ -1130,6 +1769,41 @@ FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned in
     return f_binlog;
 }
 
+FILE* create_binlog(char const* binlog_file, uint64_t creation_time, unsigned int is_multipath_supported)
+{
+    return create_binlog_v(binlog_file, creation_time, is_multipath_supported, 0x01);
+}
+
+/* Dump the events currently retained by the flight recorder, oldest
+ * first, as a regular binlog file. The recorder keeps recording; a
+ * later dump writes the events retained by then. */
+int picoquic_dump_flight_recorder(picoquic_quic_t* quic, char const* fr_file_name)
+{
+    int ret = 0;
+    picoquic_binlog_fr_t* fr = quic->binlog_fr;
+    FILE* f = NULL;
+
+    if (fr == NULL ||
+        (f = create_binlog(fr_file_name, fr->start_time,
+            quic->default_tp.is_multipath_enabled)) == NULL) {
+        ret = -1;
+    }
+    else {
+        uint64_t rank = (fr->head > fr->nb_slots) ? fr->head - fr->nb_slots : 0;
+
+        for (; ret == 0 && rank < fr->head; rank++) {
+            picoquic_binlog_fr_slot_t* slot = &fr->slots[rank % fr->nb_slots];
+
+            if (fwrite(slot->bytes, 1, slot->length, f) != slot->length) {
+                ret = -1;
+            }
+        }
+        f = picoquic_file_close(f);
+    }
+
+    return ret;
+}
+
 /*
  * Log the state of the congestion management, retransmission, etc.
  * Call either just after processing a received packet, or just after
@@ -1165,7 +1839,7 @@ void binlog_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
          * all available paths, and write the data for each path if multipath is enabled.
          * verify that it works for CSV and QLOG formats.
          */
-        binlog_compose_event_header(ps_msg, &cnx->initial_cnxid, current_time, 
+        binlog_compose_event_header(ps_msg, cnx, &cnx->initial_cnxid, current_time, 
             binlog_get_path_id(cnx, path), picoquic_log_event_cc_update);
 
         bytewrite_vint(ps_msg, pkt_ctx->send_sequence);
@@ -1225,8 +1899,9 @@ void binlog_cc_dump(picoquic_cnx_t* cnx, uint64_t current_time)
 
         bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
 
-        (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-        (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+        binlog_write_event(cnx, cnx->f_binlog,
+            bytestream_data(ps_head), bytestream_length(ps_head),
+            bytestream_data(ps_msg), bytestream_length(ps_msg));
     }
 }
 
@@ -1245,7 +1920,7 @@ void picoquic_binlog_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list var
     char* message_text;
     int written = -1;
     /* Common chunk header */
-    binlog_compose_event_header(ps_msg, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_info_message);
+    binlog_compose_event_header(ps_msg, cnx, &cnx->initial_cnxid, picoquic_get_quic_time(cnx->quic), 0, picoquic_log_event_info_message);
 
     message_text = (char*)(ps_msg->data + ps_msg->ptr);
 #ifdef _WINDOWS
@@ -1267,8 +1942,9 @@ void picoquic_binlog_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list var
 
     bytewrite_int32(ps_head, (uint32_t)bytestream_length(ps_msg));
 
-    (void)fwrite(bytestream_data(ps_head), bytestream_length(ps_head), 1, cnx->f_binlog);
-    (void)fwrite(bytestream_data(ps_msg), bytestream_length(ps_msg), 1, cnx->f_binlog);
+    binlog_write_event(cnx, cnx->f_binlog,
+        bytestream_data(ps_head), bytestream_length(ps_head),
+        bytestream_data(ps_msg), bytestream_length(ps_msg));
 }
 
 /* Log an event that cannot be attached to a specific connection */
@@ -1295,6 +1971,14 @@ void binlog_ignore_quic_pdu(picoquic_quic_t* quic, int receiving, uint64_t curre
 #endif
 }
 
+static void binlog_message(picoquic_cnx_t* cnx, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    picoquic_binlog_message_v(cnx, fmt, args);
+    va_end(args);
+}
+
 /* Log an event relating to a specific connection */
 static void binlog_app_message(picoquic_cnx_t* cnx, const char* fmt, va_list vargs)
 {
@@ -1303,12 +1987,13 @@ static void binlog_app_message(picoquic_cnx_t* cnx, const char* fmt, va_list var
     }
 }
 
-/* Return from close with nothing, as this is per connection only */
+/* Per connection logs are closed with each connection; only the writer
+ * thread, if one was started, and the flight recorder are left to stop
+ * here. */
 void binlog_close(picoquic_quic_t* quic)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(quic);
-#endif
+    (void)picoquic_set_binlog_thread(quic, 0);
+    (void)picoquic_set_flight_recorder(quic, 0);
 }
 
 struct st_picoquic_unified_logging_t binlog_functions = {
@@ -1344,3 +2029,8 @@ void picoquic_enable_binlog(picoquic_quic_t* quic)
 {
     quic->bin_log_fns = &binlog_functions;
 }
+
+void picoquic_set_binlog_v2(picoquic_quic_t* quic, int enabled)
+{
+    quic->use_binlog_v2 = (enabled != 0);
+}
@@ -20,6 +20,7 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_probes.h"
 #include "picoquic_unified_log.h"
 #include "tls_api.h"
 #include <stdlib.h>
@@ -178,8 +179,20 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
     size_t length = 0;
 
     if (pc == picoquic_packet_context_application && cnx->is_multipath_enabled) {
-        /* If unique multipath is enabled, should check for retransmission on all paths */
-        for (int i=0; i<cnx->nb_paths; i++) {
+        /* If unique multipath is enabled, should check for retransmission on all paths.
+         * Visit the path being prepared first, so that a failing path with a
+         * backlog of timed out packets cannot consume the send slot that a
+         * healthy path needs for its own repairs. */
+        int i_start = 0;
+
+        for (int i = 0; i < cnx->nb_paths; i++) {
+            if (cnx->path[i] == path_x) {
+                i_start = i;
+                break;
+            }
+        }
+        for (int j=0; j<cnx->nb_paths; j++) {
+            int i = (i_start + j) % cnx->nb_paths;
             if (length == 0) {
                 length = picoquic_retransmit_needed_loop(cnx, &cnx->path[i]->pkt_ctx, pc, path_x, current_time,
                     next_wake_time, packet, send_buffer_max, header_length);
@@ -444,15 +457,38 @@ static size_t picoquic_retransmit_needed_packet(picoquic_cnx_t* cnx, picoquic_pa
                 * manage scheduling in multipath setup */
 
                 if (old_path != NULL) {
+                    uint64_t max_path_retransmit = 9;
+
                     if (path_x == old_path) {
                         old_path->is_pto_required = 1;
                     }
                     old_path->nb_retransmit++;
                     old_path->last_loss_event_detected = current_time;
+                    /* A real timer expiry means the reordering allowance
+                     * learned from spurious retransmits is not masking
+                     * losses any more; shrink it back towards the default. */
+                    old_path->reorder_pkt_threshold /= 2;
+                    if (old_path->reorder_pkt_threshold < PICOQUIC_REORDER_PKT_THRESHOLD_DEFAULT) {
+                        old_path->reorder_pkt_threshold = PICOQUIC_REORDER_PKT_THRESHOLD_DEFAULT;
+                    }
+                    old_path->reorder_time_extra /= 2;
                     if (cnx->is_multipath_enabled && cnx->nb_paths > 1) {
                         picoquic_retransmit_path_packet_queue(cnx, old_path, pkt_ctx, current_time);
+                        /* Fast abandon: if another validated path is healthy,
+                         * there is no reason to nurse this one through the
+                         * full backoff series; its PTO budget is its own, and
+                         * after a few consecutive timeouts the traffic is
+                         * better served by the healthy path. */
+                        for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
+                            picoquic_path_t* alt_path = cnx->path[path_id];
+                            if (alt_path != old_path && alt_path->challenge_verified &&
+                                !alt_path->path_is_demoted && alt_path->nb_retransmit == 0) {
+                                max_path_retransmit = 3;
+                                break;
+                            }
+                        }
                     }
-                    if (old_path->nb_retransmit > 9 &&
+                    if (old_path->nb_retransmit > max_path_retransmit &&
                         cnx->cnx_state >= picoquic_state_ready) {
                         /* Max retransmission reached for this path */
                         DBG_PRINTF("%s\n", "Too many data retransmits, abandon path");
@@ -560,9 +596,11 @@ static int picoquic_is_packet_probably_lost(picoquic_cnx_t* cnx,
             &old_p->send_path->pkt_ctx : &cnx->pkt_ctx[old_p->pc];
         delta_seq = pkt_ctx->highest_acknowledged - old_p->sequence_number;
 
-        if (delta_seq >= 3) {
+        if (delta_seq >= (int64_t)old_p->send_path->reorder_pkt_threshold) {
             /* Last acknowledged packet is ways ahead. That means this packet
-            * is most probably lost.
+            * is most probably lost. The threshold starts at the classic
+            * value of 3 and adapts to the reordering depth measured by
+            * the spurious retransmit machinery.
             */
             retransmit_time = current_time;
             is_probably_lost = 1;
@@ -576,6 +614,7 @@ static int picoquic_is_packet_probably_lost(picoquic_cnx_t* cnx,
             }
             retransmit_time = old_p->send_time + old_p->send_path->retransmit_timer;
             rack_timer_min = pkt_ctx->highest_acknowledged_time + rack_delay
+                + old_p->send_path->reorder_time_extra
                 - delta_sent + cnx->remote_parameters.max_ack_delay;
             if (retransmit_time > rack_timer_min) {
                 retransmit_time = rack_timer_min;
@@ -694,8 +733,18 @@ int picoquic_copy_before_retransmit(picoquic_packet_t * old_p,
         if (old_p->send_path != NULL) {
             /* MTU probe was lost, presumably because of packet too big */
             old_p->send_path->mtu_probe_sent = 0;
+            if (old_p->send_path->nb_mtu_probes_in_flight > 0) {
+                old_p->send_path->nb_mtu_probes_in_flight--;
+            }
             if (!force_queue || force_queue == 2) {
-                old_p->send_path->send_mtu_max_tried = old_p->length + old_p->checksum_overhead;
+                size_t tried = old_p->length + old_p->checksum_overhead;
+                /* In sprint mode several probes can be lost in one round;
+                 * keep the smallest failed size that is still above the MTU */
+                if ((old_p->send_path->send_mtu_max_tried == 0 ||
+                    tried < old_p->send_path->send_mtu_max_tried) &&
+                    tried > old_p->send_path->send_mtu) {
+                    old_p->send_path->send_mtu_max_tried = tried;
+                }
             }
         }
         /* MTU probes should not be retransmitted */
@@ -909,6 +958,8 @@ static void picoquic_count_and_notify_loss(
 
     if (old_p->send_path != NULL) {
         old_p->send_path->nb_losses_found++;
+        PICOQUIC_PROBE_LOSS_DECLARED(picoquic_val64_connection_id(cnx->initial_cnxid),
+            old_p->sequence_number, old_p->length, timer_based_retransmit);
         if (timer_based_retransmit) {
             old_p->send_path->nb_timer_losses++;
         }
@@ -1071,4 +1122,127 @@ void picoquic_queue_retransmit_on_ack(picoquic_cnx_t* cnx, picoquic_path_t* path
             break;
         }   
     }
-}
\ No newline at end of file
+}
+/* Packet number bitmap over the retransmitted queue.
+ *
+ * Packets kept for spurious retransmission detection used to be found
+ * by walking the retransmitted queue for every ACK range. The queue
+ * holds packets for up to PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX, so
+ * under light reordering each ACK rescanned a long list that almost
+ * never contained a match. The bitmap below tracks which packet
+ * numbers currently sit in the queue, over a sliding window of
+ * PICOQUIC_RETRANSMITTED_MAP_NB_WORDS * 64 numbers; testing an ACK
+ * range against it is a handful of word operations, and the queue is
+ * only walked when the test reports a possible match.
+ *
+ * Packet numbers only grow, so the window slides forward. Bits pushed
+ * out of the window while their packet is still queued are counted in
+ * retransmitted_unmapped; while that count is not zero the test
+ * reports a possible match for every range, reverting to the scan
+ * until the old packets are pruned. */
+
+static uint64_t picoquic_retransmitted_map_popcount(uint64_t x)
+{
+    uint64_t n = 0;
+
+    while (x != 0) {
+        x &= x - 1;
+        n++;
+    }
+    return n;
+}
+
+void picoquic_retransmitted_map_set(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    const uint64_t window = 64ull * PICOQUIC_RETRANSMITTED_MAP_NB_WORDS;
+
+    if (sequence_number < pkt_ctx->retransmitted_map_base) {
+        /* Below the window. Packet numbers grow, so this is not
+         * expected, but keep the accounting correct so the spurious
+         * scan is not wrongly skipped. */
+        pkt_ctx->retransmitted_unmapped += 1;
+    }
+    else {
+        uint64_t bit;
+
+        if (sequence_number >= pkt_ctx->retransmitted_map_base + window) {
+            /* Slide the window so the new number lands in the last word */
+            uint64_t new_base = (sequence_number & ~63ull) - (window - 64);
+            uint64_t word_shift = (new_base - pkt_ctx->retransmitted_map_base) / 64;
+            int i;
+
+            if (word_shift >= PICOQUIC_RETRANSMITTED_MAP_NB_WORDS) {
+                for (i = 0; i < PICOQUIC_RETRANSMITTED_MAP_NB_WORDS; i++) {
+                    pkt_ctx->retransmitted_unmapped += picoquic_retransmitted_map_popcount(pkt_ctx->retransmitted_map[i]);
+                    pkt_ctx->retransmitted_map[i] = 0;
+                }
+            }
+            else {
+                for (i = 0; i < (int)word_shift; i++) {
+                    pkt_ctx->retransmitted_unmapped += picoquic_retransmitted_map_popcount(pkt_ctx->retransmitted_map[i]);
+                }
+                for (i = 0; i + (int)word_shift < PICOQUIC_RETRANSMITTED_MAP_NB_WORDS; i++) {
+                    pkt_ctx->retransmitted_map[i] = pkt_ctx->retransmitted_map[i + word_shift];
+                }
+                for (; i < PICOQUIC_RETRANSMITTED_MAP_NB_WORDS; i++) {
+                    pkt_ctx->retransmitted_map[i] = 0;
+                }
+            }
+            pkt_ctx->retransmitted_map_base = new_base;
+        }
+        bit = sequence_number - pkt_ctx->retransmitted_map_base;
+        pkt_ctx->retransmitted_map[bit >> 6] |= 1ull << (bit & 63);
+    }
+}
+
+void picoquic_retransmitted_map_clear(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number)
+{
+    const uint64_t window = 64ull * PICOQUIC_RETRANSMITTED_MAP_NB_WORDS;
+
+    if (sequence_number >= pkt_ctx->retransmitted_map_base &&
+        sequence_number < pkt_ctx->retransmitted_map_base + window) {
+        uint64_t bit = sequence_number - pkt_ctx->retransmitted_map_base;
+
+        pkt_ctx->retransmitted_map[bit >> 6] &= ~(1ull << (bit & 63));
+    }
+    else if (pkt_ctx->retransmitted_unmapped > 0) {
+        pkt_ctx->retransmitted_unmapped -= 1;
+    }
+}
+
+int picoquic_retransmitted_map_range_maybe(picoquic_packet_context_t* pkt_ctx, uint64_t start_of_range, uint64_t end_of_range)
+{
+    const uint64_t window = 64ull * PICOQUIC_RETRANSMITTED_MAP_NB_WORDS;
+    int maybe = 0;
+
+    if (pkt_ctx->retransmitted_newest != NULL) {
+        if (pkt_ctx->retransmitted_unmapped > 0) {
+            maybe = 1;
+        }
+        else if (end_of_range >= pkt_ctx->retransmitted_map_base &&
+            start_of_range < pkt_ctx->retransmitted_map_base + window) {
+            uint64_t first_bit = (start_of_range < pkt_ctx->retransmitted_map_base) ?
+                0 : start_of_range - pkt_ctx->retransmitted_map_base;
+            uint64_t last_bit = (end_of_range >= pkt_ctx->retransmitted_map_base + window) ?
+                window - 1 : end_of_range - pkt_ctx->retransmitted_map_base;
+            uint64_t first_word = first_bit >> 6;
+            uint64_t last_word = last_bit >> 6;
+
+            for (uint64_t w = first_word; w <= last_word && !maybe; w++) {
+                uint64_t mask = ~0ull;
+
+                if (w == first_word) {
+                    mask &= ~0ull << (first_bit & 63);
+                }
+                if (w == last_word) {
+                    mask &= ~0ull >> (63 - (last_bit & 63));
+                }
+                if ((pkt_ctx->retransmitted_map[w] & mask) != 0) {
+                    maybe = 1;
+                }
+            }
+        }
+    }
+
+    return maybe;
+}
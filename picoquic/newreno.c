@@ -73,14 +73,16 @@ static void picoquic_newreno_sim_enter_recovery(
 /* Update cwin per signaled bandwidth
  */
 static void picoquic_newreno_sim_seed_cwin(picoquic_newreno_sim_state_t* nr_state,
-    picoquic_path_t* path_x, uint64_t bytes_in_flight)
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t bytes_in_flight)
 {
     if (nr_state->alg_state == picoquic_newreno_alg_slow_start &&
         nr_state->ssthresh == UINT64_MAX) {
-        if (bytes_in_flight > nr_state->cwin) {
-            nr_state->cwin = bytes_in_flight;
+        uint64_t jump_cwin = picoquic_cc_careful_resume_jump(cnx, path_x, bytes_in_flight);
+        if (jump_cwin > nr_state->cwin) {
+            /* Careful resume: jump to half the seed, then grow towards
+             * the full seed in slow start. */
+            nr_state->cwin = jump_cwin;
             nr_state->ssthresh = bytes_in_flight;
-            nr_state->alg_state = picoquic_newreno_alg_congestion_avoidance;
         }
     }
 }
@@ -156,7 +158,7 @@ void picoquic_newreno_sim_notify(
         picoquic_newreno_sim_reset(nr_state);
         break;
     case picoquic_congestion_notification_seed_cwin:
-        picoquic_newreno_sim_seed_cwin(nr_state, path_x, ack_state->nb_bytes_acknowledged);
+        picoquic_newreno_sim_seed_cwin(nr_state, cnx, path_x, ack_state->nb_bytes_acknowledged);
         break;
     default:
         /* ignore */
@@ -267,9 +269,13 @@ static void picoquic_newreno_notify(
                     }
                 }
 
-                if (picoquic_hystart_test(&nr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
-                    cnx->path[0]->pacing.packet_time_microsec, current_time,
-                    cnx->is_time_stamp_enabled)) {
+                if ((cnx->is_hystart_pp_enabled) ?
+                    picoquic_hystart_pp_test(&nr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
+                        cnx->path[0]->pacing.packet_time_microsec, current_time,
+                        cnx->is_time_stamp_enabled) :
+                    picoquic_hystart_test(&nr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? ack_state->one_way_delay : ack_state->rtt_measurement,
+                        cnx->path[0]->pacing.packet_time_microsec, current_time,
+                        cnx->is_time_stamp_enabled)) {
                     /* RTT increased too much, get out of slow start! */
                     nr_state->nrss.ssthresh = nr_state->nrss.cwin;
                     nr_state->nrss.alg_state = picoquic_newreno_alg_congestion_avoidance;
@@ -104,6 +104,27 @@ int picoquic_is_authorized_by_pacing(picoquic_pacing_t * pacing, uint64_t curren
     return ret;
 }
 
+/* Number of bytes that pacing authorizes sending back to back right
+ * now, used to size a GSO packet train to the available credit. The
+ * bucket is refreshed first, so the credit accounts for the time
+ * elapsed since the last evaluation, then rounded down to a whole
+ * number of full size packets. This is only a sizing hint: the per
+ * packet call to picoquic_is_authorized_by_pacing remains the
+ * authority for blocked or not blocked decisions.
+ */
+size_t picoquic_pacing_credit_bytes(picoquic_pacing_t* pacing, uint64_t current_time, size_t send_mtu)
+{
+    uint64_t nb_packets = 0;
+
+    picoquic_update_pacing_bucket(pacing, current_time);
+
+    if (pacing->bucket_nanosec >= pacing->packet_time_nanosec) {
+        nb_packets = (uint64_t)pacing->bucket_nanosec / (uint64_t)pacing->packet_time_nanosec;
+    }
+
+    return (size_t)nb_packets * send_mtu;
+}
+
 /* Report pacing updates if required
  */
 static void picoquic_report_pacing_update(picoquic_pacing_t* pacing, picoquic_path_t* path_x)
@@ -134,15 +155,76 @@ static void picoquic_report_pacing_update(picoquic_pacing_t* pacing, picoquic_pa
     }
 }
 
+/* Set the pacing policy knobs for the context, see picoquic.h */
+void picoquic_set_pacing_policy(picoquic_quic_t* quic, uint64_t wakeups_per_rtt, uint64_t burst_ceiling_bytes)
+{
+    quic->pacing_wakeups_per_rtt = wakeups_per_rtt;
+    quic->pacing_burst_ceiling = burst_ceiling_bytes;
+}
+
+/* Set the aggregate admission rate for paths in slow start, see picoquic.h.
+ * The bucket quantum is set to one initial congestion window, so that a
+ * single connection arriving on an idle context still gets its normal
+ * startup burst before the limiter kicks in. */
+void picoquic_set_slow_start_admission_rate(picoquic_quic_t* quic, uint64_t rate_bytes_per_second)
+{
+    quic->slow_start_admission_rate = rate_bytes_per_second;
+    if (rate_bytes_per_second > 0) {
+        picoquic_pacing_init(&quic->slow_start_admission_pacing, picoquic_get_quic_time(quic));
+        picoquic_update_pacing_parameters(&quic->slow_start_admission_pacing, (double)rate_bytes_per_second,
+            PICOQUIC_CWIN_INITIAL, PICOQUIC_MAX_PACKET_SIZE, PICOQUIC_INITIAL_RTT, NULL);
+    }
+}
+
+/* Apply the pacing policy to the quantum computed by the default rules
+ * or by the congestion control algorithm. If a wakeup target is set,
+ * the quantum is sized so a full congestion window worth of bytes is
+ * released in about that many bursts per RTT; the burst ceiling then
+ * caps the result.
+ */
+static uint64_t picoquic_apply_pacing_policy(picoquic_path_t* signalled_path, uint64_t quantum,
+    double pacing_rate, size_t send_mtu, uint64_t smoothed_rtt)
+{
+    if (signalled_path != NULL && signalled_path->cnx != NULL) {
+        picoquic_quic_t* quic = signalled_path->cnx->quic;
+
+        if (quic->pacing_wakeups_per_rtt > 0) {
+            uint64_t bytes_per_rtt = (uint64_t)((pacing_rate * (double)smoothed_rtt) / 1000000.0);
+            uint64_t quantum_policy = bytes_per_rtt / quic->pacing_wakeups_per_rtt;
+
+            if (quantum_policy < 2ull * send_mtu) {
+                quantum_policy = 2ull * send_mtu;
+            }
+            quantum = quantum_policy;
+        }
+        if (quic->pacing_burst_ceiling > 0 && quantum > quic->pacing_burst_ceiling) {
+            quantum = quic->pacing_burst_ceiling;
+            if (quantum < send_mtu) {
+                quantum = send_mtu;
+            }
+        }
+    }
+
+    return quantum;
+}
+
 /* Reset the pacing data after recomputing the pacing rate
 */
 void picoquic_update_pacing_parameters(picoquic_pacing_t * pacing, double pacing_rate, uint64_t quantum, size_t send_mtu, uint64_t smoothed_rtt,
     picoquic_path_t * signalled_path)
 {
-    double packet_time = (double)send_mtu / pacing_rate;
-    double quantum_time = (double)quantum / pacing_rate;
+    double packet_time;
+    double quantum_time;
     uint64_t rtt_nanosec = smoothed_rtt * 1000;
 
+    if (signalled_path != NULL && pacing_rate > (double)signalled_path->pacing_rate_clamp) {
+        /* Live tuning clamp, see picoquic_set_path_pacing_rate_clamp */
+        pacing_rate = (double)signalled_path->pacing_rate_clamp;
+    }
+    quantum = picoquic_apply_pacing_policy(signalled_path, quantum, pacing_rate, send_mtu, smoothed_rtt);
+    packet_time = (double)send_mtu / pacing_rate;
+    quantum_time = (double)quantum / pacing_rate;
+
     pacing->rate = (uint64_t)pacing_rate;
 
     if (quantum > pacing->quantum_max) {
@@ -248,12 +330,43 @@ void picoquic_update_pacing_data_after_send(picoquic_pacing_t * pacing, size_t l
 void picoquic_update_pacing_after_send(picoquic_path_t* path_x, size_t length, uint64_t current_time)
 {
     picoquic_update_pacing_data_after_send(&path_x->pacing, length, path_x->send_mtu, current_time);
+    if (path_x->cnx->quic->slow_start_admission_rate > 0 && !path_x->is_ssthresh_initialized) {
+        picoquic_update_pacing_data_after_send(&path_x->cnx->quic->slow_start_admission_pacing,
+            length, path_x->send_mtu, current_time);
+    }
+}
+
+/* Ideal departure time of the packet that was just submitted, used by
+ * packet loops that offload pacing to the kernel or the NIC through
+ * SO_TXTIME. The leaky bucket lets short bursts through; when the
+ * bucket has gone negative, the deficit is the amount of transmission
+ * time by which the packet is ahead of the paced schedule. */
+uint64_t picoquic_pacing_departure_time(picoquic_path_t* path_x, uint64_t current_time)
+{
+    uint64_t departure_time = current_time;
+
+    if (path_x->pacing.bucket_nanosec < 0) {
+        departure_time += ((uint64_t)(-path_x->pacing.bucket_nanosec) + 999) / 1000;
+    }
+
+    return departure_time;
 }
 
 int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time, uint64_t* next_time)
 {
-    return picoquic_is_authorized_by_pacing(&path_x->pacing, current_time, next_time, cnx->quic->packet_train_mode,
+    int ret = picoquic_is_authorized_by_pacing(&path_x->pacing, current_time, next_time, cnx->quic->packet_train_mode,
         cnx->quic);
+
+    /* Paths still in slow start also draw from the context wide admission
+     * bucket, which caps the aggregate injection rate when many connections
+     * start at the same time. */
+    if (cnx->quic->slow_start_admission_rate > 0 && !path_x->is_ssthresh_initialized &&
+        !picoquic_is_authorized_by_pacing(&cnx->quic->slow_start_admission_pacing, current_time, next_time, 0,
+            cnx->quic)) {
+        ret = 0;
+    }
+
+    return ret;
 }
 
 /* Reset pacing data if congestion algorithm computes it directly */
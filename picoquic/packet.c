@@ -29,6 +29,7 @@
 
 #include "picoquic_internal.h"
 #include "picoquic_binlog.h"
+#include "picoquic_probes.h"
 #include "picoquic_unified_log.h"
 #include "tls_api.h"
 #include <stdint.h>
@@ -127,7 +128,7 @@ int picoquic_screen_initial_packet(
         if (picoquic_get_initial_aead_context(quic, ph->version_index, &ph->dest_cnx_id,
             0 /* is_client=0 */, 0 /* is_enc = 0 */, &aead_ctx, &pn_dec_ctx) == 0) {
             ret = picoquic_remove_header_protection_inner((uint8_t *)bytes, ph->offset + ph->payload_length,
-                decrypted_bytes, &dph, pn_dec_ctx, 0 /* is_loss_bit_enabled_incoming */, 0 /* sack_list_last*/);
+                decrypted_bytes, &dph, pn_dec_ctx, 0 /* is_loss_bit_enabled_incoming */, 0 /* sack_list_last*/, NULL);
             if (ret == 0) {
                 size_t decrypted_length = picoquic_aead_decrypt_generic(decrypted_bytes + dph.offset,
                     bytes + dph.offset, dph.payload_length, dph.pn64, decrypted_bytes, dph.offset, 
@@ -407,7 +408,10 @@ int picoquic_parse_short_packet_header(
         if (*pcnx == NULL)
         {
             if (quic->local_cnxid_length > 0) {
-                *pcnx = picoquic_cnx_by_id(quic, ph->dest_cnx_id, &ph->l_cid);
+                /* In steady state a receive burst is dominated by a few
+                 * connections; the route cache skips the hash table
+                 * lookup after the first packet of each. */
+                *pcnx = picoquic_cnx_by_id_cached(quic, ph->dest_cnx_id, &ph->l_cid);
             }
             else {
                 *pcnx = picoquic_cnx_by_net(quic, addr_from);
@@ -524,7 +528,8 @@ int picoquic_remove_header_protection_inner(
     picoquic_packet_header* ph,
     void * pn_enc,
     unsigned int is_loss_bit_enabled_incoming,
-    uint64_t sack_list_last)
+    uint64_t sack_list_last,
+    const uint8_t* hp_mask)
 {
     int ret = 0;
 
@@ -555,7 +560,14 @@ int picoquic_remove_header_protection_inner(
             uint32_t pn_val = 0;
 
             memcpy(decrypted_bytes, bytes, ph->pn_offset);
-            picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            if (hp_mask != NULL) {
+                /* The mask was precomputed in a batch from the same sample,
+                 * see picoquic_pn_encrypt_batch. */
+                memcpy(mask_bytes, hp_mask, mask_length);
+            }
+            else {
+                picoquic_pn_encrypt(pn_enc, bytes + sample_offset, mask_bytes, mask_bytes, mask_length);
+            }
             /* Decode the first byte */
             first_byte ^= (mask_bytes[0] & first_mask);
             pn_l = (first_byte & 3) + 1;
@@ -608,7 +620,8 @@ int picoquic_remove_header_protection_inner(
 int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
     uint8_t* bytes,
     uint8_t * decrypted_bytes,
-    picoquic_packet_header* ph)
+    picoquic_packet_header* ph,
+    const uint8_t* hp_mask)
 {
     int ret = 0;
     size_t length = ph->offset + ph->payload_length; /* this may change after decrypting the PN */
@@ -616,7 +629,7 @@ int picoquic_remove_header_protection(picoquic_cnx_t* cnx,
 
     picoquic_sack_list_t* sack_list = picoquic_sack_list_from_cnx_context(cnx, ph->pc, ph->l_cid);
     ret = picoquic_remove_header_protection_inner(bytes, length, decrypted_bytes, ph,
-        pn_enc, cnx->is_loss_bit_enabled_incoming, picoquic_sack_list_last(sack_list));
+        pn_enc, cnx->is_loss_bit_enabled_incoming, picoquic_sack_list_last(sack_list), hp_mask);
 
     return ret;
 }
@@ -693,6 +706,7 @@ size_t picoquic_remove_packet_protection(picoquic_cnx_t* cnx,
         else {
             /* TODO: check that this is larger than last received with current key */
             /* These could only be a new key */
+            picoquic_wait_precomputed_keys(cnx);
             if (cnx->crypto_context_new.aead_decrypt == NULL &&
                 cnx->crypto_context_new.aead_encrypt == NULL) {
                 /* If the new context was already computed, don't do it again */
@@ -725,6 +739,10 @@ size_t picoquic_remove_packet_protection(picoquic_cnx_t* cnx,
                         /* If that move was not already validated, move to the new encryption keys */
                         picoquic_apply_rotated_keys(cnx, 1);
                     }
+
+                    /* The rotation is complete; derive the next generation
+                     * ahead of time so the next rotation is a pointer swap. */
+                    picoquic_precompute_rotated_keys(cnx);
                 }
             }
             else {
@@ -769,7 +787,8 @@ int picoquic_parse_header_and_decrypt(
     picoquic_packet_header* ph,
     picoquic_cnx_t** pcnx,
     size_t * consumed,
-    int * new_ctx_created)
+    int * new_ctx_created,
+    const uint8_t* hp_mask)
 {
     /* Parse the clear text header. Ret == 0 means an incorrect packet that could not be parsed */
     int already_received = 0;
@@ -813,7 +832,7 @@ int picoquic_parse_header_and_decrypt(
 
                     if (ret == 0) {
                         /* Remove header protection at this point -- values of bytes will not change */
-                        ret = picoquic_remove_header_protection(*pcnx, (uint8_t*)bytes, decrypted_data->data, ph);
+                        ret = picoquic_remove_header_protection(*pcnx, (uint8_t*)bytes, decrypted_data->data, ph, hp_mask);
                     }
 
                     if (ret == 0) {
@@ -2108,10 +2127,25 @@ int picoquic_find_incoming_path(picoquic_cnx_t* cnx, picoquic_packet_header* ph,
 
             /* If this is a NAT rebinding, also set a challenge on the original path */
             if (nat_rebinding_path >= 0) {
-                /* Treat this as a NAT rebinding. Mark the old path for validation */
-                picoquic_set_path_challenge(cnx, nat_rebinding_path, current_time);
-                cnx->path[path_id]->is_nat_challenge = 1;
-                cnx->path[0]->is_nat_challenge = 1;
+                if (picoquic_is_address_recently_validated(cnx, addr_from, current_time)) {
+                    /* The NAT flapped back to an address that completed path
+                     * validation recently; skip the challenge round trip */
+                    cnx->path[path_id]->challenge_required = 0;
+                    cnx->path[path_id]->challenge_verified = 1;
+                    cnx->path[path_id]->is_nat_challenge = 0;
+                }
+                else {
+                    /* Treat this as a NAT rebinding. Mark the old path for validation */
+                    picoquic_set_path_challenge(cnx, nat_rebinding_path, current_time);
+                    cnx->path[path_id]->is_nat_challenge = 1;
+                    cnx->path[0]->is_nat_challenge = 1;
+                    if (picoquic_compare_ip_addr((struct sockaddr*)&cnx->path[nat_rebinding_path]->peer_addr,
+                        addr_from) == 0) {
+                        /* Only the port changed. Keep sending to the new address
+                         * while validation runs, within the amplification limit */
+                        cnx->path[path_id]->is_optimistic_send_allowed = 1;
+                    }
+                }
             }
             else {
                 cnx->path[path_id]->is_nat_challenge = 0;
@@ -2231,6 +2265,11 @@ int picoquic_incoming_1rtt(
             path_x->if_index_dest = if_index_to;
             cnx->is_1rtt_received = 1;
             picoquic_spin_function_table[cnx->spin_policy].spinbit_incoming(cnx, path_x, ph);
+            if (cnx->is_fec_enabled) {
+                /* Keep a copy of the payload so it can serve as a source
+                 * symbol if a repair frame covers this packet. */
+                picoquic_fec_receive_payload(cnx, ph->pn64, bytes + ph->offset, ph->payload_length);
+            }
             /* Accept the incoming frames */
             ret = picoquic_decode_frames(cnx, cnx->path[path_id],
                 bytes + ph->offset, ph->payload_length, received_data,
@@ -2328,12 +2367,21 @@ int  picoquic_incoming_not_decrypted(
 * Processing of the packet that was just received from the network.
 */
 
-int picoquic_incoming_segment(
+/* Process a segment whose header was already parsed and whose payload was
+ * already decrypted; continuation of picoquic_incoming_segment, split out
+ * so the batched train processing below can run all the decryptions of a
+ * GRO train back to back before any frame processing. */
+static int picoquic_incoming_parsed_segment(
     picoquic_quic_t* quic,
+    int parse_ret,
     uint8_t* raw_bytes,
     size_t length,
     size_t packet_length,
     size_t* consumed,
+    picoquic_stream_data_node_t* decrypted_data,
+    picoquic_packet_header* parsed_ph,
+    picoquic_cnx_t* parsed_cnx,
+    int new_context_created,
     struct sockaddr* addr_from,
     struct sockaddr* addr_to,
     int if_index_to,
@@ -2343,24 +2391,14 @@ int picoquic_incoming_segment(
     picoquic_connection_id_t* previous_dest_id,
     picoquic_cnx_t** first_cnx)
 {
-    int ret = 0;
-    picoquic_cnx_t* cnx = NULL;
-    picoquic_packet_header ph;
-    int new_context_created = 0;
+    int ret = parse_ret;
+    picoquic_cnx_t* cnx = parsed_cnx;
+    picoquic_packet_header ph = *parsed_ph;
     int is_first_segment = 0;
     int is_buffered = 0;
     int path_id = -1;
     int path_is_not_allocated = 0;
-    uint8_t* bytes = NULL;
-    picoquic_stream_data_node_t* decrypted_data = picoquic_stream_data_node_alloc(quic);
-
-    if (decrypted_data == NULL) {
-        return -1;
-    }
-    /* Parse the header and decrypt the segment */
-    ret = picoquic_parse_header_and_decrypt(quic, raw_bytes, length, packet_length, addr_from,
-        current_time, decrypted_data, &ph, &cnx, consumed, &new_context_created);
-    bytes = decrypted_data->data;
+    uint8_t* bytes = decrypted_data->data;
 
     /* Verify that the segment coalescing is for the same destination ID */
     if (picoquic_is_connection_id_null(previous_dest_id)) {
@@ -2578,6 +2616,8 @@ int picoquic_incoming_segment(
         if (cnx != NULL && cnx->cnx_state != picoquic_state_disconnected &&
             ph.ptype != picoquic_packet_version_negotiation) {
             cnx->nb_packets_received++;
+            PICOQUIC_PROBE_PACKET_RECEIVED(picoquic_val64_connection_id(cnx->initial_cnxid),
+                ph.pn64, length);
             cnx->latest_receive_time = current_time;
             /* Mark the sequence number as received */
             ret = picoquic_record_pn_received(cnx, ph.pc, ph.l_cid, ph.pn64, receive_time);
@@ -2630,12 +2670,57 @@ int picoquic_incoming_segment(
     }
 
     if (decrypted_data != NULL && decrypted_data->bytes == NULL) {
-        picoquic_stream_data_node_recycle(decrypted_data);
+        if (decrypted_data->loan_count > 0) {
+            /* The application holds a loan on the decrypted bytes; the node
+             * is recycled when the last loan is returned. */
+            decrypted_data->is_detached = 1;
+        }
+        else {
+            picoquic_stream_data_node_recycle(decrypted_data);
+        }
     }
 
     return ret;
 }
 
+int picoquic_incoming_segment(
+    picoquic_quic_t* quic,
+    uint8_t* raw_bytes,
+    size_t length,
+    size_t packet_length,
+    size_t* consumed,
+    struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    int if_index_to,
+    unsigned char received_ecn,
+    uint64_t current_time,
+    uint64_t receive_time,
+    picoquic_connection_id_t* previous_dest_id,
+    picoquic_cnx_t** first_cnx)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_packet_header ph;
+    int new_context_created = 0;
+    /* The decryption target is a pooled stream data node, not a scratch
+     * buffer: the AEAD writes the plaintext directly into the buffer that
+     * stream reassembly will adopt (see add_chunk_node), so payload bytes
+     * are written exactly once on the receive path. The node is recycled
+     * below if reassembly did not take ownership. */
+    picoquic_stream_data_node_t* decrypted_data = picoquic_stream_data_node_alloc(quic);
+
+    if (decrypted_data == NULL) {
+        return -1;
+    }
+    /* Parse the header and decrypt the segment */
+    ret = picoquic_parse_header_and_decrypt(quic, raw_bytes, length, packet_length, addr_from,
+        current_time, decrypted_data, &ph, &cnx, consumed, &new_context_created, NULL);
+
+    return picoquic_incoming_parsed_segment(quic, ret, raw_bytes, length, packet_length,
+        consumed, decrypted_data, &ph, cnx, new_context_created, addr_from, addr_to,
+        if_index_to, received_ecn, current_time, receive_time, previous_dest_id, first_cnx);
+}
+
 int picoquic_incoming_packet_ex(
     picoquic_quic_t* quic,
     uint8_t* bytes,
@@ -2651,6 +2736,15 @@ int picoquic_incoming_packet_ex(
     int ret = 0;
     picoquic_connection_id_t previous_destid = picoquic_null_connection_id;
 
+    /* In sharded operation, short header packets whose destination CID
+     * designates another shard are handed over before any lookup. */
+    if (quic->shard_reroute_fn != NULL && packet_length > 0 && (bytes[0] & 0x80) == 0) {
+        if (quic->shard_reroute_fn(quic->shard_reroute_ctx, bytes, packet_length,
+            addr_from, addr_to, if_index_to, received_ecn, current_time) != 0) {
+            return 0;
+        }
+    }
+
     while (consumed_index < packet_length) {
         size_t consumed = 0;
 
@@ -2695,6 +2789,198 @@ int picoquic_incoming_packet(
     return ret;
 }
 
+/* Batched processing of a coalesced receive train (UDP GRO or URO): the
+ * buffer holds consecutive datagrams of seg_size bytes, the last one
+ * possibly shorter, all from the same source address. In the steady state
+ * these are short header packets for the same connection; their header
+ * protection removal and AEAD decryption run back to back before any
+ * frame processing, which keeps the AES pipeline of the crypto provider
+ * full instead of interleaving each decryption with frame handling.
+ *
+ * Only short header datagrams are batched: in a long header datagram, the
+ * keys for a coalesced segment can depend on processing the previous
+ * segments (e.g. handshake keys derived from an initial packet), so those
+ * datagrams go through picoquic_incoming_packet_ex one at a time. Note
+ * that a duplicate packet number repeated inside one batch is only
+ * detected when the batch is processed; processing such a duplicate is
+ * harmless, the frame handlers are idempotent. */
+
+#define PICOQUIC_INCOMING_TRAIN_BATCH_MAX 32
+
+/* Precompute the header protection masks for the segments following
+ * "offset", as long as they are short header packets carrying the same
+ * destination CID as the reference packet, so they will resolve to the
+ * same connection and thus the same HP key. The masks are computed with
+ * one call to picoquic_pn_encrypt_batch -- one AES block per packet --
+ * which a batch capable provider turns into a single multi-block AES
+ * computation. Returns the number of masks, written as 5 bytes each. */
+static size_t picoquic_train_precompute_hp_masks(picoquic_quic_t* quic, const uint8_t* bytes,
+    size_t train_length, size_t seg_size, size_t offset, void* pn_dec,
+    const picoquic_connection_id_t* dest_cnx_id, uint8_t* masks)
+{
+    size_t nb_masks = 0;
+    size_t sample_offset = (size_t)1 + quic->local_cnxid_length + 4;
+    size_t sample_size = picoquic_pn_iv_size(pn_dec);
+    const uint8_t* first_sample = bytes + offset + sample_offset;
+
+    if (dest_cnx_id->id_len == quic->local_cnxid_length) {
+        while (nb_masks < PICOQUIC_PN_MASK_BATCH_MAX && offset < train_length) {
+            size_t length = train_length - offset;
+
+            if (length > seg_size) {
+                length = seg_size;
+            }
+
+            if ((bytes[offset] & 0x80) != 0 ||
+                length < sample_offset + sample_size ||
+                memcmp(bytes + offset + 1, dest_cnx_id->id, dest_cnx_id->id_len) != 0) {
+                break;
+            }
+            nb_masks++;
+            offset += length;
+        }
+    }
+
+    if (nb_masks > 0) {
+        picoquic_pn_encrypt_batch(pn_dec, first_sample, seg_size, masks, nb_masks);
+    }
+
+    return nb_masks;
+}
+
+typedef struct st_picoquic_incoming_train_entry_t {
+    picoquic_stream_data_node_t* decrypted_data;
+    picoquic_packet_header ph;
+    picoquic_cnx_t* cnx;
+    uint8_t* raw_bytes;
+    size_t length;
+    size_t consumed;
+    int parse_ret;
+    int new_context_created;
+} picoquic_incoming_train_entry_t;
+
+int picoquic_incoming_coalesced_train(
+    picoquic_quic_t* quic,
+    uint8_t* bytes,
+    size_t train_length,
+    size_t seg_size,
+    struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    int if_index_to,
+    unsigned char received_ecn,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time)
+{
+    int ret = 0;
+    size_t offset = 0;
+    /* Header protection mask cache: once an entry resolves to a 1-RTT
+     * connection, the masks for the following segments carrying the same
+     * destination CID are precomputed in batches of up to
+     * PICOQUIC_PN_MASK_BATCH_MAX with a single batch call. Slot k covers
+     * the segment starting at hp_mask_offset + k*seg_size. */
+    uint8_t hp_masks[PICOQUIC_PN_MASK_BATCH_MAX * 5];
+    size_t hp_mask_offset = 0;
+    size_t nb_hp_masks = 0;
+
+    if (seg_size == 0) {
+        seg_size = train_length;
+    }
+
+    while (ret == 0 && offset < train_length) {
+        picoquic_incoming_train_entry_t entries[PICOQUIC_INCOMING_TRAIN_BATCH_MAX];
+        int nb_entries = 0;
+
+        /* Phase 1: parse and decrypt a batch of short header datagrams */
+        while (ret == 0 && nb_entries < PICOQUIC_INCOMING_TRAIN_BATCH_MAX &&
+            offset < train_length) {
+            size_t length = train_length - offset;
+            picoquic_incoming_train_entry_t* entry = &entries[nb_entries];
+
+            if (length > seg_size) {
+                length = seg_size;
+            }
+
+            if ((bytes[offset] & 0x80) != 0 || quic->shard_reroute_fn != NULL) {
+                /* Long header, or sharded operation: no batching. Flush the
+                 * entries gathered so far first, then take the generic path
+                 * for this datagram. */
+                break;
+            }
+
+            if ((entry->decrypted_data = picoquic_stream_data_node_alloc(quic)) == NULL) {
+                ret = -1;
+            }
+            else {
+                const uint8_t* hp_mask = NULL;
+
+                if (nb_hp_masks > 0 && offset >= hp_mask_offset &&
+                    (offset - hp_mask_offset) % seg_size == 0 &&
+                    (offset - hp_mask_offset) / seg_size < nb_hp_masks) {
+                    hp_mask = hp_masks + 5 * ((offset - hp_mask_offset) / seg_size);
+                }
+                entry->raw_bytes = bytes + offset;
+                entry->length = length;
+                entry->consumed = 0;
+                entry->cnx = NULL;
+                entry->new_context_created = 0;
+                entry->parse_ret = picoquic_parse_header_and_decrypt(quic, entry->raw_bytes,
+                    length, length, addr_from, current_time, entry->decrypted_data,
+                    &entry->ph, &entry->cnx, &entry->consumed, &entry->new_context_created,
+                    hp_mask);
+                nb_entries++;
+                offset += length;
+
+                /* Refill the mask cache when the next segment is not covered
+                 * and this entry identified a 1-RTT connection. */
+                if (entry->parse_ret == 0 && entry->cnx != NULL &&
+                    entry->ph.ptype == picoquic_packet_1rtt_protected &&
+                    entry->cnx->crypto_context[picoquic_epoch_1rtt].pn_dec != NULL &&
+                    offset < train_length &&
+                    (nb_hp_masks == 0 || offset < hp_mask_offset ||
+                    (offset - hp_mask_offset) % seg_size != 0 ||
+                        (offset - hp_mask_offset) / seg_size >= nb_hp_masks)) {
+                    hp_mask_offset = offset;
+                    nb_hp_masks = picoquic_train_precompute_hp_masks(quic, bytes,
+                        train_length, seg_size, offset,
+                        entry->cnx->crypto_context[picoquic_epoch_1rtt].pn_dec,
+                        &entry->ph.dest_cnx_id, hp_masks);
+                }
+            }
+        }
+
+        /* Phase 2: process the decrypted packets */
+        for (int i = 0; i < nb_entries; i++) {
+            picoquic_incoming_train_entry_t* entry = &entries[i];
+            picoquic_connection_id_t previous_dest_id = picoquic_null_connection_id;
+            int seg_ret = picoquic_incoming_parsed_segment(quic, entry->parse_ret,
+                entry->raw_bytes, entry->length, entry->length, &entry->consumed,
+                entry->decrypted_data, &entry->ph, entry->cnx, entry->new_context_created,
+                addr_from, addr_to, if_index_to, received_ecn, current_time, current_time,
+                &previous_dest_id, first_cnx);
+
+            if (seg_ret == 0 && *first_cnx != NULL &&
+                entry->length > (*first_cnx)->max_mtu_received) {
+                (*first_cnx)->max_mtu_received = entry->length;
+            }
+        }
+
+        if (ret == 0 && offset < train_length &&
+            nb_entries < PICOQUIC_INCOMING_TRAIN_BATCH_MAX) {
+            /* The batch stopped on a long header datagram */
+            size_t length = train_length - offset;
+
+            if (length > seg_size) {
+                length = seg_size;
+            }
+            ret = picoquic_incoming_packet_ex(quic, bytes + offset, length, addr_from,
+                addr_to, if_index_to, received_ecn, first_cnx, current_time);
+            offset += length;
+        }
+    }
+
+    return ret;
+}
+
 /* Processing of stashed packets after acquiring encryption context */
 void picoquic_process_sooner_packets(picoquic_cnx_t* cnx, uint64_t current_time)
 {
@@ -0,0 +1,266 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Shared memory export of performance counters, see perf_export.h for
+ * the segment layout and the reader protocol. The writer side runs on
+ * the thread that owns the QUIC context: slots are assigned when a
+ * connection publishes its first statistics snapshot, updated in place
+ * on every snapshot refresh, and released when the connection is
+ * deleted. All updates follow the same sequence lock discipline as the
+ * in-memory snapshot in picoquic_publish_cnx_stats.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_internal.h"
+#include "perf_export.h"
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WINDOWS
+#define picoquic_perf_export_fence() MemoryBarrier()
+#else
+#define picoquic_perf_export_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+typedef struct st_picoquic_perf_export_ctx_t {
+    picoquic_perf_export_header_t* header;
+    picoquic_perf_export_slot_t* slots;
+    size_t nb_slots;
+    size_t nb_slots_in_use;
+    size_t mapped_size;
+#ifdef _WINDOWS
+    HANDLE file_handle;
+    HANDLE mapping_handle;
+#else
+    int fd;
+#endif
+} picoquic_perf_export_ctx_t;
+
+static void* picoquic_perf_export_map(picoquic_perf_export_ctx_t* ctx, char const* export_file_name, size_t mapped_size)
+{
+    void* mapped = NULL;
+#ifdef _WINDOWS
+    ctx->file_handle = CreateFileA(export_file_name, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (ctx->file_handle != INVALID_HANDLE_VALUE) {
+        ctx->mapping_handle = CreateFileMappingA(ctx->file_handle, NULL, PAGE_READWRITE,
+            (DWORD)(((uint64_t)mapped_size) >> 32), (DWORD)(mapped_size & 0xffffffff), NULL);
+        if (ctx->mapping_handle != NULL) {
+            mapped = MapViewOfFile(ctx->mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, mapped_size);
+        }
+    }
+#else
+    ctx->fd = open(export_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ctx->fd >= 0 && ftruncate(ctx->fd, (off_t)mapped_size) == 0) {
+        mapped = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = NULL;
+        }
+    }
+#endif
+    return mapped;
+}
+
+static void picoquic_perf_export_unmap(picoquic_perf_export_ctx_t* ctx)
+{
+#ifdef _WINDOWS
+    if (ctx->header != NULL) {
+        (void)UnmapViewOfFile((void*)ctx->header);
+    }
+    if (ctx->mapping_handle != NULL) {
+        (void)CloseHandle(ctx->mapping_handle);
+    }
+    if (ctx->file_handle != INVALID_HANDLE_VALUE) {
+        (void)CloseHandle(ctx->file_handle);
+    }
+#else
+    if (ctx->header != NULL) {
+        (void)munmap((void*)ctx->header, ctx->mapped_size);
+    }
+    if (ctx->fd >= 0) {
+        (void)close(ctx->fd);
+    }
+#endif
+    ctx->header = NULL;
+    ctx->slots = NULL;
+}
+
+int picoquic_perf_export_setup(picoquic_quic_t* quic, char const* export_file_name, size_t nb_slots)
+{
+    int ret = 0;
+    picoquic_perf_export_ctx_t* ctx = (picoquic_perf_export_ctx_t*)
+        malloc(sizeof(picoquic_perf_export_ctx_t));
+
+    if (ctx == NULL || nb_slots == 0) {
+        ret = -1;
+    }
+    else {
+        void* mapped;
+
+        memset(ctx, 0, sizeof(picoquic_perf_export_ctx_t));
+#ifdef _WINDOWS
+        ctx->file_handle = INVALID_HANDLE_VALUE;
+#else
+        ctx->fd = -1;
+#endif
+        ctx->nb_slots = nb_slots;
+        ctx->mapped_size = sizeof(picoquic_perf_export_header_t) +
+            nb_slots * sizeof(picoquic_perf_export_slot_t);
+        mapped = picoquic_perf_export_map(ctx, export_file_name, ctx->mapped_size);
+
+        if (mapped == NULL) {
+            picoquic_perf_export_unmap(ctx);
+            ret = -1;
+        }
+        else {
+            memset(mapped, 0, ctx->mapped_size);
+            ctx->header = (picoquic_perf_export_header_t*)mapped;
+            ctx->slots = (picoquic_perf_export_slot_t*)(void*)
+                (((uint8_t*)mapped) + sizeof(picoquic_perf_export_header_t));
+            ctx->header->header_size = sizeof(picoquic_perf_export_header_t);
+            ctx->header->slot_size = sizeof(picoquic_perf_export_slot_t);
+            ctx->header->nb_slots = nb_slots;
+            ctx->header->version = PICOQUIC_PERF_EXPORT_VERSION;
+            /* The magic is written last, so a reader that sees it can
+             * trust the layout fields */
+            picoquic_perf_export_fence();
+            ctx->header->magic = PICOQUIC_PERF_EXPORT_MAGIC;
+            quic->v_perf_export_ctx = (void*)ctx;
+        }
+    }
+
+    if (ret != 0 && ctx != NULL) {
+        free(ctx);
+    }
+
+    return ret;
+}
+
+void picoquic_perf_export_close(picoquic_quic_t* quic)
+{
+    picoquic_perf_export_ctx_t* ctx = (picoquic_perf_export_ctx_t*)quic->v_perf_export_ctx;
+
+    if (ctx != NULL) {
+        picoquic_perf_export_unmap(ctx);
+        free(ctx);
+        quic->v_perf_export_ctx = NULL;
+    }
+}
+
+static void picoquic_perf_export_header_update(picoquic_perf_export_ctx_t* ctx,
+    picoquic_quic_t* quic, uint64_t current_time)
+{
+    ctx->header->seq++;
+    picoquic_perf_export_fence();
+    ctx->header->export_time = current_time;
+    ctx->header->current_number_connections = quic->current_number_connections;
+    ctx->header->nb_slots_in_use = ctx->nb_slots_in_use;
+    picoquic_perf_export_fence();
+    ctx->header->seq++;
+}
+
+/* Assign a free slot to the connection. Runs on the thread that owns
+ * the context, so the scan does not race with other writers. Returns
+ * NULL if all slots are taken; the connection will retry on the next
+ * snapshot, and simply remains invisible to scrapers until then. */
+static picoquic_perf_export_slot_t* picoquic_perf_export_assign_slot(
+    picoquic_perf_export_ctx_t* ctx, picoquic_cnx_t* cnx)
+{
+    picoquic_perf_export_slot_t* slot = NULL;
+
+    for (size_t i = 0; i < ctx->nb_slots; i++) {
+        if (ctx->slots[i].in_use == 0) {
+            slot = &ctx->slots[i];
+            ctx->nb_slots_in_use++;
+            break;
+        }
+    }
+
+    if (slot != NULL) {
+        slot->seq++;
+        picoquic_perf_export_fence();
+        slot->in_use = 1;
+        memcpy(slot->icid, cnx->initial_cnxid.id, sizeof(slot->icid));
+        slot->icid_len = cnx->initial_cnxid.id_len;
+        slot->is_client = cnx->client_mode;
+        slot->start_time = cnx->start_time;
+        picoquic_perf_export_fence();
+        slot->seq++;
+    }
+
+    return slot;
+}
+
+void picoquic_perf_export_publish(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picoquic_perf_export_ctx_t* ctx = (picoquic_perf_export_ctx_t*)cnx->quic->v_perf_export_ctx;
+
+    if (ctx != NULL) {
+        picoquic_perf_export_slot_t* slot = cnx->perf_export_slot;
+
+        if (slot == NULL) {
+            slot = picoquic_perf_export_assign_slot(ctx, cnx);
+            cnx->perf_export_slot = slot;
+        }
+
+        if (slot != NULL) {
+            slot->seq++;
+            picoquic_perf_export_fence();
+            /* The in-memory snapshot was just refreshed by
+             * picoquic_publish_cnx_stats on this same thread */
+            slot->stats = cnx->stats_snapshot;
+            picoquic_perf_export_fence();
+            slot->seq++;
+        }
+
+        picoquic_perf_export_header_update(ctx, cnx->quic, current_time);
+    }
+}
+
+void picoquic_perf_export_on_cnx_deleted(picoquic_cnx_t* cnx)
+{
+    picoquic_perf_export_ctx_t* ctx = (picoquic_perf_export_ctx_t*)cnx->quic->v_perf_export_ctx;
+
+    if (ctx != NULL && cnx->perf_export_slot != NULL) {
+        picoquic_perf_export_slot_t* slot = cnx->perf_export_slot;
+
+        slot->seq++;
+        picoquic_perf_export_fence();
+        slot->in_use = 0;
+        picoquic_perf_export_fence();
+        slot->seq++;
+        cnx->perf_export_slot = NULL;
+        if (ctx->nb_slots_in_use > 0) {
+            ctx->nb_slots_in_use--;
+        }
+        picoquic_perf_export_header_update(ctx, cnx->quic, picoquic_get_quic_time(cnx->quic));
+    }
+}
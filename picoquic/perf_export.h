@@ -0,0 +1,85 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef PICOQUIC_PERF_EXPORT_H
+#define PICOQUIC_PERF_EXPORT_H
+
+#include "picoquic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Live export of performance counters through a file backed shared
+ * memory segment, so an external process such as a metrics exporter can
+ * scrape them without touching the thread that runs the connections or
+ * waiting for connection close records in the performance log.
+ *
+ * The segment starts with a fixed size header followed by an array of
+ * fixed size per connection slots. Both carry a sequence lock: the
+ * writer bumps "seq" to an odd value, rewrites the payload, then bumps
+ * it back to even; a reader copies the payload between two identical
+ * even reads of "seq" and retries otherwise. The writer never blocks.
+ *
+ * The layout is versioned. New fields are only appended, the version
+ * number is bumped when they are, and "slot_size" / "header_size" in
+ * the header let a reader stride over slots it does not fully know.
+ *
+ * Slots are assigned when a connection publishes its first statistics
+ * snapshot and released when it is deleted; "in_use" is zero for free
+ * slots. The connection is identified by its initial connection ID.
+ */
+
+#define PICOQUIC_PERF_EXPORT_MAGIC 0x51504558ull /* 'QPEX' */
+#define PICOQUIC_PERF_EXPORT_VERSION 1
+
+typedef struct st_picoquic_perf_export_slot_t {
+    volatile uint64_t seq; /* sequence lock, odd while the writer updates the slot */
+    uint64_t in_use; /* zero when the slot is free */
+    uint8_t icid[20]; /* initial connection ID of the connection */
+    uint8_t icid_len;
+    uint8_t padding[3];
+    uint32_t is_client;
+    uint64_t start_time; /* quic time at which the connection was created */
+    picoquic_cnx_stats_t stats; /* same layout as picoquic_get_cnx_stats */
+} picoquic_perf_export_slot_t;
+
+typedef struct st_picoquic_perf_export_header_t {
+    uint64_t magic; /* PICOQUIC_PERF_EXPORT_MAGIC */
+    uint64_t version; /* PICOQUIC_PERF_EXPORT_VERSION */
+    uint64_t header_size; /* offset of the first slot */
+    uint64_t slot_size; /* stride between slots */
+    uint64_t nb_slots;
+    volatile uint64_t seq; /* sequence lock for the counters below */
+    uint64_t export_time; /* quic time of the last header update */
+    uint64_t current_number_connections; /* connections in the context */
+    uint64_t nb_slots_in_use;
+} picoquic_perf_export_header_t;
+
+/* Create the shared memory segment backed by "export_file_name", sized
+ * for "nb_slots" connection slots, and program the context to keep it
+ * updated. Returns -1 if the file cannot be created or mapped. The
+ * segment is unmapped when the QUIC context is freed. */
+int picoquic_perf_export_setup(picoquic_quic_t* quic, char const* export_file_name, size_t nb_slots);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* PICOQUIC_PERF_EXPORT_H */
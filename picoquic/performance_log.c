@@ -64,6 +64,7 @@ typedef struct st_picoquic_performance_log_ctx_t {
     struct st_picoquic_performance_log_item_t* first;
     struct st_picoquic_performance_log_item_t* last;
     char const* perflog_file_name;
+    size_t nb_columns; /* base columns only, or base plus extended outcome columns */
 } picoquic_performance_log_ctx_t;
 
 void picoquic_perflog_item_free(picoquic_performance_log_item_t* perflog_item)
@@ -157,7 +158,7 @@ int picoquic_perflog_record(picoquic_cnx_t* cnx, picoquic_performance_log_ctx_t*
         perflog_item->cnxid = picoquic_get_logging_cnxid(cnx);
         perflog_item->cnx_time_64 = start_time;
         /* Store additional parameters */
-        perflog_item->nb_values = PICOQUIC_PERF_LOG_MAX_ITEMS;
+        perflog_item->nb_values = perflog_ctx->nb_columns;
         perflog_item->v[picoquic_perflog_is_client] = cnx->client_mode;
         perflog_item->v[picoquic_perflog_nb_packets_received] = cnx->nb_packets_received;
         perflog_item->v[picoquic_perflog_nb_trains_sent] = cnx->nb_trains_sent;
@@ -185,7 +186,9 @@ int picoquic_perflog_record(picoquic_cnx_t* cnx, picoquic_performance_log_ctx_t*
             perflog_item->v[picoquic_perflog_bwe_max] = cnx->path[0]->bandwidth_estimate_max;
             perflog_item->v[picoquic_perflog_pacing_quantum_max] = cnx->path[0]->pacing.quantum_max;
             perflog_item->v[picoquic_perflog_pacing_rate] = cnx->path[0]->pacing.rate_max;
+            perflog_item->v[picoquic_perflog_rtt_p99] = picoquic_rtt_histogram_quantile(cnx->path[0], 99);
         }
+        perflog_item->v[picoquic_perflog_cc_experiment_arm] = cnx->is_cc_experiment_arm;
         if (cnx->congestion_alg != NULL) {
             perflog_item->v[picoquic_perflog_ccalgo] = cnx->congestion_alg->congestion_algorithm_number;
         }
@@ -270,6 +273,8 @@ const char* picoquic_perflog_param_name(picoquic_perflog_column_enum rank)
     case picoquic_perflog_bwe_max: return("bwe_max");
     case picoquic_perflog_pacing_quantum_max: return("p_quantum");
     case picoquic_perflog_pacing_rate: return("p_rate");
+    case picoquic_perflog_rtt_p99: return("rtt_p99");
+    case picoquic_perflog_cc_experiment_arm: return("cc_exp");
     default:
         break;
     }
@@ -295,7 +300,7 @@ int picoquic_perflog_file_is_empty(char const* perflog_file_name)
     return (is_empty);
 }
 
-void picoquic_perflog_file_set_header(char const* perflog_file_name)
+void picoquic_perflog_file_set_header(char const* perflog_file_name, size_t nb_columns)
 {
     FILE* F = picoquic_file_open(perflog_file_name, "w");
 
@@ -303,7 +308,7 @@ void picoquic_perflog_file_set_header(char const* perflog_file_name)
         fprintf(F, "Log_v, PQ_v, Duration, Sent, Received, Mpbs_S, Mbps_R");
         fprintf(F, ", QUIC_v, ALPN, CNX_ID, T64");
         /* Print the additional values */
-        for (size_t i = 0; i < PICOQUIC_PERF_LOG_MAX_ITEMS; i++) {
+        for (size_t i = 0; i < nb_columns; i++) {
             char buf[16];
             char const* s = picoquic_perflog_param_name((picoquic_perflog_column_enum)i);
             if (s == NULL) {
@@ -317,7 +322,7 @@ void picoquic_perflog_file_set_header(char const* perflog_file_name)
     }
 }
 
-int picoquic_perflog_setup(picoquic_quic_t* quic, char const * perflog_file_name)
+int picoquic_perflog_setup_ex(picoquic_quic_t* quic, char const * perflog_file_name, int extended)
 {
     int ret = 0;
     picoquic_performance_log_ctx_t* perflog_ctx = (picoquic_performance_log_ctx_t*)
@@ -327,6 +332,7 @@ int picoquic_perflog_setup(picoquic_quic_t* quic, char const * perflog_file_name
     }
     else {
         memset(perflog_ctx, 0, sizeof(picoquic_performance_log_ctx_t));
+        perflog_ctx->nb_columns = (extended) ? PICOQUIC_PERF_LOG_MAX_ITEMS : PICOQUIC_PERF_LOG_BASE_ITEMS;
         perflog_ctx->perflog_file_name = picoquic_string_duplicate(perflog_file_name);
         if (perflog_ctx->perflog_file_name == NULL) {
             free(perflog_ctx);
@@ -334,7 +340,7 @@ int picoquic_perflog_setup(picoquic_quic_t* quic, char const * perflog_file_name
         } else {
             /* If the file is empty, add a description string, so CSV looks good */
             if (picoquic_perflog_file_is_empty(perflog_file_name)) {
-                picoquic_perflog_file_set_header(perflog_file_name);
+                picoquic_perflog_file_set_header(perflog_file_name, perflog_ctx->nb_columns);
             }
             /* Program the QUIC context to produce performance logs */
             quic->perflog_fn = picoquic_perflog;
@@ -342,4 +348,9 @@ int picoquic_perflog_setup(picoquic_quic_t* quic, char const * perflog_file_name
         }
     }
     return ret;
+}
+
+int picoquic_perflog_setup(picoquic_quic_t* quic, char const* perflog_file_name)
+{
+    return picoquic_perflog_setup_ex(quic, perflog_file_name, 0);
 }
\ No newline at end of file
@@ -26,7 +26,8 @@ extern "C" {
 #endif
 
 #define PICOQUIC_PER_LOG_VERSION 1
-#define PICOQUIC_PERF_LOG_MAX_ITEMS 27
+#define PICOQUIC_PERF_LOG_BASE_ITEMS 27
+#define PICOQUIC_PERF_LOG_MAX_ITEMS 29
 
 typedef enum {
     picoquic_perflog_is_client = 0,
@@ -55,13 +56,23 @@ typedef enum {
     picoquic_perflog_ccalgo = 23,
     picoquic_perflog_bwe_max = 24,
     picoquic_perflog_pacing_quantum_max = 25,
-    picoquic_perflog_pacing_rate = 26
+    picoquic_perflog_pacing_rate = 26,
+    /* Extended outcome columns, only emitted by picoquic_perflog_setup_ex */
+    picoquic_perflog_rtt_p99 = 27,
+    picoquic_perflog_cc_experiment_arm = 28
 } picoquic_perflog_column_enum;
 
 const char* picoquic_perflog_param_name(picoquic_perflog_column_enum rank);
 
 int picoquic_perflog_setup(picoquic_quic_t* quic, char const* perflog_file_name);
 
+/* Same as picoquic_perflog_setup but, if "extended" is not zero, the log
+ * also carries the end of connection outcome columns used for congestion
+ * control experiments: approximate p99 RTT from the path histogram, and
+ * whether the connection was assigned to the experiment arm by
+ * picoquic_set_cc_experiment. */
+int picoquic_perflog_setup_ex(picoquic_quic_t* quic, char const* perflog_file_name, int extended);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,503 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picobtree.h"
+
+/* Classic B-tree of minimum degree 8: every node except the root holds
+ * between PICOBTREE_MIN_ENTRIES and PICOBTREE_MAX_ENTRIES values.
+ * Insertion splits full nodes on the way down, deletion refills minimal
+ * nodes on the way down, so both run in a single descent. */
+
+static picobtree_node_t* picobtree_new_node(int is_leaf)
+{
+    picobtree_node_t* node = (picobtree_node_t*)malloc(sizeof(picobtree_node_t));
+
+    if (node != NULL) {
+        memset(node, 0, sizeof(picobtree_node_t));
+        node->is_leaf = is_leaf;
+    }
+
+    return node;
+}
+
+void picobtree_init(picobtree_t* tree, picobtree_comparator comp, picobtree_delete_value delete_value)
+{
+    tree->root = NULL;
+    tree->comp = comp;
+    tree->delete_value = delete_value;
+    tree->size = 0;
+}
+
+/* Rank of the first entry larger than the value, i.e. the child to
+ * descend into. */
+static int picobtree_upper_bound(picobtree_t* tree, picobtree_node_t* node, void* value)
+{
+    int rank = 0;
+
+    while (rank < node->nb_entries && tree->comp(value, node->entries[rank]) >= 0) {
+        rank++;
+    }
+
+    return rank;
+}
+
+void* picobtree_find(picobtree_t* tree, void* value)
+{
+    picobtree_node_t* node = tree->root;
+
+    while (node != NULL) {
+        int rank = 0;
+        int64_t cmp = -1;
+
+        while (rank < node->nb_entries && (cmp = tree->comp(value, node->entries[rank])) > 0) {
+            rank++;
+        }
+        if (rank < node->nb_entries && cmp == 0) {
+            return node->entries[rank];
+        }
+        node = (node->is_leaf) ? NULL : node->children[rank];
+    }
+
+    return NULL;
+}
+
+/* Largest value lower than or equal to the argument */
+void* picobtree_find_previous(picobtree_t* tree, void* value)
+{
+    picobtree_node_t* node = tree->root;
+    void* found = NULL;
+
+    while (node != NULL) {
+        int rank = picobtree_upper_bound(tree, node, value);
+
+        if (rank > 0) {
+            found = node->entries[rank - 1];
+        }
+        node = (node->is_leaf) ? NULL : node->children[rank];
+    }
+
+    return found;
+}
+
+void* picobtree_first(picobtree_t* tree)
+{
+    picobtree_node_t* node = tree->root;
+
+    if (node == NULL) {
+        return NULL;
+    }
+    while (!node->is_leaf) {
+        node = node->children[0];
+    }
+
+    return (node->nb_entries > 0) ? node->entries[0] : NULL;
+}
+
+void* picobtree_last(picobtree_t* tree)
+{
+    picobtree_node_t* node = tree->root;
+
+    if (node == NULL) {
+        return NULL;
+    }
+    while (!node->is_leaf) {
+        node = node->children[node->nb_entries];
+    }
+
+    return (node->nb_entries > 0) ? node->entries[node->nb_entries - 1] : NULL;
+}
+
+/* Smallest value strictly larger than the argument */
+void* picobtree_next(picobtree_t* tree, void* value)
+{
+    picobtree_node_t* node = tree->root;
+    void* found = NULL;
+
+    while (node != NULL) {
+        int rank = 0;
+
+        while (rank < node->nb_entries && tree->comp(value, node->entries[rank]) >= 0) {
+            rank++;
+        }
+        if (rank < node->nb_entries) {
+            found = node->entries[rank];
+        }
+        node = (node->is_leaf) ? NULL : node->children[rank];
+    }
+
+    return found;
+}
+
+/* Split the full child at the specified rank, lifting its median entry
+ * into the parent. The parent is guaranteed not full. */
+static int picobtree_split_child(picobtree_node_t* parent, int rank)
+{
+    picobtree_node_t* child = parent->children[rank];
+    picobtree_node_t* sibling = picobtree_new_node(child->is_leaf);
+    int half = PICOBTREE_MAX_ENTRIES / 2;
+
+    if (sibling == NULL) {
+        return -1;
+    }
+
+    sibling->nb_entries = PICOBTREE_MAX_ENTRIES - half - 1;
+    memcpy(sibling->entries, child->entries + half + 1, sibling->nb_entries * sizeof(void*));
+    if (!child->is_leaf) {
+        memcpy(sibling->children, child->children + half + 1,
+            (sibling->nb_entries + 1) * sizeof(picobtree_node_t*));
+    }
+
+    memmove(parent->children + rank + 2, parent->children + rank + 1,
+        (parent->nb_entries - rank) * sizeof(picobtree_node_t*));
+    memmove(parent->entries + rank + 1, parent->entries + rank,
+        (parent->nb_entries - rank) * sizeof(void*));
+    parent->entries[rank] = child->entries[half];
+    parent->children[rank + 1] = sibling;
+    parent->nb_entries++;
+    child->nb_entries = half;
+
+    return 0;
+}
+
+int picobtree_insert(picobtree_t* tree, void* value)
+{
+    picobtree_node_t* node;
+
+    if (tree->root == NULL) {
+        tree->root = picobtree_new_node(1);
+        if (tree->root == NULL) {
+            return -1;
+        }
+    }
+
+    if (tree->root->nb_entries >= PICOBTREE_MAX_ENTRIES) {
+        /* Grow the tree by one level, then split the old root */
+        picobtree_node_t* new_root = picobtree_new_node(0);
+
+        if (new_root == NULL) {
+            return -1;
+        }
+        new_root->children[0] = tree->root;
+        tree->root = new_root;
+        if (picobtree_split_child(new_root, 0) != 0) {
+            return -1;
+        }
+    }
+
+    node = tree->root;
+    for (;;) {
+        int rank = picobtree_upper_bound(tree, node, value);
+
+        if (node->is_leaf) {
+            memmove(node->entries + rank + 1, node->entries + rank,
+                (node->nb_entries - rank) * sizeof(void*));
+            node->entries[rank] = value;
+            node->nb_entries++;
+            tree->size++;
+            return 0;
+        }
+
+        if (node->children[rank]->nb_entries >= PICOBTREE_MAX_ENTRIES) {
+            if (picobtree_split_child(node, rank) != 0) {
+                return -1;
+            }
+            /* The lifted median may change the descent direction */
+            if (tree->comp(value, node->entries[rank]) >= 0) {
+                rank++;
+            }
+        }
+        node = node->children[rank];
+    }
+}
+
+/* Merge the children on both sides of the separator at the specified
+ * rank into the left one, pulling the separator down. */
+static void picobtree_merge_children(picobtree_node_t* node, int rank)
+{
+    picobtree_node_t* left = node->children[rank];
+    picobtree_node_t* right = node->children[rank + 1];
+
+    left->entries[left->nb_entries] = node->entries[rank];
+    memcpy(left->entries + left->nb_entries + 1, right->entries, right->nb_entries * sizeof(void*));
+    if (!left->is_leaf) {
+        memcpy(left->children + left->nb_entries + 1, right->children,
+            (right->nb_entries + 1) * sizeof(picobtree_node_t*));
+    }
+    left->nb_entries += 1 + right->nb_entries;
+    memmove(node->entries + rank, node->entries + rank + 1,
+        (node->nb_entries - rank - 1) * sizeof(void*));
+    memmove(node->children + rank + 1, node->children + rank + 2,
+        (node->nb_entries - rank - 1) * sizeof(picobtree_node_t*));
+    node->nb_entries--;
+    free(right);
+}
+
+/* Make sure the child at the specified rank holds more than the minimal
+ * number of entries, borrowing from a sibling or merging with one. After
+ * a merge the child pointer at the rank is the merged node. */
+static void picobtree_fill_child(picobtree_node_t* node, int rank)
+{
+    picobtree_node_t* child = node->children[rank];
+
+    if (rank > 0 && node->children[rank - 1]->nb_entries > PICOBTREE_MIN_ENTRIES) {
+        /* Rotate the separator down from the left sibling */
+        picobtree_node_t* left = node->children[rank - 1];
+
+        memmove(child->entries + 1, child->entries, child->nb_entries * sizeof(void*));
+        child->entries[0] = node->entries[rank - 1];
+        node->entries[rank - 1] = left->entries[left->nb_entries - 1];
+        if (!child->is_leaf) {
+            memmove(child->children + 1, child->children,
+                (child->nb_entries + 1) * sizeof(picobtree_node_t*));
+            child->children[0] = left->children[left->nb_entries];
+        }
+        child->nb_entries++;
+        left->nb_entries--;
+    }
+    else if (rank < node->nb_entries && node->children[rank + 1]->nb_entries > PICOBTREE_MIN_ENTRIES) {
+        /* Rotate the separator down from the right sibling */
+        picobtree_node_t* right = node->children[rank + 1];
+
+        child->entries[child->nb_entries] = node->entries[rank];
+        node->entries[rank] = right->entries[0];
+        memmove(right->entries, right->entries + 1, (right->nb_entries - 1) * sizeof(void*));
+        if (!child->is_leaf) {
+            child->children[child->nb_entries + 1] = right->children[0];
+            memmove(right->children, right->children + 1, right->nb_entries * sizeof(picobtree_node_t*));
+        }
+        child->nb_entries++;
+        right->nb_entries--;
+    }
+    else {
+        /* Merge with a sibling around the separator */
+        picobtree_merge_children(node, (rank > 0) ? rank - 1 : rank);
+    }
+}
+
+void picobtree_delete(picobtree_t* tree, void* value)
+{
+    picobtree_node_t* node = tree->root;
+    void* found = NULL;
+    int removed = 0;
+
+    if (node == NULL) {
+        return;
+    }
+
+    for (;;) {
+        int rank = 0;
+        int64_t cmp = -1;
+
+        while (rank < node->nb_entries && (cmp = tree->comp(value, node->entries[rank])) > 0) {
+            rank++;
+        }
+
+        if (rank < node->nb_entries && cmp == 0) {
+            if (node->is_leaf) {
+                if (found == NULL) {
+                    found = node->entries[rank];
+                }
+                memmove(node->entries + rank, node->entries + rank + 1,
+                    (node->nb_entries - rank - 1) * sizeof(void*));
+                node->nb_entries--;
+                removed = 1;
+                break;
+            }
+            else if (node->children[rank]->nb_entries > PICOBTREE_MIN_ENTRIES) {
+                /* Replace by the predecessor, then delete the predecessor
+                 * from the left subtree */
+                picobtree_node_t* pred = node->children[rank];
+
+                while (!pred->is_leaf) {
+                    pred = pred->children[pred->nb_entries];
+                }
+                found = node->entries[rank];
+                node->entries[rank] = pred->entries[pred->nb_entries - 1];
+                value = node->entries[rank];
+                node = node->children[rank];
+            }
+            else if (node->children[rank + 1]->nb_entries > PICOBTREE_MIN_ENTRIES) {
+                /* Replace by the successor, then delete the successor
+                 * from the right subtree */
+                picobtree_node_t* succ = node->children[rank + 1];
+
+                while (!succ->is_leaf) {
+                    succ = succ->children[0];
+                }
+                found = node->entries[rank];
+                node->entries[rank] = succ->entries[0];
+                value = node->entries[rank];
+                node = node->children[rank + 1];
+            }
+            else {
+                /* Both neighbors are minimal: merge them around the
+                 * value and continue in the merged node */
+                picobtree_merge_children(node, rank);
+                node = node->children[rank];
+            }
+        }
+        else if (node->is_leaf) {
+            /* Value not present; the root may still need shrinking if a
+             * merge on the way down emptied it */
+            break;
+        }
+        else {
+            if (node->children[rank]->nb_entries <= PICOBTREE_MIN_ENTRIES) {
+                picobtree_fill_child(node, rank);
+                /* Borrow or merge may have moved the search interval */
+                continue;
+            }
+            node = node->children[rank];
+        }
+    }
+
+    if (tree->root->nb_entries == 0) {
+        picobtree_node_t* old_root = tree->root;
+        tree->root = (old_root->is_leaf) ? NULL : old_root->children[0];
+        free(old_root);
+    }
+
+    if (removed) {
+        tree->size--;
+        if (tree->delete_value != NULL) {
+            tree->delete_value(tree, found);
+        }
+    }
+}
+
+static void picobtree_empty_node(picobtree_t* tree, picobtree_node_t* node)
+{
+    if (!node->is_leaf) {
+        for (int i = 0; i <= node->nb_entries; i++) {
+            picobtree_empty_node(tree, node->children[i]);
+        }
+    }
+    if (tree->delete_value != NULL) {
+        for (int i = 0; i < node->nb_entries; i++) {
+            tree->delete_value(tree, node->entries[i]);
+        }
+    }
+    free(node);
+}
+
+void picobtree_empty(picobtree_t* tree)
+{
+    if (tree->root != NULL) {
+        picobtree_empty_node(tree, tree->root);
+        tree->root = NULL;
+    }
+    tree->size = 0;
+}
+
+/* Bulk load helpers. The subtree height that can hold nb values is
+ * computed first; each level then divides its values between the minimal
+ * number of children, so every node ends at least half full and all
+ * leaves sit at the same depth. */
+static void picobtree_free_subtree(picobtree_node_t* node)
+{
+    if (!node->is_leaf) {
+        for (int i = 0; i <= node->nb_entries; i++) {
+            picobtree_free_subtree(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+static size_t picobtree_subtree_capacity(int height)
+{
+    size_t capacity = PICOBTREE_MAX_ENTRIES;
+
+    while (height > 0) {
+        capacity = capacity * (PICOBTREE_MAX_ENTRIES + 1) + PICOBTREE_MAX_ENTRIES;
+        height--;
+    }
+
+    return capacity;
+}
+
+static picobtree_node_t* picobtree_build_subtree(void** values, size_t nb_values, int height)
+{
+    picobtree_node_t* node;
+
+    if (height == 0) {
+        node = picobtree_new_node(1);
+        if (node != NULL) {
+            node->nb_entries = (int)nb_values;
+            memcpy(node->entries, values, nb_values * sizeof(void*));
+        }
+    }
+    else {
+        size_t child_capacity = picobtree_subtree_capacity(height - 1);
+        size_t nb_children = (nb_values + child_capacity + 1) / (child_capacity + 1);
+        size_t nb_in_children = nb_values - (nb_children - 1);
+        size_t rank = 0;
+
+        node = picobtree_new_node(0);
+        if (node != NULL) {
+            node->nb_entries = (int)(nb_children - 1);
+            for (size_t i = 0; i < nb_children; i++) {
+                size_t nb_child = nb_in_children / nb_children +
+                    ((i < nb_in_children % nb_children) ? 1 : 0);
+
+                node->children[i] = picobtree_build_subtree(values + rank, nb_child, height - 1);
+                if (node->children[i] == NULL) {
+                    /* Unwind the partially built node; the values still
+                     * belong to the caller */
+                    for (size_t j = 0; j < i; j++) {
+                        picobtree_free_subtree(node->children[j]);
+                    }
+                    free(node);
+                    return NULL;
+                }
+                rank += nb_child;
+                if (i + 1 < nb_children) {
+                    node->entries[i] = values[rank];
+                    rank++;
+                }
+            }
+        }
+    }
+
+    return node;
+}
+
+int picobtree_bulk_load(picobtree_t* tree, void** values, size_t nb_values)
+{
+    int height = 0;
+
+    if (tree->root != NULL || nb_values == 0) {
+        return (nb_values == 0) ? 0 : -1;
+    }
+
+    while (picobtree_subtree_capacity(height) < nb_values) {
+        height++;
+    }
+
+    tree->root = picobtree_build_subtree(values, nb_values, height);
+    if (tree->root == NULL) {
+        return -1;
+    }
+    tree->size = (int)nb_values;
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PICOBTREE_H
+#define PICOBTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* B-tree of small arrays, provided as a cache friendly alternative to
+ * picosplay for ordered collections. Each node packs up to
+ * PICOBTREE_MAX_ENTRIES value pointers in one allocation, so a lookup
+ * touches O(log16 N) cache lines instead of one line per element, and
+ * there is no per element malloc.
+ *
+ * Unlike picosplay the structure is not intrusive: values are stored as
+ * void* and compared with the same comparator convention as
+ * picosplay_comparator. The iteration helpers (picobtree_next,
+ * picobtree_find_previous) are keyed on the comparator and assume
+ * distinct keys.
+ */
+
+#define PICOBTREE_MAX_ENTRIES 15
+#define PICOBTREE_MIN_ENTRIES 7
+
+typedef int64_t(*picobtree_comparator)(void* left, void* right);
+typedef void(*picobtree_delete_value)(void* tree, void* value);
+
+typedef struct st_picobtree_node_t {
+    int nb_entries;
+    int is_leaf;
+    void* entries[PICOBTREE_MAX_ENTRIES];
+    struct st_picobtree_node_t* children[PICOBTREE_MAX_ENTRIES + 1];
+} picobtree_node_t;
+
+typedef struct st_picobtree_t {
+    picobtree_node_t* root;
+    picobtree_comparator comp;
+    picobtree_delete_value delete_value;
+    int size;
+} picobtree_t;
+
+void picobtree_init(picobtree_t* tree, picobtree_comparator comp, picobtree_delete_value delete_value);
+int picobtree_insert(picobtree_t* tree, void* value);
+void* picobtree_find(picobtree_t* tree, void* value);
+void* picobtree_find_previous(picobtree_t* tree, void* value);
+void* picobtree_first(picobtree_t* tree);
+void* picobtree_last(picobtree_t* tree);
+void* picobtree_next(picobtree_t* tree, void* value);
+void picobtree_delete(picobtree_t* tree, void* value);
+void picobtree_empty(picobtree_t* tree);
+/* Build a tree in one pass from an array of values sorted in increasing
+ * comparator order. The tree must be freshly initialized or empty. */
+int picobtree_bulk_load(picobtree_t* tree, void** values, size_t nb_values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PICOBTREE_H */
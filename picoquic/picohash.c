@@ -21,33 +21,224 @@
 
 /*
  * Basic hash implementation, like we have seen tons off already.
+ *
+ * The table is a flat array of slots searched by linear probing, with
+ * backward shift deletion. Growing the table allocates a new array twice
+ * the size and migrates the old one a few slots at a time from subsequent
+ * inserts and deletes, so a table with many entries never pays for a full
+ * rehash in a single operation.
  */
 #include "picohash.h"
 #include <stdlib.h>
 #include <string.h>
 
+/* Number of old slots examined per insert or delete while a migration is
+ * pending. The new array is at least twice the size of the old one, so
+ * draining faster than one slot per insert guarantees that the old array
+ * is empty long before the new one fills up. */
+#define PICOHASH_MIGRATION_BATCH 8
+
+static size_t picohash_round_to_power_of_two(size_t nb_bin)
+{
+    size_t rounded = 8;
+
+    while (rounded < nb_bin && (rounded << 1) != 0) {
+        rounded <<= 1;
+    }
+
+    return rounded;
+}
+
+/* Find the slot holding the specified key, or NULL if absent. The array
+ * is never completely full, so the probe always terminates on an empty
+ * slot. */
+static picohash_slot_t* picohash_find_key_in(picohash_table* hash_table,
+    picohash_slot_t* slots, size_t nb_slot, uint64_t hash, const void* key)
+{
+    size_t mask = nb_slot - 1;
+    size_t i = (size_t)hash & mask;
+    picohash_slot_t* found = NULL;
+#ifdef PICOQUIC_CONTAINER_STATS
+    uint64_t nb_probed = 0;
+#endif
+
+    while (slots[i].item != NULL) {
+#ifdef PICOQUIC_CONTAINER_STATS
+        nb_probed++;
+#endif
+        if (slots[i].hash == hash && hash_table->picohash_compare(key, slots[i].item->key) == 0) {
+            found = &slots[i];
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+#ifdef PICOQUIC_CONTAINER_STATS
+    hash_table->nb_lookups++;
+    hash_table->nb_probes += nb_probed;
+    if (nb_probed > hash_table->probe_max) {
+        hash_table->probe_max = nb_probed;
+    }
+#endif
+
+    return found;
+}
+
+static picohash_slot_t* picohash_find_item_in(picohash_slot_t* slots, size_t nb_slot,
+    const picohash_item* item)
+{
+    size_t mask = nb_slot - 1;
+    size_t i = (size_t)item->hash & mask;
+
+    while (slots[i].item != NULL) {
+        if (slots[i].item == item) {
+            return &slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+static void picohash_slot_insert(picohash_slot_t* slots, size_t nb_slot, picohash_item* item)
+{
+    size_t mask = nb_slot - 1;
+    size_t i = (size_t)item->hash & mask;
+
+    while (slots[i].item != NULL) {
+        i = (i + 1) & mask;
+    }
+
+    slots[i].hash = item->hash;
+    slots[i].item = item;
+}
+
+/* Remove a slot by shifting back the following entries of the probe
+ * sequence, so lookups never need tombstones. */
+static void picohash_slot_remove(picohash_slot_t* slots, size_t nb_slot, picohash_slot_t* slot)
+{
+    size_t mask = nb_slot - 1;
+    size_t i = (size_t)(slot - slots);
+    size_t j = i;
+
+    for (;;) {
+        size_t home;
+
+        j = (j + 1) & mask;
+        if (slots[j].item == NULL) {
+            break;
+        }
+        home = (size_t)slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i].hash = 0;
+    slots[i].item = NULL;
+}
+
+/* Move a batch of entries from the old array into the active one, and
+ * release the old array once it is drained. */
+static void picohash_migration_step(picohash_table* hash_table)
+{
+    if (hash_table->old_slots != NULL) {
+        size_t nb_examined = 0;
+
+        while (hash_table->migrate_next < hash_table->nb_old_bin &&
+            nb_examined < PICOHASH_MIGRATION_BATCH) {
+            picohash_slot_t* slot = &hash_table->old_slots[hash_table->migrate_next];
+
+            if (slot->item != NULL) {
+                picohash_slot_insert(hash_table->slots, hash_table->nb_bin, slot->item);
+                /* Backward shift removal keeps the old array's probe
+                 * chains intact for the lookups that still run against it
+                 * during the migration window. The shift may refill this
+                 * slot with a later entry of the cluster, so the cursor
+                 * only advances once the slot is empty. */
+                picohash_slot_remove(hash_table->old_slots, hash_table->nb_old_bin, slot);
+                hash_table->old_count--;
+            }
+            else {
+                hash_table->migrate_next++;
+            }
+            nb_examined++;
+        }
+
+        if (hash_table->old_count == 0) {
+            PICOHASH_MEMPROF(-(int64_t)(sizeof(picohash_slot_t) * hash_table->nb_old_bin));
+            free(hash_table->old_slots);
+            hash_table->old_slots = NULL;
+            hash_table->nb_old_bin = 0;
+            hash_table->migrate_next = 0;
+        }
+    }
+}
+
+static int picohash_grow(picohash_table* hash_table)
+{
+    int ret = -1;
+    size_t new_nb_bin = hash_table->nb_bin * 2;
+    size_t slots_length = sizeof(picohash_slot_t) * new_nb_bin;
+    picohash_slot_t* new_slots = NULL;
+
+    if (new_nb_bin > hash_table->nb_bin && (slots_length / sizeof(picohash_slot_t)) == new_nb_bin) {
+        new_slots = (picohash_slot_t*)malloc(slots_length);
+    }
+
+    if (new_slots != NULL) {
+        PICOHASH_MEMPROF((int64_t)slots_length);
+        (void)memset(new_slots, 0, slots_length);
+        hash_table->old_slots = hash_table->slots;
+        hash_table->nb_old_bin = hash_table->nb_bin;
+        hash_table->migrate_next = 0;
+        hash_table->old_count = hash_table->count;
+        hash_table->slots = new_slots;
+        hash_table->nb_bin = new_nb_bin;
+        ret = 0;
+    }
+
+    return ret;
+}
+
 picohash_table* picohash_create_ex(size_t nb_bin,
     uint64_t (*picohash_hash)(const void*),
     int (*picohash_compare)(const void*, const void*),
     picohash_item * (*picohash_key_to_item)(const void*))
 {
     picohash_table* t = (picohash_table*)malloc(sizeof(picohash_table));
-    size_t items_length = sizeof(picohash_item*) * nb_bin;
-    t->hash_bin = NULL;
-    if (t != NULL && (items_length / sizeof(picohash_item*)) == nb_bin) {
-        t->hash_bin = (picohash_item**)malloc(sizeof(picohash_item*) * nb_bin);
-    }
 
-    if (t->hash_bin == NULL) {
-        free(t);
-        t = NULL;
-    } else {
-        (void)memset(t->hash_bin, 0, sizeof(picohash_item*) * nb_bin);
-        t->nb_bin = nb_bin;
-        t->count = 0;
-        t->picohash_hash = picohash_hash;
-        t->picohash_compare = picohash_compare;
-        t->picohash_key_to_item = picohash_key_to_item;
+    if (t != NULL) {
+        size_t nb_slot = picohash_round_to_power_of_two(nb_bin);
+        size_t slots_length = sizeof(picohash_slot_t) * nb_slot;
+
+        t->slots = NULL;
+        if ((slots_length / sizeof(picohash_slot_t)) == nb_slot) {
+            t->slots = (picohash_slot_t*)malloc(slots_length);
+        }
+
+        if (t->slots == NULL) {
+            free(t);
+            t = NULL;
+        } else {
+            PICOHASH_MEMPROF((int64_t)(sizeof(picohash_table) + slots_length));
+            (void)memset(t->slots, 0, slots_length);
+            t->old_slots = NULL;
+            t->nb_bin = nb_slot;
+            t->nb_old_bin = 0;
+            t->migrate_next = 0;
+            t->old_count = 0;
+            t->count = 0;
+            t->picohash_hash = picohash_hash;
+            t->picohash_compare = picohash_compare;
+            t->picohash_key_to_item = picohash_key_to_item;
+#ifdef PICOQUIC_CONTAINER_STATS
+            t->nb_lookups = 0;
+            t->nb_probes = 0;
+            t->probe_max = 0;
+#endif
+        }
     }
 
     return t;
@@ -63,29 +254,41 @@ picohash_table* picohash_create(size_t nb_bin,
 picohash_item* picohash_retrieve(picohash_table* hash_table, const void* key)
 {
     uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
-    picohash_item* item = hash_table->hash_bin[bin];
+    picohash_slot_t* slot = picohash_find_key_in(hash_table, hash_table->slots,
+        hash_table->nb_bin, hash, key);
 
-    while (item != NULL) {
-        if (hash_table->picohash_compare(key, item->key) == 0) {
-            break;
-        } else {
-            item = item->next_in_bin;
-        }
+    if (slot == NULL && hash_table->old_slots != NULL) {
+        slot = picohash_find_key_in(hash_table, hash_table->old_slots,
+            hash_table->nb_old_bin, hash, key);
     }
 
-    return item;
+    return (slot == NULL) ? NULL : slot->item;
 }
 
 int picohash_insert(picohash_table* hash_table, const void* key)
 {
     uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
     int ret = 0;
     picohash_item* item;
-    
+
+    picohash_migration_step(hash_table);
+
+    /* Grow at 3/4 load. If the allocation fails, keep inserting into the
+     * current array, but never let it fill up completely, since the
+     * probe loops rely on finding an empty slot. */
+    if (hash_table->old_slots == NULL &&
+        (hash_table->count + 1) >= (hash_table->nb_bin - (hash_table->nb_bin >> 2))) {
+        if (picohash_grow(hash_table) != 0 &&
+            (hash_table->count + 1) >= hash_table->nb_bin) {
+            return -1;
+        }
+    }
+
     if (hash_table->picohash_key_to_item == NULL) {
         item = (picohash_item*)malloc(sizeof(picohash_item));
+        if (item != NULL) {
+            PICOHASH_MEMPROF((int64_t)sizeof(picohash_item));
+        }
     }
     else {
         item = hash_table->picohash_key_to_item(key);
@@ -96,8 +299,7 @@ int picohash_insert(picohash_table* hash_table, const void* key)
     } else {
         item->hash = hash;
         item->key = key;
-        item->next_in_bin = hash_table->hash_bin[bin];
-        hash_table->hash_bin[bin] = item;
+        picohash_slot_insert(hash_table->slots, hash_table->nb_bin, item);
         hash_table->count++;
     }
 
@@ -106,28 +308,27 @@ int picohash_insert(picohash_table* hash_table, const void* key)
 
 void picohash_delete_item(picohash_table* hash_table, picohash_item* item, int delete_key_too)
 {
-    uint32_t bin = (uint32_t)(item->hash % hash_table->nb_bin);
-    picohash_item* previous = hash_table->hash_bin[bin];
+    picohash_slot_t* slot = picohash_find_item_in(hash_table->slots, hash_table->nb_bin, item);
     const void* shall_delete = NULL;
 
-    if (previous == item) {
-        hash_table->hash_bin[bin] = item->next_in_bin;
+    if (slot != NULL) {
+        picohash_slot_remove(hash_table->slots, hash_table->nb_bin, slot);
         hash_table->count--;
-    } else {
-        while (previous != NULL) {
-            if (previous->next_in_bin == item) {
-                previous->next_in_bin = item->next_in_bin;
-                hash_table->count--;
-                break;
-            } else {
-                previous = previous->next_in_bin;
-            }
+    } else if (hash_table->old_slots != NULL) {
+        slot = picohash_find_item_in(hash_table->old_slots, hash_table->nb_old_bin, item);
+        if (slot != NULL) {
+            picohash_slot_remove(hash_table->old_slots, hash_table->nb_old_bin, slot);
+            hash_table->old_count--;
+            hash_table->count--;
         }
     }
 
+    picohash_migration_step(hash_table);
+
     shall_delete = item->key;
 
     if (hash_table->picohash_key_to_item == NULL) {
+        PICOHASH_MEMPROF(-(int64_t)sizeof(picohash_item));
         free(item);
     }
 
@@ -148,18 +349,18 @@ void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_t
     }
 }
 
-void picohash_delete(picohash_table* hash_table, int delete_key_too)
+static void picohash_delete_slots(picohash_table* hash_table,
+    picohash_slot_t* slots, size_t nb_slot, int delete_key_too)
 {
-    for (uint32_t i = 0; i < hash_table->nb_bin; i++) {
-        picohash_item* item = hash_table->hash_bin[i];
-        while (item != NULL) {
-            picohash_item* tmp = item;
-            const void* key_to_delete = tmp->key;
+    for (size_t i = 0; i < nb_slot; i++) {
+        picohash_item* item = slots[i].item;
 
-            item = item->next_in_bin;
+        if (item != NULL) {
+            const void* key_to_delete = item->key;
 
             if (hash_table->picohash_key_to_item == NULL) {
-                free(tmp);
+                PICOHASH_MEMPROF(-(int64_t)sizeof(picohash_item));
+                free(item);
             }
             if (delete_key_too) {
                 free((void*)key_to_delete);
@@ -167,10 +368,41 @@ void picohash_delete(picohash_table* hash_table, int delete_key_too)
         }
     }
 
-    free(hash_table->hash_bin);
+    PICOHASH_MEMPROF(-(int64_t)(sizeof(picohash_slot_t) * nb_slot));
+    free(slots);
+}
+
+void picohash_delete(picohash_table* hash_table, int delete_key_too)
+{
+    picohash_delete_slots(hash_table, hash_table->slots, hash_table->nb_bin, delete_key_too);
+    if (hash_table->old_slots != NULL) {
+        picohash_delete_slots(hash_table, hash_table->old_slots, hash_table->nb_old_bin, delete_key_too);
+    }
+
+    PICOHASH_MEMPROF(-(int64_t)sizeof(picohash_table));
     free(hash_table);
 }
 
+picohash_item* picohash_iterate(const picohash_table* hash_table, size_t* slot_index)
+{
+    picohash_item* item = NULL;
+    size_t i = *slot_index;
+
+    while (item == NULL && i < hash_table->nb_bin) {
+        item = hash_table->slots[i].item;
+        i++;
+    }
+
+    while (item == NULL && i < hash_table->nb_bin + hash_table->nb_old_bin) {
+        item = hash_table->old_slots[i - hash_table->nb_bin].item;
+        i++;
+    }
+
+    *slot_index = i;
+
+    return item;
+}
+
 uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2)
 {
     h2 ^= (hash << 17) ^ (hash >> 37);
@@ -181,11 +413,24 @@ uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2)
 
 uint64_t picohash_bytes(const uint8_t* key, uint32_t length)
 {
-    uint64_t hash = 0xDEADBEEF;
+    uint64_t hash = 0xDEADBEEFull ^ ((uint64_t)length << 32);
+
+    /* Mix eight bytes at a time instead of one; the values only feed
+     * in-memory tables, so the byte order dependency is harmless. */
+    while (length >= 8) {
+        uint64_t w;
+        memcpy(&w, key, 8);
+        hash = (hash ^ w) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+        key += 8;
+        length -= 8;
+    }
 
-    for (uint32_t i = 0; i < length; i++) {
-        hash ^= key[i];
-        hash ^= ((hash << 31) ^ (hash >> 17));
+    if (length > 0) {
+        uint64_t w = 0;
+        memcpy(&w, key, length);
+        hash = (hash ^ w) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= hash >> 32;
     }
 
     return hash;
@@ -29,24 +29,58 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Optional tagged allocation counters. When the library is built with
+ * PICOQUIC_MEMORY_PROFILE, hash table allocations are attributed to the
+ * picoquic memory profile; the hook is implemented in quicctx.c. */
+#ifdef PICOQUIC_MEMORY_PROFILE
+void picohash_memory_count(int64_t delta);
+#define PICOHASH_MEMPROF(delta) picohash_memory_count(delta)
+#else
+#define PICOHASH_MEMPROF(delta)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct _picohash_item {
     uint64_t hash;
-    struct _picohash_item* next_in_bin;
     const void* key;
 } picohash_item;
 
+/* The table is organized as a flat array of slots, searched by linear
+ * probing. Each slot points to an item, which is either allocated by the
+ * table or embedded in the caller's object when a key_to_item function
+ * is provided; item addresses are stable across resizes, so callers may
+ * keep item pointers and pass them to picohash_delete_item later.
+ * When the load factor passes 3/4 a new array twice as large is
+ * allocated and the old one is drained a few slots at a time from
+ * subsequent inserts and deletes, so no single operation pays for a
+ * full rehash. */
+typedef struct st_picohash_slot_t {
+    uint64_t hash;
+    picohash_item* item;
+} picohash_slot_t;
+
 typedef struct picohash_table {
     /* TODO: lock ! */
-    picohash_item** hash_bin;
-    size_t nb_bin;
+    picohash_slot_t* slots; /* active slot array, power of two size */
+    picohash_slot_t* old_slots; /* previous array, drained incrementally after a resize */
+    size_t nb_bin; /* number of slots in the active array */
+    size_t nb_old_bin; /* number of slots in the old array, 0 when no migration is pending */
+    size_t migrate_next; /* next old slot to examine during migration */
+    size_t old_count; /* items still waiting in the old array */
     size_t count;
     uint64_t (*picohash_hash)(const void*);
     int (*picohash_compare)(const void*, const void*);
     picohash_item* (*picohash_key_to_item)(const void*);
+#ifdef PICOQUIC_CONTAINER_STATS
+    /* Probe length statistics, collected when the library is built with
+     * PICOQUIC_CONTAINER_STATS; see picoquic_get_container_stats. */
+    uint64_t nb_lookups; /* number of probe sequences walked */
+    uint64_t nb_probes; /* cumulative slots examined */
+    uint64_t probe_max; /* longest probe sequence observed */
+#endif
 } picohash_table;
 
 picohash_table* picohash_create(size_t nb_bin,
@@ -68,6 +102,11 @@ void picohash_delete_key(picohash_table* hash_table, void* key, int delete_key_t
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too);
 
+/* Enumerate the items in the table. Initialize *slot_index to zero, then
+ * call repeatedly until the function returns NULL. The table must not be
+ * modified during the enumeration. */
+picohash_item* picohash_iterate(const picohash_table* hash_table, size_t* slot_index);
+
 uint64_t picohash_hash_mix(uint64_t hash, uint64_t h2);
 
 uint64_t picohash_bytes(const uint8_t* key, uint32_t length);
@@ -274,7 +274,8 @@ typedef enum {
     picoquic_callback_path_deleted, /* An existing path has been deleted */
     picoquic_callback_path_quality_changed, /* Some path quality parameters have changed */
     picoquic_callback_path_address_observed, /* The peer has reported an address for the path */
-    picoquic_callback_app_wakeup /* wakeup timer set by application has expired */
+    picoquic_callback_app_wakeup, /* wakeup timer set by application has expired */
+    picoquic_callback_memory_pressure /* Connection crossed its memory budget, see picoquic_set_stream_memory_limits. Stream=0, bytes=NULL, len=0 */
 } picoquic_call_back_event_t;
 
 typedef struct st_picoquic_tp_prefered_address_t {
@@ -320,6 +321,7 @@ typedef struct st_picoquic_tp_t {
     int is_multipath_enabled;
     uint64_t initial_max_path_id;
     int address_discovery_mode; /* 0=none, 1=provide only, 2=receive only, 3=both */
+    int enable_fec;
 } picoquic_tp_t;
 
 /*
@@ -366,6 +368,15 @@ typedef struct st_picoquic_tp_t {
 */
 
 uint64_t picoquic_current_time(); /* wall time */
+
+/* Cache the wall clock at the quic context level. Packet loops call
+ * this each time they sample the clock; from then on
+ * picoquic_get_quic_time returns the cached value, saving a clock
+ * system call at every internal time query. The cached value is never
+ * more stale than the last refresh, i.e. one pass over the current
+ * receive batch. Code that needs a fresher reading should call
+ * picoquic_current_time directly. */
+void picoquic_refresh_quic_time_cache(picoquic_quic_t* quic, uint64_t current_time);
 uint64_t picoquic_get_quic_time(picoquic_quic_t* quic); /* connection time, compatible with simulations */
 
 /* Callback function for providing stream data to the application,
@@ -399,6 +410,91 @@ int picoquic_add_proposed_alpn(void* tls_context, const char* alpn);
 typedef void (*picoquic_connection_id_cb_fn)(picoquic_quic_t * quic, picoquic_connection_id_t cnx_id_local,
     picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t * cnx_id_returned);
 
+/* Sharded operation: when several QUIC contexts in one process share a
+ * local port, each owning a shard of the connections, a reroute callback
+ * can be installed on each context. It is called for every incoming
+ * short header packet, before any table lookup, with the raw datagram.
+ * If the callback determines (typically from a shard index encoded in
+ * the destination connection ID) that the packet belongs to another
+ * shard and hands it over, it returns a non zero value and the local
+ * context ignores the packet. Returning zero processes the packet
+ * locally, so mis-routed packets degrade into stateless resets exactly
+ * as before. See picoquic_start_network_thread_pool in the packet loop.
+ */
+typedef int (*picoquic_shard_reroute_fn)(void* reroute_ctx, uint8_t* bytes, size_t packet_length,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, int if_index_to,
+    unsigned char received_ecn, uint64_t current_time);
+void picoquic_set_shard_reroute_fn(picoquic_quic_t* quic, picoquic_shard_reroute_fn reroute_fn, void* reroute_ctx);
+
+/* Crypto worker pool. When a pool is configured, the AEAD encryption and
+ * header protection of outgoing packets run on worker threads instead of
+ * the thread calling picoquic_prepare_next_packet; the prepared send
+ * buffers are only guaranteed complete after picoquic_crypto_pool_sync
+ * returns, so whoever transmits them must call the sync function first.
+ * The packet loop does this automatically before each socket send, and
+ * will configure the pool itself if the nb_crypto_workers parameter is
+ * set. Per path ordering of packet protection is preserved; packets of
+ * different paths are sealed in parallel.
+ *
+ * Setting nb_workers to zero deletes the pool, after waiting for the
+ * pending jobs to complete. */
+int picoquic_set_crypto_worker_pool(picoquic_quic_t* quic, int nb_workers);
+void picoquic_crypto_pool_sync(picoquic_quic_t* quic);
+
+/* Deferred stream data copy. picoquic_add_to_stream copies the submitted
+ * buffer synchronously; for a multi-megabyte write that copy can hold the
+ * calling thread for milliseconds. When a crypto worker pool is configured
+ * and min_size is not zero, submissions of at least min_size bytes are
+ * split into chunks whose copies run on the worker pool, and the chunks
+ * become sendable as the copies complete, so the call returns immediately.
+ *
+ * In this mode the submitted buffer must remain valid until the copies
+ * are done; picoquic_stream_copy_sync waits for that point. Resetting or
+ * deleting a stream waits for its pending copies internally. Setting
+ * min_size to zero restores the synchronous copy. */
+void picoquic_set_deferred_stream_copy(picoquic_quic_t* quic, size_t min_size);
+void picoquic_stream_copy_sync(picoquic_quic_t* quic);
+
+/* Asynchronous handshake mode. When enabled, the certificate signature
+ * computed during a handshake (RSA or ECDSA, typically the most
+ * expensive step of a server handshake) is dispatched to the crypto
+ * worker pool and the connection parks until the signature completes,
+ * so a burst of new connections does not stall packet processing for
+ * established ones. Requires a crypto worker pool, a TLS backend built
+ * with asynchronous signing support (PTLS_ERROR_ASYNC_OPERATION), and
+ * must be called after the certificate and key are configured; returns
+ * -1 if any of these is missing. Re-enable after replacing the key. */
+int picoquic_set_async_handshake(picoquic_quic_t* quic, int enabled);
+
+/* Shared packet pool. By default each quic context recycles its packet
+ * objects through a private free list. When several contexts run on
+ * separate threads, attaching them to a shared pool lets memory migrate
+ * between threads: the private list becomes a bounded cache of
+ * cache_target packets, refilled and flushed in batches of half that
+ * size, so packet allocation never takes the shared lock on the hot
+ * path. Attach with pool == NULL to detach. The pool must outlive the
+ * attached contexts, and nb_packets_max == 0 selects the default
+ * per-context pool limit. */
+typedef struct st_picoquic_shared_packet_pool_t picoquic_shared_packet_pool_t;
+
+picoquic_shared_packet_pool_t* picoquic_create_shared_packet_pool(size_t nb_packets_max);
+void picoquic_delete_shared_packet_pool(picoquic_shared_packet_pool_t* pool);
+int picoquic_attach_packet_pool(picoquic_quic_t* quic, picoquic_shared_packet_pool_t* pool, int cache_target);
+
+/* Shared token reuse registry. Several QUIC contexts serving the same
+ * port -- e.g. one context per core behind SO_REUSEPORT -- should share
+ * the token reuse detection state, so a NEW_TOKEN replayed towards a
+ * different core is still caught. All attached contexts must also be
+ * created with the same ticket encryption key, otherwise tokens and
+ * session tickets issued by one core cannot be decrypted by the others.
+ * Attach with registry == NULL to detach; the registry must outlive the
+ * attached contexts. */
+typedef struct st_picoquic_shared_token_registry_t picoquic_shared_token_registry_t;
+
+picoquic_shared_token_registry_t* picoquic_create_shared_token_registry(void);
+void picoquic_delete_shared_token_registry(picoquic_shared_token_registry_t* registry);
+void picoquic_attach_token_registry(picoquic_quic_t* quic, picoquic_shared_token_registry_t* registry);
+
 /* The fuzzer function is used to inject error in packets randomly.
  * It is called just prior to sending a packet, and can randomly
  * change the content or length of the packet.
@@ -412,6 +508,15 @@ void picoquic_set_fuzz(picoquic_quic_t* quic, picoquic_fuzz_fn fuzz_fn, void * f
 void picoquic_log_app_message_v(picoquic_cnx_t* cnx, const char* fmt, va_list vargs);
 void picoquic_log_app_message(picoquic_cnx_t* cnx, const char* fmt, ...);
 
+/* Tag the connection with a correlation id for cross host trace joins,
+ * e.g. when a proxy terminates a connection on one box and opens a
+ * second one towards the origin. The id is recorded in the text log,
+ * binary log and derived qlog of the connection as an info message
+ * event of the form "correlation_id=<id>", so a trace pipeline can join
+ * the logs of both connections without timestamp heuristics. Setting a
+ * NULL id clears the tag. Returns -1 on allocation failure. */
+int picoquic_set_log_correlation_id(picoquic_cnx_t* cnx, const char* correlation_id);
+
 /* Set the log level:
  * 1: log all packets
  * 0: only log the first 100 packets for each connection. */
@@ -435,6 +540,23 @@ void picoquic_set_log_level(picoquic_quic_t* quic, int log_level);
  */
 void picoquic_use_unique_log_names(picoquic_quic_t* quic, int use_unique_log_names);
 
+/* Probabilistic tracing: when "one_in_n" is larger than 1, only one
+ * connection in N is traced to the binary log (and thus to qlog when
+ * automatic conversion is set). The selection hashes the initial
+ * connection ID, so it is deterministic and picks the same connections
+ * on the client and the server side. Setting 0 or 1 traces every
+ * connection, which remains the default.
+ */
+void picoquic_set_log_sampling(picoquic_quic_t* quic, uint64_t one_in_n);
+
+/* Force tracing of one live connection, regardless of the sampling
+ * setting, e.g. when the application flags it as interesting. The trace
+ * starts when the call is made; events that happened before are lost.
+ * Returns -1 if no log folder is configured or the file cannot be
+ * created.
+ */
+int picoquic_cnx_set_qlog(picoquic_cnx_t* cnx);
+
 /* The SSLKEYLOG function defines a way to publish the encryption keys
 * used by QUIC. If that feature is enabled, the code read the environment
 * variable SSLKEYLOG to find the path of the file where to log the encryption
@@ -480,6 +602,29 @@ void picoquic_set_random_initial(picoquic_quic_t* quic, int random_initial);
 /* Set the "packet train" mode for pacing */
 void picoquic_set_packet_train_mode(picoquic_quic_t* quic, int train_mode);
 
+/* Set the pacing policy for connections in this context.
+ *
+ * By default the pacing quantum, and thus the leaky bucket size, is
+ * derived from the congestion window with fixed constants, which on
+ * very short RTT paths produces more pacing wakeups than an event loop
+ * can serve. If "wakeups_per_rtt" is not zero, the quantum is instead
+ * sized so that a full congestion window is released in about that many
+ * bursts per RTT. If "burst_ceiling_bytes" is not zero, the quantum
+ * never exceeds that many bytes regardless of how it was computed, e.g.
+ * to protect shallow switch buffers. Either parameter can be zero to
+ * keep the corresponding default. */
+void picoquic_set_pacing_policy(picoquic_quic_t* quic, uint64_t wakeups_per_rtt, uint64_t burst_ceiling_bytes);
+
+/* Global admission limiter for connection storms. When a large number of
+ * connections start at the same time, e.g. mass reconnection after a
+ * server reboot, each one slow-starts independently and the aggregate
+ * injection rate can overwhelm the uplink. If "rate_bytes_per_second"
+ * is not zero, packets sent on paths that are still in slow start draw
+ * from a single token bucket shared by all connections in the context,
+ * capping their aggregate rate. Paths that have exited slow start are
+ * not affected. Setting zero disables the limiter. */
+void picoquic_set_slow_start_admission_rate(picoquic_quic_t* quic, uint64_t rate_bytes_per_second);
+
 /* set the padding policy.
  * The padding policy is parameterized by two variables:
  * - packets shorter than padding_min_size will be padded to that size.
@@ -578,6 +723,27 @@ int picoquic_set_low_memory_mode(picoquic_quic_t* quic, int low_memory_mode);
  */
 void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode);
 
+/* By default, retry and new tokens are AEAD encrypted, which makes the
+ * rejection of forged tokens under a spoofed source flood relatively
+ * expensive. When MAC mode is enabled, tokens are instead sent in clear
+ * text and authenticated with keyed SipHash, so verifying and discarding
+ * a forged token costs a short hash and a constant time compare. The
+ * token contents (expiry time, original connection ID, initial packet
+ * number) are opaque to well behaved clients but not confidential.
+ * Switching modes invalidates previously issued tokens; affected clients
+ * simply go through one more retry round. */
+void picoquic_set_mac_retry_tokens(picoquic_quic_t* quic, int use_mac_tokens);
+
+/* Retry offload: set a dedicated retry token key, shared with an external
+ * retry service such as an anti-DDoS appliance, following the QUIC-LB
+ * shared-key model. The appliance links the library, configures the same
+ * key, and issues Retries with picoquic_prepare_retry_token (tls_api.h);
+ * servers configured with this call then validate those tokens locally,
+ * with no round trip to the appliance. Setting the key disables MAC mode
+ * tokens, whose key is random per context and cannot be shared. Without
+ * this call, token protection is derived from the ticket encryption key. */
+int picoquic_set_retry_token_key(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length);
+
 /* Set cipher suite, for tests. 
  * use cipher_suite_id = 0 for default values, or one 
  * of the values defined by IANA for cipher suites, 
@@ -596,6 +762,23 @@ int picoquic_set_cipher_suite(picoquic_quic_t* quic, int cipher_suite_id);
  */
 int picoquic_set_key_exchange(picoquic_quic_t* quic, int key_exchange_id);
 
+/* Precompute ephemeral key shares for client connections. Generating the key
+ * pair sent in the client hello is the dominant cost of assembling the first
+ * flight; an application that opens many client connections can move that
+ * cost off the connection setup path by filling a pool of precomputed shares
+ * during idle periods. Each new client handshake consumes one share from the
+ * pool and falls back to on-demand generation when the pool is empty. The
+ * shares are generated with the first key exchange algorithm configured for
+ * the quic context, and the pool is shared by all contexts in the process.
+ * Returns 0 if the requested shares were generated, -1 on error; requests
+ * beyond the pool capacity are silently capped. */
+int picoquic_precompute_key_shares(picoquic_quic_t* quic, size_t nb_shares);
+/* Number of precomputed key shares currently available */
+size_t picoquic_nb_precomputed_key_shares();
+/* Discard the precomputed key shares, e.g. before unloading the crypto
+ * providers. Also called from picoquic_tls_api_unload. */
+void picoquic_release_precomputed_key_shares();
+
 /* Init of transport parameters per quic context */
 int picoquic_set_default_tp(picoquic_quic_t* quic, picoquic_tp_t* tp);
 /* Read default parameters per quic context */
@@ -720,11 +903,92 @@ void picoquic_set_default_idle_timeout(picoquic_quic_t* quic, uint64_t idle_time
 /* Set the default handshake timeout parameter for the context.*/
 void picoquic_set_default_handshake_timeout(picoquic_quic_t* quic, uint64_t handshake_timeout_us);
 
+/* Set the delay in microseconds after which an idle connection is compacted
+ * to a minimal memory footprint. After that much silence the handshake
+ * buffers and, on the server side, the TLS stack context are released;
+ * traffic keys, connection IDs and transport parameters remain, so the
+ * connection keeps processing packets from the peer without an explicit
+ * restore step. A hibernated server connection can no longer process
+ * post handshake TLS messages, which standard QUIC clients do not send.
+ * The value 0 (default) disables hibernation. */
+void picoquic_set_default_hibernate_delay(picoquic_quic_t* quic, uint64_t hibernate_delay_us);
+
+/* Byte accounting of the memory held in reassembly and send queues.
+ * When limits are set and a connection crosses either its own budget or
+ * pushes the context past the global one, the application receives a
+ * picoquic_callback_memory_pressure event and can throttle the peer, for
+ * example by reducing flow control credit. The event fires once per
+ * excursion above the limits; it is rearmed when usage drops below them.
+ * A limit value of 0 (default) means unlimited. */
+void picoquic_set_stream_memory_limits(picoquic_quic_t* quic, uint64_t per_cnx_limit, uint64_t total_limit);
+uint64_t picoquic_get_cnx_stream_memory(picoquic_cnx_t* cnx);
+uint64_t picoquic_get_stream_memory_total(picoquic_quic_t* quic);
+
+/* Tagged allocation counters, compiled in when the library is built with
+ * the ENABLE_MEMORY_PROFILE CMake option (PICOQUIC_MEMORY_PROFILE). Each
+ * major allocation site is attributed to a tag; the counters are process
+ * wide, updated without synchronization and therefore approximate when
+ * several contexts run on different threads. In the default build,
+ * picoquic_get_memory_profile() returns -1 and the counters cost nothing. */
+typedef enum {
+    picoquic_mem_tag_packets = 0, /* packet structures, sender pool */
+    picoquic_mem_tag_stream_nodes, /* reassembly node slabs */
+    picoquic_mem_tag_stream_buffers, /* send queue data buffers */
+    picoquic_mem_tag_connections, /* connection contexts and their arenas */
+    picoquic_mem_tag_tls, /* TLS context wrappers */
+    picoquic_mem_tag_log, /* log buffers */
+    picoquic_mem_tag_hash_tables, /* hash tables, bins and items */
+    picoquic_mem_tag_max
+} picoquic_memory_tag_enum;
+
+typedef struct st_picoquic_memory_profile_t {
+    uint64_t nb_alloc[picoquic_mem_tag_max]; /* allocations since start */
+    uint64_t nb_free[picoquic_mem_tag_max]; /* releases since start */
+    uint64_t bytes_current[picoquic_mem_tag_max]; /* bytes currently held */
+    uint64_t bytes_max[picoquic_mem_tag_max]; /* high watermark of bytes_current */
+} picoquic_memory_profile_t;
+
+/* Copy the current counters into *profile. Returns 0, or -1 if the
+ * library was built without PICOQUIC_MEMORY_PROFILE. */
+int picoquic_get_memory_profile(picoquic_memory_profile_t* profile);
+
+/* Cap the amount of out of order stream data a single stream may hold in
+ * memory. On long fat paths the reassembly tree can buffer a full receive
+ * window of out of order data. When a cap is set and a stream is at or
+ * above it, chunks arriving beyond everything received so far are spilled
+ * to a temporary file and read back when delivery reaches them, keeping
+ * resident memory flat regardless of reordering depth. A value of 0
+ * (default) disables spilling. */
+void picoquic_set_reassembly_spill_cap(picoquic_quic_t* quic, uint64_t bytes_per_stream);
+
+/* Watermark based trimming of the packet free list. The free list grows
+ * to peak usage and otherwise never shrinks. When a high watermark is
+ * set and the pool stays above it for trim_delay_us microseconds, the
+ * pool is trimmed down to the low watermark, returning the memory of a
+ * traffic spike to the allocator while keeping a working set hot.
+ * Setting the watermarks also grows the pool up to the low watermark.
+ * A high watermark of 0 (default) disables trimming. The current pool
+ * size can be queried with picoquic_get_nb_packets_in_pool; trimming is
+ * checked from picoquic_prepare_next_packet_ex, or can be forced by
+ * calling picoquic_trim_packet_pool directly. */
+void picoquic_set_packet_pool_watermarks(picoquic_quic_t* quic, int low_watermark, int high_watermark, uint64_t trim_delay_us);
+int picoquic_get_nb_packets_in_pool(picoquic_quic_t* quic);
+void picoquic_trim_packet_pool(picoquic_quic_t* quic, uint64_t current_time);
+
 /* Set the length of a crypto epoch -- force rotation after that many packets sent */
 void picoquic_set_default_crypto_epoch_length(picoquic_quic_t* quic, uint64_t crypto_epoch_length_max);
 
 uint64_t picoquic_get_default_crypto_epoch_length(picoquic_quic_t* quic);
 
+/* Hold the session tickets issued by a server for that many microseconds
+ * after the handshake completes, instead of sending them with the
+ * handshake completion flight. When a large client fleet reconnects at
+ * once, this takes the ticket packets -- their construction, sealing and
+ * transmission -- out of the handshake completion burst and spreads them
+ * over the following milliseconds. Zero (the default) sends the tickets
+ * inline. */
+void picoquic_set_ticket_issuance_delay(picoquic_quic_t* quic, uint64_t delay_microsec);
+
 /* Get the local CID length */
 uint8_t picoquic_get_local_cid_length(picoquic_quic_t* quic);
 
@@ -739,9 +1003,70 @@ int picoquic_load_retry_tokens(picoquic_quic_t* quic, char const* token_store_fi
 int picoquic_save_session_tickets(picoquic_quic_t* quic, char const* ticket_store_filename);
 int picoquic_save_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename);
 
+/* Unified store journal. Instead of periodically rewriting the whole ticket
+ * and token files, the journal appends one checksummed record to a shared
+ * file every time a ticket or token is stored, so nothing is lost on a
+ * crash between saves. Opening the journal replays and compacts its
+ * current content, then keeps the file open for appending; the journal is
+ * closed when the quic context is deleted. The fsync policy chooses
+ * between relying on OS write back and forcing every record to stable
+ * storage before the store call returns. */
+typedef enum {
+    picoquic_journal_fsync_never = 0,
+    picoquic_journal_fsync_each_append = 1
+} picoquic_journal_fsync_enum;
+
+int picoquic_use_store_journal(picoquic_quic_t* quic, char const* journal_file_name,
+    picoquic_journal_fsync_enum fsync_policy);
+
+/* Hot restart support. For a binary upgrade, the old and the new process
+ * bind the same port with SO_REUSEPORT. The old process stops accepting
+ * new connections, exports its resumption-critical state (stateless reset
+ * and retry seeds, ticket and retry token keys, the QUIC-LB configuration)
+ * as an opaque blob, and drains its established connections. The
+ * application carries the blob to the new process, typically over a unix
+ * socket; importing it there lets returning clients resume their sessions
+ * instead of reconnecting from scratch. */
+void picoquic_stop_accepting(picoquic_quic_t* quic);
+int picoquic_export_restart_state(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_max, size_t* consumed);
+int picoquic_import_restart_state(picoquic_quic_t* quic, const uint8_t* bytes, size_t length);
+
+/* Cap the memory held by the client session ticket store. The store is
+ * kept in least-recently-used order: looking up a ticket moves it to the
+ * front, and when the budget is exceeded tickets are evicted from the
+ * back, so clients talking to very large server fleets keep the tickets
+ * for the servers they actually revisit. A budget of 0 (default) means
+ * unlimited. */
+void picoquic_set_ticket_memory_budget(picoquic_quic_t* quic, uint64_t budget_bytes);
+
 /* Manage bdps */
 void picoquic_set_default_bdp_frame_option(picoquic_quic_t* quic, int enable_bdp_frame);
 
+/* Optional server-side congestion hints cache, consulted when a connection
+ * is accepted. The provider receives the peer address and returns 0 if it
+ * has a hint for that network, filling rtt_estimate (microseconds) and
+ * cwin_estimate (bytes); either value may be left at 0 if unknown. The RTT
+ * estimate seeds the initial smoothed RTT instead of PICOQUIC_INITIAL_RTT,
+ * and the CWIN estimate is applied through the careful resume path, i.e.
+ * only after the first RTT sample confirms the estimate. The update
+ * callback is invoked when a connection has measured a path, so that the
+ * cache can learn; storage is entirely up to the application, which may
+ * aggregate by network prefix and share the cache across a fleet. */
+typedef int (*picoquic_cc_seed_hints_fn)(void* seed_hints_ctx,
+    const struct sockaddr* addr_peer, uint64_t* rtt_estimate, uint64_t* cwin_estimate);
+typedef void (*picoquic_cc_hints_update_fn)(void* seed_hints_ctx,
+    const struct sockaddr* addr_peer, uint64_t rtt_min, uint64_t cwin);
+void picoquic_set_seed_hints_provider(picoquic_quic_t* quic,
+    picoquic_cc_seed_hints_fn seed_hints_fn,
+    picoquic_cc_hints_update_fn hints_update_fn, void* seed_hints_ctx);
+
+/* Enable negotiation of experimental FEC repair frames on new connections.
+ * When both endpoints enable the extension, streams marked with
+ * picoquic_set_stream_fec have their packets covered by XOR repair
+ * symbols, so that an isolated loss can be recovered without waiting a
+ * full RTT for the retransmission. */
+void picoquic_set_default_fec_option(picoquic_quic_t* quic, int enable_fec);
+
 /* Set default connection ID length for the context.
  * All valid values are supported on the client.
  * Using a null value on the server is not tested, may not work.
@@ -800,6 +1125,26 @@ picoquic_cnx_t* picoquic_create_client_cnx(picoquic_quic_t* quic,
     char const* sni, char const* alpn,
     picoquic_stream_data_cb_fn callback_fn, void* callback_ctx);
 
+/* Extended variant of picoquic_create_client_cnx, attaching stream data at
+ * connection creation. The data described in "early_streams" is queued on the
+ * corresponding streams before the connection is started, which guarantees
+ * that it is ready when the first flight is prepared: if a stored session
+ * ticket permits 0-RTT, the early data rides with the Client Hello datagram
+ * instead of waiting for the next call to picoquic_add_to_stream. Without a
+ * ticket, the data is simply sent when the handshake completes. */
+typedef struct st_picoquic_early_stream_desc_t {
+    uint64_t stream_id;
+    const uint8_t* data;
+    size_t length;
+    int set_fin;
+} picoquic_early_stream_desc_t;
+
+picoquic_cnx_t* picoquic_create_client_cnx_ex(picoquic_quic_t* quic,
+    struct sockaddr* addr, uint64_t start_time, uint32_t preferred_version,
+    char const* sni, char const* alpn,
+    picoquic_stream_data_cb_fn callback_fn, void* callback_ctx,
+    picoquic_early_stream_desc_t const* early_streams, size_t nb_early_streams);
+
 int picoquic_start_client_cnx(picoquic_cnx_t* cnx);
 
 /* Closing the quic connection can be done in one of three ways.
@@ -832,6 +1177,18 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx);
 /* set the app wake up time (or cancel it by setting it to zero) */
 void picoquic_set_app_wake_time(picoquic_cnx_t* cnx, uint64_t app_wake_time);
 
+/* Declare the application's target sending rate, in bytes per second,
+ * or 0 (the default) to remove the declaration. Constant rate sources
+ * such as video encoders are structurally application limited: once
+ * the bandwidth estimate exceeds the target with some headroom, the
+ * periodic bandwidth probes of rate based congestion controllers only
+ * inflate the RTT without discovering anything the application can
+ * use. With a declared target rate, BBR suppresses its ProbeBW cycles
+ * while the estimate holds at least 1.25 times the target, and resumes
+ * probing as soon as the estimate drops below that margin, e.g. after
+ * a route change. */
+void picoquic_set_app_target_rate(picoquic_cnx_t* cnx, uint64_t bytes_per_second);
+
 /* Support for version negotiation:
  * Setting the "desired version" parameter will trigger compatible version
  * negotiation from the current version to that desired version, if the
@@ -845,6 +1202,14 @@ void picoquic_set_app_wake_time(picoquic_cnx_t* cnx, uint64_t app_wake_time);
 void picoquic_set_desired_version(picoquic_cnx_t* cnx, uint32_t desired_version);
 void picoquic_set_rejected_version(picoquic_cnx_t* cnx, uint32_t rejected_version);
 
+/* A server remembers the version last negotiated with clients of a given
+ * network (IPv4 /24, IPv6 /48). Applications that steer clients, e.g.
+ * through a bootstrap or discovery service, can query the cache to
+ * advertise a version that clients of that network are known to support,
+ * avoiding a version negotiation round trip on reconnection.
+ * Returns 0 if no version was recorded for the peer's network. */
+uint32_t picoquic_get_version_preference(picoquic_quic_t* quic, const struct sockaddr* addr_peer);
+
 /* Path management events and API
  * 
  * The "probe new path" API attempts to validate a new path. If multipath is enabled,
@@ -918,6 +1283,31 @@ int picoquic_abandon_path(picoquic_cnx_t* cnx, uint64_t unique_path_id,
 int picoquic_refresh_path_connection_id(picoquic_cnx_t* cnx, uint64_t unique_path_id);
 int picoquic_set_stream_path_affinity(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t unique_path_id);
 int picoquic_set_path_status(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_path_status_enum status);
+
+/* Selection of the multipath packet scheduler.
+ *
+ * The default scheduler rotates the data load between the available and
+ * validated paths, serving the least recently used path that has both
+ * congestion and pacing credit. The alternatives pick among the same
+ * candidates with a different preference:
+ * - "min_rtt" always prefers the path with the lowest measured RTT,
+ *   for latency sensitive traffic;
+ * - "proportional" prefers the path with the most congestion window
+ *   headroom, filling each path in proportion to its rate, for bulk
+ *   throughput;
+ * - "redundant" rotates like the default but also enables preemptive
+ *   repeat, so data sent on one path and not promptly acknowledged is
+ *   repeated on another, providing sub second failover on dual links
+ *   at the cost of duplicate transmissions.
+ * ACK and challenge scheduling are not affected by the policy. */
+typedef enum {
+    picoquic_multipath_scheduler_default = 0,
+    picoquic_multipath_scheduler_min_rtt,
+    picoquic_multipath_scheduler_proportional,
+    picoquic_multipath_scheduler_redundant
+} picoquic_multipath_scheduler_enum;
+
+void picoquic_set_multipath_scheduler(picoquic_cnx_t* cnx, picoquic_multipath_scheduler_enum scheduler);
 /* The get path addr API provides the IP addresses used by a specific path.
 * The "local" argument determines whether the APi returns the local address
 * (local == 1), the address of the peer (local == 2) or the address observed by the peer (local == 3).
@@ -972,6 +1362,174 @@ typedef struct st_picoquic_path_quality_t {
 
 int picoquic_get_path_quality(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_path_quality_t * quality);
 void picoquic_get_default_path_quality(picoquic_cnx_t* cnx, picoquic_path_quality_t* quality);
+
+/* Thread safe connection statistics snapshot. The path quality API above
+ * reads live counters, so calling it from a monitoring thread races with
+ * the thread that runs the connection. The snapshot below is published
+ * under a sequence lock: the connection thread refreshes it at the end of
+ * each packet preparation pass without ever blocking, and a reader on any
+ * other thread retries the copy if a refresh happened underneath it.
+ *
+ * picoquic_get_cnx_stats returns -1 if no snapshot has been published
+ * yet. The connection pointer must remain valid for the duration of the
+ * call: the monitoring thread must not use it after the connection could
+ * have been deleted. */
+typedef struct st_picoquic_cnx_stats_t {
+    uint64_t snapshot_time; /* quic time at which the snapshot was taken */
+    uint64_t nb_packets_received;
+    uint64_t nb_packets_sent;
+    uint64_t nb_trains_sent;
+    uint64_t nb_retransmission_total;
+    uint64_t nb_spurious;
+    uint64_t nb_preemptive_repeat;
+    uint64_t data_sent; /* bytes of stream data sent */
+    uint64_t data_received; /* bytes of stream data received */
+    uint64_t nb_bytes_queued; /* bytes queued by the application, not yet sent */
+    uint64_t smoothed_rtt; /* default path, in microseconds */
+    uint64_t rtt_min;
+    uint64_t rtt_variant;
+    uint64_t cwin; /* congestion window of the default path, in bytes */
+    uint64_t pacing_rate; /* bytes per second */
+    uint64_t bytes_in_transit;
+    uint64_t receive_rate_estimate; /* bytes per second */
+} picoquic_cnx_stats_t;
+
+int picoquic_get_cnx_stats(picoquic_cnx_t* cnx, picoquic_cnx_stats_t* stats);
+
+/* Per path congestion control state export and live tuning.
+ *
+ * picoquic_get_path_cc_state reads the per path entry of the same
+ * sequence locked snapshot as picoquic_get_cnx_stats, so it is safe to
+ * call from a monitoring thread under the same caveat: the connection
+ * pointer must remain valid for the duration of the call. It returns
+ * -1 if no snapshot has been published yet, or if the path was not
+ * present in the last snapshot. The "version" field identifies the
+ * layout of the structure; new fields are only ever appended, and the
+ * version number is bumped when they are. "algorithm_id" points to the
+ * static name of the congestion algorithm, e.g. "cubic" or "bbr", and
+ * remains valid after the call; "cc_state" and "cc_param" carry the
+ * algorithm specific values also reported in qlog, e.g. the BBR state
+ * machine phase.
+ *
+ * The setters post a tuning request that the thread running the
+ * connection applies during its next packet preparation pass, so they
+ * too may be called from a monitoring thread. Setting a clamp to 0
+ * removes it. The cwin clamp bounds the number of bytes in transit on
+ * the path, like picoquic_set_cwin_max does per context; the pacing
+ * rate clamp bounds the pacing rate computed by the congestion
+ * algorithm, in bytes per second. Clamps are meant for coarse
+ * supervision, e.g. reining in a path that a monitoring system has
+ * decided is misbehaving; they do not replace congestion control.
+ */
+#define PICOQUIC_PATH_CC_STATE_VERSION 2
+
+typedef struct st_picoquic_path_cc_state_t {
+    uint64_t version; /* PICOQUIC_PATH_CC_STATE_VERSION used by the writer */
+    uint64_t unique_path_id;
+    char const* algorithm_id; /* static name of the congestion algorithm */
+    uint64_t cc_state; /* algorithm specific state, as reported in qlog */
+    uint64_t cc_param; /* algorithm specific parameter, as reported in qlog */
+    uint64_t cwin; /* congestion window, in bytes */
+    uint64_t pacing_rate; /* bytes per second */
+    uint64_t delivery_rate_estimate; /* bytes per second */
+    uint64_t smoothed_rtt; /* in microseconds */
+    uint64_t rtt_min;
+    uint64_t rtt_variant;
+    uint64_t rtt_sample; /* most recent RTT sample */
+    uint64_t bytes_in_transit;
+    uint64_t cwin_clamp; /* UINT64_MAX if no clamp is set */
+    uint64_t pacing_rate_clamp; /* UINT64_MAX if no clamp is set */
+    /* Added in version 2: per-ACK rate samples from the shared sampler,
+     * available whatever the congestion algorithm in use. */
+    uint64_t delivery_rate_latest; /* most recent per-ACK sample, bytes per second */
+    uint64_t delivery_rate_max; /* maximum non app-limited sample over the path lifetime */
+    int is_app_limited; /* last sample was taken while application limited */
+} picoquic_path_cc_state_t;
+
+int picoquic_get_path_cc_state(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_path_cc_state_t* cc_state);
+void picoquic_set_path_cwin_clamp(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint64_t cwin_clamp);
+void picoquic_set_path_pacing_rate_clamp(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint64_t pacing_rate_clamp);
+
+/* Per path RTT histogram, retrievable without qlog. Raw RTT samples,
+ * including those rejected by the outlier filter, are accumulated in an
+ * HDR style log-linear histogram: 250 microsecond wide buckets below
+ * 1 ms, then four linear sub-buckets per power of two octave.
+ * picoquic_get_path_rtt_histogram copies up to "nb_buckets" counters
+ * into the caller's array, zero-filling the remainder, and returns -1
+ * if the path is not found. picoquic_rtt_histogram_bucket_floor returns
+ * the lower bound in microseconds of the values counted in a bucket. */
+#define PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS 64
+int picoquic_get_path_rtt_histogram(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint32_t* buckets, size_t nb_buckets);
+uint64_t picoquic_rtt_histogram_bucket_floor(size_t bucket);
+
+/* Per connection stream lifecycle timing, measured inside the transport
+ * so application layer batching does not skew the numbers:
+ * - time to first byte: stream creation to the first STREAM frame sent;
+ * - time to completion: stream creation to the FIN being acknowledged
+ *   (reset streams are not counted).
+ * The durations are aggregated in histograms with the same log-linear
+ * bucket geometry as the RTT histogram, see
+ * picoquic_rtt_histogram_bucket_floor. Returns -1 if the metric is
+ * unknown. */
+typedef enum {
+    picoquic_stream_time_to_first_byte = 0,
+    picoquic_stream_time_to_completion = 1
+} picoquic_stream_time_metric_enum;
+
+int picoquic_get_stream_time_histogram(picoquic_cnx_t* cnx, picoquic_stream_time_metric_enum metric,
+    uint32_t* buckets, size_t nb_buckets);
+
+/* Real time RTT observer. The callback is invoked from the connection's
+ * thread for every raw RTT sample, as it occurs:
+ * - "ack" samples are measured from acknowledgements, before the outlier
+ *   filter, so the observer sees spikes that the smoothing rejects;
+ * - "spin" samples are the time between consecutive incoming spin bit
+ *   edges, available when the basic spin bit policy is negotiated. This
+ *   is the same signal a passive on-path observer would compute.
+ * The callback must not block; long processing should be deferred to
+ * another thread. Set the callback to NULL to stop observing. */
+typedef enum {
+    picoquic_rtt_sample_source_ack = 0,
+    picoquic_rtt_sample_source_spin = 1
+} picoquic_rtt_sample_source_enum;
+
+typedef void (*picoquic_rtt_observer_fn)(picoquic_cnx_t* cnx, uint64_t unique_path_id,
+    picoquic_rtt_sample_source_enum rtt_source, uint64_t rtt_sample, void* v_rtt_observer_ctx);
+
+void picoquic_set_rtt_observer(picoquic_cnx_t* cnx, picoquic_rtt_observer_fn rtt_observer_fn,
+    void* v_rtt_observer_ctx);
+
+/* Health statistics for the connection lookup containers, so operations
+ * can alert on data structure degradation, e.g. pathological probe
+ * lengths in the CID hash tables under a CID guessing attack.
+ * Occupancy is always available. The probe and descent counters are
+ * only collected when the library is built with the compile time option
+ * PICOQUIC_CONTAINER_STATS, and read as zero otherwise. */
+typedef struct st_picoquic_hash_stats_t {
+    uint64_t nb_entries;
+    uint64_t nb_slots;
+    uint64_t nb_lookups; /* number of probe sequences walked */
+    uint64_t nb_probes; /* cumulative slots examined by lookups */
+    uint64_t probe_max; /* longest probe sequence observed */
+} picoquic_hash_stats_t;
+
+typedef struct st_picoquic_splay_stats_t {
+    uint64_t nb_nodes;
+    uint64_t nb_descents; /* number of find or insert descents */
+    uint64_t nb_steps; /* cumulative nodes visited during descents */
+    uint64_t depth_max; /* deepest descent observed */
+} picoquic_splay_stats_t;
+
+typedef struct st_picoquic_container_stats_t {
+    picoquic_hash_stats_t cnx_by_id;
+    picoquic_hash_stats_t cnx_by_net;
+    picoquic_hash_stats_t cnx_by_icid;
+    picoquic_hash_stats_t cnx_by_secret;
+    picoquic_splay_stats_t token_reuse;
+} picoquic_container_stats_t;
+
+void picoquic_get_container_stats(picoquic_quic_t* quic, picoquic_container_stats_t* stats);
+
 int picoquic_subscribe_to_quality_update_per_path(picoquic_cnx_t* cnx, uint64_t unique_path_id,
     uint64_t pacing_rate_delta, uint64_t rtt_delta);
 void picoquic_subscribe_to_quality_update(picoquic_cnx_t* cnx, uint64_t pacing_rate_delta, uint64_t rtt_delta);
@@ -1018,6 +1576,22 @@ void picoquic_set_default_pmtud_policy(picoquic_quic_t* quic, picoquic_pmtud_pol
 void picoquic_cnx_set_pmtud_policy(picoquic_cnx_t* cnx, picoquic_pmtud_policy_enum pmtud_policy);
 void picoquic_cnx_set_pmtud_required(picoquic_cnx_t* cnx, int is_pmtud_required);
 
+/* PMTU discovery "sprint" mode. By default a single MTU probe is in
+ * flight at a time, so the binary search between the current MTU and the
+ * largest failed size takes one round trip per step. In sprint mode up
+ * to three probes of decreasing sizes are outstanding at once, each a
+ * binary search midpoint below the previous one, so the search converges
+ * within one or two round trips.
+ *
+ * picoquic_seed_expected_pmtu records the link MTU expected on the route
+ * to the peer, e.g. 9000 on jumbo frame networks; the first probe then
+ * targets that size (minus IP and UDP overhead) instead of the
+ * configured maximum. A wrong seed costs one lost probe and the search
+ * proceeds as usual. */
+void picoquic_set_default_pmtud_sprint(picoquic_quic_t* quic, int is_sprint_enabled);
+void picoquic_cnx_set_pmtud_sprint(picoquic_cnx_t* cnx, int is_sprint_enabled);
+void picoquic_seed_expected_pmtu(picoquic_cnx_t* cnx, size_t expected_mtu);
+
 /* Check whether the handshake is of type PSK*/
 int picoquic_tls_is_psk_handshake(picoquic_cnx_t* cnx);
 
@@ -1095,6 +1669,25 @@ int picoquic_incoming_packet_ex(
     picoquic_cnx_t** first_cnx,
     uint64_t current_time);
 
+/* Pass a whole coalesced receive train (UDP GRO or URO) at once: the
+ * buffer holds consecutive datagrams of seg_size bytes each, the last
+ * one possibly shorter, all received from the same source address. The
+ * decryption of consecutive short header datagrams is batched before
+ * their frames are processed, which keeps the AES pipeline of the
+ * crypto provider full. Equivalent to calling picoquic_incoming_packet_ex
+ * once per datagram. */
+int picoquic_incoming_coalesced_train(
+    picoquic_quic_t* quic,
+    uint8_t* bytes,
+    size_t train_length,
+    size_t seg_size,
+    struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    int if_index_to,
+    unsigned char received_ecn,
+    picoquic_cnx_t** first_cnx,
+    uint64_t current_time);
+
 /* Applications must regularly poll the "next packet" API to obtain the
  * next packet that will be set over the network. The API for that is
  * picoquic_prepare_next_packet", which operates on a "quic context".
@@ -1201,7 +1794,31 @@ void picoquic_unlink_app_stream_ctx(picoquic_cnx_t* cnx, uint64_t stream_id);
 int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, int is_active, void* v_stream_ctx);
 
-/* Handling of stream priority. 
+/* Mark a stream as not worth retransmitting, or revert that.
+ *
+ * When a stream is marked, stream frames that are declared lost are
+ * never repeated: the packet copies are simply dropped instead of being
+ * rescheduled, and the stream is excluded from preemptive repeat. This
+ * suits media streams that use the reset-on-lag pattern, where data that
+ * did not arrive in time is abandoned by resetting the stream; the reset
+ * itself remains reliable. The receiver must tolerate gaps in the stream,
+ * typically by resetting or discarding it, since the missing bytes will
+ * never arrive and in-order delivery would otherwise stall.
+ */
+int picoquic_mark_no_retransmit_stream(picoquic_cnx_t* cnx,
+    uint64_t stream_id, int no_retransmit);
+
+/* Opt a stream into FEC protection. Packets carrying data from a
+ * protected stream are accumulated into XOR repair symbols, sent as
+ * repair frames at a rate driven by the observed loss statistics. This
+ * only takes effect if the FEC extension was negotiated, see
+ * picoquic_set_default_fec_option. Protection applies to packets whose
+ * payload fits in the repair symbol; larger packets fall back to plain
+ * retransmission. */
+int picoquic_set_stream_fec(picoquic_cnx_t* cnx,
+    uint64_t stream_id, int is_fec_protected);
+
+/* Handling of stream priority.
  * 
  * Picoquic handles priority as an 8 bit unsigned integer.
  * When ready to send stream frames, picoquic will pick the lowest priority
@@ -1254,7 +1871,70 @@ int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_
 int picoquic_mark_high_priority_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, int is_high_priority);
 
-/* 
+/* Selection of the scheduling discipline applied among the streams of a
+ * priority level. The default discipline is the one described above:
+ * FIFO if the priority level is odd, round robin if it is even.
+ *
+ * The weighted fair queuing scheduler shares the bytes of a priority
+ * level in proportion to per stream weights set with
+ * `picoquic_set_stream_wfq_weight`: a stream of weight 2N receives
+ * twice the bytes of a stream of weight N, with the incremental latency
+ * bound of self clocked fair queuing. Streams for which no weight was
+ * set compete with weight 1. The low order bit of the priority level is
+ * ignored when the WFQ scheduler is selected.
+ */
+typedef enum {
+    picoquic_stream_scheduler_default = 0,
+    picoquic_stream_scheduler_wfq
+} picoquic_stream_scheduler_enum;
+
+void picoquic_set_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum stream_scheduler);
+int picoquic_set_stream_wfq_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t weight);
+
+/* Set a deadline on a stream, expressed as the maximum queueing delay of
+ * submitted data in microseconds, or 0 to remove the deadline. Data
+ * queued with `picoquic_add_to_stream` that is still waiting for its
+ * first transmission when the deadline elapses is silently discarded by
+ * the stream scheduler, so stale chunks consume neither congestion
+ * credit nor sender CPU. A chunk whose transmission has started is
+ * always sent in full, which keeps the stream content consistent; the
+ * FIN, if requested, is sent at whatever offset the stream reached.
+ * This is intended for media style traffic where late data is worthless;
+ * the receiving application must tolerate the resulting gaps in its
+ * framing, e.g. by carrying explicit frame headers. */
+int picoquic_set_stream_deadline(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t deadline_microsec);
+
+/* Cork a stream so that successive small writes coalesce into a single
+ * STREAM frame instead of each producing its own frame and often its
+ * own packet. While a cork delay is set, data queued with
+ * `picoquic_add_to_stream` is withheld from the scheduler until either
+ * the delay has elapsed since the first byte was queued, a full packet
+ * worth of data has accumulated, the FIN is requested, or the
+ * application calls `picoquic_stream_flush`. Set the delay to 0 to
+ * return to immediate sending. The delay trades latency for framing
+ * efficiency; a few hundred microseconds is usually enough to collapse
+ * a burst of message writes into one packet. */
+int picoquic_set_stream_cork_delay(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t cork_delay_microsec);
+
+/* Release data held back by `picoquic_set_stream_cork_delay` without
+ * waiting for the cork delay to elapse. The cork delay itself remains
+ * set and applies to subsequent writes. */
+int picoquic_stream_flush(picoquic_cnx_t* cnx, uint64_t stream_id);
+
+/* Declare a range of already submitted stream data obsolete, so that if
+ * it is lost it will not be retransmitted. The range is recorded as if
+ * the peer had acknowledged it; every repeat path, including the data
+ * repeat queue and PTO probes, skips acknowledged ranges. This is meant
+ * for live media where a lost frame is superseded by a newer one: the
+ * application marks the old frame obsolete and queues the replacement,
+ * instead of the connection spending an RTT repeating stale bytes
+ * first. The byte offsets on the wire are not rewritten, so a skipped
+ * loss leaves a permanent gap in the stream; the receiving application
+ * must consume the stream with picoquic_mark_direct_receive_stream or
+ * otherwise tolerate gaps in its framing. */
+int picoquic_mark_data_obsolete(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t offset, uint64_t length);
+
+/*
 * Handling of datagram priorities
 * 
 * All datagrams sent on a connection have the same priority.
@@ -1313,6 +1993,41 @@ void picoquic_reset_stream_ctx(picoquic_cnx_t* cnx, uint64_t stream_id);
  */
 int picoquic_add_to_stream_with_ctx(picoquic_cnx_t * cnx, uint64_t stream_id, const uint8_t * data, size_t length, int set_fin, void * app_stream_ctx);
 
+typedef void (*picoquic_stream_sent_fn)(picoquic_cnx_t* cnx, void* sent_ctx);
+
+/* Scatter-gather variant of "picoquic_add_to_stream". The segments of
+ * the iovec array are queued as one logically contiguous range of
+ * stream data, without copying: each entry keeps pointing at the
+ * caller's memory, and the data is copied exactly once, into the packet
+ * that carries it. The caller must keep the buffers untouched until the
+ * optional "sent_fn" callback fires; that happens when the last byte
+ * has been copied into a packet, or when the data is abandoned because
+ * the stream was reset or the connection closed. Retransmissions are
+ * made from the packet copies, so the callback does not wait for
+ * acknowledgements. */
+typedef struct st_picoquic_iovec_t {
+    const uint8_t* iov_base;
+    size_t iov_len;
+} picoquic_iovec_t;
+
+int picoquic_add_to_stream_iov(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const picoquic_iovec_t* iov, size_t nb_iov, int set_fin,
+    picoquic_stream_sent_fn sent_fn, void* sent_ctx);
+
+/* Loan based zero copy receive. Called from inside a
+ * picoquic_callback_stream_data or picoquic_callback_stream_fin
+ * callback, picoquic_loan_stream_data returns a handle that keeps the
+ * buffer holding the delivered bytes valid after the callback returns,
+ * so the chunk can for example be forwarded on another connection
+ * without a copy. Each call takes one reference; the buffer goes back
+ * to the receive pool when every reference was given back with
+ * picoquic_return_stream_data. Returns NULL when the delivered bytes
+ * are not backed by a loanable buffer, in which case the application
+ * must copy as usual. Loans must be returned on the thread running the
+ * QUIC context, and before the context is deleted. */
+void* picoquic_loan_stream_data(picoquic_cnx_t* cnx);
+void picoquic_return_stream_data(void* loan);
+
 /* Reset a stream, indicating that no more data will be sent on 
  * that stream and that any data currently queued can be abandoned. */
 int picoquic_reset_stream(picoquic_cnx_t* cnx,
@@ -1435,6 +2150,16 @@ void picoquic_set_optimistic_ack_policy(picoquic_quic_t* quic, uint32_t sequence
 void picoquic_set_preemptive_repeat_policy(picoquic_quic_t* quic, int do_repeat);
 void picoquic_set_preemptive_repeat_per_cnx(picoquic_cnx_t* cnx, int do_repeat);
 
+/* Enable or disable ACK coalescing. When enabled, a data packet about to
+ * be sent picks up the pending acknowledgment state of the connection
+ * even if the ACK delay timer has not fired yet: the packet goes out
+ * anyway, so bundling the ACK costs a few bytes and saves the separate
+ * pure ACK packet that would otherwise follow. Mostly useful for
+ * bidirectional request/response traffic.
+ */
+void picoquic_set_ack_coalescing_policy(picoquic_quic_t* quic, int do_coalesce);
+void picoquic_set_ack_coalescing_per_cnx(picoquic_cnx_t* cnx, int do_coalesce);
+
 /* Enables keep alive for a connection.
  * Keep alive interval is expressed in microseconds.
  * If `interval` is `0`, it is set to `idle_timeout / 2`.
@@ -1443,6 +2168,16 @@ void picoquic_enable_keep_alive(picoquic_cnx_t* cnx, uint64_t interval);
 /* Disables keep alive for a connection. */
 void picoquic_disable_keep_alive(picoquic_cnx_t* cnx);
 
+/* Coalesce keep alive timers across connections by aligning each
+ * keep alive wake time up to the next multiple of `slack_microsec`.
+ * With a large fleet of idle connections the independent timers
+ * otherwise wake the event loop almost continuously; aligning them to
+ * e.g. 100ms buckets makes idle connections fire in batches. A keep
+ * alive is at most `slack_microsec` late, so the slack must remain
+ * small compared to the keep alive interval and thus to the idle
+ * timeout. Set to 0 (the default) to disable coalescing. */
+void picoquic_set_keep_alive_slack(picoquic_quic_t* quic, uint64_t slack_microsec);
+
 /* Returns if the given connection is the client. */
 int picoquic_is_client(picoquic_cnx_t* cnx);
 
@@ -1490,6 +2225,7 @@ typedef struct st_picoquic_per_ack_state_t {
     uint64_t inflight_prior;
     uint64_t lost_packet_number;
     uint64_t lost_packet_sent_time;
+    uint64_t delivery_rate; /* Shared delivery rate sample, bytes per second, see picoquic_cc_delivery_rate_sample */
     unsigned int is_app_limited : 1; /* App marked limited at time of ACK? */
     unsigned int is_cwnd_limited: 1; /* path marked CWIN limited after packet was sent. */
 } picoquic_per_ack_state_t;
@@ -1530,8 +2266,32 @@ void picoquic_set_default_congestion_algorithm(picoquic_quic_t* quic, picoquic_c
 
 void picoquic_set_default_congestion_algorithm_by_name(picoquic_quic_t* quic, char const* alg_name);
 
+/* Congestion control A/B experiments. A deterministic hash of the initial
+ * connection ID assigns "share_per_256" out of every 256 connections to
+ * the alternate algorithm at creation time, with no application change.
+ * The assignment is recorded in the performance log when extended outcome
+ * columns are enabled, see picoquic_perflog_setup_ex. The option string
+ * follows the conventions of picoquic_set_congestion_algorithm_ex. A NULL
+ * algorithm or a zero share disables the experiment. The option string is
+ * not copied and must remain valid for the lifetime of the context. */
+void picoquic_set_cc_experiment(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const* alt_algorithm,
+    char const* alt_option_string, uint8_t share_per_256);
+
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* algo);
 
+/* Set the congestion control algorithm together with an option string.
+ * Options are comma separated tokens; unknown tokens are ignored.
+ * Supported options:
+ *   "hystart++"  use the HyStart++ (RFC 9406) slow start exit in the
+ *                reno and cubic slow start: instead of leaving slow
+ *                start as soon as the RTT rises, the window growth is
+ *                reduced to a quarter rate for a few rounds, resuming
+ *                full growth if the rise proves spurious. This limits
+ *                the overshoot into shallow buffers.
+ */
+void picoquic_set_congestion_algorithm_ex(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* algo,
+    char const* option_string);
+
 /* Special code for Wi-Fi network. These networks are subject to occasional
  * "suspension", for power saving reasons. If the suspension is too long,
  * it causes transmission to stop after cngestion control credits are
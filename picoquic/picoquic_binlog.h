@@ -112,6 +112,56 @@ int picoquic_set_binlog(picoquic_quic_t* quic, char const* binlog_dir);
 /* Enable binary logs, e.g. if autoqlog is requests */
 void picoquic_enable_binlog(picoquic_quic_t* quic);
 
+/* Write new per connection binary logs in the v2 format. The v2 format
+ * keeps the chunk layout of v1, but encodes the event times and the
+ * packet sequence numbers as zigzag varint deltas from the previous
+ * event of the connection, which shrinks these fields to one or two
+ * bytes in steady state. The file header carries version 0x02, and the
+ * log readers reconstruct the absolute values transparently. The flight
+ * recorder keeps using v1, since it dumps a subset of the recorded
+ * events. Takes effect for connections created after the call. */
+void picoquic_set_binlog_v2(picoquic_quic_t* quic, int enabled);
+
+/* Move the binlog disk writes off the loop thread. When enabled, each
+ * event is copied into a fixed size lock free ring and a dedicated
+ * thread drains the ring to the log files; if the ring is full the
+ * event is dropped and counted, so logging never blocks the loop. The
+ * thread is stopped, after draining, when called with enabled = 0, and
+ * automatically when the QUIC context is freed. Returns -1 if the
+ * thread cannot be started; not supported on Windows. */
+int picoquic_set_binlog_thread(picoquic_quic_t* quic, int enabled);
+
+/* Number of events dropped so far because the ring was full */
+uint64_t picoquic_get_binlog_dropped(picoquic_quic_t* quic);
+
+/* Write the binary logs through a memory mapping instead of buffered
+ * stdio. The per connection log file is extended in large chunks and
+ * events are copied straight into the mapping after an atomic bump of
+ * the write offset, removing the write syscalls from the logging path.
+ * The chunk length prefix is written last, so after a crash the file
+ * ends on the last complete record. Takes effect for connections
+ * created after the call; takes precedence over the writer thread.
+ * Returns -1 when not supported (Windows). */
+int picoquic_set_binlog_mmap(picoquic_quic_t* quic, int enabled);
+
+/* In memory flight recorder. Binlog events for all connections are
+ * captured in a circular buffer holding the last nb_events events and
+ * no log file is created, so steady state logging does no disk I/O.
+ * When an incident is detected, call picoquic_dump_flight_recorder()
+ * to write the retained events to disk. Each event uses a fixed size
+ * slot, so the memory cost is about 4KB per retained event. Calling
+ * with nb_events = 0 stops the recorder and frees the buffer; this
+ * happens automatically when the QUIC context is freed. Returns -1
+ * when the recorder cannot be started; not supported on Windows. */
+int picoquic_set_flight_recorder(picoquic_quic_t* quic, size_t nb_events);
+
+/* Write the events currently retained by the flight recorder, oldest
+ * first, as a regular binlog file that picolog can convert. The
+ * recorder keeps recording; a later dump writes the events retained
+ * by then. Returns -1 if no recorder is active or the file cannot be
+ * written. */
+int picoquic_dump_flight_recorder(picoquic_quic_t* quic, char const* fr_file_name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +66,7 @@ typedef enum {
     picoquic_option_Ticket_File_Name,
     picoquic_option_Token_File_Name,
     picoquic_option_Socket_buffer_size,
+    picoquic_option_Server_threads,
     picoquic_option_Performance_Log,
     picoquic_option_Preemptive_Repeat,
     picoquic_option_Version_Upgrade,
@@ -92,6 +93,7 @@ typedef struct st_picoquic_quic_config_t {
     int cnx_id_length;
     int idle_timeout;
     int socket_buffer_size;
+    int nb_server_threads; /* number of per-core server loop threads, 0 or 1 for a single loop */
     char const* cc_algo_id;
     char const * cnx_id_cbdata;
     /* TODO: control key logging */
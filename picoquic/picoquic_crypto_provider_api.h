@@ -47,6 +47,25 @@ extern "C" {
     typedef void (*picoquic_clear_crypto_errors_t)();
     typedef void (*picoquic_set_random_provider_in_ctx_t)(ptls_context_t* ctx);
     typedef void (*picoquic_crypto_random_provider_t)(void *buf, size_t len);
+    /* Batch computation of header protection masks: nb_masks samples of 16
+     * bytes, "sample_stride" bytes apart, produce nb_masks masks of 5 bytes.
+     * Each mask is the first 5 bytes of the HP cipher keystream for the
+     * corresponding sample, i.e. one AES block per mask, so a provider can
+     * compute all of them with a single multi-block AES call. */
+    typedef void (*picoquic_pn_encrypt_batch_t)(void* pn_enc, const uint8_t* samples, size_t sample_stride,
+        uint8_t* masks, size_t nb_masks);
+    /* Scatter-gather seal: encrypt the concatenation of the iovec segments
+     * into the contiguous output buffer in a single AEAD pass, returning
+     * the number of bytes written including the authentication tag. Lets a
+     * provider seal a packet assembled from several buffers without an
+     * intermediate plaintext copy. */
+    typedef struct st_picoquic_crypto_iovec_t {
+        const uint8_t* base;
+        size_t len;
+    } picoquic_crypto_iovec_t;
+    typedef size_t (*picoquic_aead_encrypt_gather_t)(void* aead_context, uint8_t* output,
+        const picoquic_crypto_iovec_t* iov, size_t nb_iov,
+        uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length);
 
     void picoquic_register_tls_key_provider_fn(
         picoquic_set_private_key_from_file_t set_private_key_from_file_fn,
@@ -62,6 +81,32 @@ extern "C" {
 
     void picoquic_register_crypto_random_provider_fn(picoquic_crypto_random_provider_t random_provider);
 
+    void picoquic_register_pn_encrypt_batch_fn(picoquic_pn_encrypt_batch_t pn_encrypt_batch_fn);
+
+    void picoquic_register_aead_encrypt_gather_fn(picoquic_aead_encrypt_gather_t aead_encrypt_gather_fn);
+
+    /* Key exchange offload hook. When registered, the ECDH computations of
+     * the TLS handshake (server key share during ClientHello processing,
+     * client share verification) are routed through this function instead
+     * of the registered algorithm's own exchange method, with the original
+     * algorithm passed as first argument. A provider backed by QAT or a
+     * similar accelerator can complete the operation off the CPU, keeping
+     * handshake bursts from starving the data plane; the call itself stays
+     * synchronous, as the picotls key exchange interface offers no
+     * completion callback. The hook must be registered before the quic
+     * context is created. */
+    typedef int (*picoquic_key_exchange_offload_t)(const ptls_key_exchange_algorithm_t* algo,
+        ptls_iovec_t* pubkey, ptls_iovec_t* secret, ptls_iovec_t peerkey);
+
+    void picoquic_register_key_exchange_offload_fn(picoquic_key_exchange_offload_t key_exchange_offload_fn);
+
+    /* Register a vectorized ChaCha20-Poly1305 AEAD supplied by the crypto
+     * library or the application, see picoquic_ptls_chacha.c. Returns 0 if
+     * the suite was registered, -1 if the CPU lacks AVX2 support or no
+     * SHA256 provider is loaded yet. Call after picoquic_tls_api_init(). */
+    int picoquic_register_vectorized_chacha20poly1305(ptls_aead_algorithm_t* aead);
+    int picoquic_chacha_vec_is_supported_by_cpu(void);
+
 /* Additional definitions required for testing and verification */
 
 #define PICOQUIC_CIPHER_SUITES_NB_MAX 8
@@ -84,6 +129,9 @@ extern "C" {
     extern picoquic_explain_crypto_error_t picoquic_explain_crypto_error_fn;
     extern picoquic_clear_crypto_errors_t picoquic_clear_crypto_errors_fn;
     extern picoquic_crypto_random_provider_t picoquic_crypto_random_provider_fn;
+    extern picoquic_pn_encrypt_batch_t picoquic_pn_encrypt_batch_fn;
+    extern picoquic_key_exchange_offload_t picoquic_key_exchange_offload_fn;
+    extern picoquic_aead_encrypt_gather_t picoquic_aead_encrypt_gather_fn;
 
 #ifdef PICOQUIC_WITH_MBEDTLS
     /* Picoquic variant of the get certificate verifier API */
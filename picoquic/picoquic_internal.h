@@ -27,6 +27,7 @@
 #endif
 
 #include "picohash.h"
+#include "picoskip.h"
 #include "picosplay.h"
 #include "picoquic.h"
 #include "picoquic_utils.h"
@@ -48,6 +49,7 @@ extern "C" {
 #define PICOQUIC_NB_PATH_TARGET 8
 #define PICOQUIC_NB_PATH_DEFAULT 2
 #define PICOQUIC_MAX_PACKETS_IN_POOL 0x2000
+#define PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE 256
 #define PICOQUIC_STORED_IP_MAX 16
 
 #define PICOQUIC_INITIAL_RTT 250000ull /* 250 ms */
@@ -56,6 +58,9 @@ extern "C" {
 #define PICOQUIC_INITIAL_RETRANSMIT_TIMER 250000ull /* 250 ms */
 #define PICOQUIC_INITIAL_MAX_RETRANSMIT_TIMER 1000000ull /* one second */
 #define PICOQUIC_LARGE_RETRANSMIT_TIMER 2000000ull /* two seconds */
+#define PICOQUIC_RTT_OUTLIER_PERSISTENCE 3 /* consecutive outlier RTT samples accepted as a real shift */
+#define PICOQUIC_REORDER_PKT_THRESHOLD_DEFAULT 3 /* RACK packet reordering threshold before adaptation */
+#define PICOQUIC_REORDER_PKT_THRESHOLD_MAX 64 /* upper bound on the learned reordering depth */
 #define PICOQUIC_MIN_RETRANSMIT_TIMER 50000ull /* 50 ms */
 #define PICOQUIC_ACK_DELAY_MAX 10000ull /* 10 ms */
 #define PICOQUIC_ACK_DELAY_MAX_DEFAULT 25000ull /* 25 ms, per protocol spec */
@@ -67,6 +72,9 @@ extern "C" {
 #define PICOQUIC_TOKEN_DELAY_SHORT (2*60*1000000ull) /* 2 minutes */
 #define PICOQUIC_CID_REFRESH_DELAY (5*1000000ull) /* if idle for 5 seconds, refresh the CID */
 #define PICOQUIC_MTU_LOSS_THRESHOLD 10 /* if threshold of full MTU packetlost, reset MTU */
+#define PICOQUIC_SIMPLE_SEND_ROUNDS 32 /* max packets on the sender fast path before a full scheduling pass */
+#define PICOQUIC_PMTUD_SPRINT_PROBES 3 /* max MTU probes in flight in sprint mode */
+#define PICOQUIC_PMTUD_SPRINT_STEP_MIN 64 /* stop the sprint when the next midpoint gains less than this */
 
 #define PICOQUIC_BANDWIDTH_ESTIMATE_MAX 10000000000ull /* 10 GB per second */
 #define PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN 1000
@@ -103,6 +111,9 @@ extern "C" {
 
 #define PICOQUIC_CHALLENGE_REPEAT_MAX 3
 
+#define PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE 4
+#define PICOQUIC_VALIDATED_ADDRESS_LIFETIME (900ull*1000000ull) /* validated peer addresses are trusted for 15 minutes */
+
 #define PICOQUIC_ALPN_NUMBER_MAX 32
 
 #define PICOQUIC_CC_ALGO_NUMBER_NEW_RENO 1
@@ -163,7 +174,8 @@ typedef enum {
     picoquic_frame_type_max_path_id = 0x15228c0c,
     picoquic_frame_type_path_blocked = 0x15228c0d,
     picoquic_frame_type_observed_address_v4 = 0x9f81a6,
-    picoquic_frame_type_observed_address_v6 = 0x9f81a7
+    picoquic_frame_type_observed_address_v6 = 0x9f81a7,
+    picoquic_frame_type_fec_repair = 0x46ec /* experimental, see fec.c */
 } picoquic_frame_type_enum_t;
 
 /* PMTU discovery requirement status */
@@ -355,16 +367,93 @@ picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t*
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp);
 
 /* Data structure used to hold chunk of stream data before in sequence delivery */
+/* The received stream segments are indexed by a splay tree by default;
+ * building with PICOQUIC_STREAM_INDEX_SKIPLIST selects the skiplist
+ * instead (see ENABLE_STREAM_INDEX_SKIPLIST in CMakeLists.txt). The two
+ * structures share the same callback conventions, so the selection is a
+ * set of type and function aliases. */
+#ifdef PICOQUIC_STREAM_INDEX_SKIPLIST
+typedef picoskip_list_t picoquic_stream_data_index_t;
+typedef picoskip_node_t picoquic_stream_index_node_t;
+#define picoquic_stream_index_init picoskip_init_list
+#define picoquic_stream_index_insert picoskip_insert
+#define picoquic_stream_index_find_previous picoskip_find_previous
+#define picoquic_stream_index_first picoskip_first
+#define picoquic_stream_index_next picoskip_next
+#define picoquic_stream_index_delete_hint picoskip_delete_hint
+#define picoquic_stream_index_empty picoskip_empty_list
+#else
+typedef picosplay_tree_t picoquic_stream_data_index_t;
+typedef picosplay_node_t picoquic_stream_index_node_t;
+#define picoquic_stream_index_init picosplay_init_tree
+#define picoquic_stream_index_insert picosplay_insert
+#define picoquic_stream_index_find_previous picosplay_find_previous
+#define picoquic_stream_index_first picosplay_first
+#define picoquic_stream_index_next picosplay_next
+#define picoquic_stream_index_delete_hint picosplay_delete_hint
+#define picoquic_stream_index_empty picosplay_empty_tree
+#endif
+
 typedef struct st_picoquic_stream_data_node_t {
-    picosplay_node_t stream_data_node;
+    picoquic_stream_index_node_t stream_data_node;
     picoquic_quic_t* quic;
     struct st_picoquic_stream_data_node_t* next_stream_data;
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     const uint8_t* bytes;
+    int loan_count; /* Application references, see picoquic_loan_stream_data */
+    unsigned int is_detached : 1; /* The stack released the node while loans were outstanding */
     uint8_t data[PICOQUIC_MAX_PACKET_SIZE];
 } picoquic_stream_data_node_t;
 
+/* Stream data nodes are carved out of fixed size slabs instead of being
+ * malloc'ed one by one: reassembly churns through nodes constantly, and
+ * individual allocations of this size both contend on the allocator and
+ * fragment the heap. Freed nodes go back on the per context free list;
+ * the slabs themselves are only released with the quic context. */
+#define PICOQUIC_STREAM_DATA_SLAB_NB_NODES 32
+
+typedef struct st_picoquic_stream_data_slab_t {
+    struct st_picoquic_stream_data_slab_t* next_slab;
+    picoquic_stream_data_node_t nodes[PICOQUIC_STREAM_DATA_SLAB_NB_NODES];
+} picoquic_stream_data_slab_t;
+
+/* Send queue data buffers copy whatever size the application posted,
+ * which produces a wide malloc size distribution. They are served from
+ * three size class free lists instead, so the common case is a list pop;
+ * requests larger than the biggest class fall back to plain malloc.
+ * Each class keeps at most PICOQUIC_STREAM_BUFFER_POOL_MAX buffers. */
+#define PICOQUIC_STREAM_BUFFER_NB_CLASSES 3
+#define PICOQUIC_STREAM_BUFFER_POOL_MAX 64
+
+/* Tagged allocation counters, see picoquic_get_memory_profile. The
+ * macros compile to nothing unless the library is built with
+ * PICOQUIC_MEMORY_PROFILE, so the instrumented sites are free in
+ * normal builds. */
+#ifdef PICOQUIC_MEMORY_PROFILE
+void picoquic_memory_profile_add(int tag, size_t size);
+void picoquic_memory_profile_sub(int tag, size_t size);
+#define PICOQUIC_MEMPROF_ADD(tag, size) picoquic_memory_profile_add(tag, size)
+#define PICOQUIC_MEMPROF_SUB(tag, size) picoquic_memory_profile_sub(tag, size)
+#else
+#define PICOQUIC_MEMPROF_ADD(tag, size)
+#define PICOQUIC_MEMPROF_SUB(tag, size)
+#endif
+
+/* Per connection arena for small metadata tied to the connection lifetime,
+ * currently stream heads and local CID structures. Objects are bump
+ * allocated out of chained blocks and recycled through per type free
+ * lists while the connection lives; teardown releases the blocks
+ * wholesale instead of walking and freeing every object, which matters
+ * when thousands of connections are deleted at once. */
+#define PICOQUIC_CNX_ARENA_BLOCK_SIZE 0x4000
+
+typedef struct st_picoquic_cnx_arena_block_t {
+    struct st_picoquic_cnx_arena_block_t* next_block;
+    size_t bytes_used;
+    uint8_t data[PICOQUIC_CNX_ARENA_BLOCK_SIZE];
+} picoquic_cnx_arena_block_t;
+
 /* Data structure used to hold chunk of stream data queued by application */
 typedef struct st_picoquic_stream_queue_node_t {
     picoquic_quic_t* quic;
@@ -372,6 +461,12 @@ typedef struct st_picoquic_stream_queue_node_t {
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     uint8_t* bytes;
+    volatile int copy_pending; /* a worker thread is still copying into "bytes",
+                                * see picoquic_set_deferred_stream_copy */
+    unsigned int is_external : 1; /* "bytes" belongs to the caller, see picoquic_add_to_stream_iov */
+    picoquic_stream_sent_fn sent_fn; /* if not NULL, fired when the entry leaves the queue */
+    void* sent_ctx;
+    uint64_t queue_time; /* time at which the chunk was queued, used for stream deadlines */
 } picoquic_stream_queue_node_t;
 
 /*
@@ -385,7 +480,9 @@ typedef struct st_picoquic_packet_t {
     struct st_picoquic_packet_t* packet_next;
     struct st_picoquic_packet_t* packet_previous;
     struct st_picoquic_path_t* send_path;
-    picosplay_node_t queue_data_repeat_node;
+    struct st_picoquic_packet_t* data_repeat_first_child; /* pairing heap links for the data repeat queue */
+    struct st_picoquic_packet_t* data_repeat_next_sibling;
+    struct st_picoquic_packet_t* data_repeat_parent_or_left; /* parent for a first child, else left sibling */
     uint64_t sequence_number;
     uint64_t send_time;
     uint64_t delivered_prior;
@@ -423,10 +520,17 @@ typedef struct st_picoquic_packet_t {
     unsigned int is_queued_for_spurious_detection : 1;
     unsigned int is_queued_for_data_repeat : 1;
 
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    size_t bytes_alloc; /* Allocated size of the payload buffer */
+    uint8_t* bytes; /* Out of line payload buffer. Full size while the packet is
+                     * formatted, possibly replaced by a small copy once the
+                     * packet is queued for retransmission, so short packets
+                     * (typically pure ACKs) do not pin a full size buffer
+                     * while they wait for acknowledgement. */
 } picoquic_packet_t;
 
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t* quic);
+uint8_t* picoquic_packet_payload_alloc(picoquic_quic_t* quic, size_t bytes_alloc);
+void picoquic_packet_payload_free(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_alloc);
 void picoquic_recycle_packet(picoquic_quic_t* quic, picoquic_packet_t* packet);
 
 /* Definition of the token register used to prevent repeated usage of
@@ -475,9 +579,15 @@ typedef struct st_picoquic_stored_ticket_t {
     uint8_t ip_addr_length;
     uint8_t ip_addr_client_length;
     uint8_t* ip_addr_client;
+    size_t stored_size; /* Size of this allocation, for the store byte budget */
     unsigned int was_used : 1;
 } picoquic_stored_ticket_t;
 
+void picoquic_enforce_ticket_budget(picoquic_quic_t* quic);
+int picoquic_serialize_ticket(const picoquic_stored_ticket_t* ticket,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
+int picoquic_deserialize_ticket(picoquic_stored_ticket_t** ticket,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
 int picoquic_store_ticket(picoquic_quic_t* quic,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint32_t version, const uint8_t* ip_addr, uint8_t ip_addr_length,
@@ -497,12 +607,45 @@ int picoquic_get_ticket_and_version(picoquic_quic_t * quic,
 int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
     uint64_t current_time, char const* ticket_file_name);
 int picoquic_load_tickets(picoquic_quic_t* quic, char const* ticket_file_name);
+/* Indexed binary ticket store: the file carries a hash index by (SNI, ALPN),
+ * is mapped read only at load time, and records are only deserialized when a
+ * lookup misses the resident list. Append adds records after the index; the
+ * indexed save merges list and file and rebuilds the index (compaction). */
+int picoquic_save_tickets_indexed(picoquic_quic_t* quic, uint64_t current_time,
+    char const* ticket_file_name);
+int picoquic_load_tickets_indexed(picoquic_quic_t* quic, char const* ticket_file_name);
+int picoquic_ticket_store_append(char const* ticket_file_name,
+    const picoquic_stored_ticket_t* ticket);
+void picoquic_ticket_store_unmap(picoquic_quic_t* quic);
 void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket);
 void picoquic_seed_ticket(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
 
 
+/* Server side cache of the QUIC version last negotiated with clients of a
+ * given network, IPv4 /24 or IPv6 /48. Direct mapped, collisions simply
+ * overwrite; the cache is allocated on first use. */
+#define PICOQUIC_VERSION_PREFERENCE_CACHE_SIZE 128
+
+typedef struct st_picoquic_version_pref_entry_t {
+    struct sockaddr_storage network; /* client address masked to the prefix, port zero */
+    uint32_t version;
+} picoquic_version_pref_entry_t;
+
+void picoquic_record_version_preference(picoquic_quic_t* quic,
+    const struct sockaddr* addr_peer, uint32_t version);
+
+/* Client token cache. Tokens are kept in a list for serialization and
+ * enumeration, with a hash index by SNI for O(1) lookup and a time wheel
+ * for expiry, one slot per hour. */
+#define PICOQUIC_TOKEN_WHEEL_NB_SLOTS 64
+#define PICOQUIC_TOKEN_WHEEL_SLOT_MICROSEC 3600000000ull
+
 typedef struct st_picoquic_stored_token_t {
     struct st_picoquic_stored_token_t* next_token;
+    struct st_picoquic_stored_token_t* previous_token;
+    struct st_picoquic_stored_token_t* next_in_bucket; /* hash index chain */
+    struct st_picoquic_stored_token_t* next_in_wheel; /* expiry wheel chain */
+    uint64_t token_hash; /* hash of the SNI, set when the token is indexed */
     char const* sni;
     uint8_t const* token;
     uint8_t const* ip_addr;
@@ -513,6 +656,11 @@ typedef struct st_picoquic_stored_token_t {
     unsigned int was_used : 1;
 } picoquic_stored_token_t;
 
+int picoquic_serialize_token(const picoquic_stored_token_t* token,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
+int picoquic_deserialize_token(picoquic_stored_token_t** token,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
+void picoquic_token_index_insert(picoquic_quic_t* quic, picoquic_stored_token_t* stored);
 int picoquic_store_token(picoquic_quic_t * quic,
     char const* sni, uint16_t sni_length,
     uint8_t const* ip_addr, uint8_t ip_addr_length,
@@ -527,6 +675,25 @@ int picoquic_save_tokens(picoquic_quic_t* quic,
 int picoquic_load_tokens(picoquic_quic_t* quic, char const* token_file_name);
 void picoquic_free_tokens(picoquic_stored_token_t** pp_first_token);
 
+/* Unified store journal: append-only file shared by the ticket and token
+ * stores, see store_journal.c. Enabled by picoquic_use_store_journal. */
+typedef enum {
+    picoquic_journal_record_ticket = 1,
+    picoquic_journal_record_token = 2
+} picoquic_journal_record_enum;
+
+typedef struct st_picoquic_store_journal_t {
+    FILE* F; /* opened for appending; NULL after a write error until the next compaction */
+    char* file_name;
+    picoquic_journal_fsync_enum fsync_policy;
+    uint64_t nb_appends; /* records appended since the last compaction */
+} picoquic_store_journal_t;
+
+int picoquic_journal_append(picoquic_quic_t* quic, uint8_t record_type,
+    const uint8_t* bytes, size_t length);
+int picoquic_journal_compact(picoquic_quic_t* quic);
+void picoquic_journal_close(picoquic_quic_t* quic);
+
 /* Remember the tickets issued by a server, and the last
  * congestion control parameters for the corresponding connection
  */
@@ -553,6 +720,26 @@ int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
 picoquic_issued_ticket_t* picoquic_retrieve_issued_ticket(picoquic_quic_t* quic,
     uint64_t ticket_id);
 
+/* Cache of recently decrypted session tickets. A fleet of resuming clients
+ * behind a retrying load balancer presents the same ticket ciphertext many
+ * times in short succession; the cache lets repeat presentations skip the
+ * AEAD decryption. Entries are matched by a keyed hash of the full
+ * ciphertext plus a prefix comparison, and evicted LRU.
+ */
+#define PICOQUIC_TICKET_CACHE_NB_ENTRIES 16
+#define PICOQUIC_TICKET_CACHE_PREFIX_LENGTH 16
+
+typedef struct st_picoquic_ticket_cache_entry_t {
+    uint64_t ticket_hash;
+    uint64_t last_used;
+    size_t ticket_length;
+    size_t plaintext_length;
+    uint8_t prefix[PICOQUIC_TICKET_CACHE_PREFIX_LENGTH];
+    uint8_t* plaintext;
+} picoquic_ticket_cache_entry_t;
+
+void picoquic_clear_ticket_cache(picoquic_quic_t* quic);
+
 /*
  * Transport parameters, as defined by the QUIC transport specification.
  * The initial code defined the type as an enum, but the binary representation
@@ -589,6 +776,7 @@ typedef uint64_t picoquic_tp_enum;
 #define picoquic_tp_enable_bdp_frame 0xebd9 /* per draft-kuhn-quic-0rtt-bdp-09 */
 #define picoquic_tp_initial_max_path_id  0x0f739bbc1b666d11ull /* per draft quic multipath 11 */
 #define picoquic_tp_address_discovery 0x9f81a176 /* per draft-seemann-quic-address-discovery */
+#define picoquic_tp_enable_fec 0x46ec /* experimental FEC repair frames, see fec.c */
 
 /* Callback for converting binary log to quic log at the end of a connection. 
  * This is kept private for now; and will only be set through the "set quic log"
@@ -600,9 +788,62 @@ typedef int (*picoquic_autoqlog_fn)(picoquic_cnx_t * cnx);
  */
 typedef int (*picoquic_performance_log_fn)(picoquic_quic_t* quic, picoquic_cnx_t* cnx, int should_delete);
 
+/* Hierarchical timer wheel holding the connections sorted by wake time.
+ * Level 0 slots cover about 1ms each; each further level is 256 times
+ * coarser, so four levels span about 50 days. Connections whose wake
+ * time the cursor has passed sit in the due list, connections beyond
+ * the wheel horizon in the overflow list, and connections with no
+ * scheduled wake up (UINT64_MAX) in the idle list. Insertions and
+ * removals are O(1); see the wake list management in quicctx.c.
+ */
+#define PICOQUIC_WAKE_WHEEL_NB_LEVELS 4
+#define PICOQUIC_WAKE_WHEEL_SLOT_BITS 8
+#define PICOQUIC_WAKE_WHEEL_NB_SLOTS (1 << PICOQUIC_WAKE_WHEEL_SLOT_BITS)
+#define PICOQUIC_WAKE_WHEEL_GRANULARITY_BITS 10
+
+typedef struct st_picoquic_cnx_wake_wheel_t {
+    uint64_t wheel_slot; /* time cursor, in units of level 0 slots */
+    struct st_picoquic_cnx_t* slots[PICOQUIC_WAKE_WHEEL_NB_LEVELS][PICOQUIC_WAKE_WHEEL_NB_SLOTS];
+    struct st_picoquic_cnx_t* due_list;
+    struct st_picoquic_cnx_t* overflow_list;
+    struct st_picoquic_cnx_t* idle_list;
+} picoquic_cnx_wake_wheel_t;
+
+/*
+* Pacing uses a set of per path variables:
+* - rate: bytes per second.
+* - evaluation_time: last time the path was evaluated.
+* - bucket_max: maximum value (capacity) of the leaky bucket.
+* - packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
+* Internal variables:
+* - bucket_nanosec: number of nanoseconds of transmission time that are allowed.
+* - packet_time_nanosec: number of nanoseconds required to send a full size packet.
+*/
+typedef struct st_picoquic_pacing_t {
+    uint64_t rate;
+    uint64_t evaluation_time;
+    int64_t bucket_max;
+    uint64_t packet_time_microsec;
+    uint64_t quantum_max;
+    uint64_t rate_max;
+    int bandwidth_pause;
+    /* High precision variables should only be used inside pacing.c */
+    int64_t bucket_nanosec;
+    int64_t packet_time_nanosec;
+} picoquic_pacing_t;
+
 /* QUIC context, defining the tables of connections,
  * open sockets, etc.
  */
+#define PICOQUIC_CNXID_ROUTE_CACHE_SIZE 4
+
+typedef struct st_picoquic_cnxid_route_cache_entry_t {
+    picoquic_connection_id_t cnx_id;
+    struct st_picoquic_cnx_t* cnx;
+    struct st_picoquic_local_cnxid_t* l_cid;
+    uint64_t generation;
+} picoquic_cnxid_route_cache_entry_t;
+
 typedef struct st_picoquic_quic_t {
     void* tls_master_ctx;
     picoquic_stream_data_cb_fn default_callback_fn;
@@ -611,29 +852,106 @@ typedef struct st_picoquic_quic_t {
     picoquic_alpn_select_fn alpn_select_fn;
     uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE];
     uint8_t retry_seed[PICOQUIC_RETRY_SECRET_SIZE];
+    /* Effective ticket and retry token secrets, retained so a hot restart
+     * can hand them to the next process, see picoquic_export_restart_state */
+    uint8_t ticket_crypto_secret[32];
+    uint8_t retry_token_secret[32];
+    unsigned int has_ticket_crypto_secret : 1;
+    unsigned int has_retry_token_secret : 1;
+    uint8_t retry_token_mac_key[16]; /* SipHash key for MAC mode retry tokens, see picoquic_set_mac_retry_tokens */
     uint64_t* p_simulated_time;
+    /* Wall clock cache, refreshed by the packet loops through
+     * picoquic_refresh_quic_time_cache. Once a refresh has happened,
+     * picoquic_get_quic_time returns the cached value instead of
+     * sampling the clock, so its staleness is bounded by the
+     * processing time of the current receive batch. */
+    uint64_t cached_wall_time;
+    unsigned int is_wall_time_cached : 1;
     uint8_t hash_seed[8];
+    /* Prepared material for the accept path: the cipher suite used by
+     * Initial packets and the constant HkdfLabel info blocks for the
+     * "client in" and "server in" secrets, built on first use so that
+     * per-connection key setup only performs the CID dependent extract
+     * and expand steps. */
+    void* initial_cipher_suite; /* ptls_cipher_suite_t* */
+    uint8_t initial_hkdf_info[2][32]; /* [0] client, [1] server */
+    size_t initial_hkdf_info_length[2];
+    /* Deferred server credentials: PEM parsing of the certificate chain and
+     * key is postponed until the first server handshake needs them, so a
+     * multi-tenant process creating many listening contexts does not pay
+     * the parsing cost, or hold the parsed chains, for tenants that never
+     * receive a connection. See picoquic_set_tls_credentials_files. */
+    char* lazy_cert_file_name;
+    char* lazy_key_file_name;
+    unsigned int lazy_credentials_failed : 1;
+    /* Deferred certificate verifier: creating the verifier loads the root
+     * certificate store, which dominates context creation time on some
+     * providers. The root file name is retained here and the verifier is
+     * built when a connection first needs to verify a peer, see
+     * picoquic_tls_ensure_certificate_verifier. */
+    char* cert_root_file_name;
+    unsigned int verifier_pending : 1;
     char const* ticket_file_name;
     char const* token_file_name;
     picoquic_stored_ticket_t * p_first_ticket;
+    uint64_t ticket_memory_budget; /* see picoquic_set_ticket_memory_budget */
+    uint64_t ticket_memory_size; /* bytes currently held in the client ticket store */
+    uint8_t* ticket_store_map; /* indexed ticket store file, mapped read only (heap copy on Windows) */
+    size_t ticket_store_map_size;
+    unsigned int ticket_store_is_mapped : 1; /* 1 if mmap-ed, 0 if heap buffer */
+    picoquic_cc_seed_hints_fn seed_hints_fn; /* see picoquic_set_seed_hints_provider */
+    picoquic_cc_hints_update_fn hints_update_fn;
+    void* seed_hints_ctx;
+    picoquic_version_pref_entry_t* version_pref_cache; /* see picoquic_record_version_preference */
+    picoquic_store_journal_t* store_journal; /* see picoquic_use_store_journal */
     picoquic_stored_token_t * p_first_token;
+    picoquic_stored_token_t** token_hash_bucket; /* hash index by SNI over the stored tokens */
+    size_t token_hash_nb_buckets;
+    size_t token_nb_stored;
+    picoquic_stored_token_t* token_wheel[PICOQUIC_TOKEN_WHEEL_NB_SLOTS]; /* expiry wheel */
+    uint64_t token_wheel_epoch; /* wheel slot sequence number at the last sweep */
     picosplay_tree_t token_reuse_tree; /* detection of token reuse */
     uint8_t local_cnxid_length;
     uint8_t default_stream_priority;
     uint8_t default_datagram_priority;
     uint64_t local_cnxid_ttl; /* Max time to live of Connection ID in microsec, init to "forever" */
     uint32_t mtu_max;
+    uint64_t pacing_wakeups_per_rtt; /* see picoquic_set_pacing_policy, 0 means default quantum rules */
+    uint64_t pacing_burst_ceiling; /* upper bound on pacing quantum in bytes, 0 means no ceiling */
+    uint64_t slow_start_admission_rate; /* Aggregate bytes per second injected by paths still in slow start,
+                                         * see picoquic_set_slow_start_admission_rate; 0 disables the limiter */
+    picoquic_pacing_t slow_start_admission_pacing; /* token bucket shared by all connections for the admission rate */
     uint32_t padding_multiple_default;
     uint32_t padding_minsize_default;
     uint32_t sequence_hole_pseudo_period; /* Optimistic ack defense */
     picoquic_pmtud_policy_enum default_pmtud_policy;
+    unsigned int default_pmtud_sprint : 1;
     picoquic_spinbit_version_enum default_spin_policy;
     picoquic_lossbit_version_enum default_lossbit_policy;
     uint32_t default_multipath_option;
     uint64_t default_handshake_timeout;
+    uint64_t keep_alive_slack; /* Alignment of keep alive wake times in microseconds,
+                                * see picoquic_set_keep_alive_slack; 0 disables coalescing */
+    uint64_t hibernate_delay; /* Microseconds of silence after which an idle connection
+                               * is compacted, see picoquic_set_default_hibernate_delay;
+                               * 0 disables hibernation */
+    uint64_t reassembly_spill_cap; /* Per stream bytes of out of order data kept in memory before
+                                    * spilling to disk, see picoquic_set_reassembly_spill_cap;
+                                    * 0 disables spilling */
+    FILE* spill_file; /* Temporary file holding spilled chunks, opened on first spill */
+    uint64_t spill_file_size;
+    int nb_spill_chunks; /* Outstanding spilled chunks; the file is reset when this drops to 0 */
+    uint64_t stream_memory_total; /* Bytes held in reassembly and send queues, all connections */
+    uint64_t stream_memory_cnx_limit; /* Per connection budget, see picoquic_set_stream_memory_limits */
+    uint64_t stream_memory_quic_limit; /* Context wide budget; 0 means unlimited */
     uint64_t crypto_epoch_length_max; /* Default packet interval between key rotations */
+    uint64_t ticket_issuance_delay; /* Microseconds to hold session tickets after the
+                                     * handshake, spreading a resumption storm; 0 sends
+                                     * them with the handshake completion flight */
     uint32_t max_simultaneous_logs;
     uint32_t current_number_of_open_logs;
+    uint64_t log_sample_one_in_n; /* Trace one connection in N, selected by ICID hash;
+                                   * 0 or 1 traces every connection */
     uint32_t max_half_open_before_retry;
     uint32_t current_number_half_open;
     uint32_t current_number_connections;
@@ -646,6 +964,7 @@ typedef struct st_picoquic_quic_t {
     unsigned int check_token : 1;
     unsigned int force_check_token : 1;
     unsigned int provide_token : 1;
+    unsigned int use_mac_retry_tokens : 1; /* authenticate tokens with keyed SipHash instead of AEAD */
     unsigned int unconditional_cnx_id : 1;
     unsigned int client_zero_share : 1;
     unsigned int server_busy : 1;
@@ -654,6 +973,8 @@ typedef struct st_picoquic_quic_t {
     unsigned int should_close_log : 1;
     unsigned int enable_sslkeylog : 1; /* Enable the SSLKEYLOG feature */
     unsigned int use_unique_log_names : 1; /* Add 64 bit random number to log names for uniqueness */
+    unsigned int use_binlog_mmap : 1; /* Write binary logs through a memory mapping, see picoquic_set_binlog_mmap */
+    unsigned int use_binlog_v2 : 1; /* Write v2 binary logs with delta encoded fields, see picoquic_set_binlog_v2 */
     unsigned int dont_coalesce_init : 1; /* test option to turn of packet coalescing on server */
     unsigned int one_way_grease_quic_bit : 1; /* Grease of QUIC bit, but do not announce support */
     unsigned int random_initial : 2; /* Randomize the initial PN number */
@@ -661,21 +982,30 @@ typedef struct st_picoquic_quic_t {
     unsigned int use_constant_challenges : 1; /* Use predictable challenges when producing constant logs. */
     unsigned int use_low_memory : 1; /* if possible, use low memory alternatives, e.g. for AES */
     unsigned int is_preemptive_repeat_enabled : 1; /* enable premptive repeat on new connections */
+    unsigned int is_ack_coalescing_enabled : 1; /* enable ACK coalescing on new connections */
     unsigned int default_send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
+    unsigned int default_fec_enabled : 1; /* negotiate FEC repair frames on new connections */
     unsigned int enforce_client_only : 1; /* Do not authorize incoming connections */
     unsigned int test_large_server_flight : 1; /* Use TP to ensure server flight is at least 8K */
     unsigned int is_port_blocking_disabled : 1; /* Do not check client port on incoming connections */
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks by default */
     unsigned int use_predictable_random : 1; /* For logging tests */
+    unsigned int use_async_handshake : 1; /* Offload certificate signing to the crypto worker pool */
     picoquic_stateless_packet_t* pending_stateless_packet;
 
     picoquic_congestion_algorithm_t const* default_congestion_alg;
+    picoquic_congestion_algorithm_t const* cc_experiment_alg; /* A/B experiment arm, see picoquic_set_cc_experiment */
+    char const* cc_experiment_option_string; /* option string applied to connections in the experiment arm */
+    uint8_t cc_experiment_share; /* share of connections, out of 256, assigned to the experiment arm */
     uint64_t wifi_shadow_rtt;
     double bbr_quantum_ratio;
 
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
-    picosplay_tree_t cnx_wake_tree;
+    picoquic_cnx_wake_wheel_t cnx_wake_wheel;
+    /* Connections collected for the current send scheduling round,
+     * see picoquic_sched_round_collect() */
+    struct st_picoquic_cnx_t* sched_round_first;
 
     struct st_picoquic_cnx_t* cnx_in_progress;
 
@@ -693,17 +1023,83 @@ typedef struct st_picoquic_quic_t {
     int nb_packets_in_pool;
     int nb_packets_allocated;
     int nb_packets_allocated_max;
+    int packet_pool_low_watermark; /* Packets kept hot when trimming, see picoquic_set_packet_pool_watermarks */
+    int packet_pool_high_watermark; /* Trimming starts when the pool stays above this; 0 disables */
+    uint64_t packet_pool_trim_delay; /* Microseconds above the high watermark before trimming */
+    uint64_t packet_pool_above_high_since; /* Time the pool first exceeded the high watermark, or 0 */
+    /* Optional shared backing pool. When set, the per context free list
+     * above acts as a lock free cache of at most packet_cache_target
+     * entries, refilled and flushed in batches against the shared pool.
+     * See picoquic_attach_packet_pool. */
+    struct st_picoquic_shared_packet_pool_t* shared_packet_pool;
+    int packet_cache_target;
+    /* When several contexts serve the same port, token reuse detection
+     * goes through a shared registry. See picoquic_attach_token_registry. */
+    struct st_picoquic_shared_token_registry_t* shared_token_registry;
+
+    /* Free lists of packet payload buffers, full size for formatting and
+     * small for retained copies of short packets. See picoquic_packet_payload_alloc. */
+    uint8_t* p_first_payload_full;
+    uint8_t* p_first_payload_small;
+    int nb_payload_full_in_pool;
+    int nb_payload_small_in_pool;
 
     picoquic_stream_data_node_t* p_first_data_node;
+    picoquic_stream_data_node_t* p_delivery_node; /* Node being delivered to the application,
+                                                   * valid during the stream data callback only */
+    picoquic_stream_data_slab_t* p_first_data_slab;
     int nb_data_nodes_in_pool;
     int nb_data_nodes_allocated;
     int nb_data_nodes_allocated_max;
+    /* Size class pools for send queue data buffers,
+     * see picoquic_stream_buffer_alloc */
+    uint8_t* stream_buffer_pool[PICOQUIC_STREAM_BUFFER_NB_CLASSES];
+    int nb_stream_buffers_in_pool[PICOQUIC_STREAM_BUFFER_NB_CLASSES];
+
+    /* Pool of recycled TLS context wrappers, see picoquic_tlscontext_create.
+     * The type is private to tls_api.c. */
+    void* p_first_tls_ctx;
+    int nb_tls_ctx_in_pool;
+
+    /* Small route cache of the last connections matched by CID,
+     * bypassing the hash table lookup on the 1-RTT receive path. A GRO
+     * burst from a handful of connections hits the cache after the
+     * first packet of each. Entries are validated against the cache
+     * generation, which is bumped whenever a connection or a local CID
+     * is deleted, so no per entry invalidation is needed. */
+    picoquic_cnxid_route_cache_entry_t cnxid_route_cache[PICOQUIC_CNXID_ROUTE_CACHE_SIZE];
+    uint64_t cnxid_route_generation;
+    unsigned int cnxid_route_rank;
 
     picoquic_connection_id_cb_fn cnx_id_callback_fn;
     void* cnx_id_callback_ctx;
 
+    picoquic_shard_reroute_fn shard_reroute_fn;
+    void* shard_reroute_ctx;
+
+    struct st_picoquic_crypto_worker_pool_t* crypto_pool;
+    size_t deferred_copy_min_size; /* if not zero, picoquic_add_to_stream copies
+                                    * submissions of at least that size on the
+                                    * crypto worker pool instead of inline */
+
     void* aead_encrypt_ticket_ctx;
     void* aead_decrypt_ticket_ctx;
+    /* Dedicated retry token contexts, set from a shared key so an external
+     * retry service can issue tokens that this server validates. When NULL,
+     * tokens use the ticket contexts as before.
+     * See picoquic_set_retry_token_key. */
+    void* aead_encrypt_retry_token_ctx;
+    void* aead_decrypt_retry_token_ctx;
+    /* Small LRU cache of decrypted session tickets, so a resumption storm
+     * of retried, byte identical tickets does not pay the AEAD decryption
+     * per attempt. See picoquic_server_encrypt_ticket_call_back. */
+    picoquic_ticket_cache_entry_t ticket_cache[PICOQUIC_TICKET_CACHE_NB_ENTRIES];
+    uint64_t ticket_cache_use_count;
+    uint8_t ticket_cache_hash_key[16];
+    /* ChaCha20 DRBG state for picoquic_fast_random, see tls_api.c */
+    uint8_t fast_random_key[32];
+    uint64_t fast_random_block;
+    uint64_t fast_random_remaining;
     void ** retry_integrity_sign_ctx;
     void ** retry_integrity_verify_ctx;
 
@@ -711,6 +1107,17 @@ typedef struct st_picoquic_quic_t {
     picoquic_free_verify_certificate_ctx free_verify_certificate_callback_fn;
 
     picoquic_tp_t default_tp;
+    /* Preserialized prefix of the transport parameter encoding, covering the
+     * leading run of parameters that depend only on the picoquic_tp_t values.
+     * The cache is keyed on tp_prefix_cache_tp and rebuilt lazily whenever a
+     * connection encodes with different local parameters, so per connection
+     * overrides simply bypass it. */
+    uint8_t* tp_prefix_cache;
+    size_t tp_prefix_cache_length;
+    picoquic_tp_t tp_prefix_cache_tp;
+    /* Memoized layout of the last transport parameter encoding received from
+     * a peer, see picoquic_receive_transport_extensions. */
+    struct st_picoquic_tp_layout_cache_t* tp_layout_cache;
 
     picoquic_fuzz_fn fuzz_fn;
     void* fuzz_ctx;
@@ -729,6 +1136,13 @@ typedef struct st_picoquic_quic_t {
     /* Logging APIS */
     void* F_log;
     char* binlog_dir;
+    /* When set, binlog events are queued on a fixed size ring and
+     * written to disk by a dedicated thread instead of the loop thread.
+     * See picoquic_set_binlog_thread. */
+    struct st_picoquic_binlog_ring_t* binlog_ring;
+    /* In memory flight recorder holding the last N binlog events, dumped
+     * on demand. See picoquic_set_flight_recorder. */
+    struct st_picoquic_binlog_fr_t* binlog_fr;
     char* qlog_dir;
     picoquic_autoqlog_fn autoqlog_fn;
     struct st_picoquic_unified_logging_t* text_log_fns;
@@ -736,6 +1150,8 @@ typedef struct st_picoquic_quic_t {
     struct st_picoquic_unified_logging_t* qlog_fns;
     picoquic_performance_log_fn perflog_fn;
     void* v_perflog_ctx;
+    void* v_perf_export_ctx; /* shared memory counter export, see perf_export.h */
+    void* v_close_log_ctx; /* per connection close record log, see close_log.h */
 
 #ifdef BBRExperiment
     bbr_exp bbr_exp_flags;
@@ -757,7 +1173,6 @@ void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time
  */
 
 typedef struct st_picoquic_sack_item_t {
-    picosplay_node_t node;
     uint64_t start_of_sack_range;
     uint64_t end_of_sack_range;
     uint64_t time_created;
@@ -768,8 +1183,19 @@ typedef struct st_picoquic_sack_range_count_t {
     int range_counts[PICOQUIC_MAX_ACK_RANGE_REPEAT];
 } picoquic_sack_range_count_t;
 
+/* The ranges are kept in an array sorted by range start, so both the
+ * update on packet arrival and the ACK frame encoding walk contiguous
+ * memory. The array is double ended: items[start_rank] is the lowest
+ * range, so removing the front range -- the common case when an ACK of
+ * ACK or the ack horizon retires old ranges -- only advances start_rank.
+ * Insertions and middle removals shift the tail of the array; the item
+ * count stays small because coalescing merges adjacent ranges. The
+ * front slack is reclaimed before the allocation is grown. */
 typedef struct st_picoquic_sack_list_t {
-    picosplay_tree_t ack_tree;
+    picoquic_sack_item_t* items;
+    size_t start_rank;
+    size_t nb_items;
+    size_t nb_alloc;
     uint64_t ack_horizon;
     int64_t horizon_delay;
     picoquic_sack_range_count_t rc[2];
@@ -798,8 +1224,20 @@ typedef struct st_picoquic_sack_list_t {
  * The stream structure holds a variety of parameters about the state of the stream.
  */
 
+/* Reassembly spill records, see picoquic_set_reassembly_spill_cap. Once a
+ * stream holds more than the configured amount of out of order data in
+ * memory, further chunks are written to a temporary file and only these
+ * small records stay in memory, sorted by stream offset. */
+typedef struct st_picoquic_spill_chunk_t {
+    struct st_picoquic_spill_chunk_t* next;
+    uint64_t stream_offset;
+    uint64_t file_offset;
+    size_t length;
+} picoquic_spill_chunk_t;
+
 typedef struct st_picoquic_stream_head_t {
     picosplay_node_t stream_node; /* splay of streams in connection context */
+    picohash_item hash_item; /* entry in the per-connection stream id table */
     struct st_picoquic_stream_head_t * next_output_stream; /* link in the list of output streams */
     struct st_picoquic_stream_head_t * previous_output_stream;
     picoquic_cnx_t * cnx;
@@ -815,7 +1253,11 @@ typedef struct st_picoquic_stream_head_t {
     uint64_t local_stop_error;
     uint64_t remote_stop_error;
     uint64_t last_time_data_sent;
-    picosplay_tree_t stream_data_tree; /* splay of received stream segments */
+    uint64_t creation_time; /* Stream creation time, anchor of the stream lifecycle metrics */
+    uint64_t first_send_time; /* Time the first STREAM frame was sent, 0 until then */
+    picoquic_stream_data_index_t stream_data_tree; /* index of received stream segments */
+    uint64_t bytes_in_reassembly; /* Sum of the chunk lengths held in stream_data_tree */
+    picoquic_spill_chunk_t* first_spill_chunk; /* Out of order chunks spilled to disk, sorted by offset */
     uint64_t sent_offset; /* Amount of data sent in the stream */
     picoquic_stream_queue_node_t* send_queue; /* if the stream is not "active", list of data segments ready to send */
     void * app_stream_ctx;
@@ -824,6 +1266,19 @@ typedef struct st_picoquic_stream_head_t {
     picoquic_sack_list_t sack_list; /* Track which parts of the stream were acknowledged by the peer */
     /* Stream priority -- lowest is most urgent */
     uint8_t stream_priority;
+    /* Weighted fair queuing state, used when the connection scheduler is
+     * picoquic_stream_scheduler_wfq. Weight 0 is treated as weight 1. */
+    uint64_t wfq_weight;
+    uint64_t wfq_finish_tag; /* virtual finish time of the last byte sent */
+    /* Maximum queueing delay of submitted data in microseconds, 0 if none.
+     * Chunks that expire before transmission starts are silently discarded,
+     * see picoquic_set_stream_deadline. */
+    uint64_t stream_deadline;
+    /* Corking of small writes, see picoquic_set_stream_cork_delay. While
+     * "cork_time" is in the future, queued data is withheld from the
+     * scheduler so successive small writes coalesce into one frame. */
+    uint64_t cork_delay;
+    uint64_t cork_time;
     /* Flags describing the state of the stream */
     unsigned int is_active : 1; /* The application is actively managing data sending through callbacks */
     unsigned int fin_requested : 1; /* Application has requested Fin of sending stream */
@@ -842,8 +1297,11 @@ typedef struct st_picoquic_stream_head_t {
     unsigned int max_stream_updated : 1; /* After stream was closed in both directions, the max stream id number was updated */
     unsigned int stream_data_blocked_sent : 1; /* If stream_data_blocked has been sent to peer, and no data sent on stream since */
     unsigned int is_output_stream : 1; /* If stream is listed in the output list */
+    unsigned int is_output_parked : 1; /* If stream is parked out of the output list while blocked by stream flow control */
     unsigned int is_closed : 1; /* Stream is closed, closure is accouted for */
     unsigned int is_discarded : 1; /* There should be no more callback for that stream, the application has discarded it */
+    unsigned int no_retransmit : 1; /* Lost stream frames are never repeated, see picoquic_mark_no_retransmit_stream */
+    unsigned int is_fec_protected : 1; /* Stream data is covered by FEC repair frames, see picoquic_set_stream_fec */
 } picoquic_stream_head_t;
 
 #define IS_CLIENT_STREAM_ID(id) (unsigned int)(((id) & 1) == 0)
@@ -883,6 +1341,10 @@ typedef struct st_picoquic_misc_frame_header_t {
 * resending of packets.
 */
 
+/* Number of 64 bit words in the retransmitted packet bitmap, i.e. a
+ * sliding window of 1024 packet numbers. */
+#define PICOQUIC_RETRANSMITTED_MAP_NB_WORDS 16
+
 typedef struct st_picoquic_packet_context_t {
     uint64_t send_sequence; /* picoquic_decode_ack_frame */
     uint64_t next_sequence_hole;
@@ -897,6 +1359,16 @@ typedef struct st_picoquic_packet_context_t {
     picoquic_packet_t* preemptive_repeat_ptr;
     /* monitor size of queues */
     uint64_t retransmitted_queue_size;
+    /* Packet number indexed bitmap over the retransmitted queue, see
+     * picoquic_retransmitted_map_set. A bit is set while the packet
+     * with that number sits in the queue, so the ACK decoder can skip
+     * the spurious retransmission scan for ranges that contain no
+     * retransmitted packet. Queued packets whose number fell below the
+     * sliding window are counted in retransmitted_unmapped, which
+     * forces the scan until they are pruned. */
+    uint64_t retransmitted_map[PICOQUIC_RETRANSMITTED_MAP_NB_WORDS];
+    uint64_t retransmitted_map_base; /* packet number of bit 0 */
+    uint64_t retransmitted_unmapped;
     /* ECN Counters */
     uint64_t ecn_ect0_total_remote;
     uint64_t ecn_ect1_total_remote;
@@ -994,29 +1466,6 @@ typedef struct st_picoquic_remote_cnxid_stash_t {
     unsigned int is_in_use : 1;
 } picoquic_remote_cnxid_stash_t;
 
-/*
-* Pacing uses a set of per path variables:
-* - rate: bytes per second.
-* - evaluation_time: last time the path was evaluated.
-* - bucket_max: maximum value (capacity) of the leaky bucket.
-* - packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
-* Internal variables:
-* - bucket_nanosec: number of nanoseconds of transmission time that are allowed.
-* - packet_time_nanosec: number of nanoseconds required to send a full size packet.
-*/
-typedef struct st_picoquic_pacing_t {
-    uint64_t rate;
-    uint64_t evaluation_time;
-    int64_t bucket_max;
-    uint64_t packet_time_microsec;
-    uint64_t quantum_max;
-    uint64_t rate_max;
-    int bandwidth_pause;
-    /* High precision variables should only be used inside pacing.c */
-    int64_t bucket_nanosec;
-    int64_t packet_time_nanosec;
-} picoquic_pacing_t;
-
 /*
 * Per path context.
 * Path contexts are created:
@@ -1038,8 +1487,16 @@ typedef struct st_picoquic_pacing_t {
 * Packet numbering is global, see packet context.
 */
 typedef struct st_picoquic_path_t {
-    picoquic_local_cnxid_t* p_local_cnxid; 
+    picoquic_local_cnxid_t* p_local_cnxid;
     picoquic_remote_cnxid_t* p_remote_cnxid;
+    /* Preformatted short header template: flags placeholder followed by
+     * the destination CID bytes, rebuilt when the remote CID in use
+     * changes. Per packet header work is then a short memcpy plus the
+     * flags byte and packet number. */
+    uint8_t short_header_template[1 + PICOQUIC_CONNECTION_ID_MAX_SIZE];
+    size_t short_header_template_length;
+    const picoquic_remote_cnxid_t* short_header_template_cnxid;
+    uint64_t short_header_template_sequence;
     struct sockaddr_storage registered_peer_addr;
     picohash_item net_id_hash_item;
     struct st_picoquic_cnx_t* cnx;
@@ -1102,6 +1559,8 @@ typedef struct st_picoquic_path_t {
     unsigned int path_cid_rotated : 1;
     unsigned int path_is_preferred_path : 1;
     unsigned int is_nat_challenge : 1;
+    unsigned int is_optimistic_send_allowed : 1; /* NAT port rebinding: keep sending under the
+                                                  * amplification limit while validation runs */
     unsigned int is_cc_data_updated : 1;
     unsigned int is_multipath_probe_needed : 1;
     unsigned int was_local_cnxid_retired : 1;
@@ -1148,6 +1607,9 @@ typedef struct st_picoquic_path_t {
     uint64_t max_spurious_rtt;
     uint64_t max_reorder_delay;
     uint64_t max_reorder_gap;
+    uint64_t reorder_pkt_threshold; /* Adaptive RACK packet threshold, raised when spurious
+                                     * retransmits reveal deeper reordering on the path */
+    uint64_t reorder_time_extra; /* Extra RACK delay in microseconds learned the same way */
     uint64_t latest_sent_time;
     uint64_t rtt_packet_previous_period;
     uint64_t rtt_time_previous_period;
@@ -1155,11 +1617,21 @@ typedef struct st_picoquic_path_t {
     uint64_t sum_rtt_estimate_in_period;
     uint64_t max_rtt_estimate_in_period;
     uint64_t min_rtt_estimate_in_period;
+    uint64_t nb_rtt_outliers; /* Samples rejected by the spike filter in picoquic_update_path_rtt */
+    unsigned int nb_rtt_outliers_consecutive; /* Consecutive rejected samples; a persistent excess is
+                                               * accepted as a real RTT shift */
+    uint32_t rtt_histogram[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS]; /* HDR style log-linear counts of raw RTT
+                                                                * samples, see picoquic_get_path_rtt_histogram */
+    uint64_t spin_edge_time; /* Time of the last observed incoming spin bit edge, used to
+                              * derive RTT samples for the observer set by
+                              * picoquic_set_rtt_observer. Zero until the first edge. */
 
 
     /* MTU */
     size_t send_mtu;
     size_t send_mtu_max_tried;
+    size_t send_mtu_sprint_low; /* smallest probe size sent in the current sprint round */
+    uint64_t nb_mtu_probes_in_flight; /* outstanding probes; larger than 1 only in sprint mode */
 
     /* Bandwidth measurement */
     uint64_t delivered; /* The total amount of data delivered so far on the path */
@@ -1170,6 +1642,9 @@ typedef struct st_picoquic_path_t {
     uint64_t delivered_last_packet;
     uint64_t bandwidth_estimate; /* In bytes per second */
     uint64_t bandwidth_estimate_max; /* Maximum of bandwidth estimate over life of path */
+    uint64_t delivery_rate_latest; /* Last per-ACK sample from the shared sampler, see picoquic_cc_delivery_rate_sample */
+    uint64_t delivery_rate_max; /* Max non app-limited sample over life of path */
+    unsigned int delivery_rate_app_limited : 1; /* Last sample was taken while application limited */
     uint64_t max_sample_acked_time; /* Time max sample was delivered */
     uint64_t max_sample_sent_time; /* Time max sample was sent */
     uint64_t max_sample_delivered; /* Delivered value at time of max sample */
@@ -1216,6 +1691,12 @@ typedef struct st_picoquic_path_t {
     uint64_t receive_rate_threshold_low;
     uint64_t receive_rate_threshold_high;
 
+    /* Live tuning clamps, see picoquic_set_path_cwin_clamp and
+     * picoquic_set_path_pacing_rate_clamp. Both default to UINT64_MAX,
+     * meaning no clamp. */
+    uint64_t cwin_clamp; /* bound on bytes in transit for the path */
+    uint64_t pacing_rate_clamp; /* bound on the pacing rate, bytes per second */
+
     /* BDP parameters sent by the server to be stored at client */
     uint64_t rtt_min_remote;
     uint64_t cwin_remote;
@@ -1237,25 +1718,86 @@ typedef struct st_picoquic_crypto_context_t {
     void* pn_dec; /* Used for PN decryption */
 } picoquic_crypto_context_t;
 
+/* Tuning request posted by a monitoring thread and applied by the
+ * thread that runs the connection on its next packet preparation pass,
+ * see picoquic_set_path_cwin_clamp. The posting thread fills the record
+ * then bumps the sequence number; the connection thread applies the
+ * record whenever the sequence differs from the last one it applied. */
+typedef struct st_picoquic_cc_tuning_t {
+    volatile uint64_t seq; /* bumped by the posting thread after filling the record */
+    uint64_t applied_seq; /* last sequence applied by the connection thread */
+    uint64_t unique_path_id;
+    uint64_t value;
+} picoquic_cc_tuning_t;
+
+/* Forward erasure correction (FEC) state. The sender accumulates the
+ * XOR of the plaintext payloads of protected 1-RTT packets and queues
+ * a repair frame once enough source symbols are gathered; the receiver
+ * keeps a small ring of recently received payloads so that a single
+ * lost packet of a block can be recovered from the repair symbol
+ * without waiting for a retransmission. Only packets whose payload
+ * fits in PICOQUIC_FEC_SYMBOL_SIZE are protected, since the repair
+ * symbol itself must fit in a packet of the same path MTU. */
+#define PICOQUIC_FEC_SYMBOL_SIZE 1120
+#define PICOQUIC_FEC_NB_RECEIVE_SLOTS 32
+#define PICOQUIC_FEC_BLOCK_MIN 4
+#define PICOQUIC_FEC_BLOCK_MAX 32
+#define PICOQUIC_FEC_BLOCK_DEFAULT 16
+#define PICOQUIC_FEC_SPAN_MAX 62
+
+typedef struct st_picoquic_fec_sender_t {
+    uint64_t block_id;
+    uint64_t first_pn; /* packet number mapped to bit 0 of pn_mask */
+    uint64_t pn_mask; /* bit i set: packet first_pn + i is part of the block */
+    uint64_t nb_source; /* number of source symbols accumulated so far */
+    size_t symbol_length; /* length of the longest accumulated payload */
+    uint8_t symbol[PICOQUIC_FEC_SYMBOL_SIZE];
+} picoquic_fec_sender_t;
+
+typedef struct st_picoquic_fec_receive_slot_t {
+    uint64_t pn;
+    int is_valid;
+    size_t length;
+    uint8_t payload[PICOQUIC_FEC_SYMBOL_SIZE];
+} picoquic_fec_receive_slot_t;
+
+typedef struct st_picoquic_fec_receiver_t {
+    uint64_t nb_recovered;
+    picoquic_fec_receive_slot_t slot[PICOQUIC_FEC_NB_RECEIVE_SLOTS];
+} picoquic_fec_receiver_t;
+
 /*
 * Per connection context.
 */
 typedef struct st_picoquic_cnx_t {
+    /* Hot send path block. The scheduler and the per packet send loop
+     * touch these fields and the flags below on every train; keeping
+     * them in the first cache lines reduces misses in
+     * picoquic_prepare_next_packet_ex. The layout assertions after the
+     * struct keep future additions from pushing them down; new hot
+     * fields go here, everything else goes after the cold tail marker. */
     picoquic_quic_t* quic;
-
-    /* Management of context retrieval tables */
-
-    struct st_picoquic_cnx_t* next_in_table;
-    struct st_picoquic_cnx_t* previous_in_table;
-
-    /* Proposed version, may be zero if there is no reference.
-     * Rejected version that triggered reception of a Version negotiation packet, zero by default.
-     * Desired version, target of possible compatible negotiation.
-     */
-    uint32_t proposed_version;
-    uint32_t rejected_version;
-    uint32_t desired_version;
-    int version_index;
+    /* Next time sending data is expected */
+    uint64_t next_wake_time;
+    picoquic_state_enum cnx_state;
+    /* Chaining in the timer wheel bucket; cnx_wake_bucket points to the
+     * head pointer of the bucket holding this connection, or is NULL if
+     * the connection is not in the wheel. */
+    struct st_picoquic_cnx_t* cnx_wake_next;
+    struct st_picoquic_cnx_t* cnx_wake_previous;
+    struct st_picoquic_cnx_t** cnx_wake_bucket;
+    /* Chaining in the send scheduling round; a connection on the round
+     * list has been taken out of the timer wheel and will be served one
+     * send train before any connection of the round is served twice. */
+    struct st_picoquic_cnx_t* cnx_sched_next;
+    struct st_picoquic_cnx_t* cnx_sched_previous;
+    /* Management of paths; path[0] is the default path */
+    picoquic_path_t ** path;
+    int nb_paths;
+    int nb_path_alloc;
+    /* Call back function and context */
+    picoquic_stream_data_cb_fn callback_fn;
+    void* callback_ctx;
 
     /* Series of flags showing the state or choices of the connection */
     unsigned int is_0RTT_accepted : 1; /* whether 0-RTT is accepted */
@@ -1301,6 +1843,8 @@ typedef struct st_picoquic_cnx_t {
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks */
     unsigned int is_sending_large_buffer : 1; /* Buffer provided by application is sufficient for PMTUD */
     unsigned int is_preemptive_repeat_enabled : 1; /* Preemptive repat of packets to reduce transaction latency */
+    unsigned int is_ack_coalescing_enabled : 1; /* Bundle pending ACK state into outgoing data packets */
+    unsigned int is_hystart_pp_enabled : 1; /* Use HyStart++ slow start exit, see picoquic_set_congestion_algorithm_ex */
     unsigned int do_version_negotiation : 1; /* Whether compatible version negotiation is activated */
     unsigned int send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
     unsigned int cwin_notified_from_seed : 1; /* cwin was reset from a seeded value */
@@ -1311,11 +1855,37 @@ typedef struct st_picoquic_cnx_t {
     unsigned int is_forced_probe_up_required : 1; /* application wants "probe up" if CC requests it */
     unsigned int is_address_discovery_provider : 1; /* send the address discovery extension */
     unsigned int is_address_discovery_receiver : 1; /* receive the address discovery extension */
-    
+    unsigned int is_hibernated : 1; /* Idle connection was compacted, see picoquic_cnx_hibernate */
+    unsigned int is_memory_pressure_signaled : 1; /* Memory pressure callback fired, not yet rearmed */
+    unsigned int is_fec_enabled : 1; /* FEC repair frames have been negotiated */
+    unsigned int fec_protect_pending : 1; /* Next 1-RTT packet carries protected stream data */
+    unsigned int is_cc_experiment_arm : 1; /* Connection assigned to the CC experiment arm, see picoquic_set_cc_experiment */
+    unsigned int is_log_forced : 1; /* Trace this connection even if log sampling would skip it, see picoquic_cnx_set_qlog */
+
+    /* --- Cold tail: configuration, handshake and rarely touched state --- */
+
+    /* Management of context retrieval tables */
+    struct st_picoquic_cnx_t* next_in_table;
+    struct st_picoquic_cnx_t* previous_in_table;
+
+    /* Proposed version, may be zero if there is no reference.
+     * Rejected version that triggered reception of a Version negotiation packet, zero by default.
+     * Desired version, target of possible compatible negotiation.
+     */
+    uint32_t proposed_version;
+    uint32_t rejected_version;
+    uint32_t desired_version;
+    int version_index;
+
     /* PMTUD policy */
     picoquic_pmtud_policy_enum pmtud_policy;
+    unsigned int is_pmtud_sprint_enabled : 1; /* probe several sizes per RTT, see picoquic_cnx_set_pmtud_sprint */
+    size_t expected_path_mtu; /* seeded link MTU, first probe target, see picoquic_seed_expected_pmtu */
     /* Spin bit policy */
     picoquic_spinbit_version_enum spin_policy;
+    /* RTT observer, see picoquic_set_rtt_observer */
+    picoquic_rtt_observer_fn rtt_observer_fn;
+    void* v_rtt_observer_ctx;
     /* Idle timeout in microseconds */
     uint64_t idle_timeout;
     /* Local and remote parameters */
@@ -1336,6 +1906,9 @@ typedef struct st_picoquic_cnx_t {
      */
     uint64_t issued_ticket_id;
     uint64_t resumed_ticket_id;
+    /* Earliest time the 1-RTT crypto stream carrying a session ticket
+     * may be scheduled, or zero; see picoquic_set_ticket_issuance_delay */
+    uint64_t ticket_send_time;
 
     /* On clients, document the SNI and ALPN expected from the server */
     /* TODO: there may be a need to propose multiple ALPN */
@@ -1343,12 +1916,7 @@ typedef struct st_picoquic_cnx_t {
     char const* alpn;
     /* On clients, receives the maximum 0RTT size accepted by server */
     size_t max_early_data_size;
-    /* Call back function and context */
-    picoquic_stream_data_cb_fn callback_fn;
-    void* callback_ctx;
-
-    /* connection state, ID, etc. Todo: allow for multiple cnxid */
-    picoquic_state_enum cnx_state;
+    /* connection IDs. Todo: allow for multiple cnxid */
     picoquic_connection_id_t initial_cnxid;
     picoquic_connection_id_t original_cnxid;
     struct sockaddr_storage registered_icid_addr;
@@ -1356,6 +1924,12 @@ typedef struct st_picoquic_cnx_t {
     struct sockaddr_storage registered_secret_addr;
     uint8_t registered_reset_secret[PICOQUIC_RESET_SECRET_SIZE];
     picohash_item registered_reset_secret_item;
+    /* Cache of recently validated peer addresses. When a NAT flaps between
+     * a small set of ports, migrating back to an address that completed
+     * path validation recently does not need another challenge round trip.
+     * Slots are recycled oldest first. */
+    struct sockaddr_storage validated_addr[PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE];
+    uint64_t validated_addr_time[PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE];
 
     uint64_t start_time;
     int64_t phase_delay;
@@ -1368,11 +1942,11 @@ typedef struct st_picoquic_cnx_t {
     uint16_t retry_token_length;
     uint8_t * retry_token;
 
-    /* Next time sending data is expected */
-    uint64_t next_wake_time;
-    picosplay_node_t cnx_wake_node;
     /* Wakeup time requested by the application */
     uint64_t app_wake_time;
+    /* Target sending rate declared by the application in bytes per second,
+     * 0 if none; used to gate bandwidth probes, see picoquic_set_app_target_rate */
+    uint64_t app_target_rate;
     /* TLS context, TLS Send Buffer, streams, epochs */
     void* tls_ctx;
     uint64_t crypto_epoch_length_max;
@@ -1385,6 +1959,7 @@ typedef struct st_picoquic_cnx_t {
     picoquic_crypto_context_t crypto_context[PICOQUIC_NUMBER_OF_EPOCHS]; /* Encryption and decryption objects */
     picoquic_crypto_context_t crypto_context_old; /* Old encryption and decryption context after key rotation */
     picoquic_crypto_context_t crypto_context_new; /* New encryption and decryption context just before key rotation */
+    volatile int key_rotation_precompute_pending; /* a crypto pool worker is filling crypto_context_new, see picoquic_precompute_rotated_keys */
     uint64_t crypto_failure_count;
     /* Liveness detection */
     uint64_t latest_progress_time; /* last local time at which the connection progressed */
@@ -1417,12 +1992,34 @@ typedef struct st_picoquic_cnx_t {
     uint64_t nb_spurious;
     uint64_t nb_crypto_key_rotations;
     uint64_t nb_packet_holes_inserted;
+    /* Stream lifecycle timing histograms, same log-linear bucket geometry
+     * as the RTT histogram; see picoquic_get_stream_time_histogram. */
+    uint32_t stream_ttfb_histogram[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS];
+    uint32_t stream_completion_histogram[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS];
     uint64_t max_ack_delay_remote;
     uint64_t max_ack_gap_remote;
     uint64_t max_ack_delay_local;
     uint64_t max_ack_gap_local;
     uint64_t min_ack_delay_remote;
     uint64_t min_ack_delay_local;
+    /* Statistics snapshot published under a sequence lock for monitoring
+     * threads, see picoquic_get_cnx_stats. The sequence number is odd
+     * while the snapshot is being rewritten. */
+    volatile uint64_t stats_seq;
+    picoquic_cnx_stats_t stats_snapshot;
+    /* Per path congestion state published under the same sequence lock,
+     * see picoquic_get_path_cc_state, and pending tuning requests
+     * posted by monitoring threads. */
+    picoquic_path_cc_state_t cc_snapshot[PICOQUIC_NB_PATH_TARGET];
+    int nb_cc_snapshot;
+    /* Slot assigned to the connection in the shared memory counter
+     * export, NULL until the first snapshot is published there. */
+    struct st_picoquic_perf_export_slot_t* perf_export_slot;
+    picoquic_cc_tuning_t cwin_clamp_tuning;
+    picoquic_cc_tuning_t pacing_rate_clamp_tuning;
+    /* FEC state, allocated on first use when the extension is negotiated */
+    picoquic_fec_sender_t* fec_sender;
+    picoquic_fec_receiver_t* fec_receiver;
     unsigned int cwin_blocked : 1;
     unsigned int flow_blocked : 1;
     unsigned int stream_blocked : 1;
@@ -1461,18 +2058,39 @@ typedef struct st_picoquic_cnx_t {
     picoquic_misc_frame_header_t* first_misc_frame;
     picoquic_misc_frame_header_t* last_misc_frame;
 
-    /* Management of streams */
+    /* Arena backing stream heads and local CID structures, with per type
+     * free lists for reuse during the connection lifetime. Released
+     * wholesale in picoquic_delete_cnx. */
+    uint64_t stream_memory; /* Bytes held in this connection's reassembly and send queues */
+    picoquic_cnx_arena_block_t* arena_first_block;
+    picoquic_stream_head_t* arena_free_streams;
+    struct st_picoquic_local_cnxid_t* arena_free_local_cnxid;
+    picoquic_stream_queue_node_t* arena_free_stream_queue;
+
+    /* Management of streams. The hash table resolves stream ids to
+     * stream heads in one probe; the splay tree is kept for ordered
+     * iteration over the streams. */
+    picohash_table* table_stream_by_id;
     picosplay_tree_t stream_tree;
     picoquic_stream_head_t * first_output_stream;
     picoquic_stream_head_t * last_output_stream;
+    picoquic_stream_head_t * first_parked_stream; /* streams blocked by stream flow control, see picoquic_park_output_stream */
     uint64_t high_priority_stream_id;
+    picoquic_stream_scheduler_enum stream_scheduler; /* discipline inside a priority level, see picoquic_set_stream_scheduler */
+    picoquic_multipath_scheduler_enum multipath_scheduler; /* path preference for data packets, see picoquic_set_multipath_scheduler */
+    uint64_t wfq_virtual_time; /* virtual clock of the WFQ scheduler */
+    /* Number of packets the ready sender may still prepare on the fast
+     * path before running a full scheduling pass; armed by the full pass
+     * when no control work is pending, see picoquic_prepare_packet_ready. */
+    uint64_t simple_send_countdown;
+    uint64_t next_cork_time; /* earliest expiry among corked streams, 0 if none */
     uint64_t next_stream_id[4];
     uint64_t priority_limit_for_bypass; /* Bypass CC if dtagram or stream priority lower than this, 0 means never */
     picoquic_pacing_t priority_bypass_pacing;
 
     /* Repeat queue contains packets with data frames that should be
      * sent according to priority when congestion window opens. */
-    picosplay_tree_t queue_data_repeat_tree;
+    picoquic_packet_t* queue_data_repeat_first; /* pairing heap of packets queued for data repeat */
 
     /* Management of datagram queue (see also active datagram flag)
      * The "conflict" count indicates how many datagrams have been sent while
@@ -1490,10 +2108,8 @@ typedef struct st_picoquic_cnx_t {
     /* If not `0`, the connection will send keep alive messages in the given interval. */
     uint64_t keep_alive_interval;
 
-    /* Management of paths */
-    picoquic_path_t ** path;
-    int nb_paths;
-    int nb_path_alloc;
+    /* Management of paths; the path array and counts are in the hot
+     * block at the top of the struct */
     int last_path_polled;
     uint64_t unique_path_id_next;
     picoquic_path_t* nominal_path_for_ack;
@@ -1520,6 +2136,15 @@ typedef struct st_picoquic_cnx_t {
     uint64_t ack_gap_remote;
     uint64_t ack_delay_remote;
     uint64_t ack_reordering_threshold_remote;
+    /* ACK emission policy: arrival and reordering rates sampled over short
+     * epochs, used by picoquic_is_ack_needed to decide whether an out of
+     * order arrival warrants an immediate ACK or can wait for the regular
+     * ack_gap / ack_delay cadence. */
+    uint64_t ack_policy_epoch_start;
+    uint64_t ack_policy_epoch_packets;
+    uint64_t ack_policy_epoch_reorders;
+    uint64_t ack_policy_packet_rate; /* smoothed packets per second */
+    uint64_t ack_policy_reorder_rate; /* smoothed reorder events per second */
 
     /* Copies of packets received too soon */
     picoquic_stateless_packet_t* first_sooner;
@@ -1529,10 +2154,27 @@ typedef struct st_picoquic_cnx_t {
     uint16_t log_unique;
     FILE* f_binlog;
     char* binlog_file_name;
+    struct st_picoquic_binlog_mmap_t* binlog_mmap; /* mmap output buffer for the binary log,
+                                                    * NULL when writing through stdio */
+    unsigned int binlog_is_v2 : 1; /* The binary log of this connection uses the v2 delta encoding */
+    uint64_t binlog_time_prev; /* Time of the previous v2 binlog event, for delta encoding */
+    uint64_t binlog_pn_prev[2]; /* Previous v2 logged packet number, sent then received */
+    char* log_correlation_id; /* Correlation id for cross host trace joins, see picoquic_set_log_correlation_id */
     void (*memlog_call_back)(picoquic_cnx_t* cnx, picoquic_path_t* path, void* v_memlog, int op_code, uint64_t current_time);
     void *memlog_ctx;
 } picoquic_cnx_t;
 
+/* Layout check for the hot send path block of picoquic_cnx_t: the
+ * scheduler fields must stay within the first two 64 byte cache lines.
+ * A build failure here means a field was added above or inside the hot
+ * block; new fields belong after the cold tail marker. */
+#define PICOQUIC_LAYOUT_ASSERT(name, cond) typedef char name[(cond) ? 1 : -1]
+PICOQUIC_LAYOUT_ASSERT(picoquic_cnx_hot_wake_time, offsetof(struct st_picoquic_cnx_t, next_wake_time) < 64);
+PICOQUIC_LAYOUT_ASSERT(picoquic_cnx_hot_state, offsetof(struct st_picoquic_cnx_t, cnx_state) < 64);
+PICOQUIC_LAYOUT_ASSERT(picoquic_cnx_hot_wake_chain, offsetof(struct st_picoquic_cnx_t, cnx_wake_bucket) < 64);
+PICOQUIC_LAYOUT_ASSERT(picoquic_cnx_hot_path, offsetof(struct st_picoquic_cnx_t, path) < 128);
+PICOQUIC_LAYOUT_ASSERT(picoquic_cnx_hot_callback, offsetof(struct st_picoquic_cnx_t, callback_ctx) < 128);
+
 typedef struct st_picoquic_packet_data_t {
     uint64_t last_time_stamp_received;
     uint64_t last_ack_delay; /* ACK Delay in ACK frame */
@@ -1567,6 +2209,11 @@ int picoquic_register_net_secret(picoquic_cnx_t* cnx);
 /* Registration of initial connection ID and peer IP */
 int picoquic_register_net_icid(picoquic_cnx_t* cnx);
 
+/* Hand-over of a connection between quic contexts, for loop thread
+ * rebalancing. Detach on the owning thread, attach on the target. */
+void picoquic_detach_cnx(picoquic_cnx_t* cnx);
+int picoquic_attach_cnx(picoquic_quic_t* quic, picoquic_cnx_t* cnx);
+
 void picoquic_create_local_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t* cnx_id, uint8_t id_length, picoquic_connection_id_t cnx_id_remote);
 
 /* Management of path */
@@ -1582,6 +2229,10 @@ void picoquic_queue_retransmit_on_ack(picoquic_cnx_t* cnx, picoquic_path_t* path
 void picoquic_promote_path_to_default(picoquic_cnx_t* cnx, int path_index, uint64_t current_time);
 void picoquic_delete_abandoned_paths(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t * next_wake_time);
 void picoquic_set_path_challenge(picoquic_cnx_t* cnx, int path_id, uint64_t current_time);
+/* Validated peer address cache, see the comments above the validated_addr
+ * field of the connection context. */
+void picoquic_remember_validated_address(picoquic_cnx_t* cnx, const struct sockaddr* addr_peer, uint64_t current_time);
+int picoquic_is_address_recently_validated(picoquic_cnx_t* cnx, const struct sockaddr* addr_peer, uint64_t current_time);
 int picoquic_find_path_by_address(picoquic_cnx_t* cnx, const struct sockaddr* addr_local, const struct sockaddr* addr_peer, int* partial_match);
 int picoquic_find_path_by_unique_id(picoquic_cnx_t* cnx, uint64_t unique_path_id);
 int picoquic_assign_peer_cnxid_to_path(picoquic_cnx_t* cnx, int path_id);
@@ -1621,6 +2272,14 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, picoq
     int add_to_data_repeat_queue);
 void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* p);
 
+/* Maintenance of the packet number bitmap over the retransmitted queue,
+ * implemented in loss_recovery.c. The "maybe" test tells whether an ACK
+ * range could cover a queued retransmitted packet; when it returns 0 the
+ * spurious retransmission scan can be skipped. */
+void picoquic_retransmitted_map_set(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number);
+void picoquic_retransmitted_map_clear(picoquic_packet_context_t* pkt_ctx, uint64_t sequence_number);
+int picoquic_retransmitted_map_range_maybe(picoquic_packet_context_t* pkt_ctx, uint64_t start_of_range, uint64_t end_of_range);
+
 /* Reset the connection context, e.g. after retry */
 int picoquic_reset_cnx(picoquic_cnx_t* cnx, uint64_t current_time);
 
@@ -1636,6 +2295,7 @@ void picoquic_connection_disconnect(picoquic_cnx_t* cnx);
 
 /* Connection context retrieval functions */
 picoquic_cnx_t* picoquic_cnx_by_id(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id, struct st_picoquic_local_cnxid_t ** l_cid_sequence);
+picoquic_cnx_t* picoquic_cnx_by_id_cached(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id, struct st_picoquic_local_cnxid_t** l_cid_sequence);
 picoquic_cnx_t* picoquic_cnx_by_net(picoquic_quic_t* quic, const struct sockaddr* addr);
 picoquic_cnx_t* picoquic_cnx_by_icid(picoquic_quic_t* quic, picoquic_connection_id_t* icid,
     const struct sockaddr* addr);
@@ -1644,6 +2304,7 @@ picoquic_cnx_t* picoquic_cnx_by_secret(picoquic_quic_t* quic, const uint8_t* res
 /* Pacing implementation */
 void picoquic_pacing_init(picoquic_pacing_t* pacing, uint64_t current_time);
 int picoquic_is_pacing_blocked(picoquic_pacing_t* pacing);
+size_t picoquic_pacing_credit_bytes(picoquic_pacing_t* pacing, uint64_t current_time, size_t send_mtu);
 int picoquic_is_authorized_by_pacing(picoquic_pacing_t* pacing, uint64_t current_time, uint64_t* next_time, unsigned int packet_train_mode, picoquic_quic_t * quic);
 void picoquic_update_pacing_parameters(picoquic_pacing_t* pacing, double pacing_rate, uint64_t quantum, size_t send_mtu, uint64_t smoothed_rtt,
     picoquic_path_t* signalled_path);
@@ -1653,6 +2314,7 @@ void picoquic_update_pacing_data_after_send(picoquic_pacing_t * pacing, size_t l
 /* Reset the pacing data after CWIN is updated */
 void picoquic_update_pacing_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x, int slow_start);
 void picoquic_update_pacing_after_send(picoquic_path_t* path_x, size_t length, uint64_t current_time);
+uint64_t picoquic_pacing_departure_time(picoquic_path_t* path_x, uint64_t current_time);
 int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time, uint64_t* next_time);
 /* Reset pacing data if congestion algorithm computes it directly */
 void picoquic_update_pacing_rate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, double pacing_rate, uint64_t quantum);
@@ -1664,6 +2326,27 @@ int picoquic_issue_path_quality_update(picoquic_cnx_t* cnx, picoquic_path_t* pat
         * so ready connections are polled first */
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time);
 
+/* Send scheduling round: move every currently due connection from the
+ * timer wheel onto the round list, then serve them one by one. */
+void picoquic_sched_round_collect(picoquic_quic_t* quic, uint64_t current_time);
+picoquic_cnx_t* picoquic_sched_round_pop(picoquic_quic_t* quic);
+
+/* Refresh the statistics snapshot read by picoquic_get_cnx_stats. Called
+ * by the thread that runs the connection, at the end of each packet
+ * preparation pass. */
+void picoquic_publish_cnx_stats(picoquic_cnx_t* cnx, uint64_t current_time);
+
+/* Shared memory counter export, see perf_export.h. The publish and
+ * delete hooks are no-ops until picoquic_perf_export_setup is called. */
+void picoquic_perf_export_publish(picoquic_cnx_t* cnx, uint64_t current_time);
+void picoquic_perf_export_on_cnx_deleted(picoquic_cnx_t* cnx);
+void picoquic_perf_export_close(picoquic_quic_t* quic);
+
+/* Close record log, see close_log.h. The record and close hooks are
+ * no-ops until picoquic_close_log_setup is called. */
+void picoquic_close_log_record(picoquic_cnx_t* cnx);
+void picoquic_close_log_close(picoquic_quic_t* quic);
+
 /* Integer parsing macros */
 #define PICOPARSE_16(b) ((((uint16_t)(b)[0]) << 8) | (uint16_t)((b)[1]))
 #define PICOPARSE_24(b) ((((uint32_t)PICOPARSE_16(b)) << 8) | (uint32_t)((b)[2]))
@@ -1679,6 +2362,7 @@ void picoformat_64(uint8_t* bytes, uint64_t n64);
 size_t picoquic_varint_encode(uint8_t* bytes, size_t max_bytes, uint64_t n64);
 void picoquic_varint_encode_16(uint8_t* bytes, uint16_t n16);
 size_t picoquic_varint_decode(const uint8_t* bytes, size_t max_bytes, uint64_t* n64);
+size_t picoquic_varint_decode_batch(const uint8_t* bytes, size_t max_bytes, uint64_t* n64, size_t nb_max, size_t* nb_decoded);
 const uint8_t* picoquic_frames_varint_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* n64);
 const uint8_t* picoquic_frames_varint_skip(const uint8_t* bytes, const uint8_t* bytes_max);
 size_t picoquic_varint_skip(const uint8_t* bytes);
@@ -1729,9 +2413,38 @@ void picoquic_protect_packet_header(uint8_t* send_buffer, size_t pn_offset, uint
 
 size_t picoquic_protect_packet(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype, uint8_t* bytes, uint64_t sequence_number, size_t length, size_t header_length, uint8_t* send_buffer, size_t send_buffer_max, void* aead_context, void* pn_enc, picoquic_path_t* path_x, uint64_t current_time);
 
+/* Queue a packet seal job on the crypto worker pool, see crypto_pool.c.
+ * Returns -1 if no pool is configured or no job could be allocated,
+ * in which case the caller encrypts inline. */
+int picoquic_crypto_pool_submit(picoquic_quic_t* quic,
+    uint8_t* send_buffer, size_t h_length,
+    const uint8_t* plaintext, size_t plaintext_length,
+    uint64_t sequence_number, uint64_t path_id, int is_multipath,
+    void* aead_context, void* pn_enc, size_t pn_offset, uint8_t first_mask);
+
+int picoquic_crypto_pool_submit_fn(picoquic_quic_t* quic, void (*job_fn)(void*), void* job_ctx);
+/* Wait until all generic jobs submitted through picoquic_crypto_pool_submit_fn
+ * have completed. No-op when no pool is configured. */
+void picoquic_crypto_pool_fn_sync(picoquic_quic_t* quic);
+
+/* Queue a deferred stream data copy on the crypto worker pool. The worker
+ * runs memcpy(dest, src, length) then clears *copy_pending. Returns -1 if
+ * no pool is configured or no job could be allocated, in which case the
+ * caller copies inline. */
+int picoquic_crypto_pool_submit_copy(picoquic_quic_t* quic,
+    uint8_t* dest, const uint8_t* src, size_t length, volatile int* copy_pending);
+
+void picoquic_delete_crypto_worker_pool(picoquic_quic_t* quic);
+
+/* Asynchronous certificate signing, see tls_api.c. Called from the
+ * packet preparation path: resumes the TLS handshake once the worker
+ * pool has produced the signature, or clamps the wake time while the
+ * signature is still being computed. */
+int picoquic_tls_async_sign_progress(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time);
+
 uint64_t picoquic_get_packet_number64(uint64_t highest, uint64_t mask, uint32_t pn);
 
-int picoquic_remove_header_protection_inner(uint8_t* bytes, size_t length, uint8_t* decrypted_bytes, picoquic_packet_header* ph, void* pn_enc, unsigned int is_loss_bit_enabled_incoming, uint64_t sack_list_last);
+int picoquic_remove_header_protection_inner(uint8_t* bytes, size_t length, uint8_t* decrypted_bytes, picoquic_packet_header* ph, void* pn_enc, unsigned int is_loss_bit_enabled_incoming, uint64_t sack_list_last, const uint8_t* hp_mask);
 
 size_t picoquic_pad_to_target_length(uint8_t* bytes, size_t length, size_t target);
 
@@ -1756,7 +2469,8 @@ int picoquic_parse_header_and_decrypt(
     picoquic_packet_header* ph,
     picoquic_cnx_t** pcnx,
     size_t * consumed,
-    int * new_context_created);
+    int * new_context_created,
+    const uint8_t* hp_mask);
 
 /* Shortcuts to packet numbers, last ack, last ack time.
  */
@@ -1769,9 +2483,11 @@ picoquic_packet_t * picoquic_get_last_packet(picoquic_cnx_t* cnx, picoquic_path_
 /* handling of ACK logic */
 void picoquic_init_ack_ctx(picoquic_cnx_t* cnx, picoquic_ack_context_t* ack_ctx);
 
-int picoquic_is_ack_needed(picoquic_cnx_t* cnx,  uint64_t current_time, uint64_t * next_wake_time, 
+int picoquic_is_ack_needed(picoquic_cnx_t* cnx,  uint64_t current_time, uint64_t * next_wake_time,
     picoquic_packet_context_enum pc, int is_opportunistic);
 
+int picoquic_is_ack_pending(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc, int is_opportunistic);
+
 int picoquic_is_pn_already_received(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc,
     picoquic_local_cnxid_t * l_cid, uint64_t pn64);
 int picoquic_record_pn_received(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc,
@@ -1792,8 +2508,8 @@ void picoquic_update_ack_horizon(picoquic_sack_list_t* sack_list, uint64_t curre
 /* Return the first ACK item in the list */
 picoquic_sack_item_t* picoquic_sack_first_item(picoquic_sack_list_t* sack_list);
 picoquic_sack_item_t* picoquic_sack_last_item(picoquic_sack_list_t* sack_list);
-picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_item_t * sack);
-picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_item_t* sack);
+picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t * sack);
+picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack);
 int picoquic_sack_insert_item(picoquic_sack_list_t* sack_list, uint64_t range_min, 
     uint64_t range_max, uint64_t current_time);
 
@@ -1854,8 +2570,32 @@ uint64_t picoquic_current_retransmit_timer(picoquic_cnx_t* cnx, picoquic_path_t*
 void picoquic_update_path_rtt(picoquic_cnx_t* cnx, picoquic_path_t * old_path, picoquic_path_t* path_x, int epoch,
     uint64_t send_time, uint64_t current_time, uint64_t ack_delay, uint64_t time_stamp);
 
+/* Bucket index of an RTT sample in the per path histogram, see picoquic_get_path_rtt_histogram */
+size_t picoquic_rtt_histogram_bucket(uint64_t rtt);
+
+/* Record a stream lifecycle duration in one of the per connection
+ * histograms, using the RTT histogram bucket geometry. */
+void picoquic_record_stream_time(uint32_t* histogram, uint64_t duration);
+
+/* Approximate RTT quantile derived from the per path histogram */
+uint64_t picoquic_rtt_histogram_quantile(picoquic_path_t* path_x, unsigned int percent);
+
 /* stream management */
 picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t stream_id);
+
+/* Per connection arena, see picoquic_cnx_arena_block_t */
+void* picoquic_cnx_arena_alloc(picoquic_cnx_t* cnx, size_t size);
+void picoquic_cnx_arena_release(picoquic_cnx_t* cnx);
+picoquic_stream_queue_node_t* picoquic_stream_queue_node_alloc(picoquic_cnx_t* cnx);
+void picoquic_stream_queue_node_recycle(picoquic_cnx_t* cnx, picoquic_stream_queue_node_t* node);
+uint8_t* picoquic_stream_buffer_alloc(picoquic_quic_t* quic, size_t length);
+void picoquic_stream_buffer_free(picoquic_quic_t* quic, uint8_t* bytes, size_t length);
+void picoquic_cnx_hibernate(picoquic_cnx_t* cnx);
+void picoquic_account_stream_memory(picoquic_cnx_t* cnx, size_t size);
+void picoquic_release_stream_memory(picoquic_cnx_t* cnx, size_t size);
+int picoquic_spill_stream_chunk(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream,
+    uint64_t offset, const uint8_t* bytes, size_t length);
+void picoquic_clear_stream_spill(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 picoquic_stream_head_t* picoquic_create_missing_streams(picoquic_cnx_t* cnx, uint64_t stream_id, int is_remote);
 int picoquic_is_stream_closed(picoquic_stream_head_t* stream, int client_mode);
 int picoquic_delete_stream_if_closed(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
@@ -1865,6 +2605,7 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx);
 picoquic_stream_head_t * picoquic_stream_from_node(picosplay_node_t * node);
 void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream);
 void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t * stream);
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 void picoquic_reorder_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream);
 picoquic_stream_head_t * picoquic_first_stream(picoquic_cnx_t * cnx);
 picoquic_stream_head_t * picoquic_last_stream(picoquic_cnx_t * cnx);
@@ -1905,6 +2646,7 @@ void picoquic_queue_data_repeat_packet(
 void picoquic_dequeue_data_repeat_packet(
     picoquic_cnx_t* cnx, picoquic_packet_t* packet);
 picoquic_packet_t* picoquic_first_data_repeat_packet(picoquic_cnx_t* cnx);
+void picoquic_empty_data_repeat_queue(picoquic_cnx_t* cnx);
 uint8_t* picoquic_copy_stream_frame_for_retransmit(
     picoquic_cnx_t* cnx, picoquic_packet_t* packet,
     uint8_t* bytes_next, uint8_t* bytes_max);
@@ -1927,6 +2669,7 @@ int picoquic_copy_before_retransmit(picoquic_packet_t * old_p,
 
 int picoquic_retransmit_needed(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc, picoquic_path_t* path_x, uint64_t current_time, uint64_t* next_wake_time, picoquic_packet_t* packet, size_t send_buffer_max, size_t* header_length);
 
+void picoquic_ack_policy_record_arrival(picoquic_cnx_t* cnx, int is_out_of_order, uint64_t current_time);
 void picoquic_set_ack_needed(picoquic_cnx_t* cnx, uint64_t current_time, picoquic_packet_context_enum pc,
     picoquic_path_t * path_x, int is_immediate_ack_required);
 
@@ -2044,6 +2787,15 @@ int picoquic_queue_path_available_or_standby_frame(
 
 int picoquic_decode_closing_frames(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max, int* closing_received);
 
+/* Forward erasure correction, see fec.c */
+void picoquic_fec_on_packet_sent(picoquic_cnx_t* cnx, picoquic_packet_t* packet);
+void picoquic_fec_receive_payload(picoquic_cnx_t* cnx, uint64_t pn64, const uint8_t* payload, size_t length);
+const uint8_t* picoquic_decode_fec_repair_frame(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    const uint8_t* bytes, const uint8_t* bytes_max, uint64_t current_time);
+const uint8_t* picoquic_skip_fec_repair_frame(const uint8_t* bytes, const uint8_t* bytes_max);
+void picoquic_fec_delete(picoquic_cnx_t* cnx);
+uint64_t picoquic_fec_block_size(picoquic_cnx_t* cnx);
+
 void picoquic_process_sooner_packets(picoquic_cnx_t* cnx, uint64_t current_time);
 void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx);
 
@@ -233,6 +233,64 @@ uint64_t picoquic_lb_compat_cid_verify(picoquic_quic_t* quic, void* cnx_id_cb_da
     return server_id64;
 }
 
+/* Batched verification, for use by load balancers that drain a whole
+ * receive vector (e.g. recvmmsg) before dispatching. In block cipher mode,
+ * the 16 byte payloads of all the CID in the batch are gathered in a single
+ * buffer and decrypted with a single call to the AES-ECB context, so the
+ * crypto backend can pipeline the AES rounds across blocks instead of
+ * paying the per-call overhead for each CID. The other methods are
+ * processed with the per-CID code. Results are returned in the server_id64
+ * array, using UINT64_MAX to mark CID that do not match the configuration.
+ */
+#define PICOQUIC_LB_CID_BATCH_MAX 32
+
+void picoquic_lb_compat_cid_verify_batch(picoquic_quic_t* quic, void* cnx_id_cb_data,
+    picoquic_connection_id_t const* cnx_id, size_t nb_cnx_id, uint64_t* server_id64)
+{
+    picoquic_load_balancer_cid_context_t* lb_ctx = (picoquic_load_balancer_cid_context_t*)cnx_id_cb_data;
+
+    if (lb_ctx->method != picoquic_load_balancer_cid_block_cipher) {
+        for (size_t i = 0; i < nb_cnx_id; i++) {
+            server_id64[i] = picoquic_lb_compat_cid_verify(quic, cnx_id_cb_data, &cnx_id[i]);
+        }
+    }
+    else {
+        size_t batch_first = 0;
+
+        while (batch_first < nb_cnx_id) {
+            uint8_t blocks[PICOQUIC_LB_CID_BATCH_MAX * 16];
+            size_t batch_rank[PICOQUIC_LB_CID_BATCH_MAX];
+            size_t nb_blocks = 0;
+
+            /* Gather the 16 byte payloads of the well formed CID */
+            while (batch_first < nb_cnx_id && nb_blocks < PICOQUIC_LB_CID_BATCH_MAX) {
+                if (cnx_id[batch_first].id_len != lb_ctx->connection_id_length) {
+                    server_id64[batch_first] = UINT64_MAX;
+                }
+                else {
+                    memcpy(blocks + 16 * nb_blocks, cnx_id[batch_first].id + 1, 16);
+                    batch_rank[nb_blocks] = batch_first;
+                    nb_blocks++;
+                }
+                batch_first++;
+            }
+            /* Decrypt the whole batch in one call */
+            if (nb_blocks > 0) {
+                picoquic_aes128_ecb_encrypt(lb_ctx->cid_decryption_context, blocks, blocks, 16 * nb_blocks);
+
+                for (size_t j = 0; j < nb_blocks; j++) {
+                    uint64_t s_id64 = 0;
+                    for (size_t i = 0; i < lb_ctx->server_id_length; i++) {
+                        s_id64 <<= 8;
+                        s_id64 += blocks[16 * j + i];
+                    }
+                    server_id64[batch_rank[j]] = s_id64;
+                }
+            }
+        }
+    }
+}
+
 int picoquic_lb_compat_cid_config_parse(picoquic_load_balancer_config_t* lb_config, char const* txt, size_t txt_length)
 {
     int ret = 0;
@@ -386,6 +444,115 @@ int picoquic_lb_compat_cid_config_parse(picoquic_load_balancer_config_t* lb_conf
     return ret;
 }
 
+/* Verify that the method is supported and the parameters are compatible,
+ * then build the connection ID generation context, including the required
+ * encryption contexts. Returns NULL if the configuration is invalid or if
+ * an allocation fails.
+ */
+static picoquic_load_balancer_cid_context_t* picoquic_lb_compat_cid_ctx_create(
+    picoquic_load_balancer_config_t* lb_config)
+{
+    int ret = 0;
+    picoquic_load_balancer_cid_context_t* lb_ctx = NULL;
+
+    if (lb_config->connection_id_length > PICOQUIC_CONNECTION_ID_MAX_SIZE) {
+        ret = -1;
+    }
+    else {
+        switch (lb_config->method) {
+        case picoquic_load_balancer_cid_clear:
+            if (lb_config->server_id_length + 1 > lb_config->connection_id_length) {
+                ret = -1;
+            }
+            break;
+        case picoquic_load_balancer_cid_stream_cipher:
+            /* Nonce length must be 8 to 16 bytes, CID should be long enough */
+            if (lb_config->nonce_length < 8 || lb_config->nonce_length > 16 ||
+                lb_config->nonce_length + lb_config->server_id_length + 1 > lb_config->connection_id_length) {
+                ret = -1;
+            }
+            break;
+        case picoquic_load_balancer_cid_block_cipher:
+            /* CID should include a whole AES-ECB block,
+             * there should be at least 2 bytes available for uniqueness,
+             * zero padding length should be 4 bytes for security */
+            if (lb_config->connection_id_length < 17 ||
+                lb_config->server_id_length > 15) {
+                ret = -1;
+            }
+            break;
+        default:
+            /* Error, unknown method */
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0) {
+        /* Create a copy */
+        lb_ctx = (picoquic_load_balancer_cid_context_t*)malloc(sizeof(picoquic_load_balancer_cid_context_t));
+
+        if (lb_ctx != NULL) {
+            /* if allocated, create the necessary encryption contexts or variables */
+            uint64_t s_id64 = lb_config->server_id64;
+            memset(lb_ctx, 0, sizeof(picoquic_load_balancer_cid_context_t));
+            lb_ctx->method = lb_config->method;
+            lb_ctx->rotation_bits = lb_config->rotation_bits;
+            lb_ctx->first_byte_encodes_length = lb_config->first_byte_encodes_length;
+            lb_ctx->server_id_length = lb_config->server_id_length;
+            lb_ctx->nonce_length = lb_config->nonce_length;
+            lb_ctx->connection_id_length = lb_config->connection_id_length;
+            lb_ctx->server_id64 = lb_config->server_id64;
+            lb_ctx->cid_encryption_context = NULL;
+            lb_ctx->cid_decryption_context = NULL;
+            lb_ctx->config = *lb_config;
+            /* Compute the server ID bytes and set encryption contexts */
+            for (size_t i = 0; i < lb_ctx->server_id_length; i++) {
+                size_t j = lb_ctx->server_id_length - i - 1;
+                lb_ctx->server_id[j] = (uint8_t)s_id64;
+                s_id64 >>= 8;
+            }
+            if (s_id64 != 0) {
+                /* Server ID not long enough to encode actual value */
+                ret = -1;
+            } else if (lb_config->method == picoquic_load_balancer_cid_stream_cipher ||
+                lb_config->method == picoquic_load_balancer_cid_block_cipher) {
+                lb_ctx->cid_encryption_context = picoquic_aes128_ecb_create(1, lb_config->cid_encryption_key);
+                if (lb_ctx->cid_encryption_context == NULL) {
+                    ret = -1;
+                }
+                else if (lb_config->method == picoquic_load_balancer_cid_block_cipher) {
+                    lb_ctx->cid_decryption_context = picoquic_aes128_ecb_create(0, lb_config->cid_encryption_key);
+                    if (lb_ctx->cid_decryption_context == NULL) {
+                        picoquic_aes128_ecb_free(lb_ctx->cid_encryption_context);
+                        lb_ctx->cid_encryption_context = NULL;
+                        ret = -1;
+                    }
+                }
+            }
+            if (ret != 0) {
+                /* if context allocation failed, free the copy */
+                free(lb_ctx);
+                lb_ctx = NULL;
+            }
+        }
+    }
+
+    return lb_ctx;
+}
+
+static void picoquic_lb_compat_cid_ctx_free(picoquic_load_balancer_cid_context_t* lb_ctx)
+{
+    /* Release the encryption contexts so as to avoid memory leaks */
+    if (lb_ctx->cid_encryption_context != NULL) {
+        picoquic_aes128_ecb_free(lb_ctx->cid_encryption_context);
+    }
+    if (lb_ctx->cid_decryption_context != NULL) {
+        picoquic_aes128_ecb_free(lb_ctx->cid_decryption_context);
+    }
+    /* Free the data */
+    free(lb_ctx);
+}
+
 int picoquic_lb_compat_cid_config(picoquic_quic_t* quic, picoquic_load_balancer_config_t * lb_config)
 {
     int ret = 0;
@@ -399,95 +566,47 @@ int picoquic_lb_compat_cid_config(picoquic_quic_t* quic, picoquic_load_balancer_
         ret = -1;
     }
     else {
-        /* Verify that the method is supported and the parameters are compatible.
-         * If valid, configure the connection ID generation */
-        if (lb_config->connection_id_length > PICOQUIC_CONNECTION_ID_MAX_SIZE) {
+        picoquic_load_balancer_cid_context_t* lb_ctx = picoquic_lb_compat_cid_ctx_create(lb_config);
+
+        if (lb_ctx == NULL) {
             ret = -1;
         }
         else {
-            switch (lb_config->method) {
-            case picoquic_load_balancer_cid_clear:
-                if (lb_config->server_id_length + 1 > lb_config->connection_id_length) {
-                    ret = -1;
-                }
-                break;
-            case picoquic_load_balancer_cid_stream_cipher:
-                /* Nonce length must be 8 to 16 bytes, CID should be long enough */
-                if (lb_config->nonce_length < 8 || lb_config->nonce_length > 16 ||
-                    lb_config->nonce_length + lb_config->server_id_length + 1 > lb_config->connection_id_length) {
-                    ret = -1;
-                }
-                break;
-            case picoquic_load_balancer_cid_block_cipher:
-                /* CID should include a whole AES-ECB block,
-                 * there should be at least 2 bytes available for uniqueness,
-                 * zero padding length should be 4 bytes for security */
-                if (lb_config->connection_id_length < 17 ||
-                    lb_config->server_id_length > 15) {
-                    ret = -1;
-                }
-                break;
-            default:
-                /* Error, unknown method */
-                ret = -1;
-                break;
-            }
+            /* Configure the CID generation */
+            quic->local_cnxid_length = lb_ctx->connection_id_length;
+            quic->cnx_id_callback_fn = picoquic_lb_compat_cid_generate;
+            quic->cnx_id_callback_ctx = (void*)lb_ctx;
         }
-        if (ret == 0) {
-            /* Create a copy */
-            picoquic_load_balancer_cid_context_t* lb_ctx = (picoquic_load_balancer_cid_context_t*)malloc(sizeof(picoquic_load_balancer_cid_context_t));
+    }
 
-            if (lb_ctx == NULL) {
-                ret = -1;
-            }
-            else {
-                /* if allocated, create the necessary encryption contexts or variables */
-                uint64_t s_id64 = lb_config->server_id64;
-                memset(lb_ctx, 0, sizeof(picoquic_load_balancer_cid_context_t));
-                lb_ctx->method = lb_config->method;
-                lb_ctx->rotation_bits = lb_config->rotation_bits;
-                lb_ctx->first_byte_encodes_length = lb_config->first_byte_encodes_length;
-                lb_ctx->server_id_length = lb_config->server_id_length;
-                lb_ctx->nonce_length = lb_config->nonce_length;
-                lb_ctx->connection_id_length = lb_config->connection_id_length;
-                lb_ctx->server_id64 = lb_config->server_id64;
-                lb_ctx->cid_encryption_context = NULL;
-                lb_ctx->cid_decryption_context = NULL;
-                /* Compute the server ID bytes and set encryption contexts */
-                for (size_t i = 0; i < lb_ctx->server_id_length; i++) {
-                    size_t j = lb_ctx->server_id_length - i - 1;
-                    lb_ctx->server_id[j] = (uint8_t)s_id64;
-                    s_id64 >>= 8;
-                }
-                if (s_id64 != 0) {
-                    /* Server ID not long enough to encode actual value */
-                    ret = -1;
-                } else if (lb_config->method == picoquic_load_balancer_cid_stream_cipher ||
-                    lb_config->method == picoquic_load_balancer_cid_block_cipher) {
-                    lb_ctx->cid_encryption_context = picoquic_aes128_ecb_create(1, lb_config->cid_encryption_key);
-                    if (lb_ctx->cid_encryption_context == NULL) {
-                        ret = -1;
-                    }
-                    else if (lb_config->method == picoquic_load_balancer_cid_block_cipher) {
-                        lb_ctx->cid_decryption_context = picoquic_aes128_ecb_create(0, lb_config->cid_encryption_key);
-                        if (lb_ctx->cid_decryption_context == NULL) {
-                            picoquic_aes128_ecb_free(lb_ctx->cid_encryption_context);
-                            lb_ctx->cid_encryption_context = NULL;
-                            ret = -1;
-                        }
-                    }
-                }
-                if (ret != 0) {
-                    /* if context allocation failed, free the copy */
-                    free(lb_ctx);
-                    lb_ctx = NULL;
-                } else {
-                    /* Configure the CID generation */
-                    quic->local_cnxid_length = lb_ctx->connection_id_length;
-                    quic->cnx_id_callback_fn = picoquic_lb_compat_cid_generate;
-                    quic->cnx_id_callback_ctx = (void*)lb_ctx;
-                }
-            }
+    return ret;
+}
+
+int picoquic_lb_compat_cid_config_update(picoquic_quic_t* quic, picoquic_load_balancer_config_t* lb_config)
+{
+    int ret = 0;
+
+    if (quic->cnx_id_callback_fn != picoquic_lb_compat_cid_generate ||
+        quic->cnx_id_callback_ctx == NULL) {
+        /* Error. Only an existing load balancer configuration can be updated */
+        ret = -1;
+    }
+    else if (quic->cnx_list != NULL && quic->local_cnxid_length != lb_config->connection_id_length) {
+        /* Error. Changing the CID length now will break existing connections */
+        ret = -1;
+    }
+    else {
+        /* Build the new context first, so the old configuration remains in
+         * place if the new one is invalid */
+        picoquic_load_balancer_cid_context_t* lb_ctx = picoquic_lb_compat_cid_ctx_create(lb_config);
+
+        if (lb_ctx == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_lb_compat_cid_ctx_free((picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx);
+            quic->local_cnxid_length = lb_ctx->connection_id_length;
+            quic->cnx_id_callback_ctx = (void*)lb_ctx;
         }
     }
 
@@ -498,16 +617,7 @@ void picoquic_lb_compat_cid_config_free(picoquic_quic_t* quic)
 {
     if (quic->cnx_id_callback_fn == picoquic_lb_compat_cid_generate &&
         quic->cnx_id_callback_ctx != NULL) {
-        picoquic_load_balancer_cid_context_t* lb_ctx = (picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx;
-        /* Release the encryption contexts so as to avoid memory leaks */
-        if (lb_ctx->cid_encryption_context != NULL) {
-            picoquic_aes128_ecb_free(lb_ctx->cid_encryption_context);
-        }
-        if (lb_ctx->cid_decryption_context != NULL) {
-            picoquic_aes128_ecb_free(lb_ctx->cid_decryption_context);
-        }
-        /* Free the data */
-        free(lb_ctx);
+        picoquic_lb_compat_cid_ctx_free((picoquic_load_balancer_cid_context_t*)quic->cnx_id_callback_ctx);
         /* Reset the Quic context */
         quic->cnx_id_callback_fn = NULL;
         quic->cnx_id_callback_ctx = NULL;
@@ -58,6 +58,11 @@ typedef struct st_picoquic_load_balancer_config_t {
 
 int picoquic_lb_compat_cid_config_parse(picoquic_load_balancer_config_t* lb_config, char const* txt, size_t txt_length);
 int picoquic_lb_compat_cid_config(picoquic_quic_t* quic, picoquic_load_balancer_config_t* lb_config);
+/* Replace the current load balancer configuration in place, without draining
+ * the existing connections. The new context is built before the old one is
+ * released, so a rejected configuration leaves the previous one active. The
+ * CID length cannot change while connections exist. */
+int picoquic_lb_compat_cid_config_update(picoquic_quic_t* quic, picoquic_load_balancer_config_t* lb_config);
 void picoquic_lb_compat_cid_config_free(picoquic_quic_t* quic);
 
 typedef struct st_picoquic_load_balancer_cid_context_t {
@@ -71,10 +76,17 @@ typedef struct st_picoquic_load_balancer_cid_context_t {
     uint8_t server_id[16];
     void* cid_encryption_context; /* used in stream and cipher mode */
     void* cid_decryption_context; /* used in block cipher mode */
+    picoquic_load_balancer_config_t config; /* retained for picoquic_export_restart_state */
 } picoquic_load_balancer_cid_context_t;
 
 void picoquic_lb_compat_cid_generate(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id_local, picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned);
 uint64_t picoquic_lb_compat_cid_verify(picoquic_quic_t* quic, void* cnx_id_cb_data, picoquic_connection_id_t const* cnx_id);
+/* Verify a whole batch of CID in one call. In block cipher mode, the CID
+ * payloads are decrypted with a single AES-ECB invocation per batch instead
+ * of one per CID. CID that do not match the configuration are reported as
+ * UINT64_MAX in the server_id64 array. */
+void picoquic_lb_compat_cid_verify_batch(picoquic_quic_t* quic, void* cnx_id_cb_data,
+    picoquic_connection_id_t const* cnx_id, size_t nb_cnx_id, uint64_t* server_id64);
 #ifdef __cplusplus
 }
 #endif
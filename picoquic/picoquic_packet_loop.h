@@ -58,6 +58,11 @@ typedef struct st_picoquic_socket_ctx_t {
     /* Management of sendmsg */
     char cmsg_buffer[1024];
     size_t udp_coalesced_size;
+#ifndef _WINDOWS
+    /* Management of MSG_ZEROCOPY completions (Linux only) */
+    unsigned int supports_msg_zerocopy : 1;
+    uint32_t zerocopy_next_seq;
+#endif
 #ifdef _WINDOWS
     /* Windows specific */
     WSAOVERLAPPED overlap;
@@ -81,7 +86,8 @@ typedef enum {
     picoquic_packet_loop_time_check, /* argument type packet_loop_time_check_arg_t*. Optional. */
     picoquic_packet_loop_system_call_duration, /* argument type packet_loop_system_call_duration_t*. Optional. */
     picoquic_packet_loop_wake_up, /* no argument (void* NULL). Used when loop wakeup is supported */
-    picoquic_packet_loop_alt_port /* Provide alt port for testing multipath or migration */
+    picoquic_packet_loop_alt_port, /* Provide alt port for testing multipath or migration */
+    picoquic_packet_loop_health_report /* argument type packet_loop_health_t*. Optional, about once per second. */
 } picoquic_packet_loop_cb_enum;
 
 /* System call statistics.
@@ -109,6 +115,36 @@ typedef struct st_packet_loop_time_check_arg_t {
     int64_t delta_t;
 } packet_loop_time_check_arg_t;
 
+/* Loop health statistics.
+* When the application sets the "loop health" option, the loop gathers
+* for each iteration the time spent processing between two waits, the
+* number of packets received per wake, the number of packets sent per
+* send pass, and a breakdown of why the loop woke up. The counters are
+* handed to the application about once per second through a "health
+* report" callback, then reset for the next interval, so a rising share
+* of long iterations or of timer wakes turning into socket wakes shows
+* loop saturation before users notice it. The duration histogram is
+* logarithmic: bucket b counts the iterations whose processing time was
+* below 2^b microseconds.
+*/
+#define PICOQUIC_LOOP_HEALTH_NB_BUCKETS 16
+#define PICOQUIC_LOOP_HEALTH_REPORT_INTERVAL 1000000
+
+typedef struct st_packet_loop_health_t {
+    uint64_t interval_duration; /* microseconds covered by this report */
+    uint64_t nb_iterations;
+    uint64_t iteration_duration_max;
+    uint64_t iteration_duration_hist[PICOQUIC_LOOP_HEALTH_NB_BUCKETS];
+    uint64_t nb_wake_timer; /* the wait ended on timer expiration */
+    uint64_t nb_wake_socket; /* the wait ended on incoming packets */
+    uint64_t nb_wake_event; /* the wait ended on the wake up pipe or event */
+    uint64_t nb_wake_immediate; /* zero delay pass emptying the receive queue */
+    uint64_t nb_packets_received;
+    uint64_t max_packets_per_wake;
+    uint64_t nb_packets_sent;
+    uint64_t max_packets_per_send_pass;
+} packet_loop_health_t;
+
 typedef int (*picoquic_packet_loop_cb_fn)(picoquic_quic_t * quic, picoquic_packet_loop_cb_enum cb_mode, void * callback_ctx, void * callback_argv);
 
 /* Packet loop option list shows support by application of optional features.
@@ -119,6 +155,7 @@ typedef struct st_picoquic_packet_loop_options_t {
     unsigned int do_time_check : 1; /* App should be polled for next time before sock select */
     unsigned int do_system_call_duration : 1; /* App should be notified if the system call duration varies */
     unsigned int provide_alt_port : 1; /* Used for simulating multipath or migrations. */
+    unsigned int do_loop_health : 1; /* App should receive the loop health report about once per second */
 } picoquic_packet_loop_options_t;
 
 /* Version 2 of packet loop, works in progress.
@@ -135,8 +172,99 @@ typedef struct st_picoquic_packet_loop_param_t {
     int prefer_extra_socket;
     int simulate_eio;
     size_t send_length_max;
+    size_t recv_batch_size; /* On Unix platforms, if larger than 1, receive up to
+                             * that many datagrams per system call using recvmmsg()
+                             * (capped at PICOQUIC_RECVMMSG_MAX). Ignored on Windows,
+                             * which uses coalesced receive instead. */
+    size_t send_batch_size; /* On Unix platforms, if larger than 1, group up to
+                             * that many outgoing messages prepared in one send
+                             * pass and flush them per sendmmsg() call (capped at
+                             * PICOQUIC_SENDMMSG_MAX). Ignored on Windows. */
+    int use_msg_zerocopy; /* On Linux, enable SO_ZEROCOPY on the loop sockets and
+                       * send large messages with MSG_ZEROCOPY, tracking kernel
+                       * completions on the socket error queue. Ignored when the
+                       * platform lacks MSG_ZEROCOPY, or with send batching. */
+    int busy_poll_usec; /* If larger than 0, run the loop in low latency mode:
+                       * set SO_BUSY_POLL to that value on the loop sockets
+                       * (Linux), and keep calling select() with a zero
+                       * timeout for that many microseconds after the last
+                       * received packet, instead of sleeping until the next
+                       * timer. Burns a core while traffic flows; falls back
+                       * to normal blocking waits when the flow pauses.
+                       * Unix only. */
+    int use_txtime;   /* On Linux, stamp each send with the pacing departure
+                       * time in an SCM_TXTIME control message, so an fq or
+                       * etf qdisc (configured for CLOCK_MONOTONIC) enforces
+                       * sub-millisecond pacing that loop wake-ups cannot.
+                       * Disabled if the kernel rejects SO_TXTIME. */
+    int use_rx_thread; /* On Unix platforms, run the socket receive side on a
+                       * dedicated thread: it blocks in select()/recvmsg() and
+                       * posts a copy of each datagram into the loop thread's
+                       * mailbox, so the loop thread overlaps packet production
+                       * with the receive system calls and the buffering
+                       * between bursts. QUIC packet processing itself stays
+                       * on the loop thread; see the receive thread notes in
+                       * sockloop.c for why the connection state cannot be
+                       * split. Ignored on Windows. */
+    int use_stateless_sender; /* Drain the stateless response queue (Retry,
+                       * Version Negotiation, stateless reset) on a dedicated
+                       * thread, so a flood of address validation traffic does
+                       * not consume the loop's send pass or its sendmmsg
+                       * batch slots. The responses are sent on the loop's own
+                       * sockets, which UDP allows from any thread; see the
+                       * stateless sender notes in sockloop.c. */
+    int use_async_probe; /* Run a small resolver thread for the loop, so
+                       * picoquic_probe_new_path_async() can resolve peer
+                       * names and schedule multipath probes without blocking
+                       * either the application or the loop thread. */
+    int cpu_affinity_plus1; /* If not zero, pin the loop thread to CPU number
+                       * (cpu_affinity_plus1 - 1) before allocating its
+                       * buffers. On NUMA systems this keeps the receive
+                       * buffers and the packet pool on the memory node of
+                       * the core that runs the loop, through first touch
+                       * placement. The offset by one keeps a zeroed
+                       * parameter block meaning "not pinned". */
+    int use_so_reuseport; /* On Unix platforms, set SO_REUSEPORT on the loop
+                       * sockets before binding, so several loops can share
+                       * one local port. Set automatically by
+                       * picoquic_start_network_thread_pool. Ignored on
+                       * Windows. */
+    int nb_crypto_workers; /* If larger than 0, create a crypto worker pool
+                       * of that many threads on the quic context (see
+                       * picoquic_set_crypto_worker_pool) so the AEAD seal of
+                       * outgoing packets runs off the loop thread; the loop
+                       * synchronizes with the workers before each socket
+                       * send. The pool is deleted when the loop exits. */
+    int use_rio; /* On Windows, use the Registered I/O loop (see
+                       * sockloop_rio.c) instead of the overlapped I/O loop.
+                       * Requires building with the cmake option WITH_RIO; if
+                       * the support is not compiled in, the overlapped I/O
+                       * loop is used. Ignored on Unix platforms. */
+    int use_io_uring; /* Use the io_uring loop (see sockloop_uring.c) instead of
+                       * the select() loop. Requires building with the cmake
+                       * option WITH_IOURING; if the support is not compiled in,
+                       * the select() loop is used. */
+    struct st_picoquic_xdp_config_t const* xdp_config; /* If not NULL, use the
+                       * AF_XDP loop (see sockloop_xdp.c). Requires building
+                       * with the cmake option WITH_AFXDP; if the support is
+                       * not compiled in, the select() loop is used. */
 } picoquic_packet_loop_param_t;
 
+/* Configuration of the AF_XDP loop. Since that loop bypasses the kernel
+ * UDP stack, the application must provide what the stack would otherwise
+ * resolve: interface name and queue, local MAC and IPv4 address, UDP
+ * port, and the MAC address of the gateway (or of the peer, on a direct
+ * link). See sockloop_xdp.c.
+ */
+typedef struct st_picoquic_xdp_config_t {
+    char const* if_name;
+    int queue_id;
+    uint8_t local_mac[6];
+    uint8_t gateway_mac[6];
+    struct in_addr local_ipv4;
+    uint16_t local_port;
+} picoquic_xdp_config_t;
+
 int picoquic_packet_loop_v2(picoquic_quic_t* quic,
     picoquic_packet_loop_param_t * param,
     picoquic_packet_loop_cb_fn loop_callback,
@@ -163,6 +291,61 @@ typedef int (*picoquic_custom_thread_create_fn)(void** thread_id, picoquic_threa
 typedef void (*picoquic_custom_thread_setname_fn)(char const* thread_name);
 typedef void (*picoquic_custom_thread_delete_fn)(void** thread_id);
 
+/* Cross thread packet hand-over. Each network thread can own a mailbox;
+* other threads post copies of received datagrams into it and wake the
+* thread, which drains the mailbox and processes the packets in its own
+* context, so the connection tables are only ever touched by the owning
+* thread. Used by the thread pool to route packets to the shard whose
+* index is encoded in the destination connection ID. */
+typedef struct st_picoquic_packet_mail_t {
+    struct st_picoquic_packet_mail_t* next;
+    struct sockaddr_storage addr_from;
+    struct sockaddr_storage addr_to;
+    int if_index_to;
+    unsigned char received_ecn;
+    size_t length;
+    uint8_t bytes[];
+} picoquic_packet_mail_t;
+
+#define PICOQUIC_PACKET_MAILBOX_MAX 256
+
+typedef struct st_picoquic_packet_mailbox_t {
+    picoquic_mutex_t mutex;
+    picoquic_packet_mail_t* first;
+    picoquic_packet_mail_t* last;
+    int nb_mails;
+} picoquic_packet_mailbox_t;
+
+/* Lock free submission of stream data from application threads. Each
+* record carries a copy of the data; the network thread drains the queue
+* from its own loop and feeds the records to picoquic_add_to_stream. The
+* queue is a multi producer stack swapped with a single atomic exchange,
+* so producers never block each other or the loop, and the loop is only
+* woken when the queue goes from empty to non empty, not once per
+* submission. See picoquic_submit_stream_data below. */
+typedef struct st_picoquic_stream_submit_t {
+    struct st_picoquic_stream_submit_t* next;
+    picoquic_cnx_t* cnx;
+    uint64_t stream_id;
+    size_t length;
+    int set_fin;
+    void* app_stream_ctx;
+    uint8_t data[];
+} picoquic_stream_submit_t;
+
+typedef struct st_picoquic_submission_queue_t {
+    void* volatile head; /* atomically swapped stack of pending submissions */
+} picoquic_submission_queue_t;
+
+/* Cross thread connection hand-over. picoquic_migrate_cnx_to_thread
+* posts one of these on the target thread's handoff stack; the target
+* drains the stack from its own loop and attaches the connection to its
+* QUIC context. See picoquic_migrate_cnx_to_thread below. */
+typedef struct st_picoquic_cnx_handoff_t {
+    struct st_picoquic_cnx_handoff_t* next;
+    picoquic_cnx_t* cnx;
+} picoquic_cnx_handoff_t;
+
 typedef struct st_picoquic_network_thread_ctx_t {
     picoquic_quic_t* quic;
     picoquic_packet_loop_param_t* param;
@@ -176,9 +359,15 @@ typedef struct st_picoquic_network_thread_ctx_t {
     HANDLE wake_up_event;
 #else
     int wake_up_pipe_fd[2];
+    int wake_up_is_eventfd; /* On Linux, both pipe slots hold a single eventfd */
 #endif
     int is_threaded;
     int wake_up_defined;
+    picoquic_packet_mailbox_t mailbox;
+    volatile int mailbox_enabled;
+    picoquic_submission_queue_t submissions;
+    picoquic_submission_queue_t handoffs; /* connections migrated to this thread */
+    struct st_picoquic_async_prober_t* prober; /* resolver thread for async path probes */
     volatile int thread_is_ready;
     volatile int thread_should_close;
     volatile int thread_is_closed;
@@ -195,6 +384,88 @@ picoquic_network_thread_ctx_t* picoquic_start_network_thread(
 int picoquic_wake_up_network_thread(picoquic_network_thread_ctx_t* thread_ctx);
 void picoquic_delete_network_thread(picoquic_network_thread_ctx_t* thread_ctx);
 
+/* Queue stream data from any thread, without taking a lock. The data is
+* copied; the network thread calls picoquic_add_to_stream_with_ctx with
+* the record content on its next iteration, waking up only if it was
+* asleep and the queue was empty. Returns the add_to_stream convention:
+* 0 if queued, -1 on allocation failure.
+*
+* The caller must guarantee that the connection still exists when the
+* record is drained, i.e. stop submitting for a connection once its
+* close callback has been seen -- the same lifetime rule as calling
+* picoquic_add_to_stream from the loop callback. */
+int picoquic_submit_stream_data(picoquic_network_thread_ctx_t* thread_ctx,
+    picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length,
+    int set_fin, void* app_stream_ctx);
+
+/* Request a multipath probe without blocking on name resolution. The
+* request is queued to the loop's resolver thread (enabled with the
+* use_async_probe loop parameter), which resolves peer_name:peer_port --
+* a getaddrinfo call that can take seconds on a flaky cellular link --
+* and hands the result back to the loop thread, which then calls
+* picoquic_probe_new_path_ex() in its own context. addr_local may be
+* NULL to let the stack pick the source; if_index 0 means no explicit
+* interface. Returns -1 if the resolver thread is not running.
+*
+* The same lifetime rule as picoquic_submit_stream_data applies: the
+* caller must guarantee that the connection still exists when the
+* result is drained. */
+int picoquic_probe_new_path_async(picoquic_network_thread_ctx_t* thread_ctx,
+    picoquic_cnx_t* cnx, const char* peer_name, int peer_port,
+    const struct sockaddr* addr_local, int if_index);
+
+/* Sharded server mode: run one packet loop per core, each with its own
+* QUIC context, all bound to the same UDP port through SO_REUSEPORT. The
+* kernel spreads incoming datagrams between the sockets by hashing the
+* four tuple, so all packets of a given connection land on the same
+* shard as long as the client does not change address. Each shard
+* encodes its index in the locally issued connection IDs, using the
+* clear text encoding of picoquic_lb.c. When a short header packet lands
+* on the wrong shard -- after a client address change, or because the
+* kernel hash disagrees with connection ownership -- the receiving shard
+* reads the shard index from the destination CID and hands the packet to
+* the owning thread through its mailbox, so each connection is only ever
+* touched by the thread that owns it. New connections (long header
+* packets) stay on whichever shard the kernel picked.
+*
+* The caller provides one picoquic_quic_t per shard, configured but with
+* no CID generation callback set, and a loop parameter structure with a
+* non zero local_port. The loop callback context for shard i is
+* loop_callback_ctx[i], or NULL if the array itself is NULL. Only
+* supported on platforms that provide SO_REUSEPORT.
+*/
+typedef struct st_picoquic_network_thread_pool_t {
+    int nb_threads;
+    picoquic_network_thread_ctx_t** threads;
+    picoquic_packet_loop_param_t* params; /* per thread copy of the loop parameters */
+    struct st_picoquic_shard_route_ctx_t* route_ctx; /* per shard reroute contexts */
+    picoquic_shared_packet_pool_t* packet_pool; /* recycled packets shared across shards */
+    picoquic_shared_token_registry_t* token_registry; /* token reuse detection shared across shards */
+} picoquic_network_thread_pool_t;
+
+picoquic_network_thread_pool_t* picoquic_start_network_thread_pool(
+    picoquic_quic_t** quic_shards,
+    int nb_shards,
+    picoquic_packet_loop_param_t* param,
+    picoquic_packet_loop_cb_fn loop_callback,
+    void** loop_callback_ctx,
+    int* ret);
+
+void picoquic_delete_network_thread_pool(picoquic_network_thread_pool_t* pool);
+
+/* Move an established connection to another shard of the pool, e.g. to
+* rebalance load when the reuseport hash piles connections onto one
+* thread. Must be called from the thread that currently owns the
+* connection, typically from its loop callback. The connection keeps its
+* transport state, CIDs and congestion state; the source shard forwards
+* subsequent packets whose destination CID still encodes its rank, so
+* the peer notices nothing. Only connections in ready state can move.
+* Returns 0 if the connection was posted to the target thread, -1 on an
+* invalid target or allocation failure, in which case the connection
+* stays where it is. */
+int picoquic_migrate_cnx_to_thread(picoquic_network_thread_pool_t* pool,
+    picoquic_cnx_t* cnx, int target_rank);
+
 /* The function picoquic_start_network_thread creates a background thread using
 * the "native" threading APIs, CreateThread in Windows or pthread_create in
 * Unix/Posix systems. This will not work in some environments, if for example
@@ -305,10 +576,33 @@ int picoquic_packet_loop_win(picoquic_quic_t* quic,
     void* loop_callback_ctx);
 #endif
 
+#if !defined(_WINDOWS) && defined(PICOQUIC_WITH_IOURING)
+/* io_uring based packet loop, see sockloop_uring.c. Normally invoked
+ * through picoquic_packet_loop_v2 by setting the "use_io_uring" flag
+ * in the loop parameters. */
+int picoquic_packet_loop_uring(picoquic_network_thread_ctx_t* thread_ctx);
+#endif
+
+#if !defined(_WINDOWS) && defined(PICOQUIC_WITH_AFXDP)
+/* AF_XDP based packet loop, see sockloop_xdp.c. Normally invoked
+ * through picoquic_packet_loop_v2 by setting the "xdp_config" pointer
+ * in the loop parameters. */
+int picoquic_packet_loop_xdp(picoquic_network_thread_ctx_t* thread_ctx);
+#endif
+
+#if defined(_WINDOWS) && defined(PICOQUIC_WITH_RIO)
+/* Registered I/O based packet loop, see sockloop_rio.c. Normally invoked
+ * through picoquic_packet_loop_v2 by setting the "use_rio" flag
+ * in the loop parameters. */
+int picoquic_packet_loop_rio(picoquic_network_thread_ctx_t* thread_ctx);
+#endif
+
 /* Following declarations are used for unit tests. */
 void picoquic_packet_loop_close_socket(picoquic_socket_ctx_t* s_ctx);
 int picoquic_packet_loop_open_sockets(uint16_t local_port, int local_af, int socket_buffer_size, int extra_socket_required,
     int do_not_use_gso, picoquic_socket_ctx_t* s_ctx);
+int picoquic_packet_loop_open_sockets_ex(uint16_t local_port, int local_af, int socket_buffer_size, int extra_socket_required,
+    int do_not_use_gso, int use_so_reuseport, picoquic_socket_ctx_t* s_ctx);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,73 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef PICOQUIC_PROBES_H
+#define PICOQUIC_PROBES_H
+
+/* Static tracepoints at the hottest control points of the stack, so
+ * tools like bpftrace or perf can count and sample events in production
+ * without enabling any logging. When the stack is built with
+ * PICOQUIC_USDT (cmake option ENABLE_USDT), each probe compiles to a
+ * single nop plus an ELF note describing the argument locations; the
+ * nop is patched to a breakpoint only while a tracer is attached, so
+ * the cost when unused is negligible. Without the option the probes
+ * compile to nothing.
+ *
+ * All probes are in the "picoquic" provider. The first argument is
+ * always the 64 bit value of the initial connection ID, so events can
+ * be correlated per connection and with the log files.
+ *
+ * Example: count packets received per connection,
+ *   bpftrace -e 'usdt:./picoquicdemo:picoquic:packet_received
+ *       { @[arg0] = count(); }'
+ */
+
+#ifdef PICOQUIC_USDT
+#include <sys/sdt.h>
+
+/* packet received: icid, packet number, length */
+#define PICOQUIC_PROBE_PACKET_RECEIVED(icid64, pn, length) \
+    DTRACE_PROBE3(picoquic, packet_received, icid64, pn, length)
+/* packet train sent: icid, datagram length, total packets sent */
+#define PICOQUIC_PROBE_PACKET_SENT(icid64, length, nb_sent) \
+    DTRACE_PROBE3(picoquic, packet_sent, icid64, length, nb_sent)
+/* packet declared lost: icid, packet number, length, 1 if found by timer */
+#define PICOQUIC_PROBE_LOSS_DECLARED(icid64, pn, length, is_timer) \
+    DTRACE_PROBE4(picoquic, loss_declared, icid64, pn, length, is_timer)
+/* congestion window after a CC notification: icid, cwin, bytes in transit */
+#define PICOQUIC_PROBE_CWIN_UPDATED(icid64, cwin, bytes_in_transit) \
+    DTRACE_PROBE3(picoquic, cwin_updated, icid64, cwin, bytes_in_transit)
+/* stream created: icid, stream id */
+#define PICOQUIC_PROBE_STREAM_OPEN(icid64, stream_id) \
+    DTRACE_PROBE2(picoquic, stream_open, icid64, stream_id)
+/* stream deleted: icid, stream id */
+#define PICOQUIC_PROBE_STREAM_CLOSE(icid64, stream_id) \
+    DTRACE_PROBE2(picoquic, stream_close, icid64, stream_id)
+
+#else
+#define PICOQUIC_PROBE_PACKET_RECEIVED(icid64, pn, length)
+#define PICOQUIC_PROBE_PACKET_SENT(icid64, length, nb_sent)
+#define PICOQUIC_PROBE_LOSS_DECLARED(icid64, pn, length, is_timer)
+#define PICOQUIC_PROBE_CWIN_UPDATED(icid64, cwin, bytes_in_transit)
+#define PICOQUIC_PROBE_STREAM_OPEN(icid64, stream_id)
+#define PICOQUIC_PROBE_STREAM_CLOSE(icid64, stream_id)
+#endif
+
+#endif /* PICOQUIC_PROBES_H */
@@ -0,0 +1,82 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Registration plumbing for vectorized ChaCha20-Poly1305 engines.
+ *
+ * Clients without AES hardware negotiate ChaCha20-Poly1305. When picoquic
+ * is built with OpenSSL, the EVP implementation already dispatches to
+ * AVX2 or AVX-512 code at run time, so nothing more is needed there. The
+ * gap is minicrypto-only builds, where the scalar reference code runs:
+ * picoquic deliberately contains no cipher implementations of its own
+ * (see the note in picoquic_ptls_fusion.c), so a vectorized engine must
+ * come from the crypto library or the embedding application. This module
+ * provides the missing plumbing: runtime CPU capability detection, and a
+ * registration call that wraps an externally supplied AEAD into a cipher
+ * suite and enters it in the suite table with the same "latest
+ * registration wins" priority that the fusion loader relies on.
+ *
+ * The registration must run after picoquic_tls_api_init(), otherwise the
+ * default providers re-register ChaCha20-Poly1305 on top of the supplied
+ * engine.
+ */
+
+#include "picotls.h"
+#include "picoquic_crypto_provider_api.h"
+
+#if defined(_WINDOWS)
+#include <intrin.h>
+#endif
+
+/* Declaration of the function `picoquic_get_hash_algorithm_by_name`, used to
+* complete the declaration of the cipher suite. As in the fusion loader, this
+* only works once another provider has registered a suite using SHA256.
+*/
+ptls_hash_algorithm_t* picoquic_get_hash_algorithm_by_name(const char* hash_algorithm_name);
+
+int picoquic_chacha_vec_is_supported_by_cpu(void)
+{
+    int is_supported = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    is_supported = __builtin_cpu_supports("avx2");
+#elif defined(_WINDOWS) && (defined(_M_X64) || defined(_M_IX86))
+    int cpu_info[4];
+    __cpuidex(cpu_info, 7, 0);
+    is_supported = (cpu_info[1] & (1 << 5)) != 0; /* EBX bit 5: AVX2 */
+#endif
+    return is_supported;
+}
+
+static struct st_ptls_cipher_suite_t picoquic_chacha_vec_suite = {
+    PTLS_CIPHER_SUITE_CHACHA20_POLY1305_SHA256, NULL, NULL };
+
+int picoquic_register_vectorized_chacha20poly1305(ptls_aead_algorithm_t* aead)
+{
+    int ret = -1;
+
+    if (aead != NULL && picoquic_chacha_vec_is_supported_by_cpu() &&
+        (picoquic_chacha_vec_suite.hash = picoquic_get_hash_algorithm_by_name("SHA256")) != NULL) {
+        picoquic_chacha_vec_suite.aead = aead;
+        picoquic_register_ciphersuite(&picoquic_chacha_vec_suite, 0);
+        ret = 0;
+    }
+
+    return ret;
+}
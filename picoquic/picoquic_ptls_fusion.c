@@ -21,6 +21,16 @@
 
 /* This module interfaces with the PTLS "fusion" libraries. It loads the
  * required variables and function pointers so they can be used by picoquic.
+ *
+ * Fusion is x86 only (AES-NI + AVX2, see ptls_fusion_is_supported_by_cpu);
+ * on aarch64 this module registers nothing and the OpenSSL provider wins
+ * the ciphersuite table. That is not the scalar fallback it may look like:
+ * OpenSSL's EVP AES-GCM dispatches to the ARMv8 Crypto Extensions, so
+ * AES itself is hardware accelerated there. What aarch64 lacks is only
+ * fusion's fused header-protection-and-AEAD scheduling; an equivalent
+ * NEON engine would have to be implemented inside picotls, behind the
+ * same ptls_aead interface, not hand rolled here -- picoquic deliberately
+ * contains no cipher implementations of its own.
  */
 
 #include "picotls.h"
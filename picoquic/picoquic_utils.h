@@ -23,6 +23,7 @@
 #define PICOQUIC_UTILS_H
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <inttypes.h>
 #include "picoquic.h"
 
@@ -62,6 +63,8 @@ extern "C" {
 #define PICOQUIC_QUICCTX 3
 #define PICOQUIC_FRAME 4
 #define PICOQUIC_LOSS_RECOVERY 5
+#define PICOQUIC_TLSAPI 6
+#define PICOQUIC_SOCKS 7
 #define SET_LAST_WAKE(quic, file_id) ((quic)->wake_file = file_id, (quic)->wake_line = __LINE__)
 
 
@@ -79,6 +82,36 @@ int debug_printf_reset(int suspended);
 void debug_dump(const void * x, int len);
 #endif
 
+/* Structured diagnostic events. DBG_PRINTF formats text and writes it to
+ * stderr, which blocks the loop at high event rates. Applications can
+ * instead register a process wide callback receiving the severity, the
+ * subsystem identifier (the file identifiers above), a static event id
+ * and the unformatted arguments, and route them to their own
+ * asynchronous logging; formatting is entirely deferred to the callback.
+ * A minimum interval per event id, in microseconds, is enforced before
+ * delivery; suppressed occurrences are counted and reported as
+ * "nb_suppressed" with the next delivery of the same event. When no
+ * callback is registered, events fall back to the debug stream set by
+ * debug_set_stream, like DBG_PRINTF. The PICOQUIC_DIAG macro derives the
+ * event id from the subsystem id and the source line. */
+typedef enum {
+    picoquic_diag_severity_info = 0,
+    picoquic_diag_severity_warning = 1,
+    picoquic_diag_severity_error = 2
+} picoquic_diag_severity_enum;
+
+typedef void (*picoquic_diag_event_fn)(void* v_diag_ctx, picoquic_diag_severity_enum severity,
+    int subsystem_id, uint64_t event_id, uint64_t nb_suppressed, const char* fmt, va_list args);
+
+void picoquic_set_diag_event_callback(picoquic_diag_event_fn diag_fn, void* v_diag_ctx,
+    uint64_t min_interval_per_event);
+void picoquic_diag_event(picoquic_diag_severity_enum severity, int subsystem_id,
+    uint64_t event_id, const char* fmt, ...);
+
+#define PICOQUIC_DIAG(severity, subsystem_id, fmt, ...)     \
+    picoquic_diag_event(severity, subsystem_id,             \
+        (((uint64_t)(subsystem_id)) << 32) | (uint64_t)__LINE__, fmt, __VA_ARGS__)
+
 /* utilities */
 char* picoquic_string_create(const char* original, size_t len);
 char* picoquic_string_duplicate(const char* original);
@@ -0,0 +1,184 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoskip.h"
+#include <string.h>
+
+void picoskip_init_list(picoskip_list_t* list, picoskip_comparator comp, picoskip_create create,
+    picoskip_delete_node delete_node, picoskip_node_value node_value)
+{
+    memset(list, 0, sizeof(picoskip_list_t));
+    list->comp = comp;
+    list->create = create;
+    list->delete_node = delete_node;
+    list->node_value = node_value;
+    list->seed = 0x9E3779B97F4A7C15ull;
+}
+
+/* Draw a node level: level i+1 with probability 2^-(i+1), capped at
+ * PICOSKIP_MAX_LEVEL. */
+static int picoskip_random_level(picoskip_list_t* list)
+{
+    uint64_t x = list->seed;
+    int level = 1;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    list->seed = x;
+
+    while (level < PICOSKIP_MAX_LEVEL && (x & 1) != 0) {
+        level++;
+        x >>= 1;
+    }
+
+    return level;
+}
+
+picoskip_node_t* picoskip_insert(picoskip_list_t* list, void* value)
+{
+    picoskip_node_t* update[PICOSKIP_MAX_LEVEL];
+    picoskip_node_t* x = &list->head;
+    picoskip_node_t* node = (list->create == NULL) ? NULL : list->create(value);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    /* Equal keys are inserted after the existing ones */
+    for (int i = PICOSKIP_MAX_LEVEL - 1; i >= 0; i--) {
+        while (x->forward[i] != NULL && list->comp(list->node_value(x->forward[i]), value) <= 0) {
+            x = x->forward[i];
+        }
+        update[i] = x;
+    }
+
+    memset(node, 0, sizeof(picoskip_node_t));
+    node->level = picoskip_random_level(list);
+    for (int i = 0; i < node->level; i++) {
+        node->forward[i] = update[i]->forward[i];
+        update[i]->forward[i] = node;
+    }
+    list->size++;
+
+    return node;
+}
+
+picoskip_node_t* picoskip_find(picoskip_list_t* list, void* value)
+{
+    picoskip_node_t* x = &list->head;
+    picoskip_node_t* candidate;
+
+    for (int i = PICOSKIP_MAX_LEVEL - 1; i >= 0; i--) {
+        while (x->forward[i] != NULL && list->comp(list->node_value(x->forward[i]), value) < 0) {
+            x = x->forward[i];
+        }
+    }
+    candidate = x->forward[0];
+
+    return (candidate != NULL && list->comp(list->node_value(candidate), value) == 0) ? candidate : NULL;
+}
+
+/* Find the last node with a value lower than or equal to the argument,
+ * like picosplay_find_previous. */
+picoskip_node_t* picoskip_find_previous(picoskip_list_t* list, void* value)
+{
+    picoskip_node_t* x = &list->head;
+
+    for (int i = PICOSKIP_MAX_LEVEL - 1; i >= 0; i--) {
+        while (x->forward[i] != NULL && list->comp(list->node_value(x->forward[i]), value) <= 0) {
+            x = x->forward[i];
+        }
+    }
+
+    return (x == &list->head) ? NULL : x;
+}
+
+picoskip_node_t* picoskip_first(picoskip_list_t* list)
+{
+    return list->head.forward[0];
+}
+
+picoskip_node_t* picoskip_next(picoskip_node_t* node)
+{
+    return node->forward[0];
+}
+
+void picoskip_delete_hint(picoskip_list_t* list, picoskip_node_t* node)
+{
+    picoskip_node_t* update[PICOSKIP_MAX_LEVEL];
+    picoskip_node_t* x = &list->head;
+    picoskip_node_t* y;
+    void* value;
+
+    if (node == NULL) {
+        return;
+    }
+    value = list->node_value(node);
+
+    /* Descend to the first node with an equal or larger value */
+    for (int i = PICOSKIP_MAX_LEVEL - 1; i >= 0; i--) {
+        while (x->forward[i] != NULL && list->comp(list->node_value(x->forward[i]), value) < 0) {
+            x = x->forward[i];
+        }
+        update[i] = x;
+    }
+
+    /* Walk the run of equal valued nodes until the node is found,
+     * keeping track of the last possible predecessor at each level */
+    y = update[0]->forward[0];
+    while (y != NULL && y != node) {
+        for (int i = 0; i < y->level; i++) {
+            update[i] = y;
+        }
+        y = y->forward[0];
+    }
+
+    if (y == node) {
+        for (int i = 0; i < node->level; i++) {
+            if (update[i]->forward[i] == node) {
+                update[i]->forward[i] = node->forward[i];
+            }
+        }
+        list->size--;
+
+        if (list->delete_node != NULL) {
+            list->delete_node(list, node);
+        }
+    }
+}
+
+void picoskip_empty_list(picoskip_list_t* list)
+{
+    picoskip_node_t* node = list->head.forward[0];
+
+    while (node != NULL) {
+        picoskip_node_t* next = node->forward[0];
+
+        if (list->delete_node != NULL) {
+            list->delete_node(list, node);
+        }
+        node = next;
+    }
+
+    memset(list->head.forward, 0, sizeof(list->head.forward));
+    list->size = 0;
+}
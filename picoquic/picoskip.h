@@ -0,0 +1,73 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Intrusive skiplist with the same callback conventions as picosplay,
+ * so either structure can index the received stream segments. Nodes
+ * embed a fixed size tower of forward pointers; the level of each node
+ * is drawn from a per-list xorshift generator.
+ */
+#ifndef PICOSKIP_H
+#define PICOSKIP_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PICOSKIP_MAX_LEVEL 8
+
+typedef struct st_picoskip_node_t {
+    struct st_picoskip_node_t* forward[PICOSKIP_MAX_LEVEL];
+    int level; /* number of forward pointers in use, 1..PICOSKIP_MAX_LEVEL */
+} picoskip_node_t;
+
+typedef int64_t(*picoskip_comparator)(void* left, void* right);
+typedef picoskip_node_t* (*picoskip_create)(void* value);
+typedef void(*picoskip_delete_node)(void* list, picoskip_node_t* node);
+typedef void* (*picoskip_node_value)(picoskip_node_t* node);
+
+typedef struct st_picoskip_list_t {
+    picoskip_node_t head; /* sentinel; head.forward[i] is the first node at level i */
+    picoskip_comparator comp;
+    picoskip_create create;
+    picoskip_delete_node delete_node;
+    picoskip_node_value node_value;
+    uint64_t seed;
+    int size;
+} picoskip_list_t;
+
+void picoskip_init_list(picoskip_list_t* list, picoskip_comparator comp, picoskip_create create,
+    picoskip_delete_node delete_node, picoskip_node_value node_value);
+picoskip_node_t* picoskip_insert(picoskip_list_t* list, void* value);
+picoskip_node_t* picoskip_find(picoskip_list_t* list, void* value);
+picoskip_node_t* picoskip_find_previous(picoskip_list_t* list, void* value);
+picoskip_node_t* picoskip_first(picoskip_list_t* list);
+picoskip_node_t* picoskip_next(picoskip_node_t* node);
+void picoskip_delete_hint(picoskip_list_t* list, picoskip_node_t* node);
+void picoskip_empty_list(picoskip_list_t* list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PICOSKIP_H */
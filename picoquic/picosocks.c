@@ -19,9 +19,22 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifndef _WINDOWS
+/* Required so that sys/socket.h declares recvmmsg() and struct mmsghdr */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include "picosocks.h"
 #include "picoquic_utils.h"
 
+#if defined(__linux__)
+/* For struct sock_txtime (SO_TXTIME) and CLOCK_MONOTONIC */
+#include <linux/net_tstamp.h>
+#include <time.h>
+#endif
+
 int picoquic_bind_to_port(SOCKET_TYPE fd, int af, int port)
 {
     struct sockaddr_storage sa;
@@ -241,6 +254,45 @@ int picoquic_socket_set_pmtud_options(SOCKET_TYPE sd, int af)
     return ret;
 }
 
+int picoquic_socket_set_reuseport(SOCKET_TYPE sd)
+{
+    int ret = -1;
+#if !defined(_WINDOWS) && defined(SO_REUSEPORT)
+    /* Allow several sockets, typically owned by different packet loops,
+     * to bind to the same local port. The kernel spreads incoming
+     * datagrams between them by hashing the four tuple. There is no
+     * equivalent option on Windows: SO_REUSEADDR has different, unsafe
+     * semantics there. */
+    int val = 1;
+    ret = setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(int));
+#else
+#ifdef UNREFERENCED_PARAMETER
+    UNREFERENCED_PARAMETER(sd);
+#endif
+#endif
+    return ret;
+}
+
+int picoquic_socket_set_txtime(SOCKET_TYPE sd)
+{
+    int ret = -1;
+#if defined(__linux__) && defined(SO_TXTIME)
+    /* Let sendmsg() carry a per packet transmit timestamp in an
+     * SCM_TXTIME control message, which an fq or etf qdisc enforces.
+     * The timestamps are read on CLOCK_MONOTONIC; the qdisc must be
+     * configured for the same clock. */
+    struct sock_txtime txtime_cfg;
+    memset(&txtime_cfg, 0, sizeof(txtime_cfg));
+    txtime_cfg.clockid = CLOCK_MONOTONIC;
+    ret = setsockopt(sd, SOL_SOCKET, SO_TXTIME, &txtime_cfg, sizeof(txtime_cfg));
+#else
+#ifdef UNREFERENCED_PARAMETER
+    UNREFERENCED_PARAMETER(sd);
+#endif
+#endif
+    return ret;
+}
+
 SOCKET_TYPE picoquic_open_client_socket(int af)
 {
 #ifdef _WINDOWS
@@ -367,7 +419,8 @@ void picoquic_socks_cmsg_parse(
                 }
             }
             else {
-                DBG_PRINTF("Cmsg level: %d, type: %d\n", cmsg->cmsg_level, cmsg->cmsg_type);
+                PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                    "Cmsg level: %d, type: %d", cmsg->cmsg_level, cmsg->cmsg_type);
             }
         }
         else if (cmsg->cmsg_level == IPPROTO_IPV6) {
@@ -393,7 +446,8 @@ void picoquic_socks_cmsg_parse(
                 }
             }
             else {
-                DBG_PRINTF("Cmsg level: %d, type: %d\n", cmsg->cmsg_level, cmsg->cmsg_type);
+                PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                    "Cmsg level: %d, type: %d", cmsg->cmsg_level, cmsg->cmsg_type);
             }
         }
 #ifdef UDP_COALESCED_INFO
@@ -405,12 +459,14 @@ void picoquic_socks_cmsg_parse(
                 }
             }
             else {
-                DBG_PRINTF("Cmsg level: %d, type: %d\n", cmsg->cmsg_level, cmsg->cmsg_type);
+                PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                    "Cmsg level: %d, type: %d", cmsg->cmsg_level, cmsg->cmsg_type);
             }
         }
 #endif
         else {
-            DBG_PRINTF("Cmsg level: %d, type: %d\n", cmsg->cmsg_level, cmsg->cmsg_type);
+            PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                    "Cmsg level: %d, type: %d", cmsg->cmsg_level, cmsg->cmsg_type);
         }
     }
 #else
@@ -474,6 +530,18 @@ void picoquic_socks_cmsg_parse(
                 }
             }
         }
+#if defined(UDP_GRO)
+        else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            /* The kernel reports the segment size of the coalesced train,
+             * mirroring the UDP_COALESCED_INFO report on Windows. */
+            if (cmsg->cmsg_len > 0 && udp_coalesced_size != NULL) {
+                int gro_size = *((int*)CMSG_DATA(cmsg));
+                if (gro_size > 0) {
+                    *udp_coalesced_size = (size_t)gro_size;
+                }
+            }
+        }
+#endif
     }
 #endif
 }
@@ -525,15 +593,17 @@ static void* cmsg_format_header_return_data_ptr(struct msghdr* msg, struct cmsgh
 }
 #endif
 
-void picoquic_socks_cmsg_format(
+void picoquic_socks_cmsg_format_ex(
     void* vmsg,
     size_t message_length,
     size_t send_msg_size,
     struct sockaddr* addr_from,
-    int dest_if)
+    int dest_if,
+    uint64_t txtime_ns)
 {
 #ifdef _WINDOWS
     WSAMSG* msg = (WSAMSG*)vmsg;
+    UNREFERENCED_PARAMETER(txtime_ns);
     int control_length = 0;
     struct cmsghdr* last_cmsg = NULL;
     int is_null = 0;
@@ -701,6 +771,22 @@ void picoquic_socks_cmsg_format(
         }
     }
 #endif
+#if defined(SCM_TXTIME)
+    if (!is_null && txtime_ns > 0) {
+        /* The socket must have been configured with SO_TXTIME first,
+         * see picoquic_socket_set_txtime(). */
+        uint64_t* pval = (uint64_t*)cmsg_format_header_return_data_ptr(msg, &last_cmsg,
+            &control_length, SOL_SOCKET, SCM_TXTIME, sizeof(uint64_t));
+        if (pval != NULL) {
+            *pval = txtime_ns;
+        }
+        else {
+            is_null = 1;
+        }
+    }
+#else
+    (void)txtime_ns;
+#endif
 
     msg->msg_controllen = control_length;
     if (control_length == 0) {
@@ -709,6 +795,16 @@ void picoquic_socks_cmsg_format(
 #endif
 }
 
+void picoquic_socks_cmsg_format(
+    void* vmsg,
+    size_t message_length,
+    size_t send_msg_size,
+    struct sockaddr* addr_from,
+    int dest_if)
+{
+    picoquic_socks_cmsg_format_ex(vmsg, message_length, send_msg_size, addr_from, dest_if, 0);
+}
+
 
 #ifdef _WINDOWS
 
@@ -927,12 +1023,13 @@ int picoquic_recvmsg_async_start(picoquic_recvmsg_async_ctx_t* ctx)
 
 #endif
 
-int picoquic_recvmsg(SOCKET_TYPE fd,
+int picoquic_recvmsg_ex(SOCKET_TYPE fd,
     struct sockaddr_storage* addr_from,
     struct sockaddr_storage* addr_dest,
     int* dest_if,
     unsigned char* received_ecn,
-    uint8_t* buffer, int buffer_max)
+    uint8_t* buffer, int buffer_max,
+    size_t* udp_coalesced_size)
 #ifdef _WINDOWS
 {
     GUID WSARecvMsg_GUID = WSAID_WSARECVMSG;
@@ -954,6 +1051,10 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
         *received_ecn = 0;
     }
 
+    if (udp_coalesced_size != NULL) {
+        *udp_coalesced_size = 0;
+    }
+
     nResult = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
         &WSARecvMsg_GUID, sizeof WSARecvMsg_GUID,
         &WSARecvMsg, sizeof WSARecvMsg,
@@ -985,7 +1086,7 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
             bytes_recv = -1;
         } else {
             bytes_recv = NumberOfBytes;
-            picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, NULL);
+            picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, udp_coalesced_size);
         }
     }
 
@@ -1002,6 +1103,10 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
         *dest_if = 0;
     }
 
+    if (udp_coalesced_size != NULL) {
+        *udp_coalesced_size = 0;
+    }
+
     dataBuf.iov_base = (char*)buffer;
     dataBuf.iov_len = buffer_max;
 
@@ -1018,13 +1123,164 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
     if (bytes_recv <= 0) {
         addr_from->ss_family = 0;
     } else {
-        picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, NULL);
+        picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, udp_coalesced_size);
     }
 
     return bytes_recv;
 }
 #endif
 
+int picoquic_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max)
+{
+    return picoquic_recvmsg_ex(fd, addr_from, addr_dest, dest_if, received_ecn,
+        buffer, buffer_max, NULL);
+}
+
+#ifndef _WINDOWS
+int picoquic_recvmmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffers, int buffer_max,
+    int* bytes_recv, int nb_messages_max)
+#if defined(MSG_WAITFORONE)
+{
+    struct mmsghdr mmsg[PICOQUIC_RECVMMSG_MAX];
+    struct iovec dataBuf[PICOQUIC_RECVMMSG_MAX];
+    char cmsg_buffer[PICOQUIC_RECVMMSG_MAX][256];
+    int nb_recv;
+
+    if (nb_messages_max > PICOQUIC_RECVMMSG_MAX) {
+        nb_messages_max = PICOQUIC_RECVMMSG_MAX;
+    }
+
+    for (int i = 0; i < nb_messages_max; i++) {
+        dataBuf[i].iov_base = (char*)(buffers + ((size_t)i) * buffer_max);
+        dataBuf[i].iov_len = buffer_max;
+        memset(&mmsg[i], 0, sizeof(struct mmsghdr));
+        mmsg[i].msg_hdr.msg_name = (struct sockaddr*)&addr_from[i];
+        mmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        mmsg[i].msg_hdr.msg_iov = &dataBuf[i];
+        mmsg[i].msg_hdr.msg_iovlen = 1;
+        mmsg[i].msg_hdr.msg_control = (void*)cmsg_buffer[i];
+        mmsg[i].msg_hdr.msg_controllen = sizeof(cmsg_buffer[i]);
+    }
+
+    /* The caller is expected to have verified that the socket is ready.
+     * MSG_DONTWAIT guarantees that the call returns once the receive
+     * queue is drained instead of blocking until the batch is full. */
+    nb_recv = recvmmsg(fd, mmsg, nb_messages_max, MSG_DONTWAIT, NULL);
+
+    for (int i = 0; i < nb_recv; i++) {
+        bytes_recv[i] = (int)mmsg[i].msg_len;
+        if (dest_if != NULL) {
+            dest_if[i] = 0;
+        }
+        if (received_ecn != NULL) {
+            received_ecn[i] = 0;
+        }
+        picoquic_socks_cmsg_parse(&mmsg[i].msg_hdr, &addr_dest[i],
+            (dest_if == NULL) ? NULL : &dest_if[i],
+            (received_ecn == NULL) ? NULL : &received_ecn[i], NULL);
+    }
+
+    return nb_recv;
+}
+#else
+{
+    /* No recvmmsg() on this platform: receive the one message that the
+     * caller's select indicated. */
+    int nb_recv = 0;
+    int recv_one;
+
+    if (nb_messages_max > 0) {
+        recv_one = picoquic_recvmsg(fd, addr_from, addr_dest, dest_if,
+            received_ecn, buffers, buffer_max);
+        if (recv_one < 0) {
+            nb_recv = -1;
+        }
+        else if (recv_one > 0) {
+            bytes_recv[0] = recv_one;
+            nb_recv = 1;
+        }
+    }
+
+    return nb_recv;
+}
+#endif
+#endif
+
+#ifndef _WINDOWS
+int picoquic_sendmmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_dest,
+    struct sockaddr_storage* addr_from,
+    int* dest_if,
+    uint8_t* buffers, size_t buffer_stride,
+    size_t* lengths, size_t* send_msg_sizes,
+    int nb_messages, int* sock_err)
+#if defined(MSG_WAITFORONE)
+{
+    struct mmsghdr mmsg[PICOQUIC_SENDMMSG_MAX];
+    struct iovec dataBuf[PICOQUIC_SENDMMSG_MAX];
+    char cmsg_buffer[PICOQUIC_SENDMMSG_MAX][256];
+    int nb_sent;
+
+    if (nb_messages > PICOQUIC_SENDMMSG_MAX) {
+        nb_messages = PICOQUIC_SENDMMSG_MAX;
+    }
+
+    for (int i = 0; i < nb_messages; i++) {
+        dataBuf[i].iov_base = (char*)(buffers + ((size_t)i) * buffer_stride);
+        dataBuf[i].iov_len = lengths[i];
+        memset(&mmsg[i], 0, sizeof(struct mmsghdr));
+        mmsg[i].msg_hdr.msg_name = (struct sockaddr*)&addr_dest[i];
+        mmsg[i].msg_hdr.msg_namelen = picoquic_addr_length((struct sockaddr*)&addr_dest[i]);
+        mmsg[i].msg_hdr.msg_iov = &dataBuf[i];
+        mmsg[i].msg_hdr.msg_iovlen = 1;
+        mmsg[i].msg_hdr.msg_control = (void*)cmsg_buffer[i];
+        mmsg[i].msg_hdr.msg_controllen = sizeof(cmsg_buffer[i]);
+        picoquic_socks_cmsg_format(&mmsg[i].msg_hdr, lengths[i], send_msg_sizes[i],
+            (struct sockaddr*)&addr_from[i], dest_if[i]);
+    }
+
+    nb_sent = sendmmsg(fd, mmsg, nb_messages, 0);
+
+    if (nb_sent < 0 && sock_err != NULL) {
+        *sock_err = errno;
+    }
+
+    return nb_sent;
+}
+#else
+{
+    /* No sendmmsg() on this platform: send the messages one at a time. */
+    int nb_sent = 0;
+
+    for (int i = 0; i < nb_messages; i++) {
+        int one_sent = picoquic_sendmsg(fd,
+            (struct sockaddr*)&addr_dest[i], (struct sockaddr*)&addr_from[i], dest_if[i],
+            (const char*)(buffers + ((size_t)i) * buffer_stride),
+            (int)lengths[i], (int)send_msg_sizes[i], sock_err);
+        if (one_sent <= 0) {
+            if (nb_sent == 0) {
+                nb_sent = -1;
+            }
+            break;
+        }
+        nb_sent++;
+    }
+
+    return nb_sent;
+}
+#endif
+#endif
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from,
@@ -1083,10 +1339,9 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
         if (bytes_sent <= 0) {
             last_error = WSAGetLastError();
 
-#ifndef DISABLE_DEBUG_PRINTF
-            DBG_PRINTF("Could not send packet on UDP socket[AF=%d]= %d!\n",
+            PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                "Could not send packet on UDP socket[AF=%d]= %d!",
                 addr_dest->sa_family, last_error);
-#endif
         }
     }
 
@@ -1098,6 +1353,19 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     return bytes_sent;
 }
 #else
+{
+    return picoquic_sendmsg_flags(fd, addr_dest, addr_from, dest_if,
+        bytes, length, send_msg_size, 0, sock_err);
+}
+#endif
+
+#ifndef _WINDOWS
+int picoquic_sendmsg_flags(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from,
+    int dest_if,
+    const char* bytes, int length,
+    int send_msg_size, int flags, int* sock_err)
 {
     struct msghdr msg;
     struct iovec dataBuf;
@@ -1120,15 +1388,56 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     /* Format the control message */
     picoquic_socks_cmsg_format(&msg, length, send_msg_size, addr_from, dest_if);
 
-    bytes_sent = sendmsg(fd, &msg, 0);
+    bytes_sent = sendmsg(fd, &msg, flags);
 
 
     if (bytes_sent <= 0) {
         int last_error = errno;
-#ifndef DISABLE_DEBUG_PRINTF
-        DBG_PRINTF("Could not send packet on UDP socket[AF=%d]= %d!\n",
+        PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+            "Could not send packet on UDP socket[AF=%d]= %d!",
+            addr_dest->sa_family, last_error);
+        if (sock_err != NULL) {
+            *sock_err = last_error;
+        }
+    }
+    return bytes_sent;
+}
+
+int picoquic_sendmsg_txtime(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from,
+    int dest_if,
+    const char* bytes, int length,
+    int send_msg_size, uint64_t txtime_ns, int* sock_err)
+{
+    struct msghdr msg;
+    struct iovec dataBuf;
+    char cmsg_buffer[1024];
+    int bytes_sent;
+
+    /* Format the message header */
+
+    dataBuf.iov_base = (char*)bytes;
+    dataBuf.iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr_dest;
+    msg.msg_namelen = picoquic_addr_length(addr_dest);
+    msg.msg_iov = &dataBuf;
+    msg.msg_iovlen = 1;
+    msg.msg_control = (void*)cmsg_buffer;
+    msg.msg_controllen = sizeof(cmsg_buffer);
+
+    /* Format the control message, including the transmit timestamp */
+    picoquic_socks_cmsg_format_ex(&msg, length, send_msg_size, addr_from, dest_if, txtime_ns);
+
+    bytes_sent = sendmsg(fd, &msg, 0);
+
+    if (bytes_sent <= 0) {
+        int last_error = errno;
+        PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+            "Could not send packet on UDP socket[AF=%d]= %d!",
             addr_dest->sa_family, last_error);
-#endif
         if (sock_err != NULL) {
             *sock_err = last_error;
         }
@@ -1202,7 +1511,8 @@ int picoquic_select_ex(SOCKET_TYPE* sockets,
                         continue;
                     }
 #endif
-                    DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
+                    PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS,
+                        "Could not receive packet on UDP socket[%d]= %d!",
                         i, (int)sockets[i]);
 
                     break;
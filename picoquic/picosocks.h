@@ -185,6 +185,14 @@ void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets);
 int picoquic_socket_set_pkt_info(SOCKET_TYPE sd, int af);
 int picoquic_socket_set_ecn_options(SOCKET_TYPE sd, int af, int * recv_set, int * send_set);
 int picoquic_socket_set_pmtud_options(SOCKET_TYPE sd, int af);
+/* Set SO_REUSEPORT, so several sockets can bind to the same port and the
+ * kernel shards incoming datagrams between them. Must be called before
+ * binding. Returns -1 on platforms without the option, notably Windows. */
+int picoquic_socket_set_reuseport(SOCKET_TYPE sd);
+/* Set SO_TXTIME on CLOCK_MONOTONIC, so sends can carry a per packet
+ * transmit timestamp that an fq or etf qdisc enforces. Linux only;
+ * returns -1 on platforms or kernels without the option. */
+int picoquic_socket_set_txtime(SOCKET_TYPE sd);
 
 int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
     struct sockaddr_storage* addr_from,
@@ -213,6 +221,84 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
     unsigned char* received_ecn,
     uint8_t* buffer, int buffer_max);
 
+/* Variant of picoquic_recvmsg that also reports the segment size of a
+ * coalesced datagram train, as provided by UDP_COALESCED_INFO on Windows
+ * or UDP_GRO on Linux. *udp_coalesced_size is set to 0 if the received
+ * data is a single datagram.
+ */
+int picoquic_recvmsg_ex(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffer, int buffer_max,
+    size_t* udp_coalesced_size);
+
+#ifndef _WINDOWS
+/* Batched receive. On platforms that provide recvmmsg(), receive up to
+ * nb_messages_max datagrams in a single system call; on other Unix
+ * platforms, fall back to a single picoquic_recvmsg() call. The caller
+ * provides arrays of nb_messages_max entries for the addresses, interface
+ * indices, ECN marks and received lengths, and a single buffer of
+ * nb_messages_max*buffer_max bytes; message number i is received at
+ * offset i*buffer_max. Returns the number of messages received, or -1
+ * in case of error.
+ */
+#define PICOQUIC_RECVMMSG_MAX 64
+
+int picoquic_recvmmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    struct sockaddr_storage* addr_dest,
+    int* dest_if,
+    unsigned char* received_ecn,
+    uint8_t* buffers, int buffer_max,
+    int* bytes_recv, int nb_messages_max);
+
+/* Batched send. On platforms that provide sendmmsg(), send up to
+ * nb_messages datagrams in a single system call; on other Unix
+ * platforms, fall back to one picoquic_sendmsg() call per message.
+ * Message number i starts at offset i*buffer_stride in the common
+ * buffer and is lengths[i] bytes long; send_msg_sizes[i] carries the
+ * per-message UDP GSO segment size, or 0 if the message is a single
+ * datagram. Returns the number of messages sent; on error, returns
+ * the number of messages sent before the failure, or -1 if the first
+ * message failed, and sets *sock_err.
+ */
+#define PICOQUIC_SENDMMSG_MAX 64
+
+int picoquic_sendmmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_dest,
+    struct sockaddr_storage* addr_from,
+    int* dest_if,
+    uint8_t* buffers, size_t buffer_stride,
+    size_t* lengths, size_t* send_msg_sizes,
+    int nb_messages, int* sock_err);
+
+/* Variant of picoquic_sendmsg taking explicit sendmsg() flags, e.g.
+ * MSG_ZEROCOPY. With MSG_ZEROCOPY, the caller must keep the message
+ * buffer stable until the kernel posts the matching completion on the
+ * socket error queue (see the zero-copy pool in sockloop.c).
+ */
+int picoquic_sendmsg_flags(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from,
+    int dest_if,
+    const char* bytes, int length,
+    int send_msg_size, int flags, int* sock_err);
+
+/* Variant of picoquic_sendmsg stamping the message with a transmit
+ * timestamp (nanoseconds on CLOCK_MONOTONIC), which the fq or etf
+ * qdisc enforces. The socket must have been configured with
+ * picoquic_socket_set_txtime() first.
+ */
+int picoquic_sendmsg_txtime(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    struct sockaddr* addr_from,
+    int dest_if,
+    const char* bytes, int length,
+    int send_msg_size, uint64_t txtime_ns, int* sock_err);
+#endif
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     struct sockaddr* addr_from,
@@ -265,6 +351,17 @@ void picoquic_socks_cmsg_format(
     struct sockaddr* addr_from,
     int dest_if);
 
+/* Same as picoquic_socks_cmsg_format, plus an optional SCM_TXTIME
+ * transmit timestamp (nanoseconds on CLOCK_MONOTONIC, zero to omit).
+ * The timestamp is ignored on platforms without SO_TXTIME. */
+void picoquic_socks_cmsg_format_ex(
+    void* vmsg,
+    size_t message_length,
+    size_t send_msg_size,
+    struct sockaddr* addr_from,
+    int dest_if,
+    uint64_t txtime_ns);
+
 #ifdef __cplusplus
 }
 #endif
@@ -77,6 +77,18 @@ static void zigzag(picosplay_node_t *x) {
     rotate(x);
 }
 
+#ifdef PICOQUIC_CONTAINER_STATS
+/* Record the depth reached by a find or insert descent */
+static void picosplay_account_descent(picosplay_tree_t* tree, uint64_t nb_steps)
+{
+    tree->nb_descents++;
+    tree->nb_steps += nb_steps;
+    if (nb_steps > tree->depth_max) {
+        tree->depth_max = nb_steps;
+    }
+}
+#endif
+
 /* Initialize an empty tree, storing the picosplay_comparator. */
 void picosplay_init_tree(picosplay_tree_t* tree, picosplay_comparator comp, picosplay_create create, picosplay_delete_node delete_node, picosplay_node_value node_value) {
     tree->comp = comp;
@@ -85,6 +97,11 @@ void picosplay_init_tree(picosplay_tree_t* tree, picosplay_comparator comp, pico
     tree->node_value = node_value;
     tree->root = NULL;
     tree->size = 0;
+#ifdef PICOQUIC_CONTAINER_STATS
+    tree->nb_descents = 0;
+    tree->nb_steps = 0;
+    tree->depth_max = 0;
+#endif
 }
 
 /* Return an empty tree, storing the picosplay_comparator. */
@@ -113,7 +130,13 @@ picosplay_node_t* picosplay_insert(picosplay_tree_t *tree, void *value) {
             picosplay_node_t *curr = tree->root;
             picosplay_node_t *parent = NULL;
             int left = 0;
+#ifdef PICOQUIC_CONTAINER_STATS
+            uint64_t nb_steps = 0;
+#endif
             while (curr != NULL) {
+#ifdef PICOQUIC_CONTAINER_STATS
+                nb_steps++;
+#endif
                 parent = curr;
                 if (tree->comp(tree->node_value(new), tree->node_value(curr)) < 0) {
                     left = 1;
@@ -124,6 +147,9 @@ picosplay_node_t* picosplay_insert(picosplay_tree_t *tree, void *value) {
                     curr = curr->right;
                 }
             }
+#ifdef PICOQUIC_CONTAINER_STATS
+            picosplay_account_descent(tree, nb_steps);
+#endif
             new->parent = parent;
             if (left)
                 parent->left = new;
@@ -142,7 +168,13 @@ picosplay_node_t* picosplay_find(picosplay_tree_t *tree, void *value)
 {
     picosplay_node_t *curr = tree->root;
     int found = 0;
+#ifdef PICOQUIC_CONTAINER_STATS
+    uint64_t nb_steps = 0;
+#endif
     while(curr != NULL && !found) {
+#ifdef PICOQUIC_CONTAINER_STATS
+        nb_steps++;
+#endif
         int64_t relation = tree->comp(value, tree->node_value(curr));
         if(relation == 0) {
             found = 1;
@@ -152,6 +184,9 @@ picosplay_node_t* picosplay_find(picosplay_tree_t *tree, void *value)
             curr = curr->right;
         }
     }
+#ifdef PICOQUIC_CONTAINER_STATS
+    picosplay_account_descent(tree, nb_steps);
+#endif
 
     /* TODO: there may or may not be a need to perform a splay on a find operation.
      * The Wikipedia example omits it, but this code keeps it. We should
@@ -47,6 +47,13 @@ typedef struct st_picosplay_tree_t {
     picosplay_delete_node delete_node;
     picosplay_node_value node_value;
     int size;
+#ifdef PICOQUIC_CONTAINER_STATS
+    /* Descent depth statistics, collected when the library is built with
+     * PICOQUIC_CONTAINER_STATS; see picoquic_get_container_stats. */
+    uint64_t nb_descents; /* number of find or insert descents */
+    uint64_t nb_steps; /* cumulative nodes visited during descents */
+    uint64_t depth_max; /* deepest descent observed */
+#endif
 } picosplay_tree_t;
 
 
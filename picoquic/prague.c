@@ -97,6 +97,8 @@ typedef enum {
 #define NB_RTT_RENO 4
 #define PRAGUE_SHIFT_G 4 /* g = 1/2^4, gain parameter for alpha EWMA */
 #define PRAGUE_G_INV (1<<PRAGUE_SHIFT_G)
+#define PRAGUE_RTT_VIRT 25000 /* virtual RTT for RTT independence, microseconds */
+#define PRAGUE_FRAC_SHIFT 10 /* window growth accumulated in 1/1024 byte units */
 
 typedef struct st_picoquic_prague_state_t {
     picoquic_prague_alg_state_t alg_state;
@@ -104,6 +106,7 @@ typedef struct st_picoquic_prague_state_t {
     uint64_t alpha_shifted;
     uint64_t alpha;
     uint64_t residual_ack;
+    uint64_t cwin_frac; /* fractional window, in 1/1024 byte units */
     uint64_t ssthresh;
     uint64_t recovery_start;
     uint64_t l4s_update_sent;
@@ -118,6 +121,8 @@ static void picoquic_prague_init_reno(picoquic_prague_state_t* pr_state, picoqui
     pr_state->alg_state = picoquic_prague_alg_slow_start;
     pr_state->ssthresh = UINT64_MAX;
     pr_state->alpha = 0;
+    pr_state->residual_ack = 0;
+    pr_state->cwin_frac = 0;
     path_x->cwin = PICOQUIC_CWIN_INITIAL;
 }
 
@@ -198,7 +203,8 @@ static void picoquic_prague_enter_recovery(
     pr_state->recovery_start = current_time;
 
     pr_state->residual_ack = 0;
-    
+    pr_state->cwin_frac = 0;
+
     picoquic_prague_reset_l3s(cnx, pr_state, path_x);
 }
 
@@ -235,6 +241,18 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
             is_suspect = 1;
             frac = 128;
         }
+        /* With batched ACK processing, a single notification can account
+         * for the marks of several RTT epochs. Apply one smoothing step
+         * per elapsed epoch, so alpha converges at the same pace as if
+         * each epoch had been reported individually. */
+        uint64_t nb_epochs = 1;
+        if (pr_state->l4s_update_sent != 0 && path_x->smoothed_rtt > 0 &&
+            update_sent > pr_state->l4s_update_sent + path_x->smoothed_rtt) {
+            nb_epochs = (update_sent - pr_state->l4s_update_sent) / path_x->smoothed_rtt;
+            if (nb_epochs > PRAGUE_G_INV) {
+                nb_epochs = PRAGUE_G_INV;
+            }
+        }
         pr_state->l4s_update_sent = update_sent;
 
         if (delta_ce > 0 || delta_ect1 > 0) {
@@ -243,10 +261,12 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
                 pr_state->alpha_shifted = frac << PRAGUE_SHIFT_G;
             }
             else {
-                int64_t delta_frac = frac - pr_state->alpha;
+                for (uint64_t k = 0; k < nb_epochs; k++) {
+                    int64_t delta_frac = frac - pr_state->alpha;
 
-                pr_state->alpha_shifted += delta_frac;
-                pr_state->alpha = pr_state->alpha_shifted >> PRAGUE_SHIFT_G;
+                    pr_state->alpha_shifted += delta_frac;
+                    pr_state->alpha = pr_state->alpha_shifted >> PRAGUE_SHIFT_G;
+                }
             }
         }
         pr_state->l4s_epoch_send = pkt_ctx->send_sequence;
@@ -325,9 +345,23 @@ void picoquic_prague_notify(
             default: {
                 uint64_t complete_delta = ack_state->nb_bytes_acknowledged * path_x->send_mtu + pr_state->residual_ack;
                 pr_state->residual_ack = complete_delta % path_x->cwin;
-                uint64_t delta = complete_delta / path_x->cwin;
-                delta = (delta * (1024 - pr_state->alpha)) / 1024;
-                path_x->cwin += delta;
+                uint64_t delta_frac = (complete_delta / path_x->cwin) * (1024 - pr_state->alpha);
+                if (path_x->smoothed_rtt > 0 && path_x->smoothed_rtt < PRAGUE_RTT_VIRT) {
+                    /* RTT independence: grow the window as if the RTT was
+                     * the virtual RTT, so short RTT flows do not starve
+                     * flows running at the 25 ms reference. The factor is
+                     * squared because the per ACK increment already
+                     * compounds once per actual RTT. */
+                    delta_frac = (delta_frac * path_x->smoothed_rtt) / PRAGUE_RTT_VIRT;
+                    delta_frac = (delta_frac * path_x->smoothed_rtt) / PRAGUE_RTT_VIRT;
+                }
+                /* Accumulate the growth in 1/1024 byte units: at sub
+                 * millisecond RTTs the per ACK increment is well below a
+                 * byte, and truncating it to an integer makes the window
+                 * oscillate between growth and stall. */
+                pr_state->cwin_frac += delta_frac;
+                path_x->cwin += pr_state->cwin_frac >> PRAGUE_FRAC_SHIFT;
+                pr_state->cwin_frac &= (1 << PRAGUE_FRAC_SHIFT) - 1;
                 break;
             }
             }
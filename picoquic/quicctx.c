@@ -23,6 +23,7 @@
 #include "picoquic.h"
 #include "picoquic_internal.h"
 #include "picoquic_utils.h"
+#include "picoquic_probes.h"
 #include "picoquic_unified_log.h"
 #include "tls_api.h"
 #include <stdlib.h>
@@ -33,6 +34,11 @@
 #include <errno.h>
 #endif
 
+/* Size classes for the send queue buffer pools,
+ * see picoquic_stream_buffer_alloc */
+static const size_t picoquic_stream_buffer_class_size[PICOQUIC_STREAM_BUFFER_NB_CLASSES] = {
+    PICOQUIC_MAX_PACKET_SIZE, 0x4000, 0x10000 };
+
 
 /*
  * Supported versions. Specific versions may mandate different processing of different
@@ -339,6 +345,29 @@ static picohash_item * picoquic_net_icid_to_item(const void* key)
     return &cnx->registered_icid_item;
 }
 
+static uint64_t picoquic_stream_id_hash(const void* key)
+{
+    const picoquic_stream_head_t* stream = (const picoquic_stream_head_t*)key;
+    uint64_t hash = (stream->stream_id + 1) * 0x9E3779B97F4A7C15ull;
+
+    return hash ^ (hash >> 29);
+}
+
+static int picoquic_stream_id_compare(const void* key1, const void* key2)
+{
+    const picoquic_stream_head_t* stream1 = (const picoquic_stream_head_t*)key1;
+    const picoquic_stream_head_t* stream2 = (const picoquic_stream_head_t*)key2;
+
+    return (stream1->stream_id == stream2->stream_id) ? 0 : -1;
+}
+
+static picohash_item * picoquic_stream_to_item(const void* key)
+{
+    picoquic_stream_head_t* stream = (picoquic_stream_head_t*)key;
+
+    return &stream->hash_item;
+}
+
 static uint64_t picoquic_net_secret_hash(const void* key)
 {
     const picoquic_cnx_t* cnx = (const picoquic_cnx_t*)key;
@@ -556,6 +585,17 @@ static void picoquic_registered_token_delete(void* tree, picosplay_node_t* node)
     free(rt);
 }
 
+/* Shared token reuse registry. When several QUIC contexts serve the same
+ * port from one process -- e.g. the shards of a network thread pool --
+ * a returning client's token may land on any of them, so the reuse
+ * check must consult a registry common to all shards. The registry is
+ * consulted once per incoming token, not per packet, so a mutex around
+ * the shared splay tree is sufficient. */
+struct st_picoquic_shared_token_registry_t {
+    picoquic_mutex_t mutex;
+    picosplay_tree_t token_reuse_tree;
+};
+
 int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
     const uint8_t * token, size_t token_length, uint64_t expiry_time)
 {
@@ -563,12 +603,19 @@ int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
     if (token_length >= 8) {
         picoquic_registered_token_t* rt = (picoquic_registered_token_t*)malloc(sizeof(picoquic_registered_token_t));
         if (rt != NULL) {
+            picosplay_tree_t* tree = &quic->token_reuse_tree;
+            struct st_picoquic_shared_token_registry_t* registry = quic->shared_token_registry;
             picosplay_node_t* rt_n = NULL;
+
             memset(rt, 0, sizeof(picoquic_registered_token_t));
             rt->token_time = expiry_time;
             rt->token_hash = PICOPARSE_64(token + token_length - 8);
             rt->count = 1;
-            rt_n = picosplay_find(&quic->token_reuse_tree, rt);
+            if (registry != NULL) {
+                tree = &registry->token_reuse_tree;
+                (void)picoquic_lock_mutex(&registry->mutex);
+            }
+            rt_n = picosplay_find(tree, rt);
             if (rt_n != NULL) {
                 free(rt);
                 rt = (picoquic_registered_token_t*)picoquic_registered_token_value(rt_n);
@@ -576,9 +623,12 @@ int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
                 DBG_PRINTF("Token reuse detected, count=%d", rt->count);
             }
             else {
-                (void)picosplay_insert(&quic->token_reuse_tree, rt);
+                (void)picosplay_insert(tree, rt);
                 ret = 0;
             }
+            if (registry != NULL) {
+                (void)picoquic_unlock_mutex(&registry->mutex);
+            }
         }
     }
 
@@ -587,17 +637,62 @@ int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
 
 void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time_max)
 {
+    picosplay_tree_t* tree = &quic->token_reuse_tree;
+    struct st_picoquic_shared_token_registry_t* registry = quic->shared_token_registry;
     int end_reached = 0;
+
+    if (registry != NULL) {
+        tree = &registry->token_reuse_tree;
+        (void)picoquic_lock_mutex(&registry->mutex);
+    }
     do {
         picoquic_registered_token_t* rt_first = (picoquic_registered_token_t*)
-            picoquic_registered_token_value(picosplay_first(&quic->token_reuse_tree));
+            picoquic_registered_token_value(picosplay_first(tree));
         if (rt_first == NULL || rt_first->token_time >= expiry_time_max) {
             end_reached = 1;
         }
         else {
-            picosplay_delete_hint(&quic->token_reuse_tree, &rt_first->registered_token_node);
+            picosplay_delete_hint(tree, &rt_first->registered_token_node);
         }
     } while (!end_reached);
+    if (registry != NULL) {
+        (void)picoquic_unlock_mutex(&registry->mutex);
+    }
+}
+
+picoquic_shared_token_registry_t* picoquic_create_shared_token_registry(void)
+{
+    picoquic_shared_token_registry_t* registry = (picoquic_shared_token_registry_t*)malloc(
+        sizeof(picoquic_shared_token_registry_t));
+
+    if (registry != NULL) {
+        memset(registry, 0, sizeof(picoquic_shared_token_registry_t));
+        if (picoquic_create_mutex(&registry->mutex) != 0) {
+            free(registry);
+            registry = NULL;
+        }
+        else {
+            picosplay_init_tree(&registry->token_reuse_tree, picoquic_registered_token_compare,
+                picoquic_registered_token_create, picoquic_registered_token_delete,
+                picoquic_registered_token_value);
+        }
+    }
+
+    return registry;
+}
+
+void picoquic_delete_shared_token_registry(picoquic_shared_token_registry_t* registry)
+{
+    if (registry != NULL) {
+        picosplay_empty_tree(&registry->token_reuse_tree);
+        (void)picoquic_delete_mutex(&registry->mutex);
+        free(registry);
+    }
+}
+
+void picoquic_attach_token_registry(picoquic_quic_t* quic, picoquic_shared_token_registry_t* registry)
+{
+    quic->shared_token_registry = registry;
 }
 
 int picoquic_adjust_max_connections(picoquic_quic_t * quic, uint32_t max_nb_connections)
@@ -895,12 +990,48 @@ void picoquic_set_default_handshake_timeout(picoquic_quic_t* quic, uint64_t hand
     quic->default_handshake_timeout = handshake_timeout_us;
 }
 
+void picoquic_set_default_hibernate_delay(picoquic_quic_t* quic, uint64_t hibernate_delay_us)
+{
+    quic->hibernate_delay = hibernate_delay_us;
+}
+
+void picoquic_set_stream_memory_limits(picoquic_quic_t* quic, uint64_t per_cnx_limit, uint64_t total_limit)
+{
+    quic->stream_memory_cnx_limit = per_cnx_limit;
+    quic->stream_memory_quic_limit = total_limit;
+}
+
+uint64_t picoquic_get_cnx_stream_memory(picoquic_cnx_t* cnx)
+{
+    return cnx->stream_memory;
+}
+
+uint64_t picoquic_get_stream_memory_total(picoquic_quic_t* quic)
+{
+    return quic->stream_memory_total;
+}
+
+void picoquic_set_reassembly_spill_cap(picoquic_quic_t* quic, uint64_t bytes_per_stream)
+{
+    quic->reassembly_spill_cap = bytes_per_stream;
+}
+
 void picoquic_set_default_crypto_epoch_length(picoquic_quic_t* quic, uint64_t crypto_epoch_length_max)
 {
     quic->crypto_epoch_length_max = (crypto_epoch_length_max == 0) ?
         PICOQUIC_DEFAULT_CRYPTO_EPOCH_LENGTH : crypto_epoch_length_max;
 }
 
+void picoquic_set_ticket_issuance_delay(picoquic_quic_t* quic, uint64_t delay_microsec)
+{
+    quic->ticket_issuance_delay = delay_microsec;
+}
+
+void picoquic_set_deferred_stream_copy(picoquic_quic_t* quic, size_t min_size)
+{
+    quic->deferred_copy_min_size = min_size;
+}
+
 uint64_t picoquic_get_default_crypto_epoch_length(picoquic_quic_t* quic)
 {
     return quic->crypto_epoch_length_max;
@@ -944,9 +1075,17 @@ void picoquic_set_default_bdp_frame_option(picoquic_quic_t* quic, int bdp_option
     quic->default_send_receive_bdp_frame = bdp_option;
 }
 
+void picoquic_set_default_fec_option(picoquic_quic_t* quic, int enable_fec)
+{
+    quic->default_fec_enabled = enable_fec;
+}
+
 void picoquic_free(picoquic_quic_t* quic)
 {
     if (quic != NULL) {
+        /* stop the crypto workers before tearing down the AEAD contexts
+         * that pending jobs might still reference */
+        picoquic_delete_crypto_worker_pool(quic);
 
         /* delete all the connection contexts -- do this before any other
          * action, as deleting connections may add packets to queues or
@@ -968,38 +1107,115 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->aead_decrypt_ticket_ctx = NULL;
         }
 
+        if (quic->aead_encrypt_retry_token_ctx != NULL) {
+            picoquic_aead_free(quic->aead_encrypt_retry_token_ctx);
+            quic->aead_encrypt_retry_token_ctx = NULL;
+        }
+
+        if (quic->aead_decrypt_retry_token_ctx != NULL) {
+            picoquic_aead_free(quic->aead_decrypt_retry_token_ctx);
+            quic->aead_decrypt_retry_token_ctx = NULL;
+        }
+
+        picoquic_clear_ticket_cache(quic);
+
         if (quic->default_alpn != NULL) {
             free((void*)quic->default_alpn);
             quic->default_alpn = NULL;
         }
 
+        if (quic->tp_prefix_cache != NULL) {
+            free(quic->tp_prefix_cache);
+            quic->tp_prefix_cache = NULL;
+            quic->tp_prefix_cache_length = 0;
+        }
+
+        if (quic->tp_layout_cache != NULL) {
+            free(quic->tp_layout_cache);
+            quic->tp_layout_cache = NULL;
+        }
+
         /* delete the stored tickets */
         picoquic_free_tickets(&quic->p_first_ticket);
+        quic->ticket_memory_size = 0;
+        picoquic_ticket_store_unmap(quic);
 
-        /* Delete the stored tokens */
+        /* Delete the stored tokens and their hash index */
         picoquic_free_tokens(&quic->p_first_token);
+        if (quic->token_hash_bucket != NULL) {
+            free(quic->token_hash_bucket);
+            quic->token_hash_bucket = NULL;
+        }
 
         /* Deelete the reused tokens tree */
         picosplay_empty_tree(&quic->token_reuse_tree);
 
+        /* Delete the version preference cache */
+        if (quic->version_pref_cache != NULL) {
+            free(quic->version_pref_cache);
+            quic->version_pref_cache = NULL;
+        }
+
+        /* Close the store journal */
+        picoquic_journal_close(quic);
+
         /* delete packets in pool */
         while (quic->p_first_packet != NULL) {
             picoquic_packet_t * p = quic->p_first_packet->packet_previous;
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, quic->p_first_packet->bytes_alloc);
+            free(quic->p_first_packet->bytes);
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
             free(quic->p_first_packet);
             quic->p_first_packet = p;
             quic->nb_packets_allocated--;
             quic->nb_packets_in_pool--;
         }
 
-        /* delete data nodes in pool */
-        while (quic->p_first_data_node != NULL) {
-            picoquic_stream_data_node_t* p = quic->p_first_data_node->next_stream_data;
-            free(quic->p_first_data_node);
-            quic->p_first_data_node = p;
-            quic->nb_data_nodes_allocated--;
-            quic->nb_data_nodes_in_pool--;
+        /* delete the stream data node slabs; the free list points into them */
+        while (quic->p_first_data_slab != NULL) {
+            picoquic_stream_data_slab_t* s = quic->p_first_data_slab->next_slab;
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_stream_nodes, sizeof(picoquic_stream_data_slab_t));
+            free(quic->p_first_data_slab);
+            quic->p_first_data_slab = s;
+            quic->nb_data_nodes_allocated -= PICOQUIC_STREAM_DATA_SLAB_NB_NODES;
+        }
+        quic->p_first_data_node = NULL;
+        quic->nb_data_nodes_in_pool = 0;
+
+        while (quic->p_first_payload_full != NULL) {
+            uint8_t* bytes = quic->p_first_payload_full;
+            quic->p_first_payload_full = *(uint8_t**)bytes;
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, PICOQUIC_MAX_PACKET_SIZE);
+            free(bytes);
+        }
+        quic->nb_payload_full_in_pool = 0;
+        while (quic->p_first_payload_small != NULL) {
+            uint8_t* bytes = quic->p_first_payload_small;
+            quic->p_first_payload_small = *(uint8_t**)bytes;
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE);
+            free(bytes);
+        }
+        quic->nb_payload_small_in_pool = 0;
+
+        if (quic->spill_file != NULL) {
+            (void)fclose(quic->spill_file);
+            quic->spill_file = NULL;
+        }
+
+        for (int i = 0; i < PICOQUIC_STREAM_BUFFER_NB_CLASSES; i++) {
+            while (quic->stream_buffer_pool[i] != NULL) {
+                uint8_t* bytes = quic->stream_buffer_pool[i];
+                quic->stream_buffer_pool[i] = *(uint8_t**)bytes;
+                PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_stream_buffers,
+                    picoquic_stream_buffer_class_size[i]);
+                free(bytes);
+            }
+            quic->nb_stream_buffers_in_pool[i] = 0;
         }
 
+        /* delete recycled TLS context wrappers */
+        picoquic_tlscontext_clear_pool(quic);
+
         /* delete all pending stateless packets */
         while (quic->pending_stateless_packet != NULL) {
             picoquic_stateless_packet_t* to_delete = quic->pending_stateless_packet;
@@ -1039,6 +1255,13 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->tls_master_ctx = NULL;
         }
 
+        picoquic_clear_tls_credentials_files(quic);
+
+        if (quic->cert_root_file_name != NULL) {
+            free(quic->cert_root_file_name);
+            quic->cert_root_file_name = NULL;
+        }
+
         /* Close the logs */
         picoquic_log_close_logs(quic);
 
@@ -1049,6 +1272,9 @@ void picoquic_free(picoquic_quic_t* quic)
             (void)(quic->perflog_fn)(quic, NULL, 1);
         }
 
+        picoquic_perf_export_close(quic);
+        picoquic_close_log_close(quic);
+
         free(quic);
     }
 }
@@ -1081,6 +1307,15 @@ void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode)
     quic->check_token = (quic->force_check_token || quic->max_half_open_before_retry <= quic->current_number_half_open);
 }
 
+void picoquic_set_mac_retry_tokens(picoquic_quic_t* quic, int use_mac_tokens)
+{
+    if (use_mac_tokens && !quic->use_mac_retry_tokens) {
+        /* Draw a fresh SipHash key when entering MAC mode */
+        picoquic_crypto_random(quic, quic->retry_token_mac_key, sizeof(quic->retry_token_mac_key));
+    }
+    quic->use_mac_retry_tokens = (use_mac_tokens) ? 1 : 0;
+}
+
 void picoquic_set_max_half_open_retry_threshold(picoquic_quic_t* quic,  uint32_t max_half_open_before_retry)
 {
     quic->max_half_open_before_retry = max_half_open_before_retry;
@@ -1343,60 +1578,354 @@ static void picoquic_remove_cnx_from_list(picoquic_cnx_t* cnx)
     cnx->quic->current_number_connections--;
 }
 
-/* Management of the list of connections, sorted by wake time */
+/* Management of the list of connections, sorted by wake time.
+ *
+ * The connections are kept in a hierarchical timer wheel (see the
+ * definition in picoquic_internal.h) instead of a tree, so the very
+ * frequent wake time updates performed by pacing and ACK scheduling
+ * are O(1): unlink from the current bucket, compute the new bucket
+ * from the wake time, link there. The "next wake" queries pay for
+ * this with a bounded scan: the due list, then the first non empty
+ * bucket of each level. Buckets are unordered, but within a level the
+ * first non empty bucket ahead of the cursor holds that level's
+ * minimum, so one bucket list per level is enough to find the exact
+ * minimum across the wheel.
+ */
 
-static void* picoquic_wake_list_node_value(picosplay_node_t* cnx_wake_node)
+#define PICOQUIC_WAKE_WHEEL_SLOT_MASK (PICOQUIC_WAKE_WHEEL_NB_SLOTS - 1)
+
+static void picoquic_wake_list_init(picoquic_quic_t * quic)
 {
-    return (cnx_wake_node == NULL)?NULL:(void*)((char*)cnx_wake_node - offsetof(struct st_picoquic_cnx_t, cnx_wake_node));
+    memset(&quic->cnx_wake_wheel, 0, sizeof(picoquic_cnx_wake_wheel_t));
 }
 
-static int64_t picoquic_wake_list_compare(void* l, void* r) {
-    const uint64_t ltime = ((picoquic_cnx_t*)l)->next_wake_time;
-    const uint64_t rtime = ((picoquic_cnx_t*)r)->next_wake_time;
-    if (ltime < rtime) return -1;
-    if (ltime > rtime) return 1;
-    return 0;
+static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
+{
+    if (cnx->cnx_wake_bucket != NULL) {
+        if (cnx->cnx_wake_previous == NULL) {
+            *cnx->cnx_wake_bucket = cnx->cnx_wake_next;
+        }
+        else {
+            cnx->cnx_wake_previous->cnx_wake_next = cnx->cnx_wake_next;
+        }
+        if (cnx->cnx_wake_next != NULL) {
+            cnx->cnx_wake_next->cnx_wake_previous = cnx->cnx_wake_previous;
+        }
+        cnx->cnx_wake_next = NULL;
+        cnx->cnx_wake_previous = NULL;
+        cnx->cnx_wake_bucket = NULL;
+    }
 }
 
-static picosplay_node_t* picoquic_wake_list_create_node(void* v_cnx)
+static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
 {
-    return &((picoquic_cnx_t*)v_cnx)->cnx_wake_node;
+    picoquic_cnx_wake_wheel_t* wheel = &quic->cnx_wake_wheel;
+    picoquic_cnx_t** bucket;
+
+    if (cnx->next_wake_time == UINT64_MAX) {
+        bucket = &wheel->idle_list;
+    }
+    else {
+        uint64_t wake_slot = cnx->next_wake_time >> PICOQUIC_WAKE_WHEEL_GRANULARITY_BITS;
+
+        if (wake_slot <= wheel->wheel_slot) {
+            bucket = &wheel->due_list;
+        }
+        else {
+            uint64_t delta = wake_slot - wheel->wheel_slot;
+            int level = 0;
+
+            while (level < PICOQUIC_WAKE_WHEEL_NB_LEVELS &&
+                (delta >> ((level + 1) * PICOQUIC_WAKE_WHEEL_SLOT_BITS)) != 0) {
+                level++;
+            }
+            if (level >= PICOQUIC_WAKE_WHEEL_NB_LEVELS) {
+                bucket = &wheel->overflow_list;
+            }
+            else {
+                bucket = &wheel->slots[level][
+                    (wake_slot >> (level * PICOQUIC_WAKE_WHEEL_SLOT_BITS)) & PICOQUIC_WAKE_WHEEL_SLOT_MASK];
+            }
+        }
+    }
+
+    cnx->cnx_wake_next = *bucket;
+    cnx->cnx_wake_previous = NULL;
+    if (*bucket != NULL) {
+        (*bucket)->cnx_wake_previous = cnx;
+    }
+    *bucket = cnx;
+    cnx->cnx_wake_bucket = bucket;
 }
 
-static void picoquic_wake_list_delete_node(void* tree, picosplay_node_t* node)
+/* Move the wheel cursor forward. Buckets that the cursor passes are
+ * emptied and their connections placed again relative to the new cursor
+ * position: either on the due list, or on a finer level of the wheel.
+ * Levels are processed fine to coarse: entries drained from level l
+ * reinsert on the due list or on a level finer than l, whose cursor has
+ * already advanced, so they can never reach a bucket that is still to
+ * be flushed. Each bucket is detached before its entries are placed
+ * again, which keeps the drain loop finite even for an entry whose new
+ * position is the bucket being drained (possible when a jump of more
+ * than PICOQUIC_WAKE_WHEEL_NB_SLOTS cursor steps makes the flush window
+ * wrap over buckets ahead of the new cursor).
+ */
+static void picoquic_wake_wheel_advance(picoquic_quic_t* quic, uint64_t current_time)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(tree);
-#endif
-    memset(node, 0, sizeof(picosplay_node_t));
+    picoquic_cnx_wake_wheel_t* wheel = &quic->cnx_wake_wheel;
+    uint64_t current_slot = current_time >> PICOQUIC_WAKE_WHEEL_GRANULARITY_BITS;
+    uint64_t old_slot = wheel->wheel_slot;
+
+    if (current_slot <= old_slot) {
+        return;
+    }
+    wheel->wheel_slot = current_slot;
+
+    for (int level = 0; level < PICOQUIC_WAKE_WHEEL_NB_LEVELS; level++) {
+        uint64_t old_cursor = old_slot >> (level * PICOQUIC_WAKE_WHEEL_SLOT_BITS);
+        uint64_t new_cursor = current_slot >> (level * PICOQUIC_WAKE_WHEEL_SLOT_BITS);
+        uint64_t steps = new_cursor - old_cursor;
+
+        if (steps > PICOQUIC_WAKE_WHEEL_NB_SLOTS) {
+            steps = PICOQUIC_WAKE_WHEEL_NB_SLOTS;
+        }
+        for (uint64_t i = 1; i <= steps; i++) {
+            picoquic_cnx_t** bucket = &wheel->slots[level][(old_cursor + i) & PICOQUIC_WAKE_WHEEL_SLOT_MASK];
+            picoquic_cnx_t* cnx = *bucket;
+
+            *bucket = NULL;
+            while (cnx != NULL) {
+                picoquic_cnx_t* next_cnx = cnx->cnx_wake_next;
+
+                cnx->cnx_wake_next = NULL;
+                cnx->cnx_wake_previous = NULL;
+                cnx->cnx_wake_bucket = NULL;
+                picoquic_insert_cnx_by_wake_time(quic, cnx);
+                cnx = next_cnx;
+            }
+        }
+    }
 }
 
-static void picoquic_wake_list_init(picoquic_quic_t * quic)
+/* Return the connection with the smallest wake time, or NULL if no
+ * connection has a scheduled wake up. The due list is scanned in full,
+ * which is cheap since its members are about to be processed. Each
+ * level then contributes one candidate, the first non empty bucket
+ * ahead of its cursor: a coarse level can hold an earlier wake time
+ * than a finer one when the cursor has moved past a boundary without
+ * crossing the next coarse boundary, so no level may be skipped. The
+ * overflow list is scanned as well for the same reason. */
+static picoquic_cnx_t* picoquic_wake_wheel_first(picoquic_cnx_wake_wheel_t* wheel)
+{
+    picoquic_cnx_t* best = NULL;
+
+    for (picoquic_cnx_t* cnx = wheel->due_list; cnx != NULL; cnx = cnx->cnx_wake_next) {
+        if (best == NULL || cnx->next_wake_time < best->next_wake_time) {
+            best = cnx;
+        }
+    }
+
+    for (int level = 0; level < PICOQUIC_WAKE_WHEEL_NB_LEVELS; level++) {
+        uint64_t cursor = wheel->wheel_slot >> (level * PICOQUIC_WAKE_WHEEL_SLOT_BITS);
+
+        for (uint64_t i = 1; i <= PICOQUIC_WAKE_WHEEL_NB_SLOTS; i++) {
+            picoquic_cnx_t* cnx = wheel->slots[level][(cursor + i) & PICOQUIC_WAKE_WHEEL_SLOT_MASK];
+
+            if (cnx != NULL) {
+                for (; cnx != NULL; cnx = cnx->cnx_wake_next) {
+                    if (best == NULL || cnx->next_wake_time < best->next_wake_time) {
+                        best = cnx;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    for (picoquic_cnx_t* cnx = wheel->overflow_list; cnx != NULL; cnx = cnx->cnx_wake_next) {
+        if (best == NULL || cnx->next_wake_time < best->next_wake_time) {
+            best = cnx;
+        }
+    }
+
+    if (best == NULL) {
+        /* Only idle connections left; they all share UINT64_MAX */
+        best = wheel->idle_list;
+    }
+
+    return best;
+}
+
+void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
 {
-    picosplay_init_tree(&quic->cnx_wake_tree, picoquic_wake_list_compare,
-        picoquic_wake_list_create_node, picoquic_wake_list_delete_node, picoquic_wake_list_node_value);
+    picoquic_remove_cnx_from_wake_list(cnx);
+    cnx->next_wake_time = next_time;
+    picoquic_insert_cnx_by_wake_time(quic, cnx);
 }
 
-static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
+/* Send scheduling round.
+ *
+ * Preparing a packet reinserts the connection in the timer wheel, and
+ * if its new wake time is still in the past the next "earliest
+ * connection" query returns the same connection, so under load a busy
+ * connection can monopolize a send pass while others wait. The round
+ * fixes that: all currently due connections are moved from the wheel
+ * onto the round list in one pass, and each of them is served one send
+ * train before any is considered again. The list is unordered, like
+ * the due list it is built from, and the per connection budget is the
+ * send train, i.e. at most one send buffer.
+ *
+ * Connections on the round list are not in the wheel, so
+ * picoquic_get_next_wake_time() reports an immediate wake up while the
+ * list is not empty, and a connection is unlinked from the list when
+ * it is deleted or detached. */
+
+static void picoquic_sched_round_remove(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+{
+    if (quic->sched_round_first == cnx) {
+        quic->sched_round_first = cnx->cnx_sched_next;
+    }
+    else if (cnx->cnx_sched_previous != NULL) {
+        cnx->cnx_sched_previous->cnx_sched_next = cnx->cnx_sched_next;
+    }
+    else {
+        /* Not on the round list */
+        return;
+    }
+    if (cnx->cnx_sched_next != NULL) {
+        cnx->cnx_sched_next->cnx_sched_previous = cnx->cnx_sched_previous;
+    }
+    cnx->cnx_sched_next = NULL;
+    cnx->cnx_sched_previous = NULL;
+}
+
+void picoquic_sched_round_collect(picoquic_quic_t* quic, uint64_t current_time)
 {
-    picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    picoquic_cnx_t* cnx;
+
+    picoquic_wake_wheel_advance(quic, current_time);
+    /* After the advance, every connection whose wake time has passed is
+     * on the due list; entries of the same wheel slot with a wake time
+     * still in the future stay in the wheel. */
+    cnx = quic->cnx_wake_wheel.due_list;
+
+    while (cnx != NULL) {
+        picoquic_cnx_t* next_cnx = cnx->cnx_wake_next;
+
+        if (cnx->next_wake_time <= current_time) {
+            picoquic_remove_cnx_from_wake_list(cnx);
+            cnx->cnx_sched_next = quic->sched_round_first;
+            cnx->cnx_sched_previous = NULL;
+            if (quic->sched_round_first != NULL) {
+                quic->sched_round_first->cnx_sched_previous = cnx;
+            }
+            quic->sched_round_first = cnx;
+        }
+        cnx = next_cnx;
+    }
 }
 
-static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+picoquic_cnx_t* picoquic_sched_round_pop(picoquic_quic_t* quic)
 {
-    picosplay_insert(&quic->cnx_wake_tree, cnx);
+    picoquic_cnx_t* cnx = quic->sched_round_first;
+
+    if (cnx != NULL) {
+        quic->sched_round_first = cnx->cnx_sched_next;
+        if (quic->sched_round_first != NULL) {
+            quic->sched_round_first->cnx_sched_previous = NULL;
+        }
+        cnx->cnx_sched_next = NULL;
+        cnx->cnx_sched_previous = NULL;
+    }
+
+    return cnx;
 }
 
-void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
+/* Hand-over of a connection between quic contexts, used by
+ * picoquic_migrate_cnx_to_thread (sockloop.c) to rebalance loop
+ * threads. The connection object moves by pointer within the process,
+ * so the transport state needs no serialization; only the entries in
+ * the per context hash tables and lists move. Detach runs on the
+ * thread owning the source context, attach on the thread owning the
+ * target; in between, the connection must not be touched. */
+void picoquic_detach_cnx(picoquic_cnx_t* cnx)
 {
+    picoquic_local_cnxid_list_t* local_cnxid_list = cnx->first_local_cnxid_list;
+
+    /* Also unregisters the ICID and reset secret table entries */
+    picoquic_remove_cnx_from_list(cnx);
     picoquic_remove_cnx_from_wake_list(cnx);
-    cnx->next_wake_time = next_time;
+    picoquic_sched_round_remove(cnx->quic, cnx);
+
+    while (local_cnxid_list != NULL) {
+        picoquic_local_cnxid_t* l_cid = local_cnxid_list->local_cnxid_first;
+
+        while (l_cid != NULL) {
+            if (l_cid->cnx_id.id_len > 0 && l_cid->registered_cnx != NULL) {
+                picohash_delete_item(cnx->quic->table_cnx_by_id, &l_cid->hash_item, 0);
+                l_cid->registered_cnx = NULL;
+            }
+            l_cid = l_cid->next;
+        }
+        local_cnxid_list = local_cnxid_list->next_list;
+    }
+
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_unregister_net_id(cnx, cnx->path[i]);
+    }
+
+    cnx->quic->cnxid_route_generation++;
+}
+
+int picoquic_attach_cnx(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    picoquic_local_cnxid_list_t* local_cnxid_list = cnx->first_local_cnxid_list;
+
+    cnx->quic = quic;
+    picoquic_insert_cnx_in_list(quic, cnx);
     picoquic_insert_cnx_by_wake_time(quic, cnx);
+
+    while (local_cnxid_list != NULL) {
+        picoquic_local_cnxid_t* l_cid = local_cnxid_list->local_cnxid_first;
+
+        while (l_cid != NULL) {
+            if (l_cid->cnx_id.id_len > 0 &&
+                picoquic_register_cnx_id(quic, cnx, l_cid) != 0) {
+                /* CID collision in the target context. The connection
+                 * cannot be reached under that CID anymore; keep going,
+                 * the remaining CIDs and the net id still route to it. */
+                ret = -1;
+            }
+            l_cid = l_cid->next;
+        }
+        local_cnxid_list = local_cnxid_list->next_list;
+    }
+
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        if (cnx->path[i]->peer_addr.ss_family != 0) {
+            (void)picoquic_register_net_id(quic, cnx, cnx->path[i]);
+        }
+    }
+
+    if (!cnx->client_mode && quic->local_cnxid_length > 0) {
+        (void)picoquic_register_net_icid(cnx);
+    }
+    if (cnx->path[0]->p_remote_cnxid != NULL) {
+        (void)picoquic_register_net_secret(cnx);
+    }
+
+    return ret;
 }
 
 picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_t max_wake_time)
 {
-    picoquic_cnx_t* cnx = (picoquic_cnx_t *)picoquic_wake_list_node_value(picosplay_first(&quic->cnx_wake_tree));
+    picoquic_cnx_t* cnx;
+
+    if (max_wake_time != 0) {
+        picoquic_wake_wheel_advance(quic, max_wake_time);
+    }
+    cnx = picoquic_wake_wheel_first(&quic->cnx_wake_wheel);
     if (cnx != NULL && max_wake_time != 0 && cnx->next_wake_time > max_wake_time)
     {
         cnx = NULL;
@@ -1409,12 +1938,16 @@ uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_tim
 {
     uint64_t wake_time = UINT64_MAX;
 
-    if (quic->pending_stateless_packet != NULL) {
+    if (quic->pending_stateless_packet != NULL ||
+        quic->sched_round_first != NULL) {
+        /* Connections still on the round list are due now */
         wake_time = current_time;
     }
     else{
-        picoquic_cnx_t* cnx_wake_first = (picoquic_cnx_t*)picoquic_wake_list_node_value(
-            picosplay_first(&quic->cnx_wake_tree));
+        picoquic_cnx_t* cnx_wake_first;
+
+        picoquic_wake_wheel_advance(quic, current_time);
+        cnx_wake_first = picoquic_wake_wheel_first(&quic->cnx_wake_wheel);
 
         if (cnx_wake_first != NULL) {
             wake_time = cnx_wake_first->next_wake_time;
@@ -1500,35 +2033,123 @@ int picoquic_get_version_index(uint32_t proposed_version)
     return ret;
 }
 
-static void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length)
+/* Version preference cache. Clients of the same network tend to run the
+ * same stack, so the version negotiated with one of them predicts the
+ * version its neighbors will propose. The server records the negotiated
+ * version when a handshake completes, keyed by the client network, IPv4
+ * masked to /24 and IPv6 to /48. Applications query the cache to steer
+ * reconnecting clients towards a version that will not require a
+ * version negotiation round trip. */
+
+static int picoquic_version_pref_network(struct sockaddr_storage* network, const struct sockaddr* addr)
 {
-    if (id_length > 0) {
-        picoquic_crypto_random(quic, cnx_id->id, id_length);
+    int ret = 0;
+
+    memset(network, 0, sizeof(struct sockaddr_storage));
+
+    if (addr != NULL && addr->sa_family == AF_INET) {
+        struct sockaddr_in* s4 = (struct sockaddr_in*)network;
+        s4->sin_family = AF_INET;
+        memcpy(&s4->sin_addr, &((struct sockaddr_in*)addr)->sin_addr, 4);
+        ((uint8_t*)&s4->sin_addr)[3] = 0;
     }
-    if (id_length < sizeof(cnx_id->id)) {
-        memset(cnx_id->id + id_length, 0, sizeof(cnx_id->id) - id_length);
+    else if (addr != NULL && addr->sa_family == AF_INET6) {
+        struct sockaddr_in6* s6 = (struct sockaddr_in6*)network;
+        s6->sin6_family = AF_INET6;
+        memcpy(&s6->sin6_addr, &((struct sockaddr_in6*)addr)->sin6_addr, 6);
     }
-    cnx_id->id_len = id_length;
+    else {
+        ret = -1;
+    }
+
+    return ret;
 }
 
-void picoquic_create_local_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t* cnx_id, uint8_t id_length, picoquic_connection_id_t cnx_id_remote)
+static size_t picoquic_version_pref_slot(const struct sockaddr_storage* network)
 {
-    /* First call fills the CID with a random value */
-    picoquic_create_random_cnx_id(quic, cnx_id, quic->local_cnxid_length);
-    /* if required for application, call to function update that definition */
-    if (quic->cnx_id_callback_fn) {
-        quic->cnx_id_callback_fn(quic, *cnx_id, cnx_id_remote, quic->cnx_id_callback_ctx, cnx_id);
+    /* FNV-1a over the masked address; the storage was zeroed before masking
+     * so the padding bytes hash the same for equal networks */
+    const uint8_t* bytes = (const uint8_t*)network;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < sizeof(struct sockaddr_storage); i++) {
+        hash ^= bytes[i];
+        hash *= 0x00000100000001b3ull;
     }
+
+    return (size_t)(hash % PICOQUIC_VERSION_PREFERENCE_CACHE_SIZE);
 }
 
-uint64_t picoquic_find_avalaible_unique_path_id(picoquic_cnx_t* cnx, uint64_t requested_id)
+void picoquic_record_version_preference(picoquic_quic_t* quic,
+    const struct sockaddr* addr_peer, uint32_t version)
 {
-    uint64_t unique_path_id = requested_id;
+    struct sockaddr_storage network;
 
-    if (requested_id == UINT64_MAX) {
-        if (!cnx->is_multipath_enabled) {
-            unique_path_id = cnx->unique_path_id_next;
-            cnx->unique_path_id_next++;
+    if (version == 0 || picoquic_version_pref_network(&network, addr_peer) != 0) {
+        return;
+    }
+
+    if (quic->version_pref_cache == NULL) {
+        quic->version_pref_cache = (picoquic_version_pref_entry_t*)malloc(
+            PICOQUIC_VERSION_PREFERENCE_CACHE_SIZE * sizeof(picoquic_version_pref_entry_t));
+        if (quic->version_pref_cache == NULL) {
+            return;
+        }
+        memset(quic->version_pref_cache, 0,
+            PICOQUIC_VERSION_PREFERENCE_CACHE_SIZE * sizeof(picoquic_version_pref_entry_t));
+    }
+
+    picoquic_version_pref_entry_t* entry = &quic->version_pref_cache[picoquic_version_pref_slot(&network)];
+    memcpy(&entry->network, &network, sizeof(struct sockaddr_storage));
+    entry->version = version;
+}
+
+uint32_t picoquic_get_version_preference(picoquic_quic_t* quic, const struct sockaddr* addr_peer)
+{
+    uint32_t version = 0;
+    struct sockaddr_storage network;
+
+    if (quic->version_pref_cache != NULL &&
+        picoquic_version_pref_network(&network, addr_peer) == 0) {
+        picoquic_version_pref_entry_t* entry = &quic->version_pref_cache[picoquic_version_pref_slot(&network)];
+
+        if (picoquic_compare_addr((struct sockaddr*)&entry->network, (struct sockaddr*)&network) == 0) {
+            version = entry->version;
+        }
+    }
+
+    return version;
+}
+
+static void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length)
+{
+    if (id_length > 0) {
+        picoquic_fast_random(quic, cnx_id->id, id_length);
+    }
+    if (id_length < sizeof(cnx_id->id)) {
+        memset(cnx_id->id + id_length, 0, sizeof(cnx_id->id) - id_length);
+    }
+    cnx_id->id_len = id_length;
+}
+
+void picoquic_create_local_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t* cnx_id, uint8_t id_length, picoquic_connection_id_t cnx_id_remote)
+{
+    /* First call fills the CID with a random value */
+    picoquic_create_random_cnx_id(quic, cnx_id, quic->local_cnxid_length);
+    /* if required for application, call to function update that definition */
+    if (quic->cnx_id_callback_fn) {
+        quic->cnx_id_callback_fn(quic, *cnx_id, cnx_id_remote, quic->cnx_id_callback_ctx, cnx_id);
+    }
+}
+
+uint64_t picoquic_find_avalaible_unique_path_id(picoquic_cnx_t* cnx, uint64_t requested_id)
+{
+    uint64_t unique_path_id = requested_id;
+
+    if (requested_id == UINT64_MAX) {
+        if (!cnx->is_multipath_enabled) {
+            unique_path_id = cnx->unique_path_id_next;
+            cnx->unique_path_id_next++;
         }
         else {
             /* Look at available stashes. exlcude stash if id=0, as this is the
@@ -1615,11 +2236,14 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, const struct
             path_x->rtt_variant = 0;
             path_x->retransmit_timer = PICOQUIC_INITIAL_RETRANSMIT_TIMER;
             path_x->rtt_min = 0;
+            path_x->reorder_pkt_threshold = PICOQUIC_REORDER_PKT_THRESHOLD_DEFAULT;
 
             /* Initialize per path congestion control state */
             path_x->cwin = PICOQUIC_CWIN_INITIAL;
             path_x->bytes_in_transit = 0;
             path_x->congestion_alg_state = NULL;
+            path_x->cwin_clamp = UINT64_MAX;
+            path_x->pacing_rate_clamp = UINT64_MAX;
 
             /* Initialize per path pacing state */
             picoquic_pacing_init(&path_x->pacing, start_time);
@@ -1964,6 +2588,53 @@ void picoquic_set_path_challenge(picoquic_cnx_t* cnx, int path_id, uint64_t curr
     }
 }
 
+/* Cache of recently validated peer addresses. Remember an address when its
+ * path validation succeeds; a later migration back to that address can then
+ * skip the challenge round trip, which matters when a NAT flaps between a
+ * small set of ports. Entries expire after
+ * PICOQUIC_VALIDATED_ADDRESS_LIFETIME and slots are recycled oldest first.
+ */
+void picoquic_remember_validated_address(picoquic_cnx_t* cnx, const struct sockaddr* addr_peer, uint64_t current_time)
+{
+    int oldest = 0;
+
+    if (addr_peer == NULL || addr_peer->sa_family == AF_UNSPEC) {
+        return;
+    }
+
+    for (int i = 0; i < PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE; i++) {
+        if (cnx->validated_addr[i].ss_family != AF_UNSPEC &&
+            picoquic_compare_addr((struct sockaddr*)&cnx->validated_addr[i], addr_peer) == 0) {
+            /* Already cached; refresh the validation time */
+            cnx->validated_addr_time[i] = current_time;
+            return;
+        }
+        if (cnx->validated_addr_time[i] < cnx->validated_addr_time[oldest]) {
+            oldest = i;
+        }
+    }
+
+    picoquic_store_addr(&cnx->validated_addr[oldest], addr_peer);
+    cnx->validated_addr_time[oldest] = current_time;
+}
+
+int picoquic_is_address_recently_validated(picoquic_cnx_t* cnx, const struct sockaddr* addr_peer, uint64_t current_time)
+{
+    int is_validated = 0;
+
+    if (addr_peer != NULL && addr_peer->sa_family != AF_UNSPEC) {
+        for (int i = 0; i < PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE; i++) {
+            if (cnx->validated_addr[i].ss_family != AF_UNSPEC &&
+                picoquic_compare_addr((struct sockaddr*)&cnx->validated_addr[i], addr_peer) == 0) {
+                is_validated = (cnx->validated_addr_time[i] + PICOQUIC_VALIDATED_ADDRESS_LIFETIME > current_time);
+                break;
+            }
+        }
+    }
+
+    return is_validated;
+}
+
 /* Find path by address pair
  */
 int picoquic_find_path_by_address(picoquic_cnx_t* cnx, const struct sockaddr* addr_local, 
@@ -2346,6 +3017,193 @@ void picoquic_get_default_path_quality(picoquic_cnx_t* cnx, picoquic_path_qualit
     picoquic_get_path_quality_from_context(path_x, quality);
 }
 
+/* Statistics snapshot for monitoring threads, see picoquic_get_cnx_stats
+ * in picoquic.h. Classic sequence lock: the single writer is the thread
+ * that runs the connection; it bumps the sequence number to an odd value,
+ * rewrites the snapshot, then bumps it back to even. A reader copies the
+ * snapshot between two even, identical sequence reads, retrying
+ * otherwise, so the writer never waits and the reader never blocks it. */
+#ifdef _WINDOWS
+#define picoquic_stats_fence() MemoryBarrier()
+#else
+#define picoquic_stats_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* Apply a tuning request posted by a monitoring thread, see
+ * picoquic_set_path_cwin_clamp. Runs on the connection thread. */
+static void picoquic_apply_cc_tuning(picoquic_cnx_t* cnx, picoquic_cc_tuning_t* tuning, int is_pacing_rate)
+{
+    uint64_t seq = tuning->seq;
+
+    if (seq != tuning->applied_seq) {
+        int path_id;
+
+        picoquic_stats_fence();
+        path_id = picoquic_get_path_id_from_unique(cnx, tuning->unique_path_id);
+        if (path_id >= 0) {
+            if (is_pacing_rate) {
+                cnx->path[path_id]->pacing_rate_clamp = tuning->value;
+            }
+            else {
+                cnx->path[path_id]->cwin_clamp = tuning->value;
+            }
+        }
+        tuning->applied_seq = seq;
+    }
+}
+
+void picoquic_publish_cnx_stats(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picoquic_cnx_stats_t* stats = &cnx->stats_snapshot;
+    picoquic_path_t* path_x = cnx->path[0];
+    int nb_cc = cnx->nb_paths;
+    int i;
+
+    picoquic_apply_cc_tuning(cnx, &cnx->cwin_clamp_tuning, 0);
+    picoquic_apply_cc_tuning(cnx, &cnx->pacing_rate_clamp_tuning, 1);
+
+    if (nb_cc > PICOQUIC_NB_PATH_TARGET) {
+        nb_cc = PICOQUIC_NB_PATH_TARGET;
+    }
+
+    cnx->stats_seq++;
+    picoquic_stats_fence();
+    stats->snapshot_time = current_time;
+    stats->nb_packets_received = cnx->nb_packets_received;
+    stats->nb_packets_sent = cnx->nb_packets_sent;
+    stats->nb_trains_sent = cnx->nb_trains_sent;
+    stats->nb_retransmission_total = cnx->nb_retransmission_total;
+    stats->nb_spurious = cnx->nb_spurious;
+    stats->nb_preemptive_repeat = cnx->nb_preemptive_repeat;
+    stats->data_sent = cnx->data_sent;
+    stats->data_received = cnx->data_received;
+    stats->nb_bytes_queued = cnx->nb_bytes_queued;
+    stats->smoothed_rtt = path_x->smoothed_rtt;
+    stats->rtt_min = path_x->rtt_min;
+    stats->rtt_variant = path_x->rtt_variant;
+    stats->cwin = path_x->cwin;
+    stats->pacing_rate = path_x->pacing.rate;
+    stats->bytes_in_transit = path_x->bytes_in_transit;
+    stats->receive_rate_estimate = path_x->receive_rate_estimate;
+    for (i = 0; i < nb_cc; i++) {
+        picoquic_path_cc_state_t* cc = &cnx->cc_snapshot[i];
+        picoquic_path_t* path_i = cnx->path[i];
+
+        cc->version = PICOQUIC_PATH_CC_STATE_VERSION;
+        cc->unique_path_id = path_i->unique_path_id;
+        cc->algorithm_id = (cnx->congestion_alg == NULL) ? NULL : cnx->congestion_alg->congestion_algorithm_id;
+        cc->cc_state = 0;
+        cc->cc_param = 0;
+        if (cnx->congestion_alg != NULL && path_i->congestion_alg_state != NULL) {
+            cnx->congestion_alg->alg_observe(path_i, &cc->cc_state, &cc->cc_param);
+        }
+        cc->cwin = path_i->cwin;
+        cc->pacing_rate = path_i->pacing.rate;
+        cc->delivery_rate_estimate = path_i->bandwidth_estimate;
+        cc->smoothed_rtt = path_i->smoothed_rtt;
+        cc->rtt_min = path_i->rtt_min;
+        cc->rtt_variant = path_i->rtt_variant;
+        cc->rtt_sample = path_i->rtt_sample;
+        cc->bytes_in_transit = path_i->bytes_in_transit;
+        cc->cwin_clamp = path_i->cwin_clamp;
+        cc->pacing_rate_clamp = path_i->pacing_rate_clamp;
+        cc->delivery_rate_latest = path_i->delivery_rate_latest;
+        cc->delivery_rate_max = path_i->delivery_rate_max;
+        cc->is_app_limited = path_i->delivery_rate_app_limited;
+    }
+    cnx->nb_cc_snapshot = nb_cc;
+    picoquic_stats_fence();
+    cnx->stats_seq++;
+
+    if (cnx->quic->v_perf_export_ctx != NULL) {
+        picoquic_perf_export_publish(cnx, current_time);
+    }
+}
+
+int picoquic_get_cnx_stats(picoquic_cnx_t* cnx, picoquic_cnx_stats_t* stats)
+{
+    int ret = -1;
+
+    for (;;) {
+        uint64_t seq = cnx->stats_seq;
+
+        if (seq == 0) {
+            /* No snapshot published yet */
+            break;
+        }
+        if ((seq & 1) == 0) {
+            picoquic_stats_fence();
+            *stats = cnx->stats_snapshot;
+            picoquic_stats_fence();
+            if (cnx->stats_seq == seq) {
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_get_path_cc_state(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_path_cc_state_t* cc_state)
+{
+    int ret = -1;
+
+    for (;;) {
+        uint64_t seq = cnx->stats_seq;
+
+        if (seq == 0) {
+            /* No snapshot published yet */
+            break;
+        }
+        if ((seq & 1) == 0) {
+            int found = 0;
+            int nb_cc;
+            int i;
+
+            picoquic_stats_fence();
+            nb_cc = cnx->nb_cc_snapshot;
+            if (nb_cc > PICOQUIC_NB_PATH_TARGET) {
+                nb_cc = PICOQUIC_NB_PATH_TARGET;
+            }
+            for (i = 0; i < nb_cc; i++) {
+                if (cnx->cc_snapshot[i].unique_path_id == unique_path_id) {
+                    *cc_state = cnx->cc_snapshot[i];
+                    found = 1;
+                    break;
+                }
+            }
+            picoquic_stats_fence();
+            if (cnx->stats_seq == seq) {
+                ret = (found) ? 0 : -1;
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Post a tuning request for the connection thread to apply, see
+ * picoquic_apply_cc_tuning. A value of zero removes the clamp. */
+static void picoquic_post_cc_tuning(picoquic_cc_tuning_t* tuning, uint64_t unique_path_id, uint64_t value)
+{
+    tuning->unique_path_id = unique_path_id;
+    tuning->value = (value == 0) ? UINT64_MAX : value;
+    picoquic_stats_fence();
+    tuning->seq++;
+}
+
+void picoquic_set_path_cwin_clamp(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint64_t cwin_clamp)
+{
+    picoquic_post_cc_tuning(&cnx->cwin_clamp_tuning, unique_path_id, cwin_clamp);
+}
+
+void picoquic_set_path_pacing_rate_clamp(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint64_t pacing_rate_clamp)
+{
+    picoquic_post_cc_tuning(&cnx->pacing_rate_clamp_tuning, unique_path_id, pacing_rate_clamp);
+}
+
 void picoquic_subscribe_to_quality_update_per_path_context(picoquic_path_t * path_x,
     uint64_t pacing_rate_delta, uint64_t rtt_delta)
 {
@@ -2385,6 +3243,47 @@ void picoquic_subscribe_to_quality_update(picoquic_cnx_t* cnx, uint64_t pacing_r
     }
 }
 
+void picoquic_set_rtt_observer(picoquic_cnx_t* cnx, picoquic_rtt_observer_fn rtt_observer_fn,
+    void* v_rtt_observer_ctx)
+{
+    cnx->rtt_observer_fn = rtt_observer_fn;
+    cnx->v_rtt_observer_ctx = v_rtt_observer_ctx;
+}
+
+static void picoquic_hash_stats_fill(picohash_table* table, picoquic_hash_stats_t* stats)
+{
+    memset(stats, 0, sizeof(picoquic_hash_stats_t));
+    if (table != NULL) {
+        stats->nb_entries = table->count;
+        stats->nb_slots = table->nb_bin;
+#ifdef PICOQUIC_CONTAINER_STATS
+        stats->nb_lookups = table->nb_lookups;
+        stats->nb_probes = table->nb_probes;
+        stats->probe_max = table->probe_max;
+#endif
+    }
+}
+
+static void picoquic_splay_stats_fill(picosplay_tree_t* tree, picoquic_splay_stats_t* stats)
+{
+    memset(stats, 0, sizeof(picoquic_splay_stats_t));
+    stats->nb_nodes = (uint64_t)tree->size;
+#ifdef PICOQUIC_CONTAINER_STATS
+    stats->nb_descents = tree->nb_descents;
+    stats->nb_steps = tree->nb_steps;
+    stats->depth_max = tree->depth_max;
+#endif
+}
+
+void picoquic_get_container_stats(picoquic_quic_t* quic, picoquic_container_stats_t* stats)
+{
+    picoquic_hash_stats_fill(quic->table_cnx_by_id, &stats->cnx_by_id);
+    picoquic_hash_stats_fill(quic->table_cnx_by_net, &stats->cnx_by_net);
+    picoquic_hash_stats_fill(quic->table_cnx_by_icid, &stats->cnx_by_icid);
+    picoquic_hash_stats_fill(quic->table_cnx_by_secret, &stats->cnx_by_secret);
+    picoquic_splay_stats_fill(&quic->token_reuse_tree, &stats->token_reuse);
+}
+
 void picoquic_default_quality_update(picoquic_quic_t* quic, uint64_t pacing_rate_delta, uint64_t rtt_delta)
 {
     quic->pacing_rate_update_delta = pacing_rate_delta;
@@ -2423,6 +3322,34 @@ int picoquic_set_stream_path_affinity(picoquic_cnx_t* cnx, uint64_t stream_id, u
     return ret;
 }
 
+int picoquic_mark_no_retransmit_stream(picoquic_cnx_t* cnx, uint64_t stream_id, int no_retransmit)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream == NULL) {
+        ret = -1;
+    }
+    else {
+        stream->no_retransmit = (no_retransmit) ? 1 : 0;
+    }
+    return ret;
+}
+
+int picoquic_set_stream_fec(picoquic_cnx_t* cnx, uint64_t stream_id, int is_fec_protected)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream == NULL) {
+        ret = -1;
+    }
+    else {
+        stream->is_fec_protected = (is_fec_protected) ? 1 : 0;
+    }
+    return ret;
+}
+
 int picoquic_set_path_status(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_path_status_enum status)
 {
     int ret = 0;
@@ -2434,6 +3361,16 @@ int picoquic_set_path_status(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoq
     return ret;
 }
 
+void picoquic_set_multipath_scheduler(picoquic_cnx_t* cnx, picoquic_multipath_scheduler_enum scheduler)
+{
+    cnx->multipath_scheduler = scheduler;
+    if (scheduler == picoquic_multipath_scheduler_redundant) {
+        /* Redundant scheduling relies on preemptive repeat to duplicate
+         * unacknowledged data on the other paths. */
+        cnx->is_preemptive_repeat_enabled = 1;
+    }
+}
+
 int picoquic_get_path_addr(picoquic_cnx_t* cnx, uint64_t unique_path_id, int local, struct sockaddr_storage* addr)
 {
     int ret = 0;
@@ -2482,6 +3419,8 @@ void picoquic_reset_path_mtu(picoquic_path_t* path_x)
     /* Reset the MTU discovery context */
     path_x->send_mtu_max_tried = 0;
     path_x->mtu_probe_sent = 0;
+    path_x->send_mtu_sprint_low = 0;
+    path_x->nb_mtu_probes_in_flight = 0;
 }
 
 /* Manage ACK context and Packet context */
@@ -2939,139 +3878,475 @@ int picoquic_renew_path_connection_id(picoquic_cnx_t* cnx, picoquic_path_t* path
         }
     }
 
-    return ret;
+    return ret;
+}
+
+int picoquic_renew_connection_id(picoquic_cnx_t* cnx, int path_id)
+{
+    int ret;
+
+    if (path_id >= cnx->nb_paths) {
+        ret = -1;
+    }
+    else {
+        ret = picoquic_renew_path_connection_id(cnx, cnx->path[path_id]);
+    }
+
+    return ret;
+}
+
+/* stream data splay management */
+int64_t picoquic_stream_data_node_compare(void* l, void* r)
+{
+    /* Offset values are from 0 to 2^62-1, which means we are not worried with rollover */
+    return ((picoquic_stream_data_node_t*)l)->offset - ((picoquic_stream_data_node_t*)r)->offset;
+}
+
+picoquic_stream_index_node_t* picoquic_stream_data_node_create(void* value)
+{
+    return &((picoquic_stream_data_node_t*)value)->stream_data_node;
+}
+
+
+void* picoquic_stream_data_node_value(picoquic_stream_index_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_picoquic_stream_data_node_t, stream_data_node));
+}
+
+void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data)
+{
+    /* Nodes are slab members, so they always go back on the free list;
+     * individual nodes cannot be freed. */
+    stream_data->loan_count = 0;
+    stream_data->is_detached = 0;
+    stream_data->next_stream_data = stream_data->quic->p_first_data_node;
+    stream_data->quic->p_first_data_node = stream_data;
+    stream_data->quic->nb_data_nodes_in_pool++;
+}
+
+void picoquic_stream_data_node_delete(void* tree, picoquic_stream_index_node_t* node)
+{
+    picoquic_stream_data_node_t* stream_data = (picoquic_stream_data_node_t*)picoquic_stream_data_node_value(node);
+    picoquic_stream_head_t* stream = (picoquic_stream_head_t*)((char*)tree -
+        offsetof(struct st_picoquic_stream_head_t, stream_data_tree));
+
+    if (stream->bytes_in_reassembly >= stream_data->length) {
+        stream->bytes_in_reassembly -= stream_data->length;
+    }
+    else {
+        stream->bytes_in_reassembly = 0;
+    }
+
+    if (stream->cnx != NULL) {
+        picoquic_release_stream_memory(stream->cnx, sizeof(picoquic_stream_data_node_t));
+    }
+
+    if (stream_data->loan_count > 0) {
+        /* The application holds the buffer, see picoquic_loan_stream_data;
+         * the node is recycled when the last loan is returned. */
+        stream_data->is_detached = 1;
+    }
+    else {
+        picoquic_stream_data_node_recycle(stream_data);
+    }
+}
+
+picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* quic)
+{
+    picoquic_stream_data_node_t* stream_data = quic->p_first_data_node;
+
+    if (stream_data == NULL) {
+        /* The free list is empty: carve a new slab of nodes and thread
+         * all of them onto the free list. */
+        picoquic_stream_data_slab_t* slab = (picoquic_stream_data_slab_t*)
+            malloc(sizeof(picoquic_stream_data_slab_t));
+
+        if (slab != NULL) {
+            /* It might be sufficient to zero the metadata, but zeroing everything
+             * appears safer, and does not confuse checkers like valgrind.
+             */
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_stream_nodes, sizeof(picoquic_stream_data_slab_t));
+            memset(slab, 0, sizeof(picoquic_stream_data_slab_t));
+            slab->next_slab = quic->p_first_data_slab;
+            quic->p_first_data_slab = slab;
+            for (int i = 0; i < PICOQUIC_STREAM_DATA_SLAB_NB_NODES; i++) {
+                slab->nodes[i].quic = quic;
+                slab->nodes[i].next_stream_data = quic->p_first_data_node;
+                quic->p_first_data_node = &slab->nodes[i];
+            }
+            quic->nb_data_nodes_in_pool += PICOQUIC_STREAM_DATA_SLAB_NB_NODES;
+            quic->nb_data_nodes_allocated += PICOQUIC_STREAM_DATA_SLAB_NB_NODES;
+            if (quic->nb_data_nodes_allocated > quic->nb_data_nodes_allocated_max) {
+                quic->nb_data_nodes_allocated_max = quic->nb_data_nodes_allocated;
+            }
+            stream_data = quic->p_first_data_node;
+        }
+    }
+
+    if (stream_data != NULL) {
+        quic->p_first_data_node = stream_data->next_stream_data;
+        stream_data->next_stream_data = NULL;
+        stream_data->bytes = NULL;
+        quic->nb_data_nodes_in_pool--;
+    }
+
+    return stream_data;
+}
+
+/* Loan based zero copy receive. From inside the stream data callback,
+ * the application can take a reference on the node that holds the bytes
+ * being delivered, and keep using the buffer after the callback returns,
+ * e.g. to forward the chunk on another connection without a copy. The
+ * stack detaches loaned nodes instead of recycling them; the node goes
+ * back to the pool when the last loan is returned. Loans must be
+ * returned on the thread running the QUIC context, and before the
+ * context is deleted. */
+void* picoquic_loan_stream_data(picoquic_cnx_t* cnx)
+{
+    picoquic_stream_data_node_t* node = cnx->quic->p_delivery_node;
+
+    if (node != NULL) {
+        node->loan_count++;
+    }
+
+    return node;
+}
+
+void picoquic_return_stream_data(void* loan)
+{
+    picoquic_stream_data_node_t* node = (picoquic_stream_data_node_t*)loan;
+
+    if (node != NULL && node->loan_count > 0) {
+        node->loan_count--;
+        if (node->loan_count == 0 && node->is_detached) {
+            node->is_detached = 0;
+            picoquic_stream_data_node_recycle(node);
+        }
+    }
+}
+
+
+/* Stream splay management */
+
+static int64_t picoquic_stream_node_compare(void *l, void *r)
+{
+    /* STream values are from 0 to 2^62-1, which means we are not worried with rollover */
+    return ((picoquic_stream_head_t*)l)->stream_id - ((picoquic_stream_head_t*)r)->stream_id;
+}
+
+static picosplay_node_t * picoquic_stream_node_create(void * value)
+{
+    return &((picoquic_stream_head_t *)value)->stream_node;
+}
+
+
+static void * picoquic_stream_node_value(picosplay_node_t * node)
+{
+    return (void*)((char*)node - offsetof(struct st_picoquic_stream_head_t, stream_node));
+}
+
+void picoquic_clear_stream(picoquic_stream_head_t* stream)
+{
+    picoquic_stream_queue_node_t* ready = stream->send_queue;
+    picoquic_stream_queue_node_t* next;
+
+    while ((next = ready) != NULL) {
+        ready = next->next_stream_data;
+        if (next->copy_pending) {
+            /* Wait for the deferred copies before freeing their target */
+            picoquic_stream_copy_sync(next->quic);
+        }
+        picoquic_stream_queue_node_recycle(stream->cnx, next);
+    }
+    stream->send_queue = NULL;
+    if (stream->is_output_stream || stream->is_output_parked) {
+        picoquic_remove_output_stream(stream->cnx, stream);
+    }
+    picoquic_stream_index_empty(&stream->stream_data_tree);
+    if (stream->first_spill_chunk != NULL) {
+        picoquic_clear_stream_spill(stream->cnx, stream);
+    }
+    picoquic_sack_list_free(&stream->sack_list);
+}
+
+
+static void picoquic_stream_node_delete(void * tree, picosplay_node_t * node)
+{
+    picoquic_stream_head_t * stream = picoquic_stream_node_value(node);
+
+    picoquic_clear_stream(stream);
+
+    /* The stream head is arena allocated; recycle it for the next stream
+     * on this connection. */
+    stream->next_output_stream = stream->cnx->arena_free_streams;
+    stream->cnx->arena_free_streams = stream;
+}
+
+/* Per connection arena. Small metadata objects that live as long as the
+ * connection (stream heads, local CID structures) are bump allocated from
+ * chained blocks; mid-life deletions push the object on a per type free
+ * list instead of calling free(), and teardown releases the blocks in one
+ * pass. */
+void* picoquic_cnx_arena_alloc(picoquic_cnx_t* cnx, size_t size)
+{
+    void* allocated = NULL;
+
+    /* Keep allocations aligned on 8 byte boundaries */
+    size = (size + 7u) & ~(size_t)7u;
+
+    if (size <= PICOQUIC_CNX_ARENA_BLOCK_SIZE) {
+        picoquic_cnx_arena_block_t* block = cnx->arena_first_block;
+
+        if (block == NULL || block->bytes_used + size > PICOQUIC_CNX_ARENA_BLOCK_SIZE) {
+            block = (picoquic_cnx_arena_block_t*)malloc(sizeof(picoquic_cnx_arena_block_t));
+            if (block != NULL) {
+                PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_connections, sizeof(picoquic_cnx_arena_block_t));
+                block->next_block = cnx->arena_first_block;
+                block->bytes_used = 0;
+                cnx->arena_first_block = block;
+            }
+        }
+
+        if (block != NULL) {
+            allocated = block->data + block->bytes_used;
+            block->bytes_used += size;
+        }
+    }
+
+    return allocated;
 }
 
-int picoquic_renew_connection_id(picoquic_cnx_t* cnx, int path_id)
+void picoquic_cnx_arena_release(picoquic_cnx_t* cnx)
 {
-    int ret;
+    while (cnx->arena_first_block != NULL) {
+        picoquic_cnx_arena_block_t* next_block = cnx->arena_first_block->next_block;
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_connections, sizeof(picoquic_cnx_arena_block_t));
+        free(cnx->arena_first_block);
+        cnx->arena_first_block = next_block;
+    }
+    cnx->arena_free_streams = NULL;
+    cnx->arena_free_local_cnxid = NULL;
+    cnx->arena_free_stream_queue = NULL;
+}
 
-    if (path_id >= cnx->nb_paths) {
-        ret = -1;
+/* Send queue nodes are fixed size and churn once per application write,
+ * so they are carved from the connection arena and recycled on a per
+ * connection free list. The data buffer they point to stays on malloc,
+ * as its size depends on the write. */
+picoquic_stream_queue_node_t* picoquic_stream_queue_node_alloc(picoquic_cnx_t* cnx)
+{
+    picoquic_stream_queue_node_t* node = cnx->arena_free_stream_queue;
+
+    if (node != NULL) {
+        cnx->arena_free_stream_queue = node->next_stream_data;
     }
     else {
-        ret = picoquic_renew_path_connection_id(cnx, cnx->path[path_id]);
+        node = (picoquic_stream_queue_node_t*)picoquic_cnx_arena_alloc(cnx,
+            sizeof(picoquic_stream_queue_node_t));
     }
 
-    return ret;
+    if (node != NULL) {
+        node->bytes = NULL;
+        node->copy_pending = 0;
+        node->is_external = 0;
+        node->sent_fn = NULL;
+        node->sent_ctx = NULL;
+        node->queue_time = picoquic_get_quic_time(cnx->quic);
+        picoquic_account_stream_memory(cnx, sizeof(picoquic_stream_queue_node_t));
+    }
+
+    return node;
 }
 
-/* stream data splay management */
-int64_t picoquic_stream_data_node_compare(void* l, void* r)
+void picoquic_stream_queue_node_recycle(picoquic_cnx_t* cnx, picoquic_stream_queue_node_t* node)
 {
-    /* Offset values are from 0 to 2^62-1, which means we are not worried with rollover */
-    return ((picoquic_stream_data_node_t*)l)->offset - ((picoquic_stream_data_node_t*)r)->offset;
+    size_t released = sizeof(picoquic_stream_queue_node_t);
+
+    if (node->bytes != NULL) {
+        if (node->is_external) {
+            /* Caller owned buffer, see picoquic_add_to_stream_iov; it was
+             * never charged to the memory accounting. */
+            node->is_external = 0;
+        }
+        else {
+            /* The data buffer was charged when it was attached to the node */
+            released += node->length;
+            picoquic_stream_buffer_free(cnx->quic, node->bytes, node->length);
+        }
+        node->bytes = NULL;
+    }
+    if (node->sent_fn != NULL) {
+        picoquic_stream_sent_fn sent_fn = node->sent_fn;
+        node->sent_fn = NULL;
+        sent_fn(cnx, node->sent_ctx);
+        node->sent_ctx = NULL;
+    }
+    picoquic_release_stream_memory(cnx, released);
+    node->next_stream_data = cnx->arena_free_stream_queue;
+    cnx->arena_free_stream_queue = node;
 }
 
-picosplay_node_t* picoquic_stream_data_node_create(void* value)
+/* Size class pools for the send queue data buffers. Free buffers are
+ * chained through their first bytes, so a pooled allocation is a list
+ * pop and a pooled release a list push. Requests larger than the biggest
+ * class use plain malloc, as do buffers when their class is full. The
+ * class is derived from the length on both sides, so alloc and free stay
+ * consistent as long as the caller passes the same length. */
+static int picoquic_stream_buffer_class(size_t length)
 {
-    return &((picoquic_stream_data_node_t*)value)->stream_data_node;
-}
+    int size_class = -1;
 
+    for (int i = 0; i < PICOQUIC_STREAM_BUFFER_NB_CLASSES; i++) {
+        if (length <= picoquic_stream_buffer_class_size[i]) {
+            size_class = i;
+            break;
+        }
+    }
 
-void* picoquic_stream_data_node_value(picosplay_node_t* node)
-{
-    return (void*)((char*)node - offsetof(struct st_picoquic_stream_data_node_t, stream_data_node));
+    return size_class;
 }
 
-void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data)
+uint8_t* picoquic_stream_buffer_alloc(picoquic_quic_t* quic, size_t length)
 {
-    if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
-        stream_data->next_stream_data = stream_data->quic->p_first_data_node;
-        stream_data->quic->p_first_data_node = stream_data;
-        stream_data->quic->nb_data_nodes_in_pool++;
+    uint8_t* bytes;
+    int size_class = picoquic_stream_buffer_class(length);
+
+    if (size_class >= 0 && quic->stream_buffer_pool[size_class] != NULL) {
+        bytes = quic->stream_buffer_pool[size_class];
+        quic->stream_buffer_pool[size_class] = *(uint8_t**)bytes;
+        quic->nb_stream_buffers_in_pool[size_class]--;
     }
     else {
-        stream_data->quic->nb_data_nodes_allocated--;
-        free(stream_data);
+        size_t alloc_size = (size_class >= 0) ?
+            picoquic_stream_buffer_class_size[size_class] : length;
+        bytes = (uint8_t*)malloc(alloc_size);
+        if (bytes != NULL) {
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_stream_buffers, alloc_size);
+        }
     }
-}
-
-void picoquic_stream_data_node_delete(void* tree, picosplay_node_t* node)
-{
-    picoquic_stream_data_node_t* stream_data = (picoquic_stream_data_node_t*)picoquic_stream_data_node_value(node);
 
-    picoquic_stream_data_node_recycle(stream_data);
+    return bytes;
 }
 
-picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* quic)
+void picoquic_stream_buffer_free(picoquic_quic_t* quic, uint8_t* bytes, size_t length)
 {
-    picoquic_stream_data_node_t* stream_data = quic->p_first_data_node;
-    
-    if (stream_data == NULL) {
-        stream_data = (picoquic_stream_data_node_t*)
-            malloc(sizeof(picoquic_stream_data_node_t));
+    int size_class = picoquic_stream_buffer_class(length);
 
-        if (stream_data != NULL) {
-            /* It might be sufficient to zero the metadata, but zeroing everything
-             * appears safer, and does not confuse checkers like valgrind.
-             */
-            memset(stream_data, 0, sizeof(picoquic_stream_data_node_t));
-            stream_data->quic = quic;
-            quic->nb_data_nodes_allocated++;
-            if (quic->nb_data_nodes_allocated > quic->nb_data_nodes_allocated_max) {
-                quic->nb_data_nodes_allocated_max = quic->nb_data_nodes_allocated;
-            }
-        }
+    if (size_class >= 0 &&
+        quic->nb_stream_buffers_in_pool[size_class] < PICOQUIC_STREAM_BUFFER_POOL_MAX) {
+        *(uint8_t**)bytes = quic->stream_buffer_pool[size_class];
+        quic->stream_buffer_pool[size_class] = bytes;
+        quic->nb_stream_buffers_in_pool[size_class]++;
     }
     else {
-        quic->p_first_data_node = stream_data->next_stream_data;
-        stream_data->next_stream_data = NULL;
-        stream_data->bytes = NULL;
-        quic->nb_data_nodes_in_pool--;
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_stream_buffers,
+            (size_class >= 0) ? picoquic_stream_buffer_class_size[size_class] : length);
+        free(bytes);
     }
-
-    return stream_data;
 }
 
+/* Tagged allocation counters, see picoquic_get_memory_profile in
+ * picoquic.h. The counters are static so they aggregate across contexts,
+ * and they are updated without synchronization: a torn read costs an
+ * imprecise sample, which is acceptable for attribution, while an atomic
+ * would put a synchronized write on every allocation path. */
+#ifdef PICOQUIC_MEMORY_PROFILE
+static picoquic_memory_profile_t picoquic_memory_profile = { { 0 }, { 0 }, { 0 }, { 0 } };
 
-/* Stream splay management */
-
-static int64_t picoquic_stream_node_compare(void *l, void *r)
+void picoquic_memory_profile_add(int tag, size_t size)
 {
-    /* STream values are from 0 to 2^62-1, which means we are not worried with rollover */
-    return ((picoquic_stream_head_t*)l)->stream_id - ((picoquic_stream_head_t*)r)->stream_id;
+    picoquic_memory_profile.nb_alloc[tag]++;
+    picoquic_memory_profile.bytes_current[tag] += size;
+    if (picoquic_memory_profile.bytes_current[tag] > picoquic_memory_profile.bytes_max[tag]) {
+        picoquic_memory_profile.bytes_max[tag] = picoquic_memory_profile.bytes_current[tag];
+    }
 }
 
-static picosplay_node_t * picoquic_stream_node_create(void * value)
+void picoquic_memory_profile_sub(int tag, size_t size)
 {
-    return &((picoquic_stream_head_t *)value)->stream_node;
+    picoquic_memory_profile.nb_free[tag]++;
+    if (picoquic_memory_profile.bytes_current[tag] >= size) {
+        picoquic_memory_profile.bytes_current[tag] -= size;
+    }
+    else {
+        picoquic_memory_profile.bytes_current[tag] = 0;
+    }
 }
 
+void picohash_memory_count(int64_t delta)
+{
+    if (delta >= 0) {
+        picoquic_memory_profile_add(picoquic_mem_tag_hash_tables, (size_t)delta);
+    }
+    else {
+        picoquic_memory_profile_sub(picoquic_mem_tag_hash_tables, (size_t)(-delta));
+    }
+}
 
-static void * picoquic_stream_node_value(picosplay_node_t * node)
+int picoquic_get_memory_profile(picoquic_memory_profile_t* profile)
 {
-    return (void*)((char*)node - offsetof(struct st_picoquic_stream_head_t, stream_node));
+    *profile = picoquic_memory_profile;
+    return 0;
+}
+#else
+int picoquic_get_memory_profile(picoquic_memory_profile_t* profile)
+{
+    memset(profile, 0, sizeof(picoquic_memory_profile_t));
+    return -1;
 }
+#endif
 
-void picoquic_clear_stream(picoquic_stream_head_t* stream)
+/* Byte accounting for the memory held in a connection's reassembly and
+ * send queues. Every queued node or buffer is charged when it enters a
+ * queue and released when it leaves, so the counters track actual usage.
+ * Crossing the per connection or the context wide budget fires the
+ * picoquic_callback_memory_pressure event once; the event is rearmed
+ * when usage drops back below the limits. */
+void picoquic_account_stream_memory(picoquic_cnx_t* cnx, size_t size)
 {
-    picoquic_stream_queue_node_t* ready = stream->send_queue;
-    picoquic_stream_queue_node_t* next;
+    picoquic_quic_t* quic = cnx->quic;
 
-    while ((next = ready) != NULL) {
-        ready = next->next_stream_data;
-        if (next->bytes != NULL) {
-            free(next->bytes);
+    cnx->stream_memory += size;
+    quic->stream_memory_total += size;
+
+    if (!cnx->is_memory_pressure_signaled &&
+        ((quic->stream_memory_cnx_limit > 0 && cnx->stream_memory > quic->stream_memory_cnx_limit) ||
+        (quic->stream_memory_quic_limit > 0 && quic->stream_memory_total > quic->stream_memory_quic_limit))) {
+        cnx->is_memory_pressure_signaled = 1;
+        if (cnx->callback_fn != NULL) {
+            (void)cnx->callback_fn(cnx, 0, NULL, 0, picoquic_callback_memory_pressure,
+                cnx->callback_ctx, NULL);
         }
-        free(next);
     }
-    stream->send_queue = NULL;
-    if (stream->is_output_stream) {
-        picoquic_remove_output_stream(stream->cnx, stream);
-    }
-    picosplay_empty_tree(&stream->stream_data_tree);
-    picoquic_sack_list_free(&stream->sack_list);
 }
 
-
-static void picoquic_stream_node_delete(void * tree, picosplay_node_t * node)
+void picoquic_release_stream_memory(picoquic_cnx_t* cnx, size_t size)
 {
-    picoquic_stream_head_t * stream = picoquic_stream_node_value(node);
+    picoquic_quic_t* quic = cnx->quic;
 
-    picoquic_clear_stream(stream);
+    cnx->stream_memory = (cnx->stream_memory > size) ? cnx->stream_memory - size : 0;
+    quic->stream_memory_total = (quic->stream_memory_total > size) ? quic->stream_memory_total - size : 0;
+
+    if (cnx->is_memory_pressure_signaled &&
+        (quic->stream_memory_cnx_limit == 0 || cnx->stream_memory <= quic->stream_memory_cnx_limit) &&
+        (quic->stream_memory_quic_limit == 0 || quic->stream_memory_total <= quic->stream_memory_quic_limit)) {
+        cnx->is_memory_pressure_signaled = 0;
+    }
+}
 
-    free(stream);
+/* Hibernate an idle connection: release the state that a mostly idle
+ * connection does not need any more, so large numbers of such connections
+ * can be held in memory. The handshake buffers and, on the server side,
+ * the TLS stack context are freed; traffic keys, CID lists and transport
+ * parameters stay in place, so the next packet from the peer is processed
+ * without an explicit restore step. Triggered from the idle timer check
+ * when picoquic_set_default_hibernate_delay is configured. */
+void picoquic_cnx_hibernate(picoquic_cnx_t* cnx)
+{
+    if (!cnx->is_hibernated && cnx->cnx_state == picoquic_state_ready) {
+        picoquic_tlscontext_hibernate(cnx);
+        cnx->is_hibernated = 1;
+    }
 }
 
 /* Management of streams */
@@ -3121,8 +4396,34 @@ int picoquic_compare_stream_priority(picoquic_stream_head_t * stream, picoquic_s
 
 /* This code assumes that the stream is not currently present in the output stream.
  */
+/* Streams that are blocked by their own flow control limit are parked out
+ * of the output list, so picoquic_find_ready_stream does not revisit them
+ * on every packet. They come back through picoquic_insert_output_stream
+ * when their limit increases or when an urgent action is requested. */
+static void picoquic_unpark_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->is_output_parked) {
+        if (stream->previous_output_stream == NULL) {
+            cnx->first_parked_stream = stream->next_output_stream;
+        }
+        else {
+            stream->previous_output_stream->next_output_stream = stream->next_output_stream;
+        }
+        if (stream->next_output_stream != NULL) {
+            stream->next_output_stream->previous_output_stream = stream->previous_output_stream;
+        }
+        stream->next_output_stream = NULL;
+        stream->previous_output_stream = NULL;
+        stream->is_output_parked = 0;
+    }
+}
+
 void picoquic_insert_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
 {
+    if (stream->is_output_parked) {
+        picoquic_unpark_output_stream(cnx, stream);
+    }
+
     if (stream->is_output_stream == 0)  
     {
         if (IS_CLIENT_STREAM_ID(stream->stream_id) == cnx->client_mode) {
@@ -3202,6 +4503,22 @@ void picoquic_remove_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t *
         stream->previous_output_stream = NULL;
         stream->next_output_stream = NULL;
     }
+    else if (stream->is_output_parked) {
+        picoquic_unpark_output_stream(cnx, stream);
+    }
+}
+
+void picoquic_park_output_stream(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream)
+{
+    if (stream->is_output_stream && !stream->is_output_parked) {
+        picoquic_remove_output_stream(cnx, stream);
+        stream->next_output_stream = cnx->first_parked_stream;
+        if (cnx->first_parked_stream != NULL) {
+            cnx->first_parked_stream->previous_output_stream = stream;
+        }
+        cnx->first_parked_stream = stream;
+        stream->is_output_parked = 1;
+    }
 }
 
 /* Reorder streams by priorities and rank.
@@ -3231,9 +4548,12 @@ picoquic_stream_head_t * picoquic_next_stream(picoquic_stream_head_t * stream)
 picoquic_stream_head_t* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id)
 {
     picoquic_stream_head_t target;
+    picohash_item* item;
+
     target.stream_id = stream_id;
+    item = picohash_retrieve(cnx->table_stream_by_id, &target);
 
-    return (picoquic_stream_head_t *)picosplay_find(&cnx->stream_tree, (void*)&target);
+    return (item == NULL) ? NULL : (picoquic_stream_head_t*)item->key;
 }
 
 void picoquic_add_output_streams(picoquic_cnx_t* cnx, uint64_t old_limit, uint64_t new_limit, unsigned int is_bidir)
@@ -3257,7 +4577,14 @@ void picoquic_add_output_streams(picoquic_cnx_t* cnx, uint64_t old_limit, uint64
 
 picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t stream_id)
 {
-    picoquic_stream_head_t* stream = (picoquic_stream_head_t*)malloc(sizeof(picoquic_stream_head_t));
+    picoquic_stream_head_t* stream = cnx->arena_free_streams;
+
+    if (stream != NULL) {
+        cnx->arena_free_streams = stream->next_output_stream;
+    }
+    else {
+        stream = (picoquic_stream_head_t*)picoquic_cnx_arena_alloc(cnx, sizeof(picoquic_stream_head_t));
+    }
     if (stream != NULL) {
         memset(stream, 0, sizeof(picoquic_stream_head_t));
         picoquic_sack_list_init(&stream->sack_list);
@@ -3267,6 +4594,7 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
         int is_output_stream = 0;
         stream->stream_id = stream_id;
         stream->cnx = cnx;
+        stream->creation_time = picoquic_get_quic_time(cnx->quic);
 
         if (IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
             if (IS_BIDIR_STREAM_ID(stream_id)) {
@@ -3296,9 +4624,16 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
 
         stream->stream_priority = cnx->quic->default_stream_priority;
 
-        picosplay_init_tree(&stream->stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
+        picoquic_stream_index_init(&stream->stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
 
         picosplay_insert(&cnx->stream_tree, stream);
+        if (picohash_insert(cnx->table_stream_by_id, stream) != 0) {
+            /* Out of memory. Unwind, so the stream cannot be reachable
+             * through the tree while missing from the hash table; the
+             * splay delete recycles the stream head into the arena. */
+            picosplay_delete(&cnx->stream_tree, stream);
+            return NULL;
+        }
         if (is_output_stream) {
             picoquic_insert_output_stream(cnx, stream);
         }
@@ -3310,6 +4645,8 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
         if (stream_id >= cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)]) {
             cnx->next_stream_id[STREAM_TYPE_FROM_ID(stream_id)] = NEXT_STREAM_ID_FOR_TYPE(stream_id);
         }
+
+        PICOQUIC_PROBE_STREAM_OPEN(picoquic_val64_connection_id(cnx->initial_cnxid), stream_id);
     }
 
     return stream;
@@ -3317,6 +4654,8 @@ picoquic_stream_head_t* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t str
 
 void picoquic_delete_stream(picoquic_cnx_t * cnx, picoquic_stream_head_t* stream)
 {
+    PICOQUIC_PROBE_STREAM_CLOSE(picoquic_val64_connection_id(cnx->initial_cnxid), stream->stream_id);
+    picohash_delete_item(cnx->table_stream_by_id, &stream->hash_item, 0);
     picosplay_delete(&cnx->stream_tree, stream);
 }
 
@@ -3340,7 +4679,7 @@ int picoquic_mark_direct_receive_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
         stream->direct_receive_fn = direct_receive_fn;
         stream->direct_receive_ctx = direct_receive_ctx;
         /* If there is pending data, pass it. */
-        while ((data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree)) != NULL) {
+        while ((data = (picoquic_stream_data_node_t*)picoquic_stream_index_first(&stream->stream_data_tree)) != NULL) {
             size_t length = data->length;
             uint64_t offset = data->offset;
 
@@ -3360,7 +4699,7 @@ int picoquic_mark_direct_receive_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
             }
 
             if (ret == 0) {
-                picosplay_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
+                picoquic_stream_index_delete_hint(&stream->stream_data_tree, &data->stream_data_node);
             }
             else {
                 break;
@@ -3421,7 +4760,13 @@ picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx,
     int is_unique = 0;
 
     if (local_cnxid_list != NULL) {
-        l_cid = (picoquic_local_cnxid_t*)malloc(sizeof(picoquic_local_cnxid_t));
+        l_cid = cnx->arena_free_local_cnxid;
+        if (l_cid != NULL) {
+            cnx->arena_free_local_cnxid = l_cid->next;
+        }
+        else {
+            l_cid = (picoquic_local_cnxid_t*)picoquic_cnx_arena_alloc(cnx, sizeof(picoquic_local_cnxid_t));
+        }
 
         if (l_cid != NULL) {
             memset(l_cid, 0, sizeof(picoquic_local_cnxid_t));
@@ -3474,7 +4819,8 @@ picoquic_local_cnxid_t* picoquic_create_local_cnxid(picoquic_cnx_t* cnx,
                 }
             }
             else {
-                free(l_cid);
+                l_cid->next = cnx->arena_free_local_cnxid;
+                cnx->arena_free_local_cnxid = l_cid;
                 l_cid = NULL;
             }
         }
@@ -3505,6 +4851,9 @@ void picoquic_delete_local_cnxid_listed(picoquic_cnx_t* cnx,
         l_cid->registered_cnx = NULL;
     }
 
+    /* Invalidate the CID route cache, which may point here */
+    cnx->quic->cnxid_route_generation++;
+
     if (local_cnxid_list != NULL) {
         picoquic_local_cnxid_t* next = local_cnxid_list->local_cnxid_first;
 
@@ -3533,8 +4882,9 @@ void picoquic_delete_local_cnxid_listed(picoquic_cnx_t* cnx,
         }
     }
 
-    /* Delete and done */
-    free(l_cid);
+    /* Recycle the arena allocated structure and done */
+    l_cid->next = cnx->arena_free_local_cnxid;
+    cnx->arena_free_local_cnxid = l_cid;
 }
 
 void picoquic_delete_local_cnxid(picoquic_cnx_t* cnx,  picoquic_local_cnxid_t* l_cid)
@@ -3630,19 +4980,33 @@ void picoquic_check_local_cnxid_ttl(picoquic_cnx_t* cnx, picoquic_local_cnxid_li
 picoquic_local_cnxid_t* picoquic_find_local_cnxid(picoquic_cnx_t* cnx, uint64_t unique_path_id, picoquic_connection_id_t* cnxid)
 {
     picoquic_local_cnxid_t* local_cnxid = NULL;
-    picoquic_local_cnxid_list_t* local_cnxid_list = picoquic_find_or_create_local_cnxid_list(cnx, unique_path_id, 0);
-    
-    if (local_cnxid_list != NULL && (local_cnxid = local_cnxid_list->local_cnxid_first) != NULL) {
-        while (local_cnxid != NULL) {
-            if (picoquic_compare_connection_id(&local_cnxid->cnx_id, cnxid) == 0) {
-                break;
-            }
-            else {
-                local_cnxid = local_cnxid->next;
+
+    /* All local CID of positive length are registered in the per quic
+     * context hash table, so the common case is answered with a single
+     * probe instead of walking the per path list. The walk remains as
+     * a fallback for zero length CID and for the rare entries that
+     * could not be registered. */
+    if (cnx->quic->local_cnxid_length > 0 &&
+        picoquic_cnx_by_id(cnx->quic, *cnxid, &local_cnxid) != NULL) {
+        if (local_cnxid->registered_cnx != cnx || local_cnxid->path_id != unique_path_id) {
+            local_cnxid = NULL;
+        }
+    }
+    else {
+        picoquic_local_cnxid_list_t* local_cnxid_list = picoquic_find_or_create_local_cnxid_list(cnx, unique_path_id, 0);
+
+        if (local_cnxid_list != NULL && (local_cnxid = local_cnxid_list->local_cnxid_first) != NULL) {
+            while (local_cnxid != NULL) {
+                if (picoquic_compare_connection_id(&local_cnxid->cnx_id, cnxid) == 0) {
+                    break;
+                }
+                else {
+                    local_cnxid = local_cnxid->next;
+                }
             }
         }
     }
-    
+
     return local_cnxid;
 }
 
@@ -3658,6 +5022,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 
     if (cnx != NULL) {
         int ret;
+        PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_connections, sizeof(picoquic_cnx_t));
         picoquic_local_cnxid_t* cnxid0;
 
         memset(cnx, 0, sizeof(picoquic_cnx_t));
@@ -3672,6 +5037,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         cnx->initial_cnxid = initial_cnx_id;
         cnx->quic = quic;
         cnx->pmtud_policy = quic->default_pmtud_policy;
+        cnx->is_pmtud_sprint_enabled = quic->default_pmtud_sprint;
         /* Create the connection ID number 0 */
         cnxid0 = picoquic_create_local_cnxid(cnx, 0, NULL, start_time);
 
@@ -3746,6 +5112,11 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
            /* Accept and send BDP extension frame */
             cnx->local_parameters.enable_bdp_frame = 1;
         }
+
+        /* Initialize FEC transport parameter */
+        if (quic->default_fec_enabled) {
+            cnx->local_parameters.enable_fec = 1;
+        }
  
         /* Initialize local flow control variables to advertised values */
         cnx->maxdata_local = ((uint64_t)cnx->local_parameters.initial_max_data);
@@ -3785,6 +5156,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         cnx->callback_ctx = quic->default_callback_ctx;
         cnx->congestion_alg = quic->default_congestion_alg;
         cnx->is_preemptive_repeat_enabled = quic->is_preemptive_repeat_enabled;
+        cnx->is_ack_coalescing_enabled = quic->is_ack_coalescing_enabled;
 
         /* Initialize key rotation interval to default value */
         cnx->crypto_epoch_length_max = quic->crypto_epoch_length_max;
@@ -3816,6 +5188,10 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 
             cnx->cnx_state = picoquic_state_client_init;
 
+            /* Build the deferred certificate verifier; a client connection
+             * will need to verify the server */
+            picoquic_tls_ensure_certificate_verifier(quic);
+
             if (!quic->is_cert_store_not_empty) {
                 /* The open SSL certifier always fails if no certificate is stored, so we just use a NULL verifier */
                 picoquic_log_app_message(cnx, "No root crt list specified -- certificate will not be verified.\n");
@@ -3840,6 +5216,31 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
             } else {
                 cnx->proposed_version = preferred_version;
             }
+
+            /* Consult the optional hints cache for this client network. The
+             * RTT estimate replaces the initial smoothed RTT; the CWIN
+             * estimate goes through the careful resume path, which only
+             * applies it if the first RTT sample confirms the estimate. */
+            if (quic->seed_hints_fn != NULL && addr_to != NULL) {
+                uint64_t rtt_estimate = 0;
+                uint64_t cwin_estimate = 0;
+
+                if (quic->seed_hints_fn(quic->seed_hints_ctx, addr_to,
+                    &rtt_estimate, &cwin_estimate) == 0) {
+                    if (rtt_estimate > 0) {
+                        cnx->path[0]->smoothed_rtt = rtt_estimate;
+                        cnx->path[0]->rtt_variant = rtt_estimate / 2;
+                    }
+                    if (cwin_estimate > 0 && rtt_estimate > 0) {
+                        uint8_t* client_ip;
+                        uint8_t client_ip_length;
+
+                        picoquic_get_ip_addr((struct sockaddr*)addr_to, &client_ip, &client_ip_length);
+                        picoquic_seed_bandwidth(cnx, rtt_estimate, cwin_estimate,
+                            client_ip, client_ip_length);
+                    }
+                }
+            }
         }
 
         for (picoquic_packet_context_enum pc = 0;
@@ -3860,6 +5261,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 
         for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
             cnx->tls_stream[epoch].stream_id = 0;
+            cnx->tls_stream[epoch].cnx = cnx;
             cnx->tls_stream[epoch].consumed_offset = 0;
             cnx->tls_stream[epoch].fin_offset = 0;
             cnx->tls_stream[epoch].stream_node.left = NULL;
@@ -3871,7 +5273,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
             cnx->tls_stream[epoch].maxdata_local = UINT64_MAX;
             cnx->tls_stream[epoch].maxdata_remote = UINT64_MAX;
 
-            picosplay_init_tree(&cnx->tls_stream[epoch].stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
+            picoquic_stream_index_init(&cnx->tls_stream[epoch].stream_data_tree, picoquic_stream_data_node_compare, picoquic_stream_data_node_create, picoquic_stream_data_node_delete, picoquic_stream_data_node_value);
             picoquic_sack_list_init(&cnx->tls_stream[epoch].sack_list);
             /* No need to reset the state flags, as they are not used for the crypto stream */
         }
@@ -3891,13 +5293,31 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 
 
         picosplay_init_tree(&cnx->stream_tree, picoquic_stream_node_compare, picoquic_stream_node_create, picoquic_stream_node_delete, picoquic_stream_node_value);
+        cnx->table_stream_by_id = picohash_create_ex((size_t)16,
+            picoquic_stream_id_hash, picoquic_stream_id_compare, picoquic_stream_to_item);
 
         cnx->congestion_alg = cnx->quic->default_congestion_alg;
+        /* Deterministic A/B assignment for congestion control experiments:
+         * connections whose initial CID hashes into the configured share
+         * use the alternate algorithm, see picoquic_set_cc_experiment. */
+        if (cnx->quic->cc_experiment_alg != NULL &&
+            (picoquic_val64_connection_id(cnx->initial_cnxid) & 0xff) < cnx->quic->cc_experiment_share) {
+            cnx->congestion_alg = cnx->quic->cc_experiment_alg;
+            cnx->is_cc_experiment_arm = 1;
+            cnx->is_hystart_pp_enabled = (cnx->quic->cc_experiment_option_string != NULL &&
+                strstr(cnx->quic->cc_experiment_option_string, "hystart++") != NULL) ? 1 : 0;
+        }
         if (cnx->congestion_alg != NULL) {
             cnx->congestion_alg->alg_init(cnx, cnx->path[0], start_time);
         }
     }
 
+    if (cnx != NULL && cnx->table_stream_by_id == NULL) {
+        /* Cannot operate without the stream lookup table */
+        picoquic_delete_cnx(cnx);
+        cnx = NULL;
+    }
+
     /* Only initialize TLS after all parameters have been set */
     if (cnx != NULL && picoquic_tlscontext_create(quic, cnx, start_time) != 0) {
         /* Cannot just do partial creation! */
@@ -3922,7 +5342,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
     }
 
     if (quic->use_unique_log_names) {
-        picoquic_crypto_random(quic, &cnx->log_unique, sizeof(cnx->log_unique));
+        picoquic_fast_random(quic, &cnx->log_unique, sizeof(cnx->log_unique));
     }
 
     if (cnx != NULL && !cnx->client_mode) {
@@ -3935,17 +5355,35 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
 picoquic_cnx_t* picoquic_create_client_cnx(picoquic_quic_t* quic,
     struct sockaddr* addr, uint64_t start_time, uint32_t preferred_version,
     char const* sni, char const* alpn, picoquic_stream_data_cb_fn callback_fn, void* callback_ctx)
+{
+    return picoquic_create_client_cnx_ex(quic, addr, start_time, preferred_version,
+        sni, alpn, callback_fn, callback_ctx, NULL, 0);
+}
+
+picoquic_cnx_t* picoquic_create_client_cnx_ex(picoquic_quic_t* quic,
+    struct sockaddr* addr, uint64_t start_time, uint32_t preferred_version,
+    char const* sni, char const* alpn, picoquic_stream_data_cb_fn callback_fn, void* callback_ctx,
+    picoquic_early_stream_desc_t const* early_streams, size_t nb_early_streams)
 {
     picoquic_cnx_t* cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id, addr, start_time, preferred_version, sni, alpn, 1);
 
     if (cnx != NULL) {
-        int ret;
+        int ret = 0;
 
         if (callback_fn != NULL)
             cnx->callback_fn = callback_fn;
         if (callback_ctx != NULL)
             cnx->callback_ctx = callback_ctx;
-        ret = picoquic_start_client_cnx(cnx);
+        /* Queue the early data before starting the connection, so it is
+         * available when the first flight is prepared and can be sent as
+         * 0-RTT if a session ticket permits. */
+        for (size_t i = 0; ret == 0 && i < nb_early_streams; i++) {
+            ret = picoquic_add_to_stream(cnx, early_streams[i].stream_id,
+                early_streams[i].data, early_streams[i].length, early_streams[i].set_fin);
+        }
+        if (ret == 0) {
+            ret = picoquic_start_client_cnx(cnx);
+        }
         if (ret != 0) {
             /* Cannot just do partial initialization! */
             picoquic_delete_cnx(cnx);
@@ -4099,6 +5537,15 @@ void picoquic_seed_bandwidth(picoquic_cnx_t* cnx, uint64_t rtt_min, uint64_t cwi
     cnx->seed_ip_addr_length = ip_addr_length;
 }
 
+void picoquic_set_seed_hints_provider(picoquic_quic_t* quic,
+    picoquic_cc_seed_hints_fn seed_hints_fn,
+    picoquic_cc_hints_update_fn hints_update_fn, void* seed_hints_ctx)
+{
+    quic->seed_hints_fn = seed_hints_fn;
+    quic->hints_update_fn = hints_update_fn;
+    quic->seed_hints_ctx = seed_hints_ctx;
+}
+
 void picoquic_set_default_pmtud_policy(picoquic_quic_t* quic, picoquic_pmtud_policy_enum pmtud_policy)
 {
     quic->default_pmtud_policy = pmtud_policy;
@@ -4109,6 +5556,21 @@ void picoquic_cnx_set_pmtud_policy(picoquic_cnx_t* cnx, picoquic_pmtud_policy_en
     cnx->pmtud_policy = pmtud_policy;
 }
 
+void picoquic_set_default_pmtud_sprint(picoquic_quic_t* quic, int is_sprint_enabled)
+{
+    quic->default_pmtud_sprint = (is_sprint_enabled) ? 1 : 0;
+}
+
+void picoquic_cnx_set_pmtud_sprint(picoquic_cnx_t* cnx, int is_sprint_enabled)
+{
+    cnx->is_pmtud_sprint_enabled = (is_sprint_enabled) ? 1 : 0;
+}
+
+void picoquic_seed_expected_pmtu(picoquic_cnx_t* cnx, size_t expected_mtu)
+{
+    cnx->expected_path_mtu = expected_mtu;
+}
+
 void picoquic_cnx_set_pmtud_required(picoquic_cnx_t* cnx, int is_pmtud_required)
 {
     cnx->pmtud_policy = (is_pmtud_required) ? picoquic_pmtud_required : picoquic_pmtud_basic;
@@ -4166,16 +5628,25 @@ uint64_t picoquic_current_time()
 uint64_t picoquic_get_quic_time(picoquic_quic_t* quic)
 {
     uint64_t now;
-    if (quic->p_simulated_time == NULL) {
-        now = picoquic_current_time();
+    if (quic->p_simulated_time != NULL) {
+        now = *quic->p_simulated_time;
+    }
+    else if (quic->is_wall_time_cached) {
+        now = quic->cached_wall_time;
     }
     else {
-        now = *quic->p_simulated_time;
+        now = picoquic_current_time();
     }
 
     return now;
 }
 
+void picoquic_refresh_quic_time_cache(picoquic_quic_t* quic, uint64_t current_time)
+{
+    quic->cached_wall_time = current_time;
+    quic->is_wall_time_cached = 1;
+}
+
 void picoquic_set_fuzz(picoquic_quic_t * quic, picoquic_fuzz_fn fuzz_fn, void * fuzz_ctx)
 {
     quic->fuzz_fn = fuzz_fn;
@@ -4193,6 +5664,27 @@ void picoquic_use_unique_log_names(picoquic_quic_t* quic, int use_unique_log_nam
     quic->use_unique_log_names = use_unique_log_names;
 }
 
+void picoquic_set_log_sampling(picoquic_quic_t* quic, uint64_t one_in_n)
+{
+    quic->log_sample_one_in_n = one_in_n;
+}
+
+int picoquic_cnx_set_qlog(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+
+    cnx->is_log_forced = 1;
+    if (cnx->f_binlog == NULL) {
+        picoquic_log_new_connection(cnx);
+        if (cnx->f_binlog == NULL) {
+            /* No log folder configured, or the log file could not be created */
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 #ifndef PICOQUIC_WITHOUT_SSLKEYLOG
 void picoquic_enable_sslkeylog(picoquic_quic_t* quic, int enable_sslkeylog)
 {
@@ -4275,6 +5767,13 @@ void picoquic_set_default_callback(picoquic_quic_t* quic,
     quic->default_callback_ctx = callback_ctx;
 }
 
+void picoquic_set_shard_reroute_fn(picoquic_quic_t* quic,
+    picoquic_shard_reroute_fn reroute_fn, void* reroute_ctx)
+{
+    quic->shard_reroute_fn = reroute_fn;
+    quic->shard_reroute_ctx = reroute_ctx;
+}
+
 void picoquic_set_default_stateless_reset_min_interval(picoquic_quic_t* quic, uint64_t min_interval_usec)
 {
     quic->stateless_reset_next_time = picoquic_get_quic_time(quic);
@@ -4477,6 +5976,7 @@ int picoquic_reset_cnx(picoquic_cnx_t* cnx, uint64_t current_time)
         picoquic_crypto_context_free(&cnx->crypto_context[k]);
     }
 
+    picoquic_wait_precomputed_keys(cnx);
     picoquic_crypto_context_free(&cnx->crypto_context_new);
 
     ret = picoquic_setup_initial_traffic_keys(cnx);
@@ -4555,6 +6055,7 @@ int picoquic_start_key_rotation(picoquic_cnx_t* cnx)
         ret = PICOQUIC_ERROR_KEY_ROTATION_NOT_READY;
     }
     else {
+        picoquic_wait_precomputed_keys(cnx);
         ret = picoquic_compute_new_rotated_keys(cnx);
     }
 
@@ -4582,12 +6083,21 @@ void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx)
 void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 {
     if (cnx != NULL) {
+        /* drain the crypto workers: a pending seal job may still use
+         * this connection's AEAD contexts or queued packets */
+        picoquic_crypto_pool_sync(cnx->quic);
+
+        /* Invalidate the CID route cache, which may point here */
+        cnx->quic->cnxid_route_generation++;
+
         if (cnx->memlog_call_back != NULL) {
             cnx->memlog_call_back(cnx, NULL, cnx->memlog_ctx, 1, 0);
         }
         if (cnx->quic->perflog_fn != NULL) {
             (void)(cnx->quic->perflog_fn)(cnx->quic, cnx, 0);
         }
+        picoquic_perf_export_on_cnx_deleted(cnx);
+        picoquic_close_log_record(cnx);
 
         picoquic_log_close_connection(cnx);
 
@@ -4616,15 +6126,19 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             cnx->retry_token = NULL;
         }
 
+        cnx->log_correlation_id = picoquic_string_free(cnx->log_correlation_id);
+
         picoquic_delete_sooner_packets(cnx);
 
         picoquic_remove_cnx_from_list(cnx);
         picoquic_remove_cnx_from_wake_list(cnx);
+        picoquic_sched_round_remove(cnx->quic, cnx);
 
         for (int i = 0; i < PICOQUIC_NUMBER_OF_EPOCHS; i++) {
             picoquic_crypto_context_free(&cnx->crypto_context[i]);
         }
 
+        picoquic_wait_precomputed_keys(cnx);
         picoquic_crypto_context_free(&cnx->crypto_context_new);
         picoquic_crypto_context_free(&cnx->crypto_context_old);
 
@@ -4642,12 +6156,19 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             picoquic_delete_misc_or_dg(&cnx->first_datagram, &cnx->last_datagram, cnx->first_datagram);
         }
 
-        picosplay_empty_tree(&cnx->queue_data_repeat_tree);
+        picoquic_empty_data_repeat_queue(cnx);
+
+        picoquic_fec_delete(cnx);
 
         for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
             picoquic_clear_stream(&cnx->tls_stream[epoch]);
         }
 
+        if (cnx->table_stream_by_id != NULL) {
+            picohash_delete(cnx->table_stream_by_id, 0);
+            cnx->table_stream_by_id = NULL;
+        }
+
         picosplay_empty_tree(&cnx->stream_tree);
 
         if (cnx->tls_ctx != NULL) {
@@ -4671,6 +6192,11 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 
         picoquic_unregister_net_icid(cnx);
 
+        /* All arena backed metadata is dead at this point; release the
+         * blocks in one pass. */
+        picoquic_cnx_arena_release(cnx);
+
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_connections, sizeof(picoquic_cnx_t));
         free(cnx);
     }
 }
@@ -4699,6 +6225,11 @@ void picoquic_set_app_wake_time(picoquic_cnx_t* cnx, uint64_t app_wake_time)
     }
 }
 
+void picoquic_set_app_target_rate(picoquic_cnx_t* cnx, uint64_t bytes_per_second)
+{
+    cnx->app_target_rate = bytes_per_second;
+}
+
 /* Setting up version negotiation parameters */
 void picoquic_set_desired_version(picoquic_cnx_t* cnx, uint32_t desired_version)
 {
@@ -4738,6 +6269,48 @@ picoquic_cnx_t* picoquic_cnx_by_id(picoquic_quic_t* quic, picoquic_connection_id
     return ret;
 }
 
+/* CID lookup through the small route cache. Entries stamped with an
+ * older generation are stale; a miss falls through to the hash table
+ * and installs the match in round robin order. */
+picoquic_cnx_t* picoquic_cnx_by_id_cached(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id,
+    struct st_picoquic_local_cnxid_t** l_cid)
+{
+    picoquic_cnx_t* ret;
+    picoquic_local_cnxid_t* l_cid_found;
+
+    for (int i = 0; i < PICOQUIC_CNXID_ROUTE_CACHE_SIZE; i++) {
+        picoquic_cnxid_route_cache_entry_t* entry = &quic->cnxid_route_cache[i];
+
+        if (entry->cnx != NULL &&
+            entry->generation == quic->cnxid_route_generation &&
+            picoquic_compare_connection_id(&entry->cnx_id, &cnx_id) == 0) {
+            if (l_cid != NULL) {
+                *l_cid = entry->l_cid;
+            }
+            return entry->cnx;
+        }
+    }
+
+    ret = picoquic_cnx_by_id(quic, cnx_id, &l_cid_found);
+
+    if (ret != NULL && cnx_id.id_len > 0) {
+        picoquic_cnxid_route_cache_entry_t* entry =
+            &quic->cnxid_route_cache[quic->cnxid_route_rank];
+
+        quic->cnxid_route_rank = (quic->cnxid_route_rank + 1) % PICOQUIC_CNXID_ROUTE_CACHE_SIZE;
+        entry->cnx_id = cnx_id;
+        entry->cnx = ret;
+        entry->l_cid = l_cid_found;
+        entry->generation = quic->cnxid_route_generation;
+    }
+
+    if (l_cid != NULL) {
+        *l_cid = l_cid_found;
+    }
+
+    return ret;
+}
+
 picoquic_cnx_t* picoquic_cnx_by_net(picoquic_quic_t* quic, const struct sockaddr* addr)
 {
     picoquic_cnx_t* ret = NULL;
@@ -4835,6 +6408,14 @@ void picoquic_set_default_congestion_algorithm(picoquic_quic_t* quic, picoquic_c
     quic->default_congestion_alg = alg;
 }
 
+void picoquic_set_cc_experiment(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const* alt_algorithm,
+    char const* alt_option_string, uint8_t share_per_256)
+{
+    quic->cc_experiment_alg = alt_algorithm;
+    quic->cc_experiment_option_string = alt_option_string;
+    quic->cc_experiment_share = (alt_algorithm == NULL) ? 0 : share_per_256;
+}
+
 void picoquic_set_default_congestion_algorithm_by_name(picoquic_quic_t* quic, char const * alg_name)
 {
     quic->default_congestion_alg = picoquic_get_congestion_algorithm(alg_name);
@@ -4859,6 +6440,16 @@ void picoquic_set_preemptive_repeat_per_cnx(picoquic_cnx_t* cnx, int do_repeat)
     cnx->is_preemptive_repeat_enabled = (do_repeat) ? 1 : 0;
 }
 
+void picoquic_set_ack_coalescing_policy(picoquic_quic_t* quic, int do_coalesce)
+{
+    quic->is_ack_coalescing_enabled = (do_coalesce) ? 1 : 0;
+}
+
+void picoquic_set_ack_coalescing_per_cnx(picoquic_cnx_t* cnx, int do_coalesce)
+{
+    cnx->is_ack_coalescing_enabled = (do_coalesce) ? 1 : 0;
+}
+
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* alg)
 {
     if (cnx->congestion_alg != NULL) {
@@ -4880,6 +6471,14 @@ void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_
     }
 }
 
+void picoquic_set_congestion_algorithm_ex(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* alg,
+    char const* option_string)
+{
+    cnx->is_hystart_pp_enabled = (option_string != NULL &&
+        strstr(option_string, "hystart++") != NULL) ? 1 : 0;
+    picoquic_set_congestion_algorithm(cnx, alg);
+}
+
 void picoquic_set_default_wifi_shadow_rtt(picoquic_quic_t* quic, uint64_t wifi_shadow_rtt)
 {
     quic->wifi_shadow_rtt = wifi_shadow_rtt;
@@ -4978,6 +6577,11 @@ void picoquic_disable_keep_alive(picoquic_cnx_t* cnx)
     cnx->keep_alive_interval = 0;
 }
 
+void picoquic_set_keep_alive_slack(picoquic_quic_t* quic, uint64_t slack_microsec)
+{
+    quic->keep_alive_slack = slack_microsec;
+}
+
 void picoquic_set_verify_certificate_callback(picoquic_quic_t* quic, 
     ptls_verify_certificate_t * cb, picoquic_free_verify_certificate_ctx free_fn) {
     picoquic_dispose_verify_certificate_callback(quic);
@@ -32,97 +32,133 @@
 * Maintain the list of ACK
 */
 
-/* Procedures to manage the list of ack ranges as a splay
+/* Procedures to manage the list of ack ranges as a sorted array.
+ * The array is ordered by increasing range start; ranges never overlap.
  */
-static void* picoquic_sack_node_value(picosplay_node_t* node)
-{
-    return (void*)((char*)node - offsetof(struct st_picoquic_sack_item_t, node));
-}
+#define PICOQUIC_SACK_LIST_MIN_ALLOC 4
 
-static picoquic_sack_item_t* picoquic_sack_item_value(picosplay_node_t* node)
+static size_t picoquic_sack_item_index(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
-    return (node == NULL) ? NULL : (picoquic_sack_item_t*)picoquic_sack_node_value(node);
-}
-
-static int64_t picoquic_sack_item_compare(void* l, void* r) {
-    /* ranges are expressed in packet numbers, lower than 2^62,
-     * which implies no risk of integer overflow in 64 bit integers
-     */
-    int64_t delta = ((picoquic_sack_item_t*)l)->start_of_sack_range - ((picoquic_sack_item_t*)r)->start_of_sack_range;
-    return delta;
+    return (size_t)(sack - sack_list->items) - sack_list->start_rank;
 }
 
-static picosplay_node_t* picoquic_sack_node_create(void* value)
+/* Return the first ACK item in the list */
+picoquic_sack_item_t* picoquic_sack_first_item(picoquic_sack_list_t* sack_list)
 {
-    return &((picoquic_sack_item_t*)value)->node;
+    return (sack_list->nb_items == 0) ? NULL : &sack_list->items[sack_list->start_rank];
 }
 
-static void picoquic_sack_node_delete(void* tree, picosplay_node_t* node)
+picoquic_sack_item_t* picoquic_sack_last_item(picoquic_sack_list_t* sack_list)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(tree);
-#endif
-    free(picoquic_sack_node_value(node));
+    return (sack_list->nb_items == 0) ? NULL : &sack_list->items[sack_list->start_rank + sack_list->nb_items - 1];
 }
 
-/* Return the first ACK item in the list */
-picoquic_sack_item_t* picoquic_sack_first_item(picoquic_sack_list_t* sack_list)
+picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
-    return picoquic_sack_item_value(picosplay_first(&sack_list->ack_tree));
-}
+    size_t rank = picoquic_sack_item_index(sack_list, sack) + 1;
 
-picoquic_sack_item_t* picoquic_sack_last_item(picoquic_sack_list_t* sack_list)
-{
-    return picoquic_sack_item_value(picosplay_last(&sack_list->ack_tree));
+    return (rank < sack_list->nb_items) ? &sack_list->items[sack_list->start_rank + rank] : NULL;
 }
 
-picoquic_sack_item_t* picoquic_sack_next_item(picoquic_sack_item_t* sack)
+picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
-    return picoquic_sack_item_value(picosplay_next(&sack->node));
+    size_t rank = picoquic_sack_item_index(sack_list, sack);
+
+    return (rank == 0) ? NULL : &sack_list->items[sack_list->start_rank + rank - 1];
 }
 
-picoquic_sack_item_t* picoquic_sack_previous_item(picoquic_sack_item_t* sack)
+/* Insert a new range at the specified rank, shifting the tail of the
+ * array. Returns NULL if the array could not be grown.
+ */
+static picoquic_sack_item_t* picoquic_sack_insert_at_rank(picoquic_sack_list_t* sack_list, size_t rank,
+    uint64_t range_min, uint64_t range_max, uint64_t current_time)
 {
-    return picoquic_sack_item_value(picosplay_previous(&sack->node));
+    picoquic_sack_item_t* sack_new = NULL;
+
+    if (rank == 0 && sack_list->start_rank > 0) {
+        /* Front slack available: the new lowest range slides in
+         * without shifting the tail */
+        sack_list->start_rank--;
+        sack_new = &sack_list->items[sack_list->start_rank];
+    }
+    else {
+        if (sack_list->start_rank + sack_list->nb_items >= sack_list->nb_alloc) {
+            if (sack_list->start_rank > 0) {
+                /* Reclaim the front slack before growing the allocation */
+                memmove(sack_list->items, sack_list->items + sack_list->start_rank,
+                    sack_list->nb_items * sizeof(picoquic_sack_item_t));
+                sack_list->start_rank = 0;
+            }
+            if (sack_list->nb_items >= sack_list->nb_alloc) {
+                size_t new_alloc = (sack_list->nb_alloc == 0) ?
+                    PICOQUIC_SACK_LIST_MIN_ALLOC : 2 * sack_list->nb_alloc;
+                picoquic_sack_item_t* new_items = (picoquic_sack_item_t*)realloc(sack_list->items,
+                    new_alloc * sizeof(picoquic_sack_item_t));
+
+                if (new_items == NULL) {
+                    return NULL;
+                }
+                sack_list->items = new_items;
+                sack_list->nb_alloc = new_alloc;
+            }
+        }
+
+        sack_new = &sack_list->items[sack_list->start_rank + rank];
+        if (rank < sack_list->nb_items) {
+            memmove(sack_new + 1, sack_new, (sack_list->nb_items - rank) * sizeof(picoquic_sack_item_t));
+        }
+    }
+    memset(sack_new, 0, sizeof(picoquic_sack_item_t));
+    sack_new->start_of_sack_range = range_min;
+    sack_new->end_of_sack_range = range_max;
+    sack_new->time_created = current_time;
+    sack_list->nb_items++;
+    sack_list->rc[0].range_counts[0] += 1;
+    sack_list->rc[1].range_counts[0] += 1;
+
+    return sack_new;
 }
 
 int picoquic_sack_insert_item(picoquic_sack_list_t* sack_list, uint64_t range_min, uint64_t range_max, uint64_t current_time)
 {
-    int ret = 0;
-    picoquic_sack_item_t* sack_new = (picoquic_sack_item_t*)malloc(sizeof(picoquic_sack_item_t));
-    if (sack_new == NULL) {
-        ret = -1;
-    }
-    else
-    {
-        memset(sack_new, 0, sizeof(picoquic_sack_item_t));
-        sack_new->start_of_sack_range = range_min;
-        sack_new->end_of_sack_range = range_max;
-        sack_new->time_created = current_time;
-        sack_list->rc[0].range_counts[0] += 1;
-        sack_list->rc[1].range_counts[0] += 1;
-        (void)picosplay_insert(&sack_list->ack_tree, sack_new);
+    size_t rank = sack_list->nb_items;
+
+    while (rank > 0 && sack_list->items[sack_list->start_rank + rank - 1].start_of_sack_range > range_min) {
+        rank--;
     }
 
-    return ret;
+    return (picoquic_sack_insert_at_rank(sack_list, rank, range_min, range_max, current_time) == NULL) ? -1 : 0;
 }
+
 void picoquic_sack_delete_item(picoquic_sack_list_t* sack_list, picoquic_sack_item_t* sack)
 {
+    size_t rank = picoquic_sack_item_index(sack_list, sack);
+
     /* Accounting of deleted values */
     for (int r = 0; r < 2; r++) {
         if (sack->nb_times_sent[r] < PICOQUIC_MAX_ACK_RANGE_REPEAT) {
             sack_list->rc[r].range_counts[sack->nb_times_sent[r]] -= 1;
         }
     }
-    /* Delete the item in the splay */
-    picosplay_delete_hint(&sack_list->ack_tree, &sack->node);
+    if (rank == 0) {
+        /* Deleting the lowest range only advances the window start */
+        sack_list->start_rank++;
+    }
+    else if (rank + 1 < sack_list->nb_items) {
+        /* Shift the tail of the array over the deleted item */
+        memmove(sack, sack + 1, (sack_list->nb_items - rank - 1) * sizeof(picoquic_sack_item_t));
+    }
+    sack_list->nb_items--;
+    if (sack_list->nb_items == 0) {
+        sack_list->start_rank = 0;
+    }
 }
 
 /* Check whether the sack list is empty
  */
 int picoquic_sack_list_is_empty(picoquic_sack_list_t* sack_list)
 {
-    return (sack_list->ack_tree.size == 0);
+    return (sack_list->nb_items == 0);
 }
 
 /* Find the ack context from the context 
@@ -161,10 +197,22 @@ picoquic_sack_item_t* picoquic_sack_find_range_below_number(picoquic_sack_list_t
 #ifdef _WINDOWS
     UNREFERENCED_PARAMETER(previous);
 #endif
-    picoquic_sack_item_t v = { 0 };
-    v.start_of_sack_range = pn64;
-    v.end_of_sack_range = pn64;
-    return(picoquic_sack_item_value(picosplay_find_previous(&sack_list->ack_tree, &v)));
+    /* Binary search for the last range starting at or below pn64 */
+    size_t lo = 0;
+    size_t hi = sack_list->nb_items;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+
+        if (sack_list->items[sack_list->start_rank + mid].start_of_sack_range <= pn64) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return (lo == 0) ? NULL : &sack_list->items[sack_list->start_rank + lo - 1];
 }
 
 /*
@@ -202,11 +250,12 @@ int picoquic_update_sack_list(picoquic_sack_list_t* sack_list,
 
     if (previous == NULL || previous->end_of_sack_range + 1 < pn64_min) {
         /* No overlap with a range below */
-        picoquic_sack_item_t* next = (previous == NULL) ?
-            picoquic_sack_first_item(sack_list) : picoquic_sack_next_item(previous);
+        size_t next_rank = (previous == NULL) ? 0 : picoquic_sack_item_index(sack_list, previous) + 1;
+        picoquic_sack_item_t* next = (next_rank < sack_list->nb_items) ? &sack_list->items[sack_list->start_rank + next_rank] : NULL;
+
         if (next == NULL || next->start_of_sack_range - 1 > pn64_max) {
             /* create a new item in the list */
-            ret = picoquic_sack_insert_item(sack_list, pn64_min, pn64_max, current_time);
+            ret = (picoquic_sack_insert_at_rank(sack_list, next_rank, pn64_min, pn64_max, current_time) == NULL) ? -1 : 0;
             /* set previous to null to bypass the next block */
             previous = NULL;
         }
@@ -224,7 +273,7 @@ int picoquic_update_sack_list(picoquic_sack_list_t* sack_list,
     while (previous != NULL && previous->end_of_sack_range < pn64_max) {
         /* we found or created an item that includes the beginning
          * of the acked range. Check the next one */
-        picoquic_sack_item_t* next = picoquic_sack_next_item(previous);
+        picoquic_sack_item_t* next = picoquic_sack_next_item(sack_list, previous);
         if (next == NULL || next->start_of_sack_range - 1 > pn64_max) {
             /* No overlap. Extend the previous item up to the max of the range */
             previous->end_of_sack_range = pn64_max;
@@ -264,6 +313,8 @@ int picoquic_record_pn_received(picoquic_cnx_t* cnx,
     picoquic_sack_list_t* sack_list = picoquic_sack_list_from_cnx_context(cnx, pc, l_cid);
 
     if (sack_list != NULL) {
+        int is_out_of_order = 0;
+
         if (picoquic_sack_list_is_empty(sack_list)) {
             /* This is the first packet ever received.. */
             cnx->ack_ctx[pc].time_stamp_largest_received = current_microsec;
@@ -274,6 +325,7 @@ int picoquic_record_pn_received(picoquic_cnx_t* cnx,
                 if (pn64 > pn_last + 1) {
                     cnx->ack_ctx[pc].act[0].out_of_order_received = 1;
                     cnx->ack_ctx[pc].act[1].out_of_order_received = 1;
+                    is_out_of_order = 1;
                 }
                 cnx->ack_ctx[pc].time_stamp_largest_received = current_microsec;
             }
@@ -281,13 +333,17 @@ int picoquic_record_pn_received(picoquic_cnx_t* cnx,
             {
                 if (cnx->ack_ctx[pc].act[0].ack_needed && pn64 < cnx->ack_ctx[pc].act[0].highest_ack_sent) {
                     cnx->ack_ctx[pc].act[0].out_of_order_received = 1;
+                    is_out_of_order = 1;
                 }
                 if (cnx->ack_ctx[pc].act[1].ack_needed && pn64 < cnx->ack_ctx[pc].act[1].highest_ack_sent) {
                     cnx->ack_ctx[pc].act[1].out_of_order_received = 1;
+                    is_out_of_order = 1;
                 }
             }
         }
 
+        picoquic_ack_policy_record_arrival(cnx, is_out_of_order, current_microsec);
+
         ret = picoquic_update_sack_list(sack_list, pn64, pn64, current_microsec);
     }
     return ret;
@@ -351,7 +407,7 @@ picoquic_sack_item_t* picoquic_process_ack_of_ack_range(picoquic_sack_list_t* sa
     previous = picoquic_sack_find_range_below_number(sack_list, NULL, start_of_range);
 
     if (previous != NULL && previous->start_of_sack_range == start_of_range){
-        picoquic_sack_item_t* next = picoquic_sack_item_value(picosplay_next(&previous->node));
+        picoquic_sack_item_t* next = picoquic_sack_next_item(sack_list, previous);
         if (next == NULL) {
             /* Matching the highest range, which shall not be deleted */
             if (end_of_range < previous->end_of_sack_range) {
@@ -388,13 +444,15 @@ void picoquic_update_ack_horizon(picoquic_sack_list_t* sack_list, uint64_t curre
     while (first_sack != NULL && first_sack->nb_times_sent[0] >= PICOQUIC_MAX_ACK_RANGE_REPEAT) {
         int64_t delay = current_time - first_sack->time_created;
         if (delay > sack_list->horizon_delay) {
-            picoquic_sack_item_t* next_sack = picoquic_sack_next_item(first_sack);
-            if (next_sack != NULL) {
+            if (sack_list->nb_items > 1) {
                 /* Always keep the last range */
                 sack_list->ack_horizon = first_sack->end_of_sack_range + 1;
                 picoquic_sack_delete_item(sack_list, first_sack);
+                first_sack = picoquic_sack_first_item(sack_list);
+            }
+            else {
+                break;
             }
-            first_sack = next_sack;
         }
         else {
             break;
@@ -423,8 +481,7 @@ uint64_t picoquic_sack_list_last(picoquic_sack_list_t* sack_list)
  */
 picoquic_sack_item_t * picoquic_sack_list_first_range(picoquic_sack_list_t* sack_list)
 {
-    picoquic_sack_item_t* first = picoquic_sack_first_item(sack_list);
-    return(first == NULL) ? NULL : picoquic_sack_item_value(picosplay_next(&first->node));
+    return (sack_list->nb_items < 2) ? NULL : &sack_list->items[sack_list->start_rank + 1];
 }
 
 /* Initialize a sack list
@@ -432,8 +489,6 @@ picoquic_sack_item_t * picoquic_sack_list_first_range(picoquic_sack_list_t* sack
 void picoquic_sack_list_init(picoquic_sack_list_t* sack_list)
 {
     memset(sack_list, 0, sizeof(picoquic_sack_list_t));
-    picosplay_init_tree(&sack_list->ack_tree, picoquic_sack_item_compare,
-        picoquic_sack_node_create, picoquic_sack_node_delete, picoquic_sack_node_value);
 }
 
 /* Reset a SACK list to single range
@@ -450,7 +505,13 @@ int picoquic_sack_list_reset(picoquic_sack_list_t* sack_list, uint64_t range_min
  */
 void picoquic_sack_list_free(picoquic_sack_list_t* sack_list)
 {
-    picosplay_empty_tree(&sack_list->ack_tree);
+    if (sack_list->items != NULL) {
+        free(sack_list->items);
+        sack_list->items = NULL;
+    }
+    sack_list->start_rank = 0;
+    sack_list->nb_items = 0;
+    sack_list->nb_alloc = 0;
     for (int r = 0; r < 2; r++) {
         memset(sack_list->rc[r].range_counts, 0, sizeof(sack_list->rc[r].range_counts));
     }
@@ -497,5 +558,5 @@ void picoquic_sack_item_record_reset(picoquic_sack_list_t* sack_list, picoquic_s
 
 size_t picoquic_sack_list_size(picoquic_sack_list_t* sack_list)
 {
-    return (size_t)sack_list->ack_tree.size;
+    return sack_list->nb_items;
 }
\ No newline at end of file
@@ -21,6 +21,7 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_probes.h"
 #include "picoquic_unified_log.h"
 #include "tls_api.h"
 #include <stdlib.h>
@@ -47,6 +48,10 @@
  * generate new packets, which are queued in the chained list.
  */
 
+/* Chunk size of the deferred stream data copies queued on the crypto
+ * worker pool, see picoquic_set_deferred_stream_copy. */
+#define PICOQUIC_DEFERRED_COPY_CHUNK 0x10000
+
 static picoquic_stream_head_t* picoquic_find_stream_for_writing(picoquic_cnx_t* cnx,
     uint64_t stream_id, int * ret)
 {
@@ -193,6 +198,114 @@ int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_
     return ret;
 }
 
+void picoquic_set_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum stream_scheduler)
+{
+    cnx->stream_scheduler = stream_scheduler;
+}
+
+int picoquic_set_stream_wfq_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t weight)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->wfq_weight = weight;
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_deadline(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t deadline_microsec)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->stream_deadline = deadline_microsec;
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_cork_delay(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t cork_delay_microsec)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->cork_delay = cork_delay_microsec;
+        if (cork_delay_microsec == 0 && stream->cork_time != 0) {
+            stream->cork_time = 0;
+            picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_stream_flush(picoquic_cnx_t* cnx, uint64_t stream_id)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0 && stream->cork_time != 0) {
+        stream->cork_time = 0;
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+    }
+
+    return ret;
+}
+
+int picoquic_mark_data_obsolete(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t offset, uint64_t length)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream(cnx, stream_id);
+
+    if (stream == NULL) {
+        ret = PICOQUIC_ERROR_INVALID_STREAM_ID;
+    }
+    else if (length > 0) {
+        /* Record the range as acknowledged in the stream's SACK list.
+         * The repeat checks treat acknowledged ranges as not needing
+         * repetition, which covers packet loss repeats, the data repeat
+         * queue and PTO probes alike. */
+        ret = picoquic_update_sack_list(&stream->sack_list, offset, offset + length - 1, 0);
+        picoquic_delete_stream_if_closed(cnx, stream);
+    }
+
+    return ret;
+}
+
+/* Update the cork state of a stream after data was queued, see
+ * picoquic_set_stream_cork_delay. A FIN or a full packet worth of
+ * queued data releases the cork immediately; otherwise the first write
+ * into an uncorked queue starts the cork timer. */
+static void picoquic_stream_cork_update(picoquic_cnx_t* cnx, picoquic_stream_head_t* stream, int set_fin)
+{
+    if (set_fin || stream->fin_requested) {
+        stream->cork_time = 0;
+    }
+    else {
+        size_t queued = 0;
+        picoquic_stream_queue_node_t* node = stream->send_queue;
+
+        while (node != NULL && queued < PICOQUIC_MAX_PACKET_SIZE) {
+            queued += node->length - node->offset;
+            node = node->next_stream_data;
+        }
+
+        if (queued >= PICOQUIC_MAX_PACKET_SIZE) {
+            stream->cork_time = 0;
+        }
+        else if (stream->cork_time == 0) {
+            stream->cork_time = picoquic_get_quic_time(cnx->quic) + stream->cork_delay;
+            if (cnx->next_cork_time == 0 || stream->cork_time < cnx->next_cork_time) {
+                cnx->next_cork_time = stream->cork_time;
+            }
+        }
+    }
+}
+
 int picoquic_mark_high_priority_stream(picoquic_cnx_t * cnx, uint64_t stream_id, int is_high_priority)
 {
     int ret;
@@ -231,16 +344,93 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         ret = -1;
     }
 
-    if (ret == 0 && length > 0) {
-        picoquic_stream_queue_node_t* stream_data = (picoquic_stream_queue_node_t*)
-            malloc(sizeof(picoquic_stream_queue_node_t));
+    if (ret == 0 && length > 0 &&
+        cnx->quic->deferred_copy_min_size > 0 && length >= cnx->quic->deferred_copy_min_size &&
+        cnx->quic->crypto_pool != NULL) {
+        /* Deferred copy mode, see picoquic_set_deferred_stream_copy: split
+         * the submission into chunks copied on the worker pool, so a large
+         * write does not hold this thread for the duration of the memcpy.
+         * The chunk list is built completely before it is spliced onto the
+         * send queue, so an allocation failure queues nothing. */
+        picoquic_stream_queue_node_t* first_chunk = NULL;
+        picoquic_stream_queue_node_t* last_chunk = NULL;
+        size_t done = 0;
+
+        while (ret == 0 && done < length) {
+            size_t chunk = length - done;
+            picoquic_stream_queue_node_t* stream_data;
+
+            if (chunk > PICOQUIC_DEFERRED_COPY_CHUNK) {
+                chunk = PICOQUIC_DEFERRED_COPY_CHUNK;
+            }
+            stream_data = picoquic_stream_queue_node_alloc(cnx);
+            if (stream_data == NULL ||
+                (stream_data->bytes = picoquic_stream_buffer_alloc(cnx->quic, chunk)) == NULL) {
+                if (stream_data != NULL) {
+                    picoquic_stream_queue_node_recycle(cnx, stream_data);
+                }
+                ret = -1;
+            }
+            else {
+                picoquic_account_stream_memory(cnx, chunk);
+                stream_data->quic = cnx->quic;
+                stream_data->length = chunk;
+                stream_data->offset = 0;
+                stream_data->next_stream_data = NULL;
+                stream_data->copy_pending = 1;
+                if (last_chunk == NULL) {
+                    first_chunk = stream_data;
+                }
+                else {
+                    last_chunk->next_stream_data = stream_data;
+                }
+                last_chunk = stream_data;
+                done += chunk;
+            }
+        }
+
+        if (ret != 0) {
+            while (first_chunk != NULL) {
+                picoquic_stream_queue_node_t* next = first_chunk->next_stream_data;
+                picoquic_stream_queue_node_recycle(cnx, first_chunk);
+                first_chunk = next;
+            }
+        }
+        else {
+            picoquic_stream_queue_node_t** pprevious = &stream->send_queue;
+            picoquic_stream_queue_node_t* next = stream->send_queue;
+            picoquic_stream_queue_node_t* stream_data;
+
+            while (next != NULL) {
+                pprevious = &next->next_stream_data;
+                next = next->next_stream_data;
+            }
+            *pprevious = first_chunk;
+
+            done = 0;
+            for (stream_data = first_chunk; stream_data != NULL;
+                stream_data = stream_data->next_stream_data) {
+                if (picoquic_crypto_pool_submit_copy(cnx->quic, stream_data->bytes,
+                    data + done, stream_data->length, &stream_data->copy_pending) != 0) {
+                    /* pool gone; copy inline */
+                    memcpy(stream_data->bytes, data + done, stream_data->length);
+                    stream_data->copy_pending = 0;
+                }
+                done += stream_data->length;
+            }
+        }
+
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+    }
+    else if (ret == 0 && length > 0) {
+        picoquic_stream_queue_node_t* stream_data = picoquic_stream_queue_node_alloc(cnx);
         if (stream_data == 0) {
             ret = -1;
         } else {
-            stream_data->bytes = (uint8_t*)malloc(length);
+            stream_data->bytes = picoquic_stream_buffer_alloc(cnx->quic, length);
 
             if (stream_data->bytes == NULL) {
-                free(stream_data);
+                picoquic_stream_queue_node_recycle(cnx, stream_data);
                 stream_data = NULL;
                 ret = -1;
             } else {
@@ -248,9 +438,12 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
                 picoquic_stream_queue_node_t* next = stream->send_queue;
 
                 memcpy(stream_data->bytes, data, length);
+                picoquic_account_stream_memory(cnx, length);
+                stream_data->quic = cnx->quic;
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->copy_pending = 0;
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -268,6 +461,9 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         cnx->nb_bytes_queued += length;
         stream->is_active = 0;
         stream->app_stream_ctx = app_stream_ctx;
+        if (stream->cork_delay != 0) {
+            picoquic_stream_cork_update(cnx, stream, set_fin);
+        }
     }
 
     return ret;
@@ -279,6 +475,110 @@ int picoquic_add_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
     return picoquic_add_to_stream_with_ctx(cnx, stream_id, data, length, set_fin, NULL);
 }
 
+/* Scatter-gather submission, see picoquic.h. Each iovec segment becomes
+ * a queue node pointing at the caller's memory; nothing is copied until
+ * the data is formatted into a packet. The "sent_fn" callback is armed
+ * on the last node only once the whole list was built and spliced, so a
+ * mid-build allocation failure queues nothing and fires nothing. The
+ * callback itself runs from picoquic_stream_queue_node_recycle, which
+ * covers normal consumption as well as stream reset and connection
+ * teardown. */
+int picoquic_add_to_stream_iov(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const picoquic_iovec_t* iov, size_t nb_iov, int set_fin,
+    picoquic_stream_sent_fn sent_fn, void* sent_ctx)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+    size_t total_length = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_iov; i++) {
+        total_length += iov[i].iov_len;
+    }
+
+    if (ret == 0 && set_fin) {
+        if (stream->fin_requested) {
+            /* app error, notified the fin twice*/
+            if (total_length > 0) {
+                ret = -1;
+            }
+        }
+        else {
+            stream->fin_requested = 1;
+        }
+    }
+
+    /* If our side has sent RST_STREAM or received STOP_SENDING, we should not send anymore data. */
+    if (ret == 0 && (stream->reset_sent || stream->stop_sending_received)) {
+        ret = -1;
+    }
+
+    if (ret == 0 && total_length > 0) {
+        picoquic_stream_queue_node_t* first_chunk = NULL;
+        picoquic_stream_queue_node_t* last_chunk = NULL;
+
+        for (size_t i = 0; ret == 0 && i < nb_iov; i++) {
+            picoquic_stream_queue_node_t* stream_data;
+
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            stream_data = picoquic_stream_queue_node_alloc(cnx);
+            if (stream_data == NULL) {
+                ret = -1;
+            }
+            else {
+                stream_data->quic = cnx->quic;
+                stream_data->bytes = (uint8_t*)iov[i].iov_base;
+                stream_data->length = iov[i].iov_len;
+                stream_data->offset = 0;
+                stream_data->next_stream_data = NULL;
+                stream_data->is_external = 1;
+                if (last_chunk == NULL) {
+                    first_chunk = stream_data;
+                }
+                else {
+                    last_chunk->next_stream_data = stream_data;
+                }
+                last_chunk = stream_data;
+            }
+        }
+
+        if (ret != 0) {
+            /* The callback was not armed yet, so recycling fires nothing */
+            while (first_chunk != NULL) {
+                picoquic_stream_queue_node_t* next = first_chunk->next_stream_data;
+                picoquic_stream_queue_node_recycle(cnx, first_chunk);
+                first_chunk = next;
+            }
+        }
+        else {
+            picoquic_stream_queue_node_t** pprevious = &stream->send_queue;
+            picoquic_stream_queue_node_t* next = stream->send_queue;
+
+            last_chunk->sent_fn = sent_fn;
+            last_chunk->sent_ctx = sent_ctx;
+
+            while (next != NULL) {
+                pprevious = &next->next_stream_data;
+                next = next->next_stream_data;
+            }
+            *pprevious = first_chunk;
+        }
+
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+    }
+
+    if (ret == 0) {
+        cnx->nb_bytes_queued += total_length;
+        stream->is_active = 0;
+        if (stream->cork_delay != 0) {
+            picoquic_stream_cork_update(cnx, stream, set_fin);
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_open_flow_control(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t expected_data_size)
 {
     int ret = 0;
@@ -342,6 +642,7 @@ int picoquic_reset_stream(picoquic_cnx_t* cnx,
         else if (!stream->reset_requested) {
             stream->local_error = local_stream_error;
             stream->reset_requested = 1;
+            picoquic_insert_output_stream(cnx, stream);
         }
     }
 
@@ -463,19 +764,198 @@ size_t picoquic_pad_to_policy(picoquic_cnx_t * cnx, uint8_t * bytes, size_t leng
 
 /*
  * Packet management
+ *
+ * Each quic context keeps a free list of recycled packets. When several
+ * contexts run on separate threads (see the packet loop thread pool), a
+ * shared backing pool can be attached: the per context list then acts as
+ * a lock free cache of at most packet_cache_target entries, and packets
+ * move between the cache and the shared pool in batches of half the
+ * cache size, so the shared lock is taken once per batch instead of
+ * once per packet.
  */
 
+struct st_picoquic_shared_packet_pool_t {
+    picoquic_mutex_t mutex;
+    picoquic_packet_t* first_packet;
+    size_t nb_packets;
+    size_t nb_packets_max;
+};
+
+picoquic_shared_packet_pool_t* picoquic_create_shared_packet_pool(size_t nb_packets_max)
+{
+    picoquic_shared_packet_pool_t* pool =
+        (picoquic_shared_packet_pool_t*)malloc(sizeof(picoquic_shared_packet_pool_t));
+
+    if (pool != NULL) {
+        memset(pool, 0, sizeof(picoquic_shared_packet_pool_t));
+        pool->nb_packets_max = (nb_packets_max == 0) ? PICOQUIC_MAX_PACKETS_IN_POOL : nb_packets_max;
+        if (picoquic_create_mutex(&pool->mutex) != 0) {
+            free(pool);
+            pool = NULL;
+        }
+    }
+
+    return pool;
+}
+
+void picoquic_delete_shared_packet_pool(picoquic_shared_packet_pool_t* pool)
+{
+    if (pool != NULL) {
+        while (pool->first_packet != NULL) {
+            picoquic_packet_t* packet = pool->first_packet;
+            pool->first_packet = packet->packet_previous;
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, packet->bytes_alloc);
+            free(packet->bytes);
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
+            free(packet);
+        }
+        (void)picoquic_delete_mutex(&pool->mutex);
+        free(pool);
+    }
+}
+
+int picoquic_attach_packet_pool(picoquic_quic_t* quic, picoquic_shared_packet_pool_t* pool, int cache_target)
+{
+    int ret = 0;
+
+    if (pool == NULL) {
+        quic->shared_packet_pool = NULL;
+        quic->packet_cache_target = 0;
+    }
+    else if (cache_target < 2) {
+        ret = -1;
+    }
+    else {
+        quic->shared_packet_pool = pool;
+        quic->packet_cache_target = cache_target;
+    }
+
+    return ret;
+}
+
+/* Move up to half a cache worth of packets from the shared pool to the
+ * per context cache, taking the shared lock once. */
+static void picoquic_packet_cache_refill(picoquic_quic_t* quic)
+{
+    picoquic_shared_packet_pool_t* pool = quic->shared_packet_pool;
+    int nb_refill = quic->packet_cache_target / 2;
+
+    (void)picoquic_lock_mutex(&pool->mutex);
+    while (nb_refill > 0 && pool->first_packet != NULL) {
+        picoquic_packet_t* packet = pool->first_packet;
+        pool->first_packet = packet->packet_previous;
+        pool->nb_packets--;
+        packet->packet_previous = quic->p_first_packet;
+        quic->p_first_packet = packet;
+        quic->nb_packets_in_pool++;
+        quic->nb_packets_allocated++;
+        nb_refill--;
+    }
+    (void)picoquic_unlock_mutex(&pool->mutex);
+
+    if (quic->nb_packets_allocated > quic->nb_packets_allocated_max) {
+        quic->nb_packets_allocated_max = quic->nb_packets_allocated;
+    }
+}
+
+/* Move half of the per context cache to the shared pool; packets that do
+ * not fit under the shared pool limit are freed. */
+static void picoquic_packet_cache_flush(picoquic_quic_t* quic)
+{
+    picoquic_shared_packet_pool_t* pool = quic->shared_packet_pool;
+    int nb_flush = quic->packet_cache_target / 2;
+
+    (void)picoquic_lock_mutex(&pool->mutex);
+    while (nb_flush > 0 && quic->p_first_packet != NULL) {
+        picoquic_packet_t* packet = quic->p_first_packet;
+        quic->p_first_packet = packet->packet_previous;
+        quic->nb_packets_in_pool--;
+        quic->nb_packets_allocated--;
+        if (pool->nb_packets < pool->nb_packets_max) {
+            packet->packet_previous = pool->first_packet;
+            pool->first_packet = packet;
+            pool->nb_packets++;
+        }
+        else {
+            picoquic_packet_payload_free(quic, packet->bytes, packet->bytes_alloc);
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
+            free(packet);
+        }
+        nb_flush--;
+    }
+    (void)picoquic_unlock_mutex(&pool->mutex);
+}
+
+/* Packet payload buffers are allocated out of line, so the packet
+ * structure itself stays small. Formatting always uses a full size
+ * buffer; once a short packet is queued for retransmission its payload
+ * is copied into a small buffer instead, which matters on ACK heavy
+ * paths where tens of thousands of tiny packets can be in flight. Both
+ * sizes are served from per context free lists chained through the
+ * buffer head. */
+uint8_t* picoquic_packet_payload_alloc(picoquic_quic_t* quic, size_t bytes_alloc)
+{
+    uint8_t* bytes = NULL;
+
+    if (bytes_alloc == PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE && quic->p_first_payload_small != NULL) {
+        bytes = quic->p_first_payload_small;
+        quic->p_first_payload_small = *(uint8_t**)bytes;
+        quic->nb_payload_small_in_pool--;
+    }
+    else if (bytes_alloc == PICOQUIC_MAX_PACKET_SIZE && quic->p_first_payload_full != NULL) {
+        bytes = quic->p_first_payload_full;
+        quic->p_first_payload_full = *(uint8_t**)bytes;
+        quic->nb_payload_full_in_pool--;
+    }
+    else {
+        bytes = (uint8_t*)malloc(bytes_alloc);
+        if (bytes != NULL) {
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_packets, bytes_alloc);
+        }
+    }
+
+    return bytes;
+}
+
+void picoquic_packet_payload_free(picoquic_quic_t* quic, uint8_t* bytes, size_t bytes_alloc)
+{
+    if (bytes_alloc == PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE &&
+        quic->nb_payload_small_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+        *(uint8_t**)bytes = quic->p_first_payload_small;
+        quic->p_first_payload_small = bytes;
+        quic->nb_payload_small_in_pool++;
+    }
+    else if (bytes_alloc == PICOQUIC_MAX_PACKET_SIZE &&
+        quic->nb_payload_full_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+        *(uint8_t**)bytes = quic->p_first_payload_full;
+        quic->p_first_payload_full = bytes;
+        quic->nb_payload_full_in_pool++;
+    }
+    else {
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, bytes_alloc);
+        free(bytes);
+    }
+}
+
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
 {
     picoquic_packet_t* packet = quic->p_first_packet;
-    
+
+    if (packet == NULL && quic->shared_packet_pool != NULL) {
+        picoquic_packet_cache_refill(quic);
+        packet = quic->p_first_packet;
+    }
+
     if (packet == NULL) {
         packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
         if (packet != NULL) {
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
             quic->nb_packets_allocated++;
             if (quic->nb_packets_allocated > quic->nb_packets_allocated_max) {
                 quic->nb_packets_allocated_max = quic->nb_packets_allocated;
             }
+            packet->bytes = NULL;
+            packet->bytes_alloc = 0;
         }
     }
     else {
@@ -484,10 +964,33 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
     }
 
     if (packet != NULL) {
-        /* It might be sufficient to zero the metadata, but zeroing everything
-         * appears safer, and does not confuse checkers like valgrind.
-         */
-        memset(packet, 0, sizeof(picoquic_packet_t));
+        uint8_t* bytes = packet->bytes;
+
+        if (bytes != NULL && packet->bytes_alloc < PICOQUIC_MAX_PACKET_SIZE) {
+            /* The pooled packet kept a shrunken payload; formatting needs a
+             * full size buffer. */
+            picoquic_packet_payload_free(quic, bytes, packet->bytes_alloc);
+            bytes = NULL;
+        }
+        if (bytes == NULL) {
+            bytes = picoquic_packet_payload_alloc(quic, PICOQUIC_MAX_PACKET_SIZE);
+        }
+
+        if (bytes == NULL) {
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
+            quic->nb_packets_allocated--;
+            free(packet);
+            packet = NULL;
+        }
+        else {
+            /* It might be sufficient to zero the metadata, but zeroing everything
+             * appears safer, and does not confuse checkers like valgrind.
+             */
+            memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes_alloc));
+            memset(bytes, 0, PICOQUIC_MAX_PACKET_SIZE);
+            packet->bytes = bytes;
+            packet->bytes_alloc = PICOQUIC_MAX_PACKET_SIZE;
+        }
     }
 
     return packet;
@@ -496,12 +999,18 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
 void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
 {
     if (packet != NULL) {
+        if (quic->shared_packet_pool != NULL &&
+            quic->nb_packets_in_pool >= quic->packet_cache_target) {
+            picoquic_packet_cache_flush(quic);
+        }
         if (quic->nb_packets_in_pool >= PICOQUIC_MAX_PACKETS_IN_POOL) {
+            picoquic_packet_payload_free(quic, packet->bytes, packet->bytes_alloc);
+            PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
             free(packet);
             quic->nb_packets_allocated--;
         }
         else {
-            memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
+            memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes_alloc));
             packet->packet_previous = quic->p_first_packet;
             quic->p_first_packet = packet;
             quic->nb_packets_in_pool++;
@@ -509,6 +1018,73 @@ void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
     }
 }
 
+/* Watermark based trimming of the packet free list, see
+ * picoquic_set_packet_pool_watermarks. The pool size is sampled from
+ * picoquic_prepare_next_packet_ex rather than on every recycle, so the
+ * per packet paths stay untouched. */
+void picoquic_set_packet_pool_watermarks(picoquic_quic_t* quic, int low_watermark, int high_watermark, uint64_t trim_delay_us)
+{
+    if (low_watermark > high_watermark) {
+        low_watermark = high_watermark;
+    }
+    quic->packet_pool_low_watermark = low_watermark;
+    quic->packet_pool_high_watermark = high_watermark;
+    quic->packet_pool_trim_delay = trim_delay_us;
+    quic->packet_pool_above_high_since = 0;
+
+    /* Pre-heat the pool up to the low watermark */
+    while (quic->nb_packets_in_pool < low_watermark) {
+        picoquic_packet_t* packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+        uint8_t* bytes = (packet == NULL) ? NULL :
+            picoquic_packet_payload_alloc(quic, PICOQUIC_MAX_PACKET_SIZE);
+        if (bytes == NULL) {
+            free(packet);
+            break;
+        }
+        PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
+        memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes_alloc));
+        packet->bytes = bytes;
+        packet->bytes_alloc = PICOQUIC_MAX_PACKET_SIZE;
+        packet->packet_previous = quic->p_first_packet;
+        quic->p_first_packet = packet;
+        quic->nb_packets_in_pool++;
+        quic->nb_packets_allocated++;
+    }
+    if (quic->nb_packets_allocated > quic->nb_packets_allocated_max) {
+        quic->nb_packets_allocated_max = quic->nb_packets_allocated;
+    }
+}
+
+int picoquic_get_nb_packets_in_pool(picoquic_quic_t* quic)
+{
+    return quic->nb_packets_in_pool;
+}
+
+void picoquic_trim_packet_pool(picoquic_quic_t* quic, uint64_t current_time)
+{
+    if (quic->packet_pool_high_watermark > 0) {
+        if (quic->nb_packets_in_pool <= quic->packet_pool_high_watermark) {
+            quic->packet_pool_above_high_since = 0;
+        }
+        else if (quic->packet_pool_above_high_since == 0) {
+            quic->packet_pool_above_high_since = current_time;
+        }
+        else if (current_time - quic->packet_pool_above_high_since >= quic->packet_pool_trim_delay) {
+            while (quic->nb_packets_in_pool > quic->packet_pool_low_watermark &&
+                quic->p_first_packet != NULL) {
+                picoquic_packet_t* packet = quic->p_first_packet;
+                quic->p_first_packet = packet->packet_previous;
+                quic->nb_packets_in_pool--;
+                quic->nb_packets_allocated--;
+                picoquic_packet_payload_free(quic, packet->bytes, packet->bytes_alloc);
+                PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_packets, sizeof(picoquic_packet_t));
+                free(packet);
+            }
+            quic->packet_pool_above_high_since = 0;
+        }
+    }
+}
+
 void picoquic_update_payload_length(
     uint8_t* bytes, size_t pnum_index, size_t header_length, size_t packet_length)
 {
@@ -668,10 +1244,20 @@ size_t picoquic_create_packet_header(
             cnx->quic_bit_greased |= (C == 0);
         }
 
-        length = 0;
-        bytes[length++] = (K | C | picoquic_spin_function_table[cnx->spin_policy].spinbit_outgoing(cnx));
-        length += picoquic_format_connection_id(&bytes[length], PICOQUIC_MAX_PACKET_SIZE - length,
-            (path_x->is_probing_nat && path_x->p_remote_nat_cnxid != NULL) ? path_x->p_remote_nat_cnxid->cnx_id : path_x->p_remote_cnxid->cnx_id);
+        picoquic_remote_cnxid_t* r_cnxid = (path_x->is_probing_nat && path_x->p_remote_nat_cnxid != NULL) ?
+            path_x->p_remote_nat_cnxid : path_x->p_remote_cnxid;
+
+        if (path_x->short_header_template_cnxid != r_cnxid ||
+            path_x->short_header_template_sequence != r_cnxid->sequence) {
+            /* Rebuild the per path template: flags placeholder plus CID bytes */
+            path_x->short_header_template_length = 1 + picoquic_format_connection_id(
+                &path_x->short_header_template[1], sizeof(path_x->short_header_template) - 1, r_cnxid->cnx_id);
+            path_x->short_header_template_cnxid = r_cnxid;
+            path_x->short_header_template_sequence = r_cnxid->sequence;
+        }
+        memcpy(bytes, path_x->short_header_template, path_x->short_header_template_length);
+        length = path_x->short_header_template_length;
+        bytes[0] = (K | C | picoquic_spin_function_table[cnx->spin_policy].spinbit_outgoing(cnx));
 
         *pn_offset = length;
         if (header_length > length && header_length < length + 4) {
@@ -800,7 +1386,8 @@ size_t picoquic_get_checksum_length(picoquic_cnx_t* cnx, picoquic_epoch_enum epo
         ret = picoquic_aead_get_checksum_length(cnx->crypto_context[epoch].aead_encrypt);
     }
     else {
-        DBG_PRINTF("Try getting checksum for empty context, epoch %d", epoch);
+        PICOQUIC_DIAG(picoquic_diag_severity_error, PICOQUIC_SENDER,
+            "Try getting checksum for empty context, epoch %d", epoch);
     }
 
     return ret;
@@ -890,27 +1477,42 @@ size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
         }
     }
 
-    /* Encrypt the packet */
-    if (cnx->is_multipath_enabled && ptype == picoquic_packet_1rtt_protected) {
-        send_length = picoquic_aead_encrypt_mp(send_buffer + /* header_length */ h_length,
-            bytes + header_length, length - header_length, path_x->unique_path_id,
-            sequence_number, send_buffer, /* header_length */ h_length, aead_context);
-    }
-    else {
-        send_length = picoquic_aead_encrypt_generic(send_buffer + /* header_length */ h_length,
+    /* Encrypt the packet. If a crypto worker pool is configured, hand the
+     * seal and header protection to the workers; the AEAD output length is
+     * deterministic, so the send length can be computed without waiting.
+     * Logging of clear text segments and fuzzing both need the inline
+     * path, so the offload is skipped while either is active. */
+    if (cnx->quic->crypto_pool != NULL && cnx->quic->fuzz_fn == NULL &&
+        !picoquic_cnx_is_still_logging(cnx) &&
+        picoquic_crypto_pool_submit(cnx->quic, send_buffer, h_length,
             bytes + header_length, length - header_length,
-            sequence_number, send_buffer, /* header_length */ h_length, aead_context);
+            sequence_number, (path_x == NULL) ? 0 : path_x->unique_path_id,
+            (cnx->is_multipath_enabled && ptype == picoquic_packet_1rtt_protected),
+            aead_context, pn_enc, pn_offset, first_mask) == 0) {
+        send_length = h_length + (length - header_length) + aead_checksum_length;
     }
+    else {
+        if (cnx->is_multipath_enabled && ptype == picoquic_packet_1rtt_protected) {
+            send_length = picoquic_aead_encrypt_mp(send_buffer + /* header_length */ h_length,
+                bytes + header_length, length - header_length, path_x->unique_path_id,
+                sequence_number, send_buffer, /* header_length */ h_length, aead_context);
+        }
+        else {
+            send_length = picoquic_aead_encrypt_generic(send_buffer + /* header_length */ h_length,
+                bytes + header_length, length - header_length,
+                sequence_number, send_buffer, /* header_length */ h_length, aead_context);
+        }
 
-    send_length += /* header_length */ h_length;
+        send_length += /* header_length */ h_length;
 
-    /* if needed, log the segment before header protection is applied */
-    picoquic_log_outgoing_packet(cnx, path_x,
-        bytes, sequence_number, pn_length, length,
-        send_buffer, send_length, current_time);
+        /* if needed, log the segment before header protection is applied */
+        picoquic_log_outgoing_packet(cnx, path_x,
+            bytes, sequence_number, pn_length, length,
+            send_buffer, send_length, current_time);
 
-    /* Next, encrypt the PN -- The sample is located after the pn_offset */
-    picoquic_protect_packet_header(send_buffer, pn_offset, first_mask, pn_enc);
+        /* Next, encrypt the PN -- The sample is located after the pn_offset */
+        picoquic_protect_packet_header(send_buffer, pn_offset, first_mask, pn_enc);
+    }
 
     return send_length;
 }
@@ -943,6 +1545,25 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
     pkt_ctx->pending_last = packet;
     packet->is_queued_for_retransmit = 1;
 
+    /* Short packets keep only a compact copy of their payload while they
+     * wait for acknowledgement, releasing the full size buffer for reuse.
+     * Not done when the crypto worker pool is active: a pending seal job
+     * keeps a raw pointer into the full size buffer until the pool is
+     * synced at socket send time, so the buffer cannot be released here. */
+    if (cnx->quic->crypto_pool == NULL &&
+        packet->bytes_alloc > PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE &&
+        packet->length <= PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE &&
+        !packet->is_mtu_probe) {
+        uint8_t* small_bytes = picoquic_packet_payload_alloc(cnx->quic, PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE);
+
+        if (small_bytes != NULL) {
+            memcpy(small_bytes, packet->bytes, packet->length);
+            picoquic_packet_payload_free(cnx->quic, packet->bytes, packet->bytes_alloc);
+            packet->bytes = small_bytes;
+            packet->bytes_alloc = PICOQUIC_SMALL_PACKET_PAYLOAD_SIZE;
+        }
+    }
+
     if (!packet->is_ack_trap) {
         /* Account for bytes in transit, for congestion control */
         path_x->bytes_in_transit += length;
@@ -1017,6 +1638,7 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx,
         }
         pkt_ctx->retransmitted_queue_size += 1;
         p->is_queued_for_spurious_detection = 1;
+        picoquic_retransmitted_map_set(pkt_ctx, p->sequence_number);
 
         if (add_to_data_repeat_queue) {
             picoquic_queue_data_repeat_packet(cnx, p);
@@ -1029,6 +1651,7 @@ picoquic_packet_t* picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx,
 void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* p)
 {
     pkt_ctx->retransmitted_queue_size -= 1;
+    picoquic_retransmitted_map_clear(pkt_ctx, p->sequence_number);
     if (p->packet_previous == NULL) {
         pkt_ctx->retransmitted_newest = p->packet_next;
     }
@@ -1168,6 +1791,12 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx,
         *send_length = length;
 
         if (length > 0) {
+            if (packet->ptype == picoquic_packet_1rtt_protected && cnx->fec_protect_pending) {
+                /* Accumulate the plaintext payload into the FEC block; the
+                 * flag was set when a protected stream contributed data. */
+                cnx->fec_protect_pending = 0;
+                picoquic_fec_on_packet_sent(cnx, packet);
+            }
             packet->checksum_overhead = checksum_overhead;
             picoquic_queue_for_retransmit(cnx, path_x, packet, length, current_time);
             path_x->last_sent_time = current_time;
@@ -1456,8 +2085,40 @@ static size_t picoquic_next_mtu_probe_length(picoquic_cnx_t* cnx, picoquic_path_
 {
     size_t probe_length;
 
-    if (path_x->send_mtu_max_tried == 0) {
-        if (cnx->remote_parameters.max_packet_size > 0) {
+    if (path_x->nb_mtu_probes_in_flight > 0) {
+        /* Sprint mode follow-up: while the previous probe is still in
+         * flight, assume it will be lost and probe the binary search
+         * midpoint below it. If the larger probe succeeds the smaller
+         * ones are redundant but harmless. Stop when the next midpoint
+         * would gain too little; returning the current MTU makes the
+         * "is probe needed" test fail. */
+        probe_length = (path_x->send_mtu + path_x->send_mtu_sprint_low) / 2;
+        if (probe_length < path_x->send_mtu + PICOQUIC_PMTUD_SPRINT_STEP_MIN) {
+            probe_length = path_x->send_mtu;
+        }
+    }
+    else if (path_x->send_mtu_max_tried == 0) {
+        if (cnx->expected_path_mtu > 0) {
+            /* The application seeded the expected MTU of the route; aim
+             * the first probe straight at it. */
+            probe_length = cnx->expected_path_mtu - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr);
+
+            if (cnx->quic->mtu_max > 0 && (int)probe_length >
+                cnx->quic->mtu_max - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr)) {
+                probe_length = cnx->quic->mtu_max - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr);
+            }
+            if (cnx->remote_parameters.max_packet_size > 0 &&
+                probe_length > cnx->remote_parameters.max_packet_size) {
+                probe_length = cnx->remote_parameters.max_packet_size;
+            }
+            if (probe_length > PICOQUIC_MAX_PACKET_SIZE) {
+                probe_length = PICOQUIC_MAX_PACKET_SIZE;
+            }
+            if (probe_length < path_x->send_mtu) {
+                probe_length = path_x->send_mtu;
+            }
+        }
+        else if (cnx->remote_parameters.max_packet_size > 0) {
             probe_length = cnx->remote_parameters.max_packet_size;
 
             if (cnx->quic->mtu_max > 0 && (int)probe_length >
@@ -1501,7 +2162,9 @@ picoquic_pmtu_discovery_status_enum picoquic_is_mtu_probe_needed(picoquic_cnx_t*
     if ((cnx->cnx_state == picoquic_state_ready || 
         cnx->cnx_state == picoquic_state_client_ready_start || 
         cnx->cnx_state == picoquic_state_server_false_start)
-        && path_x->mtu_probe_sent == 0 && cnx->pmtud_policy != picoquic_pmtud_blocked) {
+        && (path_x->mtu_probe_sent == 0 ||
+            (cnx->is_pmtud_sprint_enabled && path_x->nb_mtu_probes_in_flight < PICOQUIC_PMTUD_SPRINT_PROBES))
+        && cnx->pmtud_policy != picoquic_pmtud_blocked) {
         if (path_x->send_mtu_max_tried == 0 || path_x->send_mtu_max_tried > 1400) {
             /* MTU discovery is required if the chances of success are large enough
              * and there are enough packets to send to amortize the discovery cost.
@@ -1677,6 +2340,14 @@ picoquic_packet_type_enum picoquic_packet_type_from_epoch(int epoch)
     return ptype;
 }
 
+/* Effective upper bound on the number of bytes in transit for a path:
+ * the per context cwin_max memory bound, possibly tightened by a per
+ * path clamp posted through picoquic_set_path_cwin_clamp. */
+static uint64_t picoquic_cwin_byte_limit(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    return (path_x->cwin_clamp < cnx->quic->cwin_max) ? path_x->cwin_clamp : cnx->quic->cwin_max;
+}
+
 /* Prepare a required repetition or ack in a previous context */
 size_t picoquic_prepare_packet_old_context(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc,
     picoquic_path_t* path_x, picoquic_packet_t* packet, size_t send_buffer_max, uint64_t current_time,
@@ -2015,7 +2686,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                 bytes_next = bytes + length;
                 bytes_max = bytes + send_buffer_max - checksum_overhead;
 
-                if ((tls_ready == 0 || path_x->cwin <= path_x->bytes_in_transit || cnx->quic->cwin_max <= path_x->bytes_in_transit)
+                if ((tls_ready == 0 || path_x->cwin <= path_x->bytes_in_transit || picoquic_cwin_byte_limit(cnx, path_x) <= path_x->bytes_in_transit)
                     && (cnx->cnx_state == picoquic_state_client_almost_ready
                         || picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc, 0) == 0)
                     && picoquic_find_first_misc_frame(cnx, pc) == NULL && !force_handshake_padding) {
@@ -2037,7 +2708,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                         &more_data, &is_pure_ack, pc);
                     length = bytes_next - bytes;
 
-                    if (ret == 0 && path_x->cwin > path_x->bytes_in_transit && cnx->quic->cwin_max > path_x->bytes_in_transit) {
+                    if (ret == 0 && path_x->cwin > path_x->bytes_in_transit && picoquic_cwin_byte_limit(cnx, path_x) > path_x->bytes_in_transit) {
                         /* Encode the crypto handshake frame */
                         if (tls_ready != 0) {
                             /* Encode the crypto frame */
@@ -2257,7 +2928,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t * p
         bytes_next = bytes + length;
 
         if (((tls_ready || picoquic_find_first_misc_frame(cnx, pc) != NULL)
-            && path_x->cwin > path_x->bytes_in_transit && cnx->quic->cwin_max > path_x->bytes_in_transit) 
+            && path_x->cwin > path_x->bytes_in_transit && picoquic_cwin_byte_limit(cnx, path_x) > path_x->bytes_in_transit) 
             || cnx->ack_ctx[pc].act[0].ack_needed) {
             bytes_next = picoquic_format_ack_frame(cnx, bytes_next, bytes_max, &more_data, current_time, pc, 0);
             /* Encode misc frames if present */
@@ -2697,6 +3368,10 @@ void picoquic_ready_state_transition(picoquic_cnx_t* cnx, uint64_t current_time)
 
     if (!cnx->client_mode) {
         (void)picoquic_queue_handshake_done_frame(cnx);
+        /* Remember the version negotiated with this client network, so the
+         * application can steer future clients of the same network */
+        picoquic_record_version_preference(cnx->quic, (struct sockaddr*)&cnx->path[0]->peer_addr,
+            picoquic_supported_versions[cnx->version_index].version);
     }
 
     if (cnx->is_half_open){
@@ -2760,6 +3435,18 @@ void picoquic_ready_state_transition(picoquic_cnx_t* cnx, uint64_t current_time)
     }
 }
 
+/* A path created by a NAT port rebinding may keep carrying application data
+ * while its validation runs, provided the amplification limit of RFC 9000
+ * section 8 is respected: no more than three times the bytes received from
+ * the unvalidated address. This avoids stalling the connection for a round
+ * trip when only the source port changed. */
+static int picoquic_optimistic_send_authorized(picoquic_path_t* path_x, size_t send_buffer_min_max)
+{
+    return (path_x->is_optimistic_send_allowed &&
+        !path_x->challenge_failed &&
+        (path_x->bytes_sent + send_buffer_min_max) <= 3 * path_x->received);
+}
+
 uint8_t * picoquic_prepare_path_challenge_frames(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_packet_context_enum pc, int is_nominal_ack_path,
     uint8_t * bytes_next, uint8_t * bytes_max, 
@@ -3065,6 +3752,29 @@ static uint8_t* picoquic_prepare_stream_and_datagrams(picoquic_cnx_t* cnx, picoq
  * Lots of the same code as in the "ready" case, but we deal here with extra
  * complexity because the handshake is not finished.
  */
+/* Check whether the 1-RTT crypto stream is held back by the ticket
+ * issuance delay (see picoquic_set_ticket_issuance_delay). While the
+ * hold lasts, schedule a wake up for its expiry. */
+static int picoquic_is_ticket_deferred(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time)
+{
+    int is_deferred = 0;
+
+    if (cnx->ticket_send_time != 0) {
+        if (current_time < cnx->ticket_send_time) {
+            is_deferred = 1;
+            if (*next_wake_time > cnx->ticket_send_time) {
+                *next_wake_time = cnx->ticket_send_time;
+                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            }
+        }
+        else {
+            cnx->ticket_send_time = 0;
+        }
+    }
+
+    return is_deferred;
+}
+
 int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t* next_wake_time,
     int* is_initial_sent)
@@ -3170,7 +3880,8 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
 
         length = bytes_next - bytes;
 
-        if (cnx->cnx_state != picoquic_state_disconnected && path_x->challenge_verified != 0) {
+        if (cnx->cnx_state != picoquic_state_disconnected &&
+            (path_x->challenge_verified != 0 || picoquic_optimistic_send_authorized(path_x, send_buffer_min_max))) {
             /* There are no frames yet that would be exempt from pacing control, but if there
              * was they should be sent here. */
 
@@ -3227,7 +3938,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                     picoquic_pmtu_discovery_status_enum pmtu_discovery_needed = picoquic_is_mtu_probe_needed(cnx, path_x);
 
                     /* if present, send tls data */
-                    if (tls_ready) {
+                    if (tls_ready && !picoquic_is_ticket_deferred(cnx, current_time, next_wake_time)) {
                         bytes_next = picoquic_format_crypto_hs_frame(&cnx->tls_stream[picoquic_epoch_1rtt],
                             bytes_next, bytes_max, &more_data, &is_pure_ack);
                     }
@@ -3288,7 +3999,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                         } /* end of PMTU not required */
 
                         if (ret == 0 && length <= header_length
-                            && path_x->cwin > path_x->bytes_in_transit && cnx->quic->cwin_max > path_x->bytes_in_transit
+                            && path_x->cwin > path_x->bytes_in_transit && picoquic_cwin_byte_limit(cnx, path_x) > path_x->bytes_in_transit
                             && pmtu_discovery_needed != picoquic_pmtu_discovery_not_needed) {
                             if (send_buffer_max > path_x->send_mtu) {
                                 /* Since there is no data to send, this is an opportunity to send an MTU probe */
@@ -3297,6 +4008,8 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
                                 packet->send_path = path_x;
                                 packet->is_mtu_probe = 1;
                                 path_x->mtu_probe_sent = 1;
+                                path_x->nb_mtu_probes_in_flight++;
+                                path_x->send_mtu_sprint_low = length + checksum_overhead;
                                 is_pure_ack = 0;
                             }
                             else if (cnx->is_sending_large_buffer) {
@@ -3384,6 +4097,22 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
 }
 
 /*  Prepare the next packet to send when in the ready state */
+/* Arm the sender fast path after a full scheduling pass. The fast path is
+ * only worth taking on a plain single path connection; the conditions that
+ * can change between two passes are re-checked inline before each fast
+ * send, so this only needs to rule out the slow moving configurations and
+ * the pending MTU probe, which is too costly to test per packet. */
+static void picoquic_simple_send_arm(picoquic_cnx_t* cnx, picoquic_path_t* path_x, size_t send_buffer_max)
+{
+    if (send_buffer_max <= path_x->send_mtu ||
+        picoquic_is_mtu_probe_needed(cnx, path_x) == picoquic_pmtu_discovery_not_needed) {
+        cnx->simple_send_countdown = PICOQUIC_SIMPLE_SEND_ROUNDS;
+    }
+    else {
+        cnx->simple_send_countdown = 0;
+    }
+}
+
 int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t* next_wake_time,
     int* is_initial_sent)
@@ -3402,6 +4131,7 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     int more_data = 0;
     int ack_sent = 0;
     int is_challenge_padding_needed = 0;
+    int simple_send_done = 0;
     int is_nominal_ack_path = (cnx->is_multipath_enabled) ?
         (path_x->is_nominal_ack_path || cnx->nb_paths == 1) : path_x == cnx->path[0];
 
@@ -3480,33 +4210,47 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
         packet->send_path = path_x;
         bytes_next = bytes + length;
 
-        /* If required, prepare challenge and response frames.
-         * These frames will be sent immediately, regardless of pacing or flow control.
-         */
-        bytes_next = picoquic_prepare_path_challenge_frames(cnx, path_x,
-            pc, is_nominal_ack_path,
-            bytes_next, bytes_max,
-            &more_data, &is_pure_ack, &is_challenge_padding_needed,
-            current_time, next_wake_time);
-
-        /* Compute the length before pacing block */
-        length = bytes_next - bytes;
+        /* Fast path for the common case of a ready connection with a single
+         * active bulk stream: when the last full pass found no control work
+         * pending, and none of the conditions that could create some have
+         * changed, go straight to ACK, pacing, congestion and stream frame
+         * formatting. The countdown armed by picoquic_simple_send_arm bounds
+         * how many packets may skip the full pass, so periodic duties such
+         * as MAX_STREAMS refreshes or local CID advertisement are delayed by
+         * at most PICOQUIC_SIMPLE_SEND_ROUNDS packets. If the fast attempt
+         * does not produce stream or datagram data, the full pass runs
+         * below, continuing from the bytes already formatted. */
+        if (cnx->simple_send_countdown > 0 &&
+            cnx->cnx_state == picoquic_state_ready &&
+            !cnx->is_multipath_enabled &&
+            cnx->nb_paths == 1 &&
+            path_x->challenge_verified &&
+            !path_x->challenge_required &&
+            !path_x->response_required &&
+            !path_x->is_multipath_probe_needed &&
+            !path_x->is_pto_required &&
+            cnx->first_misc_frame == NULL &&
+            !cnx->max_stream_data_needed &&
+            !cnx->is_ack_frequency_updated &&
+            !cnx->is_address_discovery_provider &&
+            !cnx->is_preemptive_repeat_enabled &&
+            !cnx->is_forced_probe_up_required &&
+            (cnx->client_mode || !cnx->send_receive_bdp_frame) &&
+            cnx->priority_limit_for_bypass == 0 &&
+            !picoquic_is_tls_stream_ready(cnx) &&
+            (cnx->quic->max_data_limit == 0 ?
+                2 * cnx->data_received <= cnx->maxdata_local :
+                cnx->data_received + ((3 * cnx->quic->max_data_limit) / 4) <= cnx->maxdata_local) &&
+            cnx->max_stream_id_bidir_local_computed +
+                2 * cnx->local_parameters.initial_max_stream_id_bidir <= cnx->max_stream_id_bidir_local &&
+            cnx->max_stream_id_unidir_local_computed +
+                2 * cnx->local_parameters.initial_max_stream_id_unidir <= cnx->max_stream_id_unidir_local) {
+            cnx->simple_send_countdown--;
+
+            if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time) &&
+                !(path_x->cwin < path_x->bytes_in_transit || picoquic_cwin_byte_limit(cnx, path_x) < path_x->bytes_in_transit)) {
+                int no_data_to_send = 1;
 
-        if (path_x->is_multipath_probe_needed) {
-            packet->is_multipath_probe = 1;
-            path_x->is_multipath_probe_needed = 0;
-            is_pure_ack = 0;
-            *bytes_next = picoquic_frame_type_ping;
-            length++;
-            length = picoquic_pad_to_target_length(bytes, length, (uint32_t)(send_buffer_min_max - checksum_overhead));
-            bytes_next = bytes + length;
-        } else if (cnx->cnx_state != picoquic_state_disconnected && path_x->challenge_verified != 0) {
-            /* There are no frames yet that would be exempt from pacing control, but if there
-             * was they should be sent here. */
-
-            if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time)) {
-                /* Send here the frames that are not exempt from the pacing control,
-                 * but are exempt for congestion control */
                 if (picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc, !is_nominal_ack_path)) {
                     uint8_t* bytes_ack = bytes_next;
                     bytes_next = picoquic_format_ack_frame(cnx, bytes_next, bytes_max, &more_data,
@@ -3514,206 +4258,257 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                     ack_sent = (bytes_next > bytes_ack);
                 }
 
-                /* if necessary, prepare the MAX STREAM frames */
-                if (ret == 0) {
-                    bytes_next = picoquic_format_max_streams_frame_if_needed(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
-                }
-
-                /* If necessary, encode the max data frame */
-                if (ret == 0){
-                    if (cnx->quic->max_data_limit != 0) {
-                        if (cnx->data_received + ((3 * cnx->quic->max_data_limit) / 4) > cnx->maxdata_local) {
-                            uint64_t max_data_increase = cnx->data_received + cnx->quic->max_data_limit - cnx->maxdata_local;
-                            bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
-                                max_data_increase);
-                        }
-                    }
-                    else if (2 * cnx->data_received > cnx->maxdata_local) {
-                        bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
-                            picoquic_cc_increased_window(cnx, cnx->maxdata_local));
-                    }
-                }
+                bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
+                    UINT64_MAX, current_time, &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                length = bytes_next - bytes;
 
-                /* If necessary, encode the max stream data frames */
-                if (ret == 0 && cnx->max_stream_data_needed) {
-                    bytes_next = picoquic_format_required_max_stream_data_frames(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
-                }
-                /* Funky code alert:
-                * if misc frames are present the function `picoquic_retransmit_needed` is bypassed.
-                * if "more data" was not set, the code would not reset the wait time, and the
-                * program could stall.
-                * TODO: rework the way packets are repeated so this is not necessary.
-                */
-                if (cnx->first_misc_frame != NULL) {
-                    more_data = 1;
-                }
-                /* If present, send misc frame */
-                bytes_next = picoquic_format_misc_frames_in_context(cnx, bytes_next, bytes_max,
-                    &more_data, &is_pure_ack, pc);
+                simple_send_done = (ret == 0 && !no_data_to_send && length > header_length);
+            }
+        }
 
-                /* Compute the length before entering the CC block */
-                length = bytes_next - bytes;
+        if (!simple_send_done) {
+            /* If required, prepare challenge and response frames.
+             * These frames will be sent immediately, regardless of pacing or flow control.
+             */
+            bytes_next = picoquic_prepare_path_challenge_frames(cnx, path_x,
+                pc, is_nominal_ack_path,
+                bytes_next, bytes_max,
+                &more_data, &is_pure_ack, &is_challenge_padding_needed,
+                current_time, next_wake_time);
 
-                if ((path_x->cwin < path_x->bytes_in_transit || cnx->quic->cwin_max < path_x->bytes_in_transit)
-                    &&!path_x->is_pto_required) {
-                        /* Implementation of experimental API, picoquic_set_priority_limit_for_bypass */
-                        uint8_t* bytes_next_before_bypass = bytes_next;
-                        int no_data_to_send = 0;
-                        if (cnx->priority_limit_for_bypass > 0 && cnx->nb_paths == 1 &&
-                            picoquic_is_authorized_by_pacing(&cnx->priority_bypass_pacing, current_time, next_wake_time,
-                                cnx->quic->packet_train_mode, cnx->quic)) {
-                            bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
-                                cnx->priority_limit_for_bypass, current_time,
-                                &more_data, &is_pure_ack, &no_data_to_send, &ret);
-                        }
-                        if (bytes_next != bytes_next_before_bypass) {
-                            length = bytes_next - bytes;
-                        }
-                        else {
-                            cnx->cwin_blocked = 1;
-                            path_x->last_cwin_blocked_time = current_time;
-                            if (cnx->congestion_alg != NULL) {
-                                picoquic_per_ack_state_t ack_state = { 0 };
-
-                                cnx->congestion_alg->alg_notify(cnx, path_x,
-                                    picoquic_congestion_notification_cwin_blocked,
-                                    &ack_state, current_time);
-                            }
-                        }
-                }
-                else {
-                    /* Send here the frames that are subject to both congestion and pacing control.
-                     * this includes the PMTU probes.
-                     * Check whether PMTU discovery is required. The call will return
-                     * three values: not needed at all, optional, or required.
-                     * If required, PMTU discovery takes priority over sending stream data.
-                     */
-                    int no_data_to_send = 1;
-                    int preemptive_repeat = 0;
-                    picoquic_pmtu_discovery_status_enum pmtu_discovery_needed = picoquic_is_mtu_probe_needed(cnx, path_x);
+            /* Compute the length before pacing block */
+            length = bytes_next - bytes;
 
-                    /* if present, send tls data */
-                    if (picoquic_is_tls_stream_ready(cnx)) {
-                        bytes_next = picoquic_format_crypto_hs_frame(&cnx->tls_stream[picoquic_epoch_1rtt],
-                            bytes_next, bytes_max, &more_data, &is_pure_ack);
+            if (path_x->is_multipath_probe_needed) {
+                packet->is_multipath_probe = 1;
+                path_x->is_multipath_probe_needed = 0;
+                is_pure_ack = 0;
+                *bytes_next = picoquic_frame_type_ping;
+                length++;
+                length = picoquic_pad_to_target_length(bytes, length, (uint32_t)(send_buffer_min_max - checksum_overhead));
+                bytes_next = bytes + length;
+            } else if (cnx->cnx_state != picoquic_state_disconnected &&
+                (path_x->challenge_verified != 0 || picoquic_optimistic_send_authorized(path_x, send_buffer_min_max))) {
+                /* There are no frames yet that would be exempt from pacing control, but if there
+                 * was they should be sent here. */
+
+                if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, next_wake_time)) {
+                    /* Send here the frames that are not exempt from the pacing control,
+                     * but are exempt for congestion control */
+                    if (picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc, !is_nominal_ack_path)) {
+                        uint8_t* bytes_ack = bytes_next;
+                        bytes_next = picoquic_format_ack_frame(cnx, bytes_next, bytes_max, &more_data,
+                            current_time, pc, !is_nominal_ack_path);
+                        ack_sent = (bytes_next > bytes_ack);
                     }
 
-                    if (cnx->is_address_discovery_provider) {
-                        /* If a new address was learned, prepare an observed address frame */
-                        bytes_next = picoquic_prepare_observed_address_frame(bytes_next, bytes_max,
-                            path_x, current_time, next_wake_time, &more_data, &is_pure_ack);
+                    /* if necessary, prepare the MAX STREAM frames */
+                    if (ret == 0) {
+                        bytes_next = picoquic_format_max_streams_frame_if_needed(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
                     }
 
-                    if (length > header_length || pmtu_discovery_needed != picoquic_pmtu_discovery_required ||
-                        send_buffer_max <= path_x->send_mtu) {
-                        /* No need or no way to do path MTU discovery, just go on with formatting packets */
-                        /* If there are not enough local CID published, create and advertise */
-                        if (ret == 0) {
-                            bytes_next = picoquic_format_new_local_id_as_needed(cnx, bytes_next, bytes_max,
-                                current_time, next_wake_time, &more_data, &is_pure_ack);
+                    /* If necessary, encode the max data frame */
+                    if (ret == 0){
+                        if (cnx->quic->max_data_limit != 0) {
+                            if (cnx->data_received + ((3 * cnx->quic->max_data_limit) / 4) > cnx->maxdata_local) {
+                                uint64_t max_data_increase = cnx->data_received + cnx->quic->max_data_limit - cnx->maxdata_local;
+                                bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
+                                    max_data_increase);
+                            }
                         }
-                        if (ret == 0 && cnx->is_ack_frequency_updated && cnx->is_ack_frequency_negotiated) {
-                            bytes_next = picoquic_format_ack_frequency_frame(cnx, bytes_next, bytes_max, &more_data);
+                        else if (2 * cnx->data_received > cnx->maxdata_local) {
+                            bytes_next = picoquic_format_max_data_frame(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack,
+                                picoquic_cc_increased_window(cnx, cnx->maxdata_local));
                         }
-                        if (ret == 0) {
-                            bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
-                                UINT64_MAX, current_time, &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                    }
+
+                    /* If necessary, encode the max stream data frames */
+                    if (ret == 0 && cnx->max_stream_data_needed) {
+                        bytes_next = picoquic_format_required_max_stream_data_frames(cnx, bytes_next, bytes_max, &more_data, &is_pure_ack);
+                    }
+                    /* Funky code alert:
+                    * if misc frames are present the function `picoquic_retransmit_needed` is bypassed.
+                    * if "more data" was not set, the code would not reset the wait time, and the
+                    * program could stall.
+                    * TODO: rework the way packets are repeated so this is not necessary.
+                    */
+                    if (cnx->first_misc_frame != NULL) {
+                        more_data = 1;
+                    }
+                    /* If present, send misc frame */
+                    bytes_next = picoquic_format_misc_frames_in_context(cnx, bytes_next, bytes_max,
+                        &more_data, &is_pure_ack, pc);
+
+                    /* Compute the length before entering the CC block */
+                    length = bytes_next - bytes;
+
+                    if ((path_x->cwin < path_x->bytes_in_transit || picoquic_cwin_byte_limit(cnx, path_x) < path_x->bytes_in_transit)
+                        &&!path_x->is_pto_required) {
+                            /* Implementation of experimental API, picoquic_set_priority_limit_for_bypass */
+                            uint8_t* bytes_next_before_bypass = bytes_next;
+                            int no_data_to_send = 0;
+                            if (cnx->priority_limit_for_bypass > 0 && cnx->nb_paths == 1 &&
+                                picoquic_is_authorized_by_pacing(&cnx->priority_bypass_pacing, current_time, next_wake_time,
+                                    cnx->quic->packet_train_mode, cnx->quic)) {
+                                bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
+                                    cnx->priority_limit_for_bypass, current_time,
+                                    &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                            }
+                            if (bytes_next != bytes_next_before_bypass) {
+                                length = bytes_next - bytes;
+                            }
+                            else {
+                                cnx->cwin_blocked = 1;
+                                path_x->last_cwin_blocked_time = current_time;
+                                if (cnx->congestion_alg != NULL) {
+                                    picoquic_per_ack_state_t ack_state = { 0 };
+
+                                    cnx->congestion_alg->alg_notify(cnx, path_x,
+                                        picoquic_congestion_notification_cwin_blocked,
+                                        &ack_state, current_time);
+                                }
+                            }
+                    }
+                    else {
+                        /* Send here the frames that are subject to both congestion and pacing control.
+                         * this includes the PMTU probes.
+                         * Check whether PMTU discovery is required. The call will return
+                         * three values: not needed at all, optional, or required.
+                         * If required, PMTU discovery takes priority over sending stream data.
+                         */
+                        int no_data_to_send = 1;
+                        int preemptive_repeat = 0;
+                        picoquic_pmtu_discovery_status_enum pmtu_discovery_needed = picoquic_is_mtu_probe_needed(cnx, path_x);
+
+                        /* if present, send tls data */
+                        if (picoquic_is_tls_stream_ready(cnx) &&
+                            !picoquic_is_ticket_deferred(cnx, current_time, next_wake_time)) {
+                            bytes_next = picoquic_format_crypto_hs_frame(&cnx->tls_stream[picoquic_epoch_1rtt],
+                                bytes_next, bytes_max, &more_data, &is_pure_ack);
                         }
 
-                        /* TODO: replace this by scheduling of BDP frame when window has been estimated */
-                        /* Send bdp frames if there are no stream frames to send 
-                         * and if peer wishes to receive bdp frames */
-                        if(!cnx->client_mode && cnx->send_receive_bdp_frame) {
-                           bytes_next = picoquic_format_bdp_frame(cnx, bytes_next, bytes_max, path_x, &more_data, &is_pure_ack);
+                        if (cnx->is_address_discovery_provider) {
+                            /* If a new address was learned, prepare an observed address frame */
+                            bytes_next = picoquic_prepare_observed_address_frame(bytes_next, bytes_max,
+                                path_x, current_time, next_wake_time, &more_data, &is_pure_ack);
                         }
 
-                        length = bytes_next - bytes;
+                        if (length > header_length || pmtu_discovery_needed != picoquic_pmtu_discovery_required ||
+                            send_buffer_max <= path_x->send_mtu) {
+                            /* No need or no way to do path MTU discovery, just go on with formatting packets */
+                            /* If there are not enough local CID published, create and advertise */
+                            if (ret == 0) {
+                                bytes_next = picoquic_format_new_local_id_as_needed(cnx, bytes_next, bytes_max,
+                                    current_time, next_wake_time, &more_data, &is_pure_ack);
+                            }
+                            if (ret == 0 && cnx->is_ack_frequency_updated && cnx->is_ack_frequency_negotiated) {
+                                bytes_next = picoquic_format_ack_frequency_frame(cnx, bytes_next, bytes_max, &more_data);
+                            }
+                            if (ret == 0) {
+                                bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
+                                    UINT64_MAX, current_time, &more_data, &is_pure_ack, &no_data_to_send, &ret);
+                            }
+
+                            /* TODO: replace this by scheduling of BDP frame when window has been estimated */
+                            /* Send bdp frames if there are no stream frames to send 
+                             * and if peer wishes to receive bdp frames */
+                            if(!cnx->client_mode && cnx->send_receive_bdp_frame) {
+                               bytes_next = picoquic_format_bdp_frame(cnx, bytes_next, bytes_max, path_x, &more_data, &is_pure_ack);
+                            }
 
-                        if (length <= header_length || is_pure_ack) {
-                            /* Mark the bandwidth estimation as application limited */
-                            path_x->delivered_limited_index = path_x->delivered;
-                            /* Notify the peer if something is blocked */
-                            bytes_next = picoquic_format_blocked_frames(cnx, &bytes[length], bytes_max, &more_data, &is_pure_ack);
                             length = bytes_next - bytes;
-                        }
 
-                        if (cnx->is_preemptive_repeat_enabled ||
-                            (cnx->is_forced_probe_up_required && path_x->is_cca_probing_up)) {
-                            if (length <= header_length) {
-                                /* Consider redundant retransmission:
-                                 * if the redundant retransmission index is null:
-                                 * - if the packet loss rate is large enough compared to BDP, set index to last sent packet.
-                                 * - if not, do not perform redundant retransmission.
-                                 * if the packet contains a stream frame, if that stream is finished, and if the
-                                 * data range has not been acked, and it fits: copy it to the data. Move the index to the previous packet.
-                                 */
-                                 ret = picoquic_preemptive_retransmit_as_needed(cnx, path_x, pc, current_time, next_wake_time, bytes_next,
-                                    bytes_max - bytes_next, &length, &more_data, &is_pure_ack);
-                                 if (length > header_length) {
-                                     preemptive_repeat = 1;
-                                     packet->is_preemptive_repeat = 1;
-                                     bytes_next = bytes + length;
-                                 }
-                                 else if (cnx->is_forced_probe_up_required && path_x->is_cca_probing_up) {
-                                     *bytes_next++ = picoquic_frame_type_ping;
-                                     memset(bytes_next, picoquic_frame_type_padding, bytes_max - bytes_next);
-                                     bytes_next = bytes_max;
-                                     length = bytes_next - bytes;
-                                     is_pure_ack = 0;
-                                 }
+                            if (length <= header_length || is_pure_ack) {
+                                /* Mark the bandwidth estimation as application limited */
+                                path_x->delivered_limited_index = path_x->delivered;
+                                /* Notify the peer if something is blocked */
+                                bytes_next = picoquic_format_blocked_frames(cnx, &bytes[length], bytes_max, &more_data, &is_pure_ack);
+                                length = bytes_next - bytes;
                             }
-                            else if (!more_data){
-                                /* Check whether preemptive retrasmission is needed. Same code as above,
-                                 * but in "test_only" mode, will set "more_data" or wait time if repeat is ready 
-                                 */
-                                ret = picoquic_preemptive_retransmit_as_needed(cnx, path_x, pc, current_time, next_wake_time, bytes_next,
-                                    bytes_max - bytes_next, &length, &more_data, NULL);
+
+                            if (cnx->is_preemptive_repeat_enabled ||
+                                (cnx->is_forced_probe_up_required && path_x->is_cca_probing_up)) {
+                                if (length <= header_length) {
+                                    /* Consider redundant retransmission:
+                                     * if the redundant retransmission index is null:
+                                     * - if the packet loss rate is large enough compared to BDP, set index to last sent packet.
+                                     * - if not, do not perform redundant retransmission.
+                                     * if the packet contains a stream frame, if that stream is finished, and if the
+                                     * data range has not been acked, and it fits: copy it to the data. Move the index to the previous packet.
+                                     */
+                                     ret = picoquic_preemptive_retransmit_as_needed(cnx, path_x, pc, current_time, next_wake_time, bytes_next,
+                                        bytes_max - bytes_next, &length, &more_data, &is_pure_ack);
+                                     if (length > header_length) {
+                                         preemptive_repeat = 1;
+                                         packet->is_preemptive_repeat = 1;
+                                         bytes_next = bytes + length;
+                                     }
+                                     else if (cnx->is_forced_probe_up_required && path_x->is_cca_probing_up) {
+                                         *bytes_next++ = picoquic_frame_type_ping;
+                                         memset(bytes_next, picoquic_frame_type_padding, bytes_max - bytes_next);
+                                         bytes_next = bytes_max;
+                                         length = bytes_next - bytes;
+                                         is_pure_ack = 0;
+                                     }
+                                }
+                                else if (!more_data){
+                                    /* Check whether preemptive retrasmission is needed. Same code as above,
+                                     * but in "test_only" mode, will set "more_data" or wait time if repeat is ready 
+                                     */
+                                    ret = picoquic_preemptive_retransmit_as_needed(cnx, path_x, pc, current_time, next_wake_time, bytes_next,
+                                        bytes_max - bytes_next, &length, &more_data, NULL);
+                                }
                             }
-                        }
 
-                        if (no_data_to_send && !preemptive_repeat) {
-                            path_x->last_sender_limited_time = current_time;
-                        }
-                    } /* end of PMTU not required */
-
-                    if (ret == 0 && path_x->is_pto_required){
-                        if ((length <= header_length || is_pure_ack) && bytes_next < bytes_max){
-                            /* PTO probe required. */
-                            *bytes_next++ = picoquic_frame_type_ping;
-                            length++;
-                            is_pure_ack = 0;
-                        }
-                    } 
+                            if (no_data_to_send && !preemptive_repeat) {
+                                path_x->last_sender_limited_time = current_time;
+                            }
+                        } /* end of PMTU not required */
 
-                    if (ret == 0 && length <= header_length) {
-                        if (send_buffer_max > path_x->send_mtu
-                            && path_x->cwin > path_x->bytes_in_transit 
-                            && cnx->quic->cwin_max > path_x->bytes_in_transit
-                            && pmtu_discovery_needed != picoquic_pmtu_discovery_not_needed) {
-                            /* Since there is no data to send, this is an opportunity to send an MTU probe */
-                            length = picoquic_prepare_mtu_probe(cnx, path_x, header_length, checksum_overhead, bytes, send_buffer_max);
-                            packet->length = length;
-                            packet->send_path = path_x;
-                            packet->is_mtu_probe = 1;
-                            path_x->mtu_probe_sent = 1;
-                            is_pure_ack = 0;
+                        if (ret == 0 && path_x->is_pto_required){
+                            if ((length <= header_length || is_pure_ack) && bytes_next < bytes_max){
+                                /* PTO probe required. */
+                                *bytes_next++ = picoquic_frame_type_ping;
+                                length++;
+                                is_pure_ack = 0;
+                            }
+                        } 
+
+                        if (ret == 0 && length <= header_length) {
+                            if (send_buffer_max > path_x->send_mtu
+                                && path_x->cwin > path_x->bytes_in_transit 
+                                && picoquic_cwin_byte_limit(cnx, path_x) > path_x->bytes_in_transit
+                                && pmtu_discovery_needed != picoquic_pmtu_discovery_not_needed) {
+                                /* Since there is no data to send, this is an opportunity to send an MTU probe */
+                                length = picoquic_prepare_mtu_probe(cnx, path_x, header_length, checksum_overhead, bytes, send_buffer_max);
+                                packet->length = length;
+                                packet->send_path = path_x;
+                                packet->is_mtu_probe = 1;
+                                path_x->mtu_probe_sent = 1;
+                                path_x->nb_mtu_probes_in_flight++;
+                                path_x->send_mtu_sprint_low = length + checksum_overhead;
+                                is_pure_ack = 0;
+                            }
                         }
+                    } /* end of CC */
+                } /* End of pacing */
+                else if (cnx->priority_limit_for_bypass > 0 && cnx->nb_paths == 1 &&
+                    picoquic_is_authorized_by_pacing(&cnx->priority_bypass_pacing, current_time, next_wake_time,
+                        cnx->quic->packet_train_mode, cnx->quic)) {
+                    /* If congestion bypass is implemented, also consider pacing bypass */
+                    int no_data_to_send = 0;
+
+                    if ((bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
+                        cnx->priority_limit_for_bypass, current_time,
+                        &more_data, &is_pure_ack, &no_data_to_send, &ret)) != NULL) {
+                        length = bytes_next - bytes;
                     }
-                } /* end of CC */
-            } /* End of pacing */
-            else if (cnx->priority_limit_for_bypass > 0 && cnx->nb_paths == 1 &&
-                picoquic_is_authorized_by_pacing(&cnx->priority_bypass_pacing, current_time, next_wake_time,
-                    cnx->quic->packet_train_mode, cnx->quic)) {
-                /* If congestion bypass is implemented, also consider pacing bypass */
-                int no_data_to_send = 0;
-
-                if ((bytes_next = picoquic_prepare_stream_and_datagrams(cnx, path_x, bytes_next, bytes_max,
-                    cnx->priority_limit_for_bypass, current_time,
-                    &more_data, &is_pure_ack, &no_data_to_send, &ret)) != NULL) {
-                    length = bytes_next - bytes;
                 }
-            }
-        } /* End of challenge verified */
+            } /* End of challenge verified */
+
+            /* A full pass ran; decide whether the next packets can use the fast path */
+            picoquic_simple_send_arm(cnx, path_x, send_buffer_max);
+        } /* End of full scheduling pass */
     }
 
     if (length <= header_length) {
@@ -3722,6 +4517,20 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 
     if (cnx->cnx_state != picoquic_state_disconnected) {
         if (length > 0){
+            if (cnx->is_ack_coalescing_enabled && !is_pure_ack && !ack_sent &&
+                picoquic_is_ack_pending(cnx, pc, !is_nominal_ack_path)) {
+                /* Final coalescing pass: this packet is ack eliciting and
+                 * about to be sent anyway, so pick up the pending ACK state
+                 * now even though the ACK delay timer has not fired,
+                 * instead of waking up later for a pure ACK packet. */
+                bytes_next = bytes + length;
+                bytes_next = picoquic_format_ack_frame(cnx, bytes_next, bytes_max, &more_data,
+                    current_time, pc, !is_nominal_ack_path);
+                if (bytes_next > bytes + length) {
+                    ack_sent = 1;
+                    length = bytes_next - bytes;
+                }
+            }
             path_x->is_pto_required &= is_pure_ack;
             pkt_ctx->ack_of_ack_requested |= !is_pure_ack;
             if (!pkt_ctx->ack_of_ack_requested && ack_sent) {
@@ -3782,9 +4591,21 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
                 bytes[length++] = 0;
                 cnx->latest_progress_time = current_time;
             }
-            else if (cnx->latest_progress_time + cnx->keep_alive_interval < *next_wake_time) {
-                *next_wake_time = cnx->latest_progress_time + cnx->keep_alive_interval;
-                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            else {
+                uint64_t keep_alive_time = cnx->latest_progress_time + cnx->keep_alive_interval;
+
+                if (cnx->quic->keep_alive_slack > 0) {
+                    /* Align the wake time up to the next slack boundary, so
+                     * the keep alive timers of many idle connections fire in
+                     * the same batch, see picoquic_set_keep_alive_slack. */
+                    keep_alive_time += cnx->quic->keep_alive_slack - 1;
+                    keep_alive_time -= keep_alive_time % cnx->quic->keep_alive_slack;
+                }
+
+                if (keep_alive_time < *next_wake_time) {
+                    *next_wake_time = keep_alive_time;
+                    SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+                }
             }
         }
 
@@ -3793,6 +4614,18 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
             SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
             ret = 0;
         }
+
+        if (cnx->next_cork_time != 0) {
+            /* Wake up when the earliest stream cork expires, see
+             * picoquic_set_stream_cork_delay. */
+            if (cnx->next_cork_time <= current_time) {
+                cnx->next_cork_time = 0;
+            }
+            else if (cnx->next_cork_time < *next_wake_time) {
+                *next_wake_time = cnx->next_cork_time;
+                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            }
+        }
     }
 
     if (ret == 0 && length > header_length) {
@@ -3861,6 +4694,21 @@ static int picoquic_check_idle_timer(picoquic_cnx_t* cnx, uint64_t* next_wake_ti
         SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
     }
 
+    if (ret == 0 && cnx->quic->hibernate_delay > 0 && !cnx->is_hibernated &&
+        cnx->cnx_state == picoquic_state_ready) {
+        uint64_t hibernate_timer = cnx->latest_receive_time + cnx->quic->hibernate_delay;
+
+        if (current_time >= hibernate_timer) {
+            if (picoquic_is_cnx_backlog_empty(cnx)) {
+                picoquic_cnx_hibernate(cnx);
+            }
+        }
+        else if (hibernate_timer < *next_wake_time) {
+            *next_wake_time = hibernate_timer;
+            SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+        }
+    }
+
     return ret;
 }
 
@@ -3922,11 +4770,13 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoq
         ret = PICOQUIC_ERROR_DISCONNECTED;
         break;
     case picoquic_state_client_retry_received:
-        DBG_PRINTF("Unexpected connection state: %d\n", cnx->cnx_state);
+        PICOQUIC_DIAG(picoquic_diag_severity_error, PICOQUIC_SENDER,
+            "Unexpected connection state: %d", cnx->cnx_state);
         ret = PICOQUIC_ERROR_UNEXPECTED_STATE;
         break;
     default:
-        DBG_PRINTF("Unexpected connection state: %d\n", cnx->cnx_state);
+        PICOQUIC_DIAG(picoquic_diag_severity_error, PICOQUIC_SENDER,
+            "Unexpected connection state: %d", cnx->cnx_state);
         ret = PICOQUIC_ERROR_UNEXPECTED_STATE;
         break;
     }
@@ -4033,6 +4883,80 @@ static void picoquic_set_path_addresses(picoquic_cnx_t* cnx, int path_id, int is
     }
 }
 
+/* Compare two candidate data paths according to the multipath scheduler
+ * policy set with picoquic_set_multipath_scheduler. Both candidates have
+ * already passed the availability, pacing and congestion checks. Returns
+ * non zero if path "i" should be preferred over the currently selected
+ * candidate. */
+static int picoquic_mp_scheduler_prefers(picoquic_cnx_t* cnx, int i, int candidate)
+{
+    int prefers;
+    picoquic_path_t* path_i = cnx->path[i];
+    picoquic_path_t* path_c = cnx->path[candidate];
+
+    switch (cnx->multipath_scheduler) {
+    case picoquic_multipath_scheduler_min_rtt:
+        prefers = (path_i->rtt_min < path_c->rtt_min ||
+            (path_i->rtt_min == path_c->rtt_min &&
+                path_i->last_sent_time < path_c->last_sent_time));
+        break;
+    case picoquic_multipath_scheduler_proportional: {
+        /* Prefer the path with the lowest congestion window fill ratio,
+         * which loads each path in proportion to its rate. Cross
+         * multiplication avoids a division; both factors stay well
+         * below 2^32 so the products cannot overflow. */
+        uint64_t fill_i = path_i->bytes_in_transit * path_c->cwin;
+        uint64_t fill_c = path_c->bytes_in_transit * path_i->cwin;
+        prefers = (fill_i < fill_c ||
+            (fill_i == fill_c && path_i->last_sent_time < path_c->last_sent_time));
+        break;
+    }
+    default:
+        /* The default and redundant policies rotate between paths,
+         * serving the least recently used one. */
+        prefers = (path_i->last_sent_time < path_c->last_sent_time);
+        break;
+    }
+
+    return prefers;
+}
+
+/* Estimate whether sending data on path "i" would cause head of line
+ * blocking at the receiver. When the paths are asymmetric, e.g. 5ms WiFi
+ * plus 40ms cellular, striping a small backlog over the slow path creates
+ * a reassembly hole: the fast path drains the rest of the backlog and
+ * then everything waits for the slow path delivery. The fast path
+ * delivers about one window per RTT, so it finishes the backlog about
+ * "backlog*rtt_f/cwin_f + rtt_f/2" after now, while the first byte sent
+ * on the slow path arrives after "rtt_i/2". If the fast path alone
+ * finishes first, the slow path transmission is pure blocking. The
+ * comparison is cross multiplied by 2*cwin_f to avoid divisions.
+ * The estimate only works for data queued with picoquic_add_to_stream;
+ * active streams provide data through callbacks and their backlog is
+ * unknown, in which case the slow path is not withheld. */
+static int picoquic_mp_path_hol_blocking(picoquic_cnx_t* cnx, int i, int i_fast,
+    picoquic_stream_head_t* next_stream)
+{
+    int blocking = 0;
+
+    if (i_fast >= 0 && i != i_fast &&
+        cnx->multipath_scheduler != picoquic_multipath_scheduler_redundant &&
+        (next_stream == NULL || !next_stream->is_active)) {
+        picoquic_path_t* path_i = cnx->path[i];
+        picoquic_path_t* path_f = cnx->path[i_fast];
+
+        if (path_i->smoothed_rtt > path_f->smoothed_rtt && path_f->cwin > 0 &&
+            cnx->nb_bytes_queued > cnx->data_sent) {
+            uint64_t backlog = cnx->nb_bytes_queued - cnx->data_sent;
+
+            blocking = (2 * backlog * path_f->smoothed_rtt + path_f->cwin * path_f->smoothed_rtt <
+                path_f->cwin * path_i->smoothed_rtt);
+        }
+    }
+
+    return blocking;
+}
+
 static int picoquic_select_next_path_mp(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time,
     struct sockaddr_storage * p_addr_to, struct sockaddr_storage * p_addr_from, int* if_index)
 {
@@ -4045,7 +4969,6 @@ static int picoquic_select_next_path_mp(picoquic_cnx_t* cnx, uint64_t current_ti
     uint64_t challenge_time_next = UINT64_MAX;
     uint64_t highest_retransmit = UINT64_MAX;
     uint64_t last_sent_pacing = UINT64_MAX;
-    uint64_t last_sent_cwin = UINT64_MAX;
     int i;
     int i_min_rtt = -1;
     int is_min_rtt_pacing_ok = 0;
@@ -4127,7 +5050,6 @@ static int picoquic_select_next_path_mp(picoquic_cnx_t* cnx, uint64_t current_ti
                     data_path_pacing = -1;
                     pacing_time_next = UINT64_MAX;
                     last_sent_pacing = UINT64_MAX;
-                    last_sent_cwin = UINT64_MAX;
                     i_min_rtt = -1;
                     is_min_rtt_pacing_ok = 0;
                 }
@@ -4150,9 +5072,9 @@ static int picoquic_select_next_path_mp(picoquic_cnx_t* cnx, uint64_t current_ti
                             }
                         }
                         if (cnx->path[i]->bytes_in_transit < cnx->path[i]->cwin &&
-                            cnx->path[i]->bytes_in_transit <  cnx->quic->cwin_max) {
-                            if (cnx->path[i]->last_sent_time < last_sent_cwin) {
-                                last_sent_cwin = cnx->path[i]->last_sent_time;
+                            cnx->path[i]->bytes_in_transit < picoquic_cwin_byte_limit(cnx, cnx->path[i])) {
+                            if (data_path_cwin < 0 ||
+                                picoquic_mp_scheduler_prefers(cnx, i, data_path_cwin)) {
                                 data_path_cwin = i;
                             }
                             if (affinity_path_id < 0) {
@@ -4199,6 +5121,13 @@ static int picoquic_select_next_path_mp(picoquic_cnx_t* cnx, uint64_t current_ti
         if (affinity_path_id >= 0) {
             path_id = affinity_path_id;
         }
+        else if (picoquic_mp_path_hol_blocking(cnx, data_path_cwin, i_min_rtt, next_stream)) {
+            /* The min RTT path will deliver the whole backlog before the
+             * selected path could deliver its first byte. Poll the min RTT
+             * path instead; if its window is full the connection will wake
+             * up when the next acknowledgement opens it. */
+            path_id = i_min_rtt;
+        }
         else {
             path_id = data_path_cwin;
         }
@@ -4361,6 +5290,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
     int ret = 0;
     picoquic_packet_t * packet = NULL;
     uint64_t initial_next_time;
+    size_t train_budget = 0;
     uint64_t next_wake_time = cnx->latest_receive_time + 2*PICOQUIC_MICROSEC_SILENCE_MAX;
 
     if (cnx->local_parameters.max_idle_timeout >(PICOQUIC_MICROSEC_SILENCE_MAX / 500)) {
@@ -4385,6 +5315,12 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
         ret = picoquic_check_cc_feedback_timer(cnx, &next_wake_time, current_time);
     }
 
+    if (ret == 0) {
+        /* If a certificate signature was dispatched to the crypto workers,
+         * resume the handshake when it completed, or poll again shortly. */
+        ret = picoquic_tls_async_sign_progress(cnx, current_time, &next_wake_time);
+    }
+
     if (send_buffer_max < PICOQUIC_ENFORCED_INITIAL_MTU) {
         DBG_PRINTF("Invalid buffer size: %zu", send_buffer_max);
         ret = -1;
@@ -4411,6 +5347,35 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
             cnx->is_sending_large_buffer = 1;
         }
 
+        /* Size the packet train to the credit available right now, so a
+         * GSO batch deliberately fills the number of MTU sized packets
+         * that pacing and the congestion window allow to leave back to
+         * back, instead of running the segment builder until it reports
+         * a blocked state. The budget is a cap, not an authorization:
+         * the per packet checks in picoquic_prepare_segment remain
+         * authoritative, and at least one MTU is always attempted so
+         * that ACK only or probe packets are not starved. */
+        train_budget = send_buffer_max;
+        if (send_msg_size != NULL && send_buffer_max > cnx->path[path_id]->send_mtu) {
+            size_t send_mtu = cnx->path[path_id]->send_mtu;
+            size_t credit = picoquic_pacing_credit_bytes(&cnx->path[path_id]->pacing, current_time, send_mtu);
+
+            if (cnx->path[path_id]->cwin > cnx->path[path_id]->bytes_in_transit) {
+                size_t cwin_credit = (size_t)(cnx->path[path_id]->cwin - cnx->path[path_id]->bytes_in_transit);
+                /* Round up to a whole number of packets */
+                cwin_credit = ((cwin_credit + send_mtu - 1) / send_mtu) * send_mtu;
+                if (cwin_credit < credit) {
+                    credit = cwin_credit;
+                }
+            }
+            if (credit < send_mtu) {
+                credit = send_mtu;
+            }
+            if (credit < train_budget) {
+                train_budget = credit;
+            }
+        }
+
         while (ret == 0)
         {
             /* Create a new packet, which may include several segments */
@@ -4467,7 +5432,8 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                             break;
                         }
                         else if (segment_length == 0) {
-                            DBG_PRINTF("Send bug: segment length = %zu, packet length = %zu\n", segment_length, packet->length);
+                            PICOQUIC_DIAG(picoquic_diag_severity_error, PICOQUIC_SENDER,
+                                "Send bug: segment length = %zu, packet length = %zu", segment_length, packet->length);
                             break;
                         }
                     }
@@ -4498,6 +5464,8 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                     cnx->max_mtu_sent = packet_size;
                 }
                 cnx->nb_packets_sent++;
+                PICOQUIC_PROBE_PACKET_SENT(picoquic_val64_connection_id(cnx->initial_cnxid),
+                    packet_size, cnx->nb_packets_sent);
                 /* if needed, log that the packet is sent */
                 if (p_addr_to != NULL && p_addr_from != NULL) {
                     picoquic_log_pdu(cnx, 0, current_time,
@@ -4541,7 +5509,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                 }
                 break;
             }
-            else if (*send_length + *send_msg_size > send_buffer_max) {
+            else if (*send_length + *send_msg_size > train_budget) {
                 break;
             }
         }
@@ -4556,6 +5524,8 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
 
     picoquic_reinsert_by_wake_time(cnx->quic, cnx, next_wake_time);
 
+    picoquic_publish_cnx_stats(cnx, current_time);
+
     return ret;
 }
 
@@ -4605,8 +5575,12 @@ void picoquic_close_immediate(picoquic_cnx_t* cnx)
 }
 
 /* Quic context level call.
- * will send a stateless packet if one is queued, or ask the first connection in
- * the wake list to prepare a packet */
+ * will send a stateless packet if one is queued, or serve the next
+ * connection of the send scheduling round (see quicctx.c), collecting a
+ * new round when the previous one is exhausted. Each connection of a
+ * round prepares at most one send train before any is served again,
+ * which keeps a batched send pass fair across connections and avoids
+ * reinserting the same connection in the wake list between messages. */
 
 int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
@@ -4620,6 +5594,8 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
         *p_last_cnx = NULL;
     }
 
+    picoquic_trim_packet_pool(quic, current_time);
+
     if (sp != NULL) {
         if (sp->length > send_buffer_max) {
             *send_length = 0;
@@ -4637,13 +5613,21 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
         picoquic_delete_stateless_packet(sp);
     }
     else {
-        picoquic_cnx_t* cnx = picoquic_get_earliest_cnx_to_wake(quic, current_time);
+        picoquic_cnx_t* cnx;
 
-        if (cnx == NULL) {
-            *send_length = 0;
+        if (quic->sched_round_first == NULL) {
+            /* The previous round is exhausted; collect every connection
+             * that is currently due into a new one. */
+            picoquic_sched_round_collect(quic, current_time);
         }
-        else {
-            ret = picoquic_prepare_packet_ex(cnx, current_time, send_buffer, send_buffer_max, send_length, p_addr_to, p_addr_from, 
+        if ((cnx = picoquic_sched_round_pop(quic)) == NULL) {
+            cnx = picoquic_get_earliest_cnx_to_wake(quic, current_time);
+        }
+
+        *send_length = 0;
+
+        while (cnx != NULL) {
+            ret = picoquic_prepare_packet_ex(cnx, current_time, send_buffer, send_buffer_max, send_length, p_addr_to, p_addr_from,
                 if_index, send_msg_size);
             if (log_cid != NULL) {
                 *log_cid = cnx->initial_cnxid;
@@ -4682,6 +5666,16 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
                     *p_last_cnx = cnx;
                 }
             }
+
+            if (ret == 0 && *send_length == 0) {
+                /* This connection had nothing to send after all; move to
+                 * the next connection of the round rather than ending
+                 * the send pass with an empty slot. */
+                cnx = picoquic_sched_round_pop(quic);
+            }
+            else {
+                break;
+            }
         }
     }
 
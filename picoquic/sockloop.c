@@ -33,6 +33,12 @@
  * TODO: support the QuicDoq scenario, manage extra socket.
  */
 
+#ifndef _WINDOWS
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
+#endif
+
 #ifdef _WINDOWS
 #define WIN32_LEAN_AND_MEAN
 #include <WinSock2.h>
@@ -79,6 +85,21 @@
 #include <netinet/in.h>
 #include <sys/select.h>
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define PICOQUIC_ZEROCOPY_AVAILABLE
+#include <linux/errqueue.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#if defined(PICOQUIC_USE_EPOLL)
+#include <sys/epoll.h>
+#elif defined(PICOQUIC_USE_KQUEUE)
+#include <sys/event.h>
+#endif
+
 #ifndef __APPLE__
 #ifdef __LINUX__
 #include <linux/prctl.h>  /* Definition of PR_* constants */
@@ -107,6 +128,7 @@
 #include "picoquic.h"
 #include "picoquic_internal.h"
 #include "picoquic_packet_loop.h"
+#include "picoquic_lb.h"
 #include "picoquic_unified_log.h"
 
 #if defined(_WINDOWS)
@@ -343,7 +365,7 @@ void picoquic_packet_loop_close_socket(picoquic_socket_ctx_t* s_ctx)
 }
 
 int picoquic_packet_loop_open_socket(int socket_buffer_size, int do_not_use_gso,
-    picoquic_socket_ctx_t* s_ctx)
+    int use_so_reuseport, picoquic_socket_ctx_t* s_ctx)
 {
     int ret = 0;
     struct sockaddr_storage local_address;
@@ -371,6 +393,7 @@ int picoquic_packet_loop_open_socket(int socket_buffer_size, int do_not_use_gso,
         /* TODO: set option IPv6 only */
         picoquic_socket_set_ecn_options(s_ctx->fd, s_ctx->af, &recv_set, &send_set) != 0 ||
         picoquic_socket_set_pkt_info(s_ctx->fd, s_ctx->af) != 0 ||
+        (use_so_reuseport && picoquic_socket_set_reuseport(s_ctx->fd) != 0) ||
         picoquic_bind_to_port(s_ctx->fd,s_ctx->af, s_ctx->port) != 0 ||
         picoquic_get_local_address(s_ctx->fd, &local_address) != 0 ||
         picoquic_socket_set_pmtud_options(s_ctx->fd, s_ctx->af) != 0)
@@ -421,14 +444,28 @@ int picoquic_packet_loop_open_socket(int socket_buffer_size, int do_not_use_gso,
         if (ret == 0) {
             ret = picoquic_packet_set_windows_socket(send_coalesced, recv_coalesced, s_ctx);
         }
+#else
+#if defined(UDP_GRO)
+        if (ret == 0 && !do_not_use_gso) {
+            /* Ask the kernel to coalesce consecutive datagrams from the same
+             * flow into a single receive, mirroring the URO option set on
+             * Windows sockets. The option is best effort: older kernels
+             * simply reject it and the socket keeps delivering single
+             * datagrams. */
+            int one = 1;
+            if (setsockopt(s_ctx->fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0) {
+                s_ctx->supports_udp_recv_coalesced = 1;
+            }
+        }
+#endif
 #endif
     }
 
     return ret;
 }
 
-int picoquic_packet_loop_open_sockets(uint16_t local_port, int local_af, int socket_buffer_size, int extra_socket_required,
-    int do_not_use_gso, picoquic_socket_ctx_t* s_ctx)
+int picoquic_packet_loop_open_sockets_ex(uint16_t local_port, int local_af, int socket_buffer_size, int extra_socket_required,
+    int do_not_use_gso, int use_so_reuseport, picoquic_socket_ctx_t* s_ctx)
 {
     /* Compute how many sockets are necessary, and set the intial value of AF and port per socket */
     int nb_sockets = 0;
@@ -451,7 +488,7 @@ int picoquic_packet_loop_open_sockets(uint16_t local_port, int local_af, int soc
             s_ctx[nb_sockets].af = af[i_af];
             s_ctx[nb_sockets].port = current_port;
             s_ctx[nb_sockets].n_port = htons(current_port);
-            if ((sock_ret = picoquic_packet_loop_open_socket(socket_buffer_size, do_not_use_gso, &s_ctx[nb_sockets])) == 0) {
+            if ((sock_ret = picoquic_packet_loop_open_socket(socket_buffer_size, do_not_use_gso, use_so_reuseport, &s_ctx[nb_sockets])) == 0) {
                 if (current_port == 0) {
                     current_port = s_ctx[nb_sockets].port;
                     s_ctx[nb_sockets].n_port = htons(current_port);
@@ -471,6 +508,13 @@ int picoquic_packet_loop_open_sockets(uint16_t local_port, int local_af, int soc
     return nb_sockets;
 }
 
+int picoquic_packet_loop_open_sockets(uint16_t local_port, int local_af, int socket_buffer_size, int extra_socket_required,
+    int do_not_use_gso, picoquic_socket_ctx_t* s_ctx)
+{
+    return picoquic_packet_loop_open_sockets_ex(local_port, local_af, socket_buffer_size,
+        extra_socket_required, do_not_use_gso, 0, s_ctx);
+}
+
 /*
 * Windows: use asynchronous receive. Asynchronous receive requires
 * declaring an overlap context and event per socket, as well as a
@@ -572,7 +616,460 @@ int picoquic_packet_loop_wait(picoquic_socket_ctx_t* s_ctx,
     }
     return bytes_recv;
 }
-#else 
+#else
+/* Batched receive state, used when the loop parameters request more than
+ * one datagram per receive system call. The buffers are allocated once
+ * when the loop starts; message number i is received at offset
+ * i*PICOQUIC_RECV_BATCH_BUFFER_SIZE in the common buffer.
+ */
+#define PICOQUIC_RECV_BATCH_BUFFER_SIZE 1536
+
+typedef struct st_picoquic_recv_batch_t {
+    size_t batch_size;
+    uint8_t* buffers;
+    struct sockaddr_storage* addr_from;
+    struct sockaddr_storage* addr_dest;
+    int* dest_if;
+    unsigned char* received_ecn;
+    int* bytes_recv;
+    int nb_messages;
+} picoquic_recv_batch_t;
+
+static void picoquic_packet_loop_recv_batch_release(picoquic_recv_batch_t* batch)
+{
+    if (batch->buffers != NULL) {
+        free(batch->buffers);
+        batch->buffers = NULL;
+    }
+    if (batch->addr_from != NULL) {
+        free(batch->addr_from);
+        batch->addr_from = NULL;
+    }
+    if (batch->addr_dest != NULL) {
+        free(batch->addr_dest);
+        batch->addr_dest = NULL;
+    }
+    if (batch->dest_if != NULL) {
+        free(batch->dest_if);
+        batch->dest_if = NULL;
+    }
+    if (batch->received_ecn != NULL) {
+        free(batch->received_ecn);
+        batch->received_ecn = NULL;
+    }
+    if (batch->bytes_recv != NULL) {
+        free(batch->bytes_recv);
+        batch->bytes_recv = NULL;
+    }
+    batch->batch_size = 0;
+    batch->nb_messages = 0;
+}
+
+static int picoquic_packet_loop_recv_batch_init(picoquic_recv_batch_t* batch, size_t batch_size)
+{
+    int ret = 0;
+
+    if (batch_size > PICOQUIC_RECVMMSG_MAX) {
+        batch_size = PICOQUIC_RECVMMSG_MAX;
+    }
+    batch->batch_size = batch_size;
+    batch->nb_messages = 0;
+
+    if ((batch->buffers = (uint8_t*)malloc(batch_size * PICOQUIC_RECV_BATCH_BUFFER_SIZE)) == NULL ||
+        (batch->addr_from = (struct sockaddr_storage*)malloc(batch_size * sizeof(struct sockaddr_storage))) == NULL ||
+        (batch->addr_dest = (struct sockaddr_storage*)malloc(batch_size * sizeof(struct sockaddr_storage))) == NULL ||
+        (batch->dest_if = (int*)malloc(batch_size * sizeof(int))) == NULL ||
+        (batch->received_ecn = (unsigned char*)malloc(batch_size * sizeof(unsigned char))) == NULL ||
+        (batch->bytes_recv = (int*)malloc(batch_size * sizeof(int))) == NULL) {
+        DBG_PRINTF("Cannot allocate receive batch of %zu messages", batch_size);
+        picoquic_packet_loop_recv_batch_release(batch);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Receive slot ring. The single datagram receive path reads into
+ * preallocated, cacheline aligned slots used in round robin order,
+ * instead of a per iteration stack buffer. Alignment keeps header
+ * parsing and in place decryption within whole cache lines, and
+ * rotating slots means a fresh receive does not immediately overwrite
+ * the bytes of the previous packet. The reassembly code keeps its own
+ * copies of stream data, so a slot returns to the ring as soon as
+ * picoquic_incoming_packet_ex returns.
+ */
+#define PICOQUIC_RECV_RING_NB_SLOTS 8
+#define PICOQUIC_RECV_RING_ALIGNMENT 64
+
+typedef struct st_picoquic_recv_ring_t {
+    size_t slot_size;
+    size_t current_slot;
+    uint8_t* slots;
+} picoquic_recv_ring_t;
+
+static void picoquic_recv_ring_release(picoquic_recv_ring_t* ring)
+{
+    if (ring->slots != NULL) {
+        free(ring->slots);
+        ring->slots = NULL;
+    }
+    ring->slot_size = 0;
+    ring->current_slot = 0;
+}
+
+static int picoquic_recv_ring_init(picoquic_recv_ring_t* ring, size_t slot_size)
+{
+    int ret = 0;
+    void* slots = NULL;
+
+    /* Round the slot size up to a multiple of the alignment, so every
+     * slot starts on a cache line boundary. */
+    slot_size = (slot_size + PICOQUIC_RECV_RING_ALIGNMENT - 1) & ~((size_t)(PICOQUIC_RECV_RING_ALIGNMENT - 1));
+
+    if (posix_memalign(&slots, PICOQUIC_RECV_RING_ALIGNMENT,
+        PICOQUIC_RECV_RING_NB_SLOTS * slot_size) != 0) {
+        DBG_PRINTF("Cannot allocate receive ring, %d slots of %zu bytes",
+            PICOQUIC_RECV_RING_NB_SLOTS, slot_size);
+        ret = -1;
+    }
+    else {
+        /* Touch every page now, so they are placed on the NUMA node of
+         * the thread that runs the loop rather than of whoever receives
+         * the first packet on each slot. */
+        memset(slots, 0, PICOQUIC_RECV_RING_NB_SLOTS * slot_size);
+        ring->slots = (uint8_t*)slots;
+        ring->slot_size = slot_size;
+        ring->current_slot = 0;
+    }
+
+    return ret;
+}
+
+static uint8_t* picoquic_recv_ring_next_slot(picoquic_recv_ring_t* ring)
+{
+    uint8_t* slot = ring->slots + ring->current_slot * ring->slot_size;
+
+    ring->current_slot = (ring->current_slot + 1) % PICOQUIC_RECV_RING_NB_SLOTS;
+
+    return slot;
+}
+
+/* Batched send state, used when the loop parameters request grouping of
+ * outgoing messages. Messages prepared during one send pass are queued
+ * in a preallocated buffer array, then flushed with as few sendmmsg()
+ * calls as possible; message number i occupies the slot starting at
+ * offset i*buffer_stride, where the stride is the send buffer size of
+ * the loop, so each slot can carry a full GSO train.
+ */
+typedef struct st_picoquic_send_batch_t {
+    size_t batch_size;
+    uint8_t* buffers;
+    struct sockaddr_storage* addr_dest;
+    struct sockaddr_storage* addr_from;
+    int* dest_if;
+    size_t* lengths;
+    size_t* msg_sizes;
+    SOCKET_TYPE* fds;
+    int nb_messages;
+} picoquic_send_batch_t;
+
+static void picoquic_packet_loop_send_batch_release(picoquic_send_batch_t* batch)
+{
+    if (batch->buffers != NULL) {
+        free(batch->buffers);
+        batch->buffers = NULL;
+    }
+    if (batch->addr_dest != NULL) {
+        free(batch->addr_dest);
+        batch->addr_dest = NULL;
+    }
+    if (batch->addr_from != NULL) {
+        free(batch->addr_from);
+        batch->addr_from = NULL;
+    }
+    if (batch->dest_if != NULL) {
+        free(batch->dest_if);
+        batch->dest_if = NULL;
+    }
+    if (batch->lengths != NULL) {
+        free(batch->lengths);
+        batch->lengths = NULL;
+    }
+    if (batch->msg_sizes != NULL) {
+        free(batch->msg_sizes);
+        batch->msg_sizes = NULL;
+    }
+    if (batch->fds != NULL) {
+        free(batch->fds);
+        batch->fds = NULL;
+    }
+    batch->batch_size = 0;
+    batch->nb_messages = 0;
+}
+
+static int picoquic_packet_loop_send_batch_init(picoquic_send_batch_t* batch, size_t batch_size, size_t buffer_stride)
+{
+    int ret = 0;
+
+    if (batch_size > PICOQUIC_SENDMMSG_MAX) {
+        batch_size = PICOQUIC_SENDMMSG_MAX;
+    }
+    batch->batch_size = batch_size;
+    batch->nb_messages = 0;
+
+    if ((batch->buffers = (uint8_t*)malloc(batch_size * buffer_stride)) == NULL ||
+        (batch->addr_dest = (struct sockaddr_storage*)malloc(batch_size * sizeof(struct sockaddr_storage))) == NULL ||
+        (batch->addr_from = (struct sockaddr_storage*)malloc(batch_size * sizeof(struct sockaddr_storage))) == NULL ||
+        (batch->dest_if = (int*)malloc(batch_size * sizeof(int))) == NULL ||
+        (batch->lengths = (size_t*)malloc(batch_size * sizeof(size_t))) == NULL ||
+        (batch->msg_sizes = (size_t*)malloc(batch_size * sizeof(size_t))) == NULL ||
+        (batch->fds = (SOCKET_TYPE*)malloc(batch_size * sizeof(SOCKET_TYPE))) == NULL) {
+        DBG_PRINTF("Cannot allocate send batch of %zu messages", batch_size);
+        picoquic_packet_loop_send_batch_release(batch);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int picoquic_packet_loop_send_batch_flush(picoquic_quic_t* quic,
+    picoquic_send_batch_t* batch, size_t buffer_stride, picoquic_connection_id_t* log_cid)
+{
+    int ret = 0;
+    int i = 0;
+
+    /* The buffers may still be getting sealed by the crypto workers;
+     * a no-op when no pool is configured or nothing is pending. */
+    picoquic_crypto_pool_sync(quic);
+
+    while (i < batch->nb_messages) {
+        int sock_err = 0;
+        int nb_sent;
+        int j = i + 1;
+
+        /* Group consecutive messages that target the same socket */
+        while (j < batch->nb_messages && batch->fds[j] == batch->fds[i]) {
+            j++;
+        }
+
+        nb_sent = picoquic_sendmmsg(batch->fds[i],
+            &batch->addr_dest[i], &batch->addr_from[i], &batch->dest_if[i],
+            batch->buffers + ((size_t)i) * buffer_stride, buffer_stride,
+            &batch->lengths[i], &batch->msg_sizes[i], j - i, &sock_err);
+
+        if (nb_sent < j - i) {
+            /* Retry the remaining messages one at a time, so that a single
+             * failure does not drop the rest of the batch. */
+            int first_failed = (nb_sent < 0) ? i : i + nb_sent;
+
+            for (int m = first_failed; m < j; m++) {
+                int one_err = 0;
+                int one_sent = picoquic_sendmsg(batch->fds[m],
+                    (struct sockaddr*)&batch->addr_dest[m], (struct sockaddr*)&batch->addr_from[m],
+                    batch->dest_if[m], (const char*)(batch->buffers + ((size_t)m) * buffer_stride),
+                    (int)batch->lengths[m], (int)batch->msg_sizes[m], &one_err);
+                if (one_sent <= 0) {
+                    picoquic_log_context_free_app_message(quic, log_cid,
+                        "Could not send batched message to AF_to=%d, AF_from=%d, if=%d, ret=%d, err=%d",
+                        batch->addr_dest[m].ss_family, batch->addr_from[m].ss_family,
+                        batch->dest_if[m], one_sent, one_err);
+                    ret = -1;
+                }
+            }
+        }
+        i = j;
+    }
+    batch->nb_messages = 0;
+
+    return ret;
+}
+
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+/* MSG_ZEROCOPY support. The kernel keeps a reference on the message
+ * buffer until it posts a completion on the socket error queue, so
+ * zero-copy sends cannot reuse the shared send buffer. Instead, each
+ * zero-copy message is prepared in a slot of a small pool; the slot is
+ * released when the matching completion is reaped. Zero-copy only pays
+ * off for large messages (typically GSO trains), so small messages are
+ * still sent the regular way.
+ */
+#define PICOQUIC_ZEROCOPY_POOL_SIZE 32
+#define PICOQUIC_ZEROCOPY_THRESHOLD 4096
+
+typedef struct st_picoquic_zerocopy_pool_t {
+    int is_enabled;
+    size_t buffer_size;
+    uint8_t* buffers;
+    SOCKET_TYPE slot_fd[PICOQUIC_ZEROCOPY_POOL_SIZE];
+    uint32_t slot_seq[PICOQUIC_ZEROCOPY_POOL_SIZE];
+    int slot_busy[PICOQUIC_ZEROCOPY_POOL_SIZE];
+} picoquic_zerocopy_pool_t;
+
+static void picoquic_zerocopy_pool_release(picoquic_zerocopy_pool_t* pool)
+{
+    if (pool->buffers != NULL) {
+        free(pool->buffers);
+        pool->buffers = NULL;
+    }
+    pool->is_enabled = 0;
+}
+
+static int picoquic_zerocopy_pool_init(picoquic_zerocopy_pool_t* pool, size_t buffer_size)
+{
+    int ret = 0;
+
+    memset(pool, 0, sizeof(picoquic_zerocopy_pool_t));
+    pool->buffer_size = buffer_size;
+    if ((pool->buffers = (uint8_t*)malloc(PICOQUIC_ZEROCOPY_POOL_SIZE * buffer_size)) == NULL) {
+        DBG_PRINTF("Cannot allocate zero-copy pool of %d x %zu bytes",
+            PICOQUIC_ZEROCOPY_POOL_SIZE, buffer_size);
+        ret = -1;
+    }
+    else {
+        pool->is_enabled = 1;
+    }
+
+    return ret;
+}
+
+static int picoquic_zerocopy_slot_acquire(picoquic_zerocopy_pool_t* pool)
+{
+    for (int i = 0; i < PICOQUIC_ZEROCOPY_POOL_SIZE; i++) {
+        if (!pool->slot_busy[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Drain the error queue of the sockets on which zero-copy is enabled,
+ * and release the slots covered by the reported completion ranges. */
+static void picoquic_zerocopy_reap(picoquic_zerocopy_pool_t* pool,
+    picoquic_socket_ctx_t* s_ctx, int nb_sockets)
+{
+    for (int i = 0; i < nb_sockets; i++) {
+        if (!s_ctx[i].supports_msg_zerocopy) {
+            continue;
+        }
+        for (;;) {
+            struct msghdr msg;
+            char control[128];
+            struct cmsghdr* cmsg;
+
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            if (recvmsg(s_ctx[i].fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                break;
+            }
+
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                    struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+
+                    if (serr->ee_errno == 0 && serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                        uint32_t lo = serr->ee_info;
+                        uint32_t range = serr->ee_data - lo;
+
+                        for (int s = 0; s < PICOQUIC_ZEROCOPY_POOL_SIZE; s++) {
+                            if (pool->slot_busy[s] && pool->slot_fd[s] == s_ctx[i].fd &&
+                                (uint32_t)(pool->slot_seq[s] - lo) <= range) {
+                                pool->slot_busy[s] = 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+#endif /* PICOQUIC_ZEROCOPY_AVAILABLE */
+
+/* Event polling backend. When built with PICOQUIC_USE_EPOLL (Linux) or
+ * PICOQUIC_USE_KQUEUE (BSD, macOS), the loop keeps a persistent kernel
+ * event queue with the sockets and the wake up descriptor registered
+ * once, instead of rebuilding an fd_set and having select() scan the
+ * descriptors on every iteration. The registrations are refreshed only
+ * when the socket set changes, e.g. after the port rebinding used in
+ * NAT simulations. Wait results are delivered in an fd_set, so the
+ * receive logic is shared with the select() build.
+ */
+typedef struct st_picoquic_event_poll_t {
+    int events_fd; /* epoll or kqueue descriptor, -1 until created */
+    int nb_registered;
+    SOCKET_TYPE registered_fd[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
+} picoquic_event_poll_t;
+
+static void picoquic_event_poll_release(picoquic_event_poll_t* event_poll)
+{
+    if (event_poll->events_fd >= 0) {
+        (void)close(event_poll->events_fd);
+        event_poll->events_fd = -1;
+    }
+    event_poll->nb_registered = 0;
+}
+
+#if defined(PICOQUIC_USE_EPOLL) || defined(PICOQUIC_USE_KQUEUE)
+static int picoquic_event_poll_update(picoquic_event_poll_t* event_poll,
+    picoquic_socket_ctx_t* s_ctx, int nb_sockets,
+    picoquic_network_thread_ctx_t* thread_ctx)
+{
+    int ret = 0;
+    int nb_fd = nb_sockets + ((thread_ctx->wake_up_defined) ? 1 : 0);
+    int is_current = (event_poll->events_fd >= 0 && event_poll->nb_registered == nb_fd);
+
+    for (int i = 0; is_current && i < nb_sockets; i++) {
+        is_current = (event_poll->registered_fd[i] == s_ctx[i].fd);
+    }
+    if (is_current && thread_ctx->wake_up_defined) {
+        is_current = (event_poll->registered_fd[nb_sockets] == thread_ctx->wake_up_pipe_fd[0]);
+    }
+
+    if (!is_current) {
+        picoquic_event_poll_release(event_poll);
+        for (int i = 0; i < nb_fd; i++) {
+            event_poll->registered_fd[i] = (i < nb_sockets) ? s_ctx[i].fd : thread_ctx->wake_up_pipe_fd[0];
+        }
+#if defined(PICOQUIC_USE_EPOLL)
+        if ((event_poll->events_fd = epoll_create1(0)) < 0) {
+            ret = -1;
+        }
+        for (int i = 0; ret == 0 && i < nb_fd; i++) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = (int)event_poll->registered_fd[i];
+            if (epoll_ctl(event_poll->events_fd, EPOLL_CTL_ADD, (int)event_poll->registered_fd[i], &ev) != 0) {
+                ret = -1;
+            }
+        }
+#else
+        if ((event_poll->events_fd = kqueue()) < 0) {
+            ret = -1;
+        }
+        for (int i = 0; ret == 0 && i < nb_fd; i++) {
+            struct kevent ev;
+            EV_SET(&ev, event_poll->registered_fd[i], EVFILT_READ, EV_ADD, 0, 0, NULL);
+            if (kevent(event_poll->events_fd, &ev, 1, NULL, 0, NULL) != 0) {
+                ret = -1;
+            }
+        }
+#endif
+        if (ret == 0) {
+            event_poll->nb_registered = nb_fd;
+        }
+        else {
+            DBG_PRINTF("%s", "Cannot register the sockets in the event queue");
+            picoquic_event_poll_release(event_poll);
+        }
+    }
+
+    return ret;
+}
+#endif
+
 int picoquic_packet_loop_select(picoquic_socket_ctx_t* s_ctx,
     int nb_sockets,
     struct sockaddr_storage* addr_from,
@@ -583,49 +1080,108 @@ int picoquic_packet_loop_select(picoquic_socket_ctx_t* s_ctx,
     int64_t delta_t,
     int * is_wake_up_event,
     picoquic_network_thread_ctx_t * thread_ctx,
-    int * socket_rank)
+    int * socket_rank,
+    picoquic_recv_batch_t * batch,
+    picoquic_event_poll_t * event_poll)
 {
     fd_set readfds;
-    struct timeval tv;
     int ret_select = 0;
     int bytes_recv = 0;
-    int sockmax = 0;
 
     if (received_ecn != NULL) {
         *received_ecn = 0;
     }
 
     FD_ZERO(&readfds);
+    *is_wake_up_event = 0;
 
-    for (int i = 0; i < nb_sockets; i++) {
-        if (sockmax < (int)s_ctx[i].fd) {
-            sockmax = (int)s_ctx[i].fd;
+#if defined(PICOQUIC_USE_EPOLL)
+    if (picoquic_event_poll_update(event_poll, s_ctx, nb_sockets, thread_ctx) != 0) {
+        ret_select = -1;
+    }
+    else {
+        struct epoll_event events[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
+        int timeout_ms;
+
+        if (delta_t <= 0) {
+            timeout_ms = 0;
+        }
+        else if (delta_t > 10000000) {
+            timeout_ms = 10000;
+        }
+        else {
+            /* Round up, so the loop does not wake before the timer is due */
+            timeout_ms = (int)((delta_t + 999) / 1000);
+        }
+
+        ret_select = epoll_wait(event_poll->events_fd, events,
+            PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1, timeout_ms);
+        for (int i = 0; i < ret_select; i++) {
+            FD_SET(events[i].data.fd, &readfds);
         }
-        FD_SET(s_ctx[i].fd, &readfds);
     }
+#elif defined(PICOQUIC_USE_KQUEUE)
+    if (picoquic_event_poll_update(event_poll, s_ctx, nb_sockets, thread_ctx) != 0) {
+        ret_select = -1;
+    }
+    else {
+        struct kevent events[PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1];
+        struct timespec ts;
 
-    *is_wake_up_event = 0;
-    if (thread_ctx->wake_up_defined) {
-        if (sockmax < (int)thread_ctx->wake_up_pipe_fd[0]) {
-            sockmax = (int)thread_ctx->wake_up_pipe_fd[0];
+        if (delta_t <= 0) {
+            ts.tv_sec = 0;
+            ts.tv_nsec = 0;
+        }
+        else if (delta_t > 10000000) {
+            ts.tv_sec = 10;
+            ts.tv_nsec = 0;
+        }
+        else {
+            ts.tv_sec = (time_t)(delta_t / 1000000);
+            ts.tv_nsec = (long)((delta_t % 1000000) * 1000);
+        }
+
+        ret_select = kevent(event_poll->events_fd, NULL, 0, events,
+            PICOQUIC_PACKET_LOOP_SOCKETS_MAX + 1, &ts);
+        for (int i = 0; i < ret_select; i++) {
+            FD_SET((int)events[i].ident, &readfds);
         }
-        FD_SET(thread_ctx->wake_up_pipe_fd[0], &readfds);
     }
+#else
+    {
+        struct timeval tv;
+        int sockmax = 0;
 
-    if (delta_t <= 0) {
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-    } else {
-        if (delta_t > 10000000) {
-            tv.tv_sec = (long)10;
+        for (int i = 0; i < nb_sockets; i++) {
+            if (sockmax < (int)s_ctx[i].fd) {
+                sockmax = (int)s_ctx[i].fd;
+            }
+            FD_SET(s_ctx[i].fd, &readfds);
+        }
+
+        if (thread_ctx->wake_up_defined) {
+            if (sockmax < (int)thread_ctx->wake_up_pipe_fd[0]) {
+                sockmax = (int)thread_ctx->wake_up_pipe_fd[0];
+            }
+            FD_SET(thread_ctx->wake_up_pipe_fd[0], &readfds);
+        }
+
+        if (delta_t <= 0) {
+            tv.tv_sec = 0;
             tv.tv_usec = 0;
         } else {
-            tv.tv_sec = (long)(delta_t / 1000000);
-            tv.tv_usec = (long)(delta_t % 1000000);
+            if (delta_t > 10000000) {
+                tv.tv_sec = (long)10;
+                tv.tv_usec = 0;
+            } else {
+                tv.tv_sec = (long)(delta_t / 1000000);
+                tv.tv_usec = (long)(delta_t % 1000000);
+            }
         }
-    }
 
-    ret_select = select(sockmax + 1, &readfds, NULL, NULL, &tv);
+        ret_select = select(sockmax + 1, &readfds, NULL, NULL, &tv);
+    }
+#endif
 
     if (ret_select < 0) {
         bytes_recv = -1;
@@ -650,9 +1206,42 @@ int picoquic_packet_loop_select(picoquic_socket_ctx_t* s_ctx,
             for (int i = 0; i < nb_sockets; i++) {
                 if (FD_ISSET(s_ctx[i].fd, &readfds)) {
                     *socket_rank = i;
-                    bytes_recv = picoquic_recvmsg(s_ctx[i].fd, addr_from,
+                    if (batch != NULL && batch->batch_size > 1) {
+                        batch->nb_messages = picoquic_recvmmsg(s_ctx[i].fd,
+                            batch->addr_from, batch->addr_dest,
+                            batch->dest_if, batch->received_ecn,
+                            batch->buffers, PICOQUIC_RECV_BATCH_BUFFER_SIZE,
+                            batch->bytes_recv, (int)batch->batch_size);
+                        if (batch->nb_messages < 0) {
+                            batch->nb_messages = 0;
+                            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                                /* The readiness indication was spurious; treat as a timeout. */
+                                bytes_recv = 0;
+                            }
+                            else {
+                                DBG_PRINTF("Could not receive batch on UDP socket[%d]= %d!\n",
+                                    i, (int)s_ctx[i].fd);
+                                bytes_recv = -1;
+                            }
+                        }
+                        else {
+                            bytes_recv = 0;
+                            for (int m = 0; m < batch->nb_messages; m++) {
+                                bytes_recv += batch->bytes_recv[m];
+                                /* Document incoming port */
+                                if (batch->addr_dest[m].ss_family == AF_INET6) {
+                                    ((struct sockaddr_in6*)&batch->addr_dest[m])->sin6_port = s_ctx[i].n_port;
+                                }
+                                else if (batch->addr_dest[m].ss_family == AF_INET) {
+                                    ((struct sockaddr_in*)&batch->addr_dest[m])->sin_port = s_ctx[i].n_port;
+                                }
+                            }
+                        }
+                        break;
+                    }
+                    bytes_recv = picoquic_recvmsg_ex(s_ctx[i].fd, addr_from,
                         addr_dest, dest_if, received_ecn,
-                        buffer, buffer_max);
+                        buffer, buffer_max, &s_ctx[i].udp_coalesced_size);
 
                     if (bytes_recv <= 0) {
                         DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
@@ -706,26 +1295,302 @@ static int monitor_system_call_duration(packet_loop_system_call_duration_t* sc_d
     return shall_notify;
 }
 
+/* Loop health instrumentation. Each iteration is classified by the
+ * reason it woke up, and its processing time, measured from the return
+ * of one wait to the start of the next, feeds a logarithmic histogram.
+ * The counters are reported through the loop callback about once per
+ * second, then reset for the next interval. */
+static void loop_health_account(packet_loop_health_t* lh, uint64_t duration,
+    uint64_t nb_received, uint64_t nb_sent, int was_immediate, int was_wake_up_event)
+{
+    int bucket = 0;
+
+    while (bucket < PICOQUIC_LOOP_HEALTH_NB_BUCKETS - 1 && duration >= (1ull << bucket)) {
+        bucket++;
+    }
+    lh->iteration_duration_hist[bucket]++;
+    lh->nb_iterations++;
+    if (duration > lh->iteration_duration_max) {
+        lh->iteration_duration_max = duration;
+    }
+
+    if (was_immediate) {
+        lh->nb_wake_immediate++;
+    }
+    else if (was_wake_up_event) {
+        lh->nb_wake_event++;
+    }
+    else if (nb_received > 0) {
+        lh->nb_wake_socket++;
+    }
+    else {
+        lh->nb_wake_timer++;
+    }
+
+    lh->nb_packets_received += nb_received;
+    if (nb_received > lh->max_packets_per_wake) {
+        lh->max_packets_per_wake = nb_received;
+    }
+    lh->nb_packets_sent += nb_sent;
+    if (nb_sent > lh->max_packets_per_send_pass) {
+        lh->max_packets_per_send_pass = nb_sent;
+    }
+}
+
 
+/* Cross thread packet mailbox, implemented with the thread pool below */
+static void picoquic_packet_mailbox_release(picoquic_packet_mailbox_t* mailbox);
+static size_t picoquic_packet_mailbox_drain(picoquic_quic_t* quic,
+    picoquic_packet_mailbox_t* mailbox, uint64_t current_time);
+static void picoquic_open_network_wake_up(picoquic_network_thread_ctx_t* thread_ctx, int* ret);
+static void picoquic_close_network_wake_up(picoquic_network_thread_ctx_t* thread_ctx);
+#ifndef _WINDOWS
+/* Dedicated receive thread, implemented with the mailbox below */
+typedef struct st_picoquic_rx_thread_ctx_t picoquic_rx_thread_ctx_t;
+static picoquic_rx_thread_ctx_t* picoquic_rx_thread_start(
+    picoquic_network_thread_ctx_t* thread_ctx, picoquic_socket_ctx_t* s_ctx, int nb_sockets);
+static void picoquic_rx_thread_stop(picoquic_rx_thread_ctx_t* rx_ctx);
+#endif
+/* Dedicated stateless response sender, implemented below */
+typedef struct st_picoquic_stateless_sender_ctx_t picoquic_stateless_sender_ctx_t;
+static picoquic_stateless_sender_ctx_t* picoquic_stateless_sender_start(
+    picoquic_socket_ctx_t* s_ctx, int nb_sockets);
+static void picoquic_stateless_sender_post(picoquic_stateless_sender_ctx_t* sender_ctx,
+    picoquic_quic_t* quic);
+static void picoquic_stateless_sender_stop(picoquic_stateless_sender_ctx_t* sender_ctx);
+/* Resolver thread for async path probes, implemented below */
+typedef struct st_picoquic_path_probe_t {
+    struct st_picoquic_path_probe_t* next;
+    picoquic_cnx_t* cnx;
+    struct sockaddr_storage addr_peer; /* filled by the resolver */
+    struct sockaddr_storage addr_local;
+    int if_index;
+    int resolution_ret;
+    int peer_port;
+    char peer_name[256];
+} picoquic_path_probe_t;
+
+typedef struct st_picoquic_async_prober_t {
+    picoquic_network_thread_ctx_t* thread_ctx;
+    picoquic_submission_queue_t requests; /* application threads to resolver */
+    picoquic_submission_queue_t results; /* resolver to loop thread */
+    picoquic_event_t work_ready;
+    volatile int should_close;
+    picoquic_thread_t thread;
+} picoquic_async_prober_t;
+
+static picoquic_async_prober_t* picoquic_async_prober_start(
+    picoquic_network_thread_ctx_t* thread_ctx);
+static void picoquic_async_prober_drain(picoquic_network_thread_ctx_t* thread_ctx,
+    uint64_t current_time);
+static void picoquic_async_prober_stop(picoquic_network_thread_ctx_t* thread_ctx);
+
+/* Atomic pointer exchange, used by the consumers of the lock free
+ * stacks to take the whole stack in one swap. */
 #ifdef _WINDOWS
-    DWORD WINAPI picoquic_packet_loop_v3(LPVOID v_ctx)
+#define picoquic_atomic_exchange_ptr(p_ptr, val) InterlockedExchangePointer((PVOID volatile*)(p_ptr), (PVOID)(val))
 #else
-void* picoquic_packet_loop_v3(void* v_ctx)
+#define picoquic_atomic_exchange_ptr(p_ptr, val) __atomic_exchange_n((p_ptr), (void*)(val), __ATOMIC_ACQ_REL)
 #endif
+
+/* Lock free push of a record on one of the shared stacks. The compare
+ * and swap loop links the record's next pointer before the record
+ * becomes visible, so a consumer that swaps the whole stack out never
+ * observes a head whose next pointer has not been assigned yet.
+ * Returns non zero if the stack was empty before the push, in which
+ * case the consumer may need a wake up. */
+static int picoquic_lockfree_stack_push(void* volatile* p_head, void* item, void** p_item_next)
+{
+#ifdef _WINDOWS
+    PVOID expected = *p_head;
+
+    for (;;) {
+        PVOID observed;
+
+        *p_item_next = expected;
+        observed = InterlockedCompareExchangePointer((PVOID volatile*)p_head, (PVOID)item, expected);
+        if (observed == expected) {
+            break;
+        }
+        expected = observed;
+    }
+#else
+    void* expected = __atomic_load_n(p_head, __ATOMIC_RELAXED);
+
+    do {
+        *p_item_next = expected;
+    } while (!__atomic_compare_exchange_n(p_head, &expected, item, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#endif
+    return expected == NULL;
+}
+
+int picoquic_submit_stream_data(picoquic_network_thread_ctx_t* thread_ctx,
+    picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length,
+    int set_fin, void* app_stream_ctx)
 {
-    picoquic_network_thread_ctx_t* thread_ctx = (picoquic_network_thread_ctx_t*)v_ctx;
-    picoquic_quic_t* quic = thread_ctx->quic;
-    picoquic_packet_loop_param_t* param = thread_ctx->param;
-    picoquic_packet_loop_cb_fn loop_callback = thread_ctx->loop_callback;
-    void* loop_callback_ctx = thread_ctx->loop_callback_ctx;
     int ret = 0;
-    uint64_t current_time = picoquic_get_quic_time(quic);
+    picoquic_stream_submit_t* submit = (picoquic_stream_submit_t*)malloc(
+        sizeof(picoquic_stream_submit_t) + length);
+
+    if (submit == NULL) {
+        ret = -1;
+    }
+    else {
+        submit->cnx = cnx;
+        submit->stream_id = stream_id;
+        submit->length = length;
+        submit->set_fin = set_fin;
+        submit->app_stream_ctx = app_stream_ctx;
+        if (length > 0) {
+            memcpy(submit->data, data, length);
+        }
+        /* Push on the shared stack; only the producer that found the
+         * stack empty pays for a wake up. */
+        if (picoquic_lockfree_stack_push(&thread_ctx->submissions.head,
+            submit, (void**)&submit->next)) {
+            (void)picoquic_wake_up_network_thread(thread_ctx);
+        }
+    }
+
+    return ret;
+}
+
+/* Drain the submission queue, in the order the records were posted.
+ * Runs on the network thread. */
+static void picoquic_submission_queue_drain(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_stream_submit_t* submit = (picoquic_stream_submit_t*)picoquic_atomic_exchange_ptr(
+        &thread_ctx->submissions.head, NULL);
+    picoquic_stream_submit_t* in_order = NULL;
+
+    /* The stack pops newest first; reverse it */
+    while (submit != NULL) {
+        picoquic_stream_submit_t* next = submit->next;
+        submit->next = in_order;
+        in_order = submit;
+        submit = next;
+    }
+
+    while (in_order != NULL) {
+        picoquic_stream_submit_t* next = in_order->next;
+
+        if (picoquic_add_to_stream_with_ctx(in_order->cnx, in_order->stream_id,
+            in_order->data, in_order->length, in_order->set_fin,
+            in_order->app_stream_ctx) != 0) {
+            picoquic_log_app_message(in_order->cnx,
+                "Cannot add %zu submitted bytes to stream %" PRIu64,
+                in_order->length, in_order->stream_id);
+        }
+        free(in_order);
+        in_order = next;
+    }
+}
+
+/* Attach connections handed over by other threads of a pool. Runs on
+ * the receiving network thread; the source thread detached each
+ * connection before posting, so this thread is its only user. */
+static void picoquic_handoff_queue_drain(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_cnx_handoff_t* handoff = (picoquic_cnx_handoff_t*)picoquic_atomic_exchange_ptr(
+        &thread_ctx->handoffs.head, NULL);
+
+    while (handoff != NULL) {
+        picoquic_cnx_handoff_t* next = handoff->next;
+
+        if (picoquic_attach_cnx(thread_ctx->quic, handoff->cnx) != 0) {
+            DBG_PRINTF("%s", "CID collision when attaching a migrated connection");
+        }
+        free(handoff);
+        handoff = next;
+    }
+}
+
+static void picoquic_handoff_queue_release(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_cnx_handoff_t* handoff = (picoquic_cnx_handoff_t*)picoquic_atomic_exchange_ptr(
+        &thread_ctx->handoffs.head, NULL);
+
+    while (handoff != NULL) {
+        picoquic_cnx_handoff_t* next = handoff->next;
+        free(handoff);
+        handoff = next;
+    }
+}
+
+static void picoquic_submission_queue_release(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_stream_submit_t* submit = (picoquic_stream_submit_t*)picoquic_atomic_exchange_ptr(
+        &thread_ctx->submissions.head, NULL);
+
+    while (submit != NULL) {
+        picoquic_stream_submit_t* next = submit->next;
+        free(submit);
+        submit = next;
+    }
+}
+
+/* Pin the calling thread to one CPU. Called from the loop thread itself,
+ * before it allocates its receive buffers, so that first touch placement
+ * puts those buffers on the local NUMA node. */
+static int picoquic_packet_loop_set_affinity(int cpu)
+{
+#if defined(_WINDOWS)
+    return (SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << cpu) == 0) ? -1 : 0;
+#elif defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0) ? 0 : -1;
+#else
+    (void)cpu;
+    return -1;
+#endif
+}
+
+/* Allocate a batch of packets and recycle them into the pool, so the
+ * pool pages are faulted in by the loop thread. Only useful after the
+ * thread has been pinned: the pages then live on its NUMA node. */
+static void picoquic_packet_loop_warm_packet_pool(picoquic_quic_t* quic)
+{
+    picoquic_packet_t* warm[64];
+    size_t nb_warm = 0;
+
+    while (nb_warm < sizeof(warm) / sizeof(picoquic_packet_t*) &&
+        (warm[nb_warm] = picoquic_create_packet(quic)) != NULL) {
+        nb_warm++;
+    }
+    while (nb_warm > 0) {
+        picoquic_recycle_packet(quic, warm[--nb_warm]);
+    }
+}
+
+#ifdef _WINDOWS
+    DWORD WINAPI picoquic_packet_loop_v3(LPVOID v_ctx)
+#else
+void* picoquic_packet_loop_v3(void* v_ctx)
+#endif
+{
+    picoquic_network_thread_ctx_t* thread_ctx = (picoquic_network_thread_ctx_t*)v_ctx;
+    picoquic_quic_t* quic = thread_ctx->quic;
+    picoquic_packet_loop_param_t* param = thread_ctx->param;
+    picoquic_packet_loop_cb_fn loop_callback = thread_ctx->loop_callback;
+    void* loop_callback_ctx = thread_ctx->loop_callback_ctx;
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
     int64_t delay_max = 10000000;
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
     int if_index_to;
 #ifndef _WINDOWS
-    uint8_t buffer[1536];
+    picoquic_recv_ring_t recv_ring = { 0 };
+    picoquic_recv_batch_t recv_batch = { 0 };
+    picoquic_event_poll_t event_poll = { -1, 0, { 0 } };
+    uint64_t busy_poll_deadline = 0;
+    int txtime_enabled = 0;
+    picoquic_send_batch_t send_batch = { 0 };
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+    picoquic_zerocopy_pool_t zc_pool = { 0 };
+#endif
 #endif
     uint8_t* send_buffer = NULL;
     size_t send_length = 0;
@@ -740,8 +1605,21 @@ void* picoquic_packet_loop_v3(void* v_ctx)
     picoquic_cnx_t* last_cnx = NULL;
     int loop_immediate = 0;
     unsigned int nb_loop_immediate = 0;
+    int crypto_pool_created = 0;
     picoquic_packet_loop_options_t options = { 0 };
     packet_loop_system_call_duration_t sc_duration = { 0 };
+    packet_loop_health_t loop_health = { 0 };
+    uint64_t health_interval_start = 0;
+    uint64_t health_iter_start = 0;
+    uint64_t health_iter_recv = 0;
+    uint64_t health_iter_sent = 0;
+    int health_iter_immediate = 0;
+    int health_iter_wake_event = 0;
+#ifndef _WINDOWS
+    picoquic_rx_thread_ctx_t* rx_ctx = NULL;
+    int wake_up_created = 0;
+#endif
+    picoquic_stateless_sender_ctx_t* stateless_ctx = NULL;
 
     int is_wake_up_event;
 #ifdef _WINDOWS
@@ -753,14 +1631,61 @@ void* picoquic_packet_loop_v3(void* v_ctx)
         thread_ctx->thread_setname_fn(thread_ctx->thread_name);
     }
 
+    if (param->cpu_affinity_plus1 > 0) {
+        /* Pin before the backend dispatch and before any buffer
+         * allocation, so every backend and its slabs stay local. */
+        if (picoquic_packet_loop_set_affinity(param->cpu_affinity_plus1 - 1) != 0) {
+            DBG_PRINTF("Cannot pin loop thread to CPU %d", param->cpu_affinity_plus1 - 1);
+        }
+        else {
+            picoquic_packet_loop_warm_packet_pool(quic);
+        }
+    }
+
+#if !defined(_WINDOWS) && defined(PICOQUIC_WITH_IOURING)
+    if (param->use_io_uring) {
+        (void)picoquic_packet_loop_uring(thread_ctx);
+        if (thread_ctx->is_threaded) {
+            pthread_exit((void*)&thread_ctx->return_code);
+        }
+        return NULL;
+    }
+#endif
+#if !defined(_WINDOWS) && defined(PICOQUIC_WITH_AFXDP)
+    if (param->xdp_config != NULL) {
+        (void)picoquic_packet_loop_xdp(thread_ctx);
+        if (thread_ctx->is_threaded) {
+            pthread_exit((void*)&thread_ctx->return_code);
+        }
+        return NULL;
+    }
+#endif
+#if defined(_WINDOWS) && defined(PICOQUIC_WITH_RIO)
+    if (param->use_rio) {
+        (void)picoquic_packet_loop_rio(thread_ctx);
+        return (DWORD)thread_ctx->return_code;
+    }
+#endif
+
     if (send_buffer_size == 0) {
         send_buffer_size = 0xffff;
     }
 
+    if (param->nb_crypto_workers > 0 && quic->crypto_pool == NULL) {
+        if (picoquic_set_crypto_worker_pool(quic, param->nb_crypto_workers) != 0) {
+            DBG_PRINTF("Cannot create crypto worker pool (%d workers), sealing inline",
+                param->nb_crypto_workers);
+        }
+        else {
+            crypto_pool_created = 1;
+        }
+    }
+
     memset(s_ctx, 0, sizeof(s_ctx));
-    if ((nb_sockets = picoquic_packet_loop_open_sockets(param->local_port,
+    if ((nb_sockets = picoquic_packet_loop_open_sockets_ex(param->local_port,
         param->local_af, param->socket_buffer_size,
-        param->extra_socket_required, param->do_not_use_gso, s_ctx)) <= 0) {
+        param->extra_socket_required, param->do_not_use_gso,
+        param->use_so_reuseport, s_ctx)) <= 0) {
         ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
     }
     else if (loop_callback != NULL) {
@@ -788,6 +1713,113 @@ void* picoquic_packet_loop_v3(void* v_ctx)
         if (send_buffer == NULL) {
             ret = -1;
         }
+#ifndef _WINDOWS
+        if (ret == 0 && param->recv_batch_size > 1) {
+            ret = picoquic_packet_loop_recv_batch_init(&recv_batch, param->recv_batch_size);
+#if defined(UDP_GRO)
+            /* The batched receive path uses MTU sized per message buffers,
+             * which cannot hold a coalesced train. Turn GRO back off so
+             * the kernel keeps delivering single datagrams. */
+            for (int i = 0; ret == 0 && i < nb_sockets; i++) {
+                if (s_ctx[i].supports_udp_recv_coalesced) {
+                    int zero = 0;
+                    (void)setsockopt(s_ctx[i].fd, SOL_UDP, UDP_GRO, &zero, sizeof(zero));
+                    s_ctx[i].supports_udp_recv_coalesced = 0;
+                }
+            }
+#endif
+        }
+        if (ret == 0) {
+            /* If GRO is active on at least one socket, receives may deliver
+             * a coalesced train of up to 64K bytes; size the ring slots
+             * accordingly. */
+            size_t slot_size = PICOQUIC_RECV_BATCH_BUFFER_SIZE;
+            for (int i = 0; i < nb_sockets; i++) {
+                if (s_ctx[i].supports_udp_recv_coalesced) {
+                    slot_size = 0x10000;
+                    break;
+                }
+            }
+            ret = picoquic_recv_ring_init(&recv_ring, slot_size);
+        }
+#if defined(SO_BUSY_POLL)
+        if (ret == 0 && param->busy_poll_usec > 0) {
+            /* Ask the kernel to busy poll the device queue for that many
+             * microseconds before sleeping in a blocking receive. Best
+             * effort: not all kernels or devices support it, and the
+             * user space spin below works either way. */
+            int usec = param->busy_poll_usec;
+            for (int i = 0; i < nb_sockets; i++) {
+                if (setsockopt(s_ctx[i].fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+                    DBG_PRINTF("SO_BUSY_POLL(%d) not supported, errno: %d", usec, errno);
+                    break;
+                }
+            }
+        }
+#endif
+        if (ret == 0 && param->use_txtime) {
+            /* Offload pacing to the qdisc: stamp sends with departure
+             * times instead of waking up for each paced packet. All
+             * sockets must accept the option, or none is stamped. */
+            txtime_enabled = 1;
+            for (int i = 0; i < nb_sockets; i++) {
+                if (picoquic_socket_set_txtime(s_ctx[i].fd) != 0) {
+                    DBG_PRINTF("%s", "SO_TXTIME not supported, pacing stays in the loop");
+                    txtime_enabled = 0;
+                    break;
+                }
+            }
+        }
+        if (ret == 0 && param->send_batch_size > 1) {
+            ret = picoquic_packet_loop_send_batch_init(&send_batch, param->send_batch_size, send_buffer_size);
+        }
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+        if (ret == 0 && param->use_msg_zerocopy && send_batch.batch_size <= 1) {
+            int one = 1;
+            int nb_enabled = 0;
+
+            for (int i = 0; i < nb_sockets; i++) {
+                if (setsockopt(s_ctx[i].fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+                    s_ctx[i].supports_msg_zerocopy = 1;
+                    nb_enabled++;
+                }
+            }
+            if (nb_enabled > 0) {
+                ret = picoquic_zerocopy_pool_init(&zc_pool, send_buffer_size);
+            }
+            else {
+                DBG_PRINTF("%s", "SO_ZEROCOPY not supported, using regular sends");
+            }
+        }
+#endif
+        if (ret == 0 && param->use_rx_thread) {
+            if (!thread_ctx->wake_up_defined) {
+                /* The receive thread signals the loop through the wake up
+                 * pipe; open one when running outside the threaded wrapper. */
+                int wake_ret = 0;
+                picoquic_open_network_wake_up(thread_ctx, &wake_ret);
+                wake_up_created = thread_ctx->wake_up_defined;
+            }
+            if (thread_ctx->wake_up_defined) {
+                rx_ctx = picoquic_rx_thread_start(thread_ctx, s_ctx, nb_sockets);
+            }
+            if (rx_ctx == NULL) {
+                DBG_PRINTF("%s", "Cannot start the receive thread, receiving in the loop");
+            }
+        }
+#endif
+        if (ret == 0 && param->use_stateless_sender) {
+            stateless_ctx = picoquic_stateless_sender_start(s_ctx, nb_sockets);
+            if (stateless_ctx == NULL) {
+                DBG_PRINTF("%s", "Cannot start the stateless sender thread, sending in the loop");
+            }
+        }
+        if (ret == 0 && param->use_async_probe) {
+            thread_ctx->prober = picoquic_async_prober_start(thread_ctx);
+            if (thread_ctx->prober == NULL) {
+                DBG_PRINTF("%s", "Cannot start the path probe resolver thread");
+            }
+        }
     }
 
     if (ret == 0) {
@@ -818,6 +1850,27 @@ void* picoquic_packet_loop_v3(void* v_ctx)
         * of loops in "immediate" mode, and ignoring the "loop
         * immediate" condition if that number reaches a limit */
         current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+        if (options.do_loop_health) {
+            /* Account for the iteration that just finished; its processing
+             * ran from the return of the wait to this point. */
+            if (health_iter_start != 0) {
+                loop_health_account(&loop_health, current_time - health_iter_start,
+                    health_iter_recv, health_iter_sent,
+                    health_iter_immediate, health_iter_wake_event);
+                health_iter_start = 0;
+            }
+            if (health_interval_start == 0) {
+                health_interval_start = current_time;
+            }
+            else if (current_time - health_interval_start >= PICOQUIC_LOOP_HEALTH_REPORT_INTERVAL) {
+                loop_health.interval_duration = current_time - health_interval_start;
+                ret = loop_callback(quic, picoquic_packet_loop_health_report,
+                    loop_callback_ctx, &loop_health);
+                memset(&loop_health, 0, sizeof(loop_health));
+                health_interval_start = current_time;
+            }
+        }
         if (!loop_immediate) {
             nb_loop_immediate = 1;
             delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
@@ -830,6 +1883,17 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                     delta_t = time_check_arg.delta_t;
                 }
             }
+#ifndef _WINDOWS
+            if (param->busy_poll_usec > 0 && delta_t > 0 &&
+                current_time < busy_poll_deadline) {
+                /* A packet arrived within the busy poll window: spin with
+                 * a zero select timeout instead of sleeping, so the next
+                 * packet of the burst is picked up without a scheduler
+                 * wake up. Once the window expires, fall back to the
+                 * normal blocking wait. */
+                delta_t = 0;
+            }
+#endif
         }
         else {
             nb_loop_immediate++;
@@ -846,14 +1910,26 @@ void* picoquic_packet_loop_v3(void* v_ctx)
             &addr_from, &addr_to, &if_index_to, &received_ecn, &received_buffer,
             delta_t, &is_wake_up_event, thread_ctx, &socket_rank);
 #else
-        bytes_recv = picoquic_packet_loop_select(s_ctx, nb_sockets_available,
+        received_buffer = picoquic_recv_ring_next_slot(&recv_ring);
+        /* When the receive thread runs, it owns the sockets for reading;
+         * the loop only waits for its timers and the wake up pipe. */
+        bytes_recv = picoquic_packet_loop_select(s_ctx,
+            (rx_ctx == NULL) ? nb_sockets_available : 0,
             &addr_from,
             &addr_to, &if_index_to, &received_ecn,
-            buffer, sizeof(buffer),
-            delta_t, &is_wake_up_event, thread_ctx, &socket_rank);
-        received_buffer = buffer;
+            received_buffer, (int)recv_ring.slot_size,
+            delta_t, &is_wake_up_event, thread_ctx, &socket_rank,
+            &recv_batch, &event_poll);
 #endif
         current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+        if (options.do_loop_health) {
+            health_iter_start = current_time;
+            health_iter_recv = 0;
+            health_iter_sent = 0;
+            health_iter_immediate = (nb_loop_immediate > 1);
+            health_iter_wake_event = (bytes_recv == 0 && is_wake_up_event);
+        }
         if (options.do_system_call_duration && delta_t == 0 &&
             monitor_system_call_duration(&sc_duration, current_time, previous_time)) {
             ret = loop_callback(quic, picoquic_packet_loop_system_call_duration,
@@ -873,6 +1949,11 @@ void* picoquic_packet_loop_v3(void* v_ctx)
             size_t nb_packets_sent = 0;
 
             if (bytes_recv > 0) {
+#ifndef _WINDOWS
+                if (param->busy_poll_usec > 0) {
+                    busy_poll_deadline = current_time + (uint64_t)param->busy_poll_usec;
+                }
+#endif
 #ifdef _WINDOWS
                 size_t recv_bytes = 0;
                 while (recv_bytes < (size_t)bytes_recv && ret == 0) {
@@ -894,14 +1975,63 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                     ret = picoquic_win_recvmsg_async_start(&s_ctx[socket_rank]);
                 }
 #else
-                /* Submit the packet to the server */
-                ret = picoquic_incoming_packet_ex(quic, received_buffer,
-                    (size_t)bytes_recv, (struct sockaddr*)&addr_from,
-                    (struct sockaddr*)&addr_to, if_index_to, received_ecn,
-                    &last_cnx, current_time);
+                if (recv_batch.batch_size > 1) {
+                    /* Submit each message of the batch to the server */
+                    for (int i = 0; ret == 0 && i < recv_batch.nb_messages; i++) {
+                        if (recv_batch.bytes_recv[i] <= 0) {
+                            continue;
+                        }
+                        ret = picoquic_incoming_packet_ex(quic,
+                            recv_batch.buffers + ((size_t)i) * PICOQUIC_RECV_BATCH_BUFFER_SIZE,
+                            (size_t)recv_batch.bytes_recv[i],
+                            (struct sockaddr*)&recv_batch.addr_from[i],
+                            (struct sockaddr*)&recv_batch.addr_dest[i],
+                            recv_batch.dest_if[i], recv_batch.received_ecn[i],
+                            &last_cnx, current_time);
+                    }
+                }
+                else if (socket_rank >= 0 && s_ctx[socket_rank].udp_coalesced_size > 0) {
+                    /* GRO delivered a coalesced train of datagrams; submit
+                     * the whole train so decryption can be batched. */
+                    ret = picoquic_incoming_coalesced_train(quic, received_buffer,
+                        (size_t)bytes_recv, s_ctx[socket_rank].udp_coalesced_size,
+                        (struct sockaddr*)&addr_from,
+                        (struct sockaddr*)&addr_to, if_index_to, received_ecn,
+                        &last_cnx, current_time);
+                }
+                else {
+                    /* Submit the packet to the server */
+                    ret = picoquic_incoming_packet_ex(quic, received_buffer,
+                        (size_t)bytes_recv, (struct sockaddr*)&addr_from,
+                        (struct sockaddr*)&addr_to, if_index_to, received_ecn,
+                        &last_cnx, current_time);
+                }
 #endif
 
 
+                if (options.do_loop_health) {
+                    /* Count the datagrams this wake delivered: the whole
+                     * recv batch, the messages of a coalesced train, or one */
+                    uint64_t nb_msgs = 1;
+#ifdef _WINDOWS
+                    if (s_ctx[socket_rank].udp_coalesced_size > 0 &&
+                        (size_t)bytes_recv > s_ctx[socket_rank].udp_coalesced_size) {
+                        nb_msgs = ((uint64_t)bytes_recv + s_ctx[socket_rank].udp_coalesced_size - 1) /
+                            s_ctx[socket_rank].udp_coalesced_size;
+                    }
+#else
+                    if (recv_batch.batch_size > 1) {
+                        nb_msgs = (uint64_t)recv_batch.nb_messages;
+                    }
+                    else if (socket_rank >= 0 && s_ctx[socket_rank].udp_coalesced_size > 0 &&
+                        (size_t)bytes_recv > s_ctx[socket_rank].udp_coalesced_size) {
+                        nb_msgs = ((uint64_t)bytes_recv + s_ctx[socket_rank].udp_coalesced_size - 1) /
+                            s_ctx[socket_rank].udp_coalesced_size;
+                    }
+#endif
+                    health_iter_recv = nb_msgs;
+                }
+
                 if (loop_callback != NULL) {
                     size_t b_recvd = (size_t)bytes_recv;
                     ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &b_recvd);
@@ -917,6 +2047,40 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                 }
             }
 
+            if (ret == 0 && thread_ctx->mailbox_enabled && thread_ctx->mailbox.nb_mails > 0) {
+                /* Process packets handed over by the other shards of a
+                 * thread pool. The unlocked count check is safe: a post
+                 * that races with it wakes this thread right after. */
+                size_t mailed = picoquic_packet_mailbox_drain(quic, &thread_ctx->mailbox, current_time);
+
+                if (mailed > 0 && loop_callback != NULL) {
+                    ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &mailed);
+                }
+            }
+
+            if (ret == 0 && thread_ctx->submissions.head != NULL) {
+                /* Feed stream data posted by application threads */
+                picoquic_submission_queue_drain(thread_ctx);
+            }
+
+            if (ret == 0 && thread_ctx->handoffs.head != NULL) {
+                /* Adopt connections migrated from other shards */
+                picoquic_handoff_queue_drain(thread_ctx);
+            }
+
+            if (ret == 0 && thread_ctx->prober != NULL &&
+                thread_ctx->prober->results.head != NULL) {
+                /* Start the path probes whose addresses are now resolved */
+                picoquic_async_prober_drain(thread_ctx, current_time);
+            }
+
+            if (ret == 0 && stateless_ctx != NULL && quic->pending_stateless_packet != NULL) {
+                /* Hand the stateless responses built during incoming
+                 * processing to the sender thread, keeping the send pass
+                 * below for connection traffic. */
+                picoquic_stateless_sender_post(stateless_ctx, quic);
+            }
+
             if (ret == PICOQUIC_NO_ERROR_SIMULATE_NAT) {
                 if (param->extra_socket_required) {
                     /* Stop using the extra socket.
@@ -938,15 +2102,38 @@ void* picoquic_packet_loop_v3(void* v_ctx)
             * packets may be adding in the receive queue.
              */
 
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+            if (zc_pool.is_enabled) {
+                picoquic_zerocopy_reap(&zc_pool, s_ctx, nb_sockets_available);
+            }
+#endif
             while (ret == 0 && nb_packets_sent < PICOQUIC_PACKET_LOOP_SEND_MAX) {
                 struct sockaddr_storage peer_addr;
                 struct sockaddr_storage local_addr = { 0 };
                 int if_index = param->dest_if;
                 int sock_ret = 0;
                 int sock_err = 0;
+                uint8_t* send_buffer_ptr = send_buffer;
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+                int zc_slot = -1;
+#endif
 
+#ifndef _WINDOWS
+                if (send_batch.batch_size > 1) {
+                    /* Prepare the next packet directly into its batch slot */
+                    send_buffer_ptr = send_batch.buffers + ((size_t)send_batch.nb_messages) * send_buffer_size;
+                }
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+                else if (zc_pool.is_enabled &&
+                    (zc_slot = picoquic_zerocopy_slot_acquire(&zc_pool)) >= 0) {
+                    /* Prepare into a pool slot, in case this message
+                     * qualifies for a zero-copy send. */
+                    send_buffer_ptr = zc_pool.buffers + ((size_t)zc_slot) * zc_pool.buffer_size;
+                }
+#endif
+#endif
                 ret = picoquic_prepare_next_packet_ex(quic, loop_time,
-                    send_buffer, send_buffer_size, &send_length,
+                    send_buffer_ptr, send_buffer_size, &send_length,
                     &peer_addr, &local_addr, &if_index, &log_cid, &last_cnx,
                     send_msg_ptr);
 
@@ -966,6 +2153,7 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                     * - either the source port is not specified, or it matches the local port.
                     */
                     SOCKET_TYPE send_socket = INVALID_SOCKET;
+                    int send_socket_rank = -1;
                     uint16_t send_port = (peer_addr.ss_family == AF_INET) ?
                         ((struct sockaddr_in*)&local_addr)->sin_port :
                         ((struct sockaddr_in6*)&local_addr)->sin6_port;
@@ -976,6 +2164,7 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                     for (int i = 0; i < nb_sockets_available; i++) {
                         if (s_ctx[i].af == peer_addr.ss_family) {
                             send_socket = s_ctx[i].fd;
+                            send_socket_rank = i;
                             if (send_port == 0 && !param->prefer_extra_socket) {
                                 break;
                             }
@@ -989,8 +2178,28 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                         sock_ret = -1;
                         sock_err = -1;
                     }
+#ifndef _WINDOWS
+                    else if (send_batch.batch_size > 1 && !param->simulate_eio) {
+                        /* Queue the message in its batch slot. It will be sent
+                         * when the batch is full, or when the send pass ends. */
+                        picoquic_store_addr(&send_batch.addr_dest[send_batch.nb_messages], (struct sockaddr*)&peer_addr);
+                        picoquic_store_addr(&send_batch.addr_from[send_batch.nb_messages], (struct sockaddr*)&local_addr);
+                        send_batch.dest_if[send_batch.nb_messages] = if_index;
+                        send_batch.lengths[send_batch.nb_messages] = send_length;
+                        send_batch.msg_sizes[send_batch.nb_messages] = (send_msg_ptr == NULL) ? 0 : send_msg_size;
+                        send_batch.fds[send_batch.nb_messages] = send_socket;
+                        send_batch.nb_messages++;
+                        sock_ret = (int)send_length;
+                        if ((size_t)send_batch.nb_messages >= send_batch.batch_size) {
+                            (void)picoquic_packet_loop_send_batch_flush(quic, &send_batch, send_buffer_size, &log_cid);
+                        }
+                    }
+#endif
                     else
                     {
+                        /* Wait for the crypto workers to finish sealing the
+                         * buffer; a no-op without a worker pool. */
+                        picoquic_crypto_pool_sync(quic);
 
                         if (param->simulate_eio && send_length > PICOQUIC_MAX_PACKET_SIZE) {
                             /* Test hook, simulating a driver that does not support GSO */
@@ -999,9 +2208,57 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                             param->simulate_eio = 0;
                         }
                         else {
-                            sock_ret = picoquic_sendmsg(send_socket,
-                                (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
-                                (const char*)send_buffer, (int)send_length, (int)send_msg_size, &sock_err);
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+                            if (zc_slot >= 0 && send_socket_rank >= 0 &&
+                                s_ctx[send_socket_rank].supports_msg_zerocopy &&
+                                send_length >= PICOQUIC_ZEROCOPY_THRESHOLD) {
+                                sock_ret = picoquic_sendmsg_flags(send_socket,
+                                    (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
+                                    (const char*)send_buffer_ptr, (int)send_length, (int)send_msg_size,
+                                    MSG_ZEROCOPY, &sock_err);
+                                if (sock_ret > 0) {
+                                    /* The kernel holds the buffer until the completion is reaped */
+                                    zc_pool.slot_busy[zc_slot] = 1;
+                                    zc_pool.slot_fd[zc_slot] = send_socket;
+                                    zc_pool.slot_seq[zc_slot] = s_ctx[send_socket_rank].zerocopy_next_seq++;
+                                    zc_slot = -1;
+                                }
+                                else if (sock_err == ENOBUFS) {
+                                    /* Out of kernel option memory: send the regular way */
+                                    sock_ret = picoquic_sendmsg(send_socket,
+                                        (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
+                                        (const char*)send_buffer_ptr, (int)send_length, (int)send_msg_size, &sock_err);
+                                }
+                            }
+                            else
+#endif
+#ifndef _WINDOWS
+                            if (txtime_enabled && last_cnx != NULL) {
+                                /* Translate the pacing schedule, which runs on
+                                 * the QUIC clock, into the monotonic clock that
+                                 * the qdisc enforces. */
+                                uint64_t departure_time = picoquic_pacing_departure_time(last_cnx->path[0], current_time);
+                                struct timespec ts_mono;
+                                uint64_t txtime_ns = 0;
+
+                                if (clock_gettime(CLOCK_MONOTONIC, &ts_mono) == 0) {
+                                    txtime_ns = ((uint64_t)ts_mono.tv_sec) * 1000000000ull + (uint64_t)ts_mono.tv_nsec;
+                                    if (departure_time > current_time) {
+                                        txtime_ns += (departure_time - current_time) * 1000;
+                                    }
+                                }
+                                sock_ret = picoquic_sendmsg_txtime(send_socket,
+                                    (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
+                                    (const char*)send_buffer_ptr, (int)send_length, (int)send_msg_size,
+                                    txtime_ns, &sock_err);
+                            }
+                            else
+#endif
+                            {
+                                sock_ret = picoquic_sendmsg(send_socket,
+                                    (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
+                                    (const char*)send_buffer_ptr, (int)send_length, (int)send_msg_size, &sock_err);
+                            }
                         }
                     }
                     if (sock_ret <= 0) {
@@ -1034,7 +2291,7 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                                     }
                                     sock_ret = picoquic_sendmsg(send_socket,
                                         (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
-                                        (const char*)(send_buffer + packet_index), (int)packet_size, 0, &sock_err);
+                                        (const char*)(send_buffer_ptr + packet_index), (int)packet_size, 0, &sock_err);
                                     if (sock_ret > 0) {
                                         packet_index += packet_size;
                                     }
@@ -1062,6 +2319,13 @@ void* picoquic_packet_loop_v3(void* v_ctx)
                 }
             }
 
+#ifndef _WINDOWS
+            if (ret == 0 && send_batch.nb_messages > 0) {
+                (void)picoquic_packet_loop_send_batch_flush(quic, &send_batch, send_buffer_size, &log_cid);
+            }
+#endif
+            health_iter_sent = nb_packets_sent;
+
             if (ret == 0 && loop_callback != NULL) {
                 ret = loop_callback(quic, picoquic_packet_loop_after_send, loop_callback_ctx, &bytes_sent);
             }
@@ -1075,6 +2339,29 @@ void* picoquic_packet_loop_v3(void* v_ctx)
         ret = 0;
     }
 
+    if (crypto_pool_created) {
+        /* delete only the pool created here; an application owned pool
+         * stays with the quic context. */
+        picoquic_delete_crypto_worker_pool(quic);
+    }
+
+#ifndef _WINDOWS
+    /* Stop the receive thread before closing the sockets it polls */
+    if (rx_ctx != NULL) {
+        picoquic_rx_thread_stop(rx_ctx);
+    }
+    if (wake_up_created) {
+        picoquic_close_network_wake_up(thread_ctx);
+    }
+#endif
+    /* Stop the stateless sender before closing the sockets it writes to */
+    if (stateless_ctx != NULL) {
+        picoquic_stateless_sender_stop(stateless_ctx);
+    }
+    if (thread_ctx->prober != NULL) {
+        picoquic_async_prober_stop(thread_ctx);
+    }
+
     /* Close the sockets */
     for (int i = 0; i < nb_sockets; i++) {
         picoquic_packet_loop_close_socket(&s_ctx[i]);
@@ -1083,6 +2370,15 @@ void* picoquic_packet_loop_v3(void* v_ctx)
     if (send_buffer != NULL) {
         free(send_buffer);
     }
+#ifndef _WINDOWS
+    picoquic_recv_ring_release(&recv_ring);
+    picoquic_event_poll_release(&event_poll);
+    picoquic_packet_loop_recv_batch_release(&recv_batch);
+    picoquic_packet_loop_send_batch_release(&send_batch);
+#ifdef PICOQUIC_ZEROCOPY_AVAILABLE
+    picoquic_zerocopy_pool_release(&zc_pool);
+#endif
+#endif
     thread_ctx->return_code = ret;
 #ifdef _WINDOWS
     return (DWORD)ret;
@@ -1140,8 +2436,13 @@ static void picoquic_close_network_wake_up(picoquic_network_thread_ctx_t* thread
 #ifdef _WINDOWS
         CloseHandle(thread_ctx->wake_up_event);
 #else
-        for (int i = 0; i < 2; i++) {
-            (void)close(thread_ctx->wake_up_pipe_fd[i]);
+        if (thread_ctx->wake_up_is_eventfd) {
+            (void)close(thread_ctx->wake_up_pipe_fd[0]);
+        }
+        else {
+            for (int i = 0; i < 2; i++) {
+                (void)close(thread_ctx->wake_up_pipe_fd[i]);
+            }
         }
 #endif
         thread_ctx->wake_up_defined = 0;
@@ -1160,6 +2461,21 @@ static void picoquic_open_network_wake_up(picoquic_network_thread_ctx_t* thread_
         thread_ctx->wake_up_defined = 1;
     }
 #else
+#if defined(__linux__)
+    /* Use a single eventfd instead of a self pipe. Wake up requests
+     * posted before the loop gets to run just increment the counter,
+     * and are all drained by the single read in the loop, so a burst
+     * of cross thread submissions costs one kernel transition instead
+     * of one per request. */
+    int event_fd = eventfd(0, EFD_NONBLOCK);
+    if (event_fd >= 0) {
+        thread_ctx->wake_up_pipe_fd[0] = event_fd;
+        thread_ctx->wake_up_pipe_fd[1] = event_fd;
+        thread_ctx->wake_up_is_eventfd = 1;
+        thread_ctx->wake_up_defined = 1;
+    }
+    else
+#endif
     if (pipe(thread_ctx->wake_up_pipe_fd) != 0) {
         *ret = errno;
     }
@@ -1271,9 +2587,17 @@ int picoquic_wake_up_network_thread(picoquic_network_thread_ctx_t* thread_ctx)
             ret = (int)err;
         }
 #else
-        /* TODO: write to network pipe */
         ssize_t written = 0;
-        if ((written = write(thread_ctx->wake_up_pipe_fd[1], &ret, 1)) != 1) {
+        if (thread_ctx->wake_up_is_eventfd) {
+            uint64_t one = 1;
+            if ((written = write(thread_ctx->wake_up_pipe_fd[1], &one, sizeof(one))) != sizeof(one) &&
+                errno != EAGAIN) {
+                /* EAGAIN means the counter is saturated, i.e. a wake up
+                 * is already pending; anything else is a real error. */
+                ret = errno;
+            }
+        }
+        else if ((written = write(thread_ctx->wake_up_pipe_fd[1], &ret, 1)) != 1) {
             if (written == 0) {
                 ret = EPIPE;
             }
@@ -1303,6 +2627,902 @@ void picoquic_delete_network_thread(picoquic_network_thread_ctx_t* thread_ctx)
     if (thread_ctx->is_threaded) {
         thread_ctx->thread_delete_fn((void**)&thread_ctx->pthread);
     }
+    /* Free the mailbox, now that neither this thread nor a poster runs */
+    if (thread_ctx->mailbox_enabled) {
+        thread_ctx->mailbox_enabled = 0;
+        picoquic_packet_mailbox_release(&thread_ctx->mailbox);
+    }
+    /* Free stream data that was submitted but never drained */
+    picoquic_submission_queue_release(thread_ctx);
+    /* Free handoff records that were posted but never drained */
+    picoquic_handoff_queue_release(thread_ctx);
     /* Free the context */
     free(thread_ctx);
+}
+
+/* Sharded server mode. Start one network thread per QUIC context, all
+ * bound to the same local port through SO_REUSEPORT, and configure each
+ * context so locally issued CIDs carry the shard index in clear text,
+ * per the encoding of picoquic_lb.c. The kernel's reuseport hash keeps
+ * a connection on its shard as long as the client's address is stable;
+ * the CID encoding lets an external dispatcher route rebinding clients
+ * back to the owning shard.
+ */
+/* Cross thread packet mailbox. Posting copies the datagram; the owning
+ * thread drains the mailbox from its own loop, so the QUIC context of a
+ * shard is only ever entered by its own thread. */
+static int picoquic_packet_mailbox_init(picoquic_packet_mailbox_t* mailbox)
+{
+    memset(mailbox, 0, sizeof(picoquic_packet_mailbox_t));
+    return picoquic_create_mutex(&mailbox->mutex);
+}
+
+static void picoquic_packet_mailbox_release(picoquic_packet_mailbox_t* mailbox)
+{
+    while (mailbox->first != NULL) {
+        picoquic_packet_mail_t* mail = mailbox->first;
+        mailbox->first = mail->next;
+        free(mail);
+    }
+    mailbox->last = NULL;
+    mailbox->nb_mails = 0;
+    (void)picoquic_delete_mutex(&mailbox->mutex);
+}
+
+static int picoquic_packet_mailbox_post(picoquic_packet_mailbox_t* mailbox,
+    uint8_t* bytes, size_t packet_length,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, int if_index_to,
+    unsigned char received_ecn)
+{
+    int ret = 0;
+    picoquic_packet_mail_t* mail = (picoquic_packet_mail_t*)malloc(
+        sizeof(picoquic_packet_mail_t) + packet_length);
+
+    if (mail == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(mail, 0, sizeof(picoquic_packet_mail_t));
+        picoquic_store_addr(&mail->addr_from, addr_from);
+        picoquic_store_addr(&mail->addr_to, addr_to);
+        mail->if_index_to = if_index_to;
+        mail->received_ecn = received_ecn;
+        mail->length = packet_length;
+        memcpy(mail->bytes, bytes, packet_length);
+
+        (void)picoquic_lock_mutex(&mailbox->mutex);
+        if (mailbox->nb_mails >= PICOQUIC_PACKET_MAILBOX_MAX) {
+            /* The owning thread is not keeping up; drop, as a full
+             * socket buffer would. */
+            ret = -1;
+        }
+        else {
+            if (mailbox->last == NULL) {
+                mailbox->first = mail;
+            }
+            else {
+                mailbox->last->next = mail;
+            }
+            mailbox->last = mail;
+            mailbox->nb_mails++;
+            mail = NULL;
+        }
+        (void)picoquic_unlock_mutex(&mailbox->mutex);
+
+        if (mail != NULL) {
+            free(mail);
+        }
+    }
+
+    return ret;
+}
+
+static size_t picoquic_packet_mailbox_drain(picoquic_quic_t* quic,
+    picoquic_packet_mailbox_t* mailbox, uint64_t current_time)
+{
+    size_t bytes_recv = 0;
+    picoquic_packet_mail_t* mail;
+
+    (void)picoquic_lock_mutex(&mailbox->mutex);
+    mail = mailbox->first;
+    mailbox->first = NULL;
+    mailbox->last = NULL;
+    mailbox->nb_mails = 0;
+    (void)picoquic_unlock_mutex(&mailbox->mutex);
+
+    while (mail != NULL) {
+        picoquic_packet_mail_t* next = mail->next;
+        picoquic_cnx_t* last_cnx = NULL;
+
+        bytes_recv += mail->length;
+        (void)picoquic_incoming_packet_ex(quic, mail->bytes, mail->length,
+            (struct sockaddr*)&mail->addr_from, (struct sockaddr*)&mail->addr_to,
+            mail->if_index_to, mail->received_ecn, &last_cnx, current_time);
+        free(mail);
+        mail = next;
+    }
+
+    return bytes_recv;
+}
+
+#ifndef _WINDOWS
+/* Dedicated receive thread, enabled by the use_rx_thread loop parameter.
+ *
+ * The thread blocks in select()/recvmsg() on the loop sockets, splits
+ * coalesced GRO trains into datagrams, posts a copy of each datagram
+ * into the loop thread's mailbox and wakes the loop, which drains the
+ * mailbox like packets handed over by the other shards of a pool. The
+ * loop thread stops polling the sockets for reading, so packet
+ * production overlaps the receive system calls, the copies, and the
+ * buffering between bursts instead of alternating with them.
+ *
+ * This is deliberately not a split of picoquic_incoming_packet() and
+ * picoquic_prepare_next_packet_ex() across two threads: almost all of
+ * picoquic_cnx_t is written by both sides. The receive path updates
+ * the ACK contexts, the congestion and pacing state, the flow control
+ * limits, the stream trees and the CID tables that the send path
+ * reads, and ACK processing trims the retransmission queues that the
+ * send path appends to, so running the two concurrently would need a
+ * lock around essentially the whole connection, serializing the
+ * threads again. The state that can safely move off the loop thread is
+ * what this thread owns: the sockets' receive side and the datagram
+ * copies in flight; the mailbox is the single handoff point.
+ *
+ * A full mailbox drops the datagram, as a full socket buffer would.
+ * The thread exits when should_close is set; the bounded select
+ * timeout guarantees the flag is noticed. */
+struct st_picoquic_rx_thread_ctx_t {
+    picoquic_network_thread_ctx_t* thread_ctx;
+    picoquic_socket_ctx_t* s_ctx;
+    int nb_sockets;
+    int mailbox_created; /* release the mailbox on stop if created here */
+    volatile int should_close;
+    picoquic_thread_t thread;
+    uint64_t nb_dropped;
+};
+
+static picoquic_thread_return_t picoquic_rx_thread(void* arg)
+{
+    picoquic_rx_thread_ctx_t* rx_ctx = (picoquic_rx_thread_ctx_t*)arg;
+    picoquic_network_thread_ctx_t* thread_ctx = rx_ctx->thread_ctx;
+    /* Large enough for a coalesced GRO train */
+    uint8_t* buffer = (uint8_t*)malloc(0x10000);
+
+    while (buffer != NULL && !rx_ctx->should_close) {
+        fd_set readfds;
+        struct timeval tv;
+        int sockmax = 0;
+        int ret_select;
+        int shall_wake = 0;
+
+        FD_ZERO(&readfds);
+        for (int i = 0; i < rx_ctx->nb_sockets; i++) {
+            if (sockmax < (int)rx_ctx->s_ctx[i].fd) {
+                sockmax = (int)rx_ctx->s_ctx[i].fd;
+            }
+            FD_SET(rx_ctx->s_ctx[i].fd, &readfds);
+        }
+        /* Bounded wait, so a close request is noticed */
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+
+        ret_select = select(sockmax + 1, &readfds, NULL, NULL, &tv);
+
+        if (ret_select < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            DBG_PRINTF("Error: receive thread select returns %d (errno: %d)", ret_select, errno);
+            break;
+        }
+
+        for (int i = 0; ret_select > 0 && i < rx_ctx->nb_sockets; i++) {
+            if (FD_ISSET(rx_ctx->s_ctx[i].fd, &readfds)) {
+                struct sockaddr_storage addr_from;
+                struct sockaddr_storage addr_dest;
+                int dest_if = 0;
+                unsigned char received_ecn = 0;
+                int bytes_recv = picoquic_recvmsg_ex(rx_ctx->s_ctx[i].fd, &addr_from,
+                    &addr_dest, &dest_if, &received_ecn,
+                    buffer, 0x10000, &rx_ctx->s_ctx[i].udp_coalesced_size);
+
+                if (bytes_recv > 0) {
+                    size_t recv_bytes = 0;
+                    size_t seg_size = (rx_ctx->s_ctx[i].udp_coalesced_size > 0) ?
+                        rx_ctx->s_ctx[i].udp_coalesced_size : (size_t)bytes_recv;
+
+                    /* Document incoming port */
+                    if (addr_dest.ss_family == AF_INET6) {
+                        ((struct sockaddr_in6*)&addr_dest)->sin6_port = rx_ctx->s_ctx[i].n_port;
+                    }
+                    else if (addr_dest.ss_family == AF_INET) {
+                        ((struct sockaddr_in*)&addr_dest)->sin_port = rx_ctx->s_ctx[i].n_port;
+                    }
+
+                    while (recv_bytes < (size_t)bytes_recv) {
+                        size_t recv_length = (size_t)bytes_recv - recv_bytes;
+
+                        if (recv_length > seg_size) {
+                            recv_length = seg_size;
+                        }
+                        if (picoquic_packet_mailbox_post(&thread_ctx->mailbox,
+                            buffer + recv_bytes, recv_length,
+                            (struct sockaddr*)&addr_from, (struct sockaddr*)&addr_dest,
+                            dest_if, received_ecn) != 0) {
+                            rx_ctx->nb_dropped++;
+                        }
+                        recv_bytes += recv_length;
+                    }
+                    shall_wake = 1;
+                }
+            }
+        }
+
+        if (shall_wake) {
+            (void)picoquic_wake_up_network_thread(thread_ctx);
+        }
+    }
+
+    if (buffer != NULL) {
+        free(buffer);
+    }
+    picoquic_thread_do_return;
+}
+
+static picoquic_rx_thread_ctx_t* picoquic_rx_thread_start(
+    picoquic_network_thread_ctx_t* thread_ctx, picoquic_socket_ctx_t* s_ctx, int nb_sockets)
+{
+    picoquic_rx_thread_ctx_t* rx_ctx = (picoquic_rx_thread_ctx_t*)malloc(
+        sizeof(picoquic_rx_thread_ctx_t));
+
+    if (rx_ctx != NULL) {
+        memset(rx_ctx, 0, sizeof(picoquic_rx_thread_ctx_t));
+        rx_ctx->thread_ctx = thread_ctx;
+        rx_ctx->s_ctx = s_ctx;
+        rx_ctx->nb_sockets = nb_sockets;
+
+        if (!thread_ctx->mailbox_enabled) {
+            if (picoquic_packet_mailbox_init(&thread_ctx->mailbox) == 0) {
+                thread_ctx->mailbox_enabled = 1;
+                rx_ctx->mailbox_created = 1;
+            }
+            else {
+                free(rx_ctx);
+                rx_ctx = NULL;
+            }
+        }
+
+        if (rx_ctx != NULL &&
+            picoquic_create_thread(&rx_ctx->thread, picoquic_rx_thread, rx_ctx) != 0) {
+            if (rx_ctx->mailbox_created) {
+                thread_ctx->mailbox_enabled = 0;
+                picoquic_packet_mailbox_release(&thread_ctx->mailbox);
+            }
+            free(rx_ctx);
+            rx_ctx = NULL;
+        }
+    }
+
+    return rx_ctx;
+}
+
+static void picoquic_rx_thread_stop(picoquic_rx_thread_ctx_t* rx_ctx)
+{
+    rx_ctx->should_close = 1;
+    picoquic_delete_thread(&rx_ctx->thread);
+
+    if (rx_ctx->nb_dropped > 0) {
+        DBG_PRINTF("Receive thread dropped %" PRIu64 " datagrams", rx_ctx->nb_dropped);
+    }
+    if (rx_ctx->mailbox_created) {
+        rx_ctx->thread_ctx->mailbox_enabled = 0;
+        picoquic_packet_mailbox_release(&rx_ctx->thread_ctx->mailbox);
+    }
+    free(rx_ctx);
+}
+#endif /* _WINDOWS */
+
+/* Dedicated stateless response sender, enabled by the use_stateless_sender
+ * loop parameter.
+ *
+ * Retry, Version Negotiation and stateless reset packets are built
+ * during incoming processing and queued on the quic context. Without
+ * this thread, the loop sends them from its own send pass, so an
+ * address validation flood competes with established traffic for the
+ * pass's packet budget and its sendmmsg batch slots. With it, the loop
+ * moves the finished packets from the quic queue onto a lock free
+ * stack (the submission queue pattern) after each receive pass, and
+ * this thread sends and frees them.
+ *
+ * The responses go out on the loop's own sockets: concurrent sendmsg()
+ * calls on a UDP socket are safe, each datagram is atomic. A separate
+ * socket bound with SO_REUSEPORT would not do, since it would join the
+ * kernel's receive steering group and swallow incoming packets.
+ *
+ * Note that the Retry token computation itself still runs in incoming
+ * processing on the loop thread; only the transmission moves. */
+struct st_picoquic_stateless_sender_ctx_t {
+    picoquic_socket_ctx_t* s_ctx;
+    int nb_sockets;
+    void* volatile head; /* lock free stack of stateless packets */
+    picoquic_event_t work_ready;
+    volatile int should_close;
+    picoquic_thread_t thread;
+};
+
+static void picoquic_stateless_sender_drain(picoquic_stateless_sender_ctx_t* sender_ctx)
+{
+    picoquic_stateless_packet_t* sp = (picoquic_stateless_packet_t*)picoquic_atomic_exchange_ptr(
+        &sender_ctx->head, NULL);
+    picoquic_stateless_packet_t* in_order = NULL;
+
+    /* The stack pops newest first; reverse it */
+    while (sp != NULL) {
+        picoquic_stateless_packet_t* next = sp->next_packet;
+        sp->next_packet = in_order;
+        in_order = sp;
+        sp = next;
+    }
+
+    while (in_order != NULL) {
+        picoquic_stateless_packet_t* next = in_order->next_packet;
+        SOCKET_TYPE send_socket = INVALID_SOCKET;
+        int sock_err = 0;
+        uint16_t send_port = (in_order->addr_to.ss_family == AF_INET) ?
+            ((struct sockaddr_in*)&in_order->addr_local)->sin_port :
+            ((struct sockaddr_in6*)&in_order->addr_local)->sin6_port;
+
+        for (int i = 0; i < sender_ctx->nb_sockets; i++) {
+            if (sender_ctx->s_ctx[i].af == in_order->addr_to.ss_family) {
+                send_socket = sender_ctx->s_ctx[i].fd;
+                if (send_port == 0 || sender_ctx->s_ctx[i].n_port == send_port) {
+                    break;
+                }
+            }
+        }
+
+        if (send_socket != INVALID_SOCKET) {
+            (void)picoquic_sendmsg(send_socket,
+                (struct sockaddr*)&in_order->addr_to, (struct sockaddr*)&in_order->addr_local,
+                in_order->if_index_local, (const char*)in_order->bytes,
+                (int)in_order->length, 0, &sock_err);
+        }
+        picoquic_delete_stateless_packet(in_order);
+        in_order = next;
+    }
+}
+
+static picoquic_thread_return_t picoquic_stateless_sender_thread(void* arg)
+{
+    picoquic_stateless_sender_ctx_t* sender_ctx = (picoquic_stateless_sender_ctx_t*)arg;
+
+    while (!sender_ctx->should_close) {
+        /* The timed wait tolerates a wake up lost to a race with the
+         * posting thread */
+        (void)picoquic_wait_for_event(&sender_ctx->work_ready, 100000);
+        picoquic_stateless_sender_drain(sender_ctx);
+    }
+    /* Send the responses posted before the close request */
+    picoquic_stateless_sender_drain(sender_ctx);
+
+    picoquic_thread_do_return;
+}
+
+static picoquic_stateless_sender_ctx_t* picoquic_stateless_sender_start(
+    picoquic_socket_ctx_t* s_ctx, int nb_sockets)
+{
+    picoquic_stateless_sender_ctx_t* sender_ctx = (picoquic_stateless_sender_ctx_t*)malloc(
+        sizeof(picoquic_stateless_sender_ctx_t));
+
+    if (sender_ctx != NULL) {
+        memset(sender_ctx, 0, sizeof(picoquic_stateless_sender_ctx_t));
+        sender_ctx->s_ctx = s_ctx;
+        sender_ctx->nb_sockets = nb_sockets;
+
+        if (picoquic_create_event(&sender_ctx->work_ready) != 0) {
+            free(sender_ctx);
+            sender_ctx = NULL;
+        }
+        else if (picoquic_create_thread(&sender_ctx->thread,
+            picoquic_stateless_sender_thread, sender_ctx) != 0) {
+            picoquic_delete_event(&sender_ctx->work_ready);
+            free(sender_ctx);
+            sender_ctx = NULL;
+        }
+    }
+
+    return sender_ctx;
+}
+
+/* Move the stateless packets queued during incoming processing to the
+ * sender thread. Runs on the loop thread, which is the only caller of
+ * the quic level queue. */
+static void picoquic_stateless_sender_post(picoquic_stateless_sender_ctx_t* sender_ctx,
+    picoquic_quic_t* quic)
+{
+    picoquic_stateless_packet_t* sp;
+    int was_empty = 0;
+
+    while ((sp = picoquic_dequeue_stateless_packet(quic)) != NULL) {
+        if (picoquic_lockfree_stack_push(&sender_ctx->head, sp,
+            (void**)&sp->next_packet)) {
+            was_empty = 1;
+        }
+    }
+    if (was_empty) {
+        (void)picoquic_signal_event(&sender_ctx->work_ready);
+    }
+}
+
+static void picoquic_stateless_sender_stop(picoquic_stateless_sender_ctx_t* sender_ctx)
+{
+    sender_ctx->should_close = 1;
+    (void)picoquic_signal_event(&sender_ctx->work_ready);
+    picoquic_delete_thread(&sender_ctx->thread);
+    picoquic_delete_event(&sender_ctx->work_ready);
+    free(sender_ctx);
+}
+
+/* Resolver thread for async path probes, enabled by the use_async_probe
+ * loop parameter.
+ *
+ * picoquic_probe_new_path() needs resolved addresses, so an application
+ * that probes a new path over a just-activated interface first has to
+ * resolve the peer name -- a getaddrinfo call that can block for
+ * seconds on a cellular link. This stage takes that wait off both the
+ * application thread and the loop: requests are posted on a lock free
+ * stack (the submission queue pattern), this thread resolves them, and
+ * the loop thread drains the results and calls
+ * picoquic_probe_new_path_ex() in its own context, so the connection
+ * state is only ever touched by its owning thread. */
+static void picoquic_probe_queue_free(picoquic_submission_queue_t* queue)
+{
+    picoquic_path_probe_t* probe = (picoquic_path_probe_t*)picoquic_atomic_exchange_ptr(
+        &queue->head, NULL);
+
+    while (probe != NULL) {
+        picoquic_path_probe_t* next = probe->next;
+        free(probe);
+        probe = next;
+    }
+}
+
+static picoquic_thread_return_t picoquic_async_prober_thread(void* arg)
+{
+    picoquic_async_prober_t* prober = (picoquic_async_prober_t*)arg;
+
+    while (!prober->should_close) {
+        picoquic_path_probe_t* probe;
+        int posted = 0;
+
+        /* The timed wait tolerates a wake up lost to a race with the
+         * posting thread */
+        (void)picoquic_wait_for_event(&prober->work_ready, 100000);
+
+        probe = (picoquic_path_probe_t*)picoquic_atomic_exchange_ptr(
+            &prober->requests.head, NULL);
+
+        while (probe != NULL) {
+            picoquic_path_probe_t* next = probe->next;
+            int is_name = 0;
+
+            /* The blocking call this stage exists for */
+            probe->resolution_ret = picoquic_get_server_address(probe->peer_name,
+                probe->peer_port, &probe->addr_peer, &is_name);
+
+            (void)picoquic_lockfree_stack_push(&prober->results.head, probe,
+                (void**)&probe->next);
+            posted = 1;
+            probe = next;
+        }
+
+        if (posted) {
+            (void)picoquic_wake_up_network_thread(prober->thread_ctx);
+        }
+    }
+
+    picoquic_thread_do_return;
+}
+
+int picoquic_probe_new_path_async(picoquic_network_thread_ctx_t* thread_ctx,
+    picoquic_cnx_t* cnx, const char* peer_name, int peer_port,
+    const struct sockaddr* addr_local, int if_index)
+{
+    int ret = 0;
+    picoquic_async_prober_t* prober = thread_ctx->prober;
+
+    if (prober == NULL || peer_name == NULL ||
+        strlen(peer_name) >= sizeof(((picoquic_path_probe_t*)0)->peer_name)) {
+        ret = -1;
+    }
+    else {
+        picoquic_path_probe_t* probe = (picoquic_path_probe_t*)malloc(
+            sizeof(picoquic_path_probe_t));
+
+        if (probe == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(probe, 0, sizeof(picoquic_path_probe_t));
+            probe->cnx = cnx;
+            memcpy(probe->peer_name, peer_name, strlen(peer_name));
+            probe->peer_port = peer_port;
+            probe->if_index = if_index;
+            picoquic_store_addr(&probe->addr_local, addr_local);
+
+            if (picoquic_lockfree_stack_push(&prober->requests.head, probe,
+                (void**)&probe->next)) {
+                (void)picoquic_signal_event(&prober->work_ready);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Turn the resolved probe requests into paths. Runs on the loop thread. */
+static void picoquic_async_prober_drain(picoquic_network_thread_ctx_t* thread_ctx,
+    uint64_t current_time)
+{
+    picoquic_path_probe_t* probe = (picoquic_path_probe_t*)picoquic_atomic_exchange_ptr(
+        &thread_ctx->prober->results.head, NULL);
+
+    while (probe != NULL) {
+        picoquic_path_probe_t* next = probe->next;
+
+        if (probe->resolution_ret != 0) {
+            DBG_PRINTF("Cannot resolve %s:%d for a path probe", probe->peer_name,
+                probe->peer_port);
+        }
+        else if (picoquic_probe_new_path_ex(probe->cnx,
+            (struct sockaddr*)&probe->addr_peer,
+            (probe->addr_local.ss_family == 0) ? NULL : (struct sockaddr*)&probe->addr_local,
+            probe->if_index, current_time, 0) != 0) {
+            DBG_PRINTF("Cannot probe a path to %s:%d", probe->peer_name, probe->peer_port);
+        }
+        free(probe);
+        probe = next;
+    }
+}
+
+static picoquic_async_prober_t* picoquic_async_prober_start(
+    picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_async_prober_t* prober = (picoquic_async_prober_t*)malloc(
+        sizeof(picoquic_async_prober_t));
+
+    if (prober != NULL) {
+        memset(prober, 0, sizeof(picoquic_async_prober_t));
+        prober->thread_ctx = thread_ctx;
+
+        if (picoquic_create_event(&prober->work_ready) != 0) {
+            free(prober);
+            prober = NULL;
+        }
+        else if (picoquic_create_thread(&prober->thread,
+            picoquic_async_prober_thread, prober) != 0) {
+            picoquic_delete_event(&prober->work_ready);
+            free(prober);
+            prober = NULL;
+        }
+    }
+
+    return prober;
+}
+
+static void picoquic_async_prober_stop(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_async_prober_t* prober = thread_ctx->prober;
+
+    thread_ctx->prober = NULL;
+    prober->should_close = 1;
+    (void)picoquic_signal_event(&prober->work_ready);
+    picoquic_delete_thread(&prober->thread);
+    picoquic_delete_event(&prober->work_ready);
+    /* Free the requests and results that were never drained */
+    picoquic_probe_queue_free(&prober->requests);
+    picoquic_probe_queue_free(&prober->results);
+    free(prober);
+}
+
+/* Reroute callback installed on each shard of a thread pool. The shard
+ * index is read from the first server id byte of the destination CID,
+ * i.e. datagram byte 2: byte 0 is the short header first byte, byte 1
+ * the CID first octet (see the clear encoding in picoquic_lb.c). */
+typedef struct st_picoquic_cnxid_forward_t {
+    struct st_picoquic_cnxid_forward_t* next;
+    picoquic_connection_id_t cnx_id;
+    int target_rank;
+} picoquic_cnxid_forward_t;
+
+typedef struct st_picoquic_shard_route_ctx_t {
+    picoquic_network_thread_pool_t* pool;
+    int shard_rank;
+    /* CIDs of connections migrated to another shard. The list is only
+     * touched by the shard's own thread: the reroute callback and
+     * picoquic_migrate_cnx_to_thread both run there. */
+    picoquic_cnxid_forward_t* forward_first;
+} picoquic_shard_route_ctx_t;
+
+static int picoquic_pool_shard_reroute(void* v_ctx, uint8_t* bytes, size_t packet_length,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, int if_index_to,
+    unsigned char received_ecn, uint64_t current_time)
+{
+    picoquic_shard_route_ctx_t* route_ctx = (picoquic_shard_route_ctx_t*)v_ctx;
+    picoquic_network_thread_pool_t* pool = route_ctx->pool;
+    int taken = 0;
+    int target;
+
+#ifdef UNREFERENCED_PARAMETER
+    UNREFERENCED_PARAMETER(current_time);
+#endif
+    /* Connections migrated off this shard keep CIDs that still encode
+     * the old rank; forward their packets to the new owner. */
+    for (picoquic_cnxid_forward_t* fwd = route_ctx->forward_first; fwd != NULL; fwd = fwd->next) {
+        if (packet_length >= 1u + fwd->cnx_id.id_len &&
+            memcmp(bytes + 1, fwd->cnx_id.id, fwd->cnx_id.id_len) == 0) {
+            if (pool->threads[fwd->target_rank]->mailbox_enabled &&
+                picoquic_packet_mailbox_post(&pool->threads[fwd->target_rank]->mailbox,
+                    bytes, packet_length, addr_from, addr_to, if_index_to, received_ecn) == 0) {
+                (void)picoquic_wake_up_network_thread(pool->threads[fwd->target_rank]);
+            }
+            return 1;
+        }
+    }
+
+    if (packet_length >= 3 &&
+        (target = bytes[2]) != route_ctx->shard_rank &&
+        target < pool->nb_threads &&
+        pool->threads[target]->mailbox_enabled) {
+        /* A migrated connection's CIDs encode its original rank; if the
+         * CID resolves locally the connection was handed to this shard,
+         * and bouncing the packet back would loop forever. */
+        picoquic_quic_t* quic = pool->threads[route_ctx->shard_rank]->quic;
+        picoquic_connection_id_t cid = picoquic_null_connection_id;
+
+        if (quic->local_cnxid_length > 0 &&
+            packet_length >= 1u + quic->local_cnxid_length) {
+            cid.id_len = quic->local_cnxid_length;
+            memcpy(cid.id, bytes + 1, cid.id_len);
+        }
+        if (picoquic_cnx_by_id(quic, cid, NULL) == NULL) {
+            if (picoquic_packet_mailbox_post(&pool->threads[target]->mailbox,
+                bytes, packet_length, addr_from, addr_to, if_index_to, received_ecn) == 0) {
+                (void)picoquic_wake_up_network_thread(pool->threads[target]);
+            }
+            /* Taken even if the post failed: the packet belongs to another
+             * shard, processing it here would touch foreign tables. */
+            taken = 1;
+        }
+    }
+
+    return taken;
+}
+
+/* Hand a ready connection to another shard of the pool. Must be called
+ * from the thread that currently owns the connection, i.e. from the loop
+ * callback of its shard. The connection object moves by pointer: it is
+ * unhooked from the source context's tables and wake list here, posted
+ * to the target thread, and re-registered there when that thread drains
+ * its handoff queue. Forwarding entries are left on the source shard so
+ * that packets whose CID still encodes the old rank follow the
+ * connection. */
+int picoquic_migrate_cnx_to_thread(picoquic_network_thread_pool_t* pool,
+    picoquic_cnx_t* cnx, int target_rank)
+{
+    int ret = 0;
+    int source_rank = -1;
+    picoquic_cnxid_forward_t* forward_first = NULL;
+    picoquic_cnx_handoff_t* handoff = NULL;
+
+    for (int i = 0; i < pool->nb_threads; i++) {
+        if (pool->threads[i]->quic == cnx->quic) {
+            source_rank = i;
+            break;
+        }
+    }
+
+    if (source_rank < 0 || target_rank < 0 || target_rank >= pool->nb_threads ||
+        target_rank == source_rank ||
+        !pool->threads[target_rank]->mailbox_enabled ||
+        cnx->cnx_state != picoquic_state_ready) {
+        /* Only fully established connections move: mid handshake state
+         * is still tied to the source context's TLS queues. */
+        ret = -1;
+    }
+    else if ((handoff = (picoquic_cnx_handoff_t*)malloc(sizeof(picoquic_cnx_handoff_t))) == NULL) {
+        ret = -1;
+    }
+    else {
+        /* Record every live local CID before detaching, so the move is
+         * all or nothing under allocation failure. */
+        picoquic_local_cnxid_list_t* local_cnxid_list = cnx->first_local_cnxid_list;
+
+        while (ret == 0 && local_cnxid_list != NULL) {
+            picoquic_local_cnxid_t* l_cid = local_cnxid_list->local_cnxid_first;
+
+            while (ret == 0 && l_cid != NULL) {
+                if (l_cid->cnx_id.id_len > 0) {
+                    picoquic_cnxid_forward_t* fwd = (picoquic_cnxid_forward_t*)malloc(
+                        sizeof(picoquic_cnxid_forward_t));
+
+                    if (fwd == NULL) {
+                        ret = -1;
+                    }
+                    else {
+                        fwd->cnx_id = l_cid->cnx_id;
+                        fwd->target_rank = target_rank;
+                        fwd->next = forward_first;
+                        forward_first = fwd;
+                    }
+                }
+                l_cid = l_cid->next;
+            }
+            local_cnxid_list = local_cnxid_list->next_list;
+        }
+
+        if (ret != 0) {
+            free(handoff);
+        }
+        else {
+            if (forward_first != NULL) {
+                picoquic_shard_route_ctx_t* route_ctx = &pool->route_ctx[source_rank];
+                picoquic_cnxid_forward_t* last = forward_first;
+
+                while (last->next != NULL) {
+                    last = last->next;
+                }
+                last->next = route_ctx->forward_first;
+                route_ctx->forward_first = forward_first;
+                forward_first = NULL;
+            }
+
+            picoquic_detach_cnx(cnx);
+            handoff->cnx = cnx;
+            (void)picoquic_lockfree_stack_push(&pool->threads[target_rank]->handoffs.head,
+                handoff, (void**)&handoff->next);
+            (void)picoquic_wake_up_network_thread(pool->threads[target_rank]);
+        }
+    }
+
+    while (forward_first != NULL) {
+        picoquic_cnxid_forward_t* next = forward_first->next;
+        free(forward_first);
+        forward_first = next;
+    }
+
+    return ret;
+}
+
+void picoquic_delete_network_thread_pool(picoquic_network_thread_pool_t* pool)
+{
+    if (pool != NULL) {
+        if (pool->threads != NULL) {
+            for (int i = 0; i < pool->nb_threads; i++) {
+                if (pool->threads[i] != NULL) {
+                    /* Uninstall the reroute callback before its context
+                     * and target mailboxes are freed, and detach the
+                     * shard from the shared packet pool before the pool
+                     * itself is deleted. */
+                    picoquic_set_shard_reroute_fn(pool->threads[i]->quic, NULL, NULL);
+                    (void)picoquic_attach_packet_pool(pool->threads[i]->quic, NULL, 0);
+                    picoquic_attach_token_registry(pool->threads[i]->quic, NULL);
+                    picoquic_delete_network_thread(pool->threads[i]);
+                }
+            }
+            free(pool->threads);
+        }
+        picoquic_delete_shared_packet_pool(pool->packet_pool);
+        picoquic_delete_shared_token_registry(pool->token_registry);
+        if (pool->params != NULL) {
+            free(pool->params);
+        }
+        if (pool->route_ctx != NULL) {
+            for (int i = 0; i < pool->nb_threads; i++) {
+                while (pool->route_ctx[i].forward_first != NULL) {
+                    picoquic_cnxid_forward_t* fwd = pool->route_ctx[i].forward_first;
+                    pool->route_ctx[i].forward_first = fwd->next;
+                    free(fwd);
+                }
+            }
+            free(pool->route_ctx);
+        }
+        free(pool);
+    }
+}
+
+picoquic_network_thread_pool_t* picoquic_start_network_thread_pool(
+    picoquic_quic_t** quic_shards, int nb_shards,
+    picoquic_packet_loop_param_t* param,
+    picoquic_packet_loop_cb_fn loop_callback, void** loop_callback_ctx,
+    int* ret)
+{
+    picoquic_network_thread_pool_t* pool = NULL;
+
+    *ret = 0;
+
+    if (nb_shards < 1 || nb_shards > 256 || param->local_port == 0) {
+        /* The shard index must fit in one CID byte, and the shards cannot
+         * share a port that the first socket would pick at random. */
+        *ret = -1;
+    }
+    else if ((pool = (picoquic_network_thread_pool_t*)malloc(sizeof(picoquic_network_thread_pool_t))) == NULL) {
+        *ret = -1;
+    }
+    else {
+        memset(pool, 0, sizeof(picoquic_network_thread_pool_t));
+        /* Share recycled packet objects between the shards, so memory
+         * allocated on a busy shard can be reused by the others. A 64
+         * packet cache per shard keeps the shared lock off the hot path.
+         * Failure is not fatal: shards fall back to private lists. */
+        pool->packet_pool = picoquic_create_shared_packet_pool(0);
+        /* Share the token reuse state, so a replayed NEW_TOKEN is caught
+         * even when the kernel hashes the client to a different shard.
+         * Failure is not fatal: each shard then checks on its own. */
+        pool->token_registry = picoquic_create_shared_token_registry();
+        if ((pool->threads = (picoquic_network_thread_ctx_t**)malloc(
+            nb_shards * sizeof(picoquic_network_thread_ctx_t*))) == NULL ||
+            (pool->params = (picoquic_packet_loop_param_t*)malloc(
+                nb_shards * sizeof(picoquic_packet_loop_param_t))) == NULL ||
+            (pool->route_ctx = (picoquic_shard_route_ctx_t*)malloc(
+                nb_shards * sizeof(picoquic_shard_route_ctx_t))) == NULL) {
+            *ret = -1;
+        }
+        else {
+            memset(pool->threads, 0, nb_shards * sizeof(picoquic_network_thread_ctx_t*));
+
+            for (int i = 0; *ret == 0 && i < nb_shards; i++) {
+                picoquic_load_balancer_config_t lb_config;
+
+                memset(&lb_config, 0, sizeof(lb_config));
+                lb_config.method = picoquic_load_balancer_cid_clear;
+                lb_config.server_id_length = 1;
+                lb_config.connection_id_length = quic_shards[i]->local_cnxid_length;
+                lb_config.server_id64 = (uint64_t)i;
+
+                if (picoquic_lb_compat_cid_config(quic_shards[i], &lb_config) != 0) {
+                    DBG_PRINTF("Cannot configure CID encoding for shard %d", i);
+                    *ret = -1;
+                }
+                else {
+                    pool->route_ctx[i].pool = pool;
+                    pool->route_ctx[i].shard_rank = i;
+                    pool->route_ctx[i].forward_first = NULL;
+                    picoquic_set_shard_reroute_fn(quic_shards[i],
+                        picoquic_pool_shard_reroute, &pool->route_ctx[i]);
+                    if (pool->packet_pool != NULL) {
+                        (void)picoquic_attach_packet_pool(quic_shards[i],
+                            pool->packet_pool, 64);
+                    }
+                    if (pool->token_registry != NULL) {
+                        picoquic_attach_token_registry(quic_shards[i], pool->token_registry);
+                    }
+                    pool->params[i] = *param;
+                    pool->params[i].use_so_reuseport = 1;
+                    pool->threads[i] = picoquic_start_network_thread(quic_shards[i],
+                        &pool->params[i], loop_callback,
+                        (loop_callback_ctx == NULL) ? NULL : loop_callback_ctx[i], ret);
+                    if (pool->threads[i] != NULL) {
+                        pool->nb_threads = i + 1;
+                        if (picoquic_packet_mailbox_init(&pool->threads[i]->mailbox) == 0) {
+                            pool->threads[i]->mailbox_enabled = 1;
+                        }
+                        else {
+                            *ret = -1;
+                        }
+                    }
+                    else if (*ret == 0) {
+                        *ret = -1;
+                    }
+                }
+            }
+        }
+
+        if (*ret != 0) {
+            picoquic_delete_network_thread_pool(pool);
+            pool = NULL;
+        }
+    }
+
+    return pool;
 }
\ No newline at end of file
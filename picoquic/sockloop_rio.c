@@ -0,0 +1,646 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Registered I/O (RIO) based implementation of the packet loop, for
+ * Windows. Instead of one overlapped WSARecvMsg/WSASendMsg per
+ * datagram, the loop registers fixed buffer slabs once, keeps a set of
+ * receive requests posted on each socket, and drains completions from
+ * a single completion queue. In steady state the kernel never locks or
+ * maps buffers per operation, which is where most of the per datagram
+ * cost of overlapped I/O goes.
+ *
+ * The loop is selected by setting the "use_rio" flag in
+ * picoquic_packet_loop_param_t. It is only compiled if the library is
+ * built with PICOQUIC_WITH_RIO (cmake option WITH_RIO); if the flag is
+ * set but the support is not compiled in, picoquic_packet_loop_v2
+ * falls back to the overlapped I/O loop.
+ */
+
+#ifdef _WINDOWS
+
+#define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
+#include <Windows.h>
+#include <mswsock.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ws2def.h>
+#include <ws2tcpip.h>
+
+#include "picosocks.h"
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_packet_loop.h"
+#include "picoquic_unified_log.h"
+
+#ifdef PICOQUIC_WITH_RIO
+
+#define PICOQUIC_RIO_RECV_PER_SOCKET 16
+#define PICOQUIC_RIO_SEND_POOL 32
+#define PICOQUIC_RIO_RECV_BUFFER_SIZE 1536
+#define PICOQUIC_RIO_CONTROL_SIZE 256
+#define PICOQUIC_RIO_MAX_RESULTS 64
+
+typedef enum {
+    picoquic_rio_op_recv = 0,
+    picoquic_rio_op_send
+} picoquic_rio_op_enum;
+
+typedef struct st_picoquic_rio_op_t {
+    picoquic_rio_op_enum op_type;
+    int socket_rank;
+    RIO_BUF data;
+    RIO_BUF remote_addr;
+    RIO_BUF control;
+    uint8_t* data_ptr;
+    SOCKADDR_INET* remote_addr_ptr;
+    uint8_t* control_ptr;
+    size_t data_size;
+    struct st_picoquic_rio_op_t* next_free;
+} picoquic_rio_op_t;
+
+typedef struct st_picoquic_rio_socket_t {
+    SOCKET_TYPE fd;
+    int af;
+    uint16_t port;
+    uint16_t n_port;
+    RIO_RQ rq;
+} picoquic_rio_socket_t;
+
+typedef struct st_picoquic_rio_ctx_t {
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+    RIO_CQ cq;
+    HANDLE completion_event;
+    picoquic_rio_socket_t sockets[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    int nb_sockets;
+    /* One slab per kind of memory, each registered once */
+    uint8_t* recv_slab;
+    uint8_t* send_slab;
+    uint8_t* addr_slab;
+    uint8_t* control_slab;
+    RIO_BUFFERID recv_slab_id;
+    RIO_BUFFERID send_slab_id;
+    RIO_BUFFERID addr_slab_id;
+    RIO_BUFFERID control_slab_id;
+    size_t send_buffer_size;
+    picoquic_rio_op_t* recv_ops;
+    int nb_recv_ops;
+    picoquic_rio_op_t* send_ops;
+    picoquic_rio_op_t* send_free_list;
+} picoquic_rio_ctx_t;
+
+/* Open one socket in RIO mode. The standard socket helpers are reused
+ * for the options and the binding; only the creation flag differs from
+ * the overlapped loop. */
+static int picoquic_rio_open_socket(picoquic_rio_socket_t* rio_socket,
+    int af, uint16_t port, int socket_buffer_size)
+{
+    int ret = 0;
+    int recv_set = 0;
+    int send_set = 0;
+    struct sockaddr_storage local_address;
+
+    rio_socket->af = af;
+    rio_socket->fd = WSASocket(af, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+
+    if (rio_socket->fd == INVALID_SOCKET ||
+        picoquic_socket_set_ecn_options(rio_socket->fd, af, &recv_set, &send_set) != 0 ||
+        picoquic_socket_set_pkt_info(rio_socket->fd, af) != 0 ||
+        picoquic_bind_to_port(rio_socket->fd, af, port) != 0 ||
+        picoquic_get_local_address(rio_socket->fd, &local_address) != 0) {
+        DBG_PRINTF("Cannot set RIO socket (af=%d, port = %d)\n", af, port);
+        ret = -1;
+    }
+    else {
+        if (local_address.ss_family == AF_INET6) {
+            rio_socket->port = ntohs(((struct sockaddr_in6*)&local_address)->sin6_port);
+        }
+        else if (local_address.ss_family == AF_INET) {
+            rio_socket->port = ntohs(((struct sockaddr_in*)&local_address)->sin_port);
+        }
+        rio_socket->n_port = htons(rio_socket->port);
+
+        if (socket_buffer_size > 0) {
+            int opt_len = sizeof(int);
+            (void)setsockopt(rio_socket->fd, SOL_SOCKET, SO_SNDBUF, (const char*)&socket_buffer_size, opt_len);
+            (void)setsockopt(rio_socket->fd, SOL_SOCKET, SO_RCVBUF, (const char*)&socket_buffer_size, opt_len);
+        }
+    }
+
+    return ret;
+}
+
+static int picoquic_rio_submit_recv(picoquic_rio_ctx_t* rio_ctx, picoquic_rio_op_t* op)
+{
+    DWORD flags = 0;
+
+    /* RIO does not report the length of the received control data, so
+     * the buffer is zeroed before posting and the parser stops at the
+     * first empty cmsg header. */
+    memset(op->control_ptr, 0, PICOQUIC_RIO_CONTROL_SIZE);
+    op->remote_addr.Length = sizeof(SOCKADDR_INET);
+    op->control.Length = PICOQUIC_RIO_CONTROL_SIZE;
+
+    if (!rio_ctx->rio.RIOReceiveEx(rio_ctx->sockets[op->socket_rank].rq,
+        &op->data, 1, NULL, &op->remote_addr, &op->control, NULL, flags, op)) {
+        DBG_PRINTF("RIOReceiveEx fails, error: %d", WSAGetLastError());
+        return -1;
+    }
+
+    return 0;
+}
+
+static int picoquic_rio_submit_send(picoquic_rio_ctx_t* rio_ctx, picoquic_rio_op_t* op,
+    size_t send_length, size_t send_msg_size,
+    struct sockaddr* addr_dest, struct sockaddr* addr_from, int dest_if)
+{
+    WSAMSG msg;
+
+    /* Borrow the shared cmsg formatting: only the control buffer of the
+     * WSAMSG is used, pointing into the registered control slab. */
+    memset(&msg, 0, sizeof(msg));
+    msg.Control.buf = (char*)op->control_ptr;
+    msg.Control.len = PICOQUIC_RIO_CONTROL_SIZE;
+    picoquic_socks_cmsg_format(&msg, send_length, send_msg_size, addr_dest, addr_from, dest_if, 0);
+
+    op->data.Length = (ULONG)send_length;
+    op->control.Length = msg.Control.len;
+    memset(op->remote_addr_ptr, 0, sizeof(SOCKADDR_INET));
+    memcpy(op->remote_addr_ptr, addr_dest, (addr_dest->sa_family == AF_INET6) ?
+        sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    op->remote_addr.Length = sizeof(SOCKADDR_INET);
+
+    if (!rio_ctx->rio.RIOSendEx(rio_ctx->sockets[op->socket_rank].rq,
+        &op->data, 1, NULL, &op->remote_addr,
+        (msg.Control.len > 0) ? &op->control : NULL, NULL, 0, op)) {
+        DBG_PRINTF("RIOSendEx fails, error: %d", WSAGetLastError());
+        return -1;
+    }
+
+    return 0;
+}
+
+static void picoquic_rio_ctx_release(picoquic_rio_ctx_t* rio_ctx)
+{
+    if (rio_ctx->recv_slab_id != RIO_INVALID_BUFFERID) {
+        rio_ctx->rio.RIODeregisterBuffer(rio_ctx->recv_slab_id);
+    }
+    if (rio_ctx->send_slab_id != RIO_INVALID_BUFFERID) {
+        rio_ctx->rio.RIODeregisterBuffer(rio_ctx->send_slab_id);
+    }
+    if (rio_ctx->addr_slab_id != RIO_INVALID_BUFFERID) {
+        rio_ctx->rio.RIODeregisterBuffer(rio_ctx->addr_slab_id);
+    }
+    if (rio_ctx->control_slab_id != RIO_INVALID_BUFFERID) {
+        rio_ctx->rio.RIODeregisterBuffer(rio_ctx->control_slab_id);
+    }
+    if (rio_ctx->cq != RIO_INVALID_CQ) {
+        rio_ctx->rio.RIOCloseCompletionQueue(rio_ctx->cq);
+    }
+    if (rio_ctx->completion_event != NULL) {
+        CloseHandle(rio_ctx->completion_event);
+    }
+    for (int i = 0; i < rio_ctx->nb_sockets; i++) {
+        if (rio_ctx->sockets[i].fd != INVALID_SOCKET) {
+            closesocket(rio_ctx->sockets[i].fd);
+        }
+    }
+    free(rio_ctx->recv_slab);
+    free(rio_ctx->send_slab);
+    free(rio_ctx->addr_slab);
+    free(rio_ctx->control_slab);
+    free(rio_ctx->recv_ops);
+    free(rio_ctx->send_ops);
+    memset(rio_ctx, 0, sizeof(picoquic_rio_ctx_t));
+}
+
+static int picoquic_rio_ctx_init(picoquic_rio_ctx_t* rio_ctx,
+    picoquic_packet_loop_param_t* param, size_t send_buffer_size)
+{
+    int ret = 0;
+    GUID rio_guid = WSAID_MULTIPLE_RIO;
+    DWORD nb_bytes = 0;
+    int nb_af;
+    int af[2];
+    int nb_ops;
+    size_t nb_addr;
+    RIO_NOTIFICATION_COMPLETION notification;
+
+    memset(rio_ctx, 0, sizeof(picoquic_rio_ctx_t));
+    rio_ctx->cq = RIO_INVALID_CQ;
+    rio_ctx->recv_slab_id = RIO_INVALID_BUFFERID;
+    rio_ctx->send_slab_id = RIO_INVALID_BUFFERID;
+    rio_ctx->addr_slab_id = RIO_INVALID_BUFFERID;
+    rio_ctx->control_slab_id = RIO_INVALID_BUFFERID;
+    rio_ctx->send_buffer_size = send_buffer_size;
+    for (int i = 0; i < PICOQUIC_PACKET_LOOP_SOCKETS_MAX; i++) {
+        rio_ctx->sockets[i].fd = INVALID_SOCKET;
+    }
+
+    if (param->local_af == 0) {
+        nb_af = 2;
+        af[0] = AF_INET;
+        af[1] = AF_INET6;
+    }
+    else {
+        nb_af = 1;
+        af[0] = param->local_af;
+    }
+
+    for (int i = 0; ret == 0 && i < nb_af; i++) {
+        ret = picoquic_rio_open_socket(&rio_ctx->sockets[i], af[i],
+            (uint16_t)param->local_port, param->socket_buffer_size);
+        if (ret == 0) {
+            rio_ctx->nb_sockets = i + 1;
+        }
+    }
+
+    if (ret == 0 &&
+        WSAIoctl(rio_ctx->sockets[0].fd, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+            &rio_guid, sizeof(rio_guid),
+            &rio_ctx->rio, sizeof(rio_ctx->rio), &nb_bytes, NULL, NULL) != 0) {
+        DBG_PRINTF("Cannot load the RIO function table, error: %d", WSAGetLastError());
+        ret = -1;
+    }
+
+    rio_ctx->nb_recv_ops = rio_ctx->nb_sockets * PICOQUIC_RIO_RECV_PER_SOCKET;
+    nb_ops = rio_ctx->nb_recv_ops + PICOQUIC_RIO_SEND_POOL;
+    nb_addr = (size_t)nb_ops;
+
+    /* Create the completion queue and its notification event */
+    if (ret == 0) {
+        rio_ctx->completion_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (rio_ctx->completion_event == NULL) {
+            ret = -1;
+        }
+        else {
+            notification.Type = RIO_EVENT_COMPLETION;
+            notification.Event.EventHandle = rio_ctx->completion_event;
+            notification.Event.NotifyReset = TRUE;
+            rio_ctx->cq = rio_ctx->rio.RIOCreateCompletionQueue(nb_ops, &notification);
+            if (rio_ctx->cq == RIO_INVALID_CQ) {
+                DBG_PRINTF("RIOCreateCompletionQueue fails, error: %d", WSAGetLastError());
+                ret = -1;
+            }
+        }
+    }
+
+    /* Create one request queue per socket, sharing the completion queue */
+    for (int i = 0; ret == 0 && i < rio_ctx->nb_sockets; i++) {
+        rio_ctx->sockets[i].rq = rio_ctx->rio.RIOCreateRequestQueue(
+            rio_ctx->sockets[i].fd,
+            PICOQUIC_RIO_RECV_PER_SOCKET, 1,
+            PICOQUIC_RIO_SEND_POOL, 1,
+            rio_ctx->cq, rio_ctx->cq, &rio_ctx->sockets[i]);
+        if (rio_ctx->sockets[i].rq == RIO_INVALID_RQ) {
+            DBG_PRINTF("RIOCreateRequestQueue fails, error: %d", WSAGetLastError());
+            ret = -1;
+        }
+    }
+
+    /* Allocate and register the buffer slabs */
+    if (ret == 0) {
+        size_t recv_slab_size = (size_t)rio_ctx->nb_recv_ops * PICOQUIC_RIO_RECV_BUFFER_SIZE;
+        size_t send_slab_size = (size_t)PICOQUIC_RIO_SEND_POOL * send_buffer_size;
+        size_t addr_slab_size = nb_addr * sizeof(SOCKADDR_INET);
+        size_t control_slab_size = (size_t)nb_ops * PICOQUIC_RIO_CONTROL_SIZE;
+
+        if ((rio_ctx->recv_slab = (uint8_t*)malloc(recv_slab_size)) == NULL ||
+            (rio_ctx->send_slab = (uint8_t*)malloc(send_slab_size)) == NULL ||
+            (rio_ctx->addr_slab = (uint8_t*)malloc(addr_slab_size)) == NULL ||
+            (rio_ctx->control_slab = (uint8_t*)malloc(control_slab_size)) == NULL ||
+            (rio_ctx->recv_ops = (picoquic_rio_op_t*)malloc(
+                (size_t)rio_ctx->nb_recv_ops * sizeof(picoquic_rio_op_t))) == NULL ||
+            (rio_ctx->send_ops = (picoquic_rio_op_t*)malloc(
+                (size_t)PICOQUIC_RIO_SEND_POOL * sizeof(picoquic_rio_op_t))) == NULL) {
+            ret = -1;
+        }
+        else if ((rio_ctx->recv_slab_id = rio_ctx->rio.RIORegisterBuffer(
+                (PCHAR)rio_ctx->recv_slab, (DWORD)recv_slab_size)) == RIO_INVALID_BUFFERID ||
+            (rio_ctx->send_slab_id = rio_ctx->rio.RIORegisterBuffer(
+                (PCHAR)rio_ctx->send_slab, (DWORD)send_slab_size)) == RIO_INVALID_BUFFERID ||
+            (rio_ctx->addr_slab_id = rio_ctx->rio.RIORegisterBuffer(
+                (PCHAR)rio_ctx->addr_slab, (DWORD)addr_slab_size)) == RIO_INVALID_BUFFERID ||
+            (rio_ctx->control_slab_id = rio_ctx->rio.RIORegisterBuffer(
+                (PCHAR)rio_ctx->control_slab, (DWORD)control_slab_size)) == RIO_INVALID_BUFFERID) {
+            DBG_PRINTF("RIORegisterBuffer fails, error: %d", WSAGetLastError());
+            ret = -1;
+        }
+    }
+
+    /* Carve the slabs into operation slots and post the receives */
+    if (ret == 0) {
+        int op_rank = 0;
+
+        memset(rio_ctx->recv_ops, 0, (size_t)rio_ctx->nb_recv_ops * sizeof(picoquic_rio_op_t));
+        memset(rio_ctx->send_ops, 0, (size_t)PICOQUIC_RIO_SEND_POOL * sizeof(picoquic_rio_op_t));
+
+        for (int i = 0; ret == 0 && i < rio_ctx->nb_recv_ops; i++, op_rank++) {
+            picoquic_rio_op_t* op = &rio_ctx->recv_ops[i];
+
+            op->op_type = picoquic_rio_op_recv;
+            op->socket_rank = i / PICOQUIC_RIO_RECV_PER_SOCKET;
+            op->data_size = PICOQUIC_RIO_RECV_BUFFER_SIZE;
+            op->data_ptr = rio_ctx->recv_slab + (size_t)i * PICOQUIC_RIO_RECV_BUFFER_SIZE;
+            op->data.BufferId = rio_ctx->recv_slab_id;
+            op->data.Offset = (ULONG)((size_t)i * PICOQUIC_RIO_RECV_BUFFER_SIZE);
+            op->data.Length = PICOQUIC_RIO_RECV_BUFFER_SIZE;
+            op->remote_addr_ptr = (SOCKADDR_INET*)(rio_ctx->addr_slab + (size_t)op_rank * sizeof(SOCKADDR_INET));
+            op->remote_addr.BufferId = rio_ctx->addr_slab_id;
+            op->remote_addr.Offset = (ULONG)((size_t)op_rank * sizeof(SOCKADDR_INET));
+            op->remote_addr.Length = sizeof(SOCKADDR_INET);
+            op->control_ptr = rio_ctx->control_slab + (size_t)op_rank * PICOQUIC_RIO_CONTROL_SIZE;
+            op->control.BufferId = rio_ctx->control_slab_id;
+            op->control.Offset = (ULONG)((size_t)op_rank * PICOQUIC_RIO_CONTROL_SIZE);
+            op->control.Length = PICOQUIC_RIO_CONTROL_SIZE;
+
+            ret = picoquic_rio_submit_recv(rio_ctx, op);
+        }
+
+        for (int i = 0; ret == 0 && i < PICOQUIC_RIO_SEND_POOL; i++, op_rank++) {
+            picoquic_rio_op_t* op = &rio_ctx->send_ops[i];
+
+            op->op_type = picoquic_rio_op_send;
+            op->data_size = send_buffer_size;
+            op->data_ptr = rio_ctx->send_slab + (size_t)i * send_buffer_size;
+            op->data.BufferId = rio_ctx->send_slab_id;
+            op->data.Offset = (ULONG)((size_t)i * send_buffer_size);
+            op->data.Length = (ULONG)send_buffer_size;
+            op->remote_addr_ptr = (SOCKADDR_INET*)(rio_ctx->addr_slab + (size_t)op_rank * sizeof(SOCKADDR_INET));
+            op->remote_addr.BufferId = rio_ctx->addr_slab_id;
+            op->remote_addr.Offset = (ULONG)((size_t)op_rank * sizeof(SOCKADDR_INET));
+            op->remote_addr.Length = sizeof(SOCKADDR_INET);
+            op->control_ptr = rio_ctx->control_slab + (size_t)op_rank * PICOQUIC_RIO_CONTROL_SIZE;
+            op->control.BufferId = rio_ctx->control_slab_id;
+            op->control.Offset = (ULONG)((size_t)op_rank * PICOQUIC_RIO_CONTROL_SIZE);
+            op->control.Length = 0;
+            op->next_free = rio_ctx->send_free_list;
+            rio_ctx->send_free_list = op;
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_rio_ctx_release(rio_ctx);
+    }
+
+    return ret;
+}
+
+/* Parse the control buffer of a completed receive. The shared cmsg
+ * parser expects a WSAMSG; only the control members are needed. The
+ * valid control length is recovered by walking the cmsg chain, which
+ * the zeroed buffer terminates. */
+static void picoquic_rio_parse_control(picoquic_rio_op_t* op,
+    struct sockaddr_storage* addr_dest, int* dest_if, unsigned char* received_ecn)
+{
+    WSAMSG msg;
+    DWORD control_length = 0;
+
+    while (control_length + sizeof(WSACMSGHDR) <= PICOQUIC_RIO_CONTROL_SIZE) {
+        WSACMSGHDR* cmsg = (WSACMSGHDR*)(op->control_ptr + control_length);
+        if (cmsg->cmsg_len < sizeof(WSACMSGHDR) ||
+            control_length + WSA_CMSGHDR_ALIGN(cmsg->cmsg_len) > PICOQUIC_RIO_CONTROL_SIZE) {
+            break;
+        }
+        control_length += (DWORD)WSA_CMSGHDR_ALIGN(cmsg->cmsg_len);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.Control.buf = (char*)op->control_ptr;
+    msg.Control.len = control_length;
+    picoquic_socks_cmsg_parse(&msg, addr_dest, dest_if, received_ecn, NULL);
+}
+
+int picoquic_packet_loop_rio(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_quic_t* quic = thread_ctx->quic;
+    picoquic_packet_loop_param_t* param = thread_ctx->param;
+    picoquic_packet_loop_cb_fn loop_callback = thread_ctx->loop_callback;
+    void* loop_callback_ctx = thread_ctx->loop_callback_ctx;
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    int64_t delay_max = 10000000;
+    size_t send_buffer_size = param->socket_buffer_size;
+    size_t send_msg_size = 0;
+    size_t* send_msg_ptr = (param->do_not_use_gso) ? NULL : &send_msg_size;
+    picoquic_connection_id_t log_cid;
+    picoquic_cnx_t* last_cnx = NULL;
+    picoquic_packet_loop_options_t options = { 0 };
+    picoquic_rio_ctx_t rio_ctx;
+    int rio_ready = 0;
+
+    if (send_buffer_size == 0) {
+        send_buffer_size = 0xffff;
+    }
+
+    ret = picoquic_rio_ctx_init(&rio_ctx, param, send_buffer_size);
+    rio_ready = (ret == 0);
+
+    if (ret == 0 && loop_callback != NULL) {
+        struct sockaddr_storage l_addr;
+        ret = loop_callback(quic, picoquic_packet_loop_ready, loop_callback_ctx, &options);
+        if (picoquic_store_loopback_addr(&l_addr, rio_ctx.sockets[0].af, rio_ctx.sockets[0].port) == 0) {
+            ret = loop_callback(quic, picoquic_packet_loop_port_update, loop_callback_ctx, &l_addr);
+        }
+    }
+
+    if (ret == 0) {
+        thread_ctx->thread_is_ready = 1;
+    }
+
+    while (ret == 0 && !thread_ctx->thread_should_close) {
+        RIORESULT results[PICOQUIC_RIO_MAX_RESULTS];
+        HANDLE wait_handles[2];
+        DWORD nb_handles = 1;
+        DWORD wait_ret;
+        DWORD timeout_ms;
+        int64_t delta_t;
+        ULONG nb_results;
+        size_t bytes_recv_total = 0;
+        size_t bytes_sent = 0;
+        size_t nb_packets_sent = 0;
+
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+        delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
+        if (options.do_time_check) {
+            packet_loop_time_check_arg_t time_check_arg;
+            time_check_arg.current_time = current_time;
+            time_check_arg.delta_t = delta_t;
+            ret = loop_callback(quic, picoquic_packet_loop_time_check, loop_callback_ctx, &time_check_arg);
+            if (time_check_arg.delta_t < delta_t) {
+                delta_t = time_check_arg.delta_t;
+            }
+        }
+        if (delta_t < 0) {
+            delta_t = 0;
+        }
+        timeout_ms = (DWORD)((delta_t + 999) / 1000);
+
+        /* Arm the notification, then wait for completions or wake up */
+        (void)rio_ctx.rio.RIONotify(rio_ctx.cq);
+        wait_handles[0] = rio_ctx.completion_event;
+        if (thread_ctx->wake_up_defined) {
+            wait_handles[1] = thread_ctx->wake_up_event;
+            nb_handles = 2;
+        }
+        wait_ret = WSAWaitForMultipleEvents(nb_handles, wait_handles, FALSE, timeout_ms, FALSE);
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+
+        if (wait_ret == WSA_WAIT_FAILED) {
+            ret = (thread_ctx->thread_should_close) ? PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP : -1;
+            continue;
+        }
+        if (nb_handles > 1 && wait_ret == WSA_WAIT_EVENT_0 + 1) {
+            if (ResetEvent(thread_ctx->wake_up_event) == 0) {
+                DBG_PRINTF("Cannot reset network event, error 0x%x", GetLastError());
+                ret = -1;
+            }
+            else if (loop_callback != NULL) {
+                ret = loop_callback(quic, picoquic_packet_loop_wake_up, loop_callback_ctx, NULL);
+            }
+        }
+
+        /* Drain the completion queue */
+        while (ret == 0 &&
+            (nb_results = rio_ctx.rio.RIODequeueCompletion(rio_ctx.cq,
+                results, PICOQUIC_RIO_MAX_RESULTS)) > 0) {
+            if (nb_results == RIO_CORRUPT_CQ) {
+                DBG_PRINTF("%s", "RIO completion queue is corrupt");
+                ret = -1;
+                break;
+            }
+            for (ULONG i = 0; ret == 0 && i < nb_results; i++) {
+                picoquic_rio_op_t* op = (picoquic_rio_op_t*)(uintptr_t)results[i].RequestContext;
+
+                if (op == NULL) {
+                    continue;
+                }
+                if (op->op_type == picoquic_rio_op_recv) {
+                    if (results[i].Status == 0 && results[i].BytesTransferred > 0) {
+                        struct sockaddr_storage addr_dest;
+                        int dest_if = 0;
+                        unsigned char received_ecn = 0;
+
+                        memset(&addr_dest, 0, sizeof(addr_dest));
+                        picoquic_rio_parse_control(op, &addr_dest, &dest_if, &received_ecn);
+                        if (addr_dest.ss_family == AF_INET6) {
+                            ((struct sockaddr_in6*)&addr_dest)->sin6_port = rio_ctx.sockets[op->socket_rank].n_port;
+                        }
+                        else if (addr_dest.ss_family == AF_INET) {
+                            ((struct sockaddr_in*)&addr_dest)->sin_port = rio_ctx.sockets[op->socket_rank].n_port;
+                        }
+                        bytes_recv_total += results[i].BytesTransferred;
+                        ret = picoquic_incoming_packet_ex(quic, op->data_ptr,
+                            results[i].BytesTransferred,
+                            (struct sockaddr*)op->remote_addr_ptr,
+                            (struct sockaddr*)&addr_dest, dest_if, received_ecn,
+                            &last_cnx, current_time);
+                    }
+                    /* Rearm the receive, whether it succeeded or not */
+                    if (ret == 0) {
+                        ret = picoquic_rio_submit_recv(&rio_ctx, op);
+                    }
+                }
+                else {
+                    if (results[i].Status != 0) {
+                        picoquic_log_context_free_app_message(quic, &log_cid,
+                            "RIO send failed, err=%d", results[i].Status);
+                    }
+                    op->next_free = rio_ctx.send_free_list;
+                    rio_ctx.send_free_list = op;
+                }
+            }
+        }
+
+        if (ret == 0 && bytes_recv_total > 0 && loop_callback != NULL) {
+            ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &bytes_recv_total);
+        }
+
+        /* Prepare as many packets as there are free send slots */
+        while (ret == 0 && rio_ctx.send_free_list != NULL &&
+            nb_packets_sent < PICOQUIC_PACKET_LOOP_SEND_MAX) {
+            picoquic_rio_op_t* op = rio_ctx.send_free_list;
+            struct sockaddr_storage peer_addr;
+            struct sockaddr_storage local_addr = { 0 };
+            int if_index = param->dest_if;
+            size_t send_length = 0;
+
+            ret = picoquic_prepare_next_packet_ex(quic, current_time,
+                op->data_ptr, op->data_size, &send_length,
+                &peer_addr, &local_addr, &if_index, &log_cid, &last_cnx,
+                send_msg_ptr);
+
+            if (ret == 0 && send_length > 0) {
+                int send_socket = -1;
+
+                nb_packets_sent += (send_msg_size == 0) ? 1 :
+                    (send_length + send_msg_size - 1) / (send_msg_size);
+                bytes_sent += send_length;
+
+                for (int i = 0; i < rio_ctx.nb_sockets; i++) {
+                    if (rio_ctx.sockets[i].af == peer_addr.ss_family) {
+                        send_socket = i;
+                        break;
+                    }
+                }
+                if (send_socket < 0) {
+                    picoquic_log_context_free_app_message(quic, &log_cid,
+                        "No socket for AF_to=%d", peer_addr.ss_family);
+                }
+                else {
+                    rio_ctx.send_free_list = op->next_free;
+                    op->socket_rank = send_socket;
+                    ret = picoquic_rio_submit_send(&rio_ctx, op,
+                        send_length, send_msg_size,
+                        (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr,
+                        if_index);
+                }
+            }
+            else {
+                break;
+            }
+        }
+
+        if (ret == 0 && loop_callback != NULL) {
+            ret = loop_callback(quic, picoquic_packet_loop_after_send, loop_callback_ctx, &bytes_sent);
+        }
+    }
+
+    thread_ctx->thread_is_ready = 0;
+
+    if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+        ret = 0;
+    }
+
+    if (rio_ready) {
+        picoquic_rio_ctx_release(&rio_ctx);
+    }
+
+    thread_ctx->return_code = ret;
+
+    return ret;
+}
+
+#endif /* PICOQUIC_WITH_RIO */
+#endif /* _WINDOWS */
@@ -0,0 +1,466 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* io_uring based implementation of the packet loop.
+ *
+ * Instead of a select() call followed by one receive and one send system
+ * call per datagram, the loop keeps a set of RECVMSG operations posted on
+ * each socket and a pool of SENDMSG operations for outgoing packets. In
+ * steady state, receiving and sending only costs one io_uring_enter()
+ * call per loop iteration, regardless of the number of datagrams moved.
+ *
+ * The loop is selected by setting the "use_io_uring" flag in
+ * picoquic_packet_loop_param_t. It is only compiled if the library is
+ * built with PICOQUIC_WITH_IOURING (cmake option WITH_IOURING), which
+ * requires liburing; if the flag is set but the support is not compiled
+ * in, picoquic_packet_loop_v2 falls back to the select() based loop.
+ */
+
+#ifndef _WINDOWS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "picosocks.h"
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_packet_loop.h"
+#include "picoquic_unified_log.h"
+
+#ifdef PICOQUIC_WITH_IOURING
+
+#include <liburing.h>
+
+#define PICOQUIC_URING_QUEUE_DEPTH 256
+#define PICOQUIC_URING_RECV_PER_SOCKET 16
+#define PICOQUIC_URING_SEND_POOL 64
+#define PICOQUIC_URING_RECV_BUFFER_SIZE 1536
+
+typedef enum {
+    picoquic_uring_op_recv = 0,
+    picoquic_uring_op_send,
+    picoquic_uring_op_wake_up
+} picoquic_uring_op_enum;
+
+typedef struct st_picoquic_uring_op_t {
+    picoquic_uring_op_enum op_type;
+    int socket_rank;
+    SOCKET_TYPE fd;
+    struct msghdr msg;
+    struct iovec dataBuf;
+    char cmsg_buffer[256];
+    struct sockaddr_storage addr_peer;
+    struct sockaddr_storage addr_local;
+    size_t buffer_size;
+    uint8_t* buffer;
+    struct st_picoquic_uring_op_t* next_free;
+} picoquic_uring_op_t;
+
+typedef struct st_picoquic_uring_ctx_t {
+    struct io_uring ring;
+    picoquic_socket_ctx_t* s_ctx;
+    int nb_sockets;
+    picoquic_uring_op_t* recv_ops;
+    int nb_recv_ops;
+    picoquic_uring_op_t* send_ops;
+    picoquic_uring_op_t* send_free_list;
+    uint64_t wake_up_value; /* 8 bytes: enough for an eventfd counter read */
+} picoquic_uring_ctx_t;
+
+static int picoquic_uring_submit_recv(picoquic_uring_ctx_t* uring_ctx, picoquic_uring_op_t* op)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring_ctx->ring);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    memset(&op->msg, 0, sizeof(op->msg));
+    op->dataBuf.iov_base = (char*)op->buffer;
+    op->dataBuf.iov_len = op->buffer_size;
+    op->msg.msg_name = (struct sockaddr*)&op->addr_peer;
+    op->msg.msg_namelen = sizeof(struct sockaddr_storage);
+    op->msg.msg_iov = &op->dataBuf;
+    op->msg.msg_iovlen = 1;
+    op->msg.msg_control = (void*)op->cmsg_buffer;
+    op->msg.msg_controllen = sizeof(op->cmsg_buffer);
+
+    io_uring_prep_recvmsg(sqe, op->fd, &op->msg, 0);
+    io_uring_sqe_set_data(sqe, op);
+
+    return 0;
+}
+
+static int picoquic_uring_submit_wake_up(picoquic_uring_ctx_t* uring_ctx,
+    picoquic_network_thread_ctx_t* thread_ctx, picoquic_uring_op_t* op)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring_ctx->ring);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    io_uring_prep_read(sqe, thread_ctx->wake_up_pipe_fd[0],
+        &uring_ctx->wake_up_value, sizeof(uring_ctx->wake_up_value), 0);
+    io_uring_sqe_set_data(sqe, op);
+
+    return 0;
+}
+
+static int picoquic_uring_submit_send(picoquic_uring_ctx_t* uring_ctx, picoquic_uring_op_t* op,
+    size_t send_length, size_t send_msg_size, int if_index)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring_ctx->ring);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    memset(&op->msg, 0, sizeof(op->msg));
+    op->dataBuf.iov_base = (char*)op->buffer;
+    op->dataBuf.iov_len = send_length;
+    op->msg.msg_name = (struct sockaddr*)&op->addr_peer;
+    op->msg.msg_namelen = picoquic_addr_length((struct sockaddr*)&op->addr_peer);
+    op->msg.msg_iov = &op->dataBuf;
+    op->msg.msg_iovlen = 1;
+    op->msg.msg_control = (void*)op->cmsg_buffer;
+    op->msg.msg_controllen = sizeof(op->cmsg_buffer);
+    picoquic_socks_cmsg_format(&op->msg, send_length, send_msg_size,
+        (struct sockaddr*)&op->addr_local, if_index);
+
+    io_uring_prep_sendmsg(sqe, op->fd, &op->msg, 0);
+    io_uring_sqe_set_data(sqe, op);
+
+    return 0;
+}
+
+static void picoquic_uring_ctx_release(picoquic_uring_ctx_t* uring_ctx)
+{
+    if (uring_ctx->recv_ops != NULL) {
+        for (int i = 0; i < uring_ctx->nb_recv_ops; i++) {
+            if (uring_ctx->recv_ops[i].buffer != NULL) {
+                free(uring_ctx->recv_ops[i].buffer);
+            }
+        }
+        free(uring_ctx->recv_ops);
+        uring_ctx->recv_ops = NULL;
+    }
+    if (uring_ctx->send_ops != NULL) {
+        for (int i = 0; i < PICOQUIC_URING_SEND_POOL; i++) {
+            if (uring_ctx->send_ops[i].buffer != NULL) {
+                free(uring_ctx->send_ops[i].buffer);
+            }
+        }
+        free(uring_ctx->send_ops);
+        uring_ctx->send_ops = NULL;
+    }
+    io_uring_queue_exit(&uring_ctx->ring);
+}
+
+static int picoquic_uring_ctx_init(picoquic_uring_ctx_t* uring_ctx,
+    picoquic_socket_ctx_t* s_ctx, int nb_sockets, size_t send_buffer_size)
+{
+    int ret = 0;
+
+    memset(uring_ctx, 0, sizeof(picoquic_uring_ctx_t));
+    uring_ctx->s_ctx = s_ctx;
+    uring_ctx->nb_sockets = nb_sockets;
+    uring_ctx->nb_recv_ops = nb_sockets * PICOQUIC_URING_RECV_PER_SOCKET;
+
+    if ((ret = io_uring_queue_init(PICOQUIC_URING_QUEUE_DEPTH, &uring_ctx->ring, 0)) < 0) {
+        DBG_PRINTF("io_uring_queue_init fails, ret=%d", ret);
+        return -1;
+    }
+
+    if ((uring_ctx->recv_ops = (picoquic_uring_op_t*)calloc(uring_ctx->nb_recv_ops,
+            sizeof(picoquic_uring_op_t))) == NULL ||
+        (uring_ctx->send_ops = (picoquic_uring_op_t*)calloc(PICOQUIC_URING_SEND_POOL,
+            sizeof(picoquic_uring_op_t))) == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < uring_ctx->nb_recv_ops; i++) {
+        picoquic_uring_op_t* op = &uring_ctx->recv_ops[i];
+        op->op_type = picoquic_uring_op_recv;
+        op->socket_rank = i / PICOQUIC_URING_RECV_PER_SOCKET;
+        op->fd = s_ctx[op->socket_rank].fd;
+        op->buffer_size = PICOQUIC_URING_RECV_BUFFER_SIZE;
+        if ((op->buffer = (uint8_t*)malloc(op->buffer_size)) == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = picoquic_uring_submit_recv(uring_ctx, op);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < PICOQUIC_URING_SEND_POOL; i++) {
+        picoquic_uring_op_t* op = &uring_ctx->send_ops[i];
+        op->op_type = picoquic_uring_op_send;
+        op->buffer_size = send_buffer_size;
+        if ((op->buffer = (uint8_t*)malloc(op->buffer_size)) == NULL) {
+            ret = -1;
+        }
+        else {
+            op->next_free = uring_ctx->send_free_list;
+            uring_ctx->send_free_list = op;
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_uring_ctx_release(uring_ctx);
+    }
+
+    return ret;
+}
+
+int picoquic_packet_loop_uring(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_quic_t* quic = thread_ctx->quic;
+    picoquic_packet_loop_param_t* param = thread_ctx->param;
+    picoquic_packet_loop_cb_fn loop_callback = thread_ctx->loop_callback;
+    void* loop_callback_ctx = thread_ctx->loop_callback_ctx;
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    int64_t delay_max = 10000000;
+    size_t send_buffer_size = param->socket_buffer_size;
+    size_t send_msg_size = 0;
+    size_t* send_msg_ptr = (param->do_not_use_gso) ? NULL : &send_msg_size;
+    picoquic_socket_ctx_t s_ctx[PICOQUIC_PACKET_LOOP_SOCKETS_MAX];
+    int nb_sockets = 0;
+    picoquic_connection_id_t log_cid;
+    picoquic_cnx_t* last_cnx = NULL;
+    picoquic_packet_loop_options_t options = { 0 };
+    picoquic_uring_ctx_t uring_ctx;
+    picoquic_uring_op_t wake_up_op;
+    int uring_ready = 0;
+
+    if (send_buffer_size == 0) {
+        send_buffer_size = 0xffff;
+    }
+
+    memset(s_ctx, 0, sizeof(s_ctx));
+    memset(&wake_up_op, 0, sizeof(wake_up_op));
+    wake_up_op.op_type = picoquic_uring_op_wake_up;
+
+    if ((nb_sockets = picoquic_packet_loop_open_sockets_ex(param->local_port,
+        param->local_af, param->socket_buffer_size,
+        param->extra_socket_required, param->do_not_use_gso,
+        param->use_so_reuseport, s_ctx)) <= 0) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else if (loop_callback != NULL) {
+        struct sockaddr_storage l_addr;
+        ret = loop_callback(quic, picoquic_packet_loop_ready, loop_callback_ctx, &options);
+        if (picoquic_store_loopback_addr(&l_addr, s_ctx[0].af, s_ctx[0].port) == 0) {
+            ret = loop_callback(quic, picoquic_packet_loop_port_update, loop_callback_ctx, &l_addr);
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_uring_ctx_init(&uring_ctx, s_ctx, nb_sockets, send_buffer_size);
+        uring_ready = (ret == 0);
+    }
+
+    if (ret == 0 && thread_ctx->wake_up_defined) {
+        ret = picoquic_uring_submit_wake_up(&uring_ctx, thread_ctx, &wake_up_op);
+    }
+
+    if (ret == 0) {
+        thread_ctx->thread_is_ready = 1;
+    }
+
+    while (ret == 0 && !thread_ctx->thread_should_close) {
+        struct io_uring_cqe* cqe = NULL;
+        struct __kernel_timespec ts;
+        int64_t delta_t;
+        int wait_ret;
+        size_t bytes_recv_total = 0;
+        size_t bytes_sent = 0;
+        size_t nb_packets_sent = 0;
+
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+        delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
+        if (options.do_time_check) {
+            packet_loop_time_check_arg_t time_check_arg;
+            time_check_arg.current_time = current_time;
+            time_check_arg.delta_t = delta_t;
+            ret = loop_callback(quic, picoquic_packet_loop_time_check, loop_callback_ctx, &time_check_arg);
+            if (time_check_arg.delta_t < delta_t) {
+                delta_t = time_check_arg.delta_t;
+            }
+        }
+        if (delta_t < 0) {
+            delta_t = 0;
+        }
+        ts.tv_sec = delta_t / 1000000;
+        ts.tv_nsec = (delta_t % 1000000) * 1000;
+
+        /* Flush pending submissions and wait for the first completion */
+        wait_ret = io_uring_submit_and_wait_timeout(&uring_ctx.ring, &cqe, 1, &ts, NULL);
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+
+        if (wait_ret < 0 && wait_ret != -ETIME && wait_ret != -EINTR) {
+            DBG_PRINTF("io_uring wait fails, ret=%d", wait_ret);
+            ret = (thread_ctx->thread_should_close) ? PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP : -1;
+        }
+        else {
+            /* Drain the completion queue */
+            unsigned int head;
+            unsigned int nb_cqe = 0;
+
+            io_uring_for_each_cqe(&uring_ctx.ring, head, cqe) {
+                picoquic_uring_op_t* op = (picoquic_uring_op_t*)io_uring_cqe_get_data(cqe);
+                nb_cqe++;
+
+                if (op == NULL) {
+                    continue;
+                }
+                switch (op->op_type) {
+                case picoquic_uring_op_recv:
+                    if (cqe->res > 0 && ret == 0) {
+                        struct sockaddr_storage addr_dest;
+                        int dest_if = 0;
+                        unsigned char received_ecn = 0;
+
+                        memset(&addr_dest, 0, sizeof(addr_dest));
+                        picoquic_socks_cmsg_parse(&op->msg, &addr_dest, &dest_if, &received_ecn, NULL);
+                        /* Document incoming port */
+                        if (addr_dest.ss_family == AF_INET6) {
+                            ((struct sockaddr_in6*)&addr_dest)->sin6_port = s_ctx[op->socket_rank].n_port;
+                        }
+                        else if (addr_dest.ss_family == AF_INET) {
+                            ((struct sockaddr_in*)&addr_dest)->sin_port = s_ctx[op->socket_rank].n_port;
+                        }
+                        bytes_recv_total += (size_t)cqe->res;
+                        ret = picoquic_incoming_packet_ex(quic, op->buffer,
+                            (size_t)cqe->res, (struct sockaddr*)&op->addr_peer,
+                            (struct sockaddr*)&addr_dest, dest_if, received_ecn,
+                            &last_cnx, current_time);
+                    }
+                    /* Rearm the receive operation, whether it succeeded or not */
+                    if (ret == 0) {
+                        ret = picoquic_uring_submit_recv(&uring_ctx, op);
+                    }
+                    break;
+                case picoquic_uring_op_send:
+                    if (cqe->res < 0) {
+                        picoquic_log_context_free_app_message(quic, &log_cid,
+                            "Async send failed, AF_to=%d, err=%d",
+                            op->addr_peer.ss_family, -cqe->res);
+                    }
+                    op->next_free = uring_ctx.send_free_list;
+                    uring_ctx.send_free_list = op;
+                    break;
+                case picoquic_uring_op_wake_up:
+                    if (ret == 0 && loop_callback != NULL) {
+                        ret = loop_callback(quic, picoquic_packet_loop_wake_up, loop_callback_ctx, NULL);
+                    }
+                    if (ret == 0 && thread_ctx->wake_up_defined) {
+                        ret = picoquic_uring_submit_wake_up(&uring_ctx, thread_ctx, &wake_up_op);
+                    }
+                    break;
+                }
+            }
+            io_uring_cq_advance(&uring_ctx.ring, nb_cqe);
+
+            if (ret == 0 && bytes_recv_total > 0 && loop_callback != NULL) {
+                ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &bytes_recv_total);
+            }
+
+            /* Prepare as many packets as there are free send operations */
+            while (ret == 0 && uring_ctx.send_free_list != NULL &&
+                nb_packets_sent < PICOQUIC_PACKET_LOOP_SEND_MAX) {
+                picoquic_uring_op_t* op = uring_ctx.send_free_list;
+                struct sockaddr_storage peer_addr;
+                struct sockaddr_storage local_addr = { 0 };
+                int if_index = param->dest_if;
+                size_t send_length = 0;
+
+                ret = picoquic_prepare_next_packet_ex(quic, current_time,
+                    op->buffer, op->buffer_size, &send_length,
+                    &peer_addr, &local_addr, &if_index, &log_cid, &last_cnx,
+                    send_msg_ptr);
+
+                if (ret == 0 && send_length > 0) {
+                    SOCKET_TYPE send_socket = INVALID_SOCKET;
+
+                    nb_packets_sent += (send_msg_size == 0) ? 1 :
+                        (send_length + send_msg_size - 1) / (send_msg_size);
+                    bytes_sent += send_length;
+
+                    for (int i = 0; i < nb_sockets; i++) {
+                        if (s_ctx[i].af == peer_addr.ss_family) {
+                            send_socket = s_ctx[i].fd;
+                            break;
+                        }
+                    }
+                    if (send_socket == INVALID_SOCKET) {
+                        picoquic_log_context_free_app_message(quic, &log_cid,
+                            "No socket for AF_to=%d", peer_addr.ss_family);
+                    }
+                    else {
+                        uring_ctx.send_free_list = op->next_free;
+                        op->fd = send_socket;
+                        picoquic_store_addr(&op->addr_peer, (struct sockaddr*)&peer_addr);
+                        picoquic_store_addr(&op->addr_local, (struct sockaddr*)&local_addr);
+                        ret = picoquic_uring_submit_send(&uring_ctx, op,
+                            send_length, send_msg_size, if_index);
+                    }
+                }
+                else {
+                    break;
+                }
+            }
+
+            if (ret == 0 && loop_callback != NULL) {
+                ret = loop_callback(quic, picoquic_packet_loop_after_send, loop_callback_ctx, &bytes_sent);
+            }
+        }
+    }
+
+    thread_ctx->thread_is_ready = 0;
+
+    if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+        ret = 0;
+    }
+
+    if (uring_ready) {
+        picoquic_uring_ctx_release(&uring_ctx);
+    }
+
+    for (int i = 0; i < nb_sockets; i++) {
+        picoquic_packet_loop_close_socket(&s_ctx[i]);
+    }
+
+    thread_ctx->return_code = ret;
+
+    return ret;
+}
+
+#endif /* PICOQUIC_WITH_IOURING */
+#endif /* _WINDOWS */
@@ -0,0 +1,505 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2020, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* AF_XDP based implementation of the packet loop.
+ *
+ * This loop bypasses the kernel UDP stack entirely: datagrams are
+ * exchanged with the NIC driver through a shared UMEM area, and the
+ * loop parses and builds the Ethernet, IPv4 and UDP headers itself.
+ * Received QUIC payloads are handed to picoquic_incoming_packet_ex()
+ * as pointers into the UMEM frame, and outgoing packets are prepared
+ * by picoquic_prepare_next_packet_ex() directly into the transmit
+ * frame after the header room, so the datapath is copy free on both
+ * sides.
+ *
+ * The loop is selected by setting the "xdp_config" pointer in
+ * picoquic_packet_loop_param_t. Since the kernel stack is bypassed,
+ * the configuration must provide what the stack would otherwise
+ * resolve: interface, queue, local MAC and IPv4 address, and the MAC
+ * address of the gateway (or peer, on a direct link). Only IPv4 is
+ * supported for now; front ends that require IPv6 should keep using
+ * the socket based loops.
+ *
+ * The backend is only compiled if the library is built with
+ * PICOQUIC_WITH_AFXDP (cmake option WITH_AFXDP), which requires
+ * libxdp; if the pointer is set but the support is not compiled in,
+ * picoquic_packet_loop_v2 falls back to the select() based loop.
+ */
+
+#ifndef _WINDOWS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "picosocks.h"
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_packet_loop.h"
+#include "picoquic_unified_log.h"
+
+#ifdef PICOQUIC_WITH_AFXDP
+
+#include <poll.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <sys/mman.h>
+#include <xdp/xsk.h>
+
+#define PICOQUIC_XDP_NB_FRAMES 4096
+#define PICOQUIC_XDP_FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+#define PICOQUIC_XDP_RX_BATCH 64
+#define PICOQUIC_XDP_TX_BATCH 64
+#define PICOQUIC_XDP_HEADER_ROOM (sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+typedef struct st_picoquic_xdp_ctx_t {
+    struct xsk_umem* umem;
+    struct xsk_socket* xsk;
+    void* umem_area;
+    struct xsk_ring_prod fq;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    /* Stack of free UMEM frame addresses */
+    uint64_t free_frames[PICOQUIC_XDP_NB_FRAMES];
+    uint32_t nb_free_frames;
+    uint32_t outstanding_tx;
+    picoquic_xdp_config_t const* config;
+} picoquic_xdp_ctx_t;
+
+static uint64_t picoquic_xdp_frame_alloc(picoquic_xdp_ctx_t* xdp)
+{
+    uint64_t frame = UINT64_MAX;
+    if (xdp->nb_free_frames > 0) {
+        frame = xdp->free_frames[--xdp->nb_free_frames];
+    }
+    return frame;
+}
+
+static void picoquic_xdp_frame_free(picoquic_xdp_ctx_t* xdp, uint64_t frame)
+{
+    xdp->free_frames[xdp->nb_free_frames++] = xsk_umem__extract_addr(frame);
+}
+
+static uint16_t picoquic_xdp_ip_checksum(const uint8_t* header, size_t length)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        sum += ((uint16_t)header[i] << 8) | header[i + 1];
+    }
+    while ((sum >> 16) != 0) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons((uint16_t)(~sum & 0xffff));
+}
+
+static void picoquic_xdp_release(picoquic_xdp_ctx_t* xdp)
+{
+    if (xdp->xsk != NULL) {
+        xsk_socket__delete(xdp->xsk);
+        xdp->xsk = NULL;
+    }
+    if (xdp->umem != NULL) {
+        xsk_umem__delete(xdp->umem);
+        xdp->umem = NULL;
+    }
+    if (xdp->umem_area != NULL) {
+        munmap(xdp->umem_area, (size_t)PICOQUIC_XDP_NB_FRAMES * PICOQUIC_XDP_FRAME_SIZE);
+        xdp->umem_area = NULL;
+    }
+}
+
+static int picoquic_xdp_init(picoquic_xdp_ctx_t* xdp, picoquic_xdp_config_t const* config)
+{
+    int ret = 0;
+    size_t umem_size = (size_t)PICOQUIC_XDP_NB_FRAMES * PICOQUIC_XDP_FRAME_SIZE;
+    struct xsk_socket_config xsk_cfg;
+    uint32_t idx = 0;
+
+    memset(xdp, 0, sizeof(picoquic_xdp_ctx_t));
+    xdp->config = config;
+
+    xdp->umem_area = mmap(NULL, umem_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdp->umem_area == MAP_FAILED) {
+        xdp->umem_area = NULL;
+        DBG_PRINTF("Cannot map %zu bytes of UMEM", umem_size);
+        ret = -1;
+    }
+
+    if (ret == 0 &&
+        (ret = xsk_umem__create(&xdp->umem, xdp->umem_area, umem_size,
+            &xdp->fq, &xdp->cq, NULL)) != 0) {
+        DBG_PRINTF("xsk_umem__create fails, ret=%d", ret);
+    }
+
+    if (ret == 0) {
+        memset(&xsk_cfg, 0, sizeof(xsk_cfg));
+        xsk_cfg.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+        xsk_cfg.tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS;
+        /* Try zero copy mode first, fall back to driver copy mode */
+        xsk_cfg.bind_flags = XDP_ZEROCOPY;
+        if ((ret = xsk_socket__create(&xdp->xsk, config->if_name, config->queue_id,
+            xdp->umem, &xdp->rx, &xdp->tx, &xsk_cfg)) != 0) {
+            xsk_cfg.bind_flags = XDP_COPY;
+            ret = xsk_socket__create(&xdp->xsk, config->if_name, config->queue_id,
+                xdp->umem, &xdp->rx, &xdp->tx, &xsk_cfg);
+        }
+        if (ret != 0) {
+            DBG_PRINTF("xsk_socket__create(%s, %d) fails, ret=%d",
+                config->if_name, config->queue_id, ret);
+        }
+    }
+
+    if (ret == 0) {
+        /* All frames are free initially; give half of them to the fill ring */
+        for (uint32_t i = 0; i < PICOQUIC_XDP_NB_FRAMES; i++) {
+            xdp->free_frames[i] = (uint64_t)i * PICOQUIC_XDP_FRAME_SIZE;
+        }
+        xdp->nb_free_frames = PICOQUIC_XDP_NB_FRAMES;
+
+        if (xsk_ring_prod__reserve(&xdp->fq, PICOQUIC_XDP_NB_FRAMES / 2, &idx) !=
+            PICOQUIC_XDP_NB_FRAMES / 2) {
+            DBG_PRINTF("%s", "Cannot reserve fill ring entries");
+            ret = -1;
+        }
+        else {
+            for (uint32_t i = 0; i < PICOQUIC_XDP_NB_FRAMES / 2; i++) {
+                *xsk_ring_prod__fill_addr(&xdp->fq, idx + i) = picoquic_xdp_frame_alloc(xdp);
+            }
+            xsk_ring_prod__submit(&xdp->fq, PICOQUIC_XDP_NB_FRAMES / 2);
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_xdp_release(xdp);
+    }
+
+    return ret;
+}
+
+/* Refill the fill ring from the free frame stack, and collect the
+ * frames released by the completion ring. */
+static void picoquic_xdp_replenish(picoquic_xdp_ctx_t* xdp)
+{
+    uint32_t idx = 0;
+    uint32_t nb;
+
+    nb = xsk_ring_cons__peek(&xdp->cq, PICOQUIC_XDP_TX_BATCH, &idx);
+    if (nb > 0) {
+        for (uint32_t i = 0; i < nb; i++) {
+            picoquic_xdp_frame_free(xdp, *xsk_ring_cons__comp_addr(&xdp->cq, idx + i));
+        }
+        xsk_ring_cons__release(&xdp->cq, nb);
+        xdp->outstanding_tx -= nb;
+    }
+
+    nb = xsk_prod_nb_free(&xdp->fq, xdp->nb_free_frames);
+    if (nb > xdp->nb_free_frames / 2) {
+        nb = xdp->nb_free_frames / 2;
+    }
+    if (nb > 0 && xsk_ring_prod__reserve(&xdp->fq, nb, &idx) == nb) {
+        for (uint32_t i = 0; i < nb; i++) {
+            *xsk_ring_prod__fill_addr(&xdp->fq, idx + i) = picoquic_xdp_frame_alloc(xdp);
+        }
+        xsk_ring_prod__submit(&xdp->fq, nb);
+    }
+}
+
+/* Parse an incoming frame. Returns the length of the QUIC payload and
+ * sets the peer and local addresses, or returns 0 if the frame is not
+ * an IPv4 UDP datagram for the configured port. */
+static size_t picoquic_xdp_parse_frame(picoquic_xdp_ctx_t* xdp, uint8_t* frame, size_t frame_length,
+    uint8_t** payload, struct sockaddr_storage* addr_from, struct sockaddr_storage* addr_dest)
+{
+    size_t payload_length = 0;
+
+    if (frame_length > PICOQUIC_XDP_HEADER_ROOM) {
+        struct ethhdr* eth = (struct ethhdr*)frame;
+
+        if (eth->h_proto == htons(ETH_P_IP)) {
+            struct iphdr* ip = (struct iphdr*)(frame + sizeof(struct ethhdr));
+            size_t ip_header_length = (size_t)ip->ihl * 4;
+
+            if (ip->version == 4 && ip->protocol == IPPROTO_UDP &&
+                sizeof(struct ethhdr) + ip_header_length + sizeof(struct udphdr) <= frame_length) {
+                struct udphdr* udp = (struct udphdr*)(frame + sizeof(struct ethhdr) + ip_header_length);
+
+                if (udp->dest == htons(xdp->config->local_port)) {
+                    struct sockaddr_in* from = (struct sockaddr_in*)addr_from;
+                    struct sockaddr_in* dest = (struct sockaddr_in*)addr_dest;
+                    size_t udp_length = ntohs(udp->len);
+
+                    if (udp_length >= sizeof(struct udphdr) &&
+                        sizeof(struct ethhdr) + ip_header_length + udp_length <= frame_length) {
+                        memset(addr_from, 0, sizeof(struct sockaddr_storage));
+                        memset(addr_dest, 0, sizeof(struct sockaddr_storage));
+                        from->sin_family = AF_INET;
+                        from->sin_addr.s_addr = ip->saddr;
+                        from->sin_port = udp->source;
+                        dest->sin_family = AF_INET;
+                        dest->sin_addr.s_addr = ip->daddr;
+                        dest->sin_port = udp->dest;
+                        *payload = frame + sizeof(struct ethhdr) + ip_header_length + sizeof(struct udphdr);
+                        payload_length = udp_length - sizeof(struct udphdr);
+                    }
+                }
+            }
+        }
+    }
+
+    return payload_length;
+}
+
+/* Build the Ethernet, IPv4 and UDP headers in front of a payload that
+ * was prepared at offset PICOQUIC_XDP_HEADER_ROOM in the frame. */
+static void picoquic_xdp_format_headers(picoquic_xdp_ctx_t* xdp, uint8_t* frame,
+    size_t payload_length, struct sockaddr_in* peer_addr)
+{
+    struct ethhdr* eth = (struct ethhdr*)frame;
+    struct iphdr* ip = (struct iphdr*)(frame + sizeof(struct ethhdr));
+    struct udphdr* udp = (struct udphdr*)(frame + sizeof(struct ethhdr) + sizeof(struct iphdr));
+
+    memcpy(eth->h_dest, xdp->config->gateway_mac, ETH_ALEN);
+    memcpy(eth->h_source, xdp->config->local_mac, ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+
+    memset(ip, 0, sizeof(struct iphdr));
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->tos = PICOQUIC_ECN_ECT_1;
+    ip->tot_len = htons((uint16_t)(sizeof(struct iphdr) + sizeof(struct udphdr) + payload_length));
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->saddr = xdp->config->local_ipv4.s_addr;
+    ip->daddr = peer_addr->sin_addr.s_addr;
+    ip->check = picoquic_xdp_ip_checksum((uint8_t*)ip, sizeof(struct iphdr));
+
+    udp->source = htons(xdp->config->local_port);
+    udp->dest = peer_addr->sin_port;
+    udp->len = htons((uint16_t)(sizeof(struct udphdr) + payload_length));
+    udp->check = 0; /* Optional for IPv4 */
+}
+
+int picoquic_packet_loop_xdp(picoquic_network_thread_ctx_t* thread_ctx)
+{
+    picoquic_quic_t* quic = thread_ctx->quic;
+    picoquic_packet_loop_param_t* param = thread_ctx->param;
+    picoquic_packet_loop_cb_fn loop_callback = thread_ctx->loop_callback;
+    void* loop_callback_ctx = thread_ctx->loop_callback_ctx;
+    int ret = 0;
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    int64_t delay_max = 10000000;
+    picoquic_connection_id_t log_cid;
+    picoquic_cnx_t* last_cnx = NULL;
+    picoquic_packet_loop_options_t options = { 0 };
+    picoquic_xdp_ctx_t* xdp = (picoquic_xdp_ctx_t*)malloc(sizeof(picoquic_xdp_ctx_t));
+
+    if (xdp == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = picoquic_xdp_init(xdp, param->xdp_config);
+    }
+
+    if (ret == 0 && loop_callback != NULL) {
+        struct sockaddr_storage l_addr;
+        struct sockaddr_in* l4 = (struct sockaddr_in*)&l_addr;
+
+        ret = loop_callback(quic, picoquic_packet_loop_ready, loop_callback_ctx, &options);
+        if (ret == 0) {
+            memset(&l_addr, 0, sizeof(l_addr));
+            l4->sin_family = AF_INET;
+            l4->sin_addr = param->xdp_config->local_ipv4;
+            l4->sin_port = htons(param->xdp_config->local_port);
+            ret = loop_callback(quic, picoquic_packet_loop_port_update, loop_callback_ctx, &l_addr);
+        }
+    }
+
+    if (ret == 0) {
+        thread_ctx->thread_is_ready = 1;
+    }
+
+    while (ret == 0 && !thread_ctx->thread_should_close) {
+        struct pollfd fds[2];
+        int nb_fds = 1;
+        int64_t delta_t;
+        int poll_ret;
+        uint32_t idx_rx = 0;
+        uint32_t nb_rx;
+        size_t bytes_recv_total = 0;
+        size_t bytes_sent = 0;
+        size_t nb_packets_sent = 0;
+
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+        delta_t = picoquic_get_next_wake_delay(quic, current_time, delay_max);
+        if (options.do_time_check) {
+            packet_loop_time_check_arg_t time_check_arg;
+            time_check_arg.current_time = current_time;
+            time_check_arg.delta_t = delta_t;
+            ret = loop_callback(quic, picoquic_packet_loop_time_check, loop_callback_ctx, &time_check_arg);
+            if (time_check_arg.delta_t < delta_t) {
+                delta_t = time_check_arg.delta_t;
+            }
+        }
+
+        fds[0].fd = xsk_socket__fd(xdp->xsk);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        if (thread_ctx->wake_up_defined) {
+            fds[1].fd = thread_ctx->wake_up_pipe_fd[0];
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            nb_fds = 2;
+        }
+
+        poll_ret = poll(fds, nb_fds, (delta_t <= 0) ? 0 : (int)((delta_t + 999) / 1000));
+        current_time = picoquic_current_time();
+        picoquic_refresh_quic_time_cache(quic, current_time);
+
+        if (poll_ret < 0 && errno != EINTR) {
+            ret = (thread_ctx->thread_should_close) ? PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP : -1;
+            continue;
+        }
+
+        if (nb_fds > 1 && (fds[1].revents & POLLIN) != 0) {
+            uint8_t eventbuf[8];
+            if (read(thread_ctx->wake_up_pipe_fd[0], eventbuf, sizeof(eventbuf)) <= 0) {
+                ret = -1;
+            }
+            else {
+                ret = loop_callback(quic, picoquic_packet_loop_wake_up, loop_callback_ctx, NULL);
+            }
+        }
+
+        /* Receive pass: process all frames available in the RX ring. */
+        while (ret == 0 &&
+            (nb_rx = xsk_ring_cons__peek(&xdp->rx, PICOQUIC_XDP_RX_BATCH, &idx_rx)) > 0) {
+            for (uint32_t i = 0; ret == 0 && i < nb_rx; i++) {
+                const struct xdp_desc* desc = xsk_ring_cons__rx_desc(&xdp->rx, idx_rx + i);
+                uint8_t* frame = (uint8_t*)xsk_umem__get_data(xdp->umem_area, desc->addr);
+                uint8_t* payload = NULL;
+                struct sockaddr_storage addr_from;
+                struct sockaddr_storage addr_dest;
+                size_t payload_length = picoquic_xdp_parse_frame(xdp, frame, desc->len,
+                    &payload, &addr_from, &addr_dest);
+
+                if (payload_length > 0) {
+                    bytes_recv_total += payload_length;
+                    ret = picoquic_incoming_packet_ex(quic, payload, payload_length,
+                        (struct sockaddr*)&addr_from, (struct sockaddr*)&addr_dest,
+                        0, 0, &last_cnx, current_time);
+                }
+                picoquic_xdp_frame_free(xdp, desc->addr);
+            }
+            xsk_ring_cons__release(&xdp->rx, nb_rx);
+        }
+
+        if (ret == 0 && bytes_recv_total > 0 && loop_callback != NULL) {
+            ret = loop_callback(quic, picoquic_packet_loop_after_receive, loop_callback_ctx, &bytes_recv_total);
+        }
+
+        /* Send pass: prepare packets directly into transmit frames. */
+        while (ret == 0 && nb_packets_sent < PICOQUIC_PACKET_LOOP_SEND_MAX) {
+            struct sockaddr_storage peer_addr;
+            struct sockaddr_storage local_addr = { 0 };
+            int if_index = 0;
+            size_t send_length = 0;
+            uint64_t frame_addr = picoquic_xdp_frame_alloc(xdp);
+            uint8_t* frame;
+            uint32_t idx_tx = 0;
+
+            if (frame_addr == UINT64_MAX) {
+                break;
+            }
+            frame = (uint8_t*)xsk_umem__get_data(xdp->umem_area, frame_addr);
+
+            /* No GSO on this path: prepare one MTU sized packet per frame. */
+            ret = picoquic_prepare_next_packet_ex(quic, current_time,
+                frame + PICOQUIC_XDP_HEADER_ROOM,
+                PICOQUIC_MAX_PACKET_SIZE, &send_length,
+                &peer_addr, &local_addr, &if_index, &log_cid, &last_cnx,
+                NULL);
+
+            if (ret == 0 && send_length > 0 && peer_addr.ss_family == AF_INET &&
+                xsk_ring_prod__reserve(&xdp->tx, 1, &idx_tx) == 1) {
+                struct xdp_desc* desc = xsk_ring_prod__tx_desc(&xdp->tx, idx_tx);
+
+                picoquic_xdp_format_headers(xdp, frame, send_length,
+                    (struct sockaddr_in*)&peer_addr);
+                desc->addr = frame_addr;
+                desc->len = (uint32_t)(PICOQUIC_XDP_HEADER_ROOM + send_length);
+                xsk_ring_prod__submit(&xdp->tx, 1);
+                xdp->outstanding_tx++;
+                nb_packets_sent++;
+                bytes_sent += send_length;
+            }
+            else {
+                if (ret == 0 && send_length > 0 && peer_addr.ss_family != AF_INET) {
+                    picoquic_log_context_free_app_message(quic, &log_cid,
+                        "AF_XDP loop cannot send to AF=%d", peer_addr.ss_family);
+                }
+                picoquic_xdp_frame_free(xdp, frame_addr);
+                if (ret == 0 && send_length == 0) {
+                    break;
+                }
+            }
+        }
+
+        if (ret == 0 && xdp->outstanding_tx > 0 &&
+            xsk_ring_prod__needs_wakeup(&xdp->tx)) {
+            (void)sendto(xsk_socket__fd(xdp->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+        }
+
+        picoquic_xdp_replenish(xdp);
+
+        if (ret == 0 && loop_callback != NULL) {
+            ret = loop_callback(quic, picoquic_packet_loop_after_send, loop_callback_ctx, &bytes_sent);
+        }
+    }
+
+    thread_ctx->thread_is_ready = 0;
+
+    if (ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+        ret = 0;
+    }
+
+    if (xdp != NULL) {
+        picoquic_xdp_release(xdp);
+        free(xdp);
+    }
+
+    thread_ctx->return_code = ret;
+
+    return ret;
+}
+
+#endif /* PICOQUIC_WITH_AFXDP */
+#endif /* _WINDOWS */
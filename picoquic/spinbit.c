@@ -31,7 +31,22 @@
  */
 void picoquic_spinbit_basic_incoming(picoquic_cnx_t * cnx, picoquic_path_t * path_x, picoquic_packet_header * ph)
 {
-    path_x->current_spin = ph->spin ^ cnx->client_mode;
+    unsigned int spin = ph->spin ^ cnx->client_mode;
+
+    if (cnx->rtt_observer_fn != NULL && spin != path_x->current_spin) {
+        /* The time between consecutive incoming spin edges approximates
+         * the round trip time, as seen by a passive on-path observer.
+         * The first edge only primes the measurement. */
+        uint64_t current_time = picoquic_get_quic_time(cnx->quic);
+
+        if (path_x->spin_edge_time != 0) {
+            cnx->rtt_observer_fn(cnx, path_x->unique_path_id,
+                picoquic_rtt_sample_source_spin, current_time - path_x->spin_edge_time,
+                cnx->v_rtt_observer_ctx);
+        }
+        path_x->spin_edge_time = current_time;
+    }
+    path_x->current_spin = spin;
 }
 
 uint8_t picoquic_spinbit_basic_outgoing(picoquic_cnx_t * cnx)
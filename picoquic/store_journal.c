@@ -0,0 +1,347 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Unified store journal.
+ *
+ * picoquic_save_tickets and picoquic_save_tokens rewrite their whole file
+ * on each call, so updates between two saves are lost if the process
+ * crashes. The journal makes persistence incremental: every call to
+ * picoquic_store_ticket or picoquic_store_token appends one framed record
+ * to a shared append-only file, and loading replays the records in order.
+ *
+ * Each record is framed as:
+ *
+ *     type (1 byte, ticket or token) + size (4 bytes) + payload
+ *     + checksum (8 bytes, FNV-1a over type, size and payload)
+ *
+ * The payload reuses the ticket and token serializers of the flat stores.
+ * Replay stops at the first record that is truncated or fails its
+ * checksum, so a crash in mid-append loses at most the record being
+ * written. Compaction rewrites the journal from the in-memory stores,
+ * dropping expired and superseded records; it runs when the journal is
+ * opened, which also trims a corrupted tail, and again after every
+ * PICOQUIC_JOURNAL_COMPACT_THRESHOLD appends.
+ */
+
+#include "tls_api.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PICOQUIC_JOURNAL_COMPACT_THRESHOLD 1024
+#define PICOQUIC_JOURNAL_RECORD_MAX 2048
+
+static uint64_t picoquic_journal_checksum(uint8_t record_type, uint32_t storage_size,
+    const uint8_t* bytes, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    hash = (hash ^ record_type) * 0x00000100000001b3ull;
+    hash = (hash ^ storage_size) * 0x00000100000001b3ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x00000100000001b3ull;
+    }
+
+    return hash;
+}
+
+static int picoquic_journal_flush(picoquic_store_journal_t* journal)
+{
+    int ret = 0;
+
+    if (fflush(journal->F) != 0) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+    else if (journal->fsync_policy == picoquic_journal_fsync_each_append) {
+#ifdef _WINDOWS
+        if (_commit(_fileno(journal->F)) != 0) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+#else
+        if (fsync(fileno(journal->F)) != 0) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+#endif
+    }
+
+    return ret;
+}
+
+static int picoquic_journal_write_record(FILE* F, picoquic_store_journal_t* journal,
+    uint8_t record_type, const uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    uint32_t storage_size = (uint32_t)length;
+    uint64_t checksum = picoquic_journal_checksum(record_type, storage_size, bytes, length);
+
+    if (fwrite(&record_type, 1, 1, F) != 1 ||
+        fwrite(&storage_size, 4, 1, F) != 1 ||
+        fwrite(bytes, 1, length, F) != length ||
+        fwrite(&checksum, 8, 1, F) != 1) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+    else if (journal != NULL) {
+        ret = picoquic_journal_flush(journal);
+    }
+
+    return ret;
+}
+
+int picoquic_journal_append(picoquic_quic_t* quic, uint8_t record_type,
+    const uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    picoquic_store_journal_t* journal = quic->store_journal;
+
+    if (journal == NULL || journal->F == NULL || length > PICOQUIC_JOURNAL_RECORD_MAX) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else if ((ret = picoquic_journal_write_record(journal->F, journal, record_type, bytes, length)) != 0) {
+        /* A partial frame may have reached the file; stop appending until
+         * the next compaction rewrites the journal from memory */
+        journal->F = picoquic_file_close(journal->F);
+    }
+    else {
+        journal->nb_appends++;
+        if (journal->nb_appends >= PICOQUIC_JOURNAL_COMPACT_THRESHOLD) {
+            ret = picoquic_journal_compact(quic);
+        }
+    }
+
+    return ret;
+}
+
+/* Replay the journal records into the in-memory ticket and token stores,
+ * in file order so a record appended later supersedes an earlier one.
+ * Stops quietly at the first truncated or corrupted record. */
+static void picoquic_journal_replay(picoquic_quic_t* quic, char const* file_name)
+{
+    int file_err = 0;
+    FILE* F = picoquic_file_open_ex(file_name, "rb", &file_err);
+    uint64_t current_time = picoquic_get_tls_time(quic);
+
+    if (F != NULL) {
+        for (;;) {
+            uint8_t record_type;
+            uint32_t storage_size;
+            uint64_t checksum;
+            uint8_t buffer[PICOQUIC_JOURNAL_RECORD_MAX];
+            size_t consumed = 0;
+
+            if (fread(&record_type, 1, 1, F) != 1 ||
+                fread(&storage_size, 4, 1, F) != 1 ||
+                storage_size > PICOQUIC_JOURNAL_RECORD_MAX ||
+                fread(buffer, 1, storage_size, F) != storage_size ||
+                fread(&checksum, 8, 1, F) != 1 ||
+                checksum != picoquic_journal_checksum(record_type, storage_size, buffer, storage_size)) {
+                break;
+            }
+
+            if (record_type == picoquic_journal_record_ticket) {
+                picoquic_stored_ticket_t* stored = NULL;
+
+                if (picoquic_deserialize_ticket(&stored, buffer, storage_size, &consumed) != 0 ||
+                    consumed != storage_size || stored == NULL) {
+                    break;
+                }
+                else if (stored->time_valid_until < current_time) {
+                    free(stored);
+                }
+                else {
+                    /* Insert at the head of the list: later records are found
+                     * first, so the newest ticket for a server wins */
+                    stored->next_ticket = quic->p_first_ticket;
+                    quic->p_first_ticket = stored;
+                    quic->ticket_memory_size += stored->stored_size;
+                }
+            }
+            else if (record_type == picoquic_journal_record_token) {
+                picoquic_stored_token_t* stored = NULL;
+
+                if (picoquic_deserialize_token(&stored, buffer, storage_size, &consumed) != 0 ||
+                    consumed != storage_size || stored == NULL) {
+                    break;
+                }
+                else if (stored->time_valid_until < current_time) {
+                    free(stored);
+                }
+                else {
+                    stored->sni = ((char*)stored) + sizeof(picoquic_stored_token_t);
+                    stored->ip_addr = ((uint8_t*)stored->sni) + stored->sni_length + 1;
+                    stored->token = (uint8_t*)(stored->ip_addr + stored->ip_addr_length + 1);
+                    stored->next_token = quic->p_first_token;
+                    stored->previous_token = NULL;
+                    if (quic->p_first_token != NULL) {
+                        quic->p_first_token->previous_token = stored;
+                    }
+                    quic->p_first_token = stored;
+                    picoquic_token_index_insert(quic, stored);
+                }
+            }
+            else {
+                break;
+            }
+        }
+
+        (void)picoquic_file_close(F);
+        picoquic_enforce_ticket_budget(quic);
+    }
+}
+
+int picoquic_journal_compact(picoquic_quic_t* quic)
+{
+    int ret = 0;
+    picoquic_store_journal_t* journal = quic->store_journal;
+    uint64_t current_time = picoquic_get_tls_time(quic);
+    char* tmp_name = NULL;
+    size_t tmp_name_size;
+    FILE* F = NULL;
+
+    if (journal == NULL) {
+        return PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+
+    /* Write the live records to a temporary file, then swap it in, so a
+     * crash during compaction leaves at worst the previous journal */
+    tmp_name_size = strlen(journal->file_name) + 5;
+    tmp_name = (char*)malloc(tmp_name_size);
+    if (tmp_name == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        (void)picoquic_sprintf(tmp_name, tmp_name_size, NULL, "%s.tmp", journal->file_name);
+        if ((F = picoquic_file_open(tmp_name, "wb")) == NULL) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_stored_ticket_t* next_ticket = quic->p_first_ticket;
+        picoquic_stored_token_t* next_token = quic->p_first_token;
+        uint8_t buffer[PICOQUIC_JOURNAL_RECORD_MAX];
+        size_t record_size;
+
+        while (ret == 0 && next_ticket != NULL) {
+            if (next_ticket->time_valid_until > current_time &&
+                picoquic_serialize_ticket(next_ticket, buffer, sizeof(buffer), &record_size) == 0) {
+                ret = picoquic_journal_write_record(F, NULL, picoquic_journal_record_ticket,
+                    buffer, record_size);
+            }
+            next_ticket = next_ticket->next_ticket;
+        }
+
+        while (ret == 0 && next_token != NULL) {
+            if (next_token->time_valid_until > current_time && next_token->was_used == 0 &&
+                picoquic_serialize_token(next_token, buffer, sizeof(buffer), &record_size) == 0) {
+                ret = picoquic_journal_write_record(F, NULL, picoquic_journal_record_token,
+                    buffer, record_size);
+            }
+            next_token = next_token->next_token;
+        }
+
+        (void)picoquic_file_close(F);
+    }
+
+    if (ret == 0) {
+        int last_err = 0;
+
+        if (journal->F != NULL) {
+            journal->F = picoquic_file_close(journal->F);
+        }
+        (void)picoquic_file_delete(journal->file_name, &last_err);
+        if (rename(tmp_name, journal->file_name) != 0 ||
+            (journal->F = picoquic_file_open(journal->file_name, "ab")) == NULL) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        else {
+            journal->nb_appends = 0;
+        }
+    }
+
+    if (tmp_name != NULL) {
+        free(tmp_name);
+    }
+
+    return ret;
+}
+
+int picoquic_use_store_journal(picoquic_quic_t* quic, char const* journal_file_name,
+    picoquic_journal_fsync_enum fsync_policy)
+{
+    int ret = 0;
+    picoquic_store_journal_t* journal;
+
+    if (quic->store_journal != NULL) {
+        picoquic_journal_close(quic);
+    }
+
+    journal = (picoquic_store_journal_t*)malloc(sizeof(picoquic_store_journal_t));
+    if (journal == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(journal, 0, sizeof(picoquic_store_journal_t));
+        journal->fsync_policy = fsync_policy;
+        journal->file_name = picoquic_string_duplicate(journal_file_name);
+        if (journal->file_name == NULL) {
+            free(journal);
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            quic->store_journal = journal;
+            picoquic_journal_replay(quic, journal_file_name);
+            /* Compacting after replay creates the file if absent, trims a
+             * corrupted tail and opens the journal for appending */
+            ret = picoquic_journal_compact(quic);
+            if (ret != 0) {
+                picoquic_journal_close(quic);
+            }
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_journal_close(picoquic_quic_t* quic)
+{
+    picoquic_store_journal_t* journal = quic->store_journal;
+
+    if (journal != NULL) {
+        if (journal->F != NULL) {
+            journal->F = picoquic_file_close(journal->F);
+        }
+        if (journal->file_name != NULL) {
+            free(journal->file_name);
+        }
+        free(journal);
+        quic->store_journal = NULL;
+    }
+}
@@ -26,6 +26,13 @@
 #include <string.h>
 #include <errno.h>
 
+#ifndef _WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 picoquic_stored_ticket_t* picoquic_format_ticket(uint64_t time_valid_until,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint32_t version, const uint8_t * ip_addr, uint8_t ip_addr_length,
@@ -40,6 +47,7 @@ picoquic_stored_ticket_t* picoquic_format_ticket(uint64_t time_valid_until,
         char* next_p = ((char*)stored) + sizeof(picoquic_stored_ticket_t);
 
         memset(stored, 0, ticket_size);
+        stored->stored_size = ticket_size;
         stored->time_valid_until = time_valid_until;
         stored->sni = next_p;
         stored->sni_length = sni_length;
@@ -256,6 +264,34 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
     return ret;
 }
 
+/* Byte budget for the ticket store, see picoquic_set_ticket_memory_budget.
+ * The list is kept in LRU order: new and recently used tickets sit at the
+ * head, eviction removes from the tail. */
+void picoquic_set_ticket_memory_budget(picoquic_quic_t* quic, uint64_t budget_bytes)
+{
+    quic->ticket_memory_budget = budget_bytes;
+    picoquic_enforce_ticket_budget(quic);
+}
+
+void picoquic_enforce_ticket_budget(picoquic_quic_t* quic)
+{
+    while (quic->ticket_memory_budget > 0 &&
+        quic->ticket_memory_size > quic->ticket_memory_budget &&
+        quic->p_first_ticket != NULL) {
+        picoquic_stored_ticket_t** pprevious = &quic->p_first_ticket;
+        picoquic_stored_ticket_t* last = quic->p_first_ticket;
+
+        while (last->next_ticket != NULL) {
+            pprevious = &last->next_ticket;
+            last = last->next_ticket;
+        }
+        *pprevious = NULL;
+        quic->ticket_memory_size -= last->stored_size;
+        memset(last->ticket, 0, last->ticket_length);
+        free(last);
+    }
+}
+
 int picoquic_store_ticket(picoquic_quic_t* quic,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint32_t version, const uint8_t* ip_addr, uint8_t ip_addr_length,
@@ -299,6 +335,7 @@ int picoquic_store_ticket(picoquic_quic_t* quic,
                 stored->next_ticket = next = *pp_first_ticket;
                 *pp_first_ticket = stored;
                 pprevious = &stored->next_ticket;
+                quic->ticket_memory_size += stored->stored_size;
 
                 /* Now remove the old tickets for that SNI & ALPN & version */
                 while (next != NULL) {
@@ -311,6 +348,7 @@ int picoquic_store_ticket(picoquic_quic_t* quic,
                         picoquic_stored_ticket_t* deleted = next;
                         next = next->next_ticket;
                         *pprevious = next;
+                        quic->ticket_memory_size -= deleted->stored_size;
                         memset(&deleted->ticket, 0, deleted->ticket_length);
                         free(deleted);
                     } else {
@@ -318,6 +356,17 @@ int picoquic_store_ticket(picoquic_quic_t* quic,
                         next = next->next_ticket;
                     }
                 }
+                /* Journal before the budget check, which may evict the ticket */
+                if (quic->store_journal != NULL) {
+                    uint8_t buffer[2048];
+                    size_t record_size;
+
+                    if (picoquic_serialize_ticket(stored, buffer, sizeof(buffer), &record_size) == 0) {
+                        (void)picoquic_journal_append(quic, picoquic_journal_record_ticket,
+                            buffer, record_size);
+                    }
+                }
+                picoquic_enforce_ticket_budget(quic);
             }
         }
     }
@@ -325,11 +374,16 @@ int picoquic_store_ticket(picoquic_quic_t* quic,
     return ret;
 }
 
+static picoquic_stored_ticket_t* picoquic_ticket_index_probe(picoquic_quic_t* quic,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
+    uint32_t version, uint64_t ticket_id, uint64_t current_time);
+
 picoquic_stored_ticket_t* picoquic_get_stored_ticket(picoquic_quic_t * quic,
     char const* sni, uint16_t sni_length,
     char const* alpn, uint16_t alpn_length, uint32_t version, int need_unused, uint64_t ticket_id)
 {
     picoquic_stored_ticket_t* next = quic->p_first_ticket;
+    picoquic_stored_ticket_t** pprevious = &quic->p_first_ticket;
     uint64_t current_time = picoquic_get_tls_time(quic);
 
     while (next != NULL) {
@@ -345,9 +399,33 @@ picoquic_stored_ticket_t* picoquic_get_stored_ticket(picoquic_quic_t * quic,
                 break;
             }
         }
+        pprevious = &next->next_ticket;
         next = next->next_ticket;
     }
 
+    if (next == NULL && quic->ticket_store_map != NULL) {
+        /* Miss in the resident list: probe the mapped index and materialize
+         * the matching record. Once inserted at the head of the list, further
+         * lookups for that server hit the list before the map. */
+        next = picoquic_ticket_index_probe(quic, sni, sni_length, alpn, alpn_length,
+            version, ticket_id, current_time);
+        if (next != NULL) {
+            /* Records coming from the file are never marked used, so the
+             * need_unused filter is always satisfied. */
+            next->next_ticket = quic->p_first_ticket;
+            quic->p_first_ticket = next;
+            quic->ticket_memory_size += next->stored_size;
+        }
+    }
+
+    if (next != NULL && next != quic->p_first_ticket) {
+        /* Move the ticket to the front so budget eviction removes the
+         * least recently used servers first. */
+        *pprevious = next->next_ticket;
+        next->next_ticket = quic->p_first_ticket;
+        quic->p_first_ticket = next;
+    }
+
     return next;
 }
 
@@ -486,6 +564,7 @@ int picoquic_load_tickets(picoquic_quic_t* quic, char const* ticket_file_name)
                         }
 
                         previous = next;
+                        quic->ticket_memory_size += next->stored_size;
                     }
                 }
             }
@@ -494,6 +573,542 @@ int picoquic_load_tickets(picoquic_quic_t* quic, char const* ticket_file_name)
 
     picoquic_file_close(F);
 
+    picoquic_enforce_ticket_budget(quic);
+
+    return ret;
+}
+
+/* Indexed binary ticket store.
+ *
+ * The flat format above is parsed in full at startup, which does not scale
+ * to large client stores. The indexed format keeps the same size-prefixed
+ * records, preceded by a fixed header and followed by a hash index keyed
+ * by (SNI, ALPN):
+ *
+ *     header (32 bytes): magic, format, nb_buckets, index offset, nb_records
+ *     records: 4 byte size + serialized ticket, as in the flat format
+ *     index: nb_buckets slots of { 8 byte hash, 8 byte record offset }
+ *     appended records, written after the index by picoquic_ticket_store_append
+ *
+ * Loading maps the file read only (or reads it into the heap on Windows)
+ * and merely validates the header, so startup cost is independent of the
+ * store size. Lookups that miss the resident list probe the index with
+ * linear open addressing and deserialize just the matching record; records
+ * appended since the last compaction form a short tail that is scanned
+ * sequentially, newest match winning. picoquic_save_tickets_indexed merges
+ * the resident list with the mapped records and rewrites file and index,
+ * which is the periodic compaction. */
+
+#define PICOQUIC_TICKET_INDEX_MAGIC 0x50515449 /* "PQTI" */
+#define PICOQUIC_TICKET_INDEX_FORMAT 1
+#define PICOQUIC_TICKET_INDEX_HEADER_SIZE 32
+#define PICOQUIC_TICKET_INDEX_SLOT_SIZE 16
+#define PICOQUIC_TICKET_RECORD_SIZE_MAX 2048
+
+typedef struct st_picoquic_ticket_index_header_t {
+    uint64_t nb_buckets;
+    uint64_t index_offset;
+    uint64_t nb_records;
+    uint64_t appended_offset; /* first byte past the index */
+} picoquic_ticket_index_header_t;
+
+static uint64_t picoquic_ticket_index_hash(char const* sni, uint16_t sni_length,
+    char const* alpn, uint16_t alpn_length)
+{
+    /* FNV-1a over the SNI, a zero separator and the ALPN. Zero is reserved
+     * as the empty slot marker. */
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    for (uint16_t i = 0; i < sni_length; i++) {
+        h ^= (uint8_t)sni[i];
+        h *= 0x100000001b3ull;
+    }
+    h *= 0x100000001b3ull;
+    for (uint16_t i = 0; i < alpn_length; i++) {
+        h ^= (uint8_t)alpn[i];
+        h *= 0x100000001b3ull;
+    }
+    if (h == 0) {
+        h = 1;
+    }
+
+    return h;
+}
+
+static int picoquic_ticket_index_check(const uint8_t* map, size_t map_size,
+    picoquic_ticket_index_header_t* header)
+{
+    int ret = 0;
+
+    if (map_size < PICOQUIC_TICKET_INDEX_HEADER_SIZE ||
+        PICOPARSE_32(map) != PICOQUIC_TICKET_INDEX_MAGIC ||
+        PICOPARSE_32(map + 4) != PICOQUIC_TICKET_INDEX_FORMAT) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+    else {
+        header->nb_buckets = PICOPARSE_64(map + 8);
+        header->index_offset = PICOPARSE_64(map + 16);
+        header->nb_records = PICOPARSE_64(map + 24);
+
+        if (header->index_offset < PICOQUIC_TICKET_INDEX_HEADER_SIZE ||
+            header->index_offset > map_size ||
+            header->nb_buckets > (map_size - header->index_offset) / PICOQUIC_TICKET_INDEX_SLOT_SIZE) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        else {
+            header->appended_offset = header->index_offset +
+                header->nb_buckets * PICOQUIC_TICKET_INDEX_SLOT_SIZE;
+        }
+    }
+
+    return ret;
+}
+
+/* Deserialize the record whose 4 byte size prefix starts at map[offset].
+ * Returns the allocated ticket and sets *next_offset to the first byte
+ * after the record, or returns NULL if the record does not fit in the
+ * region ending at bound. */
+static picoquic_stored_ticket_t* picoquic_ticket_index_record(const uint8_t* map,
+    size_t offset, size_t bound, size_t* next_offset)
+{
+    picoquic_stored_ticket_t* stored = NULL;
+    uint32_t storage_size;
+
+    if (offset + 4 <= bound) {
+        memcpy(&storage_size, map + offset, 4);
+        if (storage_size <= PICOQUIC_TICKET_RECORD_SIZE_MAX &&
+            offset + 4 + storage_size <= bound) {
+            size_t consumed = 0;
+            uint8_t buffer[PICOQUIC_TICKET_RECORD_SIZE_MAX];
+
+            memcpy(buffer, map + offset + 4, storage_size);
+            if (picoquic_deserialize_ticket(&stored, buffer, storage_size, &consumed) != 0 ||
+                consumed != storage_size) {
+                if (stored != NULL) {
+                    free(stored);
+                    stored = NULL;
+                }
+            }
+            else if (next_offset != NULL) {
+                *next_offset = offset + 4 + storage_size;
+            }
+        }
+    }
+
+    return stored;
+}
+
+static int picoquic_ticket_index_match(const picoquic_stored_ticket_t* stored,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
+    uint32_t version, uint64_t ticket_id, uint64_t current_time)
+{
+    int is_match = 0;
+
+    if (stored->time_valid_until > current_time &&
+        stored->sni_length == sni_length &&
+        stored->alpn_length == alpn_length &&
+        memcmp(stored->sni, sni, sni_length) == 0 &&
+        memcmp(stored->alpn, alpn, alpn_length) == 0 &&
+        (version == 0 || stored->version == version)) {
+        uint64_t stored_id = (stored->ticket_length < 8) ? 0 : PICOPARSE_64(stored->ticket);
+        if (ticket_id == 0 || stored_id == ticket_id) {
+            is_match = 1;
+        }
+    }
+
+    return is_match;
+}
+
+static picoquic_stored_ticket_t* picoquic_ticket_index_probe(picoquic_quic_t* quic,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
+    uint32_t version, uint64_t ticket_id, uint64_t current_time)
+{
+    picoquic_stored_ticket_t* found = NULL;
+    picoquic_ticket_index_header_t header;
+    const uint8_t* map = quic->ticket_store_map;
+    size_t map_size = quic->ticket_store_map_size;
+
+    if (picoquic_ticket_index_check(map, map_size, &header) == 0) {
+        /* Scan the appended tail first: those records are newer than the
+         * indexed ones, and within the tail the latest match wins. */
+        size_t offset = (size_t)header.appended_offset;
+
+        while (offset < map_size) {
+            picoquic_stored_ticket_t* stored =
+                picoquic_ticket_index_record(map, offset, map_size, &offset);
+
+            if (stored == NULL) {
+                break;
+            }
+            else if (picoquic_ticket_index_match(stored, sni, sni_length,
+                alpn, alpn_length, version, ticket_id, current_time)) {
+                if (found != NULL) {
+                    free(found);
+                }
+                found = stored;
+            }
+            else {
+                free(stored);
+            }
+        }
+
+        if (found == NULL && header.nb_buckets > 0) {
+            uint64_t hash = picoquic_ticket_index_hash(sni, sni_length, alpn, alpn_length);
+            uint64_t slot = hash % header.nb_buckets;
+
+            for (uint64_t nb_probed = 0; nb_probed < header.nb_buckets; nb_probed++) {
+                const uint8_t* entry = map + header.index_offset +
+                    slot * PICOQUIC_TICKET_INDEX_SLOT_SIZE;
+                uint64_t entry_hash = PICOPARSE_64(entry);
+
+                if (entry_hash == 0) {
+                    /* Empty slot ends the probe sequence */
+                    break;
+                }
+                else if (entry_hash == hash) {
+                    picoquic_stored_ticket_t* stored = picoquic_ticket_index_record(
+                        map, (size_t)PICOPARSE_64(entry + 8), (size_t)header.index_offset, NULL);
+
+                    if (stored != NULL) {
+                        if (picoquic_ticket_index_match(stored, sni, sni_length,
+                            alpn, alpn_length, version, ticket_id, current_time)) {
+                            found = stored;
+                            break;
+                        }
+                        free(stored);
+                    }
+                }
+                slot = (slot + 1) % header.nb_buckets;
+            }
+        }
+    }
+
+    return found;
+}
+
+void picoquic_ticket_store_unmap(picoquic_quic_t* quic)
+{
+    if (quic->ticket_store_map != NULL) {
+#ifndef _WINDOWS
+        if (quic->ticket_store_is_mapped) {
+            (void)munmap(quic->ticket_store_map, quic->ticket_store_map_size);
+        }
+        else
+#endif
+        {
+            free(quic->ticket_store_map);
+        }
+        quic->ticket_store_map = NULL;
+        quic->ticket_store_map_size = 0;
+        quic->ticket_store_is_mapped = 0;
+    }
+}
+
+int picoquic_load_tickets_indexed(picoquic_quic_t* quic, char const* ticket_file_name)
+{
+    int ret = 0;
+    uint8_t* map = NULL;
+    size_t map_size = 0;
+    int is_mapped = 0;
+    picoquic_ticket_index_header_t header;
+
+#ifndef _WINDOWS
+    int fd = open(ticket_file_name, O_RDONLY);
+
+    if (fd < 0) {
+        ret = (errno == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    }
+    else {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || st.st_size < 0) {
+            ret = -1;
+        }
+        else {
+            map_size = (size_t)st.st_size;
+            if (map_size > 0) {
+                map = (uint8_t*)mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map == MAP_FAILED) {
+                    map = NULL;
+                    ret = -1;
+                }
+                else {
+                    is_mapped = 1;
+                }
+            }
+        }
+        (void)close(fd);
+    }
+#else
+    int file_err = 0;
+    FILE* F = picoquic_file_open_ex(ticket_file_name, "rb", &file_err);
+
+    if (F == NULL) {
+        ret = (file_err == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    }
+    else {
+        long file_size;
+
+        if (fseek(F, 0, SEEK_END) != 0 || (file_size = ftell(F)) < 0 ||
+            fseek(F, 0, SEEK_SET) != 0) {
+            ret = -1;
+        }
+        else {
+            map_size = (size_t)file_size;
+            if (map_size > 0) {
+                map = (uint8_t*)malloc(map_size);
+                if (map == NULL) {
+                    ret = PICOQUIC_ERROR_MEMORY;
+                }
+                else if (fread(map, 1, map_size, F) != map_size) {
+                    ret = -1;
+                }
+            }
+        }
+        (void)picoquic_file_close(F);
+    }
+#endif
+
+    if (ret == 0) {
+        ret = picoquic_ticket_index_check(map, map_size, &header);
+    }
+
+    if (ret == 0) {
+        picoquic_ticket_store_unmap(quic);
+        quic->ticket_store_map = map;
+        quic->ticket_store_map_size = map_size;
+        quic->ticket_store_is_mapped = is_mapped;
+    }
+    else if (map != NULL) {
+#ifndef _WINDOWS
+        if (is_mapped) {
+            (void)munmap(map, map_size);
+        }
+        else
+#endif
+        {
+            free(map);
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_ticket_store_append(char const* ticket_file_name,
+    const picoquic_stored_ticket_t* ticket)
+{
+    int ret = 0;
+    FILE* F = NULL;
+    uint8_t magic_bytes[8];
+
+    /* Only append to files that carry the indexed header */
+    if ((F = picoquic_file_open(ticket_file_name, "rb")) == NULL) {
+        ret = PICOQUIC_ERROR_NO_SUCH_FILE;
+    }
+    else {
+        if (fread(magic_bytes, 1, 8, F) != 8 ||
+            PICOPARSE_32(magic_bytes) != PICOQUIC_TICKET_INDEX_MAGIC ||
+            PICOPARSE_32(magic_bytes + 4) != PICOQUIC_TICKET_INDEX_FORMAT) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        F = picoquic_file_close(F);
+    }
+
+    if (ret == 0) {
+        if ((F = picoquic_file_open(ticket_file_name, "ab")) == NULL) {
+            ret = -1;
+        }
+        else {
+            uint8_t buffer[PICOQUIC_TICKET_RECORD_SIZE_MAX];
+            size_t record_size = 0;
+
+            ret = picoquic_serialize_ticket(ticket, buffer, sizeof(buffer), &record_size);
+
+            if (ret == 0 &&
+                (fwrite(&record_size, 4, 1, F) != 1 ||
+                    fwrite(buffer, 1, record_size, F) != record_size)) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_save_tickets_indexed(picoquic_quic_t* quic, uint64_t current_time,
+    char const* ticket_file_name)
+{
+    int ret = 0;
+    FILE* F = NULL;
+    picoquic_stored_ticket_t* merged = NULL;
+    uint64_t nb_records = 0;
+    uint64_t nb_buckets = 16;
+
+    /* Collect the mapped records that are not shadowed by the resident
+     * list, walking the appended tail first so the newest copy of each
+     * (SNI, ALPN, version) wins. The resident list itself always shadows
+     * the file, since every materialized or updated ticket lives there. */
+    if (quic->ticket_store_map != NULL) {
+        picoquic_ticket_index_header_t header;
+
+        if (picoquic_ticket_index_check(quic->ticket_store_map,
+            quic->ticket_store_map_size, &header) == 0) {
+            size_t region_start[2] = { (size_t)header.appended_offset,
+                PICOQUIC_TICKET_INDEX_HEADER_SIZE };
+            size_t region_bound[2] = { quic->ticket_store_map_size,
+                (size_t)header.index_offset };
+
+            for (int r = 0; r < 2; r++) {
+                size_t offset = region_start[r];
+
+                while (offset < region_bound[r]) {
+                    picoquic_stored_ticket_t* stored = picoquic_ticket_index_record(
+                        quic->ticket_store_map, offset, region_bound[r], &offset);
+                    picoquic_stored_ticket_t* shadow;
+
+                    if (stored == NULL) {
+                        break;
+                    }
+                    if (stored->time_valid_until <= current_time) {
+                        free(stored);
+                        continue;
+                    }
+                    shadow = quic->p_first_ticket;
+                    while (shadow != NULL &&
+                        (shadow->sni_length != stored->sni_length ||
+                            shadow->alpn_length != stored->alpn_length ||
+                            shadow->version != stored->version ||
+                            memcmp(shadow->sni, stored->sni, stored->sni_length) != 0 ||
+                            memcmp(shadow->alpn, stored->alpn, stored->alpn_length) != 0)) {
+                        shadow = shadow->next_ticket;
+                    }
+                    if (shadow == NULL) {
+                        shadow = merged;
+                        while (shadow != NULL &&
+                            (shadow->sni_length != stored->sni_length ||
+                                shadow->alpn_length != stored->alpn_length ||
+                                shadow->version != stored->version ||
+                                memcmp(shadow->sni, stored->sni, stored->sni_length) != 0 ||
+                                memcmp(shadow->alpn, stored->alpn, stored->alpn_length) != 0)) {
+                            shadow = shadow->next_ticket;
+                        }
+                    }
+                    if (shadow != NULL) {
+                        free(stored);
+                    }
+                    else {
+                        stored->next_ticket = merged;
+                        merged = stored;
+                    }
+                }
+            }
+        }
+        /* The file is rewritten below; drop the mapping first. */
+        picoquic_ticket_store_unmap(quic);
+    }
+
+    /* Size the index at a load factor of one half */
+    {
+        const picoquic_stored_ticket_t* next = quic->p_first_ticket;
+
+        while (next != NULL) {
+            if (next->time_valid_until > current_time && next->was_used == 0) {
+                nb_records++;
+            }
+            next = next->next_ticket;
+        }
+        next = merged;
+        while (next != NULL) {
+            nb_records++;
+            next = next->next_ticket;
+        }
+        while (nb_buckets < 2 * nb_records) {
+            nb_buckets <<= 1;
+        }
+    }
+
+    if ((F = picoquic_file_open(ticket_file_name, "wb")) == NULL) {
+        ret = -1;
+    }
+    else {
+        uint8_t header_bytes[PICOQUIC_TICKET_INDEX_HEADER_SIZE];
+        uint8_t* index_bytes = (uint8_t*)calloc((size_t)nb_buckets,
+            PICOQUIC_TICKET_INDEX_SLOT_SIZE);
+        uint64_t index_offset = PICOQUIC_TICKET_INDEX_HEADER_SIZE;
+        const picoquic_stored_ticket_t* source[2] = { quic->p_first_ticket, merged };
+
+        if (index_bytes == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            /* Write a placeholder header, then the records, remembering
+             * each record's offset in the index. */
+            memset(header_bytes, 0, sizeof(header_bytes));
+            if (fwrite(header_bytes, 1, sizeof(header_bytes), F) != sizeof(header_bytes)) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+
+            for (int r = 0; ret == 0 && r < 2; r++) {
+                const picoquic_stored_ticket_t* next = source[r];
+
+                while (ret == 0 && next != NULL) {
+                    if (next->time_valid_until > current_time && next->was_used == 0) {
+                        uint8_t buffer[PICOQUIC_TICKET_RECORD_SIZE_MAX];
+                        size_t record_size = 0;
+
+                        ret = picoquic_serialize_ticket(next, buffer, sizeof(buffer), &record_size);
+
+                        if (ret == 0) {
+                            if (fwrite(&record_size, 4, 1, F) != 1 ||
+                                fwrite(buffer, 1, record_size, F) != record_size) {
+                                ret = PICOQUIC_ERROR_INVALID_FILE;
+                            }
+                            else {
+                                uint64_t hash = picoquic_ticket_index_hash(
+                                    next->sni, next->sni_length, next->alpn, next->alpn_length);
+                                uint64_t slot = hash % nb_buckets;
+
+                                while (PICOPARSE_64(index_bytes +
+                                    slot * PICOQUIC_TICKET_INDEX_SLOT_SIZE) != 0) {
+                                    slot = (slot + 1) % nb_buckets;
+                                }
+                                picoformat_64(index_bytes +
+                                    slot * PICOQUIC_TICKET_INDEX_SLOT_SIZE, hash);
+                                picoformat_64(index_bytes +
+                                    slot * PICOQUIC_TICKET_INDEX_SLOT_SIZE + 8, index_offset);
+                                index_offset += 4 + record_size;
+                            }
+                        }
+                    }
+                    next = next->next_ticket;
+                }
+            }
+
+            if (ret == 0 &&
+                fwrite(index_bytes, PICOQUIC_TICKET_INDEX_SLOT_SIZE, (size_t)nb_buckets, F)
+                != (size_t)nb_buckets) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+
+            if (ret == 0) {
+                picoformat_32(header_bytes, PICOQUIC_TICKET_INDEX_MAGIC);
+                picoformat_32(header_bytes + 4, PICOQUIC_TICKET_INDEX_FORMAT);
+                picoformat_64(header_bytes + 8, nb_buckets);
+                picoformat_64(header_bytes + 16, index_offset);
+                picoformat_64(header_bytes + 24, nb_records);
+                if (fseek(F, 0, SEEK_SET) != 0 ||
+                    fwrite(header_bytes, 1, sizeof(header_bytes), F) != sizeof(header_bytes)) {
+                    ret = PICOQUIC_ERROR_INVALID_FILE;
+                }
+            }
+            free(index_bytes);
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    picoquic_free_tickets(&merged);
+
     return ret;
 }
 
@@ -557,8 +1172,16 @@ void picoquic_update_stored_ticket(picoquic_cnx_t* cnx, picoquic_path_t * path_x
         if (next != NULL) {
             next->ip_addr_length = ip_addr_length;
             memcpy(next->ip_addr, ip_addr, ip_addr_length);
+            uint64_t target_cwin = path_x->cwin;
+
+            if (path_x->bandwidth_estimate_max > 0) {
+                /* Store the validated bandwidth estimate rather than the
+                 * instantaneous window, which may be deflated if the
+                 * connection ended application limited. */
+                target_cwin = (path_x->bandwidth_estimate_max * path_x->rtt_min) / 1000000ull;
+            }
             next->tp_0rtt[picoquic_tp_0rtt_rtt_local] = path_x->rtt_min;
-            next->tp_0rtt[picoquic_tp_0rtt_cwin_local] = path_x->cwin;
+            next->tp_0rtt[picoquic_tp_0rtt_cwin_local] = target_cwin;
             next->tp_0rtt[picoquic_tp_0rtt_rtt_remote] = path_x->rtt_min_remote;
             next->tp_0rtt[picoquic_tp_0rtt_cwin_remote] = path_x->cwin_remote;
             next->ip_addr_client_length = path_x->ip_client_remote_length;
@@ -584,6 +1207,11 @@ void picoquic_seed_ticket(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
         picoquic_get_ip_addr((struct sockaddr*) & path_x->peer_addr, &ip_addr, &ip_addr_length);
         (void) picoquic_remember_issued_ticket(cnx->quic, cnx->issued_ticket_id,
             path_x->rtt_min, target_cwin, ip_addr, ip_addr_length);
+        /* Let the optional hints cache learn from this path */
+        if (cnx->quic->hints_update_fn != NULL) {
+            cnx->quic->hints_update_fn(cnx->quic->seed_hints_ctx,
+                (struct sockaddr*)&path_x->peer_addr, path_x->rtt_min, target_cwin);
+        }
     }
     path_x->is_ticket_seeded = 1;
 }
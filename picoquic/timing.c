@@ -87,6 +87,151 @@ uint64_t picoquic_current_retransmit_timer(picoquic_cnx_t* cnx, picoquic_path_t
     return rto;
 }
 
+/* HDR style histogram of raw RTT samples: 250 microsecond wide buckets
+ * below 1 ms, then four linear sub-buckets per power of two octave, so
+ * the relative resolution stays around 25% whatever the RTT scale. The
+ * histogram counts every sample, including the ones rejected by the
+ * outlier filter, so spikes remain visible to monitoring.
+ */
+size_t picoquic_rtt_histogram_bucket(uint64_t rtt)
+{
+    size_t bucket;
+
+    if (rtt < 1000) {
+        bucket = (size_t)(rtt / 250);
+    }
+    else {
+        size_t octave = 0;
+        uint64_t v = rtt / 1000;
+        uint64_t base;
+
+        while (v >= 2) {
+            v >>= 1;
+            octave++;
+        }
+        base = 1000ull << octave;
+        bucket = 4 + (octave * 4) + (size_t)((4 * (rtt - base)) / base);
+        if (bucket >= PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) {
+            bucket = PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS - 1;
+        }
+    }
+
+    return bucket;
+}
+
+static void picoquic_record_rtt_histogram(picoquic_path_t* path_x, uint64_t rtt)
+{
+    size_t bucket = picoquic_rtt_histogram_bucket(rtt);
+
+    if (path_x->rtt_histogram[bucket] < UINT32_MAX) {
+        path_x->rtt_histogram[bucket] += 1;
+    }
+}
+
+uint64_t picoquic_rtt_histogram_bucket_floor(size_t bucket)
+{
+    uint64_t floor_value;
+
+    if (bucket < 4) {
+        floor_value = 250ull * bucket;
+    }
+    else {
+        size_t octave = (bucket - 4) / 4;
+        uint64_t base = 1000ull << octave;
+
+        floor_value = base + (((uint64_t)((bucket - 4) & 3)) * base) / 4;
+    }
+
+    return floor_value;
+}
+
+/* Approximate RTT quantile from the per path histogram: the floor of the
+ * bucket where the cumulative count reaches "percent" percent of the
+ * samples. Returns zero when no sample was recorded yet. */
+uint64_t picoquic_rtt_histogram_quantile(picoquic_path_t* path_x, unsigned int percent)
+{
+    uint64_t nb_total = 0;
+    uint64_t quantile = 0;
+
+    for (size_t i = 0; i < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS; i++) {
+        nb_total += path_x->rtt_histogram[i];
+    }
+
+    if (nb_total > 0) {
+        uint64_t target = (nb_total * percent + 99) / 100;
+        uint64_t cumulative = 0;
+
+        for (size_t i = 0; i < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS; i++) {
+            cumulative += path_x->rtt_histogram[i];
+            if (cumulative >= target) {
+                quantile = picoquic_rtt_histogram_bucket_floor(i);
+                break;
+            }
+        }
+    }
+
+    return quantile;
+}
+
+int picoquic_get_path_rtt_histogram(picoquic_cnx_t* cnx, uint64_t unique_path_id, uint32_t* buckets, size_t nb_buckets)
+{
+    int ret = -1;
+    int path_id = picoquic_get_path_id_from_unique(cnx, unique_path_id);
+
+    if (path_id >= 0 && buckets != NULL) {
+        size_t nb_copied = (nb_buckets < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) ?
+            nb_buckets : PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS;
+
+        memcpy(buckets, cnx->path[path_id]->rtt_histogram, nb_copied * sizeof(uint32_t));
+        for (size_t i = nb_copied; i < nb_buckets; i++) {
+            buckets[i] = 0;
+        }
+        ret = 0;
+    }
+
+    return ret;
+}
+
+void picoquic_record_stream_time(uint32_t* histogram, uint64_t duration)
+{
+    size_t bucket = picoquic_rtt_histogram_bucket(duration);
+
+    if (histogram[bucket] < UINT32_MAX) {
+        histogram[bucket] += 1;
+    }
+}
+
+int picoquic_get_stream_time_histogram(picoquic_cnx_t* cnx, picoquic_stream_time_metric_enum metric,
+    uint32_t* buckets, size_t nb_buckets)
+{
+    int ret = -1;
+    uint32_t* histogram = NULL;
+
+    switch (metric) {
+    case picoquic_stream_time_to_first_byte:
+        histogram = cnx->stream_ttfb_histogram;
+        break;
+    case picoquic_stream_time_to_completion:
+        histogram = cnx->stream_completion_histogram;
+        break;
+    default:
+        break;
+    }
+
+    if (histogram != NULL && buckets != NULL) {
+        size_t nb_copied = (nb_buckets < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) ?
+            nb_buckets : PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS;
+
+        memcpy(buckets, histogram, nb_copied * sizeof(uint32_t));
+        for (size_t i = nb_copied; i < nb_buckets; i++) {
+            buckets[i] = 0;
+        }
+        ret = 0;
+    }
+
+    return ret;
+}
+
 /* The BDP seed is validated upon receiving the first RTT measurement */
 static void picoquic_validate_bdp_seed(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t rtt_sample, uint64_t current_time)
 {
@@ -204,6 +349,34 @@ void picoquic_update_path_rtt(picoquic_cnx_t* cnx, picoquic_path_t* old_path, pi
             }
         }
         old_path->rtt_sample = rtt_estimate;
+        picoquic_record_rtt_histogram(old_path, rtt_estimate);
+        if (cnx->rtt_observer_fn != NULL) {
+            /* Deliver the raw sample, before the outlier filter */
+            cnx->rtt_observer_fn(cnx, old_path->unique_path_id,
+                picoquic_rtt_sample_source_ack, rtt_estimate, cnx->v_rtt_observer_ctx);
+        }
+
+        /* Spiky links such as WiFi produce isolated RTT outliers that
+        * pollute the smoothed RTT and inflate the PTO. Reject samples
+        * that exceed both the variance based threshold and twice the
+        * smoothed RTT, unless the excess persists: after
+        * PICOQUIC_RTT_OUTLIER_PERSISTENCE consecutive outliers the
+        * samples are accepted as a real shift of the path RTT. Rejected
+        * samples still update the histogram and the max RTT statistics.
+        */
+        if (old_path->rtt_is_initialized &&
+            rtt_estimate > old_path->smoothed_rtt + 4 * old_path->rtt_variant &&
+            rtt_estimate > 2 * old_path->smoothed_rtt &&
+            old_path->nb_rtt_outliers_consecutive + 1 < PICOQUIC_RTT_OUTLIER_PERSISTENCE) {
+            old_path->nb_rtt_outliers++;
+            old_path->nb_rtt_outliers_consecutive++;
+            if (old_path->rtt_max < rtt_estimate) {
+                old_path->rtt_max = rtt_estimate;
+            }
+            return;
+        }
+        old_path->nb_rtt_outliers_consecutive = 0;
+
         /* During a measurement period, accumulate data:
         * - number of estimates since update
         * - sum of all estimates since update
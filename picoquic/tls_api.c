@@ -76,6 +76,8 @@
 typedef struct st_picoquic_tls_ctx_t {
     ptls_t* tls;
     picoquic_cnx_t* cnx;
+    picoquic_quic_t* quic;
+    struct st_picoquic_tls_ctx_t* next_in_pool;
     int client_mode;
     ptls_raw_extension_t ext[2];
     ptls_handshake_properties_t handshake_properties;
@@ -84,10 +86,30 @@ typedef struct st_picoquic_tls_ctx_t {
     size_t alpn_count;
     uint8_t* ext_data;
     size_t ext_data_size;
+    ptls_cipher_suite_t* cipher_suite; /* Cached when hibernation frees the ptls_t */
     uint8_t app_secret_enc[PTLS_MAX_DIGEST_SIZE];
     uint8_t app_secret_dec[PTLS_MAX_DIGEST_SIZE];
+    struct st_picoquic_async_sign_state_t* async_sign;
 } picoquic_tls_ctx_t;
 
+/* Asynchronous certificate signing (see picoquic_set_async_handshake).
+ * Requires a picotls version that defines PTLS_ERROR_ASYNC_OPERATION;
+ * without it the feature compiles out and signing stays inline. */
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+#define PICOQUIC_TLS_RET_IS_ASYNC(ret) ((ret) == PTLS_ERROR_ASYNC_OPERATION)
+
+typedef struct st_picoquic_async_sign_certificate_t {
+    ptls_sign_certificate_t super;
+    ptls_sign_certificate_t* delegate;
+} picoquic_async_sign_certificate_t;
+
+static int picoquic_async_sign_certificate_cb(ptls_sign_certificate_t* _self, ptls_t* tls,
+    ptls_async_job_t** async, uint16_t* selected_algorithm, ptls_buffer_t* output,
+    ptls_iovec_t input, const uint16_t* algorithms, size_t num_algorithms);
+#else
+#define PICOQUIC_TLS_RET_IS_ASYNC(ret) (0)
+#endif
+
 struct st_picoquic_log_event_t {
     ptls_log_event_t super;
     FILE* fp;
@@ -115,6 +137,7 @@ picoquic_set_tls_root_certificates_t picoquic_set_tls_root_certificates_fn = NUL
 picoquic_explain_crypto_error_t picoquic_explain_crypto_error_fn = NULL;
 picoquic_clear_crypto_errors_t picoquic_clear_crypto_errors_fn = NULL;
 picoquic_crypto_random_provider_t picoquic_crypto_random_provider_fn = NULL;
+picoquic_pn_encrypt_batch_t picoquic_pn_encrypt_batch_fn = NULL;
 
 /* Initialization of the cryptographic tables and functions
  * 
@@ -198,8 +221,11 @@ static void picoquic_tls_api_zero()
 
     picoquic_explain_crypto_error_fn = NULL;
     picoquic_clear_crypto_errors_fn = NULL;
- 
+
     picoquic_crypto_random_provider_fn = NULL;
+    picoquic_pn_encrypt_batch_fn = NULL;
+    picoquic_key_exchange_offload_fn = NULL;
+    picoquic_aead_encrypt_gather_fn = NULL;
 }
 
 void picoquic_tls_api_init()
@@ -214,6 +240,7 @@ void picoquic_tls_api_init()
 void picoquic_tls_api_unload()
 {
     if (tls_api_is_init) {
+        picoquic_release_precomputed_key_shares();
         picoquic_tls_api_init_providers(1);
         picoquic_tls_api_zero();
         tls_api_is_init = 0;
@@ -224,6 +251,7 @@ void picoquic_tls_api_reset(uint64_t init_flags)
 {
     if (tls_api_is_init) {
         tls_api_is_init = 0;
+        picoquic_release_precomputed_key_shares();
         picoquic_tls_api_init_providers(2);
         picoquic_tls_api_zero();
     }
@@ -299,6 +327,11 @@ void picoquic_register_crypto_random_provider_fn(picoquic_crypto_random_provider
     picoquic_crypto_random_provider_fn = crypto_random_provider_fn;
 }
 
+void picoquic_register_pn_encrypt_batch_fn(picoquic_pn_encrypt_batch_t pn_encrypt_batch_fn)
+{
+    picoquic_pn_encrypt_batch_fn = pn_encrypt_batch_fn;
+}
+
 /* List of cipher suites that are suitable for this context */
 static int picoquic_set_cipher_suite_list(ptls_cipher_suite_t** selected_suites, int cipher_suite_id, int use_low_memory)
 {
@@ -473,6 +506,190 @@ size_t picoquic_hash_get_length(char const* algorithm_name) {
     return len;
 }
 
+/* Key exchange offload. When a hook is registered, the algorithm tables
+ * handed to picotls are replaced by proxies whose exchange method routes
+ * through the hook, passing the original algorithm along. The proxies are
+ * shallow copies, so the create method and identifiers behave exactly like
+ * the originals; only the one-shot exchange used for the server key share
+ * is redirected. */
+picoquic_key_exchange_offload_t picoquic_key_exchange_offload_fn = NULL;
+
+static ptls_key_exchange_algorithm_t picoquic_key_exchange_proxies[PICOQUIC_KEY_EXCHANGES_NB_MAX];
+static ptls_key_exchange_algorithm_t* picoquic_key_exchange_proxy_table[PICOQUIC_KEY_EXCHANGES_NB_MAX + 1];
+static ptls_key_exchange_algorithm_t* picoquic_key_exchange_proxy_origin[PICOQUIC_KEY_EXCHANGES_NB_MAX];
+
+void picoquic_register_key_exchange_offload_fn(picoquic_key_exchange_offload_t key_exchange_offload_fn)
+{
+    picoquic_key_exchange_offload_fn = key_exchange_offload_fn;
+}
+
+static ptls_key_exchange_algorithm_t* picoquic_key_exchange_proxy_original(
+    const ptls_key_exchange_algorithm_t* algo)
+{
+    ptls_key_exchange_algorithm_t* original = NULL;
+
+    for (int i = 0; i < PICOQUIC_KEY_EXCHANGES_NB_MAX; i++) {
+        if (algo == &picoquic_key_exchange_proxies[i]) {
+            original = picoquic_key_exchange_proxy_origin[i];
+            break;
+        }
+    }
+
+    return original;
+}
+
+static int picoquic_key_exchange_offload_proxy(const ptls_key_exchange_algorithm_t* algo,
+    ptls_iovec_t* pubkey, ptls_iovec_t* secret, ptls_iovec_t peerkey)
+{
+    ptls_key_exchange_algorithm_t* original = picoquic_key_exchange_proxy_original(algo);
+
+    if (original == NULL) {
+        return PTLS_ERROR_LIBRARY;
+    }
+    else if (picoquic_key_exchange_offload_fn != NULL) {
+        return picoquic_key_exchange_offload_fn(original, pubkey, secret, peerkey);
+    }
+    else {
+        return original->exchange(original, pubkey, secret, peerkey);
+    }
+}
+
+/* Precomputed client key shares. The ephemeral key pair sent in the client
+ * hello key share extension is the dominant cost of assembling the first
+ * flight; gateways that open many client connections to few origins can
+ * generate shares ahead of time, off the connection setup path, and have
+ * each new handshake consume one from this pool. The pool is fed by
+ * picoquic_precompute_key_shares and drained through the create method of
+ * the proxy algorithms, which falls back to on-demand generation when the
+ * pool is empty. Like the proxy tables above, the pool is a process level
+ * resource and is not protected by a lock. */
+#define PICOQUIC_KEY_SHARE_POOL_MAX 32
+
+typedef struct st_picoquic_key_share_slot_t {
+    ptls_key_exchange_algorithm_t* algo;
+    ptls_key_exchange_context_t* keyex;
+} picoquic_key_share_slot_t;
+
+static picoquic_key_share_slot_t picoquic_key_share_pool[PICOQUIC_KEY_SHARE_POOL_MAX];
+static int picoquic_key_share_pool_is_enabled = 0;
+
+static int picoquic_key_exchange_pooled_create(const struct st_ptls_key_exchange_algorithm_t* algo,
+    ptls_key_exchange_context_t** keyex)
+{
+    ptls_key_exchange_algorithm_t* original = picoquic_key_exchange_proxy_original(algo);
+
+    if (original == NULL) {
+        return PTLS_ERROR_LIBRARY;
+    }
+
+    for (int i = 0; i < PICOQUIC_KEY_SHARE_POOL_MAX; i++) {
+        if (picoquic_key_share_pool[i].keyex != NULL &&
+            picoquic_key_share_pool[i].algo == original) {
+            *keyex = picoquic_key_share_pool[i].keyex;
+            picoquic_key_share_pool[i].keyex = NULL;
+            picoquic_key_share_pool[i].algo = NULL;
+            return 0;
+        }
+    }
+
+    return original->create(original, keyex);
+}
+
+static ptls_key_exchange_algorithm_t** picoquic_key_exchange_proxy_list(
+    ptls_key_exchange_algorithm_t** originals)
+{
+    int nb_algos = 0;
+
+    for (int i = 0; i < PICOQUIC_KEY_EXCHANGES_NB_MAX && originals[i] != NULL; i++) {
+        picoquic_key_exchange_proxies[nb_algos] = *originals[i];
+        picoquic_key_exchange_proxies[nb_algos].create = picoquic_key_exchange_pooled_create;
+        picoquic_key_exchange_proxies[nb_algos].exchange = picoquic_key_exchange_offload_proxy;
+        picoquic_key_exchange_proxy_origin[nb_algos] = originals[i];
+        picoquic_key_exchange_proxy_table[nb_algos] = &picoquic_key_exchange_proxies[nb_algos];
+        nb_algos++;
+    }
+    picoquic_key_exchange_proxy_table[nb_algos] = NULL;
+
+    return picoquic_key_exchange_proxy_table;
+}
+
+int picoquic_precompute_key_shares(picoquic_quic_t* quic, size_t nb_shares)
+{
+    int ret = 0;
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+    ptls_key_exchange_algorithm_t* algo = NULL;
+
+    if (ctx == NULL || ctx->key_exchanges == NULL || ctx->key_exchanges[0] == NULL) {
+        ret = -1;
+    }
+    else {
+        /* Route the context's algorithms through the proxies, so that the
+         * create method can serve shares from the pool. The client share is
+         * always generated with the first algorithm of the list. */
+        if (ctx->key_exchanges != picoquic_key_exchange_proxy_table) {
+            ctx->key_exchanges = picoquic_key_exchange_proxy_list(ctx->key_exchanges);
+        }
+        algo = picoquic_key_exchange_proxy_origin[0];
+        picoquic_key_share_pool_is_enabled = 1;
+    }
+
+    for (size_t n = 0; ret == 0 && n < nb_shares; n++) {
+        int i_slot = -1;
+
+        for (int i = 0; i < PICOQUIC_KEY_SHARE_POOL_MAX; i++) {
+            if (picoquic_key_share_pool[i].keyex == NULL) {
+                i_slot = i;
+                break;
+            }
+        }
+
+        if (i_slot < 0) {
+            /* The pool is full */
+            break;
+        }
+        else {
+            ptls_key_exchange_context_t* keyex = NULL;
+
+            if (algo->create(algo, &keyex) != 0) {
+                ret = -1;
+            }
+            else {
+                picoquic_key_share_pool[i_slot].algo = algo;
+                picoquic_key_share_pool[i_slot].keyex = keyex;
+            }
+        }
+    }
+
+    return ret;
+}
+
+size_t picoquic_nb_precomputed_key_shares()
+{
+    size_t nb_shares = 0;
+
+    for (int i = 0; i < PICOQUIC_KEY_SHARE_POOL_MAX; i++) {
+        if (picoquic_key_share_pool[i].keyex != NULL) {
+            nb_shares++;
+        }
+    }
+
+    return nb_shares;
+}
+
+void picoquic_release_precomputed_key_shares()
+{
+    for (int i = 0; i < PICOQUIC_KEY_SHARE_POOL_MAX; i++) {
+        if (picoquic_key_share_pool[i].keyex != NULL) {
+            ptls_key_exchange_context_t* keyex = picoquic_key_share_pool[i].keyex;
+
+            picoquic_key_share_pool[i].keyex = NULL;
+            picoquic_key_share_pool[i].algo = NULL;
+            (void)keyex->on_exchange(&keyex, 1, NULL, ptls_iovec_init(NULL, 0));
+        }
+    }
+    picoquic_key_share_pool_is_enabled = 0;
+}
+
 /* Set the supported key exchange in the TLS context
 * Supported algorithms are defined by keyexchange_id
 * - 0: set all supported algorithms
@@ -500,6 +717,10 @@ static int picoquic_set_key_exchange_in_ctx(ptls_context_t* ctx, int key_exchang
         break;
     }
 
+    if (ret == 0 && (picoquic_key_exchange_offload_fn != NULL || picoquic_key_share_pool_is_enabled)) {
+        ctx->key_exchanges = picoquic_key_exchange_proxy_list(ctx->key_exchanges);
+    }
+
     return ret;
 }
 
@@ -544,10 +765,103 @@ int picoquic_set_private_key_from_file(picoquic_quic_t* quic, char const* file_n
     return set_private_key_from_file(file_name, quic->tls_master_ctx);
 }
 
+/* Deferred server credentials. Instead of passing the certificate and key
+ * file names to picoquic_create, which parses them immediately, an
+ * application hosting many listening contexts can create the context
+ * without credentials and register the file names here. The PEM chain and
+ * key are then parsed on the first server handshake that needs them, so
+ * startup time and resident certificate memory scale with the tenants
+ * actually receiving traffic, not with the size of the configuration. A
+ * parse failure is remembered, so a flood of handshakes towards a
+ * misconfigured tenant does not retry the file system on every attempt.
+ */
+int picoquic_set_tls_credentials_files(picoquic_quic_t* quic, char const* cert_file_name, char const* key_file_name)
+{
+    int ret = 0;
+
+    if (cert_file_name == NULL || key_file_name == NULL) {
+        ret = -1;
+    }
+    else {
+        if (quic->lazy_cert_file_name != NULL) {
+            free(quic->lazy_cert_file_name);
+        }
+        if (quic->lazy_key_file_name != NULL) {
+            free(quic->lazy_key_file_name);
+        }
+        quic->lazy_cert_file_name = picoquic_string_duplicate(cert_file_name);
+        quic->lazy_key_file_name = picoquic_string_duplicate(key_file_name);
+        quic->lazy_credentials_failed = 0;
+        if (quic->lazy_cert_file_name == NULL || quic->lazy_key_file_name == NULL) {
+            picoquic_clear_tls_credentials_files(quic);
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_clear_tls_credentials_files(picoquic_quic_t* quic)
+{
+    if (quic->lazy_cert_file_name != NULL) {
+        free(quic->lazy_cert_file_name);
+        quic->lazy_cert_file_name = NULL;
+    }
+    if (quic->lazy_key_file_name != NULL) {
+        free(quic->lazy_key_file_name);
+        quic->lazy_key_file_name = NULL;
+    }
+    quic->lazy_credentials_failed = 0;
+}
+
+int picoquic_tls_load_credentials_if_needed(picoquic_quic_t* quic)
+{
+    int ret = 0;
+
+    if (quic->lazy_credentials_failed) {
+        ret = -1;
+    }
+    else if (quic->lazy_cert_file_name != NULL) {
+        ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+        if (ptls_load_certificates(ctx, quic->lazy_cert_file_name) != 0) {
+            DBG_PRINTF("Cannot load certificate: %s", quic->lazy_cert_file_name);
+            ret = -1;
+        }
+        else {
+            ret = set_private_key_from_file(quic->lazy_key_file_name, ctx);
+            if (ret != 0) {
+                DBG_PRINTF("Cannot load key: %s, ret = 0x%x", quic->lazy_key_file_name, ret);
+            }
+        }
+
+        if (ret != 0) {
+            quic->lazy_credentials_failed = 1;
+        }
+        else {
+            /* Loaded. Drop the file names so later calls are a null test */
+            picoquic_clear_tls_credentials_files(quic);
+        }
+    }
+
+    return ret;
+}
+
 /* Clear certificate objects allocated by the crypto stack for a certficate
 */
 void picoquic_dispose_sign_certificate(ptls_context_t* ctx)
 {
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+    /* If the async handshake wrapper is installed, peel it off so the
+     * provider dispose function sees the certificate it allocated. */
+    if (ctx->sign_certificate != NULL &&
+        ctx->sign_certificate->cb == picoquic_async_sign_certificate_cb) {
+        picoquic_async_sign_certificate_t* wrapper =
+            (picoquic_async_sign_certificate_t*)ctx->sign_certificate;
+        ctx->sign_certificate = wrapper->delegate;
+        free(wrapper);
+    }
+#endif
     if (ctx->sign_certificate != NULL) {
         if (picoquic_dispose_sign_certificate_fn != NULL) {
             /* we expect the dispose function to free dependencies,
@@ -599,6 +913,9 @@ int picoquic_set_tls_root_certificates(picoquic_quic_t* quic, ptls_iovec_t* cert
 {
     int ret = -1;
 
+    /* The provider installs the certificates in the verifier's store */
+    picoquic_tls_ensure_certificate_verifier(quic);
+
     if (picoquic_set_tls_root_certificates_fn != NULL) {
         if ((ret = picoquic_set_tls_root_certificates_fn(quic->tls_master_ctx, certs, count)) == 0){
             quic->is_cert_store_not_empty = 1;
@@ -717,6 +1034,95 @@ uint64_t picoquic_crypto_uniform_random(picoquic_quic_t* quic, uint64_t rnd_max)
     return rnd % rnd_max;
 }
 
+/* Fast per-context DRBG. picoquic_crypto_random funnels into the picotls
+ * random provider, which may issue a getrandom() system call per request on
+ * some builds; during connection storms that cost shows up on every
+ * connection ID drawn. The DRBG below runs the ChaCha20 block function over
+ * a key drawn from the crypto random generator, producing randomness without
+ * leaving user space, and reseeds after a fixed amount of output. It is
+ * intended for values that must be unpredictable but are not key material,
+ * such as connection IDs; keys and seeds keep using picoquic_crypto_random.
+ */
+
+#define PICOQUIC_FAST_RANDOM_RESEED_INTERVAL 0x100000
+
+#define PICOQUIC_CHACHA_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define PICOQUIC_CHACHA_QR(a, b, c, d) \
+    do { \
+        a += b; d ^= a; d = PICOQUIC_CHACHA_ROTL(d, 16); \
+        c += d; b ^= c; b = PICOQUIC_CHACHA_ROTL(b, 12); \
+        a += b; d ^= a; d = PICOQUIC_CHACHA_ROTL(d, 8); \
+        c += d; b ^= c; b = PICOQUIC_CHACHA_ROTL(b, 7); \
+    } while (0)
+
+static void picoquic_chacha20_block(const uint8_t* key, uint64_t block_number, uint8_t* output)
+{
+    uint32_t input[16];
+    uint32_t x[16];
+
+    input[0] = 0x61707865;
+    input[1] = 0x3320646e;
+    input[2] = 0x79622d32;
+    input[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        input[4 + i] = (uint32_t)key[4 * i] |
+            ((uint32_t)key[4 * i + 1] << 8) |
+            ((uint32_t)key[4 * i + 2] << 16) |
+            ((uint32_t)key[4 * i + 3] << 24);
+    }
+    input[12] = (uint32_t)block_number;
+    input[13] = (uint32_t)(block_number >> 32);
+    input[14] = 0;
+    input[15] = 0;
+
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; round++) {
+        PICOQUIC_CHACHA_QR(x[0], x[4], x[8], x[12]);
+        PICOQUIC_CHACHA_QR(x[1], x[5], x[9], x[13]);
+        PICOQUIC_CHACHA_QR(x[2], x[6], x[10], x[14]);
+        PICOQUIC_CHACHA_QR(x[3], x[7], x[11], x[15]);
+        PICOQUIC_CHACHA_QR(x[0], x[5], x[10], x[15]);
+        PICOQUIC_CHACHA_QR(x[1], x[6], x[11], x[12]);
+        PICOQUIC_CHACHA_QR(x[2], x[7], x[8], x[13]);
+        PICOQUIC_CHACHA_QR(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t y = x[i] + input[i];
+        output[4 * i] = (uint8_t)y;
+        output[4 * i + 1] = (uint8_t)(y >> 8);
+        output[4 * i + 2] = (uint8_t)(y >> 16);
+        output[4 * i + 3] = (uint8_t)(y >> 24);
+    }
+}
+
+void picoquic_fast_random(picoquic_quic_t* quic, void* buf, size_t len)
+{
+    uint8_t* x = (uint8_t*)buf;
+
+    while (len > 0) {
+        uint8_t block[64];
+        size_t copied = (len > sizeof(block)) ? sizeof(block) : len;
+
+        if (quic->fast_random_remaining == 0) {
+            /* First use, or the reseed interval is exhausted. */
+            picoquic_crypto_random(quic, quic->fast_random_key, sizeof(quic->fast_random_key));
+            quic->fast_random_block = 0;
+            quic->fast_random_remaining = PICOQUIC_FAST_RANDOM_RESEED_INTERVAL;
+        }
+        picoquic_chacha20_block(quic->fast_random_key, quic->fast_random_block, block);
+        quic->fast_random_block++;
+        if (quic->fast_random_remaining > sizeof(block)) {
+            quic->fast_random_remaining -= sizeof(block);
+        }
+        else {
+            quic->fast_random_remaining = 0;
+        }
+        memcpy(x, block, copied);
+        x += copied;
+        len -= copied;
+    }
+}
+
 /*
  * Non crypto public random generator. This is meant to provide good enough randomness
  * without disclosing the state of the crypto random number generator. This is
@@ -1006,6 +1412,72 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
  * Should return 0 if the ticket is good, etc.
  */
 
+/* Session ticket decryption cache. Entries are matched on a keyed hash of
+ * the full ticket ciphertext plus a prefix comparison; the key is drawn at
+ * random on first use so an attacker cannot engineer hash collisions. The
+ * cached plaintext keeps the 4 byte version trailer, so the per-connection
+ * version check runs on cache hits exactly as on fresh decryptions.
+ */
+static uint64_t picoquic_siphash24(const uint8_t* key, const uint8_t* data, size_t length);
+
+static picoquic_ticket_cache_entry_t* picoquic_ticket_cache_find(picoquic_quic_t* quic,
+    const uint8_t* ticket, size_t ticket_length, uint64_t ticket_hash)
+{
+    picoquic_ticket_cache_entry_t* found = NULL;
+
+    for (int i = 0; i < PICOQUIC_TICKET_CACHE_NB_ENTRIES; i++) {
+        picoquic_ticket_cache_entry_t* entry = &quic->ticket_cache[i];
+        if (entry->plaintext != NULL &&
+            entry->ticket_hash == ticket_hash &&
+            entry->ticket_length == ticket_length &&
+            memcmp(entry->prefix, ticket, PICOQUIC_TICKET_CACHE_PREFIX_LENGTH) == 0) {
+            entry->last_used = ++quic->ticket_cache_use_count;
+            found = entry;
+            break;
+        }
+    }
+
+    return found;
+}
+
+static void picoquic_ticket_cache_store(picoquic_quic_t* quic,
+    const uint8_t* ticket, size_t ticket_length, uint64_t ticket_hash,
+    const uint8_t* plaintext, size_t plaintext_length)
+{
+    picoquic_ticket_cache_entry_t* victim = &quic->ticket_cache[0];
+    uint8_t* copied = (uint8_t*)malloc(plaintext_length);
+
+    if (copied != NULL) {
+        /* Evict the least recently used entry. Empty slots have
+         * last_used == 0 and are picked first. */
+        for (int i = 1; i < PICOQUIC_TICKET_CACHE_NB_ENTRIES; i++) {
+            if (quic->ticket_cache[i].last_used < victim->last_used) {
+                victim = &quic->ticket_cache[i];
+            }
+        }
+        if (victim->plaintext != NULL) {
+            free(victim->plaintext);
+        }
+        memcpy(copied, plaintext, plaintext_length);
+        victim->ticket_hash = ticket_hash;
+        victim->ticket_length = ticket_length;
+        victim->plaintext_length = plaintext_length;
+        memcpy(victim->prefix, ticket, PICOQUIC_TICKET_CACHE_PREFIX_LENGTH);
+        victim->plaintext = copied;
+        victim->last_used = ++quic->ticket_cache_use_count;
+    }
+}
+
+void picoquic_clear_ticket_cache(picoquic_quic_t* quic)
+{
+    for (int i = 0; i < PICOQUIC_TICKET_CACHE_NB_ENTRIES; i++) {
+        if (quic->ticket_cache[i].plaintext != NULL) {
+            free(quic->ticket_cache[i].plaintext);
+        }
+        memset(&quic->ticket_cache[i], 0, sizeof(picoquic_ticket_cache_entry_t));
+    }
+}
+
 int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_ticket_ctx,
     ptls_t* tls, int is_encrypt, ptls_buffer_t* dst, ptls_iovec_t src)
 {
@@ -1047,6 +1519,13 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
                 dst->base + start_off, data_length, seq_num, NULL, 0);
             /* Remember issued ticket ID in connection context */
             quic->cnx_in_progress->issued_ticket_id = seq_num;
+            if (quic->ticket_issuance_delay > 0) {
+                /* Hold the 1-RTT crypto stream carrying this ticket until
+                 * the configured delay after the handshake, see
+                 * picoquic_set_ticket_issuance_delay */
+                quic->cnx_in_progress->ticket_send_time =
+                    picoquic_get_quic_time(quic) + quic->ticket_issuance_delay;
+            }
         }
     } else {
         ptls_aead_context_t* aead_dec = (ptls_aead_context_t*)quic->aead_decrypt_ticket_ctx;
@@ -1058,9 +1537,31 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
         } else if ((ret = ptls_buffer_reserve(dst, src.len)) == 0) {
             /* Decode the ticket sequence number */
             uint64_t seq_num = PICOPARSE_64(src.base);
-            /* Decrypt */
-            size_t decrypted = ptls_aead_decrypt(aead_dec, dst->base + dst->off,
-                src.base + 8, src.len - 8, seq_num, NULL, 0);
+            uint64_t ticket_hash;
+            picoquic_ticket_cache_entry_t* cached;
+            size_t decrypted;
+            int is_cache_hit = 0;
+
+            /* Draw the cache hash key on first use. Until the first entry
+             * is stored the key may be redrawn, which is harmless. */
+            if (quic->ticket_cache_use_count == 0) {
+                picoquic_crypto_random(quic, quic->ticket_cache_hash_key,
+                    sizeof(quic->ticket_cache_hash_key));
+            }
+            ticket_hash = picoquic_siphash24(quic->ticket_cache_hash_key, src.base, src.len);
+            cached = picoquic_ticket_cache_find(quic, src.base, src.len, ticket_hash);
+            if (cached != NULL) {
+                /* Repeat presentation of a recently decrypted ticket;
+                 * skip the AEAD decryption. */
+                memcpy(dst->base + dst->off, cached->plaintext, cached->plaintext_length);
+                decrypted = cached->plaintext_length;
+                is_cache_hit = 1;
+            }
+            else {
+                /* Decrypt */
+                decrypted = ptls_aead_decrypt(aead_dec, dst->base + dst->off,
+                    src.base + 8, src.len - 8, seq_num, NULL, 0);
+            }
 
             if (decrypted > src.len - 8) {
                 /* decryption error */
@@ -1078,6 +1579,10 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
                 }
                 else {
                     picoquic_issued_ticket_t* server_ticket;
+                    if (!is_cache_hit) {
+                        picoquic_ticket_cache_store(quic, src.base, src.len, ticket_hash,
+                            dst->base + dst->off, decrypted);
+                    }
                     dst->off += decrypted - 4;
                     picoquic_log_app_message(quic->cnx_in_progress, "%s",
                         "Session ticket properly decrypted");
@@ -1189,9 +1694,30 @@ void picoquic_tls_set_verify_certificate_callback(picoquic_quic_t* quic,
 
     ctx->verify_certificate = cb;
     quic->is_cert_store_not_empty = 1;
+    /* The custom callback supersedes the deferred default verifier */
+    quic->verifier_pending = 0;
     quic->free_verify_certificate_callback_fn = free_fn;
 }
 
+/* Build the deferred certificate verifier, see picoquic_master_tlscontext.
+ * Called when a connection first needs to verify a peer: at client
+ * connection creation, when client authentication is enabled, and before
+ * installing an explicit root certificate list. */
+void picoquic_tls_ensure_certificate_verifier(picoquic_quic_t* quic)
+{
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+    if (quic->verifier_pending && ctx != NULL && ctx->verify_certificate == NULL) {
+        unsigned int is_cert_store_not_empty = 0;
+
+        ctx->verify_certificate = picoquic_get_certificate_verifier(quic->cert_root_file_name,
+            &is_cert_store_not_empty, (picoquic_free_verify_certificate_ctx*)
+            &quic->free_verify_certificate_callback_fn);
+        quic->is_cert_store_not_empty = is_cert_store_not_empty;
+    }
+    quic->verifier_pending = 0;
+}
+
 /* set key from secret: this is used to create AEAD contexts and PN encoding contexts
  * after a key update callback, and also to create the initial keys from a locally
  * computed secret
@@ -1378,13 +1904,54 @@ int picoquic_setup_initial_secrets(
     return ret;
 }
 
+/* Build the HkdfLabel info block used by HKDF-Expand-Label (RFC 8446,
+ * section 7.1) for a constant label and an empty context. The blocks for
+ * the initial secrets never change, so they are built once per QUIC
+ * context and the accept path calls ptls_hkdf_expand directly instead of
+ * re-formatting the label for every connection. */
+static size_t picoquic_format_hkdf_info(uint8_t* info, size_t info_max,
+    size_t out_length, const char* label)
+{
+    size_t prefix_length = strlen(PTLS_HKDF_EXPAND_LABEL_PREFIX);
+    size_t label_length = strlen(label);
+    size_t byte_index = 0;
+
+    if (2 + 1 + prefix_length + label_length + 1 <= info_max) {
+        info[byte_index++] = (uint8_t)(out_length >> 8);
+        info[byte_index++] = (uint8_t)(out_length & 0xFF);
+        info[byte_index++] = (uint8_t)(prefix_length + label_length);
+        memcpy(info + byte_index, PTLS_HKDF_EXPAND_LABEL_PREFIX, prefix_length);
+        byte_index += prefix_length;
+        memcpy(info + byte_index, label, label_length);
+        byte_index += label_length;
+        info[byte_index++] = 0; /* empty context */
+    }
+
+    return byte_index;
+}
+
 static int picoquic_compute_initial_secrets(picoquic_quic_t * quic, int version_index, picoquic_connection_id_t *initial_cnxid,
     ptls_cipher_suite_t * *cipher, uint8_t *client_secret, uint8_t *server_secret)
 {
     int ret = 0;
     ptls_iovec_t salt;
     uint8_t master_secret[256]; /* secret_max */
-    *cipher = picoquic_get_aes128gcm_sha256(quic->use_low_memory);
+
+    if (quic->initial_cipher_suite == NULL) {
+        /* First connection on this context: prepare the template */
+        ptls_cipher_suite_t* suite = picoquic_get_aes128gcm_sha256(quic->use_low_memory);
+
+        if (suite != NULL) {
+            quic->initial_hkdf_info_length[0] = picoquic_format_hkdf_info(
+                quic->initial_hkdf_info[0], sizeof(quic->initial_hkdf_info[0]),
+                suite->hash->digest_size, PICOQUIC_LABEL_INITIAL_CLIENT);
+            quic->initial_hkdf_info_length[1] = picoquic_format_hkdf_info(
+                quic->initial_hkdf_info[1], sizeof(quic->initial_hkdf_info[1]),
+                suite->hash->digest_size, PICOQUIC_LABEL_INITIAL_SERVER);
+            quic->initial_cipher_suite = (void*)suite;
+        }
+    }
+    *cipher = (ptls_cipher_suite_t*)quic->initial_cipher_suite;
     if (*cipher == NULL) {
         ret = -1;
     }
@@ -1394,7 +1961,19 @@ static int picoquic_compute_initial_secrets(picoquic_quic_t * quic, int version_
         /* Extract the master key -- key length will be 32 per SHA256 */
         ret = picoquic_setup_initial_master_secret(*cipher, salt, *initial_cnxid, master_secret);
         if (ret == 0) {
-            ret = picoquic_setup_initial_secrets(*cipher, master_secret, client_secret, server_secret);
+            if (quic->initial_hkdf_info_length[0] > 0 && quic->initial_hkdf_info_length[1] > 0) {
+                ptls_iovec_t prk = ptls_iovec_init(master_secret, (*cipher)->hash->digest_size);
+
+                ret = ptls_hkdf_expand((*cipher)->hash, client_secret, (*cipher)->hash->digest_size,
+                    prk, ptls_iovec_init(quic->initial_hkdf_info[0], quic->initial_hkdf_info_length[0]));
+                if (ret == 0) {
+                    ret = ptls_hkdf_expand((*cipher)->hash, server_secret, (*cipher)->hash->digest_size,
+                        prk, ptls_iovec_init(quic->initial_hkdf_info[1], quic->initial_hkdf_info_length[1]));
+                }
+            }
+            else {
+                ret = picoquic_setup_initial_secrets(*cipher, master_secret, client_secret, server_secret);
+            }
         }
     }
     return ret;
@@ -1493,6 +2072,14 @@ int picoquic_rotate_app_secret(ptls_cipher_suite_t * cipher, uint8_t * secret, c
 }
 
 
+/* The cipher suite is normally obtained from the picotls context. After
+ * hibernation frees that context, the copy cached at hibernation time is
+ * used instead. */
+static ptls_cipher_suite_t* picoquic_tlscontext_cipher(picoquic_tls_ctx_t* tls_ctx)
+{
+    return (tls_ctx->tls != NULL) ? ptls_get_cipher(tls_ctx->tls) : tls_ctx->cipher_suite;
+}
+
 uint8_t * picoquic_get_app_secret(picoquic_cnx_t* cnx, int is_enc)
 {
     picoquic_tls_ctx_t * tls_ctx = (picoquic_tls_ctx_t *)cnx->tls_ctx;
@@ -1504,7 +2091,7 @@ size_t picoquic_get_app_secret_size(picoquic_cnx_t* cnx)
 {
     picoquic_tls_ctx_t * tls_ctx = (picoquic_tls_ctx_t *)cnx->tls_ctx;
 
-    ptls_cipher_suite_t * cipher = ptls_get_cipher(tls_ctx->tls);
+    ptls_cipher_suite_t * cipher = picoquic_tlscontext_cipher(tls_ctx);
 
     return (cipher->hash->digest_size);
 }
@@ -1513,7 +2100,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
 {
     int ret = 0;
     picoquic_tls_ctx_t * tls_ctx = (picoquic_tls_ctx_t *)cnx->tls_ctx;
-    ptls_cipher_suite_t * cipher = ptls_get_cipher(tls_ctx->tls);
+    ptls_cipher_suite_t * cipher = picoquic_tlscontext_cipher(tls_ctx);
     const char *prefix_label = picoquic_supported_versions[cnx->version_index].tls_prefix_label;
     const char *traffic_update_label = picoquic_supported_versions[cnx->version_index].tls_traffic_update_label;
 
@@ -1569,6 +2156,46 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     return (ret == 0)?0: PICOQUIC_ERROR_CANNOT_COMPUTE_KEY;
 }
 
+/* Double buffered key update: as soon as a key rotation completes, the
+ * next generation of keys is derived into crypto_context_new, so the next
+ * rotation is a pointer swap instead of a synchronous key derivation in
+ * the data path. With a crypto worker pool the derivation runs on a
+ * worker; consumers of crypto_context_new call
+ * picoquic_wait_precomputed_keys first. Without a pool the derivation is
+ * done inline, which merely moves the cost from the start of the next
+ * rotation to the end of the current one. */
+static void picoquic_precompute_rotated_keys_job(void* job_ctx)
+{
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)job_ctx;
+
+    (void)picoquic_compute_new_rotated_keys(cnx);
+    cnx->key_rotation_precompute_pending = 0;
+}
+
+void picoquic_precompute_rotated_keys(picoquic_cnx_t* cnx)
+{
+    if (cnx->quic->crypto_pool != NULL) {
+        if (!cnx->key_rotation_precompute_pending) {
+            cnx->key_rotation_precompute_pending = 1;
+            if (picoquic_crypto_pool_submit_fn(cnx->quic,
+                picoquic_precompute_rotated_keys_job, cnx) != 0) {
+                cnx->key_rotation_precompute_pending = 0;
+                (void)picoquic_compute_new_rotated_keys(cnx);
+            }
+        }
+    }
+    else {
+        (void)picoquic_compute_new_rotated_keys(cnx);
+    }
+}
+
+void picoquic_wait_precomputed_keys(picoquic_cnx_t* cnx)
+{
+    if (cnx->key_rotation_precompute_pending) {
+        picoquic_crypto_pool_fn_sync(cnx->quic);
+    }
+}
+
 void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc)
 {
     if (is_enc) {
@@ -1636,7 +2263,6 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
     ptls_on_client_hello_t* och = NULL;
     ptls_encrypt_ticket_t* encrypt_ticket = NULL;
     ptls_save_ticket_t* save_ticket = NULL;
-    unsigned int is_cert_store_not_empty = 0;
 
     picoquic_tls_api_init(); /* For example, init openSSL if in use. */
 
@@ -1728,10 +2354,14 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
         }
 
         if (ret == 0) {
-            ctx->verify_certificate = picoquic_get_certificate_verifier(cert_root_file_name,
-                &is_cert_store_not_empty, (picoquic_free_verify_certificate_ctx*)
-                &quic->free_verify_certificate_callback_fn);
-            quic->is_cert_store_not_empty = is_cert_store_not_empty;
+            /* Defer the creation of the certificate verifier, and with it the
+             * loading of the root certificate store, until a connection first
+             * needs to verify a peer. */
+            quic->cert_root_file_name = picoquic_string_duplicate(cert_root_file_name);
+            quic->verifier_pending = 1;
+            if (cert_root_file_name != NULL && quic->cert_root_file_name == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
         }
 
         if (ret == 0 && quic->ticket_file_name != NULL) {
@@ -1830,32 +2460,342 @@ uint64_t picoquic_get_tls_time(picoquic_quic_t* quic)
  * This includes setting the handshake properties that will later be
  * used during the TLS handshake.
  */
-int picoquic_tlscontext_create(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t current_time)
+/* Asynchronous certificate signing.
+ *
+ * The wrapper installed by picoquic_set_async_handshake intercepts the
+ * sign_certificate callback. On the first call it copies the data to be
+ * signed, dispatches the provider's signer to the crypto worker pool and
+ * returns PTLS_ERROR_ASYNC_OPERATION; picotls parks the handshake and
+ * propagates the error through ptls_handle_message, which the stream
+ * processing below treats like "in progress". Once the worker completes,
+ * picoquic_tls_async_sign_progress resumes the handshake by feeding an
+ * empty message, causing picotls to call the wrapper again; the second
+ * call returns the precomputed signature.
+ */
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+
+typedef enum {
+    picoquic_async_sign_idle = 0,
+    picoquic_async_sign_pending,
+    picoquic_async_sign_complete
+} picoquic_async_sign_status_t;
+
+typedef struct st_picoquic_async_sign_state_t {
+    ptls_async_job_t super; /* handed to picotls; destroy is a no-op,
+                             * the block belongs to the TLS context */
+    picoquic_mutex_t mutex;
+    picoquic_event_t done_event;
+    picoquic_async_sign_status_t status;
+    int sign_ret;
+    uint16_t selected_algorithm;
+    ptls_buffer_t sign_output;
+    uint8_t* input_bytes;
+    size_t input_length;
+    uint16_t* algorithms;
+    size_t num_algorithms;
+    ptls_sign_certificate_t* delegate;
+    ptls_t* tls;
+    size_t parked_epoch;
+} picoquic_async_sign_state_t;
+
+static void picoquic_async_sign_job_destroy(ptls_async_job_t* self)
 {
-    int ret = 0;
-    /* allocate a context structure, but only if checks are correct */
-    picoquic_tls_ctx_t* ctx = NULL;
+    /* Owned and released by the picoquic TLS context, not by picotls */
+    UNREFERENCED_PARAMETER(self);
+}
 
-    if (!cnx->client_mode && ((ptls_context_t*)quic->tls_master_ctx)->encrypt_ticket == NULL) {
-        /* A server side connection, but no cert/key where given for the master context */
-        ret = PICOQUIC_ERROR_TLS_SERVER_CON_WITHOUT_CERT;
+/* Runs on a crypto pool worker thread. The signer only touches the
+ * private key, which is safe to use concurrently; the parked picotls
+ * state is not used until the resume on the connection's thread. */
+static void picoquic_async_sign_job_fn(void* v_state)
+{
+    picoquic_async_sign_state_t* state = (picoquic_async_sign_state_t*)v_state;
+    int sign_ret = state->delegate->cb(state->delegate, state->tls, NULL,
+        &state->selected_algorithm, &state->sign_output,
+        ptls_iovec_init(state->input_bytes, state->input_length),
+        state->algorithms, state->num_algorithms);
+
+    (void)picoquic_lock_mutex(&state->mutex);
+    state->sign_ret = sign_ret;
+    state->status = picoquic_async_sign_complete;
+    (void)picoquic_unlock_mutex(&state->mutex);
+    (void)picoquic_signal_event(&state->done_event);
+}
+
+static void picoquic_async_sign_reset(picoquic_async_sign_state_t* state)
+{
+    if (state->input_bytes != NULL) {
+        free(state->input_bytes);
+        state->input_bytes = NULL;
     }
-    else {
-        ctx = (picoquic_tls_ctx_t*)malloc(sizeof(picoquic_tls_ctx_t));
-        if (ctx == NULL) {
-            ret = PICOQUIC_ERROR_MEMORY;
-        }
+    if (state->algorithms != NULL) {
+        free(state->algorithms);
+        state->algorithms = NULL;
     }
+    ptls_buffer_dispose(&state->sign_output);
+    state->input_length = 0;
+    state->num_algorithms = 0;
+    state->status = picoquic_async_sign_idle;
+}
 
-    /* Create the TLS context */
-    if (ctx != NULL) {
-        memset(ctx, 0, sizeof(picoquic_tls_ctx_t));
-        ctx->ext_data_size = PICOQUIC_TRANSPORT_PARAMETERS_MAX_SIZE;
-        if (!cnx->client_mode && quic->test_large_server_flight) {
-            ctx->ext_data_size += 4096;
+static void picoquic_async_sign_release(picoquic_tls_ctx_t* ctx)
+{
+    picoquic_async_sign_state_t* state = ctx->async_sign;
+
+    if (state != NULL) {
+        /* A worker may still hold the state; wait for it to finish
+         * before freeing, like the connection teardown path does for
+         * pending seal jobs. */
+        for (;;) {
+            int is_pending;
+
+            (void)picoquic_lock_mutex(&state->mutex);
+            is_pending = (state->status == picoquic_async_sign_pending);
+            (void)picoquic_unlock_mutex(&state->mutex);
+            if (!is_pending) {
+                break;
+            }
+            (void)picoquic_wait_for_event(&state->done_event, 1000);
+        }
+        picoquic_async_sign_reset(state);
+        picoquic_delete_event(&state->done_event);
+        (void)picoquic_delete_mutex(&state->mutex);
+        free(state);
+        ctx->async_sign = NULL;
+    }
+}
+
+static int picoquic_async_sign_certificate_cb(ptls_sign_certificate_t* _self, ptls_t* tls,
+    ptls_async_job_t** async, uint16_t* selected_algorithm, ptls_buffer_t* output,
+    ptls_iovec_t input, const uint16_t* algorithms, size_t num_algorithms)
+{
+    int ret = 0;
+    picoquic_async_sign_certificate_t* self = (picoquic_async_sign_certificate_t*)_self;
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)*ptls_get_data_ptr(tls);
+    picoquic_tls_ctx_t* ctx = (cnx == NULL) ? NULL : (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    picoquic_async_sign_state_t* state = NULL;
+    int dispatch_needed = 0;
+
+    if (async == NULL || ctx == NULL ||
+        !cnx->quic->use_async_handshake || cnx->quic->crypto_pool == NULL) {
+        /* Caller cannot park the handshake, or the mode is off: sign inline */
+        return self->delegate->cb(self->delegate, tls, async,
+            selected_algorithm, output, input, algorithms, num_algorithms);
+    }
+
+    if (ctx->async_sign == NULL) {
+        state = (picoquic_async_sign_state_t*)malloc(sizeof(picoquic_async_sign_state_t));
+        if (state != NULL) {
+            memset(state, 0, sizeof(picoquic_async_sign_state_t));
+            if (picoquic_create_mutex(&state->mutex) != 0 ||
+                picoquic_create_event(&state->done_event) != 0) {
+                free(state);
+                state = NULL;
+            }
+            else {
+                state->super.destroy_ = picoquic_async_sign_job_destroy;
+                ctx->async_sign = state;
+            }
+        }
+        if (state == NULL) {
+            return self->delegate->cb(self->delegate, tls, async,
+                selected_algorithm, output, input, algorithms, num_algorithms);
+        }
+    }
+    state = ctx->async_sign;
+
+    (void)picoquic_lock_mutex(&state->mutex);
+    switch (state->status) {
+    case picoquic_async_sign_idle:
+        state->input_bytes = (uint8_t*)malloc((input.len > 0) ? input.len : 1);
+        state->algorithms = (uint16_t*)malloc((num_algorithms > 0) ? num_algorithms * sizeof(uint16_t) : sizeof(uint16_t));
+        if (state->input_bytes == NULL || state->algorithms == NULL) {
+            picoquic_async_sign_reset(state);
+            ret = -1;
+        }
+        else {
+            memcpy(state->input_bytes, input.base, input.len);
+            state->input_length = input.len;
+            memcpy(state->algorithms, algorithms, num_algorithms * sizeof(uint16_t));
+            state->num_algorithms = num_algorithms;
+            ptls_buffer_init(&state->sign_output, "", 0);
+            state->delegate = self->delegate;
+            state->tls = tls;
+            state->status = picoquic_async_sign_pending;
+            dispatch_needed = 1;
+            ret = PTLS_ERROR_ASYNC_OPERATION;
+        }
+        break;
+    case picoquic_async_sign_pending:
+        ret = PTLS_ERROR_ASYNC_OPERATION;
+        break;
+    case picoquic_async_sign_complete:
+        ret = state->sign_ret;
+        if (ret == 0) {
+            *selected_algorithm = state->selected_algorithm;
+            ret = ptls_buffer__do_pushv(output, state->sign_output.base, state->sign_output.off);
+        }
+        picoquic_async_sign_reset(state);
+        break;
+    }
+    (void)picoquic_unlock_mutex(&state->mutex);
+
+    if (ret == PTLS_ERROR_ASYNC_OPERATION) {
+        if (dispatch_needed) {
+            /* First call for this handshake: dispatch the job now, after
+             * releasing the state mutex */
+            if (picoquic_crypto_pool_submit_fn(cnx->quic, picoquic_async_sign_job_fn, state) != 0) {
+                picoquic_async_sign_reset(state);
+                return self->delegate->cb(self->delegate, tls, async,
+                    selected_algorithm, output, input, algorithms, num_algorithms);
+            }
+        }
+        *async = &state->super;
+    }
+    else if (ret == -1) {
+        /* allocation failure above: fall back to inline signing */
+        return self->delegate->cb(self->delegate, tls, async,
+            selected_algorithm, output, input, algorithms, num_algorithms);
+    }
+
+    return ret;
+}
+#endif /* PTLS_ERROR_ASYNC_OPERATION */
+
+int picoquic_set_async_handshake(picoquic_quic_t* quic, int enabled)
+{
+    int ret = 0;
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+    if (enabled) {
+        if (ctx == NULL || ctx->sign_certificate == NULL) {
+            ret = -1;
+        }
+        else if (ctx->sign_certificate->cb != picoquic_async_sign_certificate_cb) {
+            picoquic_async_sign_certificate_t* wrapper =
+                (picoquic_async_sign_certificate_t*)malloc(sizeof(picoquic_async_sign_certificate_t));
+            if (wrapper == NULL) {
+                ret = -1;
+            }
+            else {
+                wrapper->super.cb = picoquic_async_sign_certificate_cb;
+                wrapper->delegate = ctx->sign_certificate;
+                ctx->sign_certificate = &wrapper->super;
+            }
+        }
+        if (ret == 0) {
+            quic->use_async_handshake = 1;
+        }
+    }
+    else {
+        /* Leave the wrapper installed; it signs inline while the flag is off */
+        quic->use_async_handshake = 0;
+    }
+#else
+    UNREFERENCED_PARAMETER(quic);
+    if (enabled) {
+        ret = -1;
+    }
+#endif
+    return ret;
+}
+
+/* Pop a context wrapper from the per quic pool, or allocate a fresh one.
+ * Pooled wrappers keep their extension and ALPN buffers so a recycled
+ * context avoids the per connection malloc and free churn; everything
+ * else is cleared. */
+#define PICOQUIC_MAX_TLS_CTX_IN_POOL 64
+
+static picoquic_tls_ctx_t* picoquic_tlscontext_alloc(picoquic_quic_t* quic)
+{
+    picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)quic->p_first_tls_ctx;
+
+    if (ctx != NULL) {
+        uint8_t* ext_data = ctx->ext_data;
+        size_t ext_data_size = ctx->ext_data_size;
+        ptls_iovec_t* alpn_vec = ctx->alpn_vec;
+
+        quic->p_first_tls_ctx = (void*)ctx->next_in_pool;
+        quic->nb_tls_ctx_in_pool--;
+        memset(ctx, 0, sizeof(picoquic_tls_ctx_t));
+        ctx->ext_data = ext_data;
+        ctx->ext_data_size = ext_data_size;
+        ctx->alpn_vec = alpn_vec;
+    }
+    else {
+        ctx = (picoquic_tls_ctx_t*)malloc(sizeof(picoquic_tls_ctx_t));
+        if (ctx != NULL) {
+            PICOQUIC_MEMPROF_ADD(picoquic_mem_tag_tls, sizeof(picoquic_tls_ctx_t));
+            memset(ctx, 0, sizeof(picoquic_tls_ctx_t));
+        }
+    }
+
+    if (ctx != NULL) {
+        ctx->quic = quic;
+    }
+
+    return ctx;
+}
+
+void picoquic_tlscontext_clear_pool(picoquic_quic_t* quic)
+{
+    picoquic_tls_ctx_t* ctx;
+
+    while ((ctx = (picoquic_tls_ctx_t*)quic->p_first_tls_ctx) != NULL) {
+        quic->p_first_tls_ctx = (void*)ctx->next_in_pool;
+        if (ctx->ext_data != NULL) {
+            free(ctx->ext_data);
+        }
+        if (ctx->alpn_vec != NULL) {
+            free(ctx->alpn_vec);
+        }
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_tls, sizeof(picoquic_tls_ctx_t));
+        free(ctx);
+    }
+    quic->nb_tls_ctx_in_pool = 0;
+}
+
+int picoquic_tlscontext_create(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    int ret = 0;
+    /* allocate a context structure, but only if checks are correct */
+    picoquic_tls_ctx_t* ctx = NULL;
+
+    if (!cnx->client_mode && picoquic_tls_load_credentials_if_needed(quic) != 0) {
+        /* Deferred credentials were registered but cannot be loaded */
+        ret = PICOQUIC_ERROR_TLS_SERVER_CON_WITHOUT_CERT;
+    }
+    else if (!cnx->client_mode && ((ptls_context_t*)quic->tls_master_ctx)->encrypt_ticket == NULL) {
+        /* A server side connection, but no cert/key where given for the master context */
+        ret = PICOQUIC_ERROR_TLS_SERVER_CON_WITHOUT_CERT;
+    }
+    else {
+        ctx = picoquic_tlscontext_alloc(quic);
+        if (ctx == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+    }
+
+    /* Create the TLS context */
+    if (ctx != NULL) {
+        size_t ext_data_needed = PICOQUIC_TRANSPORT_PARAMETERS_MAX_SIZE;
+        if (!cnx->client_mode && quic->test_large_server_flight) {
+            ext_data_needed += 4096;
+        }
+        /* A recycled wrapper usually arrives with its buffers; allocate
+         * only what is missing or too small. */
+        if (ctx->ext_data != NULL && ctx->ext_data_size < ext_data_needed) {
+            free(ctx->ext_data);
+            ctx->ext_data = NULL;
+        }
+        if (ctx->ext_data == NULL) {
+            ctx->ext_data = (uint8_t*)malloc(ext_data_needed);
+            ctx->ext_data_size = (ctx->ext_data == NULL) ? 0 : ext_data_needed;
+        }
+        if (ctx->alpn_vec == NULL) {
+            ctx->alpn_vec = (ptls_iovec_t*)malloc(sizeof(ptls_iovec_t) * PICOQUIC_ALPN_NUMBER_MAX);
         }
-        ctx->ext_data = (uint8_t*)malloc(ctx->ext_data_size);
-        ctx->alpn_vec = (ptls_iovec_t*)malloc(sizeof(ptls_iovec_t) * PICOQUIC_ALPN_NUMBER_MAX);
         if (ctx->ext_data == NULL || ctx->alpn_vec == NULL) {
             ret = -1;
         }
@@ -1987,19 +2927,33 @@ void picoquic_tlscontext_free(void* vctx)
 {
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)vctx;
 
-    if (ctx->ext_data != NULL) {
-        free(ctx->ext_data);
-    }
-
-    if (ctx->alpn_vec != NULL) {
-        free(ctx->alpn_vec);
-    }
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+    /* must run before ptls_free: a signing worker may reference the tls object */
+    picoquic_async_sign_release(ctx);
+#endif
 
     if (ctx->tls != NULL) {
         ptls_free((ptls_t*)ctx->tls);
         ctx->tls = NULL;
     }
-    free(ctx);
+
+    if (ctx->quic != NULL && ctx->quic->nb_tls_ctx_in_pool < PICOQUIC_MAX_TLS_CTX_IN_POOL) {
+        /* Recycle the wrapper and its buffers for the next connection.
+         * The ptls_t cannot be reset and is recreated per connection. */
+        ctx->next_in_pool = (picoquic_tls_ctx_t*)ctx->quic->p_first_tls_ctx;
+        ctx->quic->p_first_tls_ctx = (void*)ctx;
+        ctx->quic->nb_tls_ctx_in_pool++;
+    }
+    else {
+        if (ctx->ext_data != NULL) {
+            free(ctx->ext_data);
+        }
+        if (ctx->alpn_vec != NULL) {
+            free(ctx->alpn_vec);
+        }
+        PICOQUIC_MEMPROF_SUB(picoquic_mem_tag_tls, sizeof(picoquic_tls_ctx_t));
+        free(ctx);
+    }
 }
 
 
@@ -2020,10 +2974,37 @@ void picoquic_tlscontext_trim_after_handshake(picoquic_cnx_t * cnx)
     }
 }
 
+/* Hibernation support. Once the handshake is confirmed, a server side
+ * connection never receives further TLS messages: QUIC forbids the TLS
+ * KeyUpdate message, and clients do not send session tickets. The picotls
+ * object can therefore be freed, keeping only the application traffic
+ * secrets stored in the wrapper and a cached cipher suite pointer so key
+ * rotation keeps working. Client connections keep their picotls object,
+ * as the server may send session tickets at any time. */
+void picoquic_tlscontext_hibernate(picoquic_cnx_t* cnx)
+{
+    picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+
+    picoquic_tlscontext_trim_after_handshake(cnx);
+
+    if (ctx->tls != NULL && !ctx->client_mode &&
+        ctx->async_sign == NULL &&
+        ptls_handshake_is_complete(ctx->tls)) {
+        ctx->cipher_suite = ptls_get_cipher(ctx->tls);
+        ptls_free(ctx->tls);
+        ctx->tls = NULL;
+    }
+}
+
 char const* picoquic_tls_get_negotiated_alpn(picoquic_cnx_t* cnx)
 {
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
 
+    if (ctx->tls == NULL) {
+        /* Hibernated connection; the negotiated value is kept in the cnx */
+        return cnx->alpn;
+    }
+
     return ptls_get_negotiated_protocol(ctx->tls);
 }
 
@@ -2031,13 +3012,19 @@ char const* picoquic_tls_get_sni(picoquic_cnx_t* cnx)
 {
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
 
+    if (ctx->tls == NULL) {
+        /* Hibernated connection; the SNI is kept in the cnx */
+        return cnx->sni;
+    }
+
     return ptls_get_server_name(ctx->tls);
 }
 
 int picoquic_tls_is_psk_handshake(picoquic_cnx_t* cnx)
 {
     /* int ret = cnx->is_psk_handshake; */
-    int ret = ptls_is_psk_handshake(((picoquic_tls_ctx_t*)(cnx->tls_ctx))->tls);
+    ptls_t* tls = ((picoquic_tls_ctx_t*)(cnx->tls_ctx))->tls;
+    int ret = (tls == NULL) ? 0 : ptls_is_psk_handshake(tls);
     return ret;
 }
 
@@ -2070,9 +3057,11 @@ static int picoquic_add_to_tls_stream(picoquic_cnx_t* cnx, const uint8_t* data,
                 picoquic_stream_queue_node_t* next = stream->send_queue;
 
                 memcpy(stream_data->bytes, data, length);
+                stream_data->quic = cnx->quic;
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->copy_pending = 0;
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -2246,6 +3235,27 @@ void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void
     ptls_cipher_encrypt((ptls_cipher_context_t *) pn_enc, output, input, len);
 }
 
+/* Compute a batch of header protection masks: one 5 byte mask per 16 byte
+ * sample, samples "sample_stride" bytes apart. Each mask is one AES block,
+ * so a provider registered through picoquic_register_pn_encrypt_batch_fn
+ * can compute the whole batch with a single multi-block AES call; absent a
+ * provider, fall back to one cipher call per sample. */
+void picoquic_pn_encrypt_batch(void* pn_enc, const uint8_t* samples, size_t sample_stride,
+    uint8_t* masks, size_t nb_masks)
+{
+    if (picoquic_pn_encrypt_batch_fn != NULL) {
+        picoquic_pn_encrypt_batch_fn(pn_enc, samples, sample_stride, masks, nb_masks);
+    }
+    else {
+        for (size_t i = 0; i < nb_masks; i++) {
+            memset(masks, 0, 5);
+            picoquic_pn_encrypt(pn_enc, samples, masks, masks, 5);
+            samples += sample_stride;
+            masks += 5;
+        }
+    }
+}
+
 /* Utility functions, so applications do not have to load picotls.h */
 
 void picoquic_aead_free(void* aead_context)
@@ -2304,12 +3314,44 @@ int picoquic_server_setup_ticket_aead_contexts(picoquic_quic_t* quic,
             ret = picoquic_set_aead_from_secret(&quic->aead_decrypt_ticket_ctx, cipher, 0, temp_secret, "random label");
         }
 
+        /* Retain the effective secret so hot restart can hand it over */
+        if (ret == 0 && cipher->hash->digest_size <= sizeof(quic->ticket_crypto_secret)) {
+            memcpy(quic->ticket_crypto_secret, temp_secret, cipher->hash->digest_size);
+            quic->has_ticket_crypto_secret = 1;
+        }
+
         /* erase the temporary secret */
         ptls_clear_memory(temp_secret, cipher->hash->digest_size);
     }
     return ret;
 }
 
+/* Replace the ticket encryption key of a running context. Used to rotate
+ * the key, and by picoquic_import_restart_state to adopt the key of the
+ * previous process so its session tickets stay decryptable. */
+int picoquic_set_ticket_crypto_secret(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length)
+{
+    int ret = 0;
+
+    if (secret == NULL || secret_length == 0) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        if (quic->aead_encrypt_ticket_ctx != NULL) {
+            picoquic_aead_free(quic->aead_encrypt_ticket_ctx);
+            quic->aead_encrypt_ticket_ctx = NULL;
+        }
+        if (quic->aead_decrypt_ticket_ctx != NULL) {
+            picoquic_aead_free(quic->aead_decrypt_ticket_ctx);
+            quic->aead_decrypt_ticket_ctx = NULL;
+        }
+        ret = picoquic_server_setup_ticket_aead_contexts(quic,
+            (ptls_context_t*)quic->tls_master_ctx, secret, secret_length);
+    }
+
+    return ret;
+}
+
 /* Access integrity limit for AEAD */
 uint64_t picoquic_aead_integrity_limit(void* aead_ctx)
 {
@@ -2351,6 +3393,42 @@ size_t picoquic_aead_encrypt_generic(uint8_t* output, const uint8_t* input, size
     return encrypted;
 }
 
+/* Gather variant of the seal: the plaintext is supplied as a list of
+ * segments and encrypted in one AEAD pass into the contiguous output, so
+ * callers do not need to assemble a contiguous plaintext first. A provider
+ * can register a fused implementation; the fallback drives the picotls
+ * incremental AEAD interface, which computes the tag across all segments. */
+picoquic_aead_encrypt_gather_t picoquic_aead_encrypt_gather_fn = NULL;
+
+void picoquic_register_aead_encrypt_gather_fn(picoquic_aead_encrypt_gather_t aead_encrypt_gather_fn)
+{
+    picoquic_aead_encrypt_gather_fn = aead_encrypt_gather_fn;
+}
+
+size_t picoquic_aead_encrypt_gather(uint8_t* output,
+    const struct st_picoquic_crypto_iovec_t* iov, size_t nb_iov,
+    uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
+{
+    size_t encrypted = 0;
+
+    if (picoquic_aead_encrypt_gather_fn != NULL) {
+        encrypted = picoquic_aead_encrypt_gather_fn(aead_context, output, iov, nb_iov,
+            seq_num, auth_data, auth_data_length);
+    }
+    else {
+        ptls_aead_context_t* ctx = (ptls_aead_context_t*)aead_context;
+
+        ptls_aead_encrypt_init(ctx, seq_num, (void*)auth_data, auth_data_length);
+        for (size_t i = 0; i < nb_iov; i++) {
+            encrypted += ptls_aead_encrypt_update(ctx, output + encrypted,
+                (const void*)iov[i].base, iov[i].len);
+        }
+        encrypted += ptls_aead_encrypt_final(ctx, output + encrypted);
+    }
+
+    return encrypted;
+}
+
 size_t picoquic_aead_decrypt_mp(uint8_t* output, const uint8_t* input, size_t input_length,
     uint64_t path_id, uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
 {
@@ -2359,6 +3437,15 @@ size_t picoquic_aead_decrypt_mp(uint8_t* output, const uint8_t* input, size_t in
     if (aead_context == NULL) {
         decrypted = SIZE_MAX;
     }
+    else if (path_id == 0) {
+        /* XOR with a zero path ID leaves the IV unchanged; skip the two
+         * ptls_aead_xor_iv calls on the common single path. The per packet
+         * nonce itself (IV XOR packet number) is assembled inside the
+         * ptls_aead provider. */
+        decrypted = ptls_aead_decrypt((ptls_aead_context_t*)aead_context,
+            (void*)output, (const void*)input, input_length, seq_num,
+            (void*)auth_data, auth_data_length);
+    }
     else {
         uint8_t seq32[4];
 
@@ -2377,14 +3464,23 @@ size_t picoquic_aead_encrypt_mp(uint8_t* output, const uint8_t* input, size_t in
     uint64_t path_id, uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
 {
     size_t encrypted = 0;
-    uint8_t seq32[4];
 
-    picoformat_32(seq32, (uint32_t)path_id);
-    ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
-    encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
-        (void*)output, (const void*)input, input_length, seq_num,
-        (void*)auth_data, auth_data_length);
-    ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+    if (path_id == 0) {
+        /* See picoquic_aead_decrypt_mp: a zero path ID does not change the IV. */
+        encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
+            (void*)output, (const void*)input, input_length, seq_num,
+            (void*)auth_data, auth_data_length);
+    }
+    else {
+        uint8_t seq32[4];
+
+        picoformat_32(seq32, (uint32_t)path_id);
+        ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+        encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
+            (void*)output, (const void*)input, input_length, seq_num,
+            (void*)auth_data, auth_data_length);
+        ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+    }
 
     return encrypted;
 }
@@ -2423,12 +3519,32 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
     size_t next_epoch = 0;
 
+    if (ctx->tls == NULL) {
+        /* The connection is hibernated; no TLS message is expected any
+         * more. Drop whatever was queued so a misbehaving peer cannot
+         * grow the crypto receive trees. */
+        for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
+            picoquic_stream_index_empty(&cnx->tls_stream[epoch].stream_data_tree);
+        }
+        return 0;
+    }
+
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+    if (ctx->async_sign != NULL &&
+        ctx->async_sign->status != picoquic_async_sign_idle) {
+        /* A certificate signature is in flight; the handshake resumes
+         * through picoquic_tls_async_sign_progress, and the received
+         * data stays queued until then. */
+        return 0;
+    }
+#endif
+
     /* Provide indication of current connection for later callbacks */
     cnx->quic->cnx_in_progress = cnx;
 
     for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0; epoch++) {
         picoquic_stream_head_t* stream = &cnx->tls_stream[epoch];
-        picoquic_stream_data_node_t* data = (picoquic_stream_data_node_t*)picosplay_first(&stream->stream_data_tree);
+        picoquic_stream_data_node_t* data = (picoquic_stream_data_node_t*)picoquic_stream_index_first(&stream->stream_data_tree);
         size_t processed = 0;
         int data_pushed = 0;
 
@@ -2472,7 +3588,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
                 data->bytes + start, epoch_data, &ctx->handshake_properties);
 
             if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS ||
-                ret == PTLS_ERROR_STATELESS_RETRY)) {
+                ret == PTLS_ERROR_STATELESS_RETRY ||
+                PICOQUIC_TLS_RET_IS_ASYNC(ret))) {
                 for (int i = 0; i < PICOQUIC_NUMBER_OF_EPOCHS; i++) {
                     if (send_offset[i] < send_offset[i + 1]) {
                         data_pushed = 1;
@@ -2517,8 +3634,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
             processed += epoch_data;
 
             if (start + epoch_data >= data->length) {
-                picosplay_delete_hint(&cnx->tls_stream[epoch].stream_data_tree, &data->stream_data_node);
-                data = (picoquic_stream_data_node_t*)picosplay_first(&cnx->tls_stream[epoch].stream_data_tree);
+                picoquic_stream_index_delete_hint(&cnx->tls_stream[epoch].stream_data_tree, &data->stream_data_node);
+                data = (picoquic_stream_data_node_t*)picoquic_stream_index_first(&cnx->tls_stream[epoch].stream_data_tree);
             }
 
             ptls_buffer_dispose(&sendbuf);
@@ -2599,7 +3716,19 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
                 }
             }
 
-            if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS || ret == PTLS_ERROR_STATELESS_RETRY)) {
+            if (PICOQUIC_TLS_RET_IS_ASYNC(ret)) {
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+                /* The handshake is parked on a certificate signature. The
+                 * flight produced so far was pushed above; remember where
+                 * to resume and stop feeding data. */
+                if (ctx->async_sign != NULL) {
+                    ctx->async_sign->parked_epoch = epoch;
+                }
+#endif
+                ret = 0;
+                break;
+            }
+            else if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS || ret == PTLS_ERROR_STATELESS_RETRY)) {
                 ret = 0;
             }
             else {
@@ -2623,12 +3752,92 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx, int * data_consumed, uint64
     return ret;
 }
 
+/* Progress check for asynchronous certificate signing, called from the
+ * packet preparation path. While the signature is being computed on a
+ * worker, the connection wake time is clamped so completion is noticed
+ * promptly; once complete, the handshake is resumed by feeding an empty
+ * message at the parked epoch, which makes picotls call the sign
+ * callback again and collect the precomputed signature. */
+int picoquic_tls_async_sign_progress(picoquic_cnx_t* cnx, uint64_t current_time, uint64_t* next_wake_time)
+{
+    int ret = 0;
+#if defined(PTLS_ERROR_ASYNC_OPERATION)
+    picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    picoquic_async_sign_state_t* state = (ctx == NULL) ? NULL : ctx->async_sign;
+
+    if (state != NULL) {
+        picoquic_async_sign_status_t status;
+
+        (void)picoquic_lock_mutex(&state->mutex);
+        status = state->status;
+        (void)picoquic_unlock_mutex(&state->mutex);
+
+        if (status == picoquic_async_sign_pending) {
+            if (*next_wake_time > current_time + 1000) {
+                *next_wake_time = current_time + 1000;
+                SET_LAST_WAKE(cnx->quic, PICOQUIC_TLSAPI);
+            }
+        }
+        else if (status == picoquic_async_sign_complete) {
+            struct st_ptls_buffer_t sendbuf;
+            size_t send_offset[PICOQUIC_NUMBER_OF_EPOCH_OFFSETS] = { 0, 0, 0, 0, 0 };
+            size_t epoch = state->parked_epoch;
+            int tls_ret;
+
+            ptls_buffer_init(&sendbuf, "", 0);
+            picoquic_clear_crypto_errors();
+
+            tls_ret = ptls_handle_message(ctx->tls, &sendbuf, send_offset, epoch,
+                NULL, 0, &ctx->handshake_properties);
+
+            if (tls_ret == 0 || tls_ret == PTLS_ERROR_IN_PROGRESS) {
+                for (int i = 0; ret == 0 && i < PICOQUIC_NUMBER_OF_EPOCHS; i++) {
+                    if (send_offset[i] < send_offset[i + 1]) {
+                        ret = picoquic_add_to_tls_stream(cnx,
+                            sendbuf.base + send_offset[i], send_offset[i + 1] - send_offset[i], i);
+                    }
+                }
+                if ((cnx->cnx_state == picoquic_state_server_init ||
+                    cnx->cnx_state == picoquic_state_server_handshake) &&
+                    cnx->crypto_context[3].aead_encrypt != NULL) {
+                    cnx->cnx_state = picoquic_state_server_almost_ready;
+                }
+            }
+            else {
+                uint16_t error_code = PICOQUIC_TRANSPORT_INTERNAL_ERROR;
+
+                picoquic_log_crypto_errors(cnx, tls_ret);
+                if (PTLS_ERROR_GET_CLASS(tls_ret) == PTLS_ERROR_CLASS_SELF_ALERT) {
+                    error_code = PICOQUIC_TRANSPORT_CRYPTO_ERROR(tls_ret);
+                }
+                (void)picoquic_connection_error(cnx, error_code, 0);
+            }
+            ptls_buffer_dispose(&sendbuf);
+
+            if (ret == 0) {
+                /* Process any handshake data that queued up while parked */
+                ret = picoquic_tls_stream_process(cnx, NULL, current_time);
+            }
+        }
+    }
+#else
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(next_wake_time);
+    UNREFERENCED_PARAMETER(cnx);
+#endif
+    return ret;
+}
+
 /*
  * Test whether the TLS handshake is complete according to TLS stack
  */
 int picoquic_is_tls_complete(picoquic_cnx_t* cnx)
 {
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    if (ctx->tls == NULL) {
+        /* The TLS context is only released after the handshake completed */
+        return 1;
+    }
     return ptls_handshake_is_complete(ctx->tls);
 }
 
@@ -2678,6 +3887,10 @@ void picoquic_set_tls_certificate_chain(picoquic_quic_t* quic, ptls_iovec_t* cer
 }
 
 void picoquic_tls_set_client_authentication(picoquic_quic_t* quic, int client_authentication) {
+    if (client_authentication) {
+        /* The server will verify client certificates */
+        picoquic_tls_ensure_certificate_verifier(quic);
+    }
     ((ptls_context_t*)quic->tls_master_ctx)->require_client_authentication = client_authentication;
 }
 
@@ -2685,7 +3898,60 @@ int picoquic_tls_client_authentication_activated(picoquic_quic_t* quic) {
     return ((ptls_context_t*)quic->tls_master_ctx)->require_client_authentication;
 }
 
-/* 
+/* Retry offload: derive dedicated retry token AEAD contexts from a key
+ * shared with an external retry service, as in the QUIC-LB shared-key
+ * model. A scrubbing appliance provisioned with the same key links the
+ * library, creates its own context, and issues Retries with
+ * picoquic_prepare_retry_token; the tokens it produces then validate here
+ * without any exchange between the appliance and the server. By default
+ * the token contexts are derived from the ticket encryption secret, which
+ * would force sharing the ticket key with the appliance as well.
+ */
+int picoquic_set_retry_token_key(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length)
+{
+    int ret = 0;
+    uint8_t temp_secret[256]; /* secret_max */
+    ptls_cipher_suite_t* cipher = picoquic_get_aes128gcm_sha256(0);
+
+    if (secret == NULL || secret_length == 0 ||
+        cipher->hash->digest_size > sizeof(temp_secret)) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        memset(temp_secret, 0, cipher->hash->digest_size);
+        memcpy(temp_secret, secret, (secret_length > cipher->hash->digest_size) ? cipher->hash->digest_size : secret_length);
+
+        /* Release previous contexts, so the shared key can be rotated */
+        if (quic->aead_encrypt_retry_token_ctx != NULL) {
+            picoquic_aead_free(quic->aead_encrypt_retry_token_ctx);
+            quic->aead_encrypt_retry_token_ctx = NULL;
+        }
+        if (quic->aead_decrypt_retry_token_ctx != NULL) {
+            picoquic_aead_free(quic->aead_decrypt_retry_token_ctx);
+            quic->aead_decrypt_retry_token_ctx = NULL;
+        }
+
+        ret = picoquic_set_aead_from_secret(&quic->aead_encrypt_retry_token_ctx, cipher, 1, temp_secret, "retry token");
+        if (ret == 0) {
+            ret = picoquic_set_aead_from_secret(&quic->aead_decrypt_retry_token_ctx, cipher, 0, temp_secret, "retry token");
+        }
+        /* MAC mode tokens use a per-context random key and would not
+         * interoperate with the external service */
+        quic->use_mac_retry_tokens = 0;
+
+        /* Retain the effective secret so hot restart can hand it over */
+        if (ret == 0 && cipher->hash->digest_size <= sizeof(quic->retry_token_secret)) {
+            memcpy(quic->retry_token_secret, temp_secret, cipher->hash->digest_size);
+            quic->has_retry_token_secret = 1;
+        }
+
+        /* erase the temporary secret */
+        ptls_clear_memory(temp_secret, cipher->hash->digest_size);
+    }
+    return ret;
+}
+
+/*
  * Create or verify a token. Tokens are tied to an IP address and a time of
  * issue, and come in two variations:
  * - specific tokens are tied to an Original DCID.
@@ -2707,6 +3973,94 @@ int picoquic_tls_client_authentication_activated(picoquic_quic_t* quic) {
  * used from a different address, the decryption will fail.
  */
 
+/* MAC mode tokens: under a spoofed source flood, the AEAD decryption of
+ * each bogus token costs microseconds. The token contents (expiry time,
+ * ODCID, RCID, initial PN) are opaque to the client but not confidential,
+ * so when picoquic_set_mac_retry_tokens is enabled the token is sent in
+ * clear and authenticated with keyed SipHash-2-4 over the client address
+ * and the token body, reducing the cost of rejecting a forged token to a
+ * short hash plus a constant time compare. The layout is the same 8 byte
+ * random sequence (top bit of byte 0 marking a "new token"), followed by
+ * the clear text body and an 8 byte tag. */
+
+#define PICOQUIC_SIPHASH_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define PICOQUIC_SIPHASH_ROUND() \
+    do { \
+        v0 += v1; v1 = PICOQUIC_SIPHASH_ROTL(v1, 13); v1 ^= v0; v0 = PICOQUIC_SIPHASH_ROTL(v0, 32); \
+        v2 += v3; v3 = PICOQUIC_SIPHASH_ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = PICOQUIC_SIPHASH_ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = PICOQUIC_SIPHASH_ROTL(v1, 17); v1 ^= v2; v2 = PICOQUIC_SIPHASH_ROTL(v2, 32); \
+    } while (0)
+
+static uint64_t picoquic_siphash24(const uint8_t* key, const uint8_t* data, size_t length)
+{
+    uint64_t k0 = PICOPARSE_64(key);
+    uint64_t k1 = PICOPARSE_64(key + 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = k1 ^ 0x7465646279746573ull;
+    uint64_t m;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        m = PICOPARSE_64(data + i);
+        v3 ^= m;
+        PICOQUIC_SIPHASH_ROUND();
+        PICOQUIC_SIPHASH_ROUND();
+        v0 ^= m;
+    }
+
+    m = ((uint64_t)length) << 56;
+    for (size_t j = 0; i + j < length; j++) {
+        m |= ((uint64_t)data[i + j]) << (8 * j);
+    }
+    v3 ^= m;
+    PICOQUIC_SIPHASH_ROUND();
+    PICOQUIC_SIPHASH_ROUND();
+    v0 ^= m;
+    v2 ^= 0xff;
+    PICOQUIC_SIPHASH_ROUND();
+    PICOQUIC_SIPHASH_ROUND();
+    PICOQUIC_SIPHASH_ROUND();
+    PICOQUIC_SIPHASH_ROUND();
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t picoquic_retry_token_mac(picoquic_quic_t* quic,
+    const uint8_t* auth_data, size_t auth_data_length, const uint8_t* token, size_t length)
+{
+    /* The MAC input is the client address followed by the token body, in a
+     * stack buffer sized for the address plus the largest token. */
+    uint8_t mac_input[16 + 256];
+    size_t mac_length = 0;
+
+    memcpy(mac_input, auth_data, auth_data_length);
+    mac_length = auth_data_length;
+    if (length > sizeof(mac_input) - mac_length) {
+        length = sizeof(mac_input) - mac_length;
+    }
+    memcpy(mac_input + mac_length, token, length);
+    mac_length += length;
+
+    return picoquic_siphash24(quic->retry_token_mac_key, mac_input, mac_length);
+}
+
+static void picoquic_token_auth_data(const struct sockaddr* addr_peer,
+    uint8_t** auth_data, size_t* auth_data_length)
+{
+    if (addr_peer->sa_family == AF_INET) {
+        *auth_data = (uint8_t*)&((struct sockaddr_in*)addr_peer)->sin_addr;
+        *auth_data_length = 4;
+    }
+    else {
+        *auth_data = (uint8_t*)&((struct sockaddr_in6*)addr_peer)->sin6_addr;
+        *auth_data_length = 16;
+    }
+}
+
 static int picoquic_server_encrypt_retry_token(picoquic_quic_t * quic, const struct sockaddr * addr_peer,
     int is_new_token,
     uint8_t * token, size_t * token_length, size_t token_max, const uint8_t * text, size_t text_length)
@@ -2721,15 +4075,7 @@ static int picoquic_server_encrypt_retry_token(picoquic_quic_t * quic, const str
         *token_length = 0;
     }
     else {
-
-        if (addr_peer->sa_family == AF_INET) {
-            auth_data = (uint8_t*)&((struct sockaddr_in*)addr_peer)->sin_addr;
-            auth_data_length = 4;
-        }
-        else {
-            auth_data = (uint8_t*)&((struct sockaddr_in6*)addr_peer)->sin6_addr;
-            auth_data_length = 16;
-        }
+        picoquic_token_auth_data(addr_peer, &auth_data, &auth_data_length);
         picoquic_crypto_random(quic, token, 8);
         if (is_new_token) {
             token[0] |= 0x80;
@@ -2737,10 +4083,22 @@ static int picoquic_server_encrypt_retry_token(picoquic_quic_t * quic, const str
         else {
             token[0] &= 0x7F;
         }
-        sequence = PICOPARSE_64(token);
 
-        *token_length = (size_t)8u + picoquic_aead_encrypt_generic(token + 8, text, text_length,
-            sequence, auth_data, auth_data_length, quic->aead_encrypt_ticket_ctx);
+        if (quic->use_mac_retry_tokens) {
+            uint64_t tag;
+
+            memcpy(token + 8, text, text_length);
+            tag = picoquic_retry_token_mac(quic, auth_data, auth_data_length, token, 8 + text_length);
+            picoformat_64(token + 8 + text_length, tag);
+            *token_length = 8 + text_length + 8;
+        }
+        else {
+            void* aead_ctx = (quic->aead_encrypt_retry_token_ctx != NULL) ?
+                quic->aead_encrypt_retry_token_ctx : quic->aead_encrypt_ticket_ctx;
+            sequence = PICOPARSE_64(token);
+            *token_length = (size_t)8u + picoquic_aead_encrypt_generic(token + 8, text, text_length,
+                sequence, auth_data, auth_data_length, aead_ctx);
+        }
     }
 
     return ret;
@@ -2754,25 +4112,47 @@ int picoquic_server_decrypt_retry_token(picoquic_quic_t* quic, const struct sock
     uint8_t* auth_data;
     size_t auth_data_length;
 
-    if (addr_peer->sa_family == AF_INET) {
-        auth_data = (uint8_t*)&((struct sockaddr_in *)addr_peer)->sin_addr;
-        auth_data_length = 4;
-    }
-    else {
-        auth_data = (uint8_t*)&((struct sockaddr_in6 *)addr_peer)->sin6_addr;
-        auth_data_length = 16;
-    }
+    picoquic_token_auth_data(addr_peer, &auth_data, &auth_data_length);
 
     if (token_length < 8) {
         *is_new_token = 0;
         ret = -1;
     }
+    else if (quic->use_mac_retry_tokens) {
+        *is_new_token = ((token[0] & 0x80) == 0) ? 0 : 1;
+
+        if (token_length < 16) {
+            ret = -1;
+        }
+        else {
+            uint64_t tag = picoquic_retry_token_mac(quic, auth_data, auth_data_length,
+                token, token_length - 8);
+            uint8_t diff = 0;
+            uint8_t tag_bytes[8];
+
+            picoformat_64(tag_bytes, tag);
+            /* Constant time comparison of the 8 tag bytes */
+            for (int i = 0; i < 8; i++) {
+                diff |= tag_bytes[i] ^ token[token_length - 8 + i];
+            }
+
+            if (diff != 0) {
+                ret = -1;
+            }
+            else {
+                *text_length = token_length - 16;
+                memcpy(text, token + 8, *text_length);
+            }
+        }
+    }
     else {
+        void* aead_ctx = (quic->aead_decrypt_retry_token_ctx != NULL) ?
+            quic->aead_decrypt_retry_token_ctx : quic->aead_decrypt_ticket_ctx;
         *is_new_token = ((token[0] & 0x80) == 0) ? 0: 1;
         sequence = PICOPARSE_64(token);
 
         *text_length = picoquic_aead_decrypt_generic(text, token+8, token_length-8,
-            sequence, auth_data, auth_data_length, quic->aead_decrypt_ticket_ctx);
+            sequence, auth_data, auth_data_length, aead_ctx);
         if (*text_length >= token_length - 8) {
             ret = -1;
         }
@@ -53,8 +53,10 @@ void picoquic_master_tlscontext_free(picoquic_quic_t* quic);
 int picoquic_tlscontext_create(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t current_time);
 
 void picoquic_tlscontext_free(void* ctx);
+void picoquic_tlscontext_clear_pool(picoquic_quic_t* quic);
 
 void picoquic_tlscontext_trim_after_handshake(picoquic_cnx_t* cnx);
+void picoquic_tlscontext_hibernate(picoquic_cnx_t* cnx);
 
 void picoquic_tlscontext_remove_ticket(picoquic_cnx_t* cnx);
 
@@ -67,6 +69,10 @@ uint64_t picoquic_get_tls_time(picoquic_quic_t* quic);
 
 void picoquic_crypto_random(picoquic_quic_t* quic, void* buf, size_t len);
 uint64_t picoquic_crypto_uniform_random(picoquic_quic_t* quic, uint64_t rnd_max);
+/* Per context ChaCha20 DRBG, seeded and periodically reseeded from the
+ * crypto random generator but never issuing a system call per draw. Use for
+ * unpredictable but non-key values, such as connection IDs. */
+void picoquic_fast_random(picoquic_quic_t* quic, void* buf, size_t len);
 
 uint64_t picoquic_public_random_64(void);
 void picoquic_public_random_seed_64(uint64_t seed, int reset);
@@ -76,6 +82,15 @@ uint64_t picoquic_public_uniform_random(uint64_t rnd_max);
 
 size_t picoquic_aead_get_checksum_length(void* aead_context);
 
+/* Scatter-gather seal, see picoquic_crypto_provider_api.h for the iovec
+ * type. Encrypts the concatenation of the segments into output in a single
+ * AEAD pass, so a packet assembled from several buffers can be sealed
+ * without first copying it contiguous. */
+struct st_picoquic_crypto_iovec_t;
+size_t picoquic_aead_encrypt_gather(uint8_t* output,
+    const struct st_picoquic_crypto_iovec_t* iov, size_t nb_iov,
+    uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context);
+
 size_t picoquic_aead_encrypt_generic(uint8_t* output, const uint8_t* input, size_t input_length,
     uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context);
 size_t picoquic_aead_decrypt_generic(uint8_t* output, const uint8_t* input, size_t input_length,
@@ -96,6 +111,12 @@ size_t picoquic_pn_iv_size(void *pn_enc);
 
 void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void *input, size_t len);
 
+/* Batch variant: nb_masks samples of 16 bytes, "sample_stride" bytes apart,
+ * produce nb_masks masks of 5 bytes each. See picoquic_register_pn_encrypt_batch_fn. */
+#define PICOQUIC_PN_MASK_BATCH_MAX 8
+void picoquic_pn_encrypt_batch(void* pn_enc, const uint8_t* samples, size_t sample_stride,
+    uint8_t* masks, size_t nb_masks);
+
 typedef const struct st_ptls_cipher_suite_t ptls_cipher_suite_t;
 
 int picoquic_setup_initial_master_secret(
@@ -119,6 +140,11 @@ uint8_t * picoquic_get_app_secret(picoquic_cnx_t* cnx, int is_enc);
 size_t picoquic_get_app_secret_size(picoquic_cnx_t* cnx);
 int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx);
 void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc);
+/* Derive the next generation of keys ahead of time, on a crypto pool
+ * worker when one is configured. Consumers of crypto_context_new must
+ * call picoquic_wait_precomputed_keys before touching it. */
+void picoquic_precompute_rotated_keys(picoquic_cnx_t* cnx);
+void picoquic_wait_precomputed_keys(picoquic_cnx_t* cnx);
 int picoquic_rotate_app_secret(ptls_cipher_suite_t * cipher, uint8_t * secret, const char *traffic_update_label);
 
 void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx);
@@ -173,8 +199,25 @@ void picoquic_hash_finalize(uint8_t* output, void* hash_context);
 uint8_t* picoquic_get_private_key_from_file(char const* file_name, int* key_length);
 #endif
 int picoquic_set_private_key_from_file(picoquic_quic_t* quic, char const* file_name);
+
+/* Deferred server credentials: register the certificate and key file names
+ * for lazy loading. The PEM files are parsed on the first server handshake
+ * instead of at context creation, which keeps startup time and resident
+ * certificate memory proportional to the tenants actually receiving
+ * traffic. See the comments in tls_api.c. */
+int picoquic_set_tls_credentials_files(picoquic_quic_t* quic, char const* cert_file_name, char const* key_file_name);
+void picoquic_clear_tls_credentials_files(picoquic_quic_t* quic);
+int picoquic_tls_load_credentials_if_needed(picoquic_quic_t* quic);
 ptls_iovec_t* picoquic_get_certs_from_file(char const* file_name, size_t * count);
 
+/* Replace the ticket encryption key of a running context, e.g. to adopt
+ * the key of a previous process during hot restart. */
+int picoquic_set_ticket_crypto_secret(picoquic_quic_t* quic, const uint8_t* secret, size_t secret_length);
+
+/* Build the certificate verifier whose creation was deferred at context
+ * creation, loading the root certificate store if required. */
+void picoquic_tls_ensure_certificate_verifier(picoquic_quic_t* quic);
+
 
 /* Special AEAD context definition functions used for stateless retry integrity protection */
 void * picoquic_create_retry_protection_context(int is_enc, uint8_t * key, const char *prefix_label);
@@ -154,6 +154,176 @@ int picoquic_deserialize_token(picoquic_stored_token_t ** token, uint8_t * bytes
     return ret;
 }
 
+/* Hash index and expiry wheel over the stored tokens.
+ *
+ * The linked list headed by quic->p_first_token remains the reference
+ * structure, used for serialization and enumeration. On top of it, a hash
+ * table keyed by the SNI makes lookup during connection setup O(1), and a
+ * time wheel with one slot per hour of expiry time lets the sweep free
+ * expired tokens without scanning the whole store. A token that expires
+ * mid-slot lingers until its slot is swept; the validity check on lookup
+ * masks the remainder. */
+
+static uint64_t picoquic_token_sni_hash(char const* sni, uint16_t sni_length)
+{
+    /* FNV-1a */
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    for (uint16_t i = 0; i < sni_length; i++) {
+        h ^= (uint8_t)sni[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+static size_t picoquic_token_wheel_slot(uint64_t time_valid_until)
+{
+    return (size_t)((time_valid_until / PICOQUIC_TOKEN_WHEEL_SLOT_MICROSEC) %
+        PICOQUIC_TOKEN_WHEEL_NB_SLOTS);
+}
+
+static void picoquic_token_index_resize(picoquic_quic_t* quic)
+{
+    size_t new_nb_buckets = (quic->token_hash_nb_buckets == 0) ? 64 :
+        2 * quic->token_hash_nb_buckets;
+    picoquic_stored_token_t** new_buckets;
+
+    while (new_nb_buckets < quic->token_nb_stored) {
+        new_nb_buckets *= 2;
+    }
+    new_buckets = (picoquic_stored_token_t**)calloc(new_nb_buckets,
+        sizeof(picoquic_stored_token_t*));
+
+    if (new_buckets != NULL) {
+        /* Rebuild the chains from the reference list */
+        picoquic_stored_token_t* next = quic->p_first_token;
+
+        while (next != NULL) {
+            size_t b = (size_t)(next->token_hash % new_nb_buckets);
+            next->next_in_bucket = new_buckets[b];
+            new_buckets[b] = next;
+            next = next->next_token;
+        }
+        if (quic->token_hash_bucket != NULL) {
+            free(quic->token_hash_bucket);
+        }
+        quic->token_hash_bucket = new_buckets;
+        quic->token_hash_nb_buckets = new_nb_buckets;
+    }
+}
+
+void picoquic_token_index_insert(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    size_t slot = picoquic_token_wheel_slot(stored->time_valid_until);
+
+    stored->token_hash = picoquic_token_sni_hash(stored->sni, stored->sni_length);
+    quic->token_nb_stored++;
+
+    if (quic->token_hash_bucket == NULL ||
+        quic->token_nb_stored > quic->token_hash_nb_buckets) {
+        picoquic_token_index_resize(quic);
+    }
+    if (quic->token_hash_bucket != NULL) {
+        size_t b = (size_t)(stored->token_hash % quic->token_hash_nb_buckets);
+        stored->next_in_bucket = quic->token_hash_bucket[b];
+        quic->token_hash_bucket[b] = stored;
+    }
+    stored->next_in_wheel = quic->token_wheel[slot];
+    quic->token_wheel[slot] = stored;
+}
+
+static void picoquic_token_bucket_unlink(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    if (quic->token_hash_bucket != NULL) {
+        picoquic_stored_token_t** pp = &quic->token_hash_bucket[
+            (size_t)(stored->token_hash % quic->token_hash_nb_buckets)];
+
+        while (*pp != NULL) {
+            if (*pp == stored) {
+                *pp = stored->next_in_bucket;
+                break;
+            }
+            pp = &(*pp)->next_in_bucket;
+        }
+    }
+}
+
+static void picoquic_token_wheel_unlink(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    picoquic_stored_token_t** pp =
+        &quic->token_wheel[picoquic_token_wheel_slot(stored->time_valid_until)];
+
+    while (*pp != NULL) {
+        if (*pp == stored) {
+            *pp = stored->next_in_wheel;
+            break;
+        }
+        pp = &(*pp)->next_in_wheel;
+    }
+}
+
+static void picoquic_token_list_unlink(picoquic_quic_t* quic, picoquic_stored_token_t* stored)
+{
+    if (stored->previous_token == NULL) {
+        quic->p_first_token = stored->next_token;
+    }
+    else {
+        stored->previous_token->next_token = stored->next_token;
+    }
+    if (stored->next_token != NULL) {
+        stored->next_token->previous_token = stored->previous_token;
+    }
+}
+
+static void picoquic_token_index_reset(picoquic_quic_t* quic)
+{
+    if (quic->token_hash_bucket != NULL) {
+        free(quic->token_hash_bucket);
+        quic->token_hash_bucket = NULL;
+    }
+    quic->token_hash_nb_buckets = 0;
+    quic->token_nb_stored = 0;
+    quic->token_wheel_epoch = 0;
+    memset(quic->token_wheel, 0, sizeof(quic->token_wheel));
+}
+
+/* Free the expired tokens in every wheel slot whose hour has elapsed since
+ * the last sweep. Each slot is visited at most once per hour, so the
+ * amortized cost is proportional to the number of expired tokens. */
+static void picoquic_token_sweep(picoquic_quic_t* quic, uint64_t current_time)
+{
+    uint64_t epoch_now = current_time / PICOQUIC_TOKEN_WHEEL_SLOT_MICROSEC;
+
+    if (epoch_now > quic->token_wheel_epoch) {
+        uint64_t nb_slots = epoch_now - quic->token_wheel_epoch;
+
+        if (nb_slots > PICOQUIC_TOKEN_WHEEL_NB_SLOTS) {
+            nb_slots = PICOQUIC_TOKEN_WHEEL_NB_SLOTS;
+        }
+        for (uint64_t k = 0; k < nb_slots; k++) {
+            size_t slot = (size_t)((quic->token_wheel_epoch + 1 + k) %
+                PICOQUIC_TOKEN_WHEEL_NB_SLOTS);
+            picoquic_stored_token_t** pp = &quic->token_wheel[slot];
+
+            while (*pp != NULL) {
+                if ((*pp)->time_valid_until <= current_time) {
+                    picoquic_stored_token_t* deleted = *pp;
+                    *pp = deleted->next_in_wheel;
+                    picoquic_token_bucket_unlink(quic, deleted);
+                    picoquic_token_list_unlink(quic, deleted);
+                    quic->token_nb_stored--;
+                    free(deleted);
+                }
+                else {
+                    pp = &(*pp)->next_in_wheel;
+                }
+            }
+        }
+        quic->token_wheel_epoch = epoch_now;
+    }
+}
+
 int picoquic_store_token(picoquic_quic_t * quic,
     char const* sni, uint16_t sni_length,
     uint8_t const* ip_addr, uint8_t ip_addr_length,
@@ -163,6 +333,8 @@ int picoquic_store_token(picoquic_quic_t * quic,
     picoquic_stored_token_t** pp_first_token = &quic->p_first_token;
     uint64_t current_time = picoquic_get_tls_time(quic);
 
+    picoquic_token_sweep(quic, current_time);
+
     if (token_length < 1 || sni == NULL || sni_length == 0) {
         ret = PICOQUIC_ERROR_INVALID_TOKEN;
     }
@@ -176,27 +348,51 @@ int picoquic_store_token(picoquic_quic_t * quic,
         }
         else {
             picoquic_stored_token_t* next;
-            picoquic_stored_token_t** pprevious;
 
             stored->next_token = next = *pp_first_token;
+            if (next != NULL) {
+                next->previous_token = stored;
+            }
+            stored->previous_token = NULL;
             *pp_first_token = stored;
-            pprevious = &stored->next_token;
-
-            /* Now remove the old tokens for that SNI & ip_addr */
-            while (next != NULL) {
-                if (next->time_valid_until <= stored->time_valid_until && next->sni_length == sni_length && next->ip_addr_length == ip_addr_length && memcmp(next->sni, sni, sni_length) == 0 && memcmp(next->ip_addr, ip_addr, ip_addr_length) == 0) {
-                    picoquic_stored_token_t* deleted = next;
-                    next = next->next_token;
-                    *pprevious = next;
-                    free(deleted);
+            picoquic_token_index_insert(quic, stored);
+
+            /* Now remove the old tokens for that SNI & ip_addr, walking
+             * the hash chain rather than the whole list */
+            if (quic->token_hash_bucket != NULL) {
+                picoquic_stored_token_t** pp = &quic->token_hash_bucket[
+                    (size_t)(stored->token_hash % quic->token_hash_nb_buckets)];
+
+                while (*pp != NULL) {
+                    next = *pp;
+                    if (next != stored &&
+                        next->time_valid_until <= stored->time_valid_until &&
+                        next->sni_length == sni_length && next->ip_addr_length == ip_addr_length &&
+                        memcmp(next->sni, sni, sni_length) == 0 &&
+                        memcmp(next->ip_addr, ip_addr, ip_addr_length) == 0) {
+                        *pp = next->next_in_bucket;
+                        picoquic_token_wheel_unlink(quic, next);
+                        picoquic_token_list_unlink(quic, next);
+                        quic->token_nb_stored--;
+                        free(next);
+                    }
+                    else {
+                        pp = &next->next_in_bucket;
+                    }
                 }
-                else {
-                    pprevious = &next->next_token;
-                    next = next->next_token;
+            }
+
+            if (quic->store_journal != NULL) {
+                uint8_t buffer[2048];
+                size_t record_size;
+
+                if (picoquic_serialize_token(stored, buffer, sizeof(buffer), &record_size) == 0) {
+                    (void)picoquic_journal_append(quic, picoquic_journal_record_token,
+                        buffer, record_size);
                 }
             }
         }
-    } 
+    }
 
     return ret;
 }
@@ -209,12 +405,18 @@ int picoquic_get_token(picoquic_quic_t * quic,
     int ret = 0;
 
     uint64_t current_time = picoquic_get_tls_time(quic);
-    picoquic_stored_token_t* p_first_token = quic->p_first_token;
-    picoquic_stored_token_t* next = p_first_token;
+    picoquic_stored_token_t* next;
     picoquic_stored_token_t* best_match = NULL;
+    uint64_t hash = picoquic_token_sni_hash(sni, sni_length);
+
+    picoquic_token_sweep(quic, current_time);
+
+    next = (quic->token_hash_bucket == NULL) ? quic->p_first_token :
+        quic->token_hash_bucket[(size_t)(hash % quic->token_hash_nb_buckets)];
 
     while (next != NULL) {
-        if (next->time_valid_until > current_time && next->sni_length == sni_length && memcmp(next->sni, sni, sni_length) == 0 && next->was_used == 0){
+        if ((quic->token_hash_bucket == NULL || next->token_hash == hash) &&
+            next->time_valid_until > current_time && next->sni_length == sni_length && memcmp(next->sni, sni, sni_length) == 0 && next->was_used == 0){
             if (ip_addr_length > 0) {
                 if (next->ip_addr_length == ip_addr_length && memcmp(next->ip_addr, ip_addr, ip_addr_length) == 0) {
                     best_match = next;
@@ -226,8 +428,8 @@ int picoquic_get_token(picoquic_quic_t * quic,
                     best_match = next;
                 }
             }
-        } 
-        next = next->next_token;
+        }
+        next = (quic->token_hash_bucket == NULL) ? next->next_token : next->next_in_bucket;
     }
 
     if (best_match == NULL || best_match->token_length == 0 || (*token = (uint8_t *)malloc(best_match->token_length)) == NULL) {
@@ -291,6 +493,9 @@ int picoquic_load_tokens(picoquic_quic_t* quic, char const* token_file_name)
     uint64_t current_time = picoquic_get_tls_time(quic);
     picoquic_stored_token_t** pp_first_token = &quic->p_first_token;
 
+    /* The load replaces the current list; rebuild the index from scratch */
+    picoquic_token_index_reset(quic);
+
     if ((F = picoquic_file_open_ex(token_file_name, "rb", &file_ret)) == NULL) {
         ret = (file_ret == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
     }
@@ -328,6 +533,7 @@ int picoquic_load_tokens(picoquic_quic_t* quic, char const* token_file_name)
                         next->ip_addr = ((uint8_t*)next->sni) + next->sni_length + 1;
                         next->token = (uint8_t*)(next->ip_addr + next->ip_addr_length + 1);
                         next->next_token = NULL;
+                        next->previous_token = previous;
                         if (previous == NULL) {
                             *pp_first_token = next;
                         }
@@ -336,6 +542,7 @@ int picoquic_load_tokens(picoquic_quic_t* quic, char const* token_file_name)
                         }
 
                         previous = next;
+                        picoquic_token_index_insert(quic, next);
                     }
                 }
             }
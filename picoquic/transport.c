@@ -26,6 +26,7 @@
 #include "picoquic_internal.h"
 #include "picoquic_unified_log.h"
 #include "tls_api.h"
+#include <stdlib.h>
 #include <string.h>
 
 uint64_t picoquic_transport_param_varint_decode(picoquic_cnx_t * cnx, uint8_t* bytes, uint64_t extension_length, int* ret) 
@@ -303,70 +304,114 @@ int picoquic_negotiate_multipath_option(picoquic_cnx_t* cnx)
     return ret;
 }
 
-int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mode,
-    uint8_t* bytes, size_t bytes_length, size_t* consumed)
+/* Encode the leading run of transport parameters that depend only on the
+ * picoquic_tp_t values. This prefix is what picoquic_prepare_transport_extensions
+ * caches at the quic context level, so the encoding order here must not be
+ * interleaved with per connection parameters. */
+static uint8_t* picoquic_encode_transport_param_tp_prefix(uint8_t* bytes, uint8_t* bytes_max,
+    const picoquic_tp_t* tp)
 {
-    int ret = 0;
-    uint8_t* bytes_zero = bytes;
-    uint8_t* bytes_max = bytes + bytes_length;
-
     bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_stream_data_bidi_local,
-        cnx->local_parameters.initial_max_stream_data_bidi_local);
+        tp->initial_max_stream_data_bidi_local);
 
     bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_data,
-        cnx->local_parameters.initial_max_data);
+        tp->initial_max_data);
 
-    if (cnx->local_parameters.initial_max_stream_id_bidir > 0) {
+    if (tp->initial_max_stream_id_bidir > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_streams_bidi,
-            cnx->local_parameters.initial_max_stream_id_bidir);
+            tp->initial_max_stream_id_bidir);
     }
 
-    if (cnx->local_parameters.max_idle_timeout > 0) {
+    if (tp->max_idle_timeout > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_idle_timeout,
-            cnx->local_parameters.max_idle_timeout);
+            tp->max_idle_timeout);
     }
 
     bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_max_packet_size,
-        cnx->local_parameters.max_packet_size);
+        tp->max_packet_size);
 
-    if (cnx->local_parameters.ack_delay_exponent != 3) {
+    if (tp->ack_delay_exponent != 3) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_ack_delay_exponent,
-            cnx->local_parameters.ack_delay_exponent);
+            tp->ack_delay_exponent);
     }
 
-    if (cnx->local_parameters.initial_max_stream_id_unidir > 0) {
+    if (tp->initial_max_stream_id_unidir > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_streams_uni,
-            cnx->local_parameters.initial_max_stream_id_unidir);
+            tp->initial_max_stream_id_unidir);
     }
 
-    if (cnx->local_parameters.prefered_address.is_defined) {
+    if (tp->prefered_address.is_defined) {
         bytes = picoquic_encode_transport_param_prefered_address(
-            bytes, bytes_max, &cnx->local_parameters.prefered_address);
+            bytes, bytes_max, (picoquic_tp_prefered_address_t*)&tp->prefered_address);
     }
 
-    if (cnx->local_parameters.migration_disabled != 0 && bytes != NULL) {
+    if (tp->migration_disabled != 0 && bytes != NULL) {
         bytes = picoquic_transport_param_type_flag_encode(bytes, bytes_max, picoquic_tp_disable_migration);
     }
 
-    if (cnx->local_parameters.initial_max_stream_data_bidi_remote > 0) {
+    if (tp->initial_max_stream_data_bidi_remote > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_stream_data_bidi_remote,
-            cnx->local_parameters.initial_max_stream_data_bidi_remote);
+            tp->initial_max_stream_data_bidi_remote);
     }
 
-    if (cnx->local_parameters.initial_max_stream_data_uni > 0) {
+    if (tp->initial_max_stream_data_uni > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_initial_max_stream_data_uni,
-            cnx->local_parameters.initial_max_stream_data_uni);
+            tp->initial_max_stream_data_uni);
     }
 
-    if (cnx->local_parameters.active_connection_id_limit > 0) {
+    if (tp->active_connection_id_limit > 0) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_active_connection_id_limit,
-            cnx->local_parameters.active_connection_id_limit);
+            tp->active_connection_id_limit);
     }
 
-    if (cnx->local_parameters.max_ack_delay != PICOQUIC_ACK_DELAY_MAX_DEFAULT) {
+    if (tp->max_ack_delay != PICOQUIC_ACK_DELAY_MAX_DEFAULT) {
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_max_ack_delay,
-            (cnx->local_parameters.max_ack_delay + 999) / 1000); /* Max ACK delay in milliseconds */
+            (tp->max_ack_delay + 999) / 1000); /* Max ACK delay in milliseconds */
+    }
+
+    return bytes;
+}
+
+int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mode,
+    uint8_t* bytes, size_t bytes_length, size_t* consumed)
+{
+    int ret = 0;
+    uint8_t* bytes_zero = bytes;
+    uint8_t* bytes_max = bytes + bytes_length;
+    picoquic_quic_t* quic = cnx->quic;
+
+    if (quic->tp_prefix_cache != NULL &&
+        memcmp(&cnx->local_parameters, &quic->tp_prefix_cache_tp, sizeof(picoquic_tp_t)) == 0) {
+        /* The static prefix was already serialized for these parameter values */
+        if (bytes + quic->tp_prefix_cache_length <= bytes_max) {
+            memcpy(bytes, quic->tp_prefix_cache, quic->tp_prefix_cache_length);
+            bytes += quic->tp_prefix_cache_length;
+        }
+        else {
+            bytes = NULL;
+        }
     }
+    else {
+        bytes = picoquic_encode_transport_param_tp_prefix(bytes, bytes_max, &cnx->local_parameters);
+
+        if (bytes != NULL) {
+            /* Remember the serialized prefix for the next connection that
+             * uses the same parameter values */
+            size_t prefix_length = bytes - bytes_zero;
+            uint8_t* prefix_copy = (uint8_t*)malloc((prefix_length > 0) ? prefix_length : 1);
+
+            if (prefix_copy != NULL) {
+                if (quic->tp_prefix_cache != NULL) {
+                    free(quic->tp_prefix_cache);
+                }
+                memcpy(prefix_copy, bytes_zero, prefix_length);
+                quic->tp_prefix_cache = prefix_copy;
+                quic->tp_prefix_cache_length = prefix_length;
+                memcpy(&quic->tp_prefix_cache_tp, &cnx->local_parameters, sizeof(picoquic_tp_t));
+            }
+        }
+    }
+
     bytes = picoquic_transport_param_cid_encode(bytes, bytes_max, picoquic_tp_handshake_connection_id, &cnx->path[0]->p_local_cnxid->cnx_id);
 
     if (extension_mode == 1){
@@ -454,6 +499,11 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
             (uint64_t)cnx->local_parameters.enable_bdp_frame);
     }
 
+    if (cnx->local_parameters.enable_fec > 0 && bytes != NULL) {
+        bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, picoquic_tp_enable_fec,
+            (uint64_t)cnx->local_parameters.enable_fec);
+    }
+
     if (cnx->local_parameters.is_multipath_enabled > 0 && bytes != NULL){
         bytes = picoquic_transport_param_type_varint_encode(bytes, bytes_max, 
             picoquic_tp_initial_max_path_id,
@@ -523,6 +573,342 @@ void picoquic_clear_transport_extensions(picoquic_cnx_t* cnx)
     cnx->remote_parameters.do_grease_quic_bit = 0;
     cnx->remote_parameters.enable_bdp_frame = 0;
     cnx->remote_parameters.initial_max_path_id = 0;
+    cnx->remote_parameters.enable_fec = 0;
+}
+
+/* Memoized layout of the transport parameter encoding received from a peer.
+ * Peers running the same software send the same sequence of parameter types
+ * and encoded lengths on every handshake, even though the values differ per
+ * connection. The cache remembers, per quic context, where each parameter
+ * sits in the blob; when a new blob carries byte-identical type and length
+ * headers, the receive path dispatches straight to the value decoding,
+ * skipping the header parsing and the duplicate detection that were already
+ * validated when the layout was memoized. Value range checks and per
+ * connection verifications, such as the handshake CID comparison, still run
+ * on every handshake. */
+#define PICOQUIC_TP_LAYOUT_NB_MAX 32
+#define PICOQUIC_TP_LAYOUT_HEADER_MAX 16
+
+typedef struct st_picoquic_tp_layout_param_t {
+    uint64_t extension_type;
+    size_t header_offset;
+    size_t header_length;
+    size_t value_offset;
+    uint64_t value_length;
+    uint8_t header[PICOQUIC_TP_LAYOUT_HEADER_MAX];
+} picoquic_tp_layout_param_t;
+
+typedef struct st_picoquic_tp_layout_cache_t {
+    int extension_mode;
+    size_t blob_length;
+    uint64_t present_flag;
+    size_t nb_params;
+    picoquic_tp_layout_param_t params[PICOQUIC_TP_LAYOUT_NB_MAX];
+} picoquic_tp_layout_cache_t;
+
+static int picoquic_tp_layout_match(const picoquic_tp_layout_cache_t* layout,
+    int extension_mode, const uint8_t* bytes, size_t bytes_max)
+{
+    int is_match = 0;
+
+    if (layout != NULL && layout->extension_mode == extension_mode &&
+        layout->blob_length == bytes_max && layout->nb_params > 0) {
+        is_match = 1;
+        for (size_t i = 0; is_match && i < layout->nb_params; i++) {
+            if (memcmp(bytes + layout->params[i].header_offset,
+                layout->params[i].header, layout->params[i].header_length) != 0) {
+                is_match = 0;
+            }
+        }
+    }
+
+    return is_match;
+}
+
+/* Process a single transport parameter. The value checks and the side
+ * effects on the connection state are shared between the generic parsing
+ * loop and the memoized layout fast path of
+ * picoquic_receive_transport_extensions. */
+static int picoquic_process_transport_param(picoquic_cnx_t* cnx, int extension_mode,
+    uint64_t extension_type, uint8_t* bytes, uint64_t extension_length,
+    picoquic_connection_id_t* original_connection_id,
+    picoquic_connection_id_t* handshake_connection_id,
+    picoquic_connection_id_t* retry_connection_id)
+{
+    int ret = 0;
+
+    switch (extension_type) {
+    case picoquic_tp_initial_max_stream_data_bidi_local:
+        cnx->remote_parameters.initial_max_stream_data_bidi_local =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+
+        /* If we sent zero rtt data, the streams were created with the
+         * old value of the remote parameter. We need to update that.
+         */
+        picoquic_update_stream_initial_remote(cnx);
+        break;
+    case picoquic_tp_initial_max_stream_data_bidi_remote:
+        cnx->remote_parameters.initial_max_stream_data_bidi_remote =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        /* If we sent zero rtt data, the streams were created with the
+        * old value of the remote parameter. We need to update that.
+        */
+        picoquic_update_stream_initial_remote(cnx);
+        break;
+    case picoquic_tp_initial_max_stream_data_uni:
+        cnx->remote_parameters.initial_max_stream_data_uni =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        /* If we sent zero rtt data, the streams were created with the
+        * old value of the remote parameter. We need to update that.
+        */
+        picoquic_update_stream_initial_remote(cnx);
+        break;
+    case picoquic_tp_initial_max_data:
+        cnx->remote_parameters.initial_max_data =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        cnx->maxdata_remote = cnx->remote_parameters.initial_max_data;
+        break;
+    case picoquic_tp_initial_max_streams_bidi: {
+        uint64_t old_limit = cnx->max_stream_id_bidir_remote;
+        cnx->remote_parameters.initial_max_stream_id_bidir =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        cnx->max_stream_id_bidir_remote = STREAM_ID_FROM_RANK(
+            (cnx->remote_parameters.initial_max_stream_id_bidir == 0xFFFFFFFF) ? 0 : cnx->remote_parameters.initial_max_stream_id_bidir,
+            cnx->client_mode, 0);
+        cnx->max_stream_data_remote = cnx->remote_parameters.initial_max_stream_data_bidi_remote;
+        picoquic_add_output_streams(cnx, old_limit, cnx->max_stream_id_bidir_remote, 1);
+        break;
+    }
+    case picoquic_tp_idle_timeout:
+        cnx->remote_parameters.max_idle_timeout = 
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        break;
+
+    case picoquic_tp_max_packet_size: {
+        /* The default for this parameter is the maximum permitted UDP payload of 65527. Values below 1200 are invalid. */
+        uint64_t max_packet_size = picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        if (ret == 0){
+            if (max_packet_size < 1200 || max_packet_size > 65527) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Max packet size TP");
+            }
+            else {
+                cnx->remote_parameters.max_packet_size = (uint32_t)max_packet_size;
+            }
+        }
+        break;
+    }
+    case picoquic_tp_stateless_reset_token:
+        if (extension_mode != 1) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Reset token from client");
+        }
+        else if (extension_length != PICOQUIC_RESET_SECRET_SIZE) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Reset token TP");
+        }
+        else {
+            memcpy(cnx->path[0]->p_remote_cnxid->reset_secret, bytes, PICOQUIC_RESET_SECRET_SIZE);
+        }
+        break;
+    case picoquic_tp_ack_delay_exponent:
+        cnx->remote_parameters.ack_delay_exponent = (uint8_t)
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        break;
+    case picoquic_tp_initial_max_streams_uni: {
+        uint64_t old_limit = cnx->max_stream_id_unidir_remote;
+        cnx->remote_parameters.initial_max_stream_id_unidir =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        cnx->max_stream_id_unidir_remote = STREAM_ID_FROM_RANK(
+            (cnx->remote_parameters.initial_max_stream_id_unidir == 0xFFFFFFFF) ? 0 : cnx->remote_parameters.initial_max_stream_id_unidir,
+            cnx->client_mode, 1);
+        picoquic_add_output_streams(cnx, old_limit, cnx->max_stream_id_unidir_remote, 0);
+        break;
+    }
+    case picoquic_tp_server_preferred_address:
+    {
+        uint64_t coded_length = picoquic_decode_transport_param_prefered_address(
+            bytes, (size_t)extension_length, &cnx->remote_parameters.prefered_address);
+
+        if (coded_length != extension_length) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Preferred address TP");
+        }
+        break;
+    }
+    case picoquic_tp_disable_migration:
+        if (extension_length != 0) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Disable migration TP");
+        }
+        else {
+            cnx->remote_parameters.migration_disabled = 1;
+        }
+        break;
+    case picoquic_tp_max_ack_delay:
+        cnx->remote_parameters.max_ack_delay = (uint32_t)
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret) * 1000;
+        if (cnx->remote_parameters.max_ack_delay > PICOQUIC_MAX_ACK_DELAY_MAX_MS * 1000) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Max ack delay TP");
+        }
+        break;
+    case picoquic_tp_original_connection_id:
+        ret = picoquic_transport_param_cid_decode(cnx, bytes, extension_length, original_connection_id);
+        break;
+    case picoquic_tp_retry_connection_id:
+        ret = picoquic_transport_param_cid_decode(cnx, bytes, extension_length, retry_connection_id);
+        break;
+    case picoquic_tp_handshake_connection_id:
+        ret = picoquic_transport_param_cid_decode(cnx, bytes, extension_length, handshake_connection_id);
+        if (ret == 0) {
+            if (picoquic_compare_connection_id(&cnx->path[0]->p_remote_cnxid->cnx_id, handshake_connection_id) != 0) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "HCID check");
+            }
+            else {
+                cnx->is_hcid_verified = 1;
+            }
+        }
+        break;
+    case picoquic_tp_active_connection_id_limit:
+        cnx->remote_parameters.active_connection_id_limit = (uint32_t)
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        /* TODO: may need to check the value, but conditions are unclear */
+        break;
+    case picoquic_tp_max_datagram_frame_size:
+        cnx->remote_parameters.max_datagram_frame_size = (uint32_t)
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        break;
+    case picoquic_tp_enable_loss_bit: {
+        uint64_t enabled = picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        if (ret == 0) {
+            if (enabled == 0) {
+                /* Send only variant of loss bit */
+                cnx->remote_parameters.enable_loss_bit = 1;
+            }
+            else if (enabled == 1) {
+                /* Both send and receive are enabled */
+                cnx->remote_parameters.enable_loss_bit = 2;
+            }
+            else {
+                /* Only values 0 and 1 are expected */
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Loss bit TP");
+            }
+        }
+        break;
+    }
+    case picoquic_tp_min_ack_delay:
+        cnx->remote_parameters.min_ack_delay =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        /* Values of 0 and values larger that 2^24 are not expected */
+        if (ret == 0 &&
+            (cnx->remote_parameters.min_ack_delay == 0 ||
+                cnx->remote_parameters.min_ack_delay > PICOQUIC_ACK_DELAY_MIN_MAX_VALUE)) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, 0, "Min ack delay TP");
+        }
+        else {
+            if (cnx->local_parameters.min_ack_delay > 0) {
+                cnx->is_ack_frequency_negotiated = 1;
+            }
+        }
+        break;
+    case picoquic_tp_enable_time_stamp: {
+        uint64_t tp_time_stamp =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+
+        if (ret == 0) {
+            if (tp_time_stamp < 1 || tp_time_stamp > 3) {
+                ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
+            }
+            else {
+                cnx->remote_parameters.enable_time_stamp = (int)tp_time_stamp;
+            }
+        }
+        break;
+    }
+    case picoquic_tp_grease_quic_bit:
+        if (extension_length != 0) {
+            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Grease TP");
+        }
+        else {
+            cnx->remote_parameters.do_grease_quic_bit = 1;
+        }
+        break;
+    case picoquic_tp_initial_max_path_id: {
+        cnx->remote_parameters.is_multipath_enabled = 1;
+        cnx->remote_parameters.initial_max_path_id = 
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        break;
+    }
+
+    case picoquic_tp_version_negotiation: {
+        uint64_t error_found;
+        uint32_t negotiated_vn;
+        int negotiated_index;
+        const uint8_t* final = picoquic_process_tp_version_negotiation(bytes,
+            bytes + extension_length, extension_mode,
+            picoquic_supported_versions[cnx->version_index].version,
+            &negotiated_vn, &negotiated_index, &error_found);
+        if (final == NULL) {
+            ret = picoquic_connection_error_ex(cnx, error_found, 0, "V. Negotiation TP");
+        }
+        else {
+            cnx->do_version_negotiation = 1;
+            if (negotiated_vn != 0 && cnx->version_index != negotiated_index){
+                ret = picoquic_process_version_upgrade(cnx, cnx->version_index, negotiated_index);
+            }
+        }
+        break;
+    }
+    case picoquic_tp_enable_bdp_frame: {
+        uint64_t enable_bdp =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        if (ret == 0) {
+            if (enable_bdp > 1) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "BDP parameter");
+            }
+            else {
+                cnx->remote_parameters.enable_bdp_frame = (int)enable_bdp;
+            }
+        }
+        break;
+    }
+    case picoquic_tp_enable_fec: {
+        uint64_t enable_fec =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        if (ret == 0) {
+            if (enable_fec > 1) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "FEC parameter");
+            }
+            else {
+                cnx->remote_parameters.enable_fec = (int)enable_fec;
+            }
+        }
+        break;
+    }
+    case picoquic_tp_address_discovery: {
+        uint64_t address_discovery_mode =
+            picoquic_transport_param_varint_decode(cnx, bytes, extension_length, &ret);
+        if (ret == 0) {
+            if (address_discovery_mode > 2) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Address discovery parameter");
+            }
+            else {
+                /* After doing +1, we get the following:
+                * address_discovery_mode == 0: nothing goes (TP is absent)
+                * address_discovery_mode == 1: send only (TP value 0)
+                * address_discovery_mode == 2: receive only (TP value 1)
+                * address_discovery_mode == 3: both (TP value 2)
+                */
+                cnx->remote_parameters.address_discovery_mode = (int)(address_discovery_mode + 1);
+                cnx->is_address_discovery_provider = ((cnx->remote_parameters.address_discovery_mode & 2) != 0 &&
+                    (cnx->local_parameters.address_discovery_mode & 1) != 0);
+                cnx->is_address_discovery_receiver = ((cnx->remote_parameters.address_discovery_mode & 1) != 0 &&
+                    (cnx->local_parameters.address_discovery_mode & 2) != 0);
+            }
+        }
+        break;
+    }
+    default:
+        /* ignore unknown extensions */
+        break;
+    }
+
+    return ret;
 }
 
 int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mode,
@@ -545,296 +931,99 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
     /* Except for ack_delay_exponent, whose default is 3 */
     cnx->remote_parameters.ack_delay_exponent = 3;
 
-    while (ret == 0 && byte_index < bytes_max) {
-        size_t ll_type = 0;
-        size_t ll_length = 0;
-        uint64_t extension_type = UINT64_MAX;
-        uint64_t extension_length = 0;
+    if (picoquic_tp_layout_match(cnx->quic->tp_layout_cache, extension_mode, bytes, bytes_max)) {
+        /* The parameter types and lengths match a previously validated
+         * layout; decode the values at the memoized offsets. */
+        picoquic_tp_layout_cache_t* layout = cnx->quic->tp_layout_cache;
 
-        if (byte_index + 2 > bytes_max) {
-            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "TP length");
-        }
-        else {
-            ll_type = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &extension_type);
-            byte_index += ll_type;
-            ll_length = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &extension_length);
-            byte_index += ll_length;
+        for (size_t i = 0; ret == 0 && i < layout->nb_params; i++) {
+            picoquic_tp_layout_param_t* p = &layout->params[i];
 
-            if (ll_type == 0 || ll_length == 0 || byte_index + extension_length > bytes_max) {
-                ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
+            ret = picoquic_process_transport_param(cnx, extension_mode, p->extension_type,
+                bytes + p->value_offset, p->value_length, &original_connection_id,
+                &handshake_connection_id, &retry_connection_id);
+
+            if (ret == 0) {
+                byte_index = p->value_offset + (size_t)p->value_length;
             }
-            else {
-                if (extension_type < 64) {
-                    if ((present_flag & (1ull << extension_type)) != 0) {
-                        /* Malformed, already present */
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Malformed TP");
-                    }
-                    else {
-                        present_flag |= (1ull << extension_type);
-                    }
-                }
+        }
+        present_flag = layout->present_flag;
+    }
+    else {
+        picoquic_tp_layout_cache_t layout_candidate;
+        int layout_recordable = 1;
 
-                switch (extension_type) {
-                case picoquic_tp_initial_max_stream_data_bidi_local:
-                    cnx->remote_parameters.initial_max_stream_data_bidi_local =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
+        layout_candidate.nb_params = 0;
 
-                    /* If we sent zero rtt data, the streams were created with the
-                     * old value of the remote parameter. We need to update that.
-                     */
-                    picoquic_update_stream_initial_remote(cnx);
-                    break;
-                case picoquic_tp_initial_max_stream_data_bidi_remote:
-                    cnx->remote_parameters.initial_max_stream_data_bidi_remote =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    /* If we sent zero rtt data, the streams were created with the
-                    * old value of the remote parameter. We need to update that.
-                    */
-                    picoquic_update_stream_initial_remote(cnx);
-                    break;
-                case picoquic_tp_initial_max_stream_data_uni:
-                    cnx->remote_parameters.initial_max_stream_data_uni =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    /* If we sent zero rtt data, the streams were created with the
-                    * old value of the remote parameter. We need to update that.
-                    */
-                    picoquic_update_stream_initial_remote(cnx);
-                    break;
-                case picoquic_tp_initial_max_data:
-                    cnx->remote_parameters.initial_max_data =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    cnx->maxdata_remote = cnx->remote_parameters.initial_max_data;
-                    break;
-                case picoquic_tp_initial_max_streams_bidi: {
-                    uint64_t old_limit = cnx->max_stream_id_bidir_remote;
-                    cnx->remote_parameters.initial_max_stream_id_bidir =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    cnx->max_stream_id_bidir_remote = STREAM_ID_FROM_RANK(
-                        (cnx->remote_parameters.initial_max_stream_id_bidir == 0xFFFFFFFF) ? 0 : cnx->remote_parameters.initial_max_stream_id_bidir,
-                        cnx->client_mode, 0);
-                    cnx->max_stream_data_remote = cnx->remote_parameters.initial_max_stream_data_bidi_remote;
-                    picoquic_add_output_streams(cnx, old_limit, cnx->max_stream_id_bidir_remote, 1);
-                    break;
-                }
-                case picoquic_tp_idle_timeout:
-                    cnx->remote_parameters.max_idle_timeout = 
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    break;
+        while (ret == 0 && byte_index < bytes_max) {
+            size_t ll_type = 0;
+            size_t ll_length = 0;
+            size_t header_offset = byte_index;
+            uint64_t extension_type = UINT64_MAX;
+            uint64_t extension_length = 0;
 
-                case picoquic_tp_max_packet_size: {
-                    /* The default for this parameter is the maximum permitted UDP payload of 65527. Values below 1200 are invalid. */
-                    uint64_t max_packet_size = picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    if (ret == 0){
-                        if (max_packet_size < 1200 || max_packet_size > 65527) {
-                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Max packet size TP");
-                        }
-                        else {
-                            cnx->remote_parameters.max_packet_size = (uint32_t)max_packet_size;
-                        }
-                    }
-                    break;
-                }
-                case picoquic_tp_stateless_reset_token:
-                    if (extension_mode != 1) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Reset token from client");
-                    }
-                    else if (extension_length != PICOQUIC_RESET_SECRET_SIZE) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Reset token TP");
-                    }
-                    else {
-                        memcpy(cnx->path[0]->p_remote_cnxid->reset_secret, bytes + byte_index, PICOQUIC_RESET_SECRET_SIZE);
-                    }
-                    break;
-                case picoquic_tp_ack_delay_exponent:
-                    cnx->remote_parameters.ack_delay_exponent = (uint8_t)
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    break;
-                case picoquic_tp_initial_max_streams_uni: {
-                    uint64_t old_limit = cnx->max_stream_id_unidir_remote;
-                    cnx->remote_parameters.initial_max_stream_id_unidir =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    cnx->max_stream_id_unidir_remote = STREAM_ID_FROM_RANK(
-                        (cnx->remote_parameters.initial_max_stream_id_unidir == 0xFFFFFFFF) ? 0 : cnx->remote_parameters.initial_max_stream_id_unidir,
-                        cnx->client_mode, 1);
-                    picoquic_add_output_streams(cnx, old_limit, cnx->max_stream_id_unidir_remote, 0);
-                    break;
-                }
-                case picoquic_tp_server_preferred_address:
-                {
-                    uint64_t coded_length = picoquic_decode_transport_param_prefered_address(
-                        bytes + byte_index, (size_t)extension_length, &cnx->remote_parameters.prefered_address);
+            if (byte_index + 2 > bytes_max) {
+                ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "TP length");
+            }
+            else {
+                ll_type = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &extension_type);
+                byte_index += ll_type;
+                ll_length = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &extension_length);
+                byte_index += ll_length;
 
-                    if (coded_length != extension_length) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Preferred address TP");
-                    }
-                    break;
+                if (ll_type == 0 || ll_length == 0 || byte_index + extension_length > bytes_max) {
+                    ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
                 }
-                case picoquic_tp_disable_migration:
-                    if (extension_length != 0) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Disable migration TP");
-                    }
-                    else {
-                        cnx->remote_parameters.migration_disabled = 1;
-                    }
-                    break;
-                case picoquic_tp_max_ack_delay:
-                    cnx->remote_parameters.max_ack_delay = (uint32_t)
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret) * 1000;
-                    if (cnx->remote_parameters.max_ack_delay > PICOQUIC_MAX_ACK_DELAY_MAX_MS * 1000) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Max ack delay TP");
-                    }
-                    break;
-                case picoquic_tp_original_connection_id:
-                    ret = picoquic_transport_param_cid_decode(cnx, bytes + byte_index, extension_length, &original_connection_id);
-                    break;
-                case picoquic_tp_retry_connection_id:
-                    ret = picoquic_transport_param_cid_decode(cnx, bytes + byte_index, extension_length, &retry_connection_id);
-                    break;
-                case picoquic_tp_handshake_connection_id:
-                    ret = picoquic_transport_param_cid_decode(cnx, bytes + byte_index, extension_length, &handshake_connection_id);
-                    if (ret == 0) {
-                        if (picoquic_compare_connection_id(&cnx->path[0]->p_remote_cnxid->cnx_id, &handshake_connection_id) != 0) {
-                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "HCID check");
-                        }
-                        else {
-                            cnx->is_hcid_verified = 1;
-                        }
-                    }
-                    break;
-                case picoquic_tp_active_connection_id_limit:
-                    cnx->remote_parameters.active_connection_id_limit = (uint32_t)
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    /* TODO: may need to check the value, but conditions are unclear */
-                    break;
-                case picoquic_tp_max_datagram_frame_size:
-                    cnx->remote_parameters.max_datagram_frame_size = (uint32_t)
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    break;
-                case picoquic_tp_enable_loss_bit: {
-                    uint64_t enabled = picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    if (ret == 0) {
-                        if (enabled == 0) {
-                            /* Send only variant of loss bit */
-                            cnx->remote_parameters.enable_loss_bit = 1;
-                        }
-                        else if (enabled == 1) {
-                            /* Both send and receive are enabled */
-                            cnx->remote_parameters.enable_loss_bit = 2;
+                else {
+                    if (extension_type < 64) {
+                        if ((present_flag & (1ull << extension_type)) != 0) {
+                            /* Malformed, already present */
+                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Malformed TP");
                         }
                         else {
-                            /* Only values 0 and 1 are expected */
-                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Loss bit TP");
+                            present_flag |= (1ull << extension_type);
                         }
                     }
-                    break;
-                }
-                case picoquic_tp_min_ack_delay:
-                    cnx->remote_parameters.min_ack_delay =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    /* Values of 0 and values larger that 2^24 are not expected */
-                    if (ret == 0 &&
-                        (cnx->remote_parameters.min_ack_delay == 0 ||
-                            cnx->remote_parameters.min_ack_delay > PICOQUIC_ACK_DELAY_MIN_MAX_VALUE)) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, 0, "Min ack delay TP");
-                    }
-                    else {
-                        if (cnx->local_parameters.min_ack_delay > 0) {
-                            cnx->is_ack_frequency_negotiated = 1;
-                        }
-                    }
-                    break;
-                case picoquic_tp_enable_time_stamp: {
-                    uint64_t tp_time_stamp =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
 
                     if (ret == 0) {
-                        if (tp_time_stamp < 1 || tp_time_stamp > 3) {
-                            ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
+                        /* Record the parameter position for the layout memo */
+                        if (layout_candidate.nb_params >= PICOQUIC_TP_LAYOUT_NB_MAX ||
+                            ll_type + ll_length > PICOQUIC_TP_LAYOUT_HEADER_MAX) {
+                            layout_recordable = 0;
                         }
                         else {
-                            cnx->remote_parameters.enable_time_stamp = (int)tp_time_stamp;
+                            picoquic_tp_layout_param_t* p = &layout_candidate.params[layout_candidate.nb_params];
+
+                            p->extension_type = extension_type;
+                            p->header_offset = header_offset;
+                            p->header_length = ll_type + ll_length;
+                            p->value_offset = byte_index;
+                            p->value_length = extension_length;
+                            memcpy(p->header, bytes + header_offset, p->header_length);
+                            layout_candidate.nb_params++;
                         }
-                    }
-                    break;
-                }
-                case picoquic_tp_grease_quic_bit:
-                    if (extension_length != 0) {
-                        ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Grease TP");
-                    }
-                    else {
-                        cnx->remote_parameters.do_grease_quic_bit = 1;
-                    }
-                    break;
-                case picoquic_tp_initial_max_path_id: {
-                    cnx->remote_parameters.is_multipath_enabled = 1;
-                    cnx->remote_parameters.initial_max_path_id = 
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    break;
-                }
 
-                case picoquic_tp_version_negotiation: {
-                    uint64_t error_found;
-                    uint32_t negotiated_vn;
-                    int negotiated_index;
-                    const uint8_t* final = picoquic_process_tp_version_negotiation(bytes + byte_index,
-                        bytes + byte_index + extension_length, extension_mode,
-                        picoquic_supported_versions[cnx->version_index].version,
-                        &negotiated_vn, &negotiated_index, &error_found);
-                    if (final == NULL) {
-                        ret = picoquic_connection_error_ex(cnx, error_found, 0, "V. Negotiation TP");
-                    }
-                    else {
-                        cnx->do_version_negotiation = 1;
-                        if (negotiated_vn != 0 && cnx->version_index != negotiated_index){
-                            ret = picoquic_process_version_upgrade(cnx, cnx->version_index, negotiated_index);
-                        }
+                        ret = picoquic_process_transport_param(cnx, extension_mode, extension_type,
+                            bytes + byte_index, extension_length, &original_connection_id,
+                            &handshake_connection_id, &retry_connection_id);
                     }
-                    break;
-                }
-                case picoquic_tp_enable_bdp_frame: {
-                    uint64_t enable_bdp =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
-                    if (ret == 0) {
-                        if (enable_bdp > 1) {
-                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "BDP parameter");
-                        }
-                        else {
-                            cnx->remote_parameters.enable_bdp_frame = (int)enable_bdp;
-                        }
-                    }
-                    break;
-                }
-                case picoquic_tp_address_discovery: {
-                    uint64_t address_discovery_mode =
-                        picoquic_transport_param_varint_decode(cnx, bytes + byte_index, extension_length, &ret);
+
                     if (ret == 0) {
-                        if (address_discovery_mode > 2) {
-                            ret = picoquic_connection_error_ex(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0, "Address discovery parameter");
-                        }
-                        else {
-                            /* After doing +1, we get the following:
-                            * address_discovery_mode == 0: nothing goes (TP is absent)
-                            * address_discovery_mode == 1: send only (TP value 0)
-                            * address_discovery_mode == 2: receive only (TP value 1)
-                            * address_discovery_mode == 3: both (TP value 2)
-                            */
-                            cnx->remote_parameters.address_discovery_mode = (int)(address_discovery_mode + 1);
-                            cnx->is_address_discovery_provider = ((cnx->remote_parameters.address_discovery_mode & 2) != 0 &&
-                                (cnx->local_parameters.address_discovery_mode & 1) != 0);
-                            cnx->is_address_discovery_receiver = ((cnx->remote_parameters.address_discovery_mode & 1) != 0 &&
-                                (cnx->local_parameters.address_discovery_mode & 2) != 0);
-                        }
+                        byte_index += (size_t)extension_length;
                     }
-                    break;
-                }
-                default:
-                    /* ignore unknown extensions */
-                    break;
                 }
+            }
+        }
 
-                if (ret == 0) {
-                    byte_index += (size_t)extension_length;
-                }
+        if (ret == 0 && layout_recordable && layout_candidate.nb_params > 0) {
+            if (cnx->quic->tp_layout_cache == NULL) {
+                cnx->quic->tp_layout_cache = (picoquic_tp_layout_cache_t*)malloc(sizeof(picoquic_tp_layout_cache_t));
+            }
+            if (cnx->quic->tp_layout_cache != NULL) {
+                layout_candidate.extension_mode = extension_mode;
+                layout_candidate.blob_length = bytes_max;
+                layout_candidate.present_flag = present_flag;
+                *cnx->quic->tp_layout_cache = layout_candidate;
             }
         }
     }
@@ -943,6 +1132,8 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
     /* Send-receive BDP frame is only enabled if negotiated by both parties */
     cnx->send_receive_bdp_frame = (cnx->local_parameters.enable_bdp_frame > 0) && (cnx->remote_parameters.enable_bdp_frame > 0);
 
+    cnx->is_fec_enabled = (cnx->local_parameters.enable_fec > 0) && (cnx->remote_parameters.enable_fec > 0);
+
     /* One way delay, Quic_bit_grease and Multipath only enabled if asked by client and accepted by server */
     if (cnx->client_mode) {
         cnx->is_time_stamp_enabled = 
@@ -80,6 +80,31 @@ void picoquic_log_app_message(picoquic_cnx_t* cnx, const char* fmt, ...)
     }
 }
 
+/* Tag the connection with a correlation id for cross host trace joins.
+ * The id is logged at once as an info message event, and again whenever
+ * a log is opened later for this connection, so every log file of the
+ * connection carries a "correlation_id=<id>" event that the trace
+ * pipeline can use to join edge and origin traces. */
+int picoquic_set_log_correlation_id(picoquic_cnx_t* cnx, const char* correlation_id)
+{
+    int ret = 0;
+
+    cnx->log_correlation_id = picoquic_string_free(cnx->log_correlation_id);
+
+    if (correlation_id != NULL) {
+        cnx->log_correlation_id = picoquic_string_duplicate(correlation_id);
+
+        if (cnx->log_correlation_id == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_log_app_message(cnx, "correlation_id=%s", cnx->log_correlation_id);
+        }
+    }
+
+    return ret;
+}
+
 void picoquic_log_context_free_app_message(picoquic_quic_t* quic, const picoquic_connection_id_t* cid, const char* fmt, ...)
 {
     if (quic->F_log != NULL) {
@@ -38,6 +38,17 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+
+/* Vector compare of connection IDs. The ID array is 20 bytes, so a 16
+ * byte unaligned load is always in bounds; lanes beyond id_len may hold
+ * stale bytes and are masked out of the comparison. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PICOQUIC_CID_COMPARE_SSE2 1
+#elif defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define PICOQUIC_CID_COMPARE_NEON 1
+#endif
 #include "picoquic_utils.h"
 
 /* clang-format on */
@@ -230,6 +241,76 @@ int debug_printf_reset(int suspended)
     return ret;
 }
 
+/* Structured diagnostic events, see picoquic_utils.h. The rate limiter
+ * is a small direct mapped table indexed by event id; two event ids
+ * hashing to the same entry share a budget, which at worst suppresses a
+ * few extra events. */
+#define PICOQUIC_DIAG_RATE_TABLE_SIZE 32
+
+typedef struct st_picoquic_diag_rate_entry_t {
+    uint64_t event_id;
+    uint64_t next_time;
+    uint64_t nb_suppressed;
+} picoquic_diag_rate_entry_t;
+
+static picoquic_diag_event_fn diag_event_fn = NULL;
+static void* diag_event_ctx = NULL;
+static uint64_t diag_min_interval = 0;
+static picoquic_diag_rate_entry_t diag_rate_table[PICOQUIC_DIAG_RATE_TABLE_SIZE];
+
+void picoquic_set_diag_event_callback(picoquic_diag_event_fn diag_fn, void* v_diag_ctx,
+    uint64_t min_interval_per_event)
+{
+    diag_event_fn = diag_fn;
+    diag_event_ctx = v_diag_ctx;
+    diag_min_interval = min_interval_per_event;
+    memset(diag_rate_table, 0, sizeof(diag_rate_table));
+}
+
+void picoquic_diag_event(picoquic_diag_severity_enum severity, int subsystem_id,
+    uint64_t event_id, const char* fmt, ...)
+{
+    va_list args;
+
+    if (diag_event_fn == NULL) {
+        /* No callback: keep the historical behavior of writing formatted
+         * text to the debug stream, when one is set. */
+        if (debug_suspended == 0 && debug_out != NULL) {
+            fprintf(debug_out, "[%d:%" PRIu64 "]: ", subsystem_id, event_id & 0xFFFFFFFF);
+            va_start(args, fmt);
+            vfprintf(debug_out, fmt, args);
+            va_end(args);
+            fprintf(debug_out, "\n");
+        }
+    }
+    else {
+        uint64_t nb_suppressed = 0;
+
+        if (diag_min_interval > 0) {
+            picoquic_diag_rate_entry_t* entry =
+                &diag_rate_table[event_id % PICOQUIC_DIAG_RATE_TABLE_SIZE];
+            uint64_t current_time = picoquic_current_time();
+
+            if (entry->event_id != event_id) {
+                entry->event_id = event_id;
+                entry->next_time = 0;
+                entry->nb_suppressed = 0;
+            }
+            if (current_time < entry->next_time) {
+                entry->nb_suppressed++;
+                return;
+            }
+            nb_suppressed = entry->nb_suppressed;
+            entry->nb_suppressed = 0;
+            entry->next_time = current_time + diag_min_interval;
+        }
+
+        va_start(args, fmt);
+        diag_event_fn(diag_event_ctx, severity, subsystem_id, event_id, nb_suppressed, fmt, args);
+        va_end(args);
+    }
+}
+
 int picoquic_sprintf(char* buf, size_t buf_len, size_t * nb_chars, const char* fmt, ...)
 {
     va_list args;
@@ -355,7 +436,38 @@ int picoquic_compare_connection_id(const picoquic_connection_id_t * cnx_id1, con
     int ret = -1;
 
     if (cnx_id1->id_len == cnx_id2->id_len) {
+#if defined(PICOQUIC_CID_COMPARE_SSE2)
+        __m128i x1 = _mm_loadu_si128((const __m128i*)cnx_id1->id);
+        __m128i x2 = _mm_loadu_si128((const __m128i*)cnx_id2->id);
+        unsigned int eq_mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x1, x2));
+        unsigned int len_mask = (cnx_id1->id_len >= 16) ? 0xFFFFu : ((1u << cnx_id1->id_len) - 1u);
+
+        if ((eq_mask & len_mask) != len_mask) {
+            ret = memcmp(cnx_id1->id, cnx_id2->id, cnx_id1->id_len);
+        }
+        else {
+            ret = 0;
+            if (cnx_id1->id_len > 16) {
+                ret = memcmp(cnx_id1->id + 16, cnx_id2->id + 16, (size_t)cnx_id1->id_len - 16);
+            }
+        }
+#elif defined(PICOQUIC_CID_COMPARE_NEON)
+        static const uint8_t lane_index[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        uint8x16_t diff = veorq_u8(vld1q_u8(cnx_id1->id), vld1q_u8(cnx_id2->id));
+        uint8x16_t in_range = vcltq_u8(vld1q_u8(lane_index), vdupq_n_u8(cnx_id1->id_len));
+
+        if (vmaxvq_u8(vandq_u8(diff, in_range)) != 0) {
+            ret = memcmp(cnx_id1->id, cnx_id2->id, cnx_id1->id_len);
+        }
+        else {
+            ret = 0;
+            if (cnx_id1->id_len > 16) {
+                ret = memcmp(cnx_id1->id + 16, cnx_id2->id + 16, (size_t)cnx_id1->id_len - 16);
+            }
+        }
+#else
         ret = memcmp(cnx_id1->id, cnx_id2->id, cnx_id1->id_len);
+#endif
     }
     else if (cnx_id1->id_len > cnx_id2->id_len) {
         ret = 1;
@@ -364,23 +476,22 @@ int picoquic_compare_connection_id(const picoquic_connection_id_t * cnx_id1, con
     return ret;
 }
 
-/* Hash connection ids for picohash_table's */
+/* Hash connection ids for picohash_table's. Read the ID as three 64 bit
+ * words through a zero padded copy instead of a byte loop; the values
+ * only feed in-memory tables, so the byte order dependency is harmless. */
 uint64_t picoquic_connection_id_hash(const picoquic_connection_id_t * cid)
 {
-    uint64_t val64 = 0;
-    size_t i = 0;
+    uint64_t w[3] = { 0, 0, 0 };
+    uint64_t val64;
 
-    for (; i < cid->id_len && i < 8; i++) {
-        val64 <<= 8;
-        val64 += cid->id[i];
-    }
+    memcpy(w, cid->id, cid->id_len);
 
-    for (; i < cid->id_len; i++) {
-        uint64_t top = val64 >> 56;
-        val64 <<= 8;
-        val64 += cid->id[i];
-        val64 += top * 0x10001;
-    }
+    val64 = (w[0] + cid->id_len) * 0x9E3779B97F4A7C15ull;
+    val64 ^= val64 >> 29;
+    val64 = (val64 + w[1]) * 0xC2B2AE3D27D4EB4Full;
+    val64 ^= val64 >> 32;
+    val64 = (val64 + w[2]) * 0x165667B19E3779F9ull;
+    val64 ^= val64 >> 29;
 
     return val64;
 }
@@ -47,14 +47,18 @@ static const picoquic_test_def_t test_table[] = {
     { "connection_id_parse", util_connection_id_parse_test },
     { "util_sprintf", util_sprintf_test },
     { "util_debug_print", util_debug_print_test },
+    { "util_diag_event", util_diag_event_test },
     { "util_uint8_to_str", util_uint8_to_str_test },
     { "util_memcmp", util_memcmp_test },
     { "threading", util_threading_test },
     { "picohash", picohash_test },
     { "picohash_embedded", picohash_embedded_test },
+    { "picohash_migration", picohash_migration_test },
+    { "container_stats", container_stats_test },
     { "picolog_basic", picolog_basic_test },
     { "bytestream", bytestream_test },
     { "sockloop_basic", sockloop_basic_test },
+    { "sockloop_batch", sockloop_batch_test },
     { "sockloop_eio", sockloop_eio_test },
     { "sockloop_errsock", sockloop_errsock_test },
     { "sockloop_ipv4", sockloop_ipv4_test },
@@ -63,7 +67,12 @@ static const picoquic_test_def_t test_table[] = {
     { "sockloop_thread", sockloop_thread_test },
     { "sockloop_thread_name", sockloop_thread_name_test },
     { "splay", splay_test },
+    { "stream_index_bench", stream_index_bench_test },
+    { "btree", btree_test },
     { "create_cnx", create_cnx_test },
+    { "create_cnx_early_data", create_cnx_early_data_test },
+    { "validated_address_cache", validated_address_cache_test },
+    { "version_pref_cache", version_pref_cache_test },
     { "create_quic", create_quic_test },
     { "parseheader", parseheadertest },
     { "incoming_initial", incoming_initial_test },
@@ -103,6 +112,8 @@ static const picoquic_test_def_t test_table[] = {
     { "cleartext_pn_enc", cleartext_pn_enc_test },
     { "cid_for_lb", cid_for_lb_test },
     { "cid_for_lb_cli", cid_for_lb_cli_test },
+    { "cid_for_lb_batch", cid_for_lb_batch_test },
+    { "hot_restart_state", hot_restart_state_test },
     { "retry_protection_vector", retry_protection_vector_test },
     { "retry_protection_v2", retry_protection_v2_test },
     { "draft17_vector", draft17_vector_test },
@@ -115,6 +126,19 @@ static const picoquic_test_def_t test_table[] = {
     { "new_cnxid", new_cnxid_test },
     { "pacing", pacing_test },
     { "pacing_repeat", pacing_repeat_test },
+    { "pacing_policy", pacing_policy_test },
+    { "pacing_admission", pacing_admission_test },
+    { "rtt_filter", rtt_filter_test },
+    { "rtt_observer", rtt_observer_test },
+    { "stream_time_histogram", stream_time_histogram_test },
+    { "cc_experiment", cc_experiment_test },
+    { "perf_export", perf_export_test },
+    { "log_sampling", log_sampling_test },
+    { "binlog_mmap", binlog_mmap_test },
+    { "binlog_v2", binlog_v2_test },
+    { "correlation_id", correlation_id_test },
+    { "flight_recorder", flight_recorder_test },
+    { "close_log", close_log_test },
 #if 0
     /* The TLS API connect test is only useful when debugging issues step by step */
     { "tls_api_connect", tls_api_connect_test },
@@ -157,6 +181,7 @@ static const picoquic_test_def_t test_table[] = {
     { "stream_rank", stream_rank_test },
     { "provide_stream_buffer", provide_stream_buffer_test },
     { "transport_param", transport_param_test },
+    { "transport_param_layout_cache", transport_param_layout_cache_test },
     { "tls_api_sni", tls_api_sni_test },
     { "tls_api_alpn", tls_api_alpn_test },
     { "tls_api_wrong_alpn", tls_api_wrong_alpn_test },
@@ -178,6 +203,7 @@ static const picoquic_test_def_t test_table[] = {
     { "retry_large", tls_api_retry_large_test},
     { "retry_token", tls_retry_token_test },
     { "retry_token_valid", tls_retry_token_valid_test },
+    { "retry_token_offload", tls_retry_token_offload_test },
     { "two_connections", tls_api_two_connections_test },
     { "multiple_versions", tls_api_multiple_versions_test },
     { "keep_alive", keep_alive_test },
@@ -189,9 +215,13 @@ static const picoquic_test_def_t test_table[] = {
     { "sockets", socket_test },
     { "socket_ecn", socket_ecn_test },
     { "ticket_store", ticket_store_test },
+    { "ticket_store_indexed", ticket_store_indexed_test },
+    { "store_journal", store_journal_test },
     { "ticket_seed", ticket_seed_test },
     { "ticket_seed_from_bdp_frame", ticket_seed_from_bdp_frame_test },
+    { "cc_seed_hints", cc_seed_hints_test },
     { "token_store", token_store_test },
+    { "token_store_wheel", token_store_wheel_test },
     { "token_reuse_api", token_reuse_api_test },
     { "session_resume", session_resume_test },
     { "zero_rtt", zero_rtt_test },
@@ -205,6 +235,7 @@ static const picoquic_test_def_t test_table[] = {
     { "mtu_delayed", mtu_delayed_test },
     { "mtu_required", mtu_required_test },
     { "mtu_max", mtu_max_test },
+    { "mtu_sprint", mtu_sprint_test },
     { "mtu_drop_bbr", mtu_drop_bbr_test },
     { "mtu_drop_cubic", mtu_drop_cubic_test },
     { "mtu_drop_dcubic", mtu_drop_dcubic_test },
@@ -228,6 +259,9 @@ static const picoquic_test_def_t test_table[] = {
     { "tls_zero_share", tls_zero_share_test },
     { "transport_param_log", transport_param_log_test },
     { "bad_certificate", bad_certificate_test },
+    { "lazy_credentials", tls_lazy_credentials_test },
+    { "lazy_verifier", tls_lazy_verifier_test },
+    { "key_share_pool", key_share_pool_test },
     { "set_verify_certificate_callback_test", set_verify_certificate_callback_test },
     { "virtual_time" , virtual_time_test },
     { "different_params", tls_different_params_test },
@@ -346,6 +380,8 @@ static const picoquic_test_def_t test_table[] = {
     { "l4s_reno", l4s_reno_test },
     { "l4s_prague", l4s_prague_test },
     { "l4s_prague_updown", l4s_prague_updown_test },
+    { "l4s_prague_subms", l4s_prague_subms_test },
+    { "fec_recovery", fec_recovery_test },
     { "l4s_bbr", l4s_bbr_test },
     { "l4s_bbr_updown", l4s_bbr_updown_test },
     { "long_rtt", long_rtt_test },
@@ -468,6 +504,7 @@ static const picoquic_test_def_t test_table[] = {
     { "multipath_basic", multipath_basic_test },
     { "multipath_drop_first", multipath_drop_first_test },
     { "multipath_drop_second", multipath_drop_second_test },
+    { "multipath_fast_abandon", multipath_fast_abandon_test },
     { "multipath_fail", multipath_fail_test },
     { "multipath_ab1", multipath_ab1_test },
     { "multipath_sat_plus", multipath_sat_plus_test },
@@ -488,6 +525,8 @@ static const picoquic_test_def_t test_table[] = {
     { "multipath_standby", multipath_standby_test },
     { "multipath_standup", multipath_standup_test },
     { "multipath_discovery", multipath_discovery_test },
+    { "multipath_min_rtt", multipath_min_rtt_test },
+    { "multipath_redundant", multipath_redundant_test },
     { "multipath_qlog", multipath_qlog_test },
     { "multipath_tunnel", multipath_tunnel_test },
     { "monopath_0rtt", monopath_0rtt_test },
@@ -80,6 +80,7 @@ static const char* token_store_filename = "demo_token_store.bin";
 #include "performance_log.h"
 #include "picoquic_config.h"
 #include "picoquic_lb.h"
+#include "tls_api.h"
 #ifdef PICOQUIC_MEMORY_LOG
 #include "auto_memlog.h"
 #endif
@@ -280,6 +281,114 @@ picohttp_server_path_item_t path_item_list[2] =
     }
 };
 
+/* Shared-nothing server mode: one QUIC context and one loop thread per
+ * core, all bound to the same port through SO_REUSEPORT, as set up by
+ * picoquic_start_network_thread_pool. Every context is created with the
+ * same ticket encryption key, and the pool shares the token reuse
+ * registry between the shards, so session resumption and 0-RTT keep
+ * working when the kernel hashes a returning client to a different
+ * core. */
+static int quic_server_pool(picoquic_quic_config_t* config, int nb_threads)
+{
+    int ret = 0;
+    uint64_t current_time = picoquic_current_time();
+    uint8_t ticket_encryption_key[32];
+    int has_local_key = 0;
+    picoquic_quic_t** qshards = NULL;
+    server_loop_cb_t* loop_cb_ctx = NULL;
+    void** loop_cb_ctx_v = NULL;
+    picoquic_network_thread_pool_t* pool = NULL;
+    picoquic_packet_loop_param_t param = { 0 };
+    picohttp_server_parameters_t picoquic_file_param;
+
+    memset(&picoquic_file_param, 0, sizeof(picohttp_server_parameters_t));
+    picoquic_file_param.web_folder = config->www_dir;
+    picoquic_file_param.path_table = path_item_list;
+    picoquic_file_param.path_table_nb = 2;
+
+    param.local_port = (uint16_t)config->server_port;
+    param.local_af = AF_UNSPEC;
+    param.socket_buffer_size = config->socket_buffer_size;
+    param.do_not_use_gso = config->do_not_use_gso;
+
+    /* All the shards must decrypt each other's session tickets and
+     * address validation tokens */
+    if (config->ticket_encryption_key == NULL) {
+        picoquic_public_random(ticket_encryption_key, sizeof(ticket_encryption_key));
+        config->ticket_encryption_key = ticket_encryption_key;
+        config->ticket_encryption_key_length = sizeof(ticket_encryption_key);
+        has_local_key = 1;
+    }
+
+    if ((qshards = (picoquic_quic_t**)calloc(nb_threads, sizeof(picoquic_quic_t*))) == NULL ||
+        (loop_cb_ctx = (server_loop_cb_t*)calloc(nb_threads, sizeof(server_loop_cb_t))) == NULL ||
+        (loop_cb_ctx_v = (void**)calloc(nb_threads, sizeof(void*))) == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < nb_threads; i++) {
+        loop_cb_ctx_v[i] = &loop_cb_ctx[i];
+        qshards[i] = picoquic_create_and_configure(config, picoquic_demo_server_callback,
+            &picoquic_file_param, current_time, NULL);
+        if (qshards[i] == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_set_key_log_file_from_env(qshards[i]);
+            picoquic_set_alpn_select_fn(qshards[i], picoquic_demo_server_callback_select_alpn);
+            picoquic_use_unique_log_names(qshards[i], 1);
+            if (config->qlog_dir != NULL) {
+                picoquic_set_qlog(qshards[i], config->qlog_dir);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        pool = picoquic_start_network_thread_pool(qshards, nb_threads, &param,
+            server_loop_cb, loop_cb_ctx_v, &ret);
+    }
+
+    if (pool != NULL) {
+        /* The loops run on the pool threads; wait until they all exit */
+        int all_closed = 0;
+
+        fprintf(stdout, "Server running on %d threads.\n", nb_threads);
+        while (!all_closed) {
+#ifdef _WINDOWS
+            Sleep(1000);
+#else
+            struct timeval tv = { 1, 0 };
+            (void)select(0, NULL, NULL, NULL, &tv);
+#endif
+            all_closed = 1;
+            for (int i = 0; i < nb_threads; i++) {
+                if (!pool->threads[i]->thread_is_closed) {
+                    all_closed = 0;
+                    break;
+                }
+            }
+        }
+        picoquic_delete_network_thread_pool(pool);
+    }
+
+    if (qshards != NULL) {
+        for (int i = 0; i < nb_threads; i++) {
+            if (qshards[i] != NULL) {
+                picoquic_free(qshards[i]);
+            }
+        }
+        free(qshards);
+    }
+    free(loop_cb_ctx);
+    free(loop_cb_ctx_v);
+    if (has_local_key) {
+        config->ticket_encryption_key = NULL;
+        config->ticket_encryption_key_length = 0;
+    }
+
+    return ret;
+}
+
 int quic_server(const char* server_name, picoquic_quic_config_t * config, int just_once)
 {
     /* Start: start the QUIC process with cert and key files */
@@ -297,6 +406,14 @@ int quic_server(const char* server_name, picoquic_quic_config_t * config, int ju
     memset(&loop_cb_ctx, 0, sizeof(server_loop_cb_t));
     loop_cb_ctx.just_once = just_once;
 
+    if (config->nb_server_threads > 1) {
+        /* Shared-nothing mode: one context and loop thread per core */
+        if (just_once) {
+            fprintf(stdout, "Option \"just once\" is ignored in multi-thread mode.\n");
+        }
+        return quic_server_pool(config, config->nb_server_threads);
+    }
+
     /* Setup the server context */
     if (ret == 0) {
         current_time = picoquic_current_time();
@@ -144,7 +144,7 @@ static int cmp_test_sack_list(picoquic_sack_list_t* sack_list,
 
         nb_compared++;
 
-        next = picoquic_sack_previous_item(next);
+        next = picoquic_sack_previous_item(sack_list, next);
 
         if (next == NULL) {
             break;
@@ -0,0 +1,328 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Test of the picobtree B-tree of small arrays, the cache friendly
+ * alternative to picosplay. The first part checks the ordered map
+ * operations against a reference bitmap through random insertions and
+ * deletions, and checks that bulk loading a sorted array produces a
+ * tree that supports the same operations. The second part replays the
+ * insert + predecessor probe + ordered drain pattern on both picosplay
+ * and picobtree and logs the measured times.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_utils.h"
+#include "picobtree.h"
+#include "picosplay.h"
+
+#define BTREE_TEST_RANGE 4096
+
+static int64_t btree_test_compare(void* l, void* r)
+{
+    return (int64_t)((intptr_t)l - (intptr_t)r);
+}
+
+static void* btree_test_value(uint64_t v)
+{
+    return (void*)(intptr_t)v;
+}
+
+/* Verify that the tree content matches the reference bitmap, including
+ * ordered iteration and predecessor queries. */
+static int btree_test_verify(picobtree_t* tree, const uint8_t* model)
+{
+    int ret = 0;
+    int nb_expected = 0;
+    uint64_t previous = 0;
+
+    for (uint64_t v = 1; ret == 0 && v < BTREE_TEST_RANGE; v++) {
+        void* found = picobtree_find(tree, btree_test_value(v));
+
+        if (model[v]) {
+            nb_expected++;
+            if (found != btree_test_value(v)) {
+                DBG_PRINTF("Value %" PRIu64 " not found", v);
+                ret = -1;
+            }
+            else if (picobtree_next(tree, btree_test_value(previous)) != btree_test_value(v)) {
+                DBG_PRINTF("Successor of %" PRIu64 " is not %" PRIu64, previous, v);
+                ret = -1;
+            }
+            else {
+                previous = v;
+            }
+        }
+        else if (found != NULL) {
+            DBG_PRINTF("Value %" PRIu64 " found after delete", v);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && tree->size != nb_expected) {
+        DBG_PRINTF("Tree size %d, expected %d", tree->size, nb_expected);
+        ret = -1;
+    }
+
+    if (ret == 0 && previous != 0 &&
+        (picobtree_last(tree) != btree_test_value(previous) ||
+            picobtree_next(tree, btree_test_value(previous)) != NULL)) {
+        DBG_PRINTF("Last element is not %" PRIu64, previous);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int btree_correctness_test()
+{
+    int ret = 0;
+    picobtree_t tree;
+    uint8_t model[BTREE_TEST_RANGE];
+    uint64_t seed = 0xB7EE0FB7EE0Full;
+
+    picobtree_init(&tree, btree_test_compare, NULL);
+    memset(model, 0, sizeof(model));
+
+    for (int op = 0; ret == 0 && op < 20000; op++) {
+        uint64_t v;
+
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        v = 1 + (seed % (BTREE_TEST_RANGE - 1));
+
+        if ((seed & 3) != 0) {
+            if (!model[v]) {
+                ret = picobtree_insert(&tree, btree_test_value(v));
+                model[v] = 1;
+            }
+        }
+        else {
+            picobtree_delete(&tree, btree_test_value(v));
+            model[v] = 0;
+        }
+
+        if (op % 1000 == 999) {
+            ret = btree_test_verify(&tree, model);
+        }
+    }
+
+    if (ret == 0) {
+        ret = btree_test_verify(&tree, model);
+    }
+    picobtree_empty(&tree);
+
+    /* Bulk load a sorted array and verify the same operations work */
+    if (ret == 0) {
+        void** values = (void**)malloc((BTREE_TEST_RANGE - 1) * sizeof(void*));
+
+        if (values == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(model, 1, sizeof(model));
+            model[0] = 0;
+            for (uint64_t v = 1; v < BTREE_TEST_RANGE; v++) {
+                values[v - 1] = btree_test_value(v);
+            }
+            ret = picobtree_bulk_load(&tree, values, BTREE_TEST_RANGE - 1);
+            if (ret == 0) {
+                ret = btree_test_verify(&tree, model);
+            }
+            /* Deleting from a bulk loaded tree must rebalance correctly */
+            for (uint64_t v = 1; ret == 0 && v < BTREE_TEST_RANGE; v += 3) {
+                picobtree_delete(&tree, btree_test_value(v));
+                model[v] = 0;
+            }
+            if (ret == 0) {
+                ret = btree_test_verify(&tree, model);
+            }
+            picobtree_empty(&tree);
+            free(values);
+        }
+    }
+
+    return ret;
+}
+
+/* Benchmark section: same access pattern as the stream index bench,
+ * on value keys. */
+
+typedef struct st_btree_bench_node_t {
+    uint64_t key;
+    picosplay_node_t splay_node;
+} btree_bench_node_t;
+
+static int64_t btree_bench_splay_compare(void* l, void* r)
+{
+    uint64_t l_k = ((btree_bench_node_t*)l)->key;
+    uint64_t r_k = ((btree_bench_node_t*)r)->key;
+
+    return (l_k < r_k) ? -1 : (l_k > r_k) ? 1 : 0;
+}
+
+static picosplay_node_t* btree_bench_splay_create(void* value)
+{
+    return &((btree_bench_node_t*)value)->splay_node;
+}
+
+static void* btree_bench_splay_value(picosplay_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_btree_bench_node_t, splay_node));
+}
+
+static void btree_bench_splay_delete(void* tree, picosplay_node_t* node)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(tree);
+    UNREFERENCED_PARAMETER(node);
+#else
+    (void)tree;
+    (void)node;
+#endif
+}
+
+static int btree_bench_one(size_t nb)
+{
+    int ret = 0;
+    btree_bench_node_t* nodes = (btree_bench_node_t*)malloc(nb * sizeof(btree_bench_node_t));
+    picosplay_tree_t splay;
+    picobtree_t btree;
+    uint64_t seed = 0xDEADBEEFBABAC001ull;
+    uint64_t t_start;
+    uint64_t splay_insert_us;
+    uint64_t splay_drain_us = 0;
+    uint64_t btree_insert_us;
+    uint64_t btree_drain_us = 0;
+
+    if (nodes == NULL) {
+        return -1;
+    }
+    memset(nodes, 0, nb * sizeof(btree_bench_node_t));
+    for (size_t i = 0; i < nb; i++) {
+        nodes[i].key = (uint64_t)(i + 1);
+    }
+    for (size_t i = nb - 1; i > 0; i--) {
+        size_t j;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        j = (size_t)(seed % (i + 1));
+        if (j != i) {
+            uint64_t k = nodes[i].key;
+            nodes[i].key = nodes[j].key;
+            nodes[j].key = k;
+        }
+    }
+
+    picosplay_init_tree(&splay, btree_bench_splay_compare,
+        btree_bench_splay_create, btree_bench_splay_delete, btree_bench_splay_value);
+    picobtree_init(&btree, btree_test_compare, NULL);
+
+    t_start = picoquic_current_time();
+    for (size_t i = 0; i < nb; i++) {
+        btree_bench_node_t target;
+        target.key = nodes[i].key;
+        (void)picosplay_find_previous(&splay, &target);
+        picosplay_insert(&splay, &nodes[i]);
+    }
+    splay_insert_us = picoquic_current_time() - t_start;
+
+    t_start = picoquic_current_time();
+    for (size_t i = 0; ret == 0 && i < nb; i++) {
+        (void)picobtree_find_previous(&btree, btree_test_value(nodes[i].key));
+        ret = picobtree_insert(&btree, btree_test_value(nodes[i].key));
+    }
+    btree_insert_us = picoquic_current_time() - t_start;
+
+    if (ret == 0 && (splay.size != (int)nb || btree.size != (int)nb)) {
+        DBG_PRINTF("Sizes after insert: splay %d, btree %d, expected %zu", splay.size, btree.size, nb);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        uint64_t expected = 1;
+
+        t_start = picoquic_current_time();
+        for (size_t i = 0; ret == 0 && i < nb; i++) {
+            picosplay_node_t* first = picosplay_first(&splay);
+            if (first == NULL ||
+                ((btree_bench_node_t*)btree_bench_splay_value(first))->key != expected) {
+                DBG_PRINTF("Splay drain out of order at rank %zu", i);
+                ret = -1;
+            }
+            else {
+                picosplay_delete_hint(&splay, first);
+                expected++;
+            }
+        }
+        splay_drain_us = picoquic_current_time() - t_start;
+    }
+
+    if (ret == 0) {
+        uint64_t expected = 1;
+
+        t_start = picoquic_current_time();
+        for (size_t i = 0; ret == 0 && i < nb; i++) {
+            void* first = picobtree_first(&btree);
+            if (first != btree_test_value(expected)) {
+                DBG_PRINTF("Btree drain out of order at rank %zu", i);
+                ret = -1;
+            }
+            else {
+                picobtree_delete(&btree, first);
+                expected++;
+            }
+        }
+        btree_drain_us = picoquic_current_time() - t_start;
+    }
+
+    if (ret == 0 && (splay.size != 0 || btree.size != 0)) {
+        DBG_PRINTF("Sizes after drain: splay %d, btree %d", splay.size, btree.size);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("%zu keys: splay insert %" PRIu64 "us drain %" PRIu64 "us, btree insert %" PRIu64 "us drain %" PRIu64 "us",
+            nb, splay_insert_us, splay_drain_us, btree_insert_us, btree_drain_us);
+    }
+
+    picobtree_empty(&btree);
+    free(nodes);
+
+    return ret;
+}
+
+int btree_test()
+{
+    int ret = btree_correctness_test();
+    const size_t nb_keys[] = { 1000, 10000, 100000 };
+
+    for (size_t i = 0; ret == 0 && i < sizeof(nb_keys) / sizeof(size_t); i++) {
+        ret = btree_bench_one(nb_keys[i]);
+    }
+
+    return ret;
+}
@@ -20,6 +20,12 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_set_binlog.h"
+#include "picoquic_binlog.h"
+#include "perf_export.h"
+#include "close_log.h"
+#include "logreader.h"
+#include <stdio.h>
 #include <stdlib.h>
 #ifdef _WINDOWS
 #include <malloc.h>
@@ -331,4 +337,1085 @@ int create_quic_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/* Test of the congestion control A/B experiment assignment: connections
+ * whose initial CID hashes into the configured share use the alternate
+ * algorithm, deterministically, and the assignment can be disabled.
+ */
+int cc_experiment_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    struct sockaddr_in saddr;
+    /* Low byte of the ICID decides the assignment; share = 128 out of 256 */
+    const uint8_t test_low_byte[4] = { 0x00, 0x7f, 0x80, 0xff };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_set_default_congestion_algorithm(quic, picoquic_newreno_algorithm);
+        picoquic_set_cc_experiment(quic, picoquic_cubic_algorithm, "hystart++", 128);
+    }
+
+    for (int trial = 0; ret == 0 && trial < 2; trial++) {
+        /* Run the assignment twice with the same ICID set, verifying that
+         * it is deterministic */
+        for (size_t i = 0; ret == 0 && i < 4; i++) {
+            picoquic_connection_id_t icid = { { 0, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+            picoquic_cnx_t* cnx;
+            int expect_arm = (test_low_byte[i] < 128);
+
+            icid.id[7] = test_low_byte[i];
+            cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+                (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+
+            if (cnx == NULL) {
+                DBG_PRINTF("Cannot create connection %zu\n", i);
+                ret = -1;
+            }
+            else {
+                if ((cnx->is_cc_experiment_arm != 0) != expect_arm) {
+                    DBG_PRINTF("ICID low byte 0x%02x: arm = %d, expected %d",
+                        test_low_byte[i], cnx->is_cc_experiment_arm, expect_arm);
+                    ret = -1;
+                }
+                else if (expect_arm &&
+                    (cnx->congestion_alg != picoquic_cubic_algorithm || !cnx->is_hystart_pp_enabled)) {
+                    DBG_PRINTF("ICID low byte 0x%02x: experiment algorithm not applied", test_low_byte[i]);
+                    ret = -1;
+                }
+                else if (!expect_arm && cnx->congestion_alg != picoquic_newreno_algorithm) {
+                    DBG_PRINTF("ICID low byte 0x%02x: default algorithm not applied", test_low_byte[i]);
+                    ret = -1;
+                }
+                picoquic_delete_cnx(cnx);
+            }
+        }
+    }
+
+    /* Disabling the experiment reverts all connections to the default */
+    if (ret == 0) {
+        picoquic_connection_id_t icid = { { 0, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+        picoquic_cnx_t* cnx;
+
+        picoquic_set_cc_experiment(quic, NULL, NULL, 128);
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL) {
+            ret = -1;
+        }
+        else {
+            if (cnx->is_cc_experiment_arm || cnx->congestion_alg != picoquic_newreno_algorithm) {
+                DBG_PRINTF("%s", "Disabled experiment still assigns connections\n");
+                ret = -1;
+            }
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the extended client connection creation API: stream data attached
+ * through picoquic_create_client_cnx_ex is queued on the streams before the
+ * connection is started, so it is available for the first flight instead of
+ * waiting for a later call to picoquic_add_to_stream.
+ */
+int create_cnx_early_data_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_storage addr;
+    const uint8_t early_data_0[] = { 'e', 'a', 'r', 'l', 'y', '-', '0' };
+    const uint8_t early_data_4[] = { 'e', 'a', 'r', 'l', 'y', '-', '4' };
+    picoquic_early_stream_desc_t early_streams[2] = {
+        { 0, early_data_0, sizeof(early_data_0), 1 },
+        { 4, early_data_4, sizeof(early_data_4), 0 }
+    };
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = picoquic_store_text_addr(&addr, "10.0.0.1", 1234);
+        if (ret == 0) {
+            cnx = picoquic_create_client_cnx_ex(quic, (struct sockaddr*) & addr, simulated_time, 0,
+                "test-sni", "test-alpn", NULL, NULL, early_streams, 2);
+            if (cnx == NULL) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Verify that the early data is queued on the streams, with the
+     * requested FIN marks */
+    for (size_t i = 0; ret == 0 && i < 2; i++) {
+        picoquic_stream_head_t* stream = picoquic_find_stream(cnx, early_streams[i].stream_id);
+
+        if (stream == NULL || stream->send_queue == NULL) {
+            DBG_PRINTF("No data queued on stream %" PRIu64, early_streams[i].stream_id);
+            ret = -1;
+        }
+        else if ((stream->fin_requested != 0) != (early_streams[i].set_fin != 0)) {
+            DBG_PRINTF("Wrong FIN mark on stream %" PRIu64, early_streams[i].stream_id);
+            ret = -1;
+        }
+    }
+
+    /* Verify that the connection was actually started: starting it again
+     * must fail, and the Client Hello must be queued on the TLS stream */
+    if (ret == 0) {
+        if (picoquic_start_client_cnx(cnx) == 0) {
+            DBG_PRINTF("%s", "Connection was not started at creation");
+            ret = -1;
+        }
+        else if (cnx->tls_stream[0].send_queue == NULL &&
+            cnx->tls_stream[0].sent_offset == 0) {
+            DBG_PRINTF("%s", "No Client Hello queued on the TLS stream");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the validated peer address cache: remembered addresses are found
+ * while fresh, unknown addresses are not, entries expire after the
+ * validation lifetime, and when the cache is full the oldest entry is the
+ * one recycled.
+ */
+int validated_address_cache_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in addr[PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE + 2];
+
+    for (int i = 0; i < PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE + 2; i++) {
+        memset(&addr[i], 0, sizeof(struct sockaddr_in));
+        addr[i].sin_family = AF_INET;
+        addr[i].sin_port = (uint16_t)(1000 + i);
+    }
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*) & addr[0], 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A remembered address is found while fresh; an unknown one is not */
+        picoquic_remember_validated_address(cnx, (struct sockaddr*) & addr[0], 1000000);
+        if (!picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[0], 2000000) ||
+            picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[1], 2000000)) {
+            DBG_PRINTF("%s", "Cache lookup does not match cache content");
+            ret = -1;
+        }
+        else if (picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[0],
+            1000000 + PICOQUIC_VALIDATED_ADDRESS_LIFETIME + 1)) {
+            DBG_PRINTF("%s", "Cache entry does not expire");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Fill the cache past its size; the oldest entry is recycled */
+        for (int i = 1; i < PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE + 1; i++) {
+            picoquic_remember_validated_address(cnx, (struct sockaddr*) & addr[i], 1000000 + (uint64_t)i * 1000);
+        }
+        if (picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[0], 2000000)) {
+            DBG_PRINTF("%s", "Oldest entry was not recycled");
+            ret = -1;
+        }
+        else {
+            /* Refreshing an entry protects it from the next recycling */
+            picoquic_remember_validated_address(cnx, (struct sockaddr*) & addr[1], 10000000);
+            picoquic_remember_validated_address(cnx, (struct sockaddr*) & addr[PICOQUIC_VALIDATED_ADDRESS_CACHE_SIZE + 1], 11000000);
+            if (!picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[1], 12000000) ||
+                picoquic_is_address_recently_validated(cnx, (struct sockaddr*) & addr[2], 12000000)) {
+                DBG_PRINTF("%s", "Refresh does not protect an entry");
+                ret = -1;
+            }
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the version preference cache: a recorded version is returned for
+ * any address of the same network regardless of port, other networks come
+ * back empty, and recording again overwrites the previous value.
+ */
+int version_pref_cache_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    struct sockaddr_in a1;
+    struct sockaddr_in a2;
+    struct sockaddr_in a3;
+
+    picoquic_store_text_addr((struct sockaddr_storage*)&a1, "10.0.0.1", 1234);
+    picoquic_store_text_addr((struct sockaddr_storage*)&a2, "10.0.0.77", 4321);
+    picoquic_store_text_addr((struct sockaddr_storage*)&a3, "10.0.1.1", 1234);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_get_version_preference(quic, (struct sockaddr*)&a1) != 0) {
+        DBG_PRINTF("%s", "Empty cache returns a version");
+        ret = -1;
+    }
+    else {
+        picoquic_record_version_preference(quic, (struct sockaddr*)&a1, PICOQUIC_INTERNAL_TEST_VERSION_1);
+        if (picoquic_get_version_preference(quic, (struct sockaddr*)&a1) != PICOQUIC_INTERNAL_TEST_VERSION_1) {
+            DBG_PRINTF("%s", "Recorded version not returned");
+            ret = -1;
+        }
+        else if (picoquic_get_version_preference(quic, (struct sockaddr*)&a2) != PICOQUIC_INTERNAL_TEST_VERSION_1) {
+            DBG_PRINTF("%s", "Same /24 network does not share the preference");
+            ret = -1;
+        }
+        else if (picoquic_get_version_preference(quic, (struct sockaddr*)&a3) != 0) {
+            DBG_PRINTF("%s", "Preference leaks to another network");
+            ret = -1;
+        }
+        else {
+            picoquic_record_version_preference(quic, (struct sockaddr*)&a2, PICOQUIC_V1_VERSION);
+            if (picoquic_get_version_preference(quic, (struct sockaddr*)&a1) != PICOQUIC_V1_VERSION) {
+                DBG_PRINTF("%s", "Recording again does not overwrite");
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the shared memory performance export: connections get a slot
+ * when they publish statistics, the segment can be read back from the
+ * backing file like an external scraper would, and slots are released
+ * when connections are deleted.
+ */
+#define PERF_EXPORT_TEST_FILE "perf_export_test.bin"
+#define PERF_EXPORT_TEST_NB_SLOTS 2
+
+static int perf_export_read_back(picoquic_perf_export_header_t* header,
+    picoquic_perf_export_slot_t* slots, size_t nb_slots)
+{
+    int ret = 0;
+    FILE* F = picoquic_file_open(PERF_EXPORT_TEST_FILE, "rb");
+
+    if (F == NULL) {
+        DBG_PRINTF("Cannot open %s", PERF_EXPORT_TEST_FILE);
+        ret = -1;
+    }
+    else {
+        if (fread(header, sizeof(picoquic_perf_export_header_t), 1, F) != 1 ||
+            fread(slots, sizeof(picoquic_perf_export_slot_t), nb_slots, F) != nb_slots) {
+            DBG_PRINTF("Cannot read %s", PERF_EXPORT_TEST_FILE);
+            ret = -1;
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+int perf_export_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* test_cnx[PERF_EXPORT_TEST_NB_SLOTS + 1] = { NULL, NULL, NULL };
+    picoquic_perf_export_header_t header;
+    picoquic_perf_export_slot_t slots[PERF_EXPORT_TEST_NB_SLOTS];
+    struct sockaddr_in saddr;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_perf_export_setup(quic, PERF_EXPORT_TEST_FILE, PERF_EXPORT_TEST_NB_SLOTS) != 0) {
+        DBG_PRINTF("Cannot set up export to %s", PERF_EXPORT_TEST_FILE);
+        ret = -1;
+    }
+
+    /* Create one more connection than there are slots, and publish
+     * statistics for all of them */
+    for (int i = 0; ret == 0 && i < PERF_EXPORT_TEST_NB_SLOTS + 1; i++) {
+        picoquic_connection_id_t icid = { { 0x9e, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+
+        icid.id[7] = (uint8_t)(i + 1);
+        test_cnx[i] = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (test_cnx[i] == NULL) {
+            DBG_PRINTF("Cannot create connection %d", i);
+            ret = -1;
+        }
+        else {
+            picoquic_publish_cnx_stats(test_cnx[i], picoquic_get_quic_time(quic));
+        }
+    }
+
+    /* Read the segment back through the backing file and verify the
+     * layout and the slot contents */
+    if (ret == 0) {
+        ret = perf_export_read_back(&header, slots, PERF_EXPORT_TEST_NB_SLOTS);
+    }
+
+    if (ret == 0) {
+        if (header.magic != PICOQUIC_PERF_EXPORT_MAGIC ||
+            header.version != PICOQUIC_PERF_EXPORT_VERSION ||
+            header.header_size != sizeof(picoquic_perf_export_header_t) ||
+            header.slot_size != sizeof(picoquic_perf_export_slot_t) ||
+            header.nb_slots != PERF_EXPORT_TEST_NB_SLOTS) {
+            DBG_PRINTF("%s", "Bad export header");
+            ret = -1;
+        }
+        else if ((header.seq & 1) != 0 ||
+            header.current_number_connections != PERF_EXPORT_TEST_NB_SLOTS + 1 ||
+            header.nb_slots_in_use != PERF_EXPORT_TEST_NB_SLOTS) {
+            DBG_PRINTF("Bad export counters, seq: %" PRIu64 ", cnx: %" PRIu64 ", in use: %" PRIu64,
+                header.seq, header.current_number_connections, header.nb_slots_in_use);
+            ret = -1;
+        }
+        else if (test_cnx[PERF_EXPORT_TEST_NB_SLOTS]->perf_export_slot != NULL) {
+            DBG_PRINTF("%s", "Overflow connection got a slot");
+            ret = -1;
+        }
+        else {
+            for (int i = 0; ret == 0 && i < PERF_EXPORT_TEST_NB_SLOTS; i++) {
+                if ((slots[i].seq & 1) != 0 || slots[i].in_use == 0 ||
+                    slots[i].icid_len != 8 ||
+                    memcmp(slots[i].icid, test_cnx[i]->initial_cnxid.id, 8) != 0) {
+                    DBG_PRINTF("Bad export slot %d", i);
+                    ret = -1;
+                }
+                else if (slots[i].stats.snapshot_time !=
+                    test_cnx[i]->stats_snapshot.snapshot_time) {
+                    DBG_PRINTF("Stats not exported in slot %d", i);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    /* Delete the first connection: its slot should be released, and
+     * then picked up when the overflow connection publishes again */
+    if (ret == 0) {
+        picoquic_delete_cnx(test_cnx[0]);
+        test_cnx[0] = NULL;
+        picoquic_publish_cnx_stats(test_cnx[PERF_EXPORT_TEST_NB_SLOTS],
+            picoquic_get_quic_time(quic));
+        ret = perf_export_read_back(&header, slots, PERF_EXPORT_TEST_NB_SLOTS);
+    }
+
+    if (ret == 0) {
+        if (slots[0].in_use == 0 ||
+            memcmp(slots[0].icid, test_cnx[PERF_EXPORT_TEST_NB_SLOTS]->initial_cnxid.id, 8) != 0) {
+            DBG_PRINTF("%s", "Released slot not reassigned");
+            ret = -1;
+        }
+        else if (header.nb_slots_in_use != PERF_EXPORT_TEST_NB_SLOTS) {
+            DBG_PRINTF("Bad slot count after reassignment: %" PRIu64, header.nb_slots_in_use);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of log sampling: with 1-in-N tracing configured, only the
+ * connections whose initial CID hashes to the sampled share open a
+ * binary log, and tracing can still be forced on a live connection.
+ */
+int log_sampling_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    struct sockaddr_in saddr;
+    /* val64 of the ICID is its big endian value; sampling is 1 in 4, so
+     * low byte 4 is traced and low bytes 1, 2, 3 are not */
+    const uint8_t test_low_byte[4] = { 4, 1, 2, 3 };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_set_binlog(quic, ".") != 0) {
+        DBG_PRINTF("%s", "Cannot set the binlog folder");
+        ret = -1;
+    }
+    else {
+        picoquic_set_log_sampling(quic, 4);
+    }
+
+    for (size_t i = 0; ret == 0 && i < 4; i++) {
+        picoquic_connection_id_t icid = { { 0, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+        picoquic_cnx_t* cnx;
+        int expect_trace = (i == 0);
+
+        icid.id[7] = test_low_byte[i];
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("Cannot create connection %zu\n", i);
+            ret = -1;
+        }
+        else {
+            if ((cnx->f_binlog != NULL) != expect_trace) {
+                DBG_PRINTF("ICID low byte %d: traced = %d, expected %d",
+                    test_low_byte[i], cnx->f_binlog != NULL, expect_trace);
+                ret = -1;
+            }
+            else if (!expect_trace) {
+                /* Forcing the trace on a skipped connection opens its log */
+                if (picoquic_cnx_set_qlog(cnx) != 0 || cnx->f_binlog == NULL) {
+                    DBG_PRINTF("ICID low byte %d: cannot force the trace", test_low_byte[i]);
+                    ret = -1;
+                }
+            }
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the memory mapped binlog output: a connection created with
+ * mmap mode on gets a mapping, events land in the file, and the file is
+ * truncated to a clean sequence of length prefixed chunks at close.
+ */
+int binlog_mmap_test()
+{
+#ifdef _WINDOWS
+    /* The mmap writer is not supported on Windows; the setter says so */
+    int ret = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        if (picoquic_set_binlog_mmap(quic, 1) != -1) {
+            ret = -1;
+        }
+        picoquic_free(quic);
+    }
+    return ret;
+#else
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    char* log_file_name = NULL;
+    struct sockaddr_in saddr;
+    picoquic_connection_id_t icid = { { 0xb1, 0x06, 0, 0, 0, 0, 0, 0 }, 8 };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL ||
+        picoquic_set_binlog(quic, ".") != 0 ||
+        picoquic_set_binlog_mmap(quic, 1) != 0) {
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL || cnx->f_binlog == NULL) {
+            DBG_PRINTF("%s", "Cannot create a logged connection");
+            ret = -1;
+        }
+        else if (cnx->binlog_mmap == NULL) {
+            DBG_PRINTF("%s", "Connection did not get a binlog mapping");
+            ret = -1;
+        }
+        else {
+            log_file_name = picoquic_string_duplicate(cnx->binlog_file_name);
+            /* Write a couple of events through the mapping */
+            picoquic_log_app_message(cnx, "mmap binlog test, pass %d", 1);
+            picoquic_log_app_message(cnx, "mmap binlog test, pass %d", 2);
+        }
+        if (cnx != NULL) {
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    /* The file must now be truncated to a clean sequence of length
+     * prefixed chunks after the 16 byte file header */
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(log_file_name, "rb");
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s", log_file_name);
+            ret = -1;
+        }
+        else {
+            uint8_t header[16];
+            uint8_t head[4];
+            int nb_chunks = 0;
+
+            if (fread(header, sizeof(header), 1, F) != 1) {
+                DBG_PRINTF("Cannot read the header of %s", log_file_name);
+                ret = -1;
+            }
+            while (ret == 0 && fread(head, sizeof(head), 1, F) == 1) {
+                uint32_t chunk_length = PICOPARSE_32(head);
+
+                if (chunk_length == 0 || fseek(F, chunk_length, SEEK_CUR) != 0) {
+                    ret = -1;
+                }
+                else {
+                    nb_chunks++;
+                }
+            }
+            if (ret == 0 && (nb_chunks < 4 || getc(F) != EOF)) {
+                /* new connection, two messages, close, exactly at EOF */
+                DBG_PRINTF("Found %d chunks in %s", nb_chunks, log_file_name);
+                ret = -1;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (log_file_name != NULL) {
+        free(log_file_name);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+#endif
+}
+
+/* Test of the in memory flight recorder: connections are logged without
+ * creating files, the circular buffer retains the last N events, and a
+ * dump produces a well formed binlog file.
+ */
+#define FLIGHT_RECORDER_TEST_FILE "flight_recorder_test.log"
+#define FLIGHT_RECORDER_TEST_SLOTS 8
+
+int flight_recorder_test()
+{
+#ifdef _WINDOWS
+    /* The flight recorder is not supported on Windows; the setter says so */
+    int ret = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        if (picoquic_set_flight_recorder(quic, 16) != -1) {
+            ret = -1;
+        }
+        picoquic_free(quic);
+    }
+    return ret;
+#else
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    picoquic_connection_id_t icid = { { 0xf1, 0x11, 0, 0, 0, 0, 0, 0 }, 8 };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_dump_flight_recorder(quic, FLIGHT_RECORDER_TEST_FILE) != -1) {
+        DBG_PRINTF("%s", "Dump without a recorder should fail");
+        ret = -1;
+    }
+    else if (picoquic_set_flight_recorder(quic, FLIGHT_RECORDER_TEST_SLOTS) != 0) {
+        DBG_PRINTF("%s", "Cannot start the flight recorder");
+        ret = -1;
+    }
+    else {
+        /* No binlog folder is configured; the recorder alone drives logging */
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL || cnx->f_binlog == NULL) {
+            DBG_PRINTF("%s", "Cannot create a recorded connection");
+            ret = -1;
+        }
+        else if (cnx->binlog_file_name != NULL) {
+            DBG_PRINTF("%s", "Flight recorder mode created a log file");
+            ret = -1;
+        }
+        else {
+            /* Produce more events than the recorder can hold */
+            for (int i = 0; i < 2 * FLIGHT_RECORDER_TEST_SLOTS; i++) {
+                picoquic_log_app_message(cnx, "flight recorder test, pass %d", i);
+            }
+        }
+        if (cnx != NULL) {
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    if (ret == 0 && picoquic_dump_flight_recorder(quic, FLIGHT_RECORDER_TEST_FILE) != 0) {
+        DBG_PRINTF("%s", "Cannot dump the flight recorder");
+        ret = -1;
+    }
+
+    /* The dump must hold exactly the retained events, as a 16 byte file
+     * header followed by length prefixed chunks */
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(FLIGHT_RECORDER_TEST_FILE, "rb");
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s", FLIGHT_RECORDER_TEST_FILE);
+            ret = -1;
+        }
+        else {
+            uint8_t header[16];
+            uint8_t head[4];
+            int nb_chunks = 0;
+
+            if (fread(header, sizeof(header), 1, F) != 1) {
+                DBG_PRINTF("Cannot read the header of %s", FLIGHT_RECORDER_TEST_FILE);
+                ret = -1;
+            }
+            while (ret == 0 && fread(head, sizeof(head), 1, F) == 1) {
+                uint32_t chunk_length = PICOPARSE_32(head);
+
+                if (chunk_length == 0 || fseek(F, chunk_length, SEEK_CUR) != 0) {
+                    ret = -1;
+                }
+                else {
+                    nb_chunks++;
+                }
+            }
+            if (ret == 0 && (nb_chunks != FLIGHT_RECORDER_TEST_SLOTS || getc(F) != EOF)) {
+                /* More events than slots were produced, so the dump holds
+                 * exactly one full ring of events */
+                DBG_PRINTF("Found %d chunks in %s", nb_chunks, FLIGHT_RECORDER_TEST_FILE);
+                ret = -1;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+#endif
+}
+
+/* Test of the close record log: each deleted connection appends one
+ * fixed size record, the writer thread is drained when the QUIC context
+ * is freed, and the file can be read back with the documented layout.
+ */
+#define CLOSE_LOG_TEST_FILE "close_log_test.bin"
+#define CLOSE_LOG_TEST_NB_CNX 3
+
+int close_log_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_connection_id_t test_icid[CLOSE_LOG_TEST_NB_CNX];
+    struct sockaddr_in saddr;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    /* Start from a fresh file, since the log opens in append mode */
+    (void)remove(CLOSE_LOG_TEST_FILE);
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_close_log_setup(quic, CLOSE_LOG_TEST_FILE) != 0) {
+        DBG_PRINTF("Cannot set up the close log to %s", CLOSE_LOG_TEST_FILE);
+        ret = -1;
+    }
+
+    /* Create a set of connections and delete them in a known order */
+    for (int i = 0; ret == 0 && i < CLOSE_LOG_TEST_NB_CNX; i++) {
+        picoquic_connection_id_t icid = { { 0xc1, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+        picoquic_cnx_t* cnx;
+
+        icid.id[7] = (uint8_t)(i + 1);
+        test_icid[i] = icid;
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL) {
+            DBG_PRINTF("Cannot create connection %d", i);
+            ret = -1;
+        }
+        else {
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    if (ret == 0 && picoquic_get_close_log_dropped(quic) != 0) {
+        DBG_PRINTF("%s", "Close records were dropped");
+        ret = -1;
+    }
+
+    /* Freeing the context drains the ring and closes the file */
+    if (quic != NULL) {
+        picoquic_free(quic);
+        quic = NULL;
+    }
+
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(CLOSE_LOG_TEST_FILE, "rb");
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s", CLOSE_LOG_TEST_FILE);
+            ret = -1;
+        }
+        else {
+            picoquic_close_log_header_t header;
+
+            if (fread(&header, sizeof(header), 1, F) != 1 ||
+                header.magic != PICOQUIC_CLOSE_LOG_MAGIC ||
+                header.version != PICOQUIC_CLOSE_LOG_VERSION ||
+                header.header_size != sizeof(picoquic_close_log_header_t) ||
+                header.record_size != sizeof(picoquic_close_record_t)) {
+                DBG_PRINTF("Bad header in %s", CLOSE_LOG_TEST_FILE);
+                ret = -1;
+            }
+            for (int i = 0; ret == 0 && i < CLOSE_LOG_TEST_NB_CNX; i++) {
+                picoquic_close_record_t record;
+
+                if (fread(&record, sizeof(record), 1, F) != 1) {
+                    DBG_PRINTF("Cannot read close record %d", i);
+                    ret = -1;
+                }
+                else if (record.icid_len != test_icid[i].id_len ||
+                    memcmp(record.icid, test_icid[i].id, test_icid[i].id_len) != 0 ||
+                    record.is_client != 1 ||
+                    record.stats.snapshot_time != record.start_time + record.duration) {
+                    DBG_PRINTF("Bad close record %d", i);
+                    ret = -1;
+                }
+            }
+            if (ret == 0 && getc(F) != EOF) {
+                DBG_PRINTF("Trailing data in %s", CLOSE_LOG_TEST_FILE);
+                ret = -1;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the v2 binlog format: a connection created with v2 enabled
+ * writes a file with header version 0x02 and delta encoded event times,
+ * and the log reader reconstructs the absolute times transparently.
+ */
+typedef struct st_binlog_v2_test_ctx_t {
+    picoquic_connection_id_t icid;
+    int nb_events;
+    int nb_bad_cid;
+    int nb_messages;
+    uint64_t message_time[4];
+} binlog_v2_test_ctx_t;
+
+static int binlog_v2_test_cb(bytestream* s, void* ptr)
+{
+    int ret = 0;
+    binlog_v2_test_ctx_t* ctx = (binlog_v2_test_ctx_t*)ptr;
+    picoquic_connection_id_t cid;
+    uint64_t event_time = 0;
+    uint64_t path_id = 0;
+    uint64_t event_type = 0;
+
+    ret |= byteread_cid(s, &cid);
+    ret |= byteread_vint(s, &event_time);
+    ret |= byteread_vint(s, &path_id);
+    ret |= byteread_vint(s, &event_type);
+
+    if (ret == 0) {
+        ctx->nb_events++;
+        if (picoquic_compare_connection_id(&cid, &ctx->icid) != 0) {
+            ctx->nb_bad_cid++;
+        }
+        if (event_type == picoquic_log_event_info_message &&
+            ctx->nb_messages < 4) {
+            ctx->message_time[ctx->nb_messages++] = event_time;
+        }
+    }
+
+    return ret;
+}
+
+int binlog_v2_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    const uint64_t message_delta = 30000;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    char* log_file_name = NULL;
+    uint64_t message_time[2] = { 0, 0 };
+    struct sockaddr_in saddr;
+    picoquic_connection_id_t icid = { { 0xb2, 0x06, 0, 0, 0, 0, 0, 0 }, 8 };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        current_time, &current_time, NULL, NULL, 0);
+    if (quic == NULL ||
+        picoquic_set_binlog(quic, ".") != 0) {
+        ret = -1;
+    }
+    else {
+        picoquic_set_binlog_v2(quic, 1);
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, current_time, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL || cnx->f_binlog == NULL) {
+            DBG_PRINTF("%s", "Cannot create a logged connection");
+            ret = -1;
+        }
+        else if (!cnx->binlog_is_v2) {
+            DBG_PRINTF("%s", "Connection did not select the v2 encoding");
+            ret = -1;
+        }
+        else {
+            log_file_name = picoquic_string_duplicate(cnx->binlog_file_name);
+            message_time[0] = current_time;
+            picoquic_log_app_message(cnx, "binlog v2 test, pass %d", 1);
+            current_time += message_delta;
+            message_time[1] = current_time;
+            picoquic_log_app_message(cnx, "binlog v2 test, pass %d", 2);
+        }
+        if (cnx != NULL) {
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    /* The file header must carry version 0x02 */
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(log_file_name, "rb");
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s", log_file_name);
+            ret = -1;
+        }
+        else {
+            uint8_t header[16];
+
+            if (fread(header, sizeof(header), 1, F) != 1 ||
+                header[6] != 0 || header[7] != 0x02) {
+                DBG_PRINTF("%s", "File header does not carry version 0x02");
+                ret = -1;
+            }
+
+            /* The reader must reconstruct the absolute event times */
+            if (ret == 0) {
+                binlog_v2_test_ctx_t ctx;
+
+                memset(&ctx, 0, sizeof(ctx));
+                ctx.icid = icid;
+
+                if (fileread_binlog(F, binlog_v2_test_cb, &ctx) != 0) {
+                    DBG_PRINTF("%s", "Cannot parse the v2 binlog");
+                    ret = -1;
+                }
+                else if (ctx.nb_events < 3 || ctx.nb_bad_cid != 0) {
+                    DBG_PRINTF("Parsed %d events, %d with a bad cid",
+                        ctx.nb_events, ctx.nb_bad_cid);
+                    ret = -1;
+                }
+                else if (ctx.nb_messages != 2 ||
+                    ctx.message_time[0] != message_time[0] ||
+                    ctx.message_time[1] != message_time[1]) {
+                    DBG_PRINTF("%d messages, times %" PRIu64 ", %" PRIu64,
+                        ctx.nb_messages, ctx.message_time[0], ctx.message_time[1]);
+                    ret = -1;
+                }
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (log_file_name != NULL) {
+        (void)remove(log_file_name);
+        free(log_file_name);
+    }
+
+    return ret;
+}
+
+/* Test of the log correlation id: the tag set on a connection must show
+ * up in its binary log as an info message event.
+ */
+typedef struct st_correlation_id_test_ctx_t {
+    int found;
+} correlation_id_test_ctx_t;
+
+static const char* correlation_id_test_value = "correlation_id=edge-0001";
+
+static int correlation_id_test_cb(bytestream* s, void* ptr)
+{
+    int ret = 0;
+    correlation_id_test_ctx_t* ctx = (correlation_id_test_ctx_t*)ptr;
+    picoquic_connection_id_t cid;
+    uint64_t event_time = 0;
+    uint64_t path_id = 0;
+    uint64_t event_type = 0;
+
+    ret |= byteread_cid(s, &cid);
+    ret |= byteread_vint(s, &event_time);
+    ret |= byteread_vint(s, &path_id);
+    ret |= byteread_vint(s, &event_type);
+
+    if (ret == 0 && event_type == picoquic_log_event_info_message) {
+        size_t message_length = bytestream_remain(s);
+
+        if (message_length == strlen(correlation_id_test_value) &&
+            memcmp(s->data + s->ptr, correlation_id_test_value, message_length) == 0) {
+            ctx->found = 1;
+        }
+    }
+
+    return ret;
+}
+
+int correlation_id_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    char* log_file_name = NULL;
+    struct sockaddr_in saddr;
+    picoquic_connection_id_t icid = { { 0xc0, 0x44, 0, 0, 0, 0, 0, 0 }, 8 };
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL ||
+        picoquic_set_binlog(quic, ".") != 0) {
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1);
+        if (cnx == NULL || cnx->f_binlog == NULL) {
+            DBG_PRINTF("%s", "Cannot create a logged connection");
+            ret = -1;
+        }
+        else if (picoquic_set_log_correlation_id(cnx, "edge-0001") != 0) {
+            DBG_PRINTF("%s", "Cannot set the correlation id");
+            ret = -1;
+        }
+        else {
+            log_file_name = picoquic_string_duplicate(cnx->binlog_file_name);
+        }
+        if (cnx != NULL) {
+            picoquic_delete_cnx(cnx);
+        }
+    }
+
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(log_file_name, "rb");
+
+        if (F == NULL) {
+            DBG_PRINTF("Cannot open %s", log_file_name);
+            ret = -1;
+        }
+        else {
+            correlation_id_test_ctx_t ctx = { 0 };
+
+            if (fileread_binlog(F, correlation_id_test_cb, &ctx) != 0 ||
+                !ctx.found) {
+                DBG_PRINTF("%s", "Correlation id event not found in the binlog");
+                ret = -1;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (log_file_name != NULL) {
+        (void)remove(log_file_name);
+        free(log_file_name);
+    }
+
+    return ret;
+}
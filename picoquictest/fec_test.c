@@ -0,0 +1,127 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquictest_internal.h"
+#include "tls_api.h"
+
+/* Test of the experimental FEC repair frames, see fec.c.
+ *
+ * The client sends a moderate amount of data on an FEC protected
+ * stream, over a simulated link with regularly spaced isolated losses.
+ * The MTU is constrained so the data packets fit in the FEC symbol
+ * size and are actually protected. The test verifies that the
+ * extension is negotiated, that the transfer completes, and that the
+ * server recovered at least one lost packet from a repair frame
+ * instead of waiting for the retransmission.
+ */
+
+static test_api_stream_desc_t test_scenario_fec[] = {
+    { 4, 0, 100000, 257 },
+    { 8, 4, 100000, 257 }
+};
+
+int fec_recovery_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xfe, 0xc0, 0, 0, 0, 0, 0, 0}, 8 };
+    int ret = tls_api_one_scenario_init_ex(&test_ctx, &simulated_time,
+        PICOQUIC_INTERNAL_TEST_VERSION_1, NULL, NULL, &initial_cid, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Enable the FEC extension on both sides. The client connection
+         * is already created, so its transport parameter is set directly. */
+        picoquic_set_default_fec_option(test_ctx->qserver, 1);
+        test_ctx->cnx_client->local_parameters.enable_fec = 1;
+        /* Keep the packets small enough to fit in the FEC symbol */
+        picoquic_set_mtu_max(test_ctx->qclient, 1024);
+        picoquic_set_mtu_max(test_ctx->qserver, 1024);
+
+        picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    /* Establish the connection without losses */
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = wait_client_connection_ready(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0 && !test_ctx->cnx_client->is_fec_enabled) {
+        DBG_PRINTF("%s", "FEC not negotiated at client");
+        ret = -1;
+    }
+
+    if (ret == 0 && !test_ctx->cnx_server->is_fec_enabled) {
+        DBG_PRINTF("%s", "FEC not negotiated at server");
+        ret = -1;
+    }
+
+    /* Protect the client data streams */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_fec, sizeof(test_scenario_fec));
+    }
+
+    if (ret == 0 &&
+        (picoquic_set_stream_fec(test_ctx->cnx_client, 4, 1) != 0 ||
+            picoquic_set_stream_fec(test_ctx->cnx_client, 8, 1) != 0)) {
+        DBG_PRINTF("%s", "Cannot mark streams as FEC protected");
+        ret = -1;
+    }
+
+    /* Send the data through regularly spaced isolated losses */
+    if (ret == 0) {
+        loss_mask = 0x0004000400040004ull;
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        loss_mask = 0;
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 10000000);
+    }
+
+    /* Verify that the server recovered at least one packet from FEC */
+    if (ret == 0 &&
+        (test_ctx->cnx_server == NULL ||
+            test_ctx->cnx_server->fec_receiver == NULL ||
+            test_ctx->cnx_server->fec_receiver->nb_recovered == 0)) {
+        DBG_PRINTF("%s", "No packet was recovered from FEC repair frames");
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
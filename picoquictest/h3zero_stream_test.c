@@ -45,6 +45,7 @@
 #include "autoqlog.h"
 #include "picoquic_binlog.h"
 #include "pico_webtransport.h"
+#include "h3zero_relay.h"
 
 /* testing:
  * uint8_t * h3zero_varint_from_stream(uint8_t* bytes, uint8_t* bytes_max, uint64_t * result, uint8_t * buffer, size_t* buffer_length)
@@ -955,4 +956,537 @@ int h3zero_capsule_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/* Test of the datagram batch APIs: batch delivery through the vector
+* callback, and batch queueing of outgoing datagrams. */
+
+typedef struct st_test_datagram_batch_ctx_t {
+    int nb_batches;
+    int nb_datagrams;
+    size_t nb_bytes;
+    size_t last_batch_count;
+    int content_error;
+} test_datagram_batch_ctx_t;
+
+static int h3zero_test_datagram_batch_cb(picoquic_cnx_t* cnx,
+    uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event,
+    struct st_h3zero_stream_ctx_t* stream_ctx,
+    void* path_app_ctx)
+{
+    int ret = 0;
+    test_datagram_batch_ctx_t* dg_ctx = (test_datagram_batch_ctx_t*)path_app_ctx;
+
+    switch (wt_event) {
+    case picohttp_callback_post_datagram_batch:
+    {
+        h3zero_datagram_vec_t* vec = (h3zero_datagram_vec_t*)bytes;
+
+        dg_ctx->nb_batches += 1;
+        dg_ctx->last_batch_count = length;
+        for (size_t i = 0; i < length; i++) {
+            /* Each test datagram carries its sequence number */
+            if (vec[i].length != 3 || vec[i].bytes[0] != (uint8_t)dg_ctx->nb_datagrams) {
+                dg_ctx->content_error = 1;
+            }
+            dg_ctx->nb_datagrams += 1;
+            dg_ctx->nb_bytes += vec[i].length;
+        }
+        break;
+    }
+    case picohttp_callback_post_datagram:
+        /* Not expected once batch mode is set */
+        ret = -1;
+        break;
+    case picohttp_callback_deregister:
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+int picowt_datagram_batch_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    h3zero_callback_ctx_t* h3_ctx = NULL;
+    uint64_t simulated_time = 0;
+    h3zero_stream_ctx_t* control_stream_ctx = NULL;
+    test_datagram_batch_ctx_t dg_ctx = { 0 };
+    int ret = h3zero_set_test_context(&quic, &cnx, &h3_ctx, &simulated_time);
+
+    if (ret == 0) {
+        control_stream_ctx = picowt_set_control_stream(cnx, h3_ctx);
+        if (control_stream_ctx == NULL ||
+            h3zero_declare_stream_prefix(h3_ctx, control_stream_ctx->stream_id,
+                h3zero_test_datagram_batch_cb, &dg_ctx) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picowt_set_datagram_batch_mode(h3_ctx, control_stream_ctx, 4, 0);
+    }
+
+    /* Deliver six datagrams. With a batch size of 4, the first four
+    * should be delivered in one vector callback, the last two held
+    * until the explicit flush. */
+    for (uint8_t i = 0; ret == 0 && i < 6; i++) {
+        uint8_t dg[8];
+        uint8_t* next_byte = picoquic_frames_varint_encode(dg, dg + sizeof(dg),
+            control_stream_ctx->stream_id >> 2);
+
+        if (next_byte == NULL || (next_byte - dg) + 3 > (ptrdiff_t)sizeof(dg)) {
+            ret = -1;
+        }
+        else {
+            next_byte[0] = i;
+            next_byte[1] = 0xaa;
+            next_byte[2] = 0x55;
+            ret = h3zero_callback_datagram(cnx, dg, (next_byte - dg) + 3, h3_ctx);
+        }
+    }
+
+    if (ret == 0 && (dg_ctx.nb_batches != 1 || dg_ctx.nb_datagrams != 4 ||
+        dg_ctx.last_batch_count != 4 || dg_ctx.content_error)) {
+        DBG_PRINTF("Expected one batch of 4, got %d batches, %d datagrams, error %d",
+            dg_ctx.nb_batches, dg_ctx.nb_datagrams, dg_ctx.content_error);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picowt_flush_datagrams(cnx, h3_ctx, control_stream_ctx);
+        if (dg_ctx.nb_batches != 2 || dg_ctx.nb_datagrams != 6 ||
+            dg_ctx.last_batch_count != 2 || dg_ctx.nb_bytes != 18 || dg_ctx.content_error) {
+            DBG_PRINTF("Expected flush of 2, got %d batches, %d datagrams, error %d",
+                dg_ctx.nb_batches, dg_ctx.nb_datagrams, dg_ctx.content_error);
+            ret = -1;
+        }
+    }
+
+    /* Queue a batch of three datagrams, then verify that an oversized
+    * entry is rejected after the previous entries were queued. */
+    if (ret == 0) {
+        uint8_t payload[PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH];
+        h3zero_datagram_vec_t vec[4];
+        size_t nb_queued = 0;
+
+        memset(payload, 0x42, sizeof(payload));
+        for (int i = 0; i < 4; i++) {
+            vec[i].bytes = payload;
+            vec[i].length = 100;
+        }
+        if (picowt_queue_datagrams(cnx, control_stream_ctx, 3, vec, &nb_queued) != 0 ||
+            nb_queued != 3 || cnx->first_datagram == NULL) {
+            DBG_PRINTF("Queued %zu datagrams instead of 3", nb_queued);
+            ret = -1;
+        }
+        else {
+            vec[3].length = sizeof(payload);
+            if (picowt_queue_datagrams(cnx, control_stream_ctx, 4, vec,
+                &nb_queued) != PICOQUIC_ERROR_DATAGRAM_TOO_LONG ||
+                nb_queued != 3) {
+                DBG_PRINTF("Oversized datagram was not rejected, %zu queued", nb_queued);
+                ret = -1;
+            }
+        }
+    }
+
+    picoquic_set_callback(cnx, NULL, NULL);
+    h3zero_callback_delete_context(cnx, h3_ctx);
+    picoquic_test_delete_minimal_cnx(&quic, &cnx);
+
+    return ret;
+}
+
+/* Test of the batch stream creation API: create a batch of local
+* streams, verify that the contexts are registered, then delete them
+* and verify that a new batch reuses the recycled contexts instead of
+* allocating. */
+int picowt_stream_batch_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    h3zero_callback_ctx_t* h3_ctx = NULL;
+    uint64_t simulated_time = 0;
+    h3zero_stream_ctx_t* control_stream_ctx = NULL;
+    h3zero_stream_ctx_t* batch[8] = { NULL };
+    int ret = h3zero_set_test_context(&quic, &cnx, &h3_ctx, &simulated_time);
+
+    if (ret == 0) {
+        control_stream_ctx = picowt_set_control_stream(cnx, h3_ctx);
+        if (control_stream_ctx == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picowt_create_local_streams(cnx, 0, h3_ctx, control_stream_ctx->stream_id,
+            (uint8_t)(PICOQUIC_DEFAULT_STREAM_PRIORITY & 0xFE), 8, batch);
+    }
+
+    for (int i = 0; ret == 0 && i < 8; i++) {
+        if (batch[i] == NULL ||
+            h3zero_find_stream(h3_ctx, batch[i]->stream_id) != batch[i] ||
+            batch[i]->ps.stream_state.control_stream_id != control_stream_ctx->stream_id) {
+            DBG_PRINTF("Batch stream %d was not properly created", i);
+            ret = -1;
+        }
+        for (int j = 0; ret == 0 && j < i; j++) {
+            if (batch[j]->stream_id == batch[i]->stream_id) {
+                DBG_PRINTF("Batch streams %d and %d share a stream id", j, i);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        for (int i = 0; i < 8; i++) {
+            h3zero_delete_stream(cnx, h3_ctx, batch[i]);
+            batch[i] = NULL;
+        }
+        if (h3_ctx->nb_stream_ctx_free != 8) {
+            DBG_PRINTF("Expected 8 recycled contexts, got %zu", h3_ctx->nb_stream_ctx_free);
+            ret = -1;
+        }
+        else if (h3_ctx->nb_stream_ctx_allocated != 9 ||
+            h3_ctx->nb_stream_ctx_high_water != 9 ||
+            h3_ctx->nb_stream_ctx_live != 1) {
+            DBG_PRINTF("Bad accounting, allocated %zu, high water %zu, live %zu",
+                h3_ctx->nb_stream_ctx_allocated, h3_ctx->nb_stream_ctx_high_water,
+                h3_ctx->nb_stream_ctx_live);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The next batch must be served from the recycling list */
+        ret = picowt_create_local_streams(cnx, 0, h3_ctx, control_stream_ctx->stream_id,
+            0, 4, batch);
+        if (ret == 0 && h3_ctx->nb_stream_ctx_free != 4) {
+            DBG_PRINTF("Expected 4 recycled contexts left, got %zu", h3_ctx->nb_stream_ctx_free);
+            ret = -1;
+        }
+        if (ret == 0 &&
+            (h3_ctx->nb_stream_ctx_recycled != 4 ||
+                h3_ctx->nb_stream_ctx_allocated != 9 ||
+                h3_ctx->nb_stream_ctx_high_water != 9 ||
+                h3_ctx->nb_stream_ctx_live != 5)) {
+            DBG_PRINTF("Bad accounting, recycled %zu, allocated %zu, high water %zu, live %zu",
+                h3_ctx->nb_stream_ctx_recycled, h3_ctx->nb_stream_ctx_allocated,
+                h3_ctx->nb_stream_ctx_high_water, h3_ctx->nb_stream_ctx_live);
+            ret = -1;
+        }
+    }
+
+    picoquic_set_callback(cnx, NULL, NULL);
+    h3zero_callback_delete_context(cnx, h3_ctx);
+    picoquic_test_delete_minimal_cnx(&quic, &cnx);
+
+    return ret;
+}
+
+/* Test of the GOAWAY based draining: verify that a GOAWAY received on
+* the peer's control stream is parsed, that sending a GOAWAY marks the
+* drain point, and that request streams past that point are rejected
+* while earlier ones are still accepted. */
+int h3zero_goaway_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    h3zero_callback_ctx_t* h3_ctx = NULL;
+    uint64_t simulated_time = 0;
+    int ret = h3zero_set_test_context(&quic, &cnx, &h3_ctx, &simulated_time);
+
+    if (ret == 0) {
+        /* Remote control stream: settings frame, then GOAWAY with id 8 */
+        uint8_t control_bytes[] = { 0x00, 0x04, 0x02, 0x33, 0x01, 0x07, 0x01, 0x08 };
+
+        ret = h3zero_callback(cnx, 3, control_bytes, sizeof(control_bytes),
+            picoquic_callback_stream_data, h3_ctx, NULL);
+        if (ret == 0 &&
+            (!h3_ctx->is_goaway_received || h3_ctx->peer_goaway_stream_id != 8)) {
+            DBG_PRINTF("GOAWAY not parsed, received %d, id %" PRIu64,
+                h3_ctx->is_goaway_received, h3_ctx->peer_goaway_stream_id);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Sending requires a local control stream */
+        if (h3zero_send_goaway(cnx, h3_ctx) == 0) {
+            DBG_PRINTF("%s", "GOAWAY sent without a control stream");
+            ret = -1;
+        }
+        else {
+            ret = h3zero_protocol_init_ex(cnx, h3_ctx);
+        }
+    }
+
+    if (ret == 0) {
+        h3_ctx->next_client_stream_id = 12;
+        ret = h3zero_send_goaway(cnx, h3_ctx);
+        if (ret == 0 &&
+            (!h3_ctx->is_goaway_sent || h3_ctx->goaway_stream_id != 12)) {
+            DBG_PRINTF("%s", "GOAWAY send did not set the drain point");
+            ret = -1;
+        }
+        if (ret == 0) {
+            /* Sending twice is a no-op */
+            ret = h3zero_send_goaway(cnx, h3_ctx);
+        }
+    }
+
+    if (ret == 0) {
+        /* Act as a draining server: requests past the drain point are
+        * rejected without creating a stream context, earlier ones are
+        * still accepted. */
+        cnx->client_mode = 0;
+        ret = h3zero_callback(cnx, 12, NULL, 0,
+            picoquic_callback_stream_data, h3_ctx, NULL);
+        if (ret == 0 && h3zero_find_stream(h3_ctx, 12) != NULL) {
+            DBG_PRINTF("%s", "Request past the drain point was accepted");
+            ret = -1;
+        }
+        if (ret == 0) {
+            ret = h3zero_callback(cnx, 8, NULL, 0,
+                picoquic_callback_stream_data, h3_ctx, NULL);
+            if (ret == 0 && h3zero_find_stream(h3_ctx, 8) == NULL) {
+                DBG_PRINTF("%s", "Request before the drain point was rejected");
+                ret = -1;
+            }
+        }
+    }
+
+    picoquic_set_callback(cnx, NULL, NULL);
+    h3zero_callback_delete_context(cnx, h3_ctx);
+    picoquic_test_delete_minimal_cnx(&quic, &cnx);
+
+    return ret;
+}
+
+/* Test of the relay facility: two connections, a relay bound between
+* stream 0 on each. Bytes fed on the incoming side must come out of the
+* prepare-to-send path of the outgoing side in order, with the fin
+* carried over; a ring overflow must spill into the send queue rather
+* than losing or reordering bytes; a reset closes both directions. */
+static int h3zero_relay_drain(h3zero_relay_ctx_t* relay, picoquic_cnx_t* cnx_to,
+    uint8_t* packet, size_t packet_size, uint8_t** app_buffer, size_t* drained, int* is_fin)
+{
+    picoquic_stream_data_buffer_argument_t stream_data_context;
+    uint8_t* next_byte = picoquic_format_stream_frame_header(packet, packet + packet_size, 0, 0);
+    int ret = (next_byte == NULL) ? -1 : 0;
+
+    if (ret == 0) {
+        memset(&stream_data_context, 0, sizeof(stream_data_context));
+        stream_data_context.bytes = packet;
+        stream_data_context.byte_index = next_byte - packet;
+        stream_data_context.allowed_space = packet_size - stream_data_context.byte_index;
+        stream_data_context.byte_space = stream_data_context.allowed_space;
+        ret = h3zero_relay_callback(cnx_to, (uint8_t*)&stream_data_context,
+            stream_data_context.byte_space, picohttp_callback_provide_data, NULL, relay);
+        *app_buffer = stream_data_context.app_buffer;
+        *drained = stream_data_context.length;
+        *is_fin = stream_data_context.is_fin;
+    }
+    return ret;
+}
+
+int h3zero_relay_test()
+{
+    picoquic_quic_t* quic_in = NULL;
+    picoquic_cnx_t* cnx_in = NULL;
+    h3zero_callback_ctx_t* h3_ctx_in = NULL;
+    picoquic_quic_t* quic_out = NULL;
+    picoquic_cnx_t* cnx_out = NULL;
+    h3zero_callback_ctx_t* h3_ctx_out = NULL;
+    uint64_t simulated_time = 0;
+    h3zero_stream_ctx_t* stream_ctx_in = NULL;
+    h3zero_stream_ctx_t* stream_ctx_out = NULL;
+    h3zero_relay_ctx_t* relay = NULL;
+    uint8_t data[1000];
+    uint8_t packet[512];
+    size_t drained = 0;
+    size_t total_drained = 0;
+    int is_fin = 0;
+    int ret = h3zero_set_test_context(&quic_in, &cnx_in, &h3_ctx_in, &simulated_time);
+
+    if (ret == 0) {
+        ret = h3zero_set_test_context(&quic_out, &cnx_out, &h3_ctx_out, &simulated_time);
+    }
+
+    if (ret == 0) {
+        stream_ctx_in = h3zero_find_or_create_stream(cnx_in, 0, h3_ctx_in, 1, 1);
+        stream_ctx_out = h3zero_find_or_create_stream(cnx_out, 0, h3_ctx_out, 1, 1);
+        if (stream_ctx_in == NULL || stream_ctx_out == NULL ||
+            (relay = h3zero_relay_create(cnx_in, stream_ctx_in, cnx_out, stream_ctx_out)) == NULL) {
+            ret = -1;
+        }
+        else if (stream_ctx_in->path_callback != h3zero_relay_callback ||
+            stream_ctx_out->path_callback_ctx != relay) {
+            DBG_PRINTF("%s", "Relay callback was not installed");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        for (size_t i = 0; i < sizeof(data); i++) {
+            data[i] = (uint8_t)(i & 0xFF);
+        }
+        ret = h3zero_relay_callback(cnx_in, data, sizeof(data),
+            picohttp_callback_post_data, stream_ctx_in, relay);
+        if (ret == 0 && relay->upstream.fill != sizeof(data)) {
+            DBG_PRINTF("Expected %zu staged bytes, got %zu", sizeof(data), relay->upstream.fill);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Mark the fin, then drain through small packets until done */
+        ret = h3zero_relay_callback(cnx_in, NULL, 0,
+            picohttp_callback_post_fin, stream_ctx_in, relay);
+        while (ret == 0 && !is_fin && total_drained < sizeof(data)) {
+            uint8_t* app_buffer = NULL;
+            ret = h3zero_relay_drain(relay, cnx_out, packet, sizeof(packet), &app_buffer, &drained, &is_fin);
+            if (ret == 0 && drained > 0 && app_buffer == NULL) {
+                DBG_PRINTF("%s", "Relay drain did not provide a buffer");
+                ret = -1;
+            }
+            for (size_t i = 0; ret == 0 && i < drained; i++) {
+                if (app_buffer[i] != (uint8_t)((total_drained + i) & 0xFF)) {
+                    DBG_PRINTF("Relayed byte %zu does not match", total_drained + i);
+                    ret = -1;
+                }
+            }
+            total_drained += drained;
+            if (ret == 0 && drained == 0 && !is_fin) {
+                DBG_PRINTF("%s", "Relay drain made no progress");
+                ret = -1;
+            }
+        }
+        if (ret == 0 && (total_drained != sizeof(data) || !is_fin ||
+            !relay->upstream.is_fin_sent || relay->upstream.fill != 0)) {
+            DBG_PRINTF("Drained %zu bytes, fin %d", total_drained, is_fin);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Overflow on the reverse direction: more than a ring's worth
+        * must spill into the send queue without losing bytes. */
+        size_t sent = 0;
+        size_t target = H3ZERO_RELAY_PIPE_SIZE + 4000;
+        while (ret == 0 && sent < target) {
+            size_t chunk = target - sent;
+            if (chunk > sizeof(data)) {
+                chunk = sizeof(data);
+            }
+            ret = h3zero_relay_callback(cnx_out, data, chunk,
+                picohttp_callback_post_data, stream_ctx_out, relay);
+            sent += chunk;
+        }
+        if (ret == 0 &&
+            relay->downstream.nb_bytes_relayed + relay->downstream.fill != target) {
+            DBG_PRINTF("Relayed %" PRIu64 " + staged %zu, expected %zu",
+                relay->downstream.nb_bytes_relayed, relay->downstream.fill, target);
+            ret = -1;
+        }
+        if (ret == 0 && relay->downstream.nb_bytes_spilled == 0) {
+            DBG_PRINTF("%s", "Overflow did not use the send queue fallback");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A reset on one side closes both pipes */
+        ret = h3zero_relay_callback(cnx_out, NULL, 0,
+            picohttp_callback_reset, stream_ctx_out, relay);
+        if (ret == 0 && (!relay->upstream.is_closed || !relay->downstream.is_closed)) {
+            DBG_PRINTF("%s", "Reset did not close the relay pipes");
+            ret = -1;
+        }
+    }
+
+    if (relay != NULL) {
+        h3zero_relay_delete(relay);
+    }
+    if (h3_ctx_in != NULL) {
+        picoquic_set_callback(cnx_in, NULL, NULL);
+        h3zero_callback_delete_context(cnx_in, h3_ctx_in);
+    }
+    if (h3_ctx_out != NULL) {
+        picoquic_set_callback(cnx_out, NULL, NULL);
+        h3zero_callback_delete_context(cnx_out, h3_ctx_out);
+    }
+    picoquic_test_delete_minimal_cnx(&quic_in, &cnx_in);
+    picoquic_test_delete_minimal_cnx(&quic_out, &cnx_out);
+
+    return ret;
+}
+
+/* Test of the PRIORITY_UPDATE frame: a reprioritization received on
+* the peer's control stream must change the priority of the designated
+* transport stream, mapping the incremental flag onto round robin
+* scheduling. */
+int h3zero_priority_update_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    h3zero_callback_ctx_t* h3_ctx = NULL;
+    uint64_t simulated_time = 0;
+    int ret = h3zero_set_test_context(&quic, &cnx, &h3_ctx, &simulated_time);
+
+    if (ret == 0) {
+        /* Create the request stream that will be reprioritized, both at
+        * the transport and at the h3zero layer. */
+        ret = picoquic_mark_active_stream(cnx, 0, 1, NULL);
+        if (ret == 0 && h3zero_find_or_create_stream(cnx, 0, h3_ctx, 1, 1) == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Remote control stream: settings frame, then PRIORITY_UPDATE
+        * for stream 0 with "u=1, i" */
+        uint8_t control_bytes[] = { 0x00, 0x04, 0x02, 0x33, 0x01,
+            0x80, 0x0F, 0x07, 0x00, 0x07, 0x00, 'u', '=', '1', ',', ' ', 'i' };
+        picoquic_stream_head_t* stream;
+
+        ret = h3zero_callback(cnx, 3, control_bytes, sizeof(control_bytes),
+            picoquic_callback_stream_data, h3_ctx, NULL);
+        if (ret == 0) {
+            stream = picoquic_find_stream(cnx, 0);
+            if (stream == NULL) {
+                DBG_PRINTF("%s", "Stream 0 was not found");
+                ret = -1;
+            }
+            else if (stream->stream_priority != (uint8_t)((2 << 1) | 0)) {
+                DBG_PRINTF("Expected priority 4, got %d", stream->stream_priority);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* An update for a stream that does not exist must be ignored
+        * without creating the stream or touching existing ones. */
+        uint8_t other_update[] = { 0x80, 0x0F, 0x07, 0x00, 0x04, 0x08, 'u', '=', '7' };
+
+        ret = h3zero_callback(cnx, 3, other_update, sizeof(other_update),
+            picoquic_callback_stream_data, h3_ctx, NULL);
+        if (ret == 0) {
+            picoquic_stream_head_t* stream = picoquic_find_stream(cnx, 0);
+            if (stream == NULL || stream->stream_priority != (uint8_t)((2 << 1) | 0)) {
+                DBG_PRINTF("%s", "Update for another stream changed stream 0");
+                ret = -1;
+            }
+        }
+    }
+
+    picoquic_set_callback(cnx, NULL, NULL);
+    h3zero_callback_delete_context(cnx, h3_ctx);
+    picoquic_test_delete_minimal_cnx(&quic, &cnx);
+
+    return ret;
+}
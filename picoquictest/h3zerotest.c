@@ -28,6 +28,7 @@
 #include "tls_api.h"
 #include "h3zero.h"
 #include "h3zero_common.h"
+#include "h3zero_filecache.h"
 #include "democlient.h"
 #include "demoserver.h"
 #ifdef _WINDOWS
@@ -899,8 +900,258 @@ int h3zero_parse_qpack_test()
     return ret;
 }
 
+/* Test of the QPACK dynamic table: parse a set of encoder stream
+ * instructions, then decode a header block that references the
+ * resulting entries, and verify the capacity and eviction rules. */
+
+static uint8_t* qpack_dyntable_encode_string(uint8_t* bytes, uint8_t* bytes_max,
+    uint8_t first_byte, uint8_t mask, char const* text)
+{
+    size_t text_length = strlen(text);
+
+    if (bytes != NULL && bytes < bytes_max) {
+        bytes[0] = first_byte;
+        bytes = h3zero_qpack_int_encode(bytes, bytes_max, mask, text_length);
+        if (bytes != NULL && bytes + text_length <= bytes_max) {
+            memcpy(bytes, text, text_length);
+            bytes += text_length;
+        }
+        else {
+            bytes = NULL;
+        }
+    }
+
+    return bytes;
+}
+
+int qpack_dyntable_test()
+{
+    int ret = 0;
+    h3zero_qpack_dyntable_t table;
+    h3zero_header_parts_t parts;
+    uint64_t error_found = 0;
+    uint8_t enc[256];
+    uint8_t hdr[64];
+    uint8_t* enc_last;
+    uint8_t* enc_insert = NULL;
+    uint8_t* hdr_last;
+    uint8_t* parsed;
+    char const* dyn_path = "/dyn/doc.html";
+
+    h3zero_qpack_dyntable_init(&table, 4096);
+
+    /* Set capacity 220, insert ":path" = dyn_path by static name
+     * reference, insert "x-trace" = "abc" with a literal name, then
+     * duplicate the path entry. */
+    enc[0] = 0x20;
+    enc_last = h3zero_qpack_int_encode(enc, enc + sizeof(enc), 0x1F, 220);
+    enc_insert = enc_last;
+    if (enc_last != NULL) {
+        enc_last[0] = 0xC0;
+        enc_last = h3zero_qpack_int_encode(enc_last, enc + sizeof(enc), 0x3F, 1);
+    }
+    enc_last = qpack_dyntable_encode_string(enc_last, enc + sizeof(enc), 0x00, 0x7F, dyn_path);
+    enc_last = qpack_dyntable_encode_string(enc_last, enc + sizeof(enc), 0x40, 0x1F, "x-trace");
+    enc_last = qpack_dyntable_encode_string(enc_last, enc + sizeof(enc), 0x00, 0x7F, "abc");
+    if (enc_last != NULL) {
+        enc_last[0] = 0x00;
+        enc_last = h3zero_qpack_int_encode(enc_last, enc + sizeof(enc), 0x1F, 1);
+    }
+    if (enc_last == NULL) {
+        DBG_PRINTF("%s", "Cannot encode the encoder stream instructions");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        parsed = h3zero_parse_qpack_encoder_stream(enc, enc_last, &table, &error_found);
+        if (parsed != enc_last || error_found != 0) {
+            DBG_PRINTF("Encoder stream parse fails, error 0x%" PRIx64, error_found);
+            ret = -1;
+        }
+        else if (table.insert_count != 3 || table.dropped_count != 0 || table.used_bytes != 142) {
+            DBG_PRINTF("Unexpected table state, %" PRIu64 " inserts, %" PRIu64 " bytes",
+                table.insert_count, table.used_bytes);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Verify that a partial instruction is left unconsumed */
+        h3zero_qpack_dyntable_t partial_table;
+
+        h3zero_qpack_dyntable_init(&partial_table, 4096);
+        parsed = h3zero_parse_qpack_encoder_stream(enc, enc_insert + 2, &partial_table, &error_found);
+        if (parsed != enc_insert || error_found != 0 || partial_table.insert_count != 0) {
+            DBG_PRINTF("%s", "Partial instruction was not held back");
+            ret = -1;
+        }
+        else {
+            parsed = h3zero_parse_qpack_encoder_stream(enc_insert, enc_last, &partial_table, &error_found);
+            if (parsed != enc_last || partial_table.insert_count != 3) {
+                DBG_PRINTF("%s", "Cannot resume a partial instruction");
+                ret = -1;
+            }
+        }
+        h3zero_qpack_dyntable_release(&partial_table);
+    }
+
+    if (ret == 0) {
+        /* Header block: required insert count 3 (encoded as 4), base 3,
+         * then method GET from the static table, the path entry by
+         * dynamic index, and the x-trace entry by dynamic name
+         * reference. */
+        hdr[0] = 0;
+        hdr_last = h3zero_qpack_int_encode(hdr, hdr + sizeof(hdr), 0xFF, 4);
+        if (hdr_last != NULL) {
+            *hdr_last++ = 0; /* S = 0, delta base = 0 */
+            *hdr_last++ = 0xC0 | H3ZERO_QPACK_CODE_GET;
+            hdr_last[0] = 0x80;
+            hdr_last = h3zero_qpack_int_encode(hdr_last, hdr + sizeof(hdr), 0x3F, 2);
+        }
+        if (hdr_last != NULL) {
+            hdr_last[0] = 0x40;
+            hdr_last = h3zero_qpack_int_encode(hdr_last, hdr + sizeof(hdr), 0x0F, 1);
+        }
+        hdr_last = qpack_dyntable_encode_string(hdr_last, hdr + sizeof(hdr), 0x00, 0x7F, "zzz");
+        if (hdr_last == NULL) {
+            DBG_PRINTF("%s", "Cannot encode the header block");
+            ret = -1;
+        }
+        else {
+            parsed = h3zero_parse_qpack_header_frame_ex(hdr, hdr_last, &parts, &table);
+            if (parsed != hdr_last) {
+                DBG_PRINTF("%s", "Cannot parse the dynamic header block");
+                ret = -1;
+            }
+            else if (parts.method != h3zero_method_get ||
+                parts.required_insert_count != 3 ||
+                parts.path_length != strlen(dyn_path) ||
+                parts.path == NULL ||
+                memcmp(parts.path, dyn_path, parts.path_length) != 0) {
+                DBG_PRINTF("%s", "Wrong values in the dynamic header block");
+                ret = -1;
+            }
+            h3zero_release_header_parts(&parts);
+        }
+    }
+
+    if (ret == 0) {
+        /* A required insert count larger than the insert count must be
+         * rejected, since we announce zero blocked streams */
+        uint8_t blocked[2] = { 5, 0 };
+
+        if (h3zero_parse_qpack_header_frame_ex(blocked, blocked + 2, &parts, &table) != NULL) {
+            DBG_PRINTF("%s", "Blocked header block was not rejected");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Reducing the capacity evicts the oldest entry, after which
+         * references to it must fail */
+        uint8_t shrink[2];
+        uint8_t dropped[3] = { 4, 0, 0x82 };
+
+        shrink[0] = 0x20;
+        enc_last = h3zero_qpack_int_encode(shrink, shrink + 2, 0x1F, 100);
+        parsed = h3zero_parse_qpack_encoder_stream(shrink, enc_last, &table, &error_found);
+        if (parsed != enc_last || table.dropped_count != 1 || table.used_bytes != 92) {
+            DBG_PRINTF("%s", "Capacity reduction did not evict the oldest entry");
+            ret = -1;
+        }
+        else if (h3zero_parse_qpack_header_frame_ex(dropped, dropped + 3, &parts, &table) != NULL) {
+            DBG_PRINTF("%s", "Reference to an evicted entry was not rejected");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 &&
+        h3zero_qpack_dyntable_set_capacity(&table, 8192) == 0) {
+        DBG_PRINTF("%s", "Capacity above the announced maximum was not rejected");
+        ret = -1;
+    }
+
+    h3zero_qpack_dyntable_release(&table);
+
+    return ret;
+}
+
+/* Test of the RFC 9218 extended priority header: parse a header block
+ * carrying a literal "priority" field, verify the urgency and
+ * incremental values, and check the mapping to stream priorities. */
+
+typedef struct st_h3zero_priority_test_case_t {
+    char const* field_value;
+    unsigned int priority_set;
+    int urgency;
+    unsigned int incremental;
+    uint8_t stream_priority;
+} h3zero_priority_test_case_t;
+
+static h3zero_priority_test_case_t priority_test_cases[] = {
+    { "u=2, i", 1, 2, 1, 6 },
+    { "i", 1, 3, 1, 8 },
+    { "u=9", 0, 3, 0, 0 },
+    { "u=5", 1, 5, 0, 13 },
+    { "u=0 , i=?1", 1, 0, 1, 2 }
+};
+
+static size_t nb_priority_test_cases = sizeof(priority_test_cases) / sizeof(h3zero_priority_test_case_t);
+
+int h3zero_priority_header_test()
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_priority_test_cases; i++) {
+        h3zero_priority_test_case_t* test_case = &priority_test_cases[i];
+        h3zero_header_parts_t parts;
+        uint8_t buffer[64];
+        uint8_t* bytes = buffer;
+        uint8_t* bytes_max = buffer + sizeof(buffer);
+        uint8_t* parsed;
+
+        /* Header block: no dynamic references, method GET from the
+         * static table, then "priority" with a literal name. */
+        *bytes++ = 0; /* required insert count = 0 */
+        *bytes++ = 0; /* S = 0, delta base = 0 */
+        *bytes++ = 0xC0 | H3ZERO_QPACK_CODE_GET;
+        bytes = qpack_dyntable_encode_string(bytes, bytes_max, 0x20, 0x07, "priority");
+        bytes = qpack_dyntable_encode_string(bytes, bytes_max, 0x00, 0x7F, test_case->field_value);
+
+        if (bytes == NULL) {
+            DBG_PRINTF("Cannot encode the priority header block %zu", i);
+            ret = -1;
+        }
+        else {
+            parsed = h3zero_parse_qpack_header_frame(buffer, bytes, &parts);
+            if (parsed != bytes) {
+                DBG_PRINTF("Cannot parse the priority header block %zu", i);
+                ret = -1;
+            }
+            else if (parts.method != h3zero_method_get ||
+                parts.priority_set != test_case->priority_set ||
+                parts.priority_urgency != test_case->urgency ||
+                parts.priority_incremental != test_case->incremental) {
+                DBG_PRINTF("Wrong priority values for \"%s\", set %u, u=%d, i=%u",
+                    test_case->field_value, parts.priority_set,
+                    parts.priority_urgency, parts.priority_incremental);
+                ret = -1;
+            }
+            else if (parts.priority_set &&
+                h3zero_map_extended_priority(&parts) != test_case->stream_priority) {
+                DBG_PRINTF("Wrong stream priority for \"%s\", got %u",
+                    test_case->field_value, h3zero_map_extended_priority(&parts));
+                ret = -1;
+            }
+            h3zero_release_header_parts(&parts);
+        }
+    }
+
+    return ret;
+}
+
 /*
- * Prepare frames of the different supported types, and 
+ * Prepare frames of the different supported types, and
  * verify that they can be decoded as expected
  */
 int h3zero_prepare_qpack_test()
@@ -1966,6 +2217,117 @@ int h09_server_test()
         0, 0, 0, 0, NULL, NULL, NULL, 0);
 }
 
+/* Test of the client connection pool: submit several requests for the
+ * same origin and verify that they are pipelined over a single pooled
+ * connection, including a request submitted after the first batch
+ * completed. */
+
+static int h3zero_client_pool_wait_idle(picoquic_test_tls_api_ctx_t* test_ctx,
+    picoquic_demo_client_pool_t* pool, uint64_t* simulated_time)
+{
+    int ret = 0;
+    int nb_trials = 0;
+    int was_active = 0;
+
+    while (ret == 0 && !(pool->first_cnx->callback_ctx.connection_ready &&
+        picoquic_demo_client_pool_is_idle(pool))) {
+        ret = tls_api_one_sim_round(test_ctx, simulated_time, 0, &was_active);
+        if (ret == 0) {
+            ret = picoquic_demo_client_pool_start_queued(pool);
+        }
+        if (++nb_trials > 100000) {
+            DBG_PRINTF("%s", "The pool did not become idle");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int h3zero_client_pool_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_demo_client_pool_t pool;
+    int nb_streams = 0;
+    int ret;
+
+    ret = tls_api_init_ctx_ex(&test_ctx,
+        PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOHTTP_ALPN_H3_LATEST, &simulated_time, NULL, NULL, 0, 1, 0, NULL);
+
+    if (ret == 0) {
+        picoquic_set_alpn_select_fn(test_ctx->qserver, picoquic_demo_server_callback_select_alpn);
+        picoquic_set_default_callback(test_ctx->qserver, picoquic_demo_server_callback, NULL);
+        /* The pool creates its own connections; the one prepared by
+         * the test harness is not needed. */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = NULL;
+
+        picoquic_demo_client_pool_init(&pool, test_ctx->qclient,
+            PICOHTTP_ALPN_H3_LATEST, 0, NULL, 1);
+
+        ret = picoquic_demo_client_pool_submit(&pool, PICOQUIC_TEST_SNI,
+            (struct sockaddr*)&test_ctx->server_addr, "index.html", 0, simulated_time);
+        if (ret == 0) {
+            ret = picoquic_demo_client_pool_submit(&pool, PICOQUIC_TEST_SNI,
+                (struct sockaddr*)&test_ctx->server_addr, "12345", 0, simulated_time);
+        }
+        if (ret == 0) {
+            if (pool.first_cnx == NULL || pool.first_cnx->next_cnx != NULL) {
+                DBG_PRINTF("%s", "Expected a single pooled connection");
+                ret = -1;
+            }
+            else {
+                pool.first_cnx->callback_ctx.no_print = 1;
+                test_ctx->cnx_client = pool.first_cnx->cnx;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = h3zero_client_pool_wait_idle(test_ctx, &pool, &simulated_time);
+    }
+
+    if (ret == 0) {
+        /* A request for the same origin must reuse the connection */
+        ret = picoquic_demo_client_pool_submit(&pool, PICOQUIC_TEST_SNI,
+            (struct sockaddr*)&test_ctx->server_addr, "54321", 0, simulated_time);
+        if (ret == 0 && pool.first_cnx->next_cnx != NULL) {
+            DBG_PRINTF("%s", "The pooled connection was not reused");
+            ret = -1;
+        }
+        if (ret == 0) {
+            ret = h3zero_client_pool_wait_idle(test_ctx, &pool, &simulated_time);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_demo_client_stream_ctx_t* stream = pool.first_cnx->callback_ctx.first_stream;
+
+        while (stream != NULL) {
+            if (stream->received_length == 0) {
+                DBG_PRINTF("Stream %" PRIu64 " received no data", stream->stream_id);
+                ret = -1;
+            }
+            nb_streams++;
+            stream = stream->next_stream;
+        }
+        if (ret == 0 && nb_streams != 3) {
+            DBG_PRINTF("Expected 3 pooled streams, got %d", nb_streams);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        picoquic_demo_client_pool_release(&pool);
+        test_ctx->cnx_client = NULL;
+        tls_api_delete_ctx(test_ctx);
+    }
+
+    return ret;
+}
+
 /* Unit test of H09 header parsing. 
  * test a variety of headers
  */
@@ -2554,6 +2916,170 @@ int demo_server_file_test()
     return ret;
 }
 
+/* Unit test of the static file cache: hit and miss accounting, LRU
+ * eviction under the byte budget, and release of entries evicted or
+ * deleted while still referenced. */
+static int filecache_write_file(const char* file_name, size_t length, uint8_t seed)
+{
+    int ret = -1;
+    FILE* F = picoquic_file_open(file_name, "wb");
+
+    if (F != NULL) {
+        ret = 0;
+        for (size_t i = 0; ret == 0 && i < length; i++) {
+            if (fputc((seed + i) & 0xFF, F) == EOF) {
+                ret = -1;
+            }
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+static int filecache_check_entry(h3zero_filecache_entry_t* entry, size_t length, uint8_t seed)
+{
+    int ret = 0;
+
+    if (entry == NULL || entry->data_length != length) {
+        ret = -1;
+    }
+    else {
+        for (size_t i = 0; ret == 0 && i < length; i++) {
+            if (entry->data[i] != ((seed + i) & 0xFF)) {
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int h3zero_filecache_test()
+{
+    int ret = 0;
+    static const char* file_name[3] = {
+        "filecache_test_1.bin", "filecache_test_2.bin", "filecache_test_3.bin" };
+    static const size_t file_length[3] = { 100, 200, 300 };
+    h3zero_filecache_t* cache = h3zero_filecache_create(550);
+
+    if (cache == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        ret = filecache_write_file(file_name[i], file_length[i], (uint8_t)i);
+    }
+
+    /* Load the three files; the budget only holds the last two */
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        h3zero_filecache_entry_t* entry = h3zero_filecache_get(cache, file_name[i]);
+
+        if (filecache_check_entry(entry, file_length[i], (uint8_t)i) != 0) {
+            DBG_PRINTF("Cannot load file %d in the cache", i);
+            ret = -1;
+        }
+        h3zero_filecache_release(entry);
+    }
+
+    if (ret == 0 && (cache->nb_misses != 3 || cache->nb_hits != 0 ||
+        cache->cached_bytes > cache->byte_budget)) {
+        DBG_PRINTF("After 3 loads: %" PRIu64 " misses, %" PRIu64 " hits, %" PRIu64 " bytes",
+            cache->nb_misses, cache->nb_hits, cache->cached_bytes);
+        ret = -1;
+    }
+
+    /* The most recently used file is still cached, the oldest was evicted */
+    if (ret == 0) {
+        h3zero_filecache_entry_t* entry = h3zero_filecache_get(cache, file_name[2]);
+
+        if (filecache_check_entry(entry, file_length[2], 2) != 0 || cache->nb_hits != 1) {
+            DBG_PRINTF("%s", "Most recent file not served from the cache");
+            ret = -1;
+        }
+        h3zero_filecache_release(entry);
+
+        if (ret == 0) {
+            entry = h3zero_filecache_get(cache, file_name[0]);
+            if (filecache_check_entry(entry, file_length[0], 0) != 0 || cache->nb_misses != 4) {
+                DBG_PRINTF("%s", "Evicted file not reloaded as a miss");
+                ret = -1;
+            }
+            h3zero_filecache_release(entry);
+        }
+    }
+
+    /* An entry still referenced when the cache is deleted survives
+     * until its release */
+    if (ret == 0) {
+        h3zero_filecache_entry_t* entry = h3zero_filecache_get(cache, file_name[1]);
+
+        if (entry == NULL) {
+            ret = -1;
+        }
+        else {
+            h3zero_filecache_delete(cache);
+            cache = NULL;
+            if (!entry->is_evicted || filecache_check_entry(entry, file_length[1], 1) != 0) {
+                DBG_PRINTF("%s", "Referenced entry not preserved across cache deletion");
+                ret = -1;
+            }
+            h3zero_filecache_release(entry);
+        }
+    }
+
+    if (cache != NULL) {
+        h3zero_filecache_delete(cache);
+    }
+    for (int i = 0; i < 3; i++) {
+        (void)remove(file_name[i]);
+    }
+
+    return ret;
+}
+
+/* The file serving scenario of demo_server_file_test, with the static
+ * file cache enabled: the first connection loads the file in the
+ * cache, the second is served from it. */
+int demo_server_file_cache_test()
+{
+    int ret = 0;
+    char file_name_buffer[1024];
+    picohttp_server_parameters_t file_param;
+    h3zero_filecache_t* file_cache = h3zero_filecache_create(0x100000);
+
+    ret = serve_file_test_set_param(&file_param, file_name_buffer, sizeof(file_name_buffer));
+
+    if (file_cache == NULL) {
+        ret = -1;
+    }
+    else {
+        file_param.file_cache = file_cache;
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if ((ret = demo_server_test(PICOHTTP_ALPN_H3_LATEST, h3zero_callback, (void*)&file_param,
+            file_test_scenario, nb_file_test_scenario, demo_file_test_stream_length, 0, 0, 0, 0, NULL, NULL, NULL, 0)) != 0) {
+            DBG_PRINTF("H3 server cached file test fails at pass %d, ret = %d\n", i, ret);
+        }
+        else {
+            ret = file_test_compare(&file_param, &file_test_scenario[0]);
+        }
+    }
+
+    if (ret == 0 && (file_cache->nb_misses != 1 || file_cache->nb_hits < 1)) {
+        DBG_PRINTF("File cache saw %" PRIu64 " misses, %" PRIu64 " hits",
+            file_cache->nb_misses, file_cache->nb_hits);
+        ret = -1;
+    }
+
+    if (file_cache != NULL) {
+        h3zero_filecache_delete(file_cache);
+    }
+
+    return ret;
+}
+
 static const picoquic_demo_stream_desc_t satellite_test_scenario[] = {
     { 0, 0, PICOQUIC_DEMO_STREAM_ID_INITIAL, "/10000000", "bin10M.txt", 0 }
 };
@@ -200,3 +200,167 @@ int picohash_embedded_test()
 {
     return(picohash_test_one(1));
 }
+
+/* Test of the incremental migration window. Build a long collision
+ * cluster in a 16 bin table, trigger a growth, and check that every
+ * entry remains retrievable and deletable while the old array is only
+ * partially drained. A migration step that breaks the old array's probe
+ * chains makes the tail of the cluster unreachable after the first
+ * batch. */
+int picohash_migration_test()
+{
+    int ret = 0;
+    picohash_table* t = picohash_create_ex(16, hashtest_hash, hashtest_compare, hashtest_key_to_item);
+    struct hashtestkey hk;
+
+    if (t == NULL) {
+        DBG_PRINTF("%s", "picohash_create_ex() failed\n");
+        ret = -1;
+    }
+    else {
+        /* Keys 1 + 16*j all hash to the same home slot of the 16 bin
+         * array, forming one cluster of 12 entries. The 12th insert
+         * passes the 3/4 load threshold and starts a migration. */
+        for (uint64_t j = 0; ret == 0 && j < 12; j++) {
+            if (picohash_insert(t, hashtest_item(1 + 16 * j)) != 0) {
+                DBG_PRINTF("picohash_insert(1 + 16 * %"PRId64") failed\n", j);
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 && t->old_slots == NULL) {
+            DBG_PRINTF("%s", "Table growth was not triggered\n");
+            ret = -1;
+        }
+
+        /* The next insert migrates a first batch of old slots, fewer
+         * than the cluster length. All entries must stay reachable. */
+        if (ret == 0 && picohash_insert(t, hashtest_item(2)) != 0) {
+            DBG_PRINTF("%s", "picohash_insert(2) failed\n");
+            ret = -1;
+        }
+
+        if (ret == 0 && t->old_slots == NULL) {
+            DBG_PRINTF("%s", "Old array drained in a single batch\n");
+            ret = -1;
+        }
+
+        for (uint64_t j = 0; ret == 0 && j < 12; j++) {
+            hk.x = 1 + 16 * j;
+            if (picohash_retrieve(t, &hk) == NULL) {
+                DBG_PRINTF("picohash_retrieve(1 + 16 * %"PRId64") failed during migration\n", j);
+                ret = -1;
+            }
+        }
+
+        /* Delete an entry that still lives in the old array */
+        if (ret == 0) {
+            picohash_item* pi;
+
+            hk.x = 1 + 16 * 10;
+            pi = picohash_retrieve(t, &hk);
+            if (pi == NULL) {
+                DBG_PRINTF("%s", "picohash_retrieve(1 + 16 * 10) failed\n");
+                ret = -1;
+            }
+            else {
+                picohash_delete_item(t, pi, 1);
+                if (picohash_retrieve(t, &hk) != NULL) {
+                    DBG_PRINTF("%s", "Deleted entry still found during migration\n");
+                    ret = -1;
+                }
+            }
+        }
+
+        /* Drain the old array through subsequent inserts and verify the
+         * surviving entries */
+        for (uint64_t j = 0; ret == 0 && j < 4 && t->old_slots != NULL; j++) {
+            if (picohash_insert(t, hashtest_item(3 + 16 * j)) != 0) {
+                DBG_PRINTF("picohash_insert(3 + 16 * %"PRId64") failed\n", j);
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 && t->old_slots != NULL) {
+            DBG_PRINTF("%s", "Old array not drained after migration\n");
+            ret = -1;
+        }
+
+        for (uint64_t j = 0; ret == 0 && j < 12; j++) {
+            if (j == 10) {
+                continue;
+            }
+            hk.x = 1 + 16 * j;
+            if (picohash_retrieve(t, &hk) == NULL) {
+                DBG_PRINTF("picohash_retrieve(1 + 16 * %"PRId64") failed after migration\n", j);
+                ret = -1;
+            }
+        }
+
+        picohash_delete(t, 1);
+    }
+
+    return ret;
+}
+
+/* Test of the container statistics export: occupancy of the connection
+ * lookup tables is reported, and grows as connections are created. The
+ * probe counters are only collected when the library is built with
+ * PICOQUIC_CONTAINER_STATS, so the test only checks occupancy.
+ */
+int container_stats_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_container_stats_t stats;
+    struct sockaddr_in saddr;
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_get_container_stats(quic, &stats);
+        if (stats.cnx_by_id.nb_entries != 0 || stats.cnx_by_id.nb_slots == 0 ||
+            (stats.cnx_by_id.nb_slots & (stats.cnx_by_id.nb_slots - 1)) != 0) {
+            DBG_PRINTF("Bad initial table stats: %" PRIu64 " entries, %" PRIu64 " slots",
+                stats.cnx_by_id.nb_entries, stats.cnx_by_id.nb_slots);
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 4; i++) {
+        picoquic_connection_id_t icid = { { 0xc5, 0, 0, 0, 0, 0, 0, 0 }, 8 };
+
+        icid.id[7] = (uint8_t)(i + 1);
+        if (picoquic_create_cnx(quic, icid, picoquic_null_connection_id,
+            (struct sockaddr*) & saddr, 0, 0, "test-sni", "test-alpn", 1) == NULL) {
+            DBG_PRINTF("Cannot create connection %d", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_get_container_stats(quic, &stats);
+        if (stats.cnx_by_id.nb_entries == 0 ||
+            stats.cnx_by_id.nb_entries > stats.cnx_by_id.nb_slots) {
+            DBG_PRINTF("Bad table stats after connections: %" PRIu64 " entries, %" PRIu64 " slots",
+                stats.cnx_by_id.nb_entries, stats.cnx_by_id.nb_slots);
+            ret = -1;
+        }
+        else if (stats.token_reuse.nb_nodes != 0) {
+            DBG_PRINTF("Unexpected token reuse nodes: %" PRIu64, stats.token_reuse.nb_nodes);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -324,7 +324,54 @@ int varint_test()
             }
         }
     }
- 
+
+    /* Batch decoder: encode a mixed length sequence, then check that
+     * picoquic_varint_decode_batch agrees with the one at a time
+     * decoder for every buffer truncation and every batch size cap. */
+    if (ret == 0) {
+        const uint64_t batch_values[] = { 0, 63, 64, 16383, 16384, 1073741823, 1073741824,
+            0x3FFFFFFFFFFFFFFFull, 5, 300, 70000, 12 };
+        const size_t nb_batch_values = sizeof(batch_values) / sizeof(uint64_t);
+        uint8_t batch_buf[64];
+        size_t batch_len = 0;
+
+        for (size_t i = 0; i < nb_batch_values; i++) {
+            batch_len += picoquic_varint_encode(batch_buf + batch_len, sizeof(batch_buf) - batch_len, batch_values[i]);
+        }
+
+        for (size_t max_bytes = 0; ret == 0 && max_bytes <= batch_len; max_bytes++) {
+            for (size_t nb_max = 0; ret == 0 && nb_max <= nb_batch_values + 1; nb_max++) {
+                uint64_t decoded[16];
+                size_t nb_decoded = 0;
+                size_t consumed = picoquic_varint_decode_batch(batch_buf, max_bytes, decoded, nb_max, &nb_decoded);
+                size_t byte_index = 0;
+                size_t expected_nb = 0;
+
+                while (expected_nb < nb_max) {
+                    uint64_t n64;
+                    size_t l = picoquic_varint_decode(batch_buf + byte_index, max_bytes - byte_index, &n64);
+                    if (l == 0) {
+                        break;
+                    }
+                    if (expected_nb >= nb_decoded || decoded[expected_nb] != n64) {
+                        DBG_PRINTF("Varint batch: value %" PRIst " mismatch (max_bytes=%" PRIst ", nb_max=%" PRIst ")",
+                            expected_nb, max_bytes, nb_max);
+                        ret = -1;
+                        break;
+                    }
+                    byte_index += l;
+                    expected_nb++;
+                }
+
+                if (ret == 0 && (nb_decoded != expected_nb || consumed != byte_index)) {
+                    DBG_PRINTF("Varint batch: decoded %" PRIst "/%" PRIst ", consumed %" PRIst "/%" PRIst,
+                        nb_decoded, expected_nb, consumed, byte_index);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
     return ret;
 }
 
@@ -161,6 +161,25 @@ int l4s_prague_updown_test()
     return ret;
 }
 
+/* Sub millisecond RTT matrix, exercising the prague RTT independence
+ * and fractional window accumulation at data center like RTTs. */
+test_vary_link_spec_t l4s_link_subms[] = {
+    { 1000000, 100000000, 100000000, 250},
+    { 1000000,  50000000,  50000000, 400},
+    { 6000000, 100000000, 100000000, 250},
+};
+
+size_t nb_l4s_link_subms = sizeof(l4s_link_subms) / sizeof(test_vary_link_spec_t);
+
+int l4s_prague_subms_test()
+{
+    picoquic_congestion_algorithm_t* ccalgo = picoquic_prague_algorithm;
+
+    int ret = l4s_congestion_test(ccalgo, 1, 5000000, 55, 6000, nb_l4s_link_subms, l4s_link_subms);
+
+    return ret;
+}
+
 int l4s_bbr_updown_test()
 {
 #if defined(_WINDOWS) && !defined(_WINDOWS64)
@@ -451,7 +451,10 @@ typedef enum {
     multipath_test_tunnel,
     multipath_test_fail,
     multipath_test_ab1,
-    multipath_test_discovery
+    multipath_test_discovery,
+    multipath_test_min_rtt,
+    multipath_test_redundant,
+    multipath_test_fast_abandon
 } multipath_test_enum_t;
 
 #ifdef _WINDOWS
@@ -905,13 +908,20 @@ int multipath_test_one(uint64_t max_completion_microsec, multipath_test_enum_t t
             test_id == multipath_test_standup) {
             ret = picoquic_set_path_status(test_ctx->cnx_client, 1, picoquic_path_status_standby);
         }
+        else if (test_id == multipath_test_min_rtt) {
+            picoquic_set_multipath_scheduler(test_ctx->cnx_client, picoquic_multipath_scheduler_min_rtt);
+        }
+        else if (test_id == multipath_test_redundant) {
+            picoquic_set_multipath_scheduler(test_ctx->cnx_client, picoquic_multipath_scheduler_redundant);
+        }
     }
 
     if (ret == 0 && (test_id == multipath_test_drop_first || test_id == multipath_test_drop_second ||
         test_id == multipath_test_renew || test_id == multipath_test_nat || test_id == multipath_test_nat_challenge ||
         test_id == multipath_test_break1 || test_id == multipath_test_break2 ||
         test_id == multipath_test_back1 || test_id == multipath_test_standup ||
-        test_id == multipath_test_abandon || test_id == multipath_test_tunnel)) {
+        test_id == multipath_test_abandon || test_id == multipath_test_tunnel ||
+        test_id == multipath_test_fast_abandon)) {
         /* If testing a final link drop before completion, perform a 
          * partial sending loop and then kill the initial link.
          * For the tunnel scenario, do the same but kill both links.
@@ -1026,6 +1036,21 @@ int multipath_test_one(uint64_t max_completion_microsec, multipath_test_enum_t t
         }
     }
 
+    if (ret == 0 && test_id == multipath_test_fast_abandon) {
+        /* The failed path should have been demoted after a few PTOs,
+         * instead of being nursed through the full backoff series. */
+        int nb_active_paths = 0;
+        for (int i = 0; i < test_ctx->cnx_client->nb_paths; i++) {
+            if (!test_ctx->cnx_client->path[i]->path_is_demoted) {
+                nb_active_paths++;
+            }
+        }
+        if (nb_active_paths != 1) {
+            DBG_PRINTF("Expected 1 active path after fast abandon, got %d\n", nb_active_paths);
+            ret = -1;
+        }
+    }
+
     if (ret == 0 && test_id == multipath_test_fail) {
         if (test_ctx->cnx_client->nb_paths != 1 ||
             (test_ctx->cnx_server != NULL && test_ctx->cnx_server->nb_paths != 1)) {
@@ -1237,6 +1262,18 @@ int multipath_drop_second_test()
     return multipath_test_one(max_completion_microsec, multipath_test_drop_second);
 }
 
+/* Fast abandon test. Same link drop as "drop second", but verifies that
+ * the failed path is demoted after a few per-path PTOs instead of the
+ * full backoff series, since the other path is healthy.
+ */
+
+int multipath_fast_abandon_test()
+{
+    uint64_t max_completion_microsec = 1260000;
+
+    return multipath_test_one(max_completion_microsec, multipath_test_fast_abandon);
+}
+
 /* Simulate the combination of a satellite link and a low latency low bandwidth
  * terrestrial link
  */
@@ -1399,6 +1436,26 @@ int multipath_discovery_test()
     return multipath_test_one(max_completion_microsec, multipath_test_discovery);
 }
 
+/* Test the min RTT packet scheduler. Same scenario as basic, but the client
+ * steers data to the lowest RTT path instead of the least recently used one.
+ */
+int multipath_min_rtt_test()
+{
+    uint64_t max_completion_microsec = 1300000;
+
+    return multipath_test_one(max_completion_microsec, multipath_test_min_rtt);
+}
+
+/* Test the redundant packet scheduler. The duplication relies on preemptive
+ * repeats across paths, so the transfer completes but may take a bit longer.
+ */
+int multipath_redundant_test()
+{
+    uint64_t max_completion_microsec = 2000000;
+
+    return multipath_test_one(max_completion_microsec, multipath_test_redundant);
+}
+
 /* Monopath tests:
  * Enable the multipath option, but use only a single path. The gal of the tests is to verify that
  * these "monopath" scenarios perform just as well as if multipath was not enabled.
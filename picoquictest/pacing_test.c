@@ -122,6 +122,115 @@ int pacing_test()
     return ret;
 }
 
+/* Test of the global slow start admission limiter. Two connections are
+ * created in the same context with an admission rate set; both paths are
+ * in slow start, so their aggregate send rate should match the cap.
+ * Once a path is marked out of slow start, it is no longer limited.
+ */
+int pacing_admission_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx[2] = { NULL, NULL };
+    struct sockaddr_in saddr;
+    const uint64_t test_byte_per_sec = 1250000;
+    int nb_sent = 0;
+    int nb_round = 0;
+    const int nb_target = 10000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_slow_start_admission_rate(quic, test_byte_per_sec);
+
+        for (int i = 0; ret == 0 && i < 2; i++) {
+            cnx[i] = picoquic_create_cnx(quic,
+                picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+                current_time, 0, "test-sni", "test-alpn", 1);
+
+            if (cnx[i] == NULL) {
+                DBG_PRINTF("Cannot create connection %d\n", i);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Send packets alternating between the two connections. The per path
+     * pacers are at their permissive defaults, so the admission bucket is
+     * the only effective limit. */
+    while (ret == 0 && nb_sent < nb_target) {
+        nb_round++;
+        if (nb_round > 8 * nb_target) {
+            DBG_PRINTF("Admission pacing needs more than %d rounds for %d packets", nb_round, nb_target);
+            ret = -1;
+        }
+        else {
+            uint64_t next_time = current_time + 10000000;
+            picoquic_cnx_t* cnx_x = cnx[nb_sent & 1];
+
+            if (picoquic_is_sending_authorized_by_pacing(cnx_x, cnx_x->path[0], current_time, &next_time)) {
+                nb_sent++;
+                picoquic_update_pacing_after_send(cnx_x->path[0], cnx_x->path[0]->send_mtu, current_time);
+            }
+            else {
+                if (current_time < next_time) {
+                    current_time = next_time;
+                }
+                else {
+                    DBG_PRINTF("Admission pacing next = %" PRIu64", current = %" PRIu64, next_time, current_time);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    /* Verify that the aggregate send time matches the admission rate,
+     * allowing for the initial window worth of bucket credit. */
+    if (ret == 0) {
+        uint64_t volume_sent = ((uint64_t)nb_target) * cnx[0]->path[0]->send_mtu;
+        uint64_t time_max = ((volume_sent * 1000000) / test_byte_per_sec) + 1;
+        uint64_t time_min = (((volume_sent - PICOQUIC_CWIN_INITIAL) * 1000000) / test_byte_per_sec) + 1;
+
+        if (current_time > time_max) {
+            DBG_PRINTF("Admission pacing used = %" PRIu64", expected max = %" PRIu64, current_time, time_max);
+            ret = -1;
+        }
+        else if (current_time < time_min) {
+            DBG_PRINTF("Admission pacing used = %" PRIu64", expected min = %" PRIu64, current_time, time_min);
+            ret = -1;
+        }
+    }
+
+    /* A path that has exited slow start should not be limited, even when
+     * the admission bucket is empty. */
+    if (ret == 0) {
+        uint64_t next_time = current_time + 10000000;
+
+        cnx[0]->path[0]->is_ssthresh_initialized = 1;
+        if (!picoquic_is_sending_authorized_by_pacing(cnx[0], cnx[0]->path[0], current_time, &next_time)) {
+            DBG_PRINTF("%s", "Admission pacing limits a path out of slow start\n");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /* Test effects of leaky bucket pacer
 */
 
@@ -242,6 +351,95 @@ int pacing_newreno_test()
 }
 
 
+/* Test of the pacing policy knobs set by picoquic_set_pacing_policy:
+ * the wakeups per RTT target and the burst ceiling both act on the
+ * pacing quantum, which is observable through the bucket size. */
+
+static int pacing_policy_check(picoquic_cnx_t* cnx, uint64_t cwin, size_t send_mtu, uint64_t rtt,
+    uint64_t expected_quantum)
+{
+    int ret = 0;
+    picoquic_pacing_t* pacing = &cnx->path[0]->pacing;
+    double pacing_rate = ((double)cwin / (double)(rtt * 1000)) * 1000000000.0;
+    int64_t expected_bucket = (int64_t)(((double)expected_quantum / pacing_rate) * 1000000000.0);
+    int64_t delta;
+
+    picoquic_update_pacing_window(pacing, 0, cwin, send_mtu, rtt, cnx->path[0]);
+    delta = pacing->bucket_max - expected_bucket;
+    if (delta < -(expected_bucket / 1000) - 2 || delta > (expected_bucket / 1000) + 2) {
+        DBG_PRINTF("Expected bucket max %" PRId64 ", got %" PRId64, expected_bucket, pacing->bucket_max);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int pacing_policy_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t cwin = 256000;
+    const size_t send_mtu = 1536;
+    const uint64_t rtt = 10000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Default policy: quantum is cwin/4, capped at 16 packets */
+        ret = pacing_policy_check(cnx, cwin, send_mtu, rtt, 16 * send_mtu);
+    }
+    if (ret == 0) {
+        /* Eight wakeups per RTT: quantum is one eighth of the window */
+        picoquic_set_pacing_policy(quic, 8, 0);
+        ret = pacing_policy_check(cnx, cwin, send_mtu, rtt, cwin / 8);
+    }
+    if (ret == 0) {
+        /* The burst ceiling caps the quantum */
+        picoquic_set_pacing_policy(quic, 8, 4096);
+        ret = pacing_policy_check(cnx, cwin, send_mtu, rtt, 4096);
+    }
+    if (ret == 0) {
+        /* The wakeup target cannot shrink the quantum below two packets */
+        picoquic_set_pacing_policy(quic, 1000, 0);
+        ret = pacing_policy_check(cnx, cwin, send_mtu, rtt, 2 * send_mtu);
+    }
+    if (ret == 0) {
+        /* Resetting the policy restores the default computation */
+        picoquic_set_pacing_policy(quic, 0, 0);
+        ret = pacing_policy_check(cnx, cwin, send_mtu, rtt, 16 * send_mtu);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /* Verify that pacing provides repeatable results
  */
 
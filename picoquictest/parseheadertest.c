@@ -589,7 +589,7 @@ int test_packet_decrypt_one(
         current_time,
         decrypted_data,
         &received_ph, &server_cnx,
-        &consumed, &new_context_created);
+        &consumed, &new_context_created, NULL);
 
     /* verify that decryption matches original value */
     if (decoding_return != expected_return) {
@@ -652,6 +652,7 @@ int test_packet_encrypt_one(
     size_t checksum_overhead = 0;
     size_t send_length = 0;
     uint8_t send_buffer[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t packet_bytes[PICOQUIC_MAX_PACKET_SIZE];
     picoquic_path_t * path_x = cnx_client->path[0];
     uint64_t current_time = 0;
     picoquic_packet_header expected_header;
@@ -667,6 +668,8 @@ int test_packet_encrypt_one(
         pkt_ctx = (ptype == picoquic_packet_1rtt_protected && cnx_client->is_multipath_enabled) ?
             &path_x->pkt_ctx : &cnx_client->pkt_ctx[pc];
         memset(packet, 0, sizeof(picoquic_packet_t));
+        packet->bytes = packet_bytes;
+        packet->bytes_alloc = sizeof(packet_bytes);
         memset(packet->bytes, 0xbb, length);
         header_length = picoquic_predict_packet_header_length(cnx_client, ptype, pkt_ctx);
         packet->ptype = ptype;
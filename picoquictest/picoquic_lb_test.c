@@ -1211,4 +1211,248 @@ int cid_for_lb_cli_test()
     }
     /* Done */
     return ret;
-}
\ No newline at end of file
+}
+
+/* Batch verification and hot reload tests.
+ * Configure the block cipher method, generate a set of CID with varying
+ * "server use" bytes, and check that the batched verification returns the
+ * same server ID as the per-CID call for each of them, with UINT64_MAX for
+ * a malformed CID. Then update the configuration in place, verifying that
+ * CID generated after the update carry the new server ID and that a
+ * rejected update leaves the previous configuration active.
+ */
+#define CID_FOR_LB_BATCH_NB 49
+
+int cid_for_lb_batch_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+    picoquic_load_balancer_config_t config = {
+        picoquic_load_balancer_cid_block_cipher,
+        0, 0, 2, 0, 17, 0x3456,
+        { CID_ENCRYPTION_KEY }
+    };
+    picoquic_load_balancer_config_t updated = {
+        picoquic_load_balancer_cid_block_cipher,
+        0, 0, 2, 0, 17, 0x789a,
+        { 16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1 }
+    };
+    picoquic_load_balancer_config_t bad_update = {
+        picoquic_load_balancer_cid_block_cipher,
+        0, 0, 2, 0, 5, 0x1111,
+        { CID_ENCRYPTION_KEY }
+    };
+    picoquic_connection_id_t batch[CID_FOR_LB_BATCH_NB];
+    uint64_t server_id64[CID_FOR_LB_BATCH_NB];
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Could not create the quic context.");
+        ret = -1;
+    }
+    else {
+        ret = picoquic_lb_compat_cid_config(quic, &config);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Could not configure the load balancer context.");
+        }
+    }
+
+    if (ret == 0) {
+        /* Generate a batch of CID, with varied server use bytes */
+        for (size_t i = 0; i < CID_FOR_LB_BATCH_NB; i++) {
+            memset(&batch[i], 0, sizeof(picoquic_connection_id_t));
+            batch[i].id_len = 17;
+            batch[i].id[16] = (uint8_t)i;
+            batch[i].id[8] = (uint8_t)(0x80 + i);
+            quic->cnx_id_callback_fn(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+                quic->cnx_id_callback_ctx, &batch[i]);
+        }
+        /* Truncate the last CID so it is rejected */
+        batch[CID_FOR_LB_BATCH_NB - 1].id_len = 8;
+
+        picoquic_lb_compat_cid_verify_batch(quic, quic->cnx_id_callback_ctx,
+            batch, CID_FOR_LB_BATCH_NB, server_id64);
+
+        for (size_t i = 0; ret == 0 && i < CID_FOR_LB_BATCH_NB; i++) {
+            uint64_t expected = (i == CID_FOR_LB_BATCH_NB - 1) ? UINT64_MAX :
+                picoquic_lb_compat_cid_verify(quic, quic->cnx_id_callback_ctx, &batch[i]);
+
+            if (i != CID_FOR_LB_BATCH_NB - 1 && expected != config.server_id64) {
+                DBG_PRINTF("Batch CID %zu decodes to %" PRIu64 " per CID", i, expected);
+                ret = -1;
+            }
+            else if (server_id64[i] != expected) {
+                DBG_PRINTF("Batch CID %zu decodes to %" PRIu64 " instead of %" PRIu64,
+                    i, server_id64[i], expected);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* An invalid update must fail and leave the configuration in place */
+        if (picoquic_lb_compat_cid_config_update(quic, &bad_update) == 0) {
+            DBG_PRINTF("%s", "Invalid update was accepted.");
+            ret = -1;
+        }
+        else if (picoquic_lb_compat_cid_verify(quic, quic->cnx_id_callback_ctx, &batch[0]) != config.server_id64) {
+            DBG_PRINTF("%s", "Old configuration lost after rejected update.");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A valid update replaces the mapping without draining */
+        ret = picoquic_lb_compat_cid_config_update(quic, &updated);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Could not update the load balancer context.");
+        }
+        else {
+            picoquic_connection_id_t result;
+
+            memset(&result, 0, sizeof(picoquic_connection_id_t));
+            result.id_len = 17;
+            quic->cnx_id_callback_fn(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+                quic->cnx_id_callback_ctx, &result);
+            if (picoquic_lb_compat_cid_verify(quic, quic->cnx_id_callback_ctx, &result) != updated.server_id64) {
+                DBG_PRINTF("%s", "CID generated after update carries the wrong server ID.");
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_lb_compat_cid_config_free(quic);
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the hot restart state handover: the resumption-critical state of
+ * one quic context is exported as a blob and imported into a second one,
+ * as the application would do across a binary upgrade. The second context
+ * must share the reset and retry seeds, decrypt what the first one
+ * encrypted with the ticket and retry token keys, and decode the server
+ * ID from CID generated by the first one.
+ */
+int hot_restart_state_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t ticket_key[16] = { 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25 };
+    uint8_t token_key[16] = { 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45 };
+    picoquic_load_balancer_config_t config = {
+        picoquic_load_balancer_cid_block_cipher,
+        0, 0, 2, 0, 17, 0x3456,
+        { CID_ENCRYPTION_KEY }
+    };
+    uint8_t blob[512];
+    size_t blob_length = 0;
+    picoquic_quic_t* quic_old = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, ticket_key, sizeof(ticket_key));
+    picoquic_quic_t* quic_new = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic_old == NULL || quic_new == NULL) {
+        DBG_PRINTF("%s", "Could not create the quic contexts.");
+        ret = -1;
+    }
+    else if (picoquic_set_retry_token_key(quic_old, token_key, sizeof(token_key)) != 0 ||
+        picoquic_lb_compat_cid_config(quic_old, &config) != 0) {
+        DBG_PRINTF("%s", "Could not configure the old context.");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_stop_accepting(quic_old);
+        if (!quic_old->server_busy) {
+            DBG_PRINTF("%s", "Stop accepting did not mark the context busy.");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_export_restart_state(quic_old, blob, sizeof(blob), &blob_length);
+        if (ret != 0 || blob_length == 0) {
+            DBG_PRINTF("Export fails, ret = 0x%x", ret);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_import_restart_state(quic_new, blob, blob_length);
+        if (ret != 0) {
+            DBG_PRINTF("Import fails, ret = 0x%x", ret);
+        }
+    }
+
+    if (ret == 0 &&
+        (memcmp(quic_old->reset_seed, quic_new->reset_seed, sizeof(quic_old->reset_seed)) != 0 ||
+            memcmp(quic_old->retry_seed, quic_new->retry_seed, sizeof(quic_old->retry_seed)) != 0)) {
+        DBG_PRINTF("%s", "Seeds differ after import.");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* The new context must decrypt what the old one encrypted */
+        uint8_t clear_text[32] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        uint8_t encrypted[64];
+        uint8_t decrypted[64];
+        size_t encrypted_length;
+        size_t decrypted_length;
+
+        encrypted_length = picoquic_aead_encrypt_generic(encrypted, clear_text, sizeof(clear_text),
+            0, NULL, 0, quic_old->aead_encrypt_ticket_ctx);
+        decrypted_length = picoquic_aead_decrypt_generic(decrypted, encrypted, encrypted_length,
+            0, NULL, 0, quic_new->aead_decrypt_ticket_ctx);
+        if (decrypted_length != sizeof(clear_text) ||
+            memcmp(decrypted, clear_text, sizeof(clear_text)) != 0) {
+            DBG_PRINTF("%s", "Ticket key was not handed over.");
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            encrypted_length = picoquic_aead_encrypt_generic(encrypted, clear_text, sizeof(clear_text),
+                0, NULL, 0, quic_old->aead_encrypt_retry_token_ctx);
+            decrypted_length = picoquic_aead_decrypt_generic(decrypted, encrypted, encrypted_length,
+                0, NULL, 0, quic_new->aead_decrypt_retry_token_ctx);
+            if (decrypted_length != sizeof(clear_text) ||
+                memcmp(decrypted, clear_text, sizeof(clear_text)) != 0) {
+                DBG_PRINTF("%s", "Retry token key was not handed over.");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* A CID generated by the old context decodes on the new one */
+        picoquic_connection_id_t cid;
+
+        memset(&cid, 0, sizeof(picoquic_connection_id_t));
+        cid.id_len = 17;
+        cid.id[16] = 0x5a;
+        quic_old->cnx_id_callback_fn(quic_old, picoquic_null_connection_id, picoquic_null_connection_id,
+            quic_old->cnx_id_callback_ctx, &cid);
+        if (quic_new->cnx_id_callback_fn != picoquic_lb_compat_cid_generate ||
+            picoquic_lb_compat_cid_verify(quic_new, quic_new->cnx_id_callback_ctx, &cid) != config.server_id64) {
+            DBG_PRINTF("%s", "Load balancer configuration was not handed over.");
+            ret = -1;
+        }
+    }
+
+    if (quic_old != NULL) {
+        picoquic_lb_compat_cid_config_free(quic_old);
+        picoquic_free(quic_old);
+    }
+    if (quic_new != NULL) {
+        picoquic_lb_compat_cid_config_free(quic_new);
+        picoquic_free(quic_new);
+    }
+
+    return ret;
+}
@@ -39,14 +39,28 @@ int util_connection_id_print_test();
 int util_connection_id_parse_test();
 int util_sprintf_test();
 int util_debug_print_test();
+int util_diag_event_test();
 int util_uint8_to_str_test();
 int util_memcmp_test();
 int util_threading_test();
 int picohash_test();
 int picohash_embedded_test();
+int picohash_migration_test();
+int container_stats_test();
 int picolog_basic_test();
 int bytestream_test();
 int create_cnx_test();
+int create_cnx_early_data_test();
+int validated_address_cache_test();
+int version_pref_cache_test();
+int cc_experiment_test();
+int perf_export_test();
+int log_sampling_test();
+int binlog_mmap_test();
+int binlog_v2_test();
+int correlation_id_test();
+int flight_recorder_test();
+int close_log_test();
 int create_quic_test();
 int parseheadertest();
 int incoming_initial_test();
@@ -78,6 +92,7 @@ int tls_api_version_negotiation_test();
 int tls_api_version_invariant_test();
 int test_version_negotiation_spoof();
 int transport_param_test();
+int transport_param_layout_cache_test();
 int tls_api_sni_test();
 int tls_api_alpn_test();
 int tls_api_wrong_alpn_test();
@@ -116,9 +131,13 @@ int app_message_overflow_test();
 int socket_test();
 int test_stateless_blowback();
 int ticket_store_test();
+int ticket_store_indexed_test();
+int store_journal_test();
 int ticket_seed_test();
+int cc_seed_hints_test();
 int ticket_seed_from_bdp_frame_test();
 int token_store_test();
+int token_store_wheel_test();
 int session_resume_test();
 int zero_rtt_test();
 int zero_rtt_loss_test();
@@ -131,6 +150,7 @@ int mtu_blocked_test();
 int mtu_delayed_test();
 int mtu_required_test();
 int mtu_max_test();
+int mtu_sprint_test();
 int mtu_drop_bbr_test();
 int mtu_drop_cubic_test();
 int mtu_drop_dcubic_test();
@@ -143,6 +163,9 @@ int pn_enc_1rtt_test();
 int tls_zero_share_test();
 int transport_param_log_test();
 int bad_certificate_test();
+int tls_lazy_credentials_test();
+int tls_lazy_verifier_test();
+int key_share_pool_test();
 int set_verify_certificate_callback_test();
 int virtual_time_test();
 int tls_different_params_test();
@@ -183,6 +206,7 @@ int cnx_stress_do_test(uint64_t duration, int nb_clients, int do_report);
 int cnx_ddos_unit_test();
 int cnx_ddos_test_loop(int nb_connections, uint64_t ddos_interval, const char* qlogdir);
 int sockloop_basic_test();
+int sockloop_batch_test();
 int sockloop_eio_test();
 int sockloop_errsock_test();
 int sockloop_ipv4_test();
@@ -191,6 +215,8 @@ int sockloop_nat_test();
 int sockloop_thread_test();
 int sockloop_thread_name_test();
 int splay_test();
+int stream_index_bench_test();
+int btree_test();
 int TlsStreamFrameTest();
 int draft17_vector_test();
 int dtn_basic_test();
@@ -310,10 +336,17 @@ int h3zero_unidir_error_test();
 int h3zero_setting_error_test();
 int h3zero_capsule_test();
 int h3zero_client_data_test();
+int picowt_datagram_batch_test();
+int picowt_stream_batch_test();
+int h3zero_goaway_test();
+int h3zero_relay_test();
+int h3zero_priority_update_test();
 int qpack_huffman_test();
 int qpack_huffman_base_test();
 int h3zero_parse_qpack_test();
 int h3zero_prepare_qpack_test();
+int qpack_dyntable_test();
+int h3zero_priority_header_test();
 int h3zero_user_agent_test();
 int h3zero_uri_test();
 int h3zero_null_sni_test();
@@ -322,11 +355,13 @@ int h3zero_stream_test();
 int h3zero_stream_fuzz_test();
 int parse_demo_scenario_test();
 int h3zero_server_test();
+int h3zero_client_pool_test();
 int h09_server_test();
 int h09_header_test();
 int generic_server_test();
 int tls_retry_token_test();
 int tls_retry_token_valid_test();
+int tls_retry_token_offload_test();
 int optimistic_ack_test();
 int optimistic_hole_test();
 int document_addresses_test();
@@ -337,6 +372,8 @@ int preferred_address_dis_mig_test();
 int preferred_address_zero_test();
 int cid_for_lb_test();
 int cid_for_lb_cli_test();
+int cid_for_lb_batch_test();
+int hot_restart_state_test();
 int retry_protection_vector_test();
 int retry_protection_v2_test();
 int test_copy_for_retransmit();
@@ -369,6 +406,8 @@ int bbr_asym400_test();
 int l4s_reno_test();
 int l4s_prague_test();
 int l4s_prague_updown_test();
+int l4s_prague_subms_test();
+int fec_recovery_test();
 int l4s_bbr_test();
 int l4s_bbr_updown_test();
 int large_client_hello_test();
@@ -408,6 +447,11 @@ int cwin_max_test();
 int initial_race_test();
 int pacing_test();
 int pacing_repeat_test();
+int pacing_policy_test();
+int pacing_admission_test();
+int rtt_filter_test();
+int rtt_observer_test();
+int stream_time_histogram_test();
 int chacha20_test();
 int cnx_limit_test();
 int cert_verify_bad_cert_test();
@@ -470,6 +514,7 @@ int multipath_fail_test();
 int multipath_ab1_test();
 int multipath_drop_first_test();
 int multipath_drop_second_test();
+int multipath_fast_abandon_test();
 int multipath_sat_plus_test();
 int multipath_renew_test();
 int multipath_rotation_test();
@@ -488,6 +533,8 @@ int multipath_dg_af_test();
 int multipath_standby_test();
 int multipath_standup_test();
 int multipath_discovery_test();
+int multipath_min_rtt_test();
+int multipath_redundant_test();
 int multipath_qlog_test();
 int multipath_tunnel_test();
 int token_reuse_api_test();
@@ -527,6 +574,8 @@ int demo_alpn_test();
 int demo_file_sanitize_test();
 int demo_file_access_test();
 int demo_server_file_test();
+int demo_server_file_cache_test();
+int h3zero_filecache_test();
 int demo_ticket_test();
 int demo_error_test();
 int h3zero_satellite_test();
@@ -562,6 +611,8 @@ int quicperf_datagram_test();
 int quicperf_media_test();
 int quicperf_multi_test();
 int quicperf_overflow_test();
+int quicperf_load_test();
+int quicperf_histogram_test();
 int cplusplustest();
 
 #ifdef __cplusplus
@@ -31,8 +31,18 @@
 #include "picoquic_binlog.h"
 #include "picosplay.h"
 #include "picoquictest_internal.h"
+#include "picoquic_packet_loop.h"
+#include "picosocks.h"
 #include "quicperf.h"
 
+#ifndef SLEEP
+#ifdef _WINDOWS
+#define SLEEP(x) Sleep(x)
+#else
+#define SLEEP(x) usleep((x)*1000)
+#endif
+#endif
+
 #define qpstr_batch "256:12345;"
 #define qpstr_batch100 "* 100:256 : 12345;"
 #define qpstr_batch2 "= b1:256 : 12345; = b2:=b1: 256 : 12345;"
@@ -702,3 +712,172 @@ int quicperf_overflow_test()
 
     return quicperf_e2e_test(0xf1, overflow_scenario, 6000000, 4, overflow_target);
 }
+
+/* End to end test of the load generation mode. A quicperf server is
+* started on a background network thread, bound to the loopback
+* address, and quicperf_load_run drives a small batch of connections
+* against it from two client threads. The test verifies that every
+* connection completes and that the aggregated report accounts for the
+* scenario traffic. */
+int quicperf_load_test()
+{
+    int ret = 0;
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    picoquic_quic_t* qserver = NULL;
+    picoquic_network_thread_ctx_t* thread_ctx = NULL;
+    picoquic_packet_loop_param_t param = { 0 };
+    quicperf_load_config_t config = { 0 };
+    quicperf_load_report_t report = { 0 };
+    uint16_t server_port = 3467;
+
+    config.server_name = "127.0.0.1";
+    config.server_port = server_port;
+    config.sni = PICOQUIC_TEST_SNI;
+    config.scenario_text = "=b1:*1:397:5000;";
+    config.nb_threads = 2;
+    config.nb_connections = 4;
+    config.nb_parallel = 2;
+    config.arrival_interval = 0;
+    config.max_duration = 30000000;
+
+    ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file),
+        picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
+
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file),
+            picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
+    }
+
+    if (ret == 0) {
+        qserver = picoquic_create(8, test_server_cert_file, test_server_key_file, NULL,
+            QUICPERF_ALPN, quicperf_callback, NULL, NULL, NULL, NULL,
+            picoquic_current_time(), NULL, NULL, NULL, 0);
+        if (qserver == NULL) {
+            DBG_PRINTF("%s", "Could not create the server context");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        param.local_port = server_port;
+        param.local_af = AF_INET;
+        param.socket_buffer_size = 0xffff;
+        thread_ctx = picoquic_start_network_thread(qserver, &param,
+            NULL, NULL, &ret);
+        if (thread_ctx == NULL) {
+            DBG_PRINTF("Could not start the server thread, ret = %d", ret);
+            if (ret == 0) {
+                ret = -1;
+            }
+        }
+        else {
+            for (int i = 0; i < 2000 && !thread_ctx->thread_is_ready; i++) {
+                SLEEP(1);
+            }
+            if (!thread_ctx->thread_is_ready) {
+                DBG_PRINTF("%s", "Cannot start the server thread in 2000ms");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicperf_load_run(&config, &report);
+        if (ret != 0) {
+            DBG_PRINTF("quicperf_load_run returns %d", ret);
+        }
+    }
+
+    if (ret == 0) {
+        if (report.nb_connections_started != (uint64_t)config.nb_connections ||
+            report.nb_connections_complete != (uint64_t)config.nb_connections ||
+            report.nb_connections_failed != 0) {
+            DBG_PRINTF("Started %" PRIu64 ", complete %" PRIu64 ", failed %" PRIu64,
+                report.nb_connections_started, report.nb_connections_complete,
+                report.nb_connections_failed);
+            ret = -1;
+        }
+        else if (report.data_received < 4 * 5000 || report.nb_streams != 4) {
+            DBG_PRINTF("Received %" PRIu64 " bytes on %" PRIu64 " streams",
+                report.data_received, report.nb_streams);
+            ret = -1;
+        }
+        else if (report.end_time < report.start_time ||
+            report.max_connection_time > report.end_time - report.start_time) {
+            DBG_PRINTF("%s", "Inconsistent report times");
+            ret = -1;
+        }
+    }
+
+    if (thread_ctx != NULL) {
+        picoquic_delete_network_thread(thread_ctx);
+    }
+    if (qserver != NULL) {
+        picoquic_free(qserver);
+    }
+
+    return ret;
+}
+
+/* Unit test of the latency histogram. The log-linear buckets bound the
+* relative error of a quantile to 1/QUICPERF_HISTOGRAM_NB_SUB, so the
+* quantiles of a uniform series can be checked against that bound. */
+int quicperf_histogram_test()
+{
+    int ret = 0;
+    quicperf_histogram_t* hist = (quicperf_histogram_t*)malloc(sizeof(quicperf_histogram_t));
+
+    if (hist == NULL) {
+        ret = -1;
+    }
+    else {
+        const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+        const uint64_t nb_values = 100000;
+
+        memset(hist, 0, sizeof(quicperf_histogram_t));
+
+        if (quicperf_histogram_quantile(hist, 0.5) != 0) {
+            DBG_PRINTF("%s", "Empty histogram quantile is not zero");
+            ret = -1;
+        }
+
+        for (uint64_t v = 1; ret == 0 && v <= nb_values; v++) {
+            quicperf_histogram_record(hist, v);
+        }
+
+        if (ret == 0 &&
+            (hist->nb_samples != nb_values || hist->min_value != 1 ||
+                hist->max_value != nb_values ||
+                hist->sum_values != (nb_values * (nb_values + 1)) / 2)) {
+            DBG_PRINTF("Bad counters, %" PRIu64 " samples, min %" PRIu64 ", max %" PRIu64,
+                hist->nb_samples, hist->min_value, hist->max_value);
+            ret = -1;
+        }
+
+        for (int i = 0; ret == 0 && i < 4; i++) {
+            uint64_t expected = (uint64_t)(quantiles[i] * (double)nb_values);
+            uint64_t observed = quicperf_histogram_quantile(hist, quantiles[i]);
+
+            if (observed < expected ||
+                observed > expected + expected / QUICPERF_HISTOGRAM_NB_SUB + 1) {
+                DBG_PRINTF("Quantile %f: expected about %" PRIu64 ", got %" PRIu64,
+                    quantiles[i], expected, observed);
+                ret = -1;
+            }
+        }
+
+        /* Out of range values land in the last bucket instead of overflowing */
+        if (ret == 0) {
+            quicperf_histogram_record(hist, UINT64_MAX);
+            if (hist->max_value != UINT64_MAX) {
+                DBG_PRINTF("%s", "Max value not recorded");
+                ret = -1;
+            }
+        }
+
+        free(hist);
+    }
+
+    return ret;
+}
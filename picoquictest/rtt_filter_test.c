@@ -0,0 +1,453 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include "picoquictest_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Test of the RTT measurement pipeline: outlier rejection in
+ * picoquic_update_path_rtt, and the per path RTT histogram.
+ *
+ * A connection is created and fed synthetic RTT samples directly through
+ * picoquic_update_path_rtt. A steady 10 ms RTT is established, then a
+ * single 100 ms spike is injected and should be rejected without moving
+ * the smoothed RTT or the retransmit timer. A persistent excess of
+ * PICOQUIC_RTT_OUTLIER_PERSISTENCE consecutive samples should instead be
+ * accepted as a real shift of the path RTT.
+ */
+
+static void rtt_filter_feed_sample(picoquic_cnx_t* cnx, uint64_t* current_time, uint64_t rtt)
+{
+    *current_time += 1000;
+    picoquic_update_path_rtt(cnx, cnx->path[0], cnx->path[0], picoquic_epoch_1rtt,
+        *current_time - rtt, *current_time, 0, 0);
+}
+
+int rtt_filter_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t nb_samples = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t rtt_nominal = 10000;
+    const uint64_t rtt_spike = 100000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    /* Establish a steady 10 ms RTT */
+    if (ret == 0) {
+        for (int i = 0; i < 20; i++) {
+            rtt_filter_feed_sample(cnx, &current_time, rtt_nominal);
+            nb_samples++;
+        }
+        if (cnx->path[0]->smoothed_rtt > 2 * rtt_nominal ||
+            cnx->path[0]->smoothed_rtt < rtt_nominal / 2) {
+            DBG_PRINTF("Smoothed RTT %" PRIu64 " not close to nominal %" PRIu64,
+                cnx->path[0]->smoothed_rtt, rtt_nominal);
+            ret = -1;
+        }
+    }
+
+    /* A single spike should be rejected */
+    if (ret == 0) {
+        uint64_t smoothed_before = cnx->path[0]->smoothed_rtt;
+        uint64_t timer_before = cnx->path[0]->retransmit_timer;
+
+        rtt_filter_feed_sample(cnx, &current_time, rtt_spike);
+        nb_samples++;
+
+        if (cnx->path[0]->nb_rtt_outliers != 1) {
+            DBG_PRINTF("Expected 1 outlier, got %" PRIu64, cnx->path[0]->nb_rtt_outliers);
+            ret = -1;
+        }
+        else if (cnx->path[0]->smoothed_rtt != smoothed_before ||
+            cnx->path[0]->retransmit_timer != timer_before) {
+            DBG_PRINTF("Rejected spike moved smoothed RTT to %" PRIu64 ", timer to %" PRIu64,
+                cnx->path[0]->smoothed_rtt, cnx->path[0]->retransmit_timer);
+            ret = -1;
+        }
+        else if (cnx->path[0]->rtt_max < rtt_spike) {
+            DBG_PRINTF("Rejected spike did not update rtt_max (%" PRIu64 ")",
+                cnx->path[0]->rtt_max);
+            ret = -1;
+        }
+    }
+
+    /* After a normal sample, a persistent excess should be accepted */
+    if (ret == 0) {
+        rtt_filter_feed_sample(cnx, &current_time, rtt_nominal);
+        nb_samples++;
+
+        for (int i = 0; i < PICOQUIC_RTT_OUTLIER_PERSISTENCE; i++) {
+            rtt_filter_feed_sample(cnx, &current_time, rtt_spike);
+            nb_samples++;
+        }
+
+        if (cnx->path[0]->smoothed_rtt <= rtt_nominal + rtt_nominal / 2) {
+            DBG_PRINTF("Persistent excess not accepted, smoothed RTT = %" PRIu64,
+                cnx->path[0]->smoothed_rtt);
+            ret = -1;
+        }
+    }
+
+    /* Verify the histogram: every sample counted, retrievable by path id */
+    if (ret == 0) {
+        uint32_t buckets[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS];
+        uint64_t nb_counted = 0;
+
+        if (picoquic_get_path_rtt_histogram(cnx, 0, buckets, PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) != 0) {
+            DBG_PRINTF("%s", "Cannot retrieve RTT histogram for path 0\n");
+            ret = -1;
+        }
+        else {
+            for (size_t i = 0; i < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS; i++) {
+                nb_counted += buckets[i];
+            }
+            if (nb_counted != nb_samples) {
+                DBG_PRINTF("Histogram counts %" PRIu64 " samples instead of %" PRIu64,
+                    nb_counted, nb_samples);
+                ret = -1;
+            }
+            else if (buckets[picoquic_rtt_histogram_bucket(rtt_nominal)] == 0) {
+                DBG_PRINTF("%s", "No count in the nominal RTT bucket\n");
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 &&
+            picoquic_get_path_rtt_histogram(cnx, 1234, buckets, PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) == 0) {
+            DBG_PRINTF("%s", "Histogram retrieval succeeded for absent path\n");
+            ret = -1;
+        }
+    }
+
+    /* Verify the bucket geometry: floors are increasing, and each sample
+     * value maps to the bucket whose floor is just below it. */
+    if (ret == 0) {
+        uint64_t floor_previous = picoquic_rtt_histogram_bucket_floor(0);
+
+        for (size_t b = 1; ret == 0 && b < PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS; b++) {
+            uint64_t floor_b = picoquic_rtt_histogram_bucket_floor(b);
+
+            if (floor_b <= floor_previous) {
+                DBG_PRINTF("Bucket floor %zu (%" PRIu64 ") not above previous (%" PRIu64 ")",
+                    b, floor_b, floor_previous);
+                ret = -1;
+            }
+            else if (picoquic_rtt_histogram_bucket(floor_b) != b) {
+                DBG_PRINTF("Floor of bucket %zu maps to bucket %zu",
+                    b, picoquic_rtt_histogram_bucket(floor_b));
+                ret = -1;
+            }
+            floor_previous = floor_b;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the real time RTT observer: ack derived samples are delivered
+ * raw, before the outlier filter, and incoming spin bit edges produce
+ * spin derived samples.
+ */
+typedef struct st_rtt_observer_test_ctx_t {
+    uint64_t nb_ack_samples;
+    uint64_t nb_spin_samples;
+    uint64_t last_sample;
+    uint64_t last_path_id;
+    picoquic_rtt_sample_source_enum last_source;
+} rtt_observer_test_ctx_t;
+
+static void rtt_observer_test_cb(picoquic_cnx_t* cnx, uint64_t unique_path_id,
+    picoquic_rtt_sample_source_enum rtt_source, uint64_t rtt_sample, void* v_rtt_observer_ctx)
+{
+    rtt_observer_test_ctx_t* obs = (rtt_observer_test_ctx_t*)v_rtt_observer_ctx;
+
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(cnx);
+#endif
+    if (rtt_source == picoquic_rtt_sample_source_spin) {
+        obs->nb_spin_samples++;
+    }
+    else {
+        obs->nb_ack_samples++;
+    }
+    obs->last_sample = rtt_sample;
+    obs->last_path_id = unique_path_id;
+    obs->last_source = rtt_source;
+}
+
+int rtt_observer_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    rtt_observer_test_ctx_t obs = { 0 };
+    const uint64_t rtt_nominal = 10000;
+    const uint64_t rtt_spike = 100000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+        else {
+            picoquic_set_rtt_observer(cnx, rtt_observer_test_cb, &obs);
+        }
+    }
+
+    /* Ack derived samples: every raw sample is delivered, including the
+     * spikes that the outlier filter rejects */
+    if (ret == 0) {
+        for (int i = 0; i < 20; i++) {
+            rtt_filter_feed_sample(cnx, &current_time, rtt_nominal);
+        }
+        rtt_filter_feed_sample(cnx, &current_time, rtt_spike);
+
+        if (obs.nb_ack_samples != 21 || obs.nb_spin_samples != 0) {
+            DBG_PRINTF("Got %" PRIu64 " ack samples, %" PRIu64 " spin samples",
+                obs.nb_ack_samples, obs.nb_spin_samples);
+            ret = -1;
+        }
+        else if (obs.last_sample != rtt_spike ||
+            obs.last_source != picoquic_rtt_sample_source_ack ||
+            obs.last_path_id != cnx->path[0]->unique_path_id) {
+            DBG_PRINTF("Bad ack sample: %" PRIu64 " from source %d, path %" PRIu64,
+                obs.last_sample, obs.last_source, obs.last_path_id);
+            ret = -1;
+        }
+        else if (cnx->path[0]->nb_rtt_outliers != 1) {
+            DBG_PRINTF("Observer changed filtering, %" PRIu64 " outliers",
+                cnx->path[0]->nb_rtt_outliers);
+            ret = -1;
+        }
+    }
+
+    /* Spin derived samples: the first incoming edge primes the
+     * measurement, the second delivers the time between edges */
+    if (ret == 0) {
+        picoquic_packet_header ph;
+
+        memset(&ph, 0, sizeof(ph));
+        ph.spin = !cnx->client_mode;
+        picoquic_spin_function_table[picoquic_spinbit_basic].spinbit_incoming(cnx, cnx->path[0], &ph);
+        current_time += rtt_nominal;
+        ph.spin = cnx->client_mode;
+        picoquic_spin_function_table[picoquic_spinbit_basic].spinbit_incoming(cnx, cnx->path[0], &ph);
+
+        if (obs.nb_spin_samples != 1) {
+            DBG_PRINTF("Got %" PRIu64 " spin samples", obs.nb_spin_samples);
+            ret = -1;
+        }
+        else if (obs.last_sample != rtt_nominal ||
+            obs.last_source != picoquic_rtt_sample_source_spin) {
+            DBG_PRINTF("Bad spin sample: %" PRIu64 " from source %d",
+                obs.last_sample, obs.last_source);
+            ret = -1;
+        }
+    }
+
+    /* Clearing the observer stops the deliveries */
+    if (ret == 0) {
+        picoquic_set_rtt_observer(cnx, NULL, NULL);
+        rtt_filter_feed_sample(cnx, &current_time, rtt_nominal);
+        if (obs.nb_ack_samples != 21) {
+            DBG_PRINTF("Cleared observer got %" PRIu64 " ack samples", obs.nb_ack_samples);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the stream lifecycle timing histograms: time to first byte is
+ * recorded when the first STREAM frame is formatted, time to completion
+ * when the FIN is acknowledged and the stream is deleted.
+ */
+int stream_time_histogram_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_stream_head_t* stream = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t ttfb_expected = 5000;
+    const uint64_t completion_extra = 7000;
+    uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        stream = picoquic_create_stream(cnx, 0);
+        if (stream == NULL || stream->creation_time != current_time) {
+            DBG_PRINTF("%s", "Stream creation time not recorded\n");
+            ret = -1;
+        }
+        else {
+            /* Open the flow control so the frame can be formatted */
+            stream->maxdata_remote = 0x10000;
+            cnx->maxdata_remote = 0x10000;
+        }
+    }
+
+    /* Queue data with a FIN, then format the first STREAM frame */
+    if (ret == 0) {
+        uint8_t buffer[256];
+        int more_data = 0;
+        int is_pure_ack = 1;
+        int ret_frame = 0;
+        uint8_t* bytes_next;
+
+        current_time += ttfb_expected;
+        if (picoquic_add_to_stream(cnx, 0, data, sizeof(data), 1) != 0) {
+            DBG_PRINTF("%s", "Cannot add data to stream\n");
+            ret = -1;
+        }
+        else if ((bytes_next = picoquic_format_stream_frame(cnx, stream, buffer, buffer + sizeof(buffer),
+            &more_data, &is_pure_ack, NULL, &ret_frame)) == NULL ||
+            bytes_next == buffer || ret_frame != 0 || !stream->fin_sent) {
+            DBG_PRINTF("Cannot format stream frame, ret = %d", ret_frame);
+            ret = -1;
+        }
+        else if (stream->first_send_time != current_time) {
+            DBG_PRINTF("First send time %" PRIu64 " instead of %" PRIu64,
+                stream->first_send_time, current_time);
+            ret = -1;
+        }
+        else {
+            uint32_t buckets[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS];
+
+            if (picoquic_get_stream_time_histogram(cnx, picoquic_stream_time_to_first_byte,
+                buckets, PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) != 0 ||
+                buckets[picoquic_rtt_histogram_bucket(ttfb_expected)] != 1) {
+                DBG_PRINTF("%s", "Time to first byte not recorded\n");
+                ret = -1;
+            }
+        }
+    }
+
+    /* Close the receive side, acknowledge the FIN, delete the stream */
+    if (ret == 0) {
+        current_time += completion_extra;
+        stream->fin_received = 1;
+        stream->fin_signalled = 1;
+        if (picoquic_update_sack_list(&stream->sack_list, 0, stream->sent_offset, current_time) != 0) {
+            DBG_PRINTF("%s", "Cannot acknowledge the stream data\n");
+            ret = -1;
+        }
+        else {
+            uint32_t buckets[PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS];
+
+            (void)picoquic_delete_stream_if_closed(cnx, stream);
+            stream = NULL;
+
+            if (picoquic_get_stream_time_histogram(cnx, picoquic_stream_time_to_completion,
+                buckets, PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) != 0 ||
+                buckets[picoquic_rtt_histogram_bucket(ttfb_expected + completion_extra)] != 1) {
+                DBG_PRINTF("%s", "Time to completion not recorded\n");
+                ret = -1;
+            }
+            else if (picoquic_get_stream_time_histogram(cnx, (picoquic_stream_time_metric_enum)5,
+                buckets, PICOQUIC_RTT_HISTOGRAM_NB_BUCKETS) == 0) {
+                DBG_PRINTF("%s", "Unknown metric accepted\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -131,7 +131,7 @@ int check_ack_ranges(picoquic_sack_list_t* sack_list)
             else if (sack->nb_times_sent[r] < PICOQUIC_MAX_ACK_RANGE_REPEAT) {
                 range_sum[sack->nb_times_sent[r]] += 1;
             }
-            sack = picoquic_sack_next_item(sack);
+            sack = picoquic_sack_next_item(sack_list, sack);
         }
 
         for (int i = 0; ret == 0 && i < PICOQUIC_MAX_ACK_RANGE_REPEAT; i++) {
@@ -1355,7 +1355,12 @@ int frames_repeat_test()
 
 void frame_init_test_packet(picoquic_packet_t* p, picoquic_cnx_t* cnx, int epoch, uint64_t simulated_time)
 {
+    uint8_t* bytes = p->bytes;
+    size_t bytes_alloc = p->bytes_alloc;
+
     memset(p, 0, sizeof(picoquic_packet_t));
+    p->bytes = bytes;
+    p->bytes_alloc = bytes_alloc;
     /* struct st_picoquic_packet_t* packet_next; */
     /* struct st_picoquic_packet_t* packet_previous; */
     p->send_path = cnx->path[0];
@@ -1461,9 +1466,13 @@ int frames_ackack_error_test()
         &simulated_time, NULL, NULL, 0);
     struct sockaddr_in saddr = { 0 };
     picoquic_packet_t p;
+    uint8_t p_bytes[PICOQUIC_MAX_PACKET_SIZE];
     int nb_trials = 0;
     int nb_disconnected = 0;
 
+    p.bytes = p_bytes;
+    p.bytes_alloc = sizeof(p_bytes);
+
     if (qclient == NULL) {
         ret = -1;
     }
@@ -2749,6 +2758,7 @@ int test_copy_for_retransmit()
     picoquic_cnx_t * cnx = NULL;
     int ret = 0;
     picoquic_packet_t old_p;
+    uint8_t old_p_bytes[PICOQUIC_MAX_PACKET_SIZE];
     uint8_t new_bytes[PICOQUIC_MAX_PACKET_SIZE];
     size_t length = 0;
     int packet_is_pure_ack = 0;
@@ -2789,6 +2799,8 @@ int test_copy_for_retransmit()
 
         /* Initialize the old packet */
         memset(&old_p, 0, sizeof(picoquic_packet_t));
+        old_p.bytes = old_p_bytes;
+        old_p.bytes_alloc = sizeof(old_p_bytes);
         if (copy_retransmit_case[i].packet_length > 0) {
             memcpy(old_p.bytes, copy_retransmit_case[i].packet, copy_retransmit_case[i].packet_length);
             old_p.length = copy_retransmit_case[i].packet_length;
@@ -2905,10 +2917,13 @@ static size_t dataqueue_prepare_packet(
     uint64_t stream_id, uint64_t offset, size_t frame_data_length)
 {
     uint8_t* bytes = packet->bytes;
-    uint8_t* bytes_max = bytes + sizeof(packet->bytes);
+    uint8_t* bytes_max = bytes + packet->bytes_alloc;
     size_t copied_index;
+    size_t bytes_alloc = packet->bytes_alloc;
 
     memset(packet, 0, sizeof(picoquic_packet_t));
+    packet->bytes = bytes;
+    packet->bytes_alloc = bytes_alloc;
     packet->offset = 12;
     packet->data_repeat_frame = 17;
     packet->data_repeat_index = 17;
@@ -3090,10 +3105,14 @@ int dataqueue_copy_test()
 {
     int ret = 0;
     picoquic_packet_t packet;
+    uint8_t packet_bytes[PICOQUIC_MAX_PACKET_SIZE];
     uint8_t data[1536];
     uint8_t output[1536];
     size_t length_max = 1536;
 
+    packet.bytes = packet_bytes;
+    packet.bytes_alloc = sizeof(packet_bytes);
+
     for (int case_opt = 0; ret == 0 && case_opt < 5; case_opt++) {
         int has_length = (case_opt & 1) == 0;
         int has_fin = (case_opt & 2) == 2;
@@ -3411,13 +3430,13 @@ int send_stream_blocked_test()
     return ret;
 }
 
-int picoquic_queue_network_input(picoquic_quic_t * quic, picosplay_tree_t* tree, uint64_t consumed_offset,
+int picoquic_queue_network_input(picoquic_quic_t * quic, picoquic_stream_data_index_t* tree, uint64_t consumed_offset,
     uint64_t stream_ofs, const uint8_t* bytes, size_t length, int is_last_frame, picoquic_stream_data_node_t* received_data, int* new_data_available);
 
 int64_t picoquic_stream_data_node_compare(void* l, void* r);
-picosplay_node_t* picoquic_stream_data_node_create(void* value);
-void picoquic_stream_data_node_delete(void* tree, picosplay_node_t* node);
-void* picoquic_stream_data_node_value(picosplay_node_t* node);
+picoquic_stream_index_node_t* picoquic_stream_data_node_create(void* value);
+void picoquic_stream_data_node_delete(void* tree, picoquic_stream_index_node_t* node);
+void* picoquic_stream_data_node_value(picoquic_stream_index_node_t* node);
 
 int queue_network_input_test()
 {
@@ -3438,15 +3457,18 @@ int queue_network_input_test()
     const uint8_t data[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
     int new_data_available = 0;
 
-    picosplay_tree_t* tree = picosplay_new_tree(
-        picoquic_stream_data_node_compare,
-        picoquic_stream_data_node_create,
-        picoquic_stream_data_node_delete,
-        picoquic_stream_data_node_value);
+    picoquic_stream_data_index_t* tree = (picoquic_stream_data_index_t*)malloc(sizeof(picoquic_stream_data_index_t));
 
     if (quic == NULL || tree == NULL) {
         ret = -1;
     }
+    else {
+        picoquic_stream_index_init(tree,
+            picoquic_stream_data_node_compare,
+            picoquic_stream_data_node_create,
+            picoquic_stream_data_node_delete,
+            picoquic_stream_data_node_value);
+    }
 
     /* Fill 0..3 */
     if (ret == 0) {
@@ -3497,7 +3519,7 @@ int queue_network_input_test()
     }
 
     if (ret == 0) {
-        picoquic_stream_data_node_t* next = (picoquic_stream_data_node_t*)picosplay_first(tree);
+        picoquic_stream_data_node_t* next = (picoquic_stream_data_node_t*)picoquic_stream_index_first(tree);
         for (int i = 0; i < 3; ++i) {
             if (next == NULL) {
                 DBG_PRINTF("tree does not contain enough data (%d chunks vs 3 exptected)", i);
@@ -3512,12 +3534,12 @@ int queue_network_input_test()
                     break;
                 }
             }
-            next = (picoquic_stream_data_node_t*)picosplay_next(&next->stream_data_node);
+            next = (picoquic_stream_data_node_t*)picoquic_stream_index_next(&next->stream_data_node);
         }
     }
 
     if (tree != NULL) {
-        picosplay_empty_tree(tree);
+        picoquic_stream_index_empty(tree);
         free(tree);
     }
 
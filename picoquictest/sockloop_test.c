@@ -62,6 +62,8 @@ typedef struct st_sockloop_test_spec_t {
     int extra_socket_required;
     int prefer_extra_socket;
     int force_migration;
+    size_t recv_batch_size;
+    size_t send_batch_size;
 } sockloop_test_spec_t;
 
 typedef struct st_sockloop_test_cb_t {
@@ -522,7 +524,9 @@ int sockloop_test_one(sockloop_test_spec_t *spec)
             param.simulate_eio = spec->simulate_eio;
             param.extra_socket_required = spec->extra_socket_required;
             param.prefer_extra_socket = spec->prefer_extra_socket;
-            
+            param.recv_batch_size = spec->recv_batch_size;
+            param.send_batch_size = spec->send_batch_size;
+
 
             loop_cb.force_migration = spec->force_migration;
             loop_cb.param = &param;
@@ -729,5 +733,18 @@ int sockloop_thread_name_test()
     spec.use_background_thread = 1;
     spec.thread_name = "picoquic loop";
 
+    return(sockloop_test_one(&spec));
+}
+
+int sockloop_batch_test()
+{
+    sockloop_test_spec_t spec;
+    sockloop_test_set_spec(&spec, 9);
+    spec.socket_buffer_size = 0xffff;
+    spec.scenario = sockloop_test_scenario_1M;
+    spec.scenario_size = sizeof(sockloop_test_scenario_1M);
+    spec.recv_batch_size = 32;
+    spec.send_batch_size = 16;
+
     return(sockloop_test_one(&spec));
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Benchmark of the candidate stream segment indexes: the picosplay tree
+ * that the stack uses by default, and the picoskip skiplist that can be
+ * selected with PICOQUIC_STREAM_INDEX_SKIPLIST. The test replays the
+ * access pattern of the reassembly code on out of order delivery:
+ * insert a segment, probe the predecessor of a random offset, then
+ * drain in order with first + delete_hint. It verifies that both
+ * structures produce the same order, and logs the measured times so
+ * the numbers can guide the choice of default.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_utils.h"
+#include "picoskip.h"
+#include "picosplay.h"
+
+typedef struct st_stream_index_test_node_t {
+    uint64_t offset;
+    picosplay_node_t splay_node;
+    picoskip_node_t skip_node;
+} stream_index_test_node_t;
+
+static int64_t stream_index_test_compare(void* l, void* r)
+{
+    uint64_t l_o = ((stream_index_test_node_t*)l)->offset;
+    uint64_t r_o = ((stream_index_test_node_t*)r)->offset;
+
+    return (l_o < r_o) ? -1 : (l_o > r_o) ? 1 : 0;
+}
+
+static picosplay_node_t* stream_index_test_splay_create(void* value)
+{
+    return &((stream_index_test_node_t*)value)->splay_node;
+}
+
+static void* stream_index_test_splay_value(picosplay_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_stream_index_test_node_t, splay_node));
+}
+
+static void stream_index_test_splay_delete(void* tree, picosplay_node_t* node)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(tree);
+    UNREFERENCED_PARAMETER(node);
+#else
+    (void)tree;
+    (void)node;
+#endif
+}
+
+static picoskip_node_t* stream_index_test_skip_create(void* value)
+{
+    return &((stream_index_test_node_t*)value)->skip_node;
+}
+
+static void* stream_index_test_skip_value(picoskip_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_stream_index_test_node_t, skip_node));
+}
+
+static void stream_index_test_skip_delete(void* list, picoskip_node_t* node)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(list);
+    UNREFERENCED_PARAMETER(node);
+#else
+    (void)list;
+    (void)node;
+#endif
+}
+
+/* Produce a deterministic permutation of segment offsets, simulating
+ * out of order arrival of nb 512 byte segments. */
+static void stream_index_test_shuffle(stream_index_test_node_t* nodes, size_t nb)
+{
+    uint64_t seed = 0xDEADBEEFBABAC001ull;
+
+    for (size_t i = 0; i < nb; i++) {
+        nodes[i].offset = (uint64_t)i * 512;
+    }
+
+    for (size_t i = nb - 1; i > 0; i--) {
+        size_t j;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        j = (size_t)(seed % (i + 1));
+        if (j != i) {
+            uint64_t o = nodes[i].offset;
+            nodes[i].offset = nodes[j].offset;
+            nodes[j].offset = o;
+        }
+    }
+}
+
+static int stream_index_test_one(size_t nb)
+{
+    int ret = 0;
+    stream_index_test_node_t* nodes = (stream_index_test_node_t*)malloc(nb * sizeof(stream_index_test_node_t));
+    picosplay_tree_t splay;
+    picoskip_list_t skip;
+    uint64_t t_start;
+    uint64_t splay_insert_us = 0;
+    uint64_t splay_drain_us = 0;
+    uint64_t skip_insert_us = 0;
+    uint64_t skip_drain_us = 0;
+
+    if (nodes == NULL) {
+        return -1;
+    }
+    memset(nodes, 0, nb * sizeof(stream_index_test_node_t));
+    stream_index_test_shuffle(nodes, nb);
+
+    picosplay_init_tree(&splay, stream_index_test_compare,
+        stream_index_test_splay_create, stream_index_test_splay_delete, stream_index_test_splay_value);
+    picoskip_init_list(&skip, stream_index_test_compare,
+        stream_index_test_skip_create, stream_index_test_skip_delete, stream_index_test_skip_value);
+
+    /* Insert phase, with a predecessor probe after each insert as the
+     * reassembly code does to find overlapping segments. */
+    t_start = picoquic_current_time();
+    for (size_t i = 0; i < nb; i++) {
+        stream_index_test_node_t target;
+        target.offset = nodes[i].offset;
+        (void)picosplay_find_previous(&splay, &target);
+        picosplay_insert(&splay, &nodes[i]);
+    }
+    splay_insert_us = picoquic_current_time() - t_start;
+
+    t_start = picoquic_current_time();
+    for (size_t i = 0; i < nb; i++) {
+        stream_index_test_node_t target;
+        target.offset = nodes[i].offset;
+        (void)picoskip_find_previous(&skip, &target);
+        picoskip_insert(&skip, &nodes[i]);
+    }
+    skip_insert_us = picoquic_current_time() - t_start;
+
+    if (splay.size != (int)nb || skip.size != (int)nb) {
+        DBG_PRINTF("Sizes after insert: splay %d, skip %d, expected %zu", splay.size, skip.size, nb);
+        ret = -1;
+    }
+
+    /* Drain phase: both structures must deliver the offsets in order. */
+    if (ret == 0) {
+        uint64_t expected = 0;
+
+        t_start = picoquic_current_time();
+        for (size_t i = 0; ret == 0 && i < nb; i++) {
+            picosplay_node_t* first = picosplay_first(&splay);
+            if (first == NULL ||
+                ((stream_index_test_node_t*)stream_index_test_splay_value(first))->offset != expected) {
+                DBG_PRINTF("Splay drain out of order at rank %zu", i);
+                ret = -1;
+            }
+            else {
+                picosplay_delete_hint(&splay, first);
+                expected += 512;
+            }
+        }
+        splay_drain_us = picoquic_current_time() - t_start;
+    }
+
+    if (ret == 0) {
+        uint64_t expected = 0;
+
+        t_start = picoquic_current_time();
+        for (size_t i = 0; ret == 0 && i < nb; i++) {
+            picoskip_node_t* first = picoskip_first(&skip);
+            if (first == NULL ||
+                ((stream_index_test_node_t*)stream_index_test_skip_value(first))->offset != expected) {
+                DBG_PRINTF("Skiplist drain out of order at rank %zu", i);
+                ret = -1;
+            }
+            else {
+                picoskip_delete_hint(&skip, first);
+                expected += 512;
+            }
+        }
+        skip_drain_us = picoquic_current_time() - t_start;
+    }
+
+    if (ret == 0 && (splay.size != 0 || skip.size != 0)) {
+        DBG_PRINTF("Sizes after drain: splay %d, skip %d", splay.size, skip.size);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("%zu segments: splay insert %" PRIu64 "us drain %" PRIu64 "us, skip insert %" PRIu64 "us drain %" PRIu64 "us",
+            nb, splay_insert_us, splay_drain_us, skip_insert_us, skip_drain_us);
+    }
+
+    free(nodes);
+
+    return ret;
+}
+
+int stream_index_bench_test()
+{
+    int ret = 0;
+    const size_t nb_segments[] = { 1000, 10000, 100000 };
+
+    for (size_t i = 0; ret == 0 && i < sizeof(nb_segments) / sizeof(size_t); i++) {
+        ret = stream_index_test_one(nb_segments[i]);
+    }
+
+    return ret;
+}
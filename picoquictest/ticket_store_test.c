@@ -256,6 +256,170 @@ int ticket_store_test()
     return ret;
 }
 
+/* Indexed ticket store: verify that the indexed file loads without
+ * materializing any ticket, that lookups materialize records one at a
+ * time through the hash index, that appended records shadow the indexed
+ * ones, and that the indexed save compacts list and file together. */
+static char const* test_ticket_indexed_file_name = "ticket_store_indexed_test.bin";
+
+int ticket_store_indexed_test()
+{
+    int ret = 0;
+    uint64_t ticket_time = 40000000000ull;
+    uint64_t current_time = 50000000000ull;
+    uint64_t retrieve_time = 60000000000ull;
+    uint32_t ttl = 100000;
+    uint8_t ticket[128];
+    uint16_t appended_length = 100;
+    uint64_t simulated_time = current_time;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+
+    /* Generate a set of tickets and save them in the indexed format */
+    for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+        for (size_t j = 0; ret == 0 && j < nb_test_alpn; j++) {
+            uint16_t ticket_length = (uint16_t)(64 + j * nb_test_sni + i);
+            uint64_t test_ticket_time = ticket_time / 1000 + ((uint64_t)1000) * ((i * nb_test_alpn) + j);
+
+            ret = create_test_ticket(test_ticket_time, ttl, ticket, ticket_length);
+
+            if (ret == 0) {
+                ret = picoquic_store_ticket(quic,
+                    test_sni[i], (uint16_t)strlen(test_sni[i]),
+                    test_alpn[j], (uint16_t)strlen(test_alpn[j]),
+                    test_version[j], NULL, 0, NULL, 0,
+                    ticket, ticket_length, &test_tp);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = picoquic_save_tickets_indexed(quic, current_time, test_ticket_indexed_file_name);
+    }
+
+    /* Load the indexed file: the map is installed but nothing is parsed */
+    if (ret == 0) {
+        picoquic_free_tickets(&quic->p_first_ticket);
+        quic->ticket_memory_size = 0;
+        simulated_time = retrieve_time;
+
+        ret = picoquic_load_tickets_indexed(quic, test_ticket_indexed_file_name);
+
+        if (ret == 0 && (quic->ticket_store_map == NULL || quic->p_first_ticket != NULL)) {
+            ret = -1;
+        }
+    }
+
+    /* Each lookup should materialize the matching record from the map */
+    for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+        for (size_t j = 0; ret == 0 && j < nb_test_alpn; j++) {
+            uint16_t ticket_length = 0;
+            uint16_t expected_length = (uint16_t)(64 + j * nb_test_sni + i);
+            uint8_t* stored_bytes = NULL;
+
+            ret = picoquic_get_ticket(quic,
+                test_sni[i], (uint16_t)strlen(test_sni[i]),
+                test_alpn[j], (uint16_t)strlen(test_alpn[j]),
+                test_version[j],
+                &stored_bytes, &ticket_length, NULL, 0);
+            if (ret == 0 && ticket_length != expected_length) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && quic->p_first_ticket == NULL) {
+            ret = -1;
+        }
+    }
+
+    /* A lookup for an unknown SNI should find nothing */
+    if (ret == 0) {
+        uint16_t ticket_length = 0;
+        uint8_t* stored_bytes = NULL;
+
+        if (picoquic_get_ticket(quic, "unknown.example.org", 19,
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), test_version[0],
+            &stored_bytes, &ticket_length, NULL, 0) == 0) {
+            ret = -1;
+        }
+    }
+
+    /* Append a fresher ticket for the first key, and verify that the
+     * appended tail shadows the indexed record after a reload */
+    if (ret == 0) {
+        ret = create_test_ticket(retrieve_time / 1000, ttl, ticket, appended_length);
+    }
+    if (ret == 0) {
+        ret = picoquic_store_ticket(quic,
+            test_sni[0], (uint16_t)strlen(test_sni[0]),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]),
+            test_version[0], NULL, 0, NULL, 0,
+            ticket, appended_length, &test_tp);
+    }
+    if (ret == 0) {
+        ret = picoquic_ticket_store_append(test_ticket_indexed_file_name, quic->p_first_ticket);
+    }
+    if (ret == 0) {
+        picoquic_free_tickets(&quic->p_first_ticket);
+        quic->ticket_memory_size = 0;
+        ret = picoquic_load_tickets_indexed(quic, test_ticket_indexed_file_name);
+    }
+    if (ret == 0) {
+        uint16_t ticket_length = 0;
+        uint8_t* stored_bytes = NULL;
+
+        ret = picoquic_get_ticket(quic,
+            test_sni[0], (uint16_t)strlen(test_sni[0]),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), test_version[0],
+            &stored_bytes, &ticket_length, NULL, 0);
+        if (ret == 0 && ticket_length != appended_length) {
+            ret = -1;
+        }
+    }
+
+    /* Compaction: merge the one materialized ticket with the mapped
+     * records, then verify the whole set from the rewritten file */
+    if (ret == 0) {
+        ret = picoquic_save_tickets_indexed(quic, retrieve_time, test_ticket_indexed_file_name);
+
+        if (ret == 0 && quic->ticket_store_map != NULL) {
+            /* The save drops the mapping before rewriting the file */
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        picoquic_free_tickets(&quic->p_first_ticket);
+        quic->ticket_memory_size = 0;
+        ret = picoquic_load_tickets_indexed(quic, test_ticket_indexed_file_name);
+    }
+    for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+        for (size_t j = 0; ret == 0 && j < nb_test_alpn; j++) {
+            uint16_t ticket_length = 0;
+            uint16_t expected_length = (i == 0 && j == 0) ? appended_length :
+                (uint16_t)(64 + j * nb_test_sni + i);
+            uint8_t* stored_bytes = NULL;
+
+            ret = picoquic_get_ticket(quic,
+                test_sni[i], (uint16_t)strlen(test_sni[i]),
+                test_alpn[j], (uint16_t)strlen(test_alpn[j]),
+                test_version[j],
+                &stored_bytes, &ticket_length, NULL, 0);
+            if (ret == 0 && ticket_length != expected_length) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /*
  * The token store is extremely similar to the ticket store.
  */
@@ -457,6 +621,241 @@ int token_store_test()
     return ret;
 }
 
+/* Token hash index and expiry wheel: verify that lookups through the
+ * hash buckets find each stored token, that storing a replacement drops
+ * the older copy, and that the wheel sweep frees expired tokens. */
+int token_store_wheel_test()
+{
+    int ret = 0;
+    const size_t nb_tokens = 40;
+    uint64_t simulated_time = 50000000000ull;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_tokens; i++) {
+        char sni[64];
+        uint8_t token[32];
+
+        (void)picoquic_sprintf(sni, sizeof(sni), NULL, "srv%d.example.com", (int)i);
+        memset(token, (uint8_t)i, sizeof(token));
+        ret = picoquic_store_token(quic, sni, (uint16_t)strlen(sni),
+            NULL, 0, token, (uint16_t)(16 + i % 16));
+    }
+
+    if (ret == 0 && (quic->token_nb_stored != nb_tokens || quic->token_hash_bucket == NULL)) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_tokens; i++) {
+        char sni[64];
+        uint8_t* token = NULL;
+        uint16_t token_length = 0;
+
+        (void)picoquic_sprintf(sni, sizeof(sni), NULL, "srv%d.example.com", (int)i);
+        ret = picoquic_get_token(quic, sni, (uint16_t)strlen(sni),
+            NULL, 0, &token, &token_length, 0);
+        if (ret == 0) {
+            if (token_length != (uint16_t)(16 + i % 16) || token[0] != (uint8_t)i) {
+                ret = -1;
+            }
+            free(token);
+        }
+    }
+
+    /* Storing a replacement removes the older token for that SNI */
+    if (ret == 0) {
+        uint8_t token[32];
+
+        memset(token, 0xaa, sizeof(token));
+        ret = picoquic_store_token(quic, "srv0.example.com", 16, NULL, 0, token, 32);
+
+        if (ret == 0 && quic->token_nb_stored != nb_tokens) {
+            ret = -1;
+        }
+    }
+
+    /* After 25 hours every token is expired; the sweep triggered by the
+     * next store should free them all */
+    if (ret == 0) {
+        uint8_t token[32];
+
+        simulated_time += 25 * 3600 * 1000000ull;
+        memset(token, 0xbb, sizeof(token));
+        ret = picoquic_store_token(quic, "fresh.example.com", 17, NULL, 0, token, 32);
+
+        if (ret == 0 &&
+            (quic->token_nb_stored != 1 ||
+                quic->p_first_token == NULL ||
+                quic->p_first_token->next_token != NULL)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uint8_t* token = NULL;
+        uint16_t token_length = 0;
+
+        if (picoquic_get_token(quic, "srv1.example.com", 16,
+            NULL, 0, &token, &token_length, 0) == 0) {
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the unified store journal: tickets and tokens stored with the
+ * journal enabled are recovered by replaying the journal in a new context,
+ * without any explicit save call, and a garbage tail left by a simulated
+ * crash in mid-append is trimmed without losing the preceding records.
+ */
+static char const* test_journal_file_name = "store_journal_test.bin";
+
+static int store_journal_load_and_check(uint64_t* p_simulated_time)
+{
+    int ret = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, p_simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = picoquic_use_store_journal(quic, test_journal_file_name, picoquic_journal_fsync_never);
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+        uint16_t ticket_length = 0;
+        uint8_t* ticket_bytes = NULL;
+        uint8_t* token_bytes = NULL;
+        uint16_t token_length = 0;
+
+        if (picoquic_get_ticket(quic,
+            test_sni[i], (uint16_t)strlen(test_sni[i]),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]),
+            test_version[0], &ticket_bytes, &ticket_length, NULL, 0) != 0 ||
+            ticket_length != (uint16_t)(64 + i)) {
+            DBG_PRINTF("Ticket %zu not recovered from the journal", i);
+            ret = -1;
+        }
+        else if (picoquic_get_token(quic,
+            test_sni[i], (uint16_t)strlen(test_sni[i]),
+            test_ip_addr[0].ip_addr, test_ip_addr[0].ip_addr_length,
+            &token_bytes, &token_length, 0) != 0 ||
+            token_length != (uint16_t)(48 + i)) {
+            DBG_PRINTF("Token %zu not recovered from the journal", i);
+            ret = -1;
+        }
+        if (token_bytes != NULL) {
+            free(token_bytes);
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int store_journal_test()
+{
+    int ret = 0;
+    uint64_t ticket_time = 40000000000ull;
+    uint64_t current_time = 50000000000ull;
+    uint32_t ttl = 100000;
+    uint8_t ticket[128];
+    uint64_t simulated_time = current_time;
+    int last_err = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    (void)picoquic_file_delete(test_journal_file_name, &last_err);
+
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = picoquic_use_store_journal(quic, test_journal_file_name, picoquic_journal_fsync_never);
+    }
+
+    /* Store a set of tickets and tokens; each call appends to the journal */
+    for (size_t i = 0; ret == 0 && i < nb_test_sni; i++) {
+        ret = create_test_ticket(ticket_time / 1000, ttl, ticket, (uint16_t)(64 + i));
+
+        if (ret == 0) {
+            ret = picoquic_store_ticket(quic,
+                test_sni[i], (uint16_t)strlen(test_sni[i]),
+                test_alpn[0], (uint16_t)strlen(test_alpn[0]),
+                test_version[0], NULL, 0, NULL, 0,
+                ticket, (uint16_t)(64 + i), &test_tp);
+        }
+
+        if (ret == 0) {
+            ret = create_test_token(current_time, ttl, ticket, (uint16_t)(48 + i));
+        }
+
+        if (ret == 0) {
+            ret = picoquic_store_token(quic,
+                test_sni[i], (uint16_t)strlen(test_sni[i]),
+                test_ip_addr[0].ip_addr, test_ip_addr[0].ip_addr_length,
+                ticket, (uint16_t)(48 + i));
+        }
+    }
+
+    /* Close without any save call; the journal is the only persistence */
+    if (quic != NULL) {
+        picoquic_free(quic);
+        quic = NULL;
+    }
+
+    if (ret == 0) {
+        ret = store_journal_load_and_check(&simulated_time);
+    }
+
+    /* Simulate a crash in mid-append by adding a garbage tail, then
+     * verify that replay still recovers the complete records */
+    if (ret == 0) {
+        FILE* F = picoquic_file_open(test_journal_file_name, "ab");
+
+        if (F == NULL) {
+            ret = -1;
+        }
+        else {
+            uint8_t garbage[13] = { picoquic_journal_record_ticket, 9, 0, 0, 0, 0xde, 0xad, 0xbe, 0xef, 0, 0, 0, 0 };
+
+            if (fwrite(garbage, 1, sizeof(garbage), F) != sizeof(garbage)) {
+                ret = -1;
+            }
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    if (ret == 0) {
+        ret = store_journal_load_and_check(&simulated_time);
+    }
+
+    /* The second load compacted the journal, trimming the garbage tail;
+     * a third load must find the same records */
+    if (ret == 0) {
+        ret = store_journal_load_and_check(&simulated_time);
+    }
+
+    if (ret == 0) {
+        (void)picoquic_file_delete(test_journal_file_name, &last_err);
+    }
+
+    return ret;
+}
+
 /* Check the protection against token reuse */
 typedef struct st_token_reuse_api_case_t {
     uint64_t expiry_date;
@@ -728,10 +1127,105 @@ int ticket_seed_test_one(int bdp_option)
 }
 
 int ticket_seed_test() {
-    
+
    return ticket_seed_test_one(1);
 }
 
+/* Server-side congestion hints cache: verify that the provider is consulted
+ * when a connection is accepted, that the returned estimates seed the
+ * connection, and that the update callback learns from the measured path. */
+typedef struct st_seed_hints_test_ctx_t {
+    int nb_lookups;
+    int nb_updates;
+    uint64_t updated_rtt;
+    uint64_t updated_cwin;
+} seed_hints_test_ctx_t;
+
+static int test_seed_hints_provider(void* seed_hints_ctx,
+    const struct sockaddr* addr_peer, uint64_t* rtt_estimate, uint64_t* cwin_estimate)
+{
+    seed_hints_test_ctx_t* hints = (seed_hints_test_ctx_t*)seed_hints_ctx;
+
+    hints->nb_lookups++;
+    *rtt_estimate = 20000;
+    *cwin_estimate = 1000000;
+
+    return 0;
+}
+
+static void test_seed_hints_update(void* seed_hints_ctx,
+    const struct sockaddr* addr_peer, uint64_t rtt_min, uint64_t cwin)
+{
+    seed_hints_test_ctx_t* hints = (seed_hints_test_ctx_t*)seed_hints_ctx;
+
+    hints->nb_updates++;
+    hints->updated_rtt = rtt_min;
+    hints->updated_cwin = cwin;
+}
+
+int cc_seed_hints_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t max_completion_microsec = 1000000;
+    seed_hints_test_ctx_t hints = { 0 };
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    char const* hints_seed_store = "seed_hints_store.bin";
+
+    /* Initialize an empty ticket store so that session tickets are issued */
+    ret = picoquic_save_tickets(NULL, simulated_time, hints_seed_store);
+
+    if (ret == 0) {
+        ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+            PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, hints_seed_store, NULL, 0, 0, 0);
+    }
+
+    if (ret == 0) {
+        picoquic_set_seed_hints_provider(test_ctx->qserver,
+            test_seed_hints_provider, test_seed_hints_update, &hints);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        if (hints.nb_lookups < 1) {
+            DBG_PRINTF("%s", "Hints provider was not consulted.");
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server == NULL ||
+            test_ctx->cnx_server->seed_rtt_min != 20000 ||
+            test_ctx->cnx_server->seed_cwin != 1000000) {
+            DBG_PRINTF("%s", "Hint estimates were not seeded on the server connection.");
+            ret = -1;
+        }
+    }
+
+    /* Run a data scenario so the server measures the path and seeds tickets */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_ticket_seed, sizeof(test_scenario_ticket_seed));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, max_completion_microsec);
+    }
+
+    if (ret == 0 && (hints.nb_updates < 1 || hints.updated_rtt == 0)) {
+        DBG_PRINTF("%s", "Hints cache was not updated from the measured path.");
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 
 int ticket_seed_from_bdp_frame_test() {
     
@@ -3785,6 +3785,97 @@ int tls_retry_token_valid_test()
     return ret;
 }
 
+/* Unit test of the retry offload model: an external retry service and a
+ * server that share a retry token key. The "appliance" context issues a
+ * token; the server context, created with a different ticket key, must
+ * validate it. A server without the shared key must reject it, and the
+ * shared key must not leak into ticket protection.
+ */
+int tls_retry_token_offload_test()
+{
+    int ret = 0;
+    int is_new_token = 0;
+    struct sockaddr_in addr1;
+    picoquic_connection_id_t odcid = { { 3,3,3,3,3,3,3,3}, 8 };
+    picoquic_connection_id_t rcid = { { 1,1,1,1,1,1,1,1}, 8 };
+    picoquic_connection_id_t odcid_found;
+    uint64_t time_base = 10000;
+    uint8_t token_buffer[128];
+    size_t token_size = 0;
+    uint8_t shared_key[16] = { 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5 };
+    uint8_t other_ticket_key[16] = { 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    picoquic_quic_t* q_appliance = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL, NULL,
+        time_base * 1000000, NULL, NULL, test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key));
+    picoquic_quic_t* q_server = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL, NULL,
+        time_base * 1000000, NULL, NULL, other_ticket_key, sizeof(other_ticket_key));
+    picoquic_quic_t* q_stranger = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL, NULL,
+        time_base * 1000000, NULL, NULL, other_ticket_key, sizeof(other_ticket_key));
+
+    picoquic_set_test_address(&addr1, 0x01010101, 1234);
+
+    if (q_appliance == NULL || q_server == NULL || q_stranger == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_set_retry_token_key(q_appliance, shared_key, sizeof(shared_key)) != 0 ||
+        picoquic_set_retry_token_key(q_server, shared_key, sizeof(shared_key)) != 0) {
+        DBG_PRINTF("%s", "Cannot set the shared retry token key\n");
+        ret = -1;
+    }
+    else if (picoquic_prepare_retry_token(q_appliance, (struct sockaddr*)&addr1,
+        time_base * 1000000, &odcid, &rcid, 1,
+        token_buffer, sizeof(token_buffer), &token_size) != 0) {
+        DBG_PRINTF("%s", "Cannot prepare the token at the appliance\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* The server configured with the shared key validates the token */
+        if (picoquic_verify_retry_token(q_server, (struct sockaddr*)&addr1,
+            time_base * 1000000, &is_new_token, &odcid_found, &rcid, 2,
+            token_buffer, token_size, 0) != 0 ||
+            picoquic_compare_connection_id(&odcid, &odcid_found) != 0) {
+            DBG_PRINTF("%s", "Server does not validate the appliance token\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A server without the shared key must reject the token */
+        if (picoquic_verify_retry_token(q_stranger, (struct sockaddr*)&addr1,
+            time_base * 1000000, &is_new_token, &odcid_found, &rcid, 2,
+            token_buffer, token_size, 0) == 0) {
+            DBG_PRINTF("%s", "Server without the shared key accepts the token\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Rotating the shared key invalidates previously issued tokens */
+        if (picoquic_set_retry_token_key(q_server, other_ticket_key, sizeof(other_ticket_key)) != 0) {
+            DBG_PRINTF("%s", "Cannot rotate the shared retry token key\n");
+            ret = -1;
+        }
+        else if (picoquic_verify_retry_token(q_server, (struct sockaddr*)&addr1,
+            time_base * 1000000, &is_new_token, &odcid_found, &rcid, 2,
+            token_buffer, token_size, 0) == 0) {
+            DBG_PRINTF("%s", "Token accepted after key rotation\n");
+            ret = -1;
+        }
+    }
+
+    if (q_appliance != NULL) {
+        picoquic_free(q_appliance);
+    }
+    if (q_server != NULL) {
+        picoquic_free(q_server);
+    }
+    if (q_stranger != NULL) {
+        picoquic_free(q_stranger);
+    }
+
+    return ret;
+}
+
 int tls_api_retry_test_one(int large_client_hello)
 {
     uint64_t simulated_time = 0;
@@ -4731,6 +4822,55 @@ int mtu_max_test()
     return ret;
 }
 
+/* MTU discovery in sprint mode, with the expected route MTU seeded on the
+ * client. The seed is the link MTU; for IPv4 the resulting probe size is
+ * 28 bytes less, which is also the value that basic discovery converges to.
+ */
+int mtu_sprint_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        picoquic_set_default_pmtud_sprint(test_ctx->qserver, 1);
+        picoquic_cnx_set_pmtud_sprint(test_ctx->cnx_client, 1);
+        picoquic_seed_expected_pmtu(test_ctx->cnx_client, 1468);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_mtu_discovery, sizeof(test_scenario_mtu_discovery));
+    }
+
+    /* Perform a data sending loop */
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_client->path[0]->send_mtu != 1440) {
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server->path[0]->send_mtu != 1440) {
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 /*
 * MTU drop test. Perform a long duration transmission.
 * Verify that MTU was properly set to expected value, then
@@ -5020,6 +5160,199 @@ int bad_certificate_test()
     return ret;
 }
 
+/* Test of deferred server credentials: registering the certificate and key
+ * file names does not parse them; the chain is loaded on demand and only
+ * once; a bad file name fails, and the failure is remembered instead of
+ * retrying the file system on every call.
+ */
+int tls_lazy_credentials_test()
+{
+    int ret = 0;
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    picoquic_quic_t* quic = NULL;
+
+    ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir,
+        PICOQUIC_TEST_FILE_SERVER_CERT);
+
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir,
+            PICOQUIC_TEST_FILE_SERVER_KEY);
+    }
+
+    if (ret == 0) {
+        quic = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL, NULL,
+            0, NULL, NULL, test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key));
+        if (quic == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ptls_context_t* tls_ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+        if (picoquic_set_tls_credentials_files(quic, test_server_cert_file, test_server_key_file) != 0) {
+            DBG_PRINTF("%s", "Cannot register the credential files\n");
+            ret = -1;
+        }
+        else if (tls_ctx->certificates.count != 0) {
+            DBG_PRINTF("%s", "Registration parsed the chain immediately\n");
+            ret = -1;
+        }
+        else if (picoquic_tls_load_credentials_if_needed(quic) != 0) {
+            DBG_PRINTF("%s", "Cannot load the deferred credentials\n");
+            ret = -1;
+        }
+        else if (tls_ctx->certificates.count == 0 || tls_ctx->sign_certificate == NULL) {
+            DBG_PRINTF("%s", "Credentials not installed after loading\n");
+            ret = -1;
+        }
+        else if (quic->lazy_cert_file_name != NULL ||
+            picoquic_tls_load_credentials_if_needed(quic) != 0) {
+            DBG_PRINTF("%s", "Second load is not a null operation\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A bad file name must fail, and fail fast on retries */
+        if (picoquic_set_tls_credentials_files(quic, "no_such_cert_file.pem", test_server_key_file) != 0) {
+            DBG_PRINTF("%s", "Cannot register the bad credential files\n");
+            ret = -1;
+        }
+        else if (picoquic_tls_load_credentials_if_needed(quic) == 0) {
+            DBG_PRINTF("%s", "Loading a missing certificate succeeds\n");
+            ret = -1;
+        }
+        else if (!quic->lazy_credentials_failed ||
+            picoquic_tls_load_credentials_if_needed(quic) == 0) {
+            DBG_PRINTF("%s", "Load failure is not remembered\n");
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the deferred certificate verifier: creating a context does not
+ * build the verifier or load the root certificate store; creating a client
+ * connection does, exactly once.
+ */
+int tls_lazy_verifier_test()
+{
+    int ret = 0;
+    char test_server_cert_store_file[512];
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_storage addr;
+
+    ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file),
+        picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+
+    if (ret == 0) {
+        (void)picoquic_store_text_addr(&addr, "10.0.0.1", 443);
+        quic = picoquic_create(8, NULL, NULL, test_server_cert_store_file, PICOQUIC_TEST_ALPN,
+            NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+        if (quic == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ptls_context_t* tls_ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+        if (tls_ctx->verify_certificate != NULL || !quic->verifier_pending) {
+            DBG_PRINTF("%s", "Verifier was built at context creation\n");
+            ret = -1;
+        }
+        else if ((cnx = picoquic_create_cnx(quic, picoquic_null_connection_id,
+            picoquic_null_connection_id, (struct sockaddr*)&addr, 0, 0,
+            "test-sni", PICOQUIC_TEST_ALPN, 1)) == NULL) {
+            DBG_PRINTF("%s", "Cannot create the client connection\n");
+            ret = -1;
+        }
+        else if (tls_ctx->verify_certificate == NULL || !quic->is_cert_store_not_empty ||
+            quic->verifier_pending) {
+            DBG_PRINTF("%s", "Verifier not built at client connection creation\n");
+            ret = -1;
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/*
+* Test the pool of precomputed key shares. Fill the pool, verify that
+* starting a client connection consumes one share, and that the pool can
+* be released.
+*/
+
+int key_share_pool_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_storage addr;
+
+    (void)picoquic_store_text_addr(&addr, "10.0.0.1", 443);
+    quic = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_TEST_ALPN,
+        NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (quic == NULL) {
+        ret = -1;
+    }
+    else if (picoquic_precompute_key_shares(quic, 4) != 0) {
+        DBG_PRINTF("%s", "Cannot precompute the key shares\n");
+        ret = -1;
+    }
+    else if (picoquic_nb_precomputed_key_shares() != 4) {
+        DBG_PRINTF("Expected 4 precomputed shares, got %zu\n",
+            picoquic_nb_precomputed_key_shares());
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(quic, picoquic_null_connection_id,
+        picoquic_null_connection_id, (struct sockaddr*)&addr, 0, 0,
+        "test-sni", PICOQUIC_TEST_ALPN, 1)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create the client connection\n");
+        ret = -1;
+    }
+    else if (picoquic_start_client_cnx(cnx) != 0) {
+        DBG_PRINTF("%s", "Cannot start the client connection\n");
+        ret = -1;
+    }
+    else if (picoquic_nb_precomputed_key_shares() != 3) {
+        DBG_PRINTF("Expected 3 precomputed shares after start, got %zu\n",
+            picoquic_nb_precomputed_key_shares());
+        ret = -1;
+    }
+
+    picoquic_release_precomputed_key_shares();
+
+    if (ret == 0 && picoquic_nb_precomputed_key_shares() != 0) {
+        DBG_PRINTF("%s", "Pool not empty after release\n");
+        ret = -1;
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 /*
 * Test setting the verify certificate callback.
 */
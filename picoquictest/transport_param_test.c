@@ -804,6 +804,90 @@ int transport_param_fuzz_test(int mode, uint32_t version, uint32_t proposed_vers
     return ret;
 }
 
+/* Verify the memoization of the transport parameter layout. The first
+ * decoding populates the per context layout cache; decoding the same blob
+ * again takes the memoized fast path and must produce the same parameter
+ * values, and a blob with a different layout must fall back to the generic
+ * parser. */
+int transport_param_layout_cache_test()
+{
+    int ret;
+    picoquic_quic_t* quic_ctx = NULL;
+    picoquic_cnx_t* test_cnx = NULL;
+    uint8_t buffer[256];
+    size_t encoded = 0, decoded = 0;
+    uint64_t simulated_time = 0;
+    uint32_t version_default = picoquic_supported_versions[0].version;
+
+    ret = transport_param_set_contexts(&quic_ctx, &test_cnx, &simulated_time, 0);
+
+    if (ret == 0) {
+        memcpy(&test_cnx->local_parameters, &transport_param_test1, sizeof(picoquic_tp_t));
+        test_cnx->version_index = picoquic_get_version_index(version_default);
+        test_cnx->proposed_version = version_default;
+
+        ret = picoquic_prepare_transport_extensions(test_cnx, 0, buffer, sizeof(buffer), &encoded);
+    }
+
+    if (ret == 0) {
+        /* First decoding, through the generic parser, memoizes the layout */
+        ret = picoquic_receive_transport_extensions(test_cnx, 0, buffer, encoded, &decoded);
+
+        if (ret == 0 && quic_ctx->tp_layout_cache == NULL) {
+            DBG_PRINTF("%s", "Layout not memoized after first decoding\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Second decoding of the same blob takes the fast path */
+        ret = picoquic_receive_transport_extensions(test_cnx, 0, buffer, encoded, &decoded);
+
+        if (ret != 0 || decoded != encoded) {
+            DBG_PRINTF("Fast path decoding returns %x, decoded %d vs %d\n", ret, (int)decoded, (int)encoded);
+            ret = -1;
+        }
+        else if (transport_param_compare(&test_cnx->remote_parameters, &transport_param_test1) != 0) {
+            DBG_PRINTF("%s", "Fast path parameter values don't match\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* A blob with a different layout falls back to the generic parser */
+        int suspended = debug_printf_reset(1);
+        int err_ret = picoquic_receive_transport_extensions(test_cnx, 0, buffer, encoded - 1, &decoded);
+
+        (void)debug_printf_reset(suspended);
+
+        if (err_ret == 0) {
+            DBG_PRINTF("%s", "Truncated blob was accepted\n");
+            ret = -1;
+        }
+        else {
+            /* Reset the error state, then check that the full blob still decodes */
+            test_cnx->cnx_state = picoquic_state_client_init;
+            test_cnx->local_error = 0;
+            ret = picoquic_receive_transport_extensions(test_cnx, 0, buffer, encoded, &decoded);
+
+            if (ret != 0 || transport_param_compare(&test_cnx->remote_parameters, &transport_param_test1) != 0) {
+                DBG_PRINTF("%s", "Decoding after fallback failed\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (test_cnx != NULL) {
+        picoquic_delete_cnx(test_cnx);
+    }
+
+    if (quic_ctx != NULL) {
+        picoquic_free(quic_ctx);
+    }
+
+    return ret;
+}
+
 int transport_param_test()
 {
     int ret = 0;
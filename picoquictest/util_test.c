@@ -455,3 +455,93 @@ int util_threading_test()
     return ret;
 }
 
+
+/* Test of the structured diagnostic event callback: events carry the
+ * severity, subsystem and event id, the per event rate limiter
+ * suppresses repeats within the minimum interval, and clearing the
+ * callback restores the default behavior.
+ */
+typedef struct st_diag_event_test_ctx_t {
+    int nb_events;
+    picoquic_diag_severity_enum last_severity;
+    int last_subsystem;
+    uint64_t last_event_id;
+    uint64_t last_nb_suppressed;
+    int last_arg;
+} diag_event_test_ctx_t;
+
+static void diag_event_test_cb(void* v_diag_ctx, picoquic_diag_severity_enum severity,
+    int subsystem_id, uint64_t event_id, uint64_t nb_suppressed, const char* fmt, va_list args)
+{
+    diag_event_test_ctx_t* ctx = (diag_event_test_ctx_t*)v_diag_ctx;
+
+    ctx->nb_events++;
+    ctx->last_severity = severity;
+    ctx->last_subsystem = subsystem_id;
+    ctx->last_event_id = event_id;
+    ctx->last_nb_suppressed = nb_suppressed;
+    if (fmt != NULL) {
+        ctx->last_arg = va_arg(args, int);
+    }
+}
+
+int util_diag_event_test()
+{
+    int ret = 0;
+    diag_event_test_ctx_t ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    /* With no rate limit, every event is delivered with its arguments */
+    picoquic_set_diag_event_callback(diag_event_test_cb, &ctx, 0);
+    for (int i = 0; i < 3; i++) {
+        PICOQUIC_DIAG(picoquic_diag_severity_warning, PICOQUIC_SOCKS, "test event %d", 17);
+    }
+    if (ctx.nb_events != 3 ||
+        ctx.last_severity != picoquic_diag_severity_warning ||
+        ctx.last_subsystem != PICOQUIC_SOCKS ||
+        (ctx.last_event_id >> 32) != PICOQUIC_SOCKS ||
+        ctx.last_arg != 17) {
+        DBG_PRINTF("Got %d events, subsystem %d, id %" PRIx64 ", arg %d",
+            ctx.nb_events, ctx.last_subsystem, ctx.last_event_id, ctx.last_arg);
+        ret = -1;
+    }
+
+    /* With a long minimum interval, only the first occurrence of an
+     * event id is delivered, repeats are suppressed */
+    if (ret == 0) {
+        memset(&ctx, 0, sizeof(ctx));
+        picoquic_set_diag_event_callback(diag_event_test_cb, &ctx, 3600000000ull);
+        for (int i = 0; i < 5; i++) {
+            picoquic_diag_event(picoquic_diag_severity_error, PICOQUIC_SENDER, 0x1234, "repeat %d", i);
+        }
+        if (ctx.nb_events != 1 || ctx.last_nb_suppressed != 0 ||
+            ctx.last_event_id != 0x1234) {
+            DBG_PRINTF("Rate limit delivered %d events, %" PRIu64 " suppressed",
+                ctx.nb_events, ctx.last_nb_suppressed);
+            ret = -1;
+        }
+        else {
+            /* A different event id has its own budget */
+            picoquic_diag_event(picoquic_diag_severity_info, PICOQUIC_SENDER, 0x5678, "other %d", 1);
+            if (ctx.nb_events != 2 || ctx.last_event_id != 0x5678) {
+                DBG_PRINTF("Second event id not delivered, %d events", ctx.nb_events);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Clearing the callback stops deliveries */
+    picoquic_set_diag_event_callback(NULL, NULL, 0);
+    if (ret == 0) {
+        int nb_before = ctx.nb_events;
+
+        PICOQUIC_DIAG(picoquic_diag_severity_info, PICOQUIC_SENDER, "after clear %d", 1);
+        if (ctx.nb_events != nb_before) {
+            DBG_PRINTF("%s", "Cleared callback still delivered an event");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
@@ -52,6 +52,14 @@ int picoquic_sample_background(char const* server_name, int server_port, char co
 
 int picoquic_sample_server(int server_port, const char* pem_cert, const char* pem_key, const char * default_dir);
 
+/* Multi-client benchmark harness: runs nb_servers server contexts and
+ * nb_clients client contexts in-process, each on its own network
+ * thread, over loopback sockets. The scenario describes the payload
+ * mix per client, e.g. "10*5000,2*1000000"; results are written as
+ * CSV to result_file. */
+int picoquic_sample_bench(int first_port, int nb_servers, int nb_clients,
+    const char* pem_cert, const char* pem_key, char const* scenario, char const* result_file);
+
 #ifdef __cplusplus
 }
 #endif
@@ -53,6 +53,9 @@ static void usage(char const * sample_name)
     fprintf(stderr, "    %s background server_name port folder\n", sample_name);
     fprintf(stderr, "or :\n");
     fprintf(stderr, "    %s server port cert_file private_key_file folder\n", sample_name);
+    fprintf(stderr, "or :\n");
+    fprintf(stderr, "    %s bench first_port nb_servers nb_clients cert_file private_key_file scenario result_file\n", sample_name);
+    fprintf(stderr, "    (scenario is the payload mix per client, e.g. 10*5000,2*1000000)\n");
     exit(1);
 }
 
@@ -100,6 +103,19 @@ int main(int argc, char** argv)
             exit_code = picoquic_sample_background(argv[2], server_port, argv[4]);
         }
     }
+    else if (strcmp(argv[1], "bench") == 0) {
+        if (argc != 9) {
+            usage(argv[0]);
+        }
+        else {
+            int first_port = get_port(argv[0], argv[2]);
+            int nb_servers = atoi(argv[3]);
+            int nb_clients = atoi(argv[4]);
+
+            exit_code = picoquic_sample_bench(first_port, nb_servers, nb_clients,
+                argv[5], argv[6], argv[7], argv[8]);
+        }
+    }
     else if (strcmp(argv[1], "server") == 0) {
         if (argc != 6) {
             usage(argv[0]);
@@ -0,0 +1,574 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* The "bench" mode of the sample program runs a multi-client benchmark
+ * in a single process, over real sockets on the loopback interface.
+ * It starts a number of server contexts, each on its own port and
+ * network thread, and a number of client contexts, each on its own
+ * thread, connecting to the servers in round robin. Instead of files,
+ * clients request synthetic payloads: the "file name" sent on each
+ * stream is the decimal size of the payload, and the server streams
+ * that many generated bytes back. The payload mix is configured as a
+ * scenario string, e.g. "10*5000,2*1000000" for ten transfers of 5KB
+ * and two of 1MB per client.
+ *
+ * When all clients are done (or the time limit expires) the harness
+ * writes a CSV result file, one line per client plus a total line, so
+ * successive library versions can be compared mechanically.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <picoquic.h>
+#include <picoquic_utils.h>
+#include <picosocks.h>
+#include <picoquic_packet_loop.h>
+#include "picoquic_sample.h"
+
+#ifdef _WINDOWS
+#define BENCH_SLEEP(x) Sleep(x)
+#else
+#include <unistd.h>
+#define BENCH_SLEEP(x) usleep((x)*1000)
+#endif
+
+#define SAMPLE_BENCH_MAX_NODES 32
+#define SAMPLE_BENCH_MAX_MIX 16
+#define SAMPLE_BENCH_TIME_LIMIT 120000000ull /* 120 seconds, in microseconds */
+
+typedef struct st_sample_bench_mix_item_t {
+    int nb_transfers;
+    uint64_t size;
+} sample_bench_mix_item_t;
+
+typedef struct st_sample_bench_mix_t {
+    sample_bench_mix_item_t item[SAMPLE_BENCH_MAX_MIX];
+    int nb_items;
+    int nb_streams;
+    uint64_t nb_bytes;
+} sample_bench_mix_t;
+
+/* Parse the scenario string, a comma separated list of
+ * <nb_transfers>*<size> items. */
+static int sample_bench_parse_mix(char const* scenario, sample_bench_mix_t* mix)
+{
+    int ret = 0;
+    char const* p = scenario;
+
+    memset(mix, 0, sizeof(sample_bench_mix_t));
+    while (ret == 0 && *p != 0) {
+        char* after = NULL;
+        long nb_transfers = strtol(p, &after, 10);
+
+        if (after == p || *after != '*' || nb_transfers <= 0) {
+            ret = -1;
+        }
+        else {
+            unsigned long long size;
+            p = after + 1;
+            size = strtoull(p, &after, 10);
+            if (after == p || size == 0 || mix->nb_items >= SAMPLE_BENCH_MAX_MIX) {
+                ret = -1;
+            }
+            else {
+                mix->item[mix->nb_items].nb_transfers = (int)nb_transfers;
+                mix->item[mix->nb_items].size = (uint64_t)size;
+                mix->nb_items++;
+                mix->nb_streams += (int)nb_transfers;
+                mix->nb_bytes += ((uint64_t)nb_transfers) * size;
+                p = after;
+                if (*p == ',') {
+                    p++;
+                }
+                else if (*p != 0) {
+                    ret = -1;
+                }
+            }
+        }
+    }
+    if (ret == 0 && mix->nb_items == 0) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Invalid scenario: <%s>, expected e.g. 10*5000,2*1000000\n", scenario);
+    }
+    return ret;
+}
+
+/* Server side. Each request stream carries the decimal payload size,
+ * fin-terminated; the response is that many generated bytes. */
+
+typedef struct st_sample_bench_server_stream_ctx_t {
+    struct st_sample_bench_server_stream_ctx_t* next_stream;
+    uint64_t stream_id;
+    uint64_t bytes_to_send;
+    uint64_t bytes_sent;
+    size_t name_length;
+    char name[24];
+    unsigned int is_name_read : 1;
+} sample_bench_server_stream_ctx_t;
+
+typedef struct st_sample_bench_server_conn_ctx_t {
+    sample_bench_server_stream_ctx_t* first_stream;
+} sample_bench_server_conn_ctx_t;
+
+static sample_bench_server_stream_ctx_t* sample_bench_server_create_stream(
+    sample_bench_server_conn_ctx_t* conn_ctx, uint64_t stream_id)
+{
+    sample_bench_server_stream_ctx_t* stream_ctx = (sample_bench_server_stream_ctx_t*)
+        malloc(sizeof(sample_bench_server_stream_ctx_t));
+
+    if (stream_ctx != NULL) {
+        memset(stream_ctx, 0, sizeof(sample_bench_server_stream_ctx_t));
+        stream_ctx->stream_id = stream_id;
+        stream_ctx->next_stream = conn_ctx->first_stream;
+        conn_ctx->first_stream = stream_ctx;
+    }
+    return stream_ctx;
+}
+
+static void sample_bench_server_delete_conn(sample_bench_server_conn_ctx_t* conn_ctx)
+{
+    while (conn_ctx->first_stream != NULL) {
+        sample_bench_server_stream_ctx_t* stream_ctx = conn_ctx->first_stream;
+        conn_ctx->first_stream = stream_ctx->next_stream;
+        free(stream_ctx);
+    }
+    free(conn_ctx);
+}
+
+static int sample_bench_server_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    sample_bench_server_conn_ctx_t* conn_ctx = (sample_bench_server_conn_ctx_t*)callback_ctx;
+    sample_bench_server_stream_ctx_t* stream_ctx = (sample_bench_server_stream_ctx_t*)v_stream_ctx;
+
+    if (conn_ctx == picoquic_get_default_callback_context(picoquic_get_quic_ctx(cnx))) {
+        /* First event on this connection: allocate a per-connection context */
+        conn_ctx = (sample_bench_server_conn_ctx_t*)malloc(sizeof(sample_bench_server_conn_ctx_t));
+        if (conn_ctx == NULL) {
+            picoquic_close(cnx, PICOQUIC_SAMPLE_INTERNAL_ERROR);
+            return 0;
+        }
+        memset(conn_ctx, 0, sizeof(sample_bench_server_conn_ctx_t));
+        picoquic_set_callback(cnx, sample_bench_server_callback, conn_ctx);
+    }
+
+    switch (fin_or_event) {
+    case picoquic_callback_stream_data:
+    case picoquic_callback_stream_fin:
+        if (stream_ctx == NULL) {
+            stream_ctx = sample_bench_server_create_stream(conn_ctx, stream_id);
+            if (stream_ctx == NULL) {
+                (void)picoquic_reset_stream(cnx, stream_id, PICOQUIC_SAMPLE_INTERNAL_ERROR);
+                break;
+            }
+            (void)picoquic_set_app_stream_ctx(cnx, stream_id, stream_ctx);
+        }
+        if (!stream_ctx->is_name_read) {
+            if (stream_ctx->name_length + length >= sizeof(stream_ctx->name)) {
+                (void)picoquic_reset_stream(cnx, stream_id, PICOQUIC_SAMPLE_NAME_TOO_LONG_ERROR);
+                break;
+            }
+            memcpy(stream_ctx->name + stream_ctx->name_length, bytes, length);
+            stream_ctx->name_length += length;
+            if (fin_or_event == picoquic_callback_stream_fin) {
+                stream_ctx->name[stream_ctx->name_length] = 0;
+                stream_ctx->bytes_to_send = strtoull(stream_ctx->name, NULL, 10);
+                stream_ctx->is_name_read = 1;
+                ret = picoquic_mark_active_stream(cnx, stream_id, 1, stream_ctx);
+            }
+        }
+        break;
+    case picoquic_callback_prepare_to_send:
+        if (stream_ctx != NULL) {
+            uint64_t remaining = stream_ctx->bytes_to_send - stream_ctx->bytes_sent;
+            size_t available = length;
+            int is_fin = 1;
+            uint8_t* buffer;
+
+            if (remaining < (uint64_t)available) {
+                available = (size_t)remaining;
+            }
+            else if (remaining > (uint64_t)available) {
+                is_fin = 0;
+            }
+            buffer = picoquic_provide_stream_data_buffer(bytes, available, is_fin, !is_fin);
+            if (buffer == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(buffer, 'b', available);
+                stream_ctx->bytes_sent += available;
+            }
+        }
+        break;
+    case picoquic_callback_stream_reset:
+    case picoquic_callback_stop_sending:
+        if (stream_ctx != NULL) {
+            stream_ctx->bytes_to_send = stream_ctx->bytes_sent;
+            (void)picoquic_reset_stream(cnx, stream_id, PICOQUIC_SAMPLE_FILE_CANCEL_ERROR);
+        }
+        break;
+    case picoquic_callback_close:
+    case picoquic_callback_application_close:
+    case picoquic_callback_stateless_reset:
+        sample_bench_server_delete_conn(conn_ctx);
+        picoquic_set_callback(cnx, NULL, NULL);
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+/* Client side. All streams of the payload mix are opened at start and
+ * the received bytes are counted, not stored. */
+
+typedef struct st_sample_bench_client_stream_ctx_t {
+    struct st_sample_bench_client_stream_ctx_t* next_stream;
+    uint64_t stream_id;
+    uint64_t bytes_expected;
+    uint64_t bytes_received;
+    unsigned int is_finished : 1;
+    unsigned int is_failed : 1;
+} sample_bench_client_stream_ctx_t;
+
+typedef struct st_sample_bench_client_ctx_t {
+    picoquic_cnx_t* cnx;
+    sample_bench_client_stream_ctx_t* first_stream;
+    int nb_streams;
+    int nb_streams_done;
+    int nb_streams_failed;
+    uint64_t bytes_received;
+    uint64_t start_time;
+    uint64_t end_time;
+    volatile int is_disconnected;
+} sample_bench_client_ctx_t;
+
+static void sample_bench_client_finish_stream(sample_bench_client_ctx_t* client_ctx,
+    sample_bench_client_stream_ctx_t* stream_ctx, int is_failed)
+{
+    if (!stream_ctx->is_finished) {
+        stream_ctx->is_finished = 1;
+        stream_ctx->is_failed = (is_failed ||
+            stream_ctx->bytes_received != stream_ctx->bytes_expected);
+        client_ctx->nb_streams_done++;
+        if (stream_ctx->is_failed) {
+            client_ctx->nb_streams_failed++;
+        }
+        if (client_ctx->nb_streams_done >= client_ctx->nb_streams) {
+            client_ctx->end_time = picoquic_current_time();
+            (void)picoquic_close(client_ctx->cnx, 0);
+        }
+    }
+}
+
+static int sample_bench_client_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    sample_bench_client_ctx_t* client_ctx = (sample_bench_client_ctx_t*)callback_ctx;
+    sample_bench_client_stream_ctx_t* stream_ctx = (sample_bench_client_stream_ctx_t*)v_stream_ctx;
+
+    switch (fin_or_event) {
+    case picoquic_callback_stream_data:
+    case picoquic_callback_stream_fin:
+        if (stream_ctx != NULL) {
+            stream_ctx->bytes_received += length;
+            client_ctx->bytes_received += length;
+            if (fin_or_event == picoquic_callback_stream_fin) {
+                sample_bench_client_finish_stream(client_ctx, stream_ctx, 0);
+            }
+        }
+        break;
+    case picoquic_callback_stream_reset:
+        if (stream_ctx != NULL) {
+            sample_bench_client_finish_stream(client_ctx, stream_ctx, 1);
+        }
+        break;
+    case picoquic_callback_close:
+    case picoquic_callback_application_close:
+    case picoquic_callback_stateless_reset:
+        if (client_ctx->end_time == 0) {
+            client_ctx->end_time = picoquic_current_time();
+        }
+        client_ctx->is_disconnected = 1;
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+static int sample_bench_client_loop_cb(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    int ret = 0;
+    sample_bench_client_ctx_t* client_ctx = (sample_bench_client_ctx_t*)callback_ctx;
+
+    if (client_ctx != NULL &&
+        (cb_mode == picoquic_packet_loop_after_receive || cb_mode == picoquic_packet_loop_after_send) &&
+        client_ctx->is_disconnected) {
+        ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+    }
+    return ret;
+}
+
+static int sample_bench_client_open_streams(sample_bench_client_ctx_t* client_ctx,
+    const sample_bench_mix_t* mix)
+{
+    int ret = 0;
+    uint64_t stream_id = 0;
+
+    for (int i = 0; ret == 0 && i < mix->nb_items; i++) {
+        for (int j = 0; ret == 0 && j < mix->item[i].nb_transfers; j++) {
+            sample_bench_client_stream_ctx_t* stream_ctx = (sample_bench_client_stream_ctx_t*)
+                malloc(sizeof(sample_bench_client_stream_ctx_t));
+            if (stream_ctx == NULL) {
+                ret = -1;
+            }
+            else {
+                char name[24];
+                size_t name_length;
+
+                memset(stream_ctx, 0, sizeof(sample_bench_client_stream_ctx_t));
+                stream_ctx->stream_id = stream_id;
+                stream_ctx->bytes_expected = mix->item[i].size;
+                stream_ctx->next_stream = client_ctx->first_stream;
+                client_ctx->first_stream = stream_ctx;
+                client_ctx->nb_streams++;
+                name_length = (size_t)snprintf(name, sizeof(name), "%" PRIu64, mix->item[i].size);
+                ret = picoquic_add_to_stream_with_ctx(client_ctx->cnx, stream_id,
+                    (const uint8_t*)name, name_length, 1, stream_ctx);
+                stream_id += 4;
+            }
+        }
+    }
+    return ret;
+}
+
+static void sample_bench_client_free(sample_bench_client_ctx_t* client_ctx)
+{
+    while (client_ctx->first_stream != NULL) {
+        sample_bench_client_stream_ctx_t* stream_ctx = client_ctx->first_stream;
+        client_ctx->first_stream = stream_ctx->next_stream;
+        free(stream_ctx);
+    }
+}
+
+/* Write the machine readable result file, one CSV line per client and
+ * a total line. Throughput counts application bytes only. */
+static int sample_bench_write_results(char const* result_file,
+    sample_bench_client_ctx_t* client_ctx, int nb_clients)
+{
+    int ret = 0;
+    FILE* F = picoquic_file_open(result_file, "w");
+
+    if (F == NULL) {
+        fprintf(stderr, "Cannot open result file <%s>\n", result_file);
+        ret = -1;
+    }
+    else {
+        uint64_t total_bytes = 0;
+        uint64_t max_elapsed = 0;
+        int total_ok = 0;
+        int total_failed = 0;
+
+        fprintf(F, "client,elapsed_us,bytes,streams_ok,streams_failed,mbps\n");
+        for (int i = 0; i < nb_clients; i++) {
+            sample_bench_client_ctx_t* c = &client_ctx[i];
+            uint64_t elapsed = (c->end_time > c->start_time) ? c->end_time - c->start_time : 0;
+            double mbps = (elapsed > 0) ? (8.0 * (double)c->bytes_received) / (double)elapsed : 0.0;
+
+            fprintf(F, "%d,%" PRIu64 ",%" PRIu64 ",%d,%d,%.3f\n",
+                i, elapsed, c->bytes_received,
+                c->nb_streams_done - c->nb_streams_failed,
+                c->nb_streams_failed + (c->nb_streams - c->nb_streams_done), mbps);
+            total_bytes += c->bytes_received;
+            total_ok += c->nb_streams_done - c->nb_streams_failed;
+            total_failed += c->nb_streams_failed + (c->nb_streams - c->nb_streams_done);
+            if (elapsed > max_elapsed) {
+                max_elapsed = elapsed;
+            }
+        }
+        fprintf(F, "total,%" PRIu64 ",%" PRIu64 ",%d,%d,%.3f\n",
+            max_elapsed, total_bytes, total_ok, total_failed,
+            (max_elapsed > 0) ? (8.0 * (double)total_bytes) / (double)max_elapsed : 0.0);
+        (void)picoquic_file_close(F);
+    }
+    return ret;
+}
+
+int picoquic_sample_bench(int first_port, int nb_servers, int nb_clients,
+    const char* pem_cert, const char* pem_key, char const* scenario, char const* result_file)
+{
+    int ret = 0;
+    sample_bench_mix_t mix;
+    uint64_t current_time = picoquic_current_time();
+    picoquic_quic_t* server_quic[SAMPLE_BENCH_MAX_NODES] = { NULL };
+    picoquic_quic_t* client_quic[SAMPLE_BENCH_MAX_NODES] = { NULL };
+    picoquic_network_thread_ctx_t* server_thread[SAMPLE_BENCH_MAX_NODES] = { NULL };
+    picoquic_network_thread_ctx_t* client_thread[SAMPLE_BENCH_MAX_NODES] = { NULL };
+    picoquic_packet_loop_param_t server_param[SAMPLE_BENCH_MAX_NODES];
+    picoquic_packet_loop_param_t client_param[SAMPLE_BENCH_MAX_NODES];
+    sample_bench_client_ctx_t client_ctx[SAMPLE_BENCH_MAX_NODES];
+
+    memset(server_param, 0, sizeof(server_param));
+    memset(client_param, 0, sizeof(client_param));
+    memset(client_ctx, 0, sizeof(client_ctx));
+
+    if (nb_servers <= 0 || nb_servers > SAMPLE_BENCH_MAX_NODES ||
+        nb_clients <= 0 || nb_clients > SAMPLE_BENCH_MAX_NODES) {
+        fprintf(stderr, "Number of servers and clients must be between 1 and %d\n",
+            SAMPLE_BENCH_MAX_NODES);
+        ret = -1;
+    }
+    else {
+        ret = sample_bench_parse_mix(scenario, &mix);
+    }
+
+    /* Start the servers, one port and one network thread each */
+    for (int i = 0; ret == 0 && i < nb_servers; i++) {
+        server_quic[i] = picoquic_create((uint32_t)(2 * nb_clients), pem_cert, pem_key, NULL,
+            PICOQUIC_SAMPLE_ALPN, sample_bench_server_callback, NULL,
+            NULL, NULL, NULL, current_time, NULL, NULL, NULL, 0);
+        if (server_quic[i] == NULL) {
+            fprintf(stderr, "Could not create server context %d\n", i);
+            ret = -1;
+        }
+        else {
+            int thread_ret = 0;
+            picoquic_set_default_congestion_algorithm(server_quic[i], picoquic_bbr_algorithm);
+            server_param[i].local_port = (uint16_t)(first_port + i);
+            server_thread[i] = picoquic_start_custom_network_thread(server_quic[i], &server_param[i],
+                picoquic_internal_thread_create, picoquic_internal_thread_delete,
+                picoquic_internal_thread_setname, "bench_server", NULL, NULL, &thread_ret);
+            if (server_thread[i] == NULL) {
+                fprintf(stderr, "Could not start server thread %d, ret = %d\n", i, thread_ret);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Start the clients, round robin over the server ports */
+    for (int i = 0; ret == 0 && i < nb_clients; i++) {
+        struct sockaddr_storage server_address;
+        int is_name = 0;
+        int server_port = first_port + (i % nb_servers);
+        picoquic_cnx_t* cnx = NULL;
+
+        ret = picoquic_get_server_address("127.0.0.1", server_port, &server_address, &is_name);
+        if (ret == 0) {
+            client_quic[i] = picoquic_create(1, NULL, NULL, NULL, PICOQUIC_SAMPLE_ALPN,
+                NULL, NULL, NULL, NULL, NULL, current_time, NULL, NULL, NULL, 0);
+            if (client_quic[i] == NULL) {
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            picoquic_set_default_congestion_algorithm(client_quic[i], picoquic_bbr_algorithm);
+            cnx = picoquic_create_cnx(client_quic[i], picoquic_null_connection_id,
+                picoquic_null_connection_id, (struct sockaddr*)&server_address,
+                current_time, 0, PICOQUIC_SAMPLE_SNI, PICOQUIC_SAMPLE_ALPN, 1);
+            if (cnx == NULL) {
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            client_ctx[i].cnx = cnx;
+            client_ctx[i].start_time = picoquic_current_time();
+            picoquic_set_callback(cnx, sample_bench_client_callback, &client_ctx[i]);
+            ret = sample_bench_client_open_streams(&client_ctx[i], &mix);
+            if (ret == 0) {
+                ret = picoquic_start_client_cnx(cnx);
+            }
+        }
+        if (ret == 0) {
+            int thread_ret = 0;
+            client_param[i].local_af = server_address.ss_family;
+            client_thread[i] = picoquic_start_custom_network_thread(client_quic[i], &client_param[i],
+                picoquic_internal_thread_create, picoquic_internal_thread_delete,
+                picoquic_internal_thread_setname, "bench_client",
+                sample_bench_client_loop_cb, &client_ctx[i], &thread_ret);
+            if (client_thread[i] == NULL) {
+                fprintf(stderr, "Could not start client thread %d, ret = %d\n", i, thread_ret);
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            fprintf(stderr, "Could not start client %d\n", i);
+        }
+    }
+
+    /* Wait for the clients, within the time limit */
+    if (ret == 0) {
+        uint64_t start = picoquic_current_time();
+        int nb_done = 0;
+
+        while (nb_done < nb_clients &&
+            picoquic_current_time() - start < SAMPLE_BENCH_TIME_LIMIT) {
+            nb_done = 0;
+            for (int i = 0; i < nb_clients; i++) {
+                nb_done += (client_ctx[i].is_disconnected) ? 1 : 0;
+            }
+            if (nb_done < nb_clients) {
+                BENCH_SLEEP(10);
+            }
+        }
+        if (nb_done < nb_clients) {
+            fprintf(stderr, "Time limit reached, %d of %d clients done\n", nb_done, nb_clients);
+        }
+    }
+
+    /* Stop the threads; deleting a network thread closes its loop */
+    for (int i = 0; i < nb_clients; i++) {
+        if (client_thread[i] != NULL) {
+            picoquic_delete_network_thread(client_thread[i]);
+        }
+        if (client_quic[i] != NULL) {
+            picoquic_free(client_quic[i]);
+        }
+    }
+    for (int i = 0; i < nb_servers; i++) {
+        if (server_thread[i] != NULL) {
+            picoquic_delete_network_thread(server_thread[i]);
+        }
+        if (server_quic[i] != NULL) {
+            picoquic_free(server_quic[i]);
+        }
+    }
+
+    if (ret == 0) {
+        ret = sample_bench_write_results(result_file, client_ctx, nb_clients);
+    }
+
+    for (int i = 0; i < nb_clients; i++) {
+        sample_bench_client_free(&client_ctx[i]);
+    }
+
+    return ret;
+}
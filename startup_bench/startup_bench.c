@@ -0,0 +1,166 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Startup benchmark. Measures the cost of bringing up a picoquic context,
+ * which is the dominant cost in per-tenant-process and serverless
+ * deployments that create a fresh process per workload:
+ *
+ *   - crypto-init:  one-time provider loading (cipher suite registration,
+ *                   CPU feature probing), shared by every context in the
+ *                   process;
+ *   - first-create: the first picoquic_create after provider loading;
+ *   - warm-create:  steady state create and free of a client context;
+ *   - client-cnx:   first client connection on a fresh context, which
+ *                   builds the deferred certificate verifier and loads
+ *                   the root certificate store;
+ *   - server-eager / server-lazy: with certificate and key files given on
+ *                   the command line, server context creation with PEM
+ *                   parsing at create time versus deferred to the first
+ *                   handshake (picoquic_set_tls_credentials_files).
+ *
+ * Usage: startup_bench [cert_file key_file]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_internal.h"
+#include "tls_api.h"
+
+#define STARTUP_BENCH_WARM_ITERATIONS 100
+
+static picoquic_quic_t* startup_bench_create(char const* cert_file, char const* key_file)
+{
+    return picoquic_create(8, cert_file, key_file, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, picoquic_current_time(), NULL, NULL, NULL, 0);
+}
+
+static void startup_bench_report(char const* phase, uint64_t elapsed, int iterations)
+{
+    printf("%-14s %10.1f us\n", phase, (double)elapsed / (double)iterations);
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    char const* cert_file = (argc > 2) ? argv[1] : NULL;
+    char const* key_file = (argc > 2) ? argv[2] : NULL;
+    picoquic_quic_t* quic = NULL;
+    uint64_t start_time;
+
+    /* One-time provider loading, shared by all contexts in the process */
+    start_time = picoquic_current_time();
+    picoquic_tls_api_init();
+    startup_bench_report("crypto-init", picoquic_current_time() - start_time, 1);
+
+    /* First context creation after provider loading */
+    start_time = picoquic_current_time();
+    quic = startup_bench_create(NULL, NULL);
+    startup_bench_report("first-create", picoquic_current_time() - start_time, 1);
+    if (quic == NULL) {
+        fprintf(stderr, "Cannot create the first quic context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_free(quic);
+    }
+
+    /* Steady state context creation */
+    if (ret == 0) {
+        start_time = picoquic_current_time();
+        for (int i = 0; ret == 0 && i < STARTUP_BENCH_WARM_ITERATIONS; i++) {
+            quic = startup_bench_create(NULL, NULL);
+            if (quic == NULL) {
+                ret = -1;
+            }
+            else {
+                picoquic_free(quic);
+            }
+        }
+        startup_bench_report("warm-create", picoquic_current_time() - start_time,
+            STARTUP_BENCH_WARM_ITERATIONS);
+    }
+
+    /* First client connection, which builds the deferred certificate
+     * verifier and loads the root certificate store */
+    if (ret == 0) {
+        struct sockaddr_storage addr;
+
+        (void)picoquic_store_text_addr(&addr, "10.0.0.1", 443);
+        quic = startup_bench_create(NULL, NULL);
+        if (quic == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_cnx_t* cnx;
+
+            start_time = picoquic_current_time();
+            cnx = picoquic_create_cnx(quic, picoquic_null_connection_id,
+                picoquic_null_connection_id, (struct sockaddr*)&addr, picoquic_current_time(),
+                0, "bench.example.com", "bench", 1);
+            startup_bench_report("client-cnx", picoquic_current_time() - start_time, 1);
+            if (cnx != NULL) {
+                picoquic_delete_cnx(cnx);
+            }
+            picoquic_free(quic);
+        }
+    }
+
+    if (ret == 0 && cert_file != NULL && key_file != NULL) {
+        /* Server context with PEM parsing at create time */
+        start_time = picoquic_current_time();
+        for (int i = 0; ret == 0 && i < STARTUP_BENCH_WARM_ITERATIONS; i++) {
+            quic = startup_bench_create(cert_file, key_file);
+            if (quic == NULL) {
+                ret = -1;
+            }
+            else {
+                picoquic_free(quic);
+            }
+        }
+        startup_bench_report("server-eager", picoquic_current_time() - start_time,
+            STARTUP_BENCH_WARM_ITERATIONS);
+
+        /* Server context with credential loading deferred to the first
+         * handshake */
+        start_time = picoquic_current_time();
+        for (int i = 0; ret == 0 && i < STARTUP_BENCH_WARM_ITERATIONS; i++) {
+            quic = startup_bench_create(NULL, NULL);
+            if (quic == NULL ||
+                picoquic_set_tls_credentials_files(quic, cert_file, key_file) != 0) {
+                ret = -1;
+            }
+            if (quic != NULL) {
+                picoquic_free(quic);
+            }
+        }
+        startup_bench_report("server-lazy", picoquic_current_time() - start_time,
+            STARTUP_BENCH_WARM_ITERATIONS);
+    }
+
+    picoquic_tls_api_unload();
+
+    return ret;
+}